@@ -87,6 +87,9 @@ enum rbh_backend_id {
     RBH_BI_MONGO,
     RBH_BI_LUSTRE,
     RBH_BI_HESTIA,
+    RBH_BI_MEMORY,
+    RBH_BI_LMDB,
+    RBH_BI_COLUMNAR,
 
     /* User defined backends should use an ID so that:
      * RBI_RESERVED_MAX < ID <= 255
@@ -121,9 +124,9 @@ struct rbh_filter_projection {
     unsigned int statx_mask;
     /** xattrs to fill (a map with a count of 0 means every xattr) */
     struct {
-        /** inode xattrs to fill */
-        struct rbh_value_map ns;
         /** namespace xattrs to fill */
+        struct rbh_value_map ns;
+        /** inode xattrs to fill */
         struct rbh_value_map inode;
     } xattrs;
 };
@@ -157,6 +160,32 @@ struct rbh_filter_options {
     } sort;
 };
 
+/**
+ * The format of the documents rbh_backend_export() yields
+ */
+enum rbh_document_format {
+    RBH_DF_JSON,        /* a JSON object (without a trailing newline) */
+    RBH_DF_BSON,        /* a BSON document (which starts with its length) */
+};
+
+/**
+ * A document, as stored by a backend
+ */
+struct rbh_document {
+    const void *data;
+    size_t size;
+};
+
+/**
+ * How a worker releases an item of a work queue it leased
+ *
+ * Refer to rbh_backend_queue_ack() for more information.
+ */
+enum rbh_queue_ack {
+    RBH_QA_DONE,        /* the item was processed, never lease it again */
+    RBH_QA_RETRY,       /* the item could not be processed, lease it again */
+};
+
 /**
  * Operations backends implement
  *
@@ -198,12 +227,50 @@ struct rbh_backend_operations {
             const struct rbh_filter *filter,
             const struct rbh_filter_options *options
             );
+    struct rbh_iterator *(*export_entries)(
+            void *backend,
+            const struct rbh_filter *filter,
+            const struct rbh_filter_options *options,
+            enum rbh_document_format format
+            );
+    char *(*explain)(
+            void *backend,
+            const struct rbh_filter *filter,
+            const struct rbh_filter_options *options
+            );
     int (*get_attribute)(
             void *backend,
             const char *attr_name,
             void *arg,
             struct rbh_value_pair *data
             );
+    int (*sweep)(
+            void *backend,
+            uint64_t generation
+            );
+    ssize_t (*queue_push)(
+            void *backend,
+            const char *queue,
+            const char * const *items,
+            size_t count
+            );
+    char *(*queue_lease)(
+            void *backend,
+            const char *queue,
+            const char *owner,
+            unsigned int duration
+            );
+    int (*queue_ack)(
+            void *backend,
+            const char *queue,
+            const char *item,
+            const char *owner,
+            enum rbh_queue_ack ack
+            );
+    struct rbh_mut_iterator *(*queue_abandoned)(
+            void *backend,
+            const char *queue
+            );
     void (*destroy)(
             void *backend
             );
@@ -248,6 +315,122 @@ enum rbh_generic_backend_option {
      * type: bool
      */
     RBH_GBO_GC,
+    /** Tag the fsentries and namespace entries written to a backend
+     *
+     * When this option is set to a non-zero value (on a backend that supports
+     * it), every fsentry and namespace entry created or updated by subsequent
+     * calls to the `update' operator is tagged with this scan generation.
+     *
+     * Refer to rbh_backend_sweep() for a way to make use of these tags.
+     *
+     * Until it is set, getting this option returns the greatest generation the
+     * fsentries of the backend were tagged with (0 if none), for applications
+     * to pick a greater one.
+     *
+     * type: uint64_t
+     */
+    RBH_GBO_GENERATION,
+    /** Exclude subtrees from the results of subsequent calls to `filter'
+     *
+     * Each subtree is designated by the path of its root, relative to the
+     * backend's root (eg. "/a/b"). Neither this root nor any of its descendants
+     * is returned, and backends that walk a filesystem should not even read
+     * them. Setting this option again replaces the previous set of subtrees.
+     *
+     * type: const char *[] (data_size is the size of the array in bytes)
+     */
+    RBH_GBO_SKIP_SUBTREES,
+    /** Limit how deep subsequent calls to `filter' walk below the root
+     *
+     * Fsentries deeper than this option's value (the root being at depth 0)
+     * are not returned, and backends that walk a filesystem should not even
+     * read them. A negative value (the default) means there is no limit.
+     *
+     * type: int
+     */
+    RBH_GBO_MAX_DEPTH,
+    /** Cap the rate at which subsequent calls to `filter' read entries
+     *
+     * This is meant for backends that walk a live filesystem, to limit the
+     * load they put on it. 0 (the default) means there is no limit.
+     *
+     * type: uint64_t (entries per second)
+     */
+    RBH_GBO_RATE_LIMIT,
+    /** Make the rate limit of a backend adapt to the latency of its source
+     *
+     * When set to a non-zero value, backends measure how long it takes to
+     * fetch the metadata of each entry (open, statx, ...). Whenever this
+     * latency rises above the option's value, the rate at which entries are
+     * read is reduced, it then slowly increases back to RBH_GBO_RATE_LIMIT.
+     *
+     * type: uint64_t (microseconds)
+     */
+    RBH_GBO_LATENCY_TARGET,
+    /** The current state of a backend's throttle (read-only)
+     *
+     * type: struct rbh_throttle_state
+     */
+    RBH_GBO_THROTTLE,
+    /** Fetch the inode data of hardlinked files once per inode
+     *
+     * When set to a non-zero value, backends that walk a filesystem remember
+     * (at most this many of) the files with more than one link they return.
+     * Other names of those files are then returned as fsentries that only
+     * bear an ID, a parent ID, a name and namespace xattrs. 0 (the default)
+     * disables this behaviour.
+     *
+     * type: size_t (number of inodes)
+     */
+    RBH_GBO_HARDLINK_CACHE,
+    /** Exclude the entries that match some rules from subsequent `filter's
+     *
+     * Each rule is one of:
+     *   - "glob:PATTERN": the entries whose path (relative to the backend's
+     *     root) matches the fnmatch(3) PATTERN if it contains a '/', or whose
+     *     name matches it otherwise (eg. "glob:.snapshot");
+     *   - "regex:REGEX": the entries whose path matches the POSIX extended
+     *     regular expression REGEX;
+     *   - "uid:UID": the entries owned by UID.
+     *
+     * Rules that start with none of these prefixes are considered globs.
+     *
+     * Neither excluded entries nor any of their descendants are returned, and
+     * backends that walk a filesystem should not even read them. The root of a
+     * backend is never excluded. Setting this option again replaces the
+     * previous set of rules.
+     *
+     * type: const char *[] (data_size is the size of the array in bytes)
+     */
+    RBH_GBO_EXCLUDE,
+    /** Select the inode xattrs subsequent calls to `filter' fetch
+     *
+     * Each rule is either the name of an xattr (eg. "user.foo"), or a
+     * namespace, that is a prefix that ends with a '.' (eg. "trusted."). Rules
+     * that start with a '!' exclude the xattrs they match, the others include
+     * them: when there is at least one such rule, only the xattrs that match
+     * one are fetched. Exclusions take precedence over inclusions.
+     *
+     * Backends that walk a filesystem should not even read the value of an
+     * xattr that is not selected. The xattrs of the projection of `filter'
+     * (if any) further restrict the ones that are fetched. Setting this option
+     * again replaces the previous set of rules.
+     *
+     * type: const char *[] (data_size is the size of the array in bytes)
+     */
+    RBH_GBO_XATTRS,
+};
+
+/**
+ * The state of a backend's throttle (cf. RBH_GBO_THROTTLE)
+ */
+struct rbh_throttle_state {
+    /** The rate currently enforced, in entries per second (0: unlimited) */
+    uint64_t rate;
+    /** The average latency of the last entries, in microseconds */
+    uint64_t latency;
+    /** How many times the rate was reduced because of a high latency */
+    uint64_t backoffs;
 };
 
 /**
@@ -421,7 +604,7 @@ rbh_backend_update(struct rbh_backend *backend, struct rbh_iterator *fsevents,
  * @param backend   the backend to extract a new backend from
  * @param id        the id of the fsentry to use as the root of the new backend
  * @param path      the path of the fsentry to use as the root of the new
- *                  backend, may be NULL
+ *                  backend, relative to the root of \p backend, may be NULL
  *
  * @return          a pointer to a newly allocated struct rbh_backend on
  *                  success, NULL on error and errno is set appropriately
@@ -497,6 +680,74 @@ rbh_backend_filter(struct rbh_backend *backend, const struct rbh_filter *filter,
     return backend->ops->filter(backend, filter, options);
 }
 
+/**
+ * Return an iterator over the documents that match a set of criteria
+ *
+ * @param backend   the backend from which to fetch documents
+ * @param filter    a set of criteria that the returned documents must match
+ * @param options   a set of filtering options (must not be NULL)
+ * @param format    the format of the returned documents
+ *
+ * @return          an iterator over const struct rbh_document on success,
+ *                  NULL on error and errno is set appropriately
+ *
+ * @error ENOMEM    there was not enough memory available
+ * @error ENOTSUP   \p backend does not support exporting documents (or not in
+ *                  \p format)
+ *
+ * This is rbh_backend_filter(), without the fsentries: documents are the
+ * projected fsentries, in the layout \p backend stores them with, before they
+ * are decoded. It is meant for bulk exports, where decoding fsentries only to
+ * format them again is a waste. A document is only valid until the next call
+ * to the iterator's next method.
+ *
+ * This function may fail and set errno to any error number specifically
+ * documented by \p backend.
+ */
+static inline struct rbh_iterator *
+rbh_backend_export(struct rbh_backend *backend, const struct rbh_filter *filter,
+                   const struct rbh_filter_options *options,
+                   enum rbh_document_format format)
+{
+    if (backend->ops->export_entries == NULL) {
+        errno = ENOTSUP;
+        return NULL;
+    }
+    return backend->ops->export_entries(backend, filter, options, format);
+}
+
+/**
+ * Describe how a backend would run a filter query
+ *
+ * @param backend   the backend to describe the query of
+ * @param filter    a set of criteria that the fsentries must match
+ * @param options   a set of filtering options (must not be NULL)
+ *
+ * @return          a JSON document (to be freed by the caller) on success,
+ *                  NULL on error and errno is set appropriately
+ *
+ * @error ENOMEM    there was not enough memory available
+ * @error ENOTSUP   \p backend cannot explain its queries
+ *
+ * The query is not run, what the document describes is specific to \p backend
+ * (typically, the query it would send to a database, and the plan of the
+ * database).
+ *
+ * This function may fail and set errno to any error number specifically
+ * documented by \p backend.
+ */
+static inline char *
+rbh_backend_explain(struct rbh_backend *backend,
+                    const struct rbh_filter *filter,
+                    const struct rbh_filter_options *options)
+{
+    if (backend->ops->explain == NULL) {
+        errno = ENOTSUP;
+        return NULL;
+    }
+    return backend->ops->explain(backend, filter, options);
+}
+
 /**
  * Retrieve specific attributes from a backend
  *
@@ -519,6 +770,160 @@ rbh_backend_get_attribute(struct rbh_backend *backend, const char *attr_name,
     return backend->ops->get_attribute(backend, attr_name, arg, data);
 }
 
+/**
+ * Remove the fsentries and namespace entries a scan did not see
+ *
+ * @param backend       the backend to clean up
+ * @param generation    the generation of the last complete scan of \p backend
+ *
+ * @return              0 on success, -1 on error and errno is set appropriately
+ *
+ * @error ENOTSUP       \p backend does not support sweeping
+ *
+ * This is meant to be called after a complete scan of \p backend's source was
+ * applied with the RBH_GBO_GENERATION option set to \p generation: every
+ * namespace entry tagged with an older (or no) generation is removed, and so is
+ * every fsentry that is left without any namespace entry as a result.
+ *
+ * If \p backend is a branch, only the namespace entries of the branch are
+ * considered.
+ *
+ * This function may fail and set errno to any error number specifically
+ * documented by \p backend.
+ */
+static inline int
+rbh_backend_sweep(struct rbh_backend *backend, uint64_t generation)
+{
+    if (backend->ops->sweep == NULL) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    return backend->ops->sweep(backend, generation);
+}
+
+/**
+ * Add items to a work queue shared by several processes
+ *
+ * @param backend       the backend that hosts the work queue
+ * @param queue         the name of the work queue
+ * @param items         the items to add to \p queue
+ * @param count         the number of items in \p items
+ *
+ * @return              the number of items that were not already in \p queue
+ *                      on success, -1 on error and errno is set appropriately
+ *
+ * @error ENOTSUP       \p backend does not support work queues
+ *
+ * Items are strings that identify a unit of work. An item that is already in
+ * \p queue (whether it was processed or not) is not added again, which makes
+ * pushing the same items several times harmless.
+ *
+ * This function may fail and set errno to any error number specifically
+ * documented by \p backend.
+ */
+static inline ssize_t
+rbh_backend_queue_push(struct rbh_backend *backend, const char *queue,
+                       const char * const *items, size_t count)
+{
+    if (backend->ops->queue_push == NULL) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    return backend->ops->queue_push(backend, queue, items, count);
+}
+
+/**
+ * Lease an item of a work queue
+ *
+ * @param backend       the backend that hosts the work queue
+ * @param queue         the name of the work queue
+ * @param owner         a string that uniquely identifies the caller
+ * @param duration      the number of seconds the lease lasts
+ *
+ * @return              a newly allocated copy of the leased item on success,
+ *                      NULL on error and errno is set appropriately
+ *
+ * @error EAGAIN        every item left in \p queue is currently leased
+ * @error ENODATA       every item of \p queue was processed
+ * @error ENOTSUP       \p backend does not support work queues
+ *
+ * An item is leased to a single owner at a time. Once the lease expires, the
+ * item may be leased again, to another owner: this is how the failure of a
+ * worker is detected. Backends may give up on items that were leased too many
+ * times, they are then no longer returned.
+ *
+ * This function may fail and set errno to any error number specifically
+ * documented by \p backend.
+ */
+static inline char *
+rbh_backend_queue_lease(struct rbh_backend *backend, const char *queue,
+                        const char *owner, unsigned int duration)
+{
+    if (backend->ops->queue_lease == NULL) {
+        errno = ENOTSUP;
+        return NULL;
+    }
+    return backend->ops->queue_lease(backend, queue, owner, duration);
+}
+
+/**
+ * Release an item of a work queue
+ *
+ * @param backend       the backend that hosts the work queue
+ * @param queue         the name of the work queue
+ * @param item          an item leased with rbh_backend_queue_lease()
+ * @param owner         the owner of the lease on \p item
+ * @param ack           whether \p item was processed or should be retried
+ *
+ * @return              0 on success, -1 on error and errno is set appropriately
+ *
+ * @error ENOTSUP       \p backend does not support work queues
+ * @error ESTALE        the lease of \p owner on \p item expired, and \p item
+ *                      was leased again
+ *
+ * This function may fail and set errno to any error number specifically
+ * documented by \p backend.
+ */
+static inline int
+rbh_backend_queue_ack(struct rbh_backend *backend, const char *queue,
+                      const char *item, const char *owner,
+                      enum rbh_queue_ack ack)
+{
+    if (backend->ops->queue_ack == NULL) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    return backend->ops->queue_ack(backend, queue, item, owner, ack);
+}
+
+/**
+ * List the items of a work queue that were given up on
+ *
+ * @param backend       the backend that hosts the work queue
+ * @param queue         the name of the work queue
+ *
+ * @return              an iterator over newly allocated copies of the items
+ *                      \p backend gave up on (cf. rbh_backend_queue_lease()) on
+ *                      success, NULL on error and errno is set appropriately
+ *
+ * @error ENOTSUP       \p backend does not support work queues
+ *
+ * Once rbh_backend_queue_lease() fails with ENODATA, this is the list of the
+ * items of \p queue that were never processed.
+ *
+ * This function may fail and set errno to any error number specifically
+ * documented by \p backend.
+ */
+static inline struct rbh_mut_iterator *
+rbh_backend_queue_abandoned(struct rbh_backend *backend, const char *queue)
+{
+    if (backend->ops->queue_abandoned == NULL) {
+        errno = ENOTSUP;
+        return NULL;
+    }
+    return backend->ops->queue_abandoned(backend, queue);
+}
+
 /**
  * Free resources associated to a struct rbh_backend
  *
@@ -19,14 +19,74 @@
  */
 
 #include <fts.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "robinhood/backend.h"
+#include "robinhood/hashmap.h"
+#include "robinhood/list.h"
 #include "robinhood/sstack.h"
 
+/*----------------------------------------------------------------------------*
+ |                               posix_throttle                               |
+ *----------------------------------------------------------------------------*/
+
+/* Limits the rate at which a backend's iterators read entries (cf.
+ * RBH_GBO_RATE_LIMIT and RBH_GBO_LATENCY_TARGET). Iterators that run in
+ * parallel share their backend's throttle.
+ */
+struct posix_throttle {
+    pthread_mutex_t lock;
+    /** Whether either of the options below is set */
+    bool enabled;
+    uint64_t rate_limit;
+    uint64_t latency_target;
+
+    /** The rate currently enforced (0 means unlimited) */
+    double rate;
+    /** Entries that may be read right away (negative when some are waiting) */
+    double tokens;
+    struct timespec refilled_at;
+    /** Exponential moving average of the latency (in microseconds) */
+    double latency;
+    struct timespec adjusted_at;
+    uint64_t backoffs;
+};
+
+/*----------------------------------------------------------------------------*
+ |                              posix_hardlinks                               |
+ *----------------------------------------------------------------------------*/
+
+/* Remembers the files with several links an iterator already returned (cf.
+ * RBH_GBO_HARDLINK_CACHE), so that their inode data is only fetched once.
+ */
+struct posix_hardlinks {
+    /** Maps the ID of each file to its struct posix_hardlink */
+    struct rbh_hashmap *map;
+    /** Files in the order they were first seen, to evict the oldest first */
+    struct rbh_list_node fifo;
+    size_t count;
+    size_t capacity;
+};
+
 /*----------------------------------------------------------------------------*
  |                               posix_iterator                               |
  *----------------------------------------------------------------------------*/
 
+/* A rule that excludes entries from a walk (cf. RBH_GBO_EXCLUDE) */
+struct posix_exclude;
+
+/* A rule that selects the inode xattrs to fetch (cf. RBH_GBO_XATTRS) */
+struct posix_xattr_rule {
+    /** The rule, as it was set */
+    char *rule;
+    /** The name of an xattr, or a namespace if it ends with a '.' */
+    const char *name;
+    size_t length;
+    /** Whether the xattrs that match the rule are excluded */
+    bool exclude;
+};
+
 struct posix_iterator {
     struct rbh_mut_iterator iterator;
 
@@ -50,10 +110,38 @@ struct posix_iterator {
                                  struct rbh_sstack *values);
 
     int statx_sync_type;
+    /** How to retrieve the statx metadata of entries (rbh_statx() usually) */
+    int (*get_statx)(int dirfd, const char *pathname, int flags,
+                     unsigned int mask, struct rbh_statx *statxbuf);
     size_t prefix_len;
     FTS *fts_handle;
     FTSENT *ftsent;
     bool skip_error;
+    /** The id of the parent of the root of a branch, if any (owned) */
+    struct rbh_id *branch_parent_id;
+
+    /** Sorted paths of the subtrees not to walk (owned by the backend) */
+    char * const *skip_subtrees;
+    size_t skip_count;
+    /** Rules that exclude entries from the walk (owned by the backend) */
+    const struct posix_exclude *excludes;
+    size_t exclude_count;
+    /** Depth below which not to walk (negative means unlimited) */
+    int max_depth;
+    /** The throttle of the backend, if enabled */
+    struct posix_throttle *throttle;
+    /** How many hardlinked files to remember (0 disables the cache) */
+    size_t hardlink_cache;
+    /** Allocated the first time a file with several links is returned */
+    struct posix_hardlinks *hardlinks;
+    /** Whether to fetch inode xattrs at all (cf. the projection of `filter') */
+    bool inode_xattrs;
+    /** Rules that select the inode xattrs to fetch (owned) */
+    struct posix_xattr_rule *xattr_rules;
+    size_t xattr_rule_count;
+    /** The inode xattrs the projection of `filter' asks for (owned) */
+    struct posix_xattr_rule *projected_xattrs;
+    size_t projected_xattr_count;
 };
 
 struct posix_iterator *
@@ -83,6 +171,13 @@ posix_backend_filter(void *backend, const struct rbh_filter *filter,
 void
 posix_backend_destroy(void *backend);
 
+struct rbh_mut_iterator *
+posix_branch_backend_filter(void *backend, const struct rbh_filter *filter,
+                            const struct rbh_filter_options *options);
+
+void
+posix_branch_backend_destroy(void *backend);
+
 /*----------------------------------------------------------------------------*
  |                               posix_backend                                |
  *----------------------------------------------------------------------------*/
@@ -92,6 +187,16 @@ struct posix_backend {
     struct posix_iterator *(*iter_new)(const char *, const char *, int);
     char *root;
     int statx_sync_type;
+    int (*get_statx)(int, const char *, int, unsigned int, struct rbh_statx *);
+    char **skip_subtrees;
+    size_t skip_count;
+    struct posix_exclude *excludes;
+    size_t exclude_count;
+    int max_depth;
+    struct posix_throttle throttle;
+    size_t hardlink_cache;
+    struct posix_xattr_rule *xattr_rules;
+    size_t xattr_rule_count;
 };
 
 #endif
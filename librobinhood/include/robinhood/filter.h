@@ -453,4 +453,41 @@ rbh_filter_validate(const struct rbh_filter *filter);
 struct rbh_filter *
 rbh_filter_clone(const struct rbh_filter *filter);
 
+/**
+ * Evaluate a filter against an fsentry
+ *
+ * @param filter    the filter to evaluate (must be valid)
+ * @param fsentry   the fsentry to evaluate \p filter against
+ *
+ * @return          true if \p fsentry matches \p filter, false otherwise
+ *
+ * This implements the semantics of the mongo backend: comparisons on a field
+ * \p fsentry does not have never match, integers of any type compare with one
+ * another but never with values of another kind (strings, binaries, ...), and
+ * a sequence matches if it matches as a whole or if any of its elements does.
+ *
+ * Regexes are evaluated as POSIX extended regular expressions.
+ */
+bool
+rbh_filter_matches(const struct rbh_filter *filter,
+                   const struct rbh_fsentry *fsentry);
+
+/**
+ * Compare two fsentries on a field, in the order rbh_backend_filter() sorts
+ *
+ * @param field     the field to compare \p first and \p second on
+ * @param first     the first fsentry to compare
+ * @param second    the second fsentry to compare
+ *
+ * @return          an integer lower than, equal to, or greater than 0 if the
+ *                  value of \p field in \p first is respectively lower than,
+ *                  equal to, or greater than the one in \p second
+ *
+ * Fsentries that do not have \p field sort first.
+ */
+int
+rbh_filter_field_compare(const struct rbh_filter_field *field,
+                         const struct rbh_fsentry *first,
+                         const struct rbh_fsentry *second);
+
 #endif
@@ -0,0 +1,39 @@
+/* This file is part of RobinHood 4
+ * Copyright (C) 2019 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: LGPL-3.0-or-later
+ */
+
+/**
+ * Lustre utility functions that do not require liblustreapi
+ */
+
+#ifndef ROBINHOOD_LUSTRE_UTILS_H
+#define ROBINHOOD_LUSTRE_UTILS_H
+
+#include "robinhood/statx.h"
+
+/**
+ * A drop-in replacement for rbh_statx() that reads the size and blocks of
+ * regular files from their lazy size (LSOM) rather than from their OSTs
+ *
+ * @param dirfd     a file descriptor of the entry, opened with or without
+ *                  O_PATH
+ * @param pathname  must be empty (and \p flags must contain AT_EMPTY_PATH) for
+ *                  the lazy size to be used
+ * @param flags     cf. rbh_statx()
+ * @param mask      cf. rbh_statx()
+ * @param statxbuf  cf. rbh_statx()
+ *
+ * @return          0 on success, -1 on error and errno is set appropriately
+ *
+ * Leaving the size and blocks out of statx()'s mask spares Lustre clients a
+ * glimpse of every OST a file is striped on. Entries without a lazy size, or
+ * with a stale one, fall back on rbh_statx().
+ */
+int
+rbh_lustre_lazy_statx(int dirfd, const char *pathname, int flags,
+                      unsigned int mask, struct rbh_statx *statxbuf);
+
+#endif
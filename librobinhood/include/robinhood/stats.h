@@ -0,0 +1,70 @@
+/* This file is part of RobinHood 4
+ * Copyright (C) 2024 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: LGPL-3.0-or-later
+ */
+
+#ifndef ROBINHOOD_STATS_H
+#define ROBINHOOD_STATS_H
+
+#include <stdio.h>
+
+#include "robinhood/backend.h"
+
+/**
+ * The name to prefix the URI of a backend with to instrument it
+ *
+ * eg. "rbh:stats:mongo:test" is an instrumented "rbh:mongo:test".
+ */
+#define RBH_STATS_BACKEND_NAME "stats"
+
+/**
+ * The environment variable that, if set (and not empty), makes
+ * rbh_backend_from_uri() instrument every backend it creates
+ */
+#define RBH_STATS_ENV "RBH_STATS"
+
+/**
+ * Instrument a backend
+ *
+ * @param backend   the backend to instrument
+ * @param name      a name for the backend in reports (eg. its URI)
+ *
+ * @return          a pointer to a newly allocated backend on success, NULL on
+ *                  error and errno is set appropriately
+ *
+ * @error ENOMEM    there was not enough memory available
+ *
+ * The returned backend forwards every operation to \p backend, and records the
+ * number of calls, the number of errors and a histogram of the latency of the
+ * filter, update, root, branch and get_attribute operations, and of the next
+ * operation of the iterators filter returns. It also records the number of
+ * fsevents each call to update applies.
+ *
+ * It shares the ID and the name of \p backend, and it owns it: destroying the
+ * returned backend destroys \p backend. Branches of the returned backend are
+ * instrumented too, and share its counters.
+ *
+ * A report is written on stderr when the returned backend, its branches and
+ * the iterators they returned are all destroyed. Sending SIGUSR1 to the
+ * process writes a report of every instrumented backend the next time one of
+ * their operations is called (unless the application handles SIGUSR1 itself).
+ */
+struct rbh_backend *
+rbh_stats_backend_new(struct rbh_backend *backend, const char *name);
+
+/**
+ * Write a report of the operations of an instrumented backend
+ *
+ * @param backend   a backend rbh_stats_backend_new() returned
+ * @param file      where to write the report
+ *
+ * @return          0 on success, -1 on error and errno is set appropriately
+ *
+ * @error EINVAL    \p backend is not an instrumented backend
+ */
+int
+rbh_stats_backend_report(struct rbh_backend *backend, FILE *file);
+
+#endif
@@ -32,6 +32,15 @@ rbh_generic_backend_get_option(struct rbh_backend *backend, unsigned int option,
         errno = ENOTSUP;
         return -1;
     case RBH_GBO_GC:
+    case RBH_GBO_GENERATION:
+    case RBH_GBO_SKIP_SUBTREES:
+    case RBH_GBO_MAX_DEPTH:
+    case RBH_GBO_RATE_LIMIT:
+    case RBH_GBO_LATENCY_TARGET:
+    case RBH_GBO_THROTTLE:
+    case RBH_GBO_HARDLINK_CACHE:
+    case RBH_GBO_EXCLUDE:
+    case RBH_GBO_XATTRS:
         if (backend->ops->get_option == NULL) {
             errno = ENOTSUP;
             return -1;
@@ -56,6 +65,15 @@ rbh_generic_backend_set_option(struct rbh_backend *backend, unsigned int option,
         errno = ENOTSUP;
         return -1;
     case RBH_GBO_GC:
+    case RBH_GBO_GENERATION:
+    case RBH_GBO_SKIP_SUBTREES:
+    case RBH_GBO_MAX_DEPTH:
+    case RBH_GBO_RATE_LIMIT:
+    case RBH_GBO_LATENCY_TARGET:
+    case RBH_GBO_THROTTLE:
+    case RBH_GBO_HARDLINK_CACHE:
+    case RBH_GBO_EXCLUDE:
+    case RBH_GBO_XATTRS:
         if (backend->ops->set_option == NULL) {
             errno = ENOTSUP;
             return -1;
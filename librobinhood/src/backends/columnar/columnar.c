@@ -0,0 +1,2702 @@
+/* This file is part of RobinHood 4
+ * Copyright (C) 2024 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: LGPL-3.0-or-later
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "robinhood/backends/columnar.h"
+#include "robinhood/backends/memory.h"
+#include "robinhood/filter.h"
+#include "robinhood/fsentry.h"
+#include "robinhood/fsevent.h"
+#include "robinhood/hashmap.h"
+#include "robinhood/id.h"
+#include "robinhood/iterator.h"
+#include "robinhood/itertools.h"
+#include "robinhood/statx.h"
+#include "robinhood/value.h"
+
+/*----------------------------------------------------------------------------*
+ |                                  snapshot                                  |
+ *----------------------------------------------------------------------------*/
+
+/* A snapshot is a single file, in the host's byte order:
+ *   - a header;
+ *   - the descriptor of every column;
+ *   - the sections of every column, each aligned on COLUMNAR_ALIGNMENT bytes.
+ *
+ * There is one row per namespace entry (ie. per link of an inode), and every
+ * column has a value for every row:
+ *   - the mask column holds the stx_mask of the row (plus COLUMNAR_HAS_STATX);
+ *   - statx columns hold fixed-width values (0 when the mask of the row does
+ *     not have the field), or the code of the value in a sorted dictionary;
+ *   - variable-sized columns hold row_count + 1 offsets into a blob. Strings
+ *     include their terminating '\0' so that an empty value stands for NULL.
+ *
+ * Rows are split in blocks of `block_size' rows. Every statx column has a zone
+ * map: the minimum and maximum key (cf. statx_field2key()), or code, of each
+ * block, computed on the rows that have the field.
+ */
+
+#define COLUMNAR_ALIGNMENT 64
+#define COLUMNAR_DEFAULT_BLOCK_SIZE 4096
+
+/* A bit of stx_mask no RBH_STATX_* field uses */
+#define COLUMNAR_HAS_STATX 0x80000000U
+
+static const char COLUMNAR_MAGIC[8] = "rbhcol01";
+
+struct columnar_header {
+    char magic[8];
+    uint64_t row_count;
+    uint32_t block_size;
+    uint32_t column_count;
+};
+
+enum columnar_kind {
+    CK_MASK,
+    CK_STATX,
+    CK_ATTRIBUTES_MASK,
+    CK_ID,
+    CK_PARENT_ID,
+    CK_NAME,
+    CK_SYMLINK,
+    CK_PATH,
+};
+
+enum columnar_flag {
+    CCF_SIGNED = 1 << 0,        /* values are int64_t */
+    CCF_DICTIONARY = 1 << 1,    /* values are codes into a dictionary */
+};
+
+struct columnar_column {
+    uint32_t kind;
+    uint32_t field;         /* the RBH_STATX_* field of CK_STATX columns */
+    uint32_t width;         /* of a value, 0 for variable-sized columns */
+    uint32_t flags;
+    uint64_t values;        /* offset of the values (or of the offsets) */
+    uint64_t extra;         /* offset of the dictionary (or of the blob) */
+    uint64_t extra_size;    /* entries in the dictionary (or bytes in the blob) */
+    uint64_t zones;         /* offset of the zone maps, 0 if there are none */
+};
+
+struct columnar_zone {
+    uint64_t min;
+    uint64_t max;
+};
+
+/* The statx fields that have a column, and how their values are stored (the
+ * width of dictionary codes depends on the size of the dictionary)
+ */
+static const struct columnar_field {
+    uint32_t field;
+    uint32_t width;
+    uint32_t flags;
+} FIELDS[] = {
+    { RBH_STATX_TYPE, 0, CCF_DICTIONARY },
+    { RBH_STATX_MODE, 2, 0 },
+    { RBH_STATX_NLINK, 4, 0 },
+    { RBH_STATX_UID, 0, CCF_DICTIONARY },
+    { RBH_STATX_GID, 0, CCF_DICTIONARY },
+    { RBH_STATX_ATIME_SEC, 8, CCF_SIGNED },
+    { RBH_STATX_MTIME_SEC, 8, CCF_SIGNED },
+    { RBH_STATX_CTIME_SEC, 8, CCF_SIGNED },
+    { RBH_STATX_INO, 8, 0 },
+    { RBH_STATX_SIZE, 8, 0 },
+    { RBH_STATX_BLOCKS, 8, 0 },
+    { RBH_STATX_BTIME_SEC, 8, CCF_SIGNED },
+    { RBH_STATX_MNT_ID, 8, 0 },
+    { RBH_STATX_BLKSIZE, 4, 0 },
+    { RBH_STATX_ATTRIBUTES, 8, 0 },
+    { RBH_STATX_ATIME_NSEC, 4, 0 },
+    { RBH_STATX_BTIME_NSEC, 4, 0 },
+    { RBH_STATX_CTIME_NSEC, 4, 0 },
+    { RBH_STATX_MTIME_NSEC, 4, 0 },
+    { RBH_STATX_RDEV_MAJOR, 4, 0 },
+    { RBH_STATX_RDEV_MINOR, 4, 0 },
+    { RBH_STATX_DEV_MAJOR, 4, 0 },
+    { RBH_STATX_DEV_MINOR, 4, 0 },
+};
+
+#define FIELD_COUNT (sizeof(FIELDS) / sizeof(*FIELDS))
+
+/* The mask, attributes mask, statx, and variable-sized columns */
+#define COLUMN_COUNT (2 + FIELD_COUNT + 5)
+
+    /*--------------------------------------------------------------------*
+     |                                keys                                |
+     *--------------------------------------------------------------------*/
+
+/* Keys are the values of statx fields as unsigned integers, that sort like the
+ * values: signed fields are offset by 2^63.
+ */
+#define SIGN_BIT (UINT64_C(1) << 63)
+
+static bool
+is_signed_field(uint32_t field)
+{
+    return field & (RBH_STATX_ATIME_SEC | RBH_STATX_BTIME_SEC
+                  | RBH_STATX_CTIME_SEC | RBH_STATX_MTIME_SEC);
+}
+
+static uint64_t
+signed2key(int64_t value)
+{
+    return (uint64_t)value ^ SIGN_BIT;
+}
+
+static uint64_t
+statx_field2key(const struct rbh_statx *statx, uint32_t field)
+{
+    switch (field) {
+    case RBH_STATX_TYPE:
+        return statx->stx_mode & S_IFMT;
+    case RBH_STATX_MODE:
+        return statx->stx_mode & ~S_IFMT;
+    case RBH_STATX_NLINK:
+        return statx->stx_nlink;
+    case RBH_STATX_UID:
+        return statx->stx_uid;
+    case RBH_STATX_GID:
+        return statx->stx_gid;
+    case RBH_STATX_ATIME_SEC:
+        return signed2key(statx->stx_atime.tv_sec);
+    case RBH_STATX_MTIME_SEC:
+        return signed2key(statx->stx_mtime.tv_sec);
+    case RBH_STATX_CTIME_SEC:
+        return signed2key(statx->stx_ctime.tv_sec);
+    case RBH_STATX_INO:
+        return statx->stx_ino;
+    case RBH_STATX_SIZE:
+        return statx->stx_size;
+    case RBH_STATX_BLOCKS:
+        return statx->stx_blocks;
+    case RBH_STATX_BTIME_SEC:
+        return signed2key(statx->stx_btime.tv_sec);
+    case RBH_STATX_MNT_ID:
+        return statx->stx_mnt_id;
+    case RBH_STATX_BLKSIZE:
+        return statx->stx_blksize;
+    case RBH_STATX_ATTRIBUTES:
+        return statx->stx_attributes;
+    case RBH_STATX_ATIME_NSEC:
+        return statx->stx_atime.tv_nsec;
+    case RBH_STATX_BTIME_NSEC:
+        return statx->stx_btime.tv_nsec;
+    case RBH_STATX_CTIME_NSEC:
+        return statx->stx_ctime.tv_nsec;
+    case RBH_STATX_MTIME_NSEC:
+        return statx->stx_mtime.tv_nsec;
+    case RBH_STATX_RDEV_MAJOR:
+        return statx->stx_rdev_major;
+    case RBH_STATX_RDEV_MINOR:
+        return statx->stx_rdev_minor;
+    case RBH_STATX_DEV_MAJOR:
+        return statx->stx_dev_major;
+    case RBH_STATX_DEV_MINOR:
+        return statx->stx_dev_minor;
+    }
+
+    return 0;
+}
+
+static void
+statx_set_key(struct rbh_statx *statx, uint32_t field, uint64_t key)
+{
+    switch (field) {
+    case RBH_STATX_TYPE:
+    case RBH_STATX_MODE:
+        statx->stx_mode |= key;
+        break;
+    case RBH_STATX_NLINK:
+        statx->stx_nlink = key;
+        break;
+    case RBH_STATX_UID:
+        statx->stx_uid = key;
+        break;
+    case RBH_STATX_GID:
+        statx->stx_gid = key;
+        break;
+    case RBH_STATX_ATIME_SEC:
+        statx->stx_atime.tv_sec = key ^ SIGN_BIT;
+        break;
+    case RBH_STATX_MTIME_SEC:
+        statx->stx_mtime.tv_sec = key ^ SIGN_BIT;
+        break;
+    case RBH_STATX_CTIME_SEC:
+        statx->stx_ctime.tv_sec = key ^ SIGN_BIT;
+        break;
+    case RBH_STATX_INO:
+        statx->stx_ino = key;
+        break;
+    case RBH_STATX_SIZE:
+        statx->stx_size = key;
+        break;
+    case RBH_STATX_BLOCKS:
+        statx->stx_blocks = key;
+        break;
+    case RBH_STATX_BTIME_SEC:
+        statx->stx_btime.tv_sec = key ^ SIGN_BIT;
+        break;
+    case RBH_STATX_MNT_ID:
+        statx->stx_mnt_id = key;
+        break;
+    case RBH_STATX_BLKSIZE:
+        statx->stx_blksize = key;
+        break;
+    case RBH_STATX_ATTRIBUTES:
+        statx->stx_attributes = key;
+        break;
+    case RBH_STATX_ATIME_NSEC:
+        statx->stx_atime.tv_nsec = key;
+        break;
+    case RBH_STATX_BTIME_NSEC:
+        statx->stx_btime.tv_nsec = key;
+        break;
+    case RBH_STATX_CTIME_NSEC:
+        statx->stx_ctime.tv_nsec = key;
+        break;
+    case RBH_STATX_MTIME_NSEC:
+        statx->stx_mtime.tv_nsec = key;
+        break;
+    case RBH_STATX_RDEV_MAJOR:
+        statx->stx_rdev_major = key;
+        break;
+    case RBH_STATX_RDEV_MINOR:
+        statx->stx_rdev_minor = key;
+        break;
+    case RBH_STATX_DEV_MAJOR:
+        statx->stx_dev_major = key;
+        break;
+    case RBH_STATX_DEV_MINOR:
+        statx->stx_dev_minor = key;
+        break;
+    }
+}
+
+/* The index of the first element of \p array greater than \p key */
+static size_t
+upper_bound(const uint64_t *array, size_t count, uint64_t key)
+{
+    size_t low = 0;
+
+    while (count > 0) {
+        size_t half = count / 2;
+
+        if (array[low + half] <= key) {
+            low += half + 1;
+            count -= half + 1;
+        } else {
+            count = half;
+        }
+    }
+    return low;
+}
+
+/* The index of the first element of \p array greater than or equal to \p key */
+static size_t
+lower_bound(const uint64_t *array, size_t count, uint64_t key)
+{
+    return key == 0 ? 0 : upper_bound(array, count, key - 1);
+}
+
+    /*--------------------------------------------------------------------*
+     |                                map                                 |
+     *--------------------------------------------------------------------*/
+
+/* A column of a mapped snapshot */
+struct columnar_map {
+    const struct columnar_column *column;   /* NULL if there is none */
+    const void *values;
+    const uint64_t *dictionary;
+    const char *blob;
+    const struct columnar_zone *zones;
+};
+
+struct columnar_snapshot {
+    unsigned int refcount;
+    void *data;
+    size_t size;
+
+    size_t row_count;
+    size_t block_size;
+    size_t block_count;
+
+    const uint32_t *mask;
+    struct columnar_map attributes_mask;
+    struct columnar_map statx[32];          /* indexed by ctz(field) */
+    struct columnar_map id;
+    struct columnar_map parent_id;
+    struct columnar_map name;
+    struct columnar_map symlink;
+    struct columnar_map path;
+};
+
+static uint64_t
+load_value(const struct columnar_map *map, size_t row)
+{
+    switch (map->column->width) {
+    case 1:
+        return ((const uint8_t *)map->values)[row];
+    case 2:
+        return ((const uint16_t *)map->values)[row];
+    case 4:
+        return ((const uint32_t *)map->values)[row];
+    default:
+        return ((const uint64_t *)map->values)[row];
+    }
+}
+
+/* The key of the value of a statx column at \p row */
+static uint64_t
+load_key(const struct columnar_map *map, size_t row)
+{
+    uint64_t value = load_value(map, row);
+
+    if (map->column->flags & CCF_DICTIONARY)
+        return value < map->column->extra_size ? map->dictionary[value] : 0;
+    if (map->column->flags & CCF_SIGNED)
+        return value ^ SIGN_BIT;
+    return value;
+}
+
+/* The value of a variable-sized column at \p row */
+static const char *
+load_bytes(const struct columnar_map *map, size_t row, size_t *size)
+{
+    const uint64_t *offsets = map->values;
+
+    *size = offsets[row + 1] - offsets[row];
+    return map->blob + offsets[row];
+}
+
+static const char *
+load_string(const struct columnar_map *map, size_t row)
+{
+    const char *string;
+    size_t size;
+
+    if (map->column == NULL)
+        return NULL;
+
+    string = load_bytes(map, row, &size);
+    return size == 0 ? NULL : string;
+}
+
+static bool
+section_fits(const struct columnar_snapshot *snapshot, uint64_t offset,
+             uint64_t count, uint64_t size)
+{
+    return offset % COLUMNAR_ALIGNMENT == 0 && offset <= snapshot->size
+        && (size == 0 || count <= (snapshot->size - offset) / size);
+}
+
+static bool
+is_string_column(enum columnar_kind kind)
+{
+    return kind == CK_NAME || kind == CK_SYMLINK || kind == CK_PATH;
+}
+
+/* Check that a variable-sized column only points inside its blob */
+static bool
+check_offsets(const struct columnar_snapshot *snapshot,
+              const struct columnar_map *map)
+{
+    const uint64_t *offsets = map->values;
+
+    if (offsets[0] != 0 || offsets[snapshot->row_count]
+                           != map->column->extra_size)
+        return false;
+
+    for (size_t i = 0; i < snapshot->row_count; i++) {
+        if (offsets[i + 1] < offsets[i])
+            return false;
+
+        if (is_string_column(map->column->kind) && offsets[i + 1] > offsets[i]
+         && map->blob[offsets[i + 1] - 1] != '\0')
+            return false;
+    }
+    return true;
+}
+
+static bool
+map_column(struct columnar_snapshot *snapshot,
+           const struct columnar_column *column)
+{
+    struct columnar_map *map;
+
+    switch (column->kind) {
+    case CK_MASK:
+        if (column->width != sizeof(*snapshot->mask)
+         || !section_fits(snapshot, column->values, snapshot->row_count,
+                          column->width))
+            return false;
+        snapshot->mask = (const uint32_t *)
+            ((const char *)snapshot->data + column->values);
+        return true;
+    case CK_STATX:
+        if (__builtin_popcount(column->field) != 1)
+            return false;
+        map = &snapshot->statx[__builtin_ctz(column->field)];
+        break;
+    case CK_ATTRIBUTES_MASK:
+        map = &snapshot->attributes_mask;
+        break;
+    case CK_ID:
+        map = &snapshot->id;
+        break;
+    case CK_PARENT_ID:
+        map = &snapshot->parent_id;
+        break;
+    case CK_NAME:
+        map = &snapshot->name;
+        break;
+    case CK_SYMLINK:
+        map = &snapshot->symlink;
+        break;
+    case CK_PATH:
+        map = &snapshot->path;
+        break;
+    default:
+        /* Ignore the columns of later versions */
+        return true;
+    }
+
+    map->column = column;
+    map->values = (const char *)snapshot->data + column->values;
+
+    if (column->width == 0) {
+        if (column->kind == CK_STATX || column->kind == CK_ATTRIBUTES_MASK
+         || !section_fits(snapshot, column->values, snapshot->row_count + 1,
+                          sizeof(uint64_t))
+         || !section_fits(snapshot, column->extra, column->extra_size, 1))
+            return false;
+
+        map->blob = (const char *)snapshot->data + column->extra;
+        return check_offsets(snapshot, map);
+    }
+
+    switch (column->width) {
+    case 1:
+    case 2:
+    case 4:
+    case 8:
+        break;
+    default:
+        return false;
+    }
+
+    if (!section_fits(snapshot, column->values, snapshot->row_count,
+                      column->width))
+        return false;
+
+    if (column->flags & CCF_DICTIONARY) {
+        if (!section_fits(snapshot, column->extra, column->extra_size,
+                          sizeof(uint64_t)))
+            return false;
+        map->dictionary = (const uint64_t *)
+            ((const char *)snapshot->data + column->extra);
+    }
+
+    if (column->zones) {
+        if (!section_fits(snapshot, column->zones, snapshot->block_count,
+                          sizeof(struct columnar_zone)))
+            return false;
+        map->zones = (const struct columnar_zone *)
+            ((const char *)snapshot->data + column->zones);
+    }
+
+    return true;
+}
+
+static void
+snapshot_release(struct columnar_snapshot *snapshot)
+{
+    if (snapshot == NULL || --snapshot->refcount > 0)
+        return;
+
+    munmap(snapshot->data, snapshot->size);
+    free(snapshot);
+}
+
+/* Map the snapshot at \p path
+ *
+ * @return          a pointer to the snapshot, NULL if there is none (errno is
+ *                  set to ENOENT) or on error
+ */
+static struct columnar_snapshot *
+snapshot_open(const char *path)
+{
+    const struct columnar_column *columns;
+    const struct columnar_header *header;
+    struct columnar_snapshot *snapshot;
+    struct stat st;
+    int save_errno;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &st))
+        goto out_close;
+
+    if ((size_t)st.st_size < sizeof(*header)) {
+        errno = EINVAL;
+        goto out_close;
+    }
+
+    snapshot = calloc(1, sizeof(*snapshot));
+    if (snapshot == NULL)
+        goto out_close;
+
+    snapshot->refcount = 1;
+    snapshot->size = st.st_size;
+    snapshot->data = mmap(NULL, snapshot->size, PROT_READ, MAP_SHARED, fd, 0);
+    if (snapshot->data == MAP_FAILED) {
+        save_errno = errno;
+        free(snapshot);
+        errno = save_errno;
+        goto out_close;
+    }
+    close(fd);
+
+    header = snapshot->data;
+    if (memcmp(header->magic, COLUMNAR_MAGIC, sizeof(COLUMNAR_MAGIC))
+     || header->block_size == 0 || header->row_count >= SIZE_MAX / 8
+     || header->column_count > (snapshot->size - sizeof(*header))
+                               / sizeof(*columns))
+        goto out_invalid;
+
+    snapshot->row_count = header->row_count;
+    snapshot->block_size = header->block_size;
+    snapshot->block_count = (snapshot->row_count + snapshot->block_size - 1)
+                          / snapshot->block_size;
+
+    columns = (const struct columnar_column *)(header + 1);
+    for (size_t i = 0; i < header->column_count; i++) {
+        if (!map_column(snapshot, &columns[i]))
+            goto out_invalid;
+    }
+
+    if (snapshot->mask == NULL || snapshot->id.column == NULL
+     || snapshot->id.column->width != 0
+     || snapshot->parent_id.column == NULL
+     || snapshot->parent_id.column->width != 0)
+        goto out_invalid;
+
+    return snapshot;
+
+out_invalid:
+    snapshot_release(snapshot);
+    errno = EINVAL;
+    return NULL;
+
+out_close:
+    save_errno = errno;
+    close(fd);
+    errno = save_errno;
+    return NULL;
+}
+
+    /*--------------------------------------------------------------------*
+     |                               export                               |
+     *--------------------------------------------------------------------*/
+
+/* Snapshots are written in two passes over a catalog: the first one sizes the
+ * columns and builds the dictionaries, the second one fills the columns of the
+ * mapped file.
+ */
+
+struct dictionary {
+    uint64_t *keys;
+    size_t count;
+    size_t size;
+};
+
+static int
+dictionary_add(struct dictionary *dictionary, uint64_t key)
+{
+    size_t index = lower_bound(dictionary->keys, dictionary->count, key);
+
+    if (index < dictionary->count && dictionary->keys[index] == key)
+        return 0;
+
+    if (dictionary->count == dictionary->size) {
+        size_t new_size = dictionary->size ? 2 * dictionary->size : 16;
+        uint64_t *keys;
+
+        keys = reallocarray(dictionary->keys, new_size, sizeof(*keys));
+        if (keys == NULL)
+            return -1;
+
+        dictionary->keys = keys;
+        dictionary->size = new_size;
+    }
+
+    memmove(&dictionary->keys[index + 1], &dictionary->keys[index],
+            (dictionary->count - index) * sizeof(*dictionary->keys));
+    dictionary->keys[index] = key;
+    dictionary->count++;
+    return 0;
+}
+
+static uint32_t
+dictionary_width(const struct dictionary *dictionary)
+{
+    if (dictionary->count <= UINT8_MAX + 1)
+        return 1;
+    if (dictionary->count <= UINT16_MAX + 1)
+        return 2;
+    return 4;
+}
+
+struct export {
+    struct columnar_column columns[COLUMN_COUNT];
+    struct dictionary dictionaries[FIELD_COUNT];
+    uint64_t row_count;
+    uint32_t block_size;
+    char *data;
+    size_t size;
+};
+
+/* The index in `columns' of the first variable-sized column */
+#define VARIABLE_COLUMNS (2 + FIELD_COUNT)
+
+static const enum columnar_kind VARIABLE_KINDS[] = {
+    CK_ID, CK_PARENT_ID, CK_NAME, CK_SYMLINK, CK_PATH,
+};
+
+static const char *
+fsentry_path(const struct rbh_fsentry *fsentry)
+{
+    if (!(fsentry->mask & RBH_FP_NAMESPACE_XATTRS))
+        return NULL;
+
+    for (size_t i = 0; i < fsentry->xattrs.ns.count; i++) {
+        const struct rbh_value_pair *pair = &fsentry->xattrs.ns.pairs[i];
+
+        if (strcmp(pair->key, "path") == 0 && pair->value
+         && pair->value->type == RBH_VT_STRING)
+            return pair->value->string;
+    }
+    return NULL;
+}
+
+/* The value of a variable-sized column of \p fsentry */
+static const void *
+fsentry_bytes(const struct rbh_fsentry *fsentry, enum columnar_kind kind,
+              size_t *size)
+{
+    const char *string = NULL;
+
+    switch (kind) {
+    case CK_ID:
+        *size = fsentry->id.size;
+        return fsentry->id.data;
+    case CK_PARENT_ID:
+        *size = fsentry->parent_id.size;
+        return fsentry->parent_id.data;
+    case CK_NAME:
+        string = fsentry->mask & RBH_FP_NAME ? fsentry->name : NULL;
+        break;
+    case CK_SYMLINK:
+        string = fsentry->mask & RBH_FP_SYMLINK ? fsentry->symlink : NULL;
+        break;
+    case CK_PATH:
+        string = fsentry_path(fsentry);
+        break;
+    default:
+        break;
+    }
+
+    *size = string ? strlen(string) + 1 : 0;
+    return string;
+}
+
+static const struct rbh_statx *
+fsentry_statx(const struct rbh_fsentry *fsentry)
+{
+    return fsentry->mask & RBH_FP_STATX ? fsentry->statx : NULL;
+}
+
+static int
+export_size(struct export *export, const struct rbh_fsentry *fsentry)
+{
+    const struct rbh_statx *statx = fsentry_statx(fsentry);
+
+    export->row_count++;
+
+    for (size_t i = 0; i < sizeof(VARIABLE_KINDS) / sizeof(*VARIABLE_KINDS);
+         i++) {
+        size_t size;
+
+        fsentry_bytes(fsentry, VARIABLE_KINDS[i], &size);
+        export->columns[VARIABLE_COLUMNS + i].extra_size += size;
+    }
+
+    if (statx == NULL)
+        return 0;
+
+    for (size_t i = 0; i < FIELD_COUNT; i++) {
+        uint32_t field = FIELDS[i].field;
+
+        if (FIELDS[i].flags & CCF_DICTIONARY && statx->stx_mask & field
+         && dictionary_add(&export->dictionaries[i],
+                           statx_field2key(statx, field)))
+            return -1;
+    }
+    return 0;
+}
+
+static uint64_t
+section(uint64_t *offset, uint64_t size)
+{
+    uint64_t start = (*offset + COLUMNAR_ALIGNMENT - 1)
+                   & ~(uint64_t)(COLUMNAR_ALIGNMENT - 1);
+
+    *offset = start + size;
+    return start;
+}
+
+/* Describe every column, and the size of the snapshot */
+static void
+export_layout(struct export *export)
+{
+    uint64_t rows = export->row_count;
+    uint64_t blocks = (rows + export->block_size - 1) / export->block_size;
+    struct columnar_column *column = export->columns;
+    uint64_t offset;
+
+    offset = sizeof(struct columnar_header) + sizeof(export->columns);
+
+    *column = (struct columnar_column){
+        .kind = CK_MASK,
+        .width = sizeof(uint32_t),
+    };
+    column->values = section(&offset, rows * column->width);
+    column++;
+
+    *column = (struct columnar_column){
+        .kind = CK_ATTRIBUTES_MASK,
+        .width = sizeof(uint64_t),
+    };
+    column->values = section(&offset, rows * column->width);
+    column++;
+
+    for (size_t i = 0; i < FIELD_COUNT; i++, column++) {
+        const struct dictionary *dictionary = &export->dictionaries[i];
+
+        *column = (struct columnar_column){
+            .kind = CK_STATX,
+            .field = FIELDS[i].field,
+            .width = FIELDS[i].width,
+            .flags = FIELDS[i].flags,
+        };
+
+        if (column->flags & CCF_DICTIONARY) {
+            column->width = dictionary_width(dictionary);
+            column->extra_size = dictionary->count;
+            column->extra = section(&offset,
+                                    dictionary->count * sizeof(uint64_t));
+        }
+        column->values = section(&offset, rows * column->width);
+        column->zones = section(&offset,
+                                blocks * sizeof(struct columnar_zone));
+    }
+
+    for (size_t i = 0; i < sizeof(VARIABLE_KINDS) / sizeof(*VARIABLE_KINDS);
+         i++, column++) {
+        /* The size of the blob was computed by export_size() */
+        column->kind = VARIABLE_KINDS[i];
+        column->values = section(&offset, (rows + 1) * sizeof(uint64_t));
+        column->extra = section(&offset, column->extra_size);
+    }
+
+    export->size = offset;
+}
+
+static void *
+export_at(struct export *export, uint64_t offset)
+{
+    return export->data + offset;
+}
+
+static void
+store_value(void *values, uint32_t width, size_t row, uint64_t value)
+{
+    switch (width) {
+    case 1:
+        ((uint8_t *)values)[row] = value;
+        break;
+    case 2:
+        ((uint16_t *)values)[row] = value;
+        break;
+    case 4:
+        ((uint32_t *)values)[row] = value;
+        break;
+    default:
+        ((uint64_t *)values)[row] = value;
+        break;
+    }
+}
+
+static void
+export_row(struct export *export, const struct rbh_fsentry *fsentry,
+           size_t row, uint64_t *blob_offsets)
+{
+    const struct rbh_statx *statx = fsentry_statx(fsentry);
+    struct columnar_column *columns = export->columns;
+    uint32_t mask = 0;
+
+    if (statx)
+        mask = (statx->stx_mask & RBH_STATX_ALL) | COLUMNAR_HAS_STATX;
+
+    store_value(export_at(export, columns[0].values), sizeof(mask), row, mask);
+    store_value(export_at(export, columns[1].values), sizeof(uint64_t), row,
+                statx ? statx->stx_attributes_mask : 0);
+
+    for (size_t i = 0; i < FIELD_COUNT; i++) {
+        struct columnar_column *column = &columns[2 + i];
+        struct columnar_zone *zone;
+        uint64_t value = 0;
+        uint64_t key;
+
+        if (mask & column->field) {
+            key = statx_field2key(statx, column->field);
+            if (column->flags & CCF_DICTIONARY) {
+                value = lower_bound(export_at(export, column->extra),
+                                    column->extra_size, key);
+                key = value;
+            } else {
+                value = column->flags & CCF_SIGNED ? key ^ SIGN_BIT : key;
+            }
+
+            zone = export_at(export, column->zones);
+            zone += row / export->block_size;
+            if (key < zone->min)
+                zone->min = key;
+            if (key > zone->max)
+                zone->max = key;
+        }
+
+        store_value(export_at(export, column->values), column->width, row,
+                    value);
+    }
+
+    for (size_t i = 0; i < sizeof(VARIABLE_KINDS) / sizeof(*VARIABLE_KINDS);
+         i++) {
+        struct columnar_column *column = &columns[VARIABLE_COLUMNS + i];
+        uint64_t *offsets = export_at(export, column->values);
+        const void *bytes;
+        size_t size;
+
+        bytes = fsentry_bytes(fsentry, column->kind, &size);
+        if (size > 0)
+            memcpy(export_at(export, column->extra + blob_offsets[i]), bytes,
+                   size);
+        blob_offsets[i] += size;
+        offsets[row + 1] = blob_offsets[i];
+    }
+}
+
+/* Initialize the dictionaries and zone maps of the mapped snapshot */
+static void
+export_init(struct export *export)
+{
+    uint64_t blocks = (export->row_count + export->block_size - 1)
+                    / export->block_size;
+    struct columnar_header *header = export_at(export, 0);
+
+    memcpy(header->magic, COLUMNAR_MAGIC, sizeof(COLUMNAR_MAGIC));
+    header->row_count = export->row_count;
+    header->block_size = export->block_size;
+    header->column_count = COLUMN_COUNT;
+    memcpy(header + 1, export->columns, sizeof(export->columns));
+
+    for (size_t i = 0; i < FIELD_COUNT; i++) {
+        struct columnar_column *column = &export->columns[2 + i];
+        struct columnar_zone *zones = export_at(export, column->zones);
+
+        if (column->extra_size > 0)
+            memcpy(export_at(export, column->extra),
+                   export->dictionaries[i].keys,
+                   column->extra_size * sizeof(uint64_t));
+
+        for (size_t j = 0; j < blocks; j++)
+            zones[j] = (struct columnar_zone){ .min = UINT64_MAX, .max = 0 };
+    }
+}
+
+static const struct rbh_filter_options EXPORT_OPTIONS = {
+    .projection = {
+        .fsentry_mask = RBH_FP_ALL,
+        .statx_mask = RBH_STATX_ALL,
+    },
+};
+
+/* Run \p pass on every fsentry of \p catalog */
+static int
+export_pass(struct rbh_backend *catalog, struct export *export,
+            int (*pass)(struct export *export,
+                        const struct rbh_fsentry *fsentry, void *arg),
+            void *arg)
+{
+    struct rbh_mut_iterator *fsentries;
+    struct rbh_fsentry *fsentry;
+    int save_errno;
+    int rc = 0;
+
+    fsentries = rbh_backend_filter(catalog, NULL, &EXPORT_OPTIONS);
+    if (fsentries == NULL)
+        return -1;
+
+    while (rc == 0 && (fsentry = rbh_mut_iter_next(fsentries)) != NULL) {
+        rc = pass(export, fsentry, arg);
+        free(fsentry);
+    }
+
+    save_errno = errno;
+    rbh_mut_iter_destroy(fsentries);
+    if (rc == 0 && save_errno != ENODATA)
+        rc = -1;
+    errno = save_errno;
+    return rc;
+}
+
+static int
+size_pass(struct export *export, const struct rbh_fsentry *fsentry,
+          void *arg)
+{
+    (void)arg;
+    return export_size(export, fsentry);
+}
+
+struct fill_state {
+    size_t row;
+    uint64_t blob_offsets[sizeof(VARIABLE_KINDS) / sizeof(*VARIABLE_KINDS)];
+};
+
+static int
+fill_pass(struct export *export, const struct rbh_fsentry *fsentry, void *arg)
+{
+    struct fill_state *state = arg;
+
+    /* The catalog did not change in between passes */
+    if (state->row >= export->row_count) {
+        errno = EIO;
+        return -1;
+    }
+
+    export_row(export, fsentry, state->row++, state->blob_offsets);
+    return 0;
+}
+
+/* Write every fsentry of \p catalog to \p path (atomically) */
+static int
+snapshot_write(const char *path, struct rbh_backend *catalog,
+               uint32_t block_size)
+{
+    struct fill_state state = {};
+    struct export export = {
+        .block_size = block_size,
+    };
+    int save_errno;
+    char *tmp;
+    int rc = -1;
+    int fd;
+
+    if (export_pass(catalog, &export, size_pass, NULL))
+        goto out_free_dictionaries;
+
+    export_layout(&export);
+
+    if (asprintf(&tmp, "%s.tmp", path) < 0)
+        goto out_free_dictionaries;
+
+    fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        goto out_free_tmp;
+
+    if (ftruncate(fd, export.size))
+        goto out_close;
+
+    export.data = mmap(NULL, export.size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       fd, 0);
+    if (export.data == MAP_FAILED)
+        goto out_close;
+
+    export_init(&export);
+    rc = export_pass(catalog, &export, fill_pass, &state);
+    if (rc == 0 && state.row != export.row_count) {
+        errno = EIO;
+        rc = -1;
+    }
+
+    save_errno = errno;
+    munmap(export.data, export.size);
+    errno = save_errno;
+    if (rc)
+        goto out_close;
+
+    rc = close(fd);
+    fd = -1;
+    if (rc == 0)
+        rc = rename(tmp, path);
+
+out_close:
+    save_errno = errno;
+    if (fd >= 0)
+        close(fd);
+    if (rc)
+        unlink(tmp);
+    errno = save_errno;
+out_free_tmp:
+    save_errno = errno;
+    free(tmp);
+    errno = save_errno;
+out_free_dictionaries:
+    save_errno = errno;
+    for (size_t i = 0; i < FIELD_COUNT; i++)
+        free(export.dictionaries[i].keys);
+    errno = save_errno;
+    return rc;
+}
+
+/*----------------------------------------------------------------------------*
+ |                                  fsentry                                   |
+ *----------------------------------------------------------------------------*/
+
+/* A struct rbh_fsentry that points into the columns of a row (plus a copy of
+ * its statx, and of its symlink), which filters are evaluated on
+ */
+struct columnar_view {
+    struct rbh_fsentry *fsentry;
+    size_t size;
+    struct rbh_statx statx;
+    struct rbh_value path;
+    struct rbh_value_pair pair;
+};
+
+static void
+row_statx(const struct columnar_snapshot *snapshot, size_t row,
+          struct rbh_statx *statx)
+{
+    uint32_t mask = snapshot->mask[row];
+
+    memset(statx, 0, sizeof(*statx));
+    statx->stx_mask = mask & ~COLUMNAR_HAS_STATX;
+
+    for (size_t i = 0; i < FIELD_COUNT; i++) {
+        uint32_t field = FIELDS[i].field;
+        const struct columnar_map *map;
+
+        map = &snapshot->statx[__builtin_ctz(field)];
+        if (!(mask & field))
+            continue;
+
+        if (map->column == NULL) {
+            /* The snapshot does not have this column */
+            statx->stx_mask &= ~field;
+            continue;
+        }
+        statx_set_key(statx, field, load_key(map, row));
+    }
+
+    if (snapshot->attributes_mask.column)
+        statx->stx_attributes_mask = load_value(&snapshot->attributes_mask,
+                                                row);
+}
+
+static const struct rbh_fsentry *
+view_fill(struct columnar_view *view,
+          const struct columnar_snapshot *snapshot, size_t row)
+{
+    size_t size = sizeof(*view->fsentry);
+    struct rbh_fsentry *fsentry;
+    const char *symlink;
+    const char *path;
+    size_t id_size;
+
+    symlink = load_string(&snapshot->symlink, row);
+    if (symlink)
+        size += strlen(symlink) + 1;
+
+    if (size > view->size) {
+        fsentry = realloc(view->fsentry, size);
+        if (fsentry == NULL)
+            return NULL;
+
+        view->fsentry = fsentry;
+        view->size = size;
+    }
+
+    fsentry = view->fsentry;
+    fsentry->mask = RBH_FP_ID | RBH_FP_PARENT_ID | RBH_FP_NAMESPACE_XATTRS
+                  | RBH_FP_INODE_XATTRS;
+
+    fsentry->id.data = load_bytes(&snapshot->id, row, &id_size);
+    fsentry->id.size = id_size;
+    fsentry->parent_id.data = load_bytes(&snapshot->parent_id, row, &id_size);
+    fsentry->parent_id.size = id_size;
+
+    fsentry->name = load_string(&snapshot->name, row);
+    if (fsentry->name)
+        fsentry->mask |= RBH_FP_NAME;
+
+    fsentry->statx = NULL;
+    if (snapshot->mask[row] & COLUMNAR_HAS_STATX) {
+        row_statx(snapshot, row, &view->statx);
+        fsentry->statx = &view->statx;
+        fsentry->mask |= RBH_FP_STATX;
+    }
+
+    fsentry->xattrs.ns = (struct rbh_value_map){};
+    fsentry->xattrs.inode = (struct rbh_value_map){};
+    path = load_string(&snapshot->path, row);
+    if (path) {
+        view->path = (struct rbh_value){
+            .type = RBH_VT_STRING,
+            .string = path,
+        };
+        view->pair = (struct rbh_value_pair){
+            .key = "path",
+            .value = &view->path,
+        };
+        fsentry->xattrs.ns.pairs = &view->pair;
+        fsentry->xattrs.ns.count = 1;
+    }
+
+    if (symlink) {
+        strcpy(fsentry->symlink, symlink);
+        fsentry->mask |= RBH_FP_SYMLINK;
+    }
+
+    return fsentry;
+}
+
+/* Keep the xattrs of \p xattrs whose key is in \p keys (every one of them if
+ * \p keys is NULL or empty)
+ */
+static struct rbh_value_map
+xattrs_project(const struct rbh_value_map *xattrs, const struct rbh_value *keys,
+               struct rbh_value_pair *pairs)
+{
+    struct rbh_value_map map = {};
+
+    if (keys == NULL || keys->map.count == 0)
+        return *xattrs;
+
+    map.pairs = pairs;
+    for (size_t i = 0; i < xattrs->count; i++) {
+        for (size_t j = 0; j < keys->map.count; j++) {
+            if (strcmp(xattrs->pairs[i].key, keys->map.pairs[j].key))
+                continue;
+
+            pairs[map.count++] = xattrs->pairs[i];
+            break;
+        }
+    }
+    return map;
+}
+
+struct columnar_projection {
+    unsigned int fsentry_mask;
+    unsigned int statx_mask;
+    struct rbh_value *ns;           /* the keys of ns xattrs to keep */
+    struct rbh_value *inode;        /* the keys of inode xattrs to keep */
+};
+
+static const struct columnar_projection PROJECT_ALL = {
+    .fsentry_mask = RBH_FP_ALL,
+    .statx_mask = UINT32_MAX,
+};
+
+static int
+projection_init(struct columnar_projection *dest,
+                const struct rbh_filter_projection *src)
+{
+    dest->fsentry_mask = src->fsentry_mask;
+    dest->statx_mask = src->statx_mask;
+
+    dest->ns = rbh_value_map_new(src->xattrs.ns.pairs, src->xattrs.ns.count);
+    if (dest->ns == NULL)
+        return -1;
+
+    dest->inode = rbh_value_map_new(src->xattrs.inode.pairs,
+                                    src->xattrs.inode.count);
+    if (dest->inode == NULL) {
+        int save_errno = errno;
+
+        free(dest->ns);
+        errno = save_errno;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+projection_fini(struct columnar_projection *projection)
+{
+    free(projection->inode);
+    free(projection->ns);
+}
+
+static struct rbh_fsentry *
+fsentry_project(const struct rbh_fsentry *fsentry,
+                const struct columnar_projection *projection)
+{
+    unsigned int mask = projection->fsentry_mask & fsentry->mask;
+    struct rbh_value_map ns_xattrs, xattrs;
+    struct rbh_value_pair *pairs;
+    struct rbh_fsentry *projected;
+    struct rbh_statx statx;
+    size_t count;
+
+    count = fsentry->xattrs.ns.count + fsentry->xattrs.inode.count;
+    pairs = reallocarray(NULL, count ? count : 1, sizeof(*pairs));
+    if (pairs == NULL)
+        return NULL;
+
+    ns_xattrs = xattrs_project(&fsentry->xattrs.ns, projection->ns, pairs);
+    xattrs = xattrs_project(&fsentry->xattrs.inode, projection->inode,
+                            pairs + ns_xattrs.count);
+
+    if (mask & RBH_FP_STATX) {
+        statx = *fsentry->statx;
+        statx.stx_mask &= projection->statx_mask;
+    }
+
+    projected = rbh_fsentry_new(
+            mask & RBH_FP_ID ? &fsentry->id : NULL,
+            mask & RBH_FP_PARENT_ID ? &fsentry->parent_id : NULL,
+            mask & RBH_FP_NAME ? fsentry->name : NULL,
+            mask & RBH_FP_STATX ? &statx : NULL,
+            mask & RBH_FP_NAMESPACE_XATTRS ? &ns_xattrs : NULL,
+            mask & RBH_FP_INODE_XATTRS ? &xattrs : NULL,
+            mask & RBH_FP_SYMLINK ? fsentry->symlink : NULL
+            );
+    free(pairs);
+    return projected;
+}
+
+/*----------------------------------------------------------------------------*
+ |                                   filter                                   |
+ *----------------------------------------------------------------------------*/
+
+/* Filters are evaluated a block of rows at a time, into selections: arrays of
+ * one byte per row, set to 1 if the row matches and 0 otherwise.
+ *
+ * Every evaluation is restricted to a selection of candidates: rows that are
+ * not candidates never match, whatever the filter. This lets conjunctions only
+ * evaluate the costliest comparisons on the rows that cheaper ones selected.
+ */
+
+struct columnar_block {
+    const struct columnar_snapshot *snapshot;
+    size_t index;
+    size_t start;
+    size_t count;
+    struct columnar_view *view;     /* to evaluate comparisons on */
+};
+
+/* The number of nested logical operators in \p filter */
+static size_t
+filter_depth(const struct rbh_filter *filter)
+{
+    size_t depth = 0;
+
+    if (filter == NULL || rbh_is_comparison_operator(filter->op))
+        return 0;
+
+    for (size_t i = 0; i < filter->logical.count; i++) {
+        size_t child = filter_depth(filter->logical.filters[i]);
+
+        if (child > depth)
+            depth = child;
+    }
+    return depth + 1;
+}
+
+static bool
+is_range_comparison(const struct rbh_filter *filter)
+{
+    switch (filter->op) {
+    case RBH_FOP_EQUAL:
+    case RBH_FOP_STRICTLY_LOWER:
+    case RBH_FOP_LOWER_OR_EQUAL:
+    case RBH_FOP_STRICTLY_GREATER:
+    case RBH_FOP_GREATER_OR_EQUAL:
+        break;
+    default:
+        return false;
+    }
+
+    switch (filter->compare.value.type) {
+    case RBH_VT_INT32:
+    case RBH_VT_UINT32:
+    case RBH_VT_INT64:
+    case RBH_VT_UINT64:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* The statx column \p filter can be evaluated on, if any */
+static const struct columnar_map *
+filter_column(const struct columnar_snapshot *snapshot,
+              const struct rbh_filter *filter)
+{
+    const struct columnar_map *map;
+    uint32_t field;
+
+    if (!rbh_is_comparison_operator(filter->op)
+     || filter->compare.field.fsentry != RBH_FP_STATX)
+        return NULL;
+
+    field = filter->compare.field.statx;
+    if (__builtin_popcount(field) != 1)
+        return NULL;
+
+    map = &snapshot->statx[__builtin_ctz(field)];
+    if (map->column == NULL)
+        return NULL;
+
+    if (filter->op == RBH_FOP_EXISTS || is_range_comparison(filter))
+        return map;
+    return NULL;
+}
+
+/* The range of keys a comparison of a \p field to an integer matches
+ *
+ * @return          false if the range is empty
+ */
+static bool
+key_range(const struct rbh_filter *filter, uint32_t field, uint64_t *low,
+          uint64_t *high)
+{
+    const struct rbh_value *value = &filter->compare.value;
+    bool is_signed = is_signed_field(field);
+    bool below = false; /* the value is lower than every key */
+    bool above = false; /* the value is greater than every key */
+    uint64_t key = 0;
+    int64_t s64;
+    uint64_t u64;
+
+    switch (value->type) {
+    case RBH_VT_INT32:
+    case RBH_VT_INT64:
+        s64 = value->type == RBH_VT_INT32 ? value->int32 : value->int64;
+        if (is_signed)
+            key = signed2key(s64);
+        else if (s64 < 0)
+            below = true;
+        else
+            key = s64;
+        break;
+    default:
+        u64 = value->type == RBH_VT_UINT32 ? value->uint32 : value->uint64;
+        if (!is_signed)
+            key = u64;
+        else if (u64 > INT64_MAX)
+            above = true;
+        else
+            key = signed2key(u64);
+        break;
+    }
+
+    *low = 0;
+    *high = UINT64_MAX;
+    switch (filter->op) {
+    case RBH_FOP_EQUAL:
+        *low = *high = key;
+        return !below && !above;
+    case RBH_FOP_STRICTLY_LOWER:
+        if (below || (!above && key == 0))
+            return false;
+        if (!above)
+            *high = key - 1;
+        return true;
+    case RBH_FOP_LOWER_OR_EQUAL:
+        if (!above)
+            *high = key;
+        return !below;
+    case RBH_FOP_STRICTLY_GREATER:
+        if (above || (!below && key == UINT64_MAX))
+            return false;
+        if (!below)
+            *low = key + 1;
+        return true;
+    default:
+        if (!below)
+            *low = key;
+        return !above;
+    }
+}
+
+/* Branchless loops over a column, that compilers vectorize */
+#define DEFINE_RANGE_SCAN(name, type)                                         \
+static void                                                                   \
+name(const void *values, size_t count, type low, type high,                   \
+     uint8_t *selection)                                                      \
+{                                                                             \
+    const type *array = values;                                               \
+                                                                              \
+    for (size_t i = 0; i < count; i++)                                        \
+        selection[i] &= (array[i] >= low) & (array[i] <= high);               \
+}
+
+DEFINE_RANGE_SCAN(range_scan_u8, uint8_t)
+DEFINE_RANGE_SCAN(range_scan_u16, uint16_t)
+DEFINE_RANGE_SCAN(range_scan_u32, uint32_t)
+DEFINE_RANGE_SCAN(range_scan_u64, uint64_t)
+DEFINE_RANGE_SCAN(range_scan_s64, int64_t)
+
+/* Select the candidates whose row has \p field */
+static void
+block_present(const struct columnar_block *block, uint32_t field,
+              const uint8_t *candidates, uint8_t *selection)
+{
+    const uint32_t *mask = block->snapshot->mask + block->start;
+
+    for (size_t i = 0; i < block->count; i++)
+        selection[i] = candidates[i] & ((mask[i] & field) != 0);
+}
+
+/* Evaluate a comparison of a statx field to an integer on its column */
+static void
+block_range(const struct columnar_block *block, const struct rbh_filter *filter,
+            const struct columnar_map *map, const uint8_t *candidates,
+            uint8_t *selection)
+{
+    const struct columnar_column *column = map->column;
+    const void *values;
+    uint64_t low, high;
+    uint64_t max;
+
+    block_present(block, column->field, candidates, selection);
+
+    if (!key_range(filter, column->field, &low, &high))
+        goto out_none;
+
+    if (column->flags & CCF_DICTIONARY) {
+        /* Dictionaries are sorted: a range of keys is a range of codes */
+        size_t end = upper_bound(map->dictionary, column->extra_size, high);
+
+        low = lower_bound(map->dictionary, column->extra_size, low);
+        if (low >= end)
+            goto out_none;
+        high = end - 1;
+    }
+
+    if (map->zones) {
+        const struct columnar_zone *zone = &map->zones[block->index];
+
+        if (zone->max < low || zone->min > high)
+            goto out_none;
+
+        /* Every value of the block is in range */
+        if (low <= zone->min && zone->max <= high)
+            return;
+    }
+
+    values = (const char *)map->values + block->start * column->width;
+    if (column->flags & CCF_SIGNED) {
+        range_scan_s64(values, block->count, low ^ SIGN_BIT, high ^ SIGN_BIT,
+                       selection);
+        return;
+    }
+
+    max = column->width == 8 ? UINT64_MAX
+                             : (UINT64_C(1) << (8 * column->width)) - 1;
+    if (low > max)
+        goto out_none;
+    if (high > max)
+        high = max;
+
+    switch (column->width) {
+    case 1:
+        range_scan_u8(values, block->count, low, high, selection);
+        break;
+    case 2:
+        range_scan_u16(values, block->count, low, high, selection);
+        break;
+    case 4:
+        range_scan_u32(values, block->count, low, high, selection);
+        break;
+    default:
+        range_scan_u64(values, block->count, low, high, selection);
+        break;
+    }
+    return;
+
+out_none:
+    memset(selection, 0, block->count);
+}
+
+/* Evaluate a comparison on a view of each candidate */
+static int
+block_match(const struct columnar_block *block, const struct rbh_filter *filter,
+            const uint8_t *candidates, uint8_t *selection)
+{
+    for (size_t i = 0; i < block->count; i++) {
+        const struct rbh_fsentry *fsentry;
+
+        selection[i] = 0;
+        if (!candidates[i])
+            continue;
+
+        fsentry = view_fill(block->view, block->snapshot, block->start + i);
+        if (fsentry == NULL)
+            return -1;
+
+        selection[i] = rbh_filter_matches(filter, fsentry);
+    }
+    return 0;
+}
+
+static bool
+is_none(const uint8_t *selection, size_t count)
+{
+    return memchr(selection, 1, count) == NULL;
+}
+
+/* Evaluate \p filter on the \p candidates of \p block
+ *
+ * @param scratch   filter_depth(filter) selections of the size of a block
+ */
+static int
+block_eval(const struct columnar_block *block, const struct rbh_filter *filter,
+           const uint8_t *candidates, uint8_t *selection, uint8_t *scratch)
+{
+    uint8_t *tmp = scratch;
+    const struct columnar_map *map;
+
+    if (filter == NULL || is_none(candidates, block->count)) {
+        memcpy(selection, candidates, block->count);
+        return 0;
+    }
+
+    scratch += block->snapshot->block_size;
+    switch (filter->op) {
+    case RBH_FOP_AND:
+        memcpy(selection, candidates, block->count);
+
+        /* Columns first, then the comparisons that need a view of each row */
+        for (int columns = 1; columns >= 0; columns--) {
+            for (size_t i = 0; i < filter->logical.count; i++) {
+                const struct rbh_filter *child = filter->logical.filters[i];
+
+                if ((filter_column(block->snapshot, child) != NULL)
+                    != columns)
+                    continue;
+
+                if (block_eval(block, child, selection, tmp, scratch))
+                    return -1;
+                memcpy(selection, tmp, block->count);
+            }
+        }
+        return 0;
+    case RBH_FOP_OR:
+        memset(selection, 0, block->count);
+        for (size_t i = 0; i < filter->logical.count; i++) {
+            if (block_eval(block, filter->logical.filters[i], candidates, tmp,
+                           scratch))
+                return -1;
+
+            for (size_t j = 0; j < block->count; j++)
+                selection[j] |= tmp[j];
+        }
+        return 0;
+    case RBH_FOP_NOT:
+        if (block_eval(block, filter->logical.filters[0], candidates, tmp,
+                       scratch))
+            return -1;
+
+        for (size_t i = 0; i < block->count; i++)
+            selection[i] = candidates[i] & !tmp[i];
+        return 0;
+    default:
+        break;
+    }
+
+    map = filter_column(block->snapshot, filter);
+    if (map == NULL)
+        return block_match(block, filter, candidates, selection);
+
+    if (filter->op != RBH_FOP_EXISTS) {
+        block_range(block, filter, map, candidates, selection);
+        return 0;
+    }
+
+    block_present(block, map->column->field, candidates, selection);
+    if (!filter->compare.value.boolean) {
+        for (size_t i = 0; i < block->count; i++)
+            selection[i] = candidates[i] & !selection[i];
+    }
+    return 0;
+}
+
+    /*--------------------------------------------------------------------*
+     |                              subtree                               |
+     *--------------------------------------------------------------------*/
+
+/* Keep hashmaps at most 70% full (they use open addressing) */
+#define COLUMNAR_MIN_SLOTS (1 << 10)
+
+static size_t
+slots_for(size_t count)
+{
+    size_t slots = count * 10 / 7 + 1;
+
+    return slots < COLUMNAR_MIN_SLOTS ? COLUMNAR_MIN_SLOTS : slots;
+}
+
+static size_t
+id_hash(const void *key)
+{
+    const struct rbh_id *id = key;
+    size_t hash = 5381;
+
+    /* djb2 */
+    for (size_t i = 0; i < id->size; i++)
+        hash = ((hash << 5) + hash) + (unsigned char)id->data[i];
+
+    return hash;
+}
+
+static bool
+id_equals(const void *first, const void *second)
+{
+    return rbh_id_equal(first, second);
+}
+
+static void
+load_id(const struct columnar_map *map, size_t row, struct rbh_id *id)
+{
+    size_t size;
+
+    id->data = load_bytes(map, row, &size);
+    id->size = size;
+}
+
+struct subtree {
+    struct rbh_id *ids;             /* of every row */
+    struct rbh_id *parent_ids;      /* of every row */
+    size_t *next;                   /* the next row with the same parent + 1 */
+    struct rbh_hashmap *children;   /* parent id -> its first row + 1 */
+    struct rbh_hashmap *visited;    /* ids in the subtree */
+    const struct rbh_id **queue;
+};
+
+static void
+subtree_fini(struct subtree *subtree)
+{
+    free(subtree->queue);
+    if (subtree->visited)
+        rbh_hashmap_destroy(subtree->visited);
+    if (subtree->children)
+        rbh_hashmap_destroy(subtree->children);
+    free(subtree->next);
+    free(subtree->parent_ids);
+    free(subtree->ids);
+}
+
+/* Whether each row of \p snapshot belongs to the subtree rooted at \p root_id,
+ * breadth first (the subtree is empty if the root is not in the snapshot)
+ */
+static uint8_t *
+subtree_rows(const struct columnar_snapshot *snapshot,
+             const struct rbh_id *root_id)
+{
+    size_t rows = snapshot->row_count;
+    struct subtree subtree = {};
+    size_t head = 0, tail = 0;
+    uint8_t *selected;
+    int save_errno;
+
+    selected = calloc(rows ? rows : 1, sizeof(*selected));
+    if (selected == NULL)
+        return NULL;
+
+    subtree.ids = reallocarray(NULL, rows ? rows : 1, sizeof(*subtree.ids));
+    subtree.parent_ids = reallocarray(NULL, rows ? rows : 1,
+                                      sizeof(*subtree.parent_ids));
+    subtree.next = reallocarray(NULL, rows ? rows : 1, sizeof(*subtree.next));
+    subtree.queue = reallocarray(NULL, rows ? rows : 1,
+                                 sizeof(*subtree.queue));
+    if (subtree.ids == NULL || subtree.parent_ids == NULL
+     || subtree.next == NULL || subtree.queue == NULL)
+        goto out_free;
+
+    subtree.children = rbh_hashmap_new(id_equals, id_hash, slots_for(rows));
+    if (subtree.children == NULL)
+        goto out_free;
+
+    subtree.visited = rbh_hashmap_new(id_equals, id_hash, slots_for(rows));
+    if (subtree.visited == NULL)
+        goto out_free;
+
+    /* Chain the rows of every parent, in the order of the rows */
+    for (size_t i = rows; i > 0; i--) {
+        size_t row = i - 1;
+        const void *first;
+
+        load_id(&snapshot->id, row, &subtree.ids[row]);
+        load_id(&snapshot->parent_id, row, &subtree.parent_ids[row]);
+
+        first = rbh_hashmap_get(subtree.children, &subtree.parent_ids[row]);
+        subtree.next[row] = (uintptr_t)first;
+        if (rbh_hashmap_set(subtree.children, &subtree.parent_ids[row],
+                            (void *)(uintptr_t)(row + 1)))
+            goto out_free;
+
+        if (rbh_id_equal(&subtree.ids[row], root_id)) {
+            selected[row] = 1;
+            if (tail == 0) {
+                if (rbh_hashmap_set(subtree.visited, &subtree.ids[row],
+                                    &subtree.ids[row]))
+                    goto out_free;
+                subtree.queue[tail++] = &subtree.ids[row];
+            }
+        }
+    }
+
+    while (head < tail) {
+        const struct rbh_id *id = subtree.queue[head++];
+        uintptr_t next;
+
+        next = (uintptr_t)rbh_hashmap_get(subtree.children, id);
+        while (next > 0) {
+            size_t row = next - 1;
+
+            selected[row] = 1;
+            next = subtree.next[row];
+
+            if (rbh_hashmap_get(subtree.visited, &subtree.ids[row]))
+                continue;
+
+            if (rbh_hashmap_set(subtree.visited, &subtree.ids[row],
+                                &subtree.ids[row]))
+                goto out_free;
+            subtree.queue[tail++] = &subtree.ids[row];
+        }
+    }
+
+    subtree_fini(&subtree);
+    return selected;
+
+out_free:
+    save_errno = errno;
+    subtree_fini(&subtree);
+    free(selected);
+    errno = save_errno;
+    return NULL;
+}
+
+    /*--------------------------------------------------------------------*
+     |                                scan                                |
+     *--------------------------------------------------------------------*/
+
+/* The state of an evaluation of a filter on every block of a snapshot */
+struct scan {
+    const struct columnar_snapshot *snapshot;
+    const struct rbh_filter *filter;
+    uint8_t *branch;                /* NULL, or the rows of the branch */
+    struct columnar_view view;
+
+    struct columnar_block block;    /* the last evaluated block */
+    size_t next_block;
+    size_t position;                /* in `block' */
+    uint8_t *candidates;
+    uint8_t *selection;
+    uint8_t *scratch;
+};
+
+static void
+scan_fini(struct scan *scan)
+{
+    free(scan->scratch);
+    free(scan->selection);
+    free(scan->candidates);
+    free(scan->branch);
+    free(scan->view.fsentry);
+}
+
+static int
+scan_init(struct scan *scan, const struct columnar_snapshot *snapshot,
+          const struct rbh_filter *filter, const struct rbh_id *root_id)
+{
+    size_t block_size = snapshot ? snapshot->block_size : 1;
+    int save_errno;
+
+    memset(scan, 0, sizeof(*scan));
+    scan->snapshot = snapshot;
+    scan->filter = filter;
+    if (snapshot == NULL)
+        return 0;
+
+    if (root_id) {
+        scan->branch = subtree_rows(snapshot, root_id);
+        if (scan->branch == NULL)
+            return -1;
+    }
+
+    scan->candidates = malloc(block_size);
+    scan->selection = malloc(block_size);
+    scan->scratch = reallocarray(NULL, filter_depth(filter) + 1, block_size);
+    if (scan->candidates == NULL || scan->selection == NULL
+     || scan->scratch == NULL) {
+        save_errno = errno;
+        scan_fini(scan);
+        errno = save_errno;
+        return -1;
+    }
+
+    memset(scan->candidates, 1, block_size);
+    scan->block.snapshot = snapshot;
+    scan->block.view = &scan->view;
+    return 0;
+}
+
+/* Evaluate the filter of \p scan on its next block
+ *
+ * @return          1 if there was one, 0 if there was none, -1 on error
+ */
+static int
+scan_next_block(struct scan *scan)
+{
+    const struct columnar_snapshot *snapshot = scan->snapshot;
+    struct columnar_block *block = &scan->block;
+    const uint8_t *candidates = scan->candidates;
+
+    if (snapshot == NULL || scan->next_block >= snapshot->block_count)
+        return 0;
+
+    block->index = scan->next_block++;
+    block->start = block->index * snapshot->block_size;
+    block->count = snapshot->row_count - block->start;
+    if (block->count > snapshot->block_size)
+        block->count = snapshot->block_size;
+    scan->position = 0;
+
+    if (scan->branch)
+        candidates = scan->branch + block->start;
+
+    return block_eval(block, scan->filter, candidates, scan->selection,
+                      scan->scratch) ? -1 : 1;
+}
+
+/* The next row of \p scan that matches its filter
+ *
+ * @return          1 if there is one, 0 if there is none, -1 on error
+ */
+static int
+scan_next(struct scan *scan, size_t *row)
+{
+    do {
+        const uint8_t *selection = scan->selection;
+        size_t remaining = scan->block.count - scan->position;
+        const uint8_t *next;
+
+        next = remaining ? memchr(selection + scan->position, 1, remaining)
+                         : NULL;
+        if (next != NULL) {
+            scan->position = next - selection + 1;
+            *row = scan->block.start + (next - selection);
+            return 1;
+        }
+
+        switch (scan_next_block(scan)) {
+        case -1:
+            return -1;
+        case 0:
+            return 0;
+        }
+    } while (true);
+}
+
+    /*--------------------------------------------------------------------*
+     |                              iterator                              |
+     *--------------------------------------------------------------------*/
+
+struct columnar_iterator {
+    struct rbh_mut_iterator iterator;
+    struct columnar_snapshot *snapshot;
+
+    struct rbh_filter *filter;
+    struct scan scan;
+
+    struct columnar_projection projection;
+    size_t skip;
+    size_t remaining;
+
+    /* Sorted results are collected upfront */
+    struct rbh_fsentry **sorted;
+    size_t index;
+    size_t count;
+};
+
+/* The next fsentry that matches the filter of \p iter, as a view */
+static const struct rbh_fsentry *
+iter_next_match(struct columnar_iterator *iter)
+{
+    size_t row;
+
+    switch (scan_next(&iter->scan, &row)) {
+    case -1:
+        return NULL;
+    case 0:
+        errno = ENODATA;
+        return NULL;
+    }
+
+    return view_fill(&iter->scan.view, iter->snapshot, row);
+}
+
+static void *
+columnar_iter_next(void *iterator)
+{
+    struct columnar_iterator *columnar_iter = iterator;
+    const struct rbh_fsentry *fsentry;
+
+    if (columnar_iter->sorted) {
+        if (columnar_iter->index >= columnar_iter->count) {
+            errno = ENODATA;
+            return NULL;
+        }
+        return fsentry_project(columnar_iter->sorted[columnar_iter->index++],
+                               &columnar_iter->projection);
+    }
+
+    for (; columnar_iter->skip > 0; columnar_iter->skip--) {
+        if (iter_next_match(columnar_iter) == NULL)
+            return NULL;
+    }
+
+    if (columnar_iter->remaining == 0) {
+        errno = ENODATA;
+        return NULL;
+    }
+
+    fsentry = iter_next_match(columnar_iter);
+    if (fsentry == NULL)
+        return NULL;
+
+    columnar_iter->remaining--;
+    return fsentry_project(fsentry, &columnar_iter->projection);
+}
+
+static void
+columnar_iter_destroy(void *iterator)
+{
+    struct columnar_iterator *columnar_iter = iterator;
+
+    for (size_t i = 0; i < columnar_iter->count; i++)
+        free(columnar_iter->sorted[i]);
+    free(columnar_iter->sorted);
+    scan_fini(&columnar_iter->scan);
+    projection_fini(&columnar_iter->projection);
+    free(columnar_iter->filter);
+    snapshot_release(columnar_iter->snapshot);
+    free(columnar_iter);
+}
+
+static const struct rbh_mut_iterator_operations COLUMNAR_ITER_OPS = {
+    .next = columnar_iter_next,
+    .destroy = columnar_iter_destroy,
+};
+
+static const struct rbh_mut_iterator COLUMNAR_ITER = {
+    .ops = &COLUMNAR_ITER_OPS,
+};
+
+struct sort_context {
+    const struct rbh_filter_sort *items;
+    size_t count;
+};
+
+static int
+fsentry_compare(const void *first, const void *second, void *arg)
+{
+    const struct rbh_fsentry *x = *(struct rbh_fsentry * const *)first;
+    const struct rbh_fsentry *y = *(struct rbh_fsentry * const *)second;
+    struct sort_context *context = arg;
+
+    for (size_t i = 0; i < context->count; i++) {
+        const struct rbh_filter_sort *item = &context->items[i];
+        int rc = rbh_filter_field_compare(&item->field, x, y);
+
+        if (rc)
+            return item->ascending ? rc : -rc;
+    }
+    return 0;
+}
+
+/* Collect, sort, then skip and limit every match of \p iter */
+static int
+iter_sort(struct columnar_iterator *iter,
+          const struct rbh_filter_options *options)
+{
+    struct sort_context context = {
+        .items = options->sort.items,
+        .count = options->sort.count,
+    };
+    const struct rbh_fsentry *fsentry;
+    size_t size = 0;
+    size_t skip;
+
+    while ((fsentry = iter_next_match(iter)) != NULL) {
+        if (iter->count == size) {
+            size_t new_size = size ? 2 * size : 64;
+            struct rbh_fsentry **sorted;
+
+            sorted = reallocarray(iter->sorted, new_size, sizeof(*sorted));
+            if (sorted == NULL)
+                return -1;
+
+            iter->sorted = sorted;
+            size = new_size;
+        }
+
+        iter->sorted[iter->count] = fsentry_project(fsentry, &PROJECT_ALL);
+        if (iter->sorted[iter->count] == NULL)
+            return -1;
+        iter->count++;
+    }
+
+    if (errno != ENODATA)
+        return -1;
+
+    if (iter->sorted == NULL) {
+        /* An empty but non-NULL array, to tell sorted iterators apart */
+        iter->sorted = malloc(sizeof(*iter->sorted));
+        if (iter->sorted == NULL)
+            return -1;
+    }
+
+    qsort_r(iter->sorted, iter->count, sizeof(*iter->sorted), fsentry_compare,
+            &context);
+
+    skip = iter->skip < iter->count ? iter->skip : iter->count;
+    iter->index = skip;
+    if (iter->remaining < iter->count - skip) {
+        for (size_t i = skip + iter->remaining; i < iter->count; i++)
+            free(iter->sorted[i]);
+        iter->count = skip + iter->remaining;
+    }
+    return 0;
+}
+
+static struct rbh_mut_iterator *
+snapshot_filter(struct columnar_snapshot *snapshot,
+                const struct rbh_filter *filter,
+                const struct rbh_filter_options *options,
+                const struct rbh_id *root_id)
+{
+    struct columnar_iterator *columnar_iter;
+    int save_errno;
+
+    if (rbh_filter_validate(filter))
+        return NULL;
+
+    columnar_iter = calloc(1, sizeof(*columnar_iter));
+    if (columnar_iter == NULL)
+        return NULL;
+
+    columnar_iter->iterator = COLUMNAR_ITER;
+    columnar_iter->snapshot = snapshot;
+    if (snapshot)
+        snapshot->refcount++;
+
+    if (projection_init(&columnar_iter->projection, &options->projection)) {
+        save_errno = errno;
+        snapshot_release(snapshot);
+        free(columnar_iter);
+        errno = save_errno;
+        return NULL;
+    }
+
+    columnar_iter->skip = options->skip;
+    columnar_iter->remaining = options->limit > 0 ? options->limit : SIZE_MAX;
+
+    columnar_iter->filter = rbh_filter_clone(filter);
+    if (filter != NULL && columnar_iter->filter == NULL)
+        goto out_destroy;
+
+    if (scan_init(&columnar_iter->scan, snapshot, columnar_iter->filter,
+                  root_id))
+        goto out_destroy;
+
+    if (options->sort.count > 0 && iter_sort(columnar_iter, options))
+        goto out_destroy;
+
+    return &columnar_iter->iterator;
+
+out_destroy:
+    save_errno = errno;
+    columnar_iter_destroy(columnar_iter);
+    errno = save_errno;
+    return NULL;
+}
+
+    /*--------------------------------------------------------------------*
+     |                             histogram                              |
+     *--------------------------------------------------------------------*/
+
+static int64_t
+key2integer(uint64_t key, uint32_t field)
+{
+    if (is_signed_field(field))
+        return key ^ SIGN_BIT;
+    return key > INT64_MAX ? INT64_MAX : (int64_t)key;
+}
+
+static int
+snapshot_histogram(const struct columnar_snapshot *snapshot,
+                   const struct rbh_filter *filter,
+                   const struct rbh_id *root_id, uint32_t field,
+                   const int64_t *bounds, size_t count,
+                   struct rbh_columnar_bucket *buckets)
+{
+    const struct columnar_map *size_map;
+    const struct columnar_map *map;
+    struct scan scan;
+    int rc;
+
+    memset(buckets, 0, (count + 1) * sizeof(*buckets));
+    if (snapshot == NULL)
+        return 0;
+
+    map = &snapshot->statx[__builtin_ctz(field)];
+    size_map = &snapshot->statx[__builtin_ctz(RBH_STATX_SIZE)];
+    if (map->column == NULL)
+        return 0;
+
+    if (scan_init(&scan, snapshot, filter, root_id))
+        return -1;
+
+    while ((rc = scan_next_block(&scan)) == 1) {
+        const uint32_t *mask = snapshot->mask + scan.block.start;
+
+        for (size_t i = 0; i < scan.block.count; i++) {
+            size_t row = scan.block.start + i;
+            struct rbh_columnar_bucket *bucket;
+            int64_t value;
+            size_t low = 0;
+            size_t high = count;
+
+            if (!scan.selection[i] || !(mask[i] & field))
+                continue;
+
+            /* The first bound greater than the value */
+            value = key2integer(load_key(map, row), field);
+            while (low < high) {
+                size_t middle = low + (high - low) / 2;
+
+                if (bounds[middle] <= value)
+                    low = middle + 1;
+                else
+                    high = middle;
+            }
+
+            bucket = &buckets[low];
+            bucket->count++;
+            if (mask[i] & RBH_STATX_SIZE && size_map->column)
+                bucket->size += load_key(size_map, row);
+        }
+    }
+
+    scan_fini(&scan);
+    return rc;
+}
+
+/*----------------------------------------------------------------------------*
+ |                                  catalog                                   |
+ *----------------------------------------------------------------------------*/
+
+struct columnar_catalog {
+    unsigned int refcount;
+    char *path;
+    uint32_t block_size;
+    struct columnar_snapshot *snapshot;     /* NULL if there is none yet */
+    struct rbh_backend *staging;            /* NULL until it is updated */
+};
+
+/* Copy the rows of \p snapshot in \p staging */
+static int
+snapshot_import(const struct columnar_snapshot *snapshot,
+                struct rbh_backend *staging)
+{
+    struct columnar_view view = {};
+    int save_errno;
+    int rc;
+
+    for (size_t row = 0; row < snapshot->row_count; row++) {
+        const struct rbh_fsentry *fsentry;
+        struct rbh_iterator *fsevents;
+        struct rbh_fsevent link[2];
+
+        fsentry = view_fill(&view, snapshot, row);
+        if (fsentry == NULL)
+            goto out_free;
+
+        link[0] = (struct rbh_fsevent){
+            .type = RBH_FET_UPSERT,
+            .id = fsentry->id,
+            .upsert = {
+                .statx = fsentry->statx,
+                .symlink = fsentry->mask & RBH_FP_SYMLINK ? fsentry->symlink
+                                                          : NULL,
+            },
+        };
+        link[1] = (struct rbh_fsevent){
+            .type = RBH_FET_LINK,
+            .id = fsentry->id,
+            .xattrs = fsentry->xattrs.ns,
+            .link = {
+                .parent_id = &fsentry->parent_id,
+                .name = fsentry->name ? fsentry->name : "",
+            },
+        };
+
+        fsevents = rbh_iter_array(link, sizeof(*link), 2);
+        if (fsevents == NULL)
+            goto out_free;
+
+        rc = rbh_backend_update(staging, fsevents, false) == 2 ? 0 : -1;
+        rbh_iter_destroy(fsevents);
+        if (rc)
+            goto out_free;
+    }
+
+    free(view.fsentry);
+    return 0;
+
+out_free:
+    save_errno = errno;
+    free(view.fsentry);
+    errno = save_errno;
+    return -1;
+}
+
+static ssize_t
+catalog_update(struct columnar_catalog *catalog,
+               struct rbh_iterator *fsevents, bool skip_error)
+{
+    uint32_t indexes = 0;
+    int save_errno;
+
+    if (catalog->staging == NULL) {
+        catalog->staging = rbh_memory_backend_new(NULL);
+        if (catalog->staging == NULL)
+            return -1;
+
+        /* The staging catalog is only ever scanned as a whole */
+        if (rbh_backend_set_option(catalog->staging, RBH_MEMBO_INDEXES,
+                                   &indexes, sizeof(indexes))
+         || (catalog->snapshot
+          && snapshot_import(catalog->snapshot, catalog->staging))) {
+            save_errno = errno;
+            rbh_backend_destroy(catalog->staging);
+            catalog->staging = NULL;
+            errno = save_errno;
+            return -1;
+        }
+    }
+
+    return rbh_backend_update(catalog->staging, fsevents, skip_error);
+}
+
+/* Write the updates of \p catalog to its snapshot */
+static int
+catalog_flush(struct columnar_catalog *catalog)
+{
+    struct columnar_snapshot *snapshot;
+
+    if (catalog->staging == NULL)
+        return 0;
+
+    if (snapshot_write(catalog->path, catalog->staging, catalog->block_size))
+        return -1;
+
+    snapshot = snapshot_open(catalog->path);
+    if (snapshot == NULL)
+        return -1;
+
+    snapshot_release(catalog->snapshot);
+    catalog->snapshot = snapshot;
+    rbh_backend_destroy(catalog->staging);
+    catalog->staging = NULL;
+    return 0;
+}
+
+static struct rbh_mut_iterator *
+catalog_filter(struct columnar_catalog *catalog,
+               const struct rbh_filter *filter,
+               const struct rbh_filter_options *options,
+               const struct rbh_id *root_id)
+{
+    if (catalog_flush(catalog))
+        return NULL;
+
+    return snapshot_filter(catalog->snapshot, filter, options, root_id);
+}
+
+static void
+catalog_release(struct columnar_catalog *catalog)
+{
+    if (--catalog->refcount > 0)
+        return;
+
+    if (catalog_flush(catalog))
+        fprintf(stderr, "Failed to write the columnar snapshot '%s': %s\n",
+                catalog->path, strerror(errno));
+
+    if (catalog->staging)
+        rbh_backend_destroy(catalog->staging);
+    snapshot_release(catalog->snapshot);
+    free(catalog->path);
+    free(catalog);
+}
+
+static struct columnar_catalog *
+catalog_open(const char *path)
+{
+    struct columnar_catalog *catalog;
+    int save_errno;
+
+    catalog = calloc(1, sizeof(*catalog));
+    if (catalog == NULL)
+        return NULL;
+
+    catalog->refcount = 1;
+    catalog->block_size = COLUMNAR_DEFAULT_BLOCK_SIZE;
+    catalog->path = strdup(path);
+    if (catalog->path == NULL)
+        goto out_free;
+
+    catalog->snapshot = snapshot_open(path);
+    if (catalog->snapshot == NULL && errno != ENOENT)
+        goto out_free;
+
+    if (catalog->snapshot)
+        catalog->block_size = catalog->snapshot->block_size;
+    return catalog;
+
+out_free:
+    save_errno = errno;
+    free(catalog->path);
+    free(catalog);
+    errno = save_errno;
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*
+ |                              columnar_backend                              |
+ *----------------------------------------------------------------------------*/
+
+struct columnar_backend {
+    struct rbh_backend backend;
+    struct columnar_catalog *catalog;
+    struct rbh_id *root_id;         /* NULL, or the root of a branch */
+};
+
+    /*--------------------------------------------------------------------*
+     |                             get_option                             |
+     *--------------------------------------------------------------------*/
+
+static int
+columnar_get_option(void *backend, unsigned int option, void *data,
+                    size_t *data_size)
+{
+    struct columnar_backend *columnar = backend;
+    uint32_t block_size = columnar->catalog->block_size;
+
+    switch (option) {
+    case RBH_CBO_BLOCK_SIZE:
+        if (*data_size < sizeof(block_size)) {
+            *data_size = sizeof(block_size);
+            errno = EOVERFLOW;
+            return -1;
+        }
+        memcpy(data, &block_size, sizeof(block_size));
+        *data_size = sizeof(block_size);
+        return 0;
+    }
+
+    errno = ENOPROTOOPT;
+    return -1;
+}
+
+    /*--------------------------------------------------------------------*
+     |                             set_option                             |
+     *--------------------------------------------------------------------*/
+
+static int
+columnar_set_option(void *backend, unsigned int option, const void *data,
+                    size_t data_size)
+{
+    struct columnar_backend *columnar = backend;
+    uint32_t block_size;
+
+    switch (option) {
+    case RBH_CBO_BLOCK_SIZE:
+        if (data_size != sizeof(block_size)) {
+            errno = EINVAL;
+            return -1;
+        }
+        memcpy(&block_size, data, sizeof(block_size));
+
+        if (block_size == 0 || block_size % 64) {
+            errno = EINVAL;
+            return -1;
+        }
+        columnar->catalog->block_size = block_size;
+        return 0;
+    }
+
+    errno = ENOPROTOOPT;
+    return -1;
+}
+
+    /*--------------------------------------------------------------------*
+     |                               update                               |
+     *--------------------------------------------------------------------*/
+
+static ssize_t
+columnar_backend_update(void *backend, struct rbh_iterator *fsevents,
+                        bool skip_error)
+{
+    struct columnar_backend *columnar = backend;
+
+    return catalog_update(columnar->catalog, fsevents, skip_error);
+}
+
+    /*--------------------------------------------------------------------*
+     |                               filter                               |
+     *--------------------------------------------------------------------*/
+
+static struct rbh_mut_iterator *
+columnar_backend_filter(void *backend, const struct rbh_filter *filter,
+                        const struct rbh_filter_options *options)
+{
+    struct columnar_backend *columnar = backend;
+
+    return catalog_filter(columnar->catalog, filter, options,
+                          columnar->root_id);
+}
+
+    /*--------------------------------------------------------------------*
+     |                                root                                |
+     *--------------------------------------------------------------------*/
+
+static const struct rbh_filter ROOT_FILTER = {
+    .op = RBH_FOP_EQUAL,
+    .compare = {
+        .field = {
+            .fsentry = RBH_FP_PARENT_ID,
+        },
+        .value = {
+            .type = RBH_VT_BINARY,
+            .binary = {
+                .size = 0,
+            },
+        },
+    },
+};
+
+static struct rbh_fsentry *
+columnar_root(void *backend, const struct rbh_filter_projection *projection)
+{
+    struct columnar_backend *columnar = backend;
+    const struct rbh_filter ID_FILTER = {
+        .op = RBH_FOP_EQUAL,
+        .compare = {
+            .field = {
+                .fsentry = RBH_FP_ID,
+            },
+            .value = {
+                .type = RBH_VT_BINARY,
+                .binary = {
+                    .data = columnar->root_id ? columnar->root_id->data : NULL,
+                    .size = columnar->root_id ? columnar->root_id->size : 0,
+                },
+            },
+        },
+    };
+
+    return rbh_backend_filter_one(backend, columnar->root_id ? &ID_FILTER
+                                                             : &ROOT_FILTER,
+                                  projection);
+}
+
+    /*--------------------------------------------------------------------*
+     |                               branch                               |
+     *--------------------------------------------------------------------*/
+
+static const struct rbh_backend COLUMNAR_BACKEND;
+
+static struct rbh_backend *
+columnar_backend_branch(void *backend, const struct rbh_id *id,
+                        const char *path)
+{
+    const struct rbh_filter_projection ID_ONLY = {
+        .fsentry_mask = RBH_FP_ID,
+    };
+    struct columnar_backend *columnar = backend;
+    struct rbh_fsentry *fsentry = NULL;
+    struct columnar_backend *branch;
+    int save_errno;
+
+    if (id == NULL) {
+        if (path == NULL) {
+            errno = EINVAL;
+            return NULL;
+        }
+
+        fsentry = rbh_backend_fsentry_from_path(backend, path, &ID_ONLY);
+        if (fsentry == NULL)
+            return NULL;
+
+        if (!(fsentry->mask & RBH_FP_ID)) {
+            free(fsentry);
+            errno = ENODATA;
+            return NULL;
+        }
+        id = &fsentry->id;
+    }
+
+    branch = malloc(sizeof(*branch));
+    if (branch == NULL)
+        goto out_free_fsentry;
+
+    branch->root_id = rbh_id_new(id->data, id->size);
+    if (branch->root_id == NULL)
+        goto out_free_branch;
+
+    free(fsentry);
+    branch->backend = COLUMNAR_BACKEND;
+    branch->catalog = columnar->catalog;
+    branch->catalog->refcount++;
+    return &branch->backend;
+
+out_free_branch:
+    save_errno = errno;
+    free(branch);
+    errno = save_errno;
+out_free_fsentry:
+    save_errno = errno;
+    free(fsentry);
+    errno = save_errno;
+    return NULL;
+}
+
+    /*--------------------------------------------------------------------*
+     |                              destroy()                             |
+     *--------------------------------------------------------------------*/
+
+static void
+columnar_backend_destroy(void *backend)
+{
+    struct columnar_backend *columnar = backend;
+
+    catalog_release(columnar->catalog);
+    free(columnar->root_id);
+    free(columnar);
+}
+
+static const struct rbh_backend_operations COLUMNAR_BACKEND_OPS = {
+    .get_option = columnar_get_option,
+    .set_option = columnar_set_option,
+    .update = columnar_backend_update,
+    .branch = columnar_backend_branch,
+    .root = columnar_root,
+    .filter = columnar_backend_filter,
+    .destroy = columnar_backend_destroy,
+};
+
+static const struct rbh_backend COLUMNAR_BACKEND = {
+    .id = RBH_BI_COLUMNAR,
+    .name = RBH_COLUMNAR_BACKEND_NAME,
+    .ops = &COLUMNAR_BACKEND_OPS,
+};
+
+/*----------------------------------------------------------------------------*
+ |                         rbh_columnar_backend_new()                         |
+ *----------------------------------------------------------------------------*/
+
+struct rbh_backend *
+rbh_columnar_backend_new(const char *path)
+{
+    struct columnar_backend *columnar;
+    int save_errno;
+
+    if (path == NULL || *path == '\0') {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    columnar = malloc(sizeof(*columnar));
+    if (columnar == NULL)
+        return NULL;
+
+    columnar->catalog = catalog_open(path);
+    if (columnar->catalog == NULL) {
+        save_errno = errno;
+        free(columnar);
+        errno = save_errno;
+        return NULL;
+    }
+
+    columnar->backend = COLUMNAR_BACKEND;
+    columnar->root_id = NULL;
+    return &columnar->backend;
+}
+
+/*----------------------------------------------------------------------------*
+ |                      rbh_columnar_backend_histogram()                      |
+ *----------------------------------------------------------------------------*/
+
+int
+rbh_columnar_backend_histogram(struct rbh_backend *backend,
+                               const struct rbh_filter *filter, uint32_t field,
+                               const int64_t *bounds, size_t count,
+                               struct rbh_columnar_bucket *buckets)
+{
+    struct columnar_backend *columnar = (struct columnar_backend *)backend;
+    bool is_field = false;
+
+    for (size_t i = 0; i < FIELD_COUNT; i++)
+        is_field |= FIELDS[i].field == field;
+
+    if (backend->id != RBH_BI_COLUMNAR || !is_field) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (rbh_filter_validate(filter) || catalog_flush(columnar->catalog))
+        return -1;
+
+    return snapshot_histogram(columnar->catalog->snapshot, filter,
+                              columnar->root_id, field, bounds, count,
+                              buckets);
+}
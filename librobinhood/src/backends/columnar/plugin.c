@@ -0,0 +1,27 @@
+/* This file is part of Robinhood 4
+ * Copyright (C) 2024 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: LGPL-3.0-or-later
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdlib.h>
+
+#include "robinhood/backends/columnar.h"
+#include "robinhood/plugins/backend.h"
+
+static const struct rbh_backend_plugin_operations COLUMNAR_BACKEND_PLUGIN_OPS = {
+    .new = rbh_columnar_backend_new,
+};
+
+const struct rbh_backend_plugin RBH_BACKEND_PLUGIN_SYMBOL(COLUMNAR) = {
+    .plugin = {
+        .name = RBH_COLUMNAR_BACKEND_NAME,
+        .version = RBH_COLUMNAR_BACKEND_VERSION,
+    },
+    .ops = &COLUMNAR_BACKEND_PLUGIN_OPS,
+};
@@ -9,12 +9,17 @@
 # include "config.h"
 #endif
 
+#include <errno.h>
 #include <error.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <sys/param.h>
+
 #include "robinhood/backends/hestia.h"
 #include "robinhood/sstack.h"
 #include "robinhood/statx.h"
@@ -32,6 +37,19 @@ struct tier_objects {
                         * the next call to "hestia_iter_next". */
 };
 
+/* How many objects to fetch the attributes of concurrently, by default */
+#define DEFAULT_CONCURRENCY 16
+/* How many objects to prefetch per concurrent fetch */
+#define PREFETCH_DEPTH 4
+
+struct prefetched_object {
+    HestiaId *id;
+    HestiaObject object;
+    /* The return value of hestia_object_get_attrs(), and errno */
+    int rc;
+    int error;
+};
+
 struct hestia_iterator {
     struct rbh_mut_iterator iterator;
     struct rbh_sstack *values;
@@ -40,22 +58,33 @@ struct hestia_iterator {
     size_t tiers_length;
     size_t current_tier; /* index of the tier in "tiers" that will be managed in
                           * the next call to "hestia_iter_next". */
+
+    /* Objects whose attributes were fetched ahead of "hestia_iter_next" */
+    size_t concurrency;
+    struct prefetched_object *prefetched;
+    size_t prefetched_count;
+    size_t prefetched_index; /* index of the object in "prefetched" that will
+                              * be managed in the next call to
+                              * "hestia_iter_next". */
 };
 
 static HestiaId *
 get_next_object(struct hestia_iterator *hestia_iter)
 {
-    struct tier_objects *tier = &hestia_iter->tiers[hestia_iter->current_tier];
+    struct tier_objects *tier;
     HestiaId *to_return;
 
-    if (tier->current_id == tier->ids_length) {
-        if (hestia_iter->current_tier + 1 == hestia_iter->tiers_length) {
+    while (true) {
+        if (hestia_iter->current_tier == hestia_iter->tiers_length) {
             errno = ENODATA;
             return NULL;
         }
 
+        tier = &hestia_iter->tiers[hestia_iter->current_tier];
+        if (tier->current_id < tier->ids_length)
+            break;
+
         hestia_iter->current_tier++;
-        return get_next_object(hestia_iter);
     }
 
     to_return = &tier->ids[tier->current_id];
@@ -65,6 +94,90 @@ get_next_object(struct hestia_iterator *hestia_iter)
     return to_return;
 }
 
+    /*--------------------------------------------------------------------*
+     |                              prefetch                              |
+     *--------------------------------------------------------------------*/
+
+/* Hestia is queried by as many threads as the concurrency of an iterator, each
+ * one thread takes care of every `stride'-th object of a window.
+ */
+struct fetcher {
+    struct prefetched_object *objects;
+    size_t count;
+    size_t first;
+    size_t stride;
+};
+
+static void *
+fetch_attrs(void *arg)
+{
+    struct fetcher *fetcher = arg;
+
+    for (size_t i = fetcher->first; i < fetcher->count; i += fetcher->stride) {
+        struct prefetched_object *prefetched = &fetcher->objects[i];
+
+        errno = 0;
+        prefetched->rc = hestia_object_get_attrs(prefetched->id,
+                                                 &prefetched->object);
+        prefetched->error = errno ? : EIO;
+    }
+
+    return NULL;
+}
+
+static int
+prefetch(struct hestia_iterator *hestia_iter)
+{
+    size_t window = hestia_iter->concurrency * PREFETCH_DEPTH;
+    struct fetcher fetchers[RBH_HESTIA_MAX_CONCURRENCY];
+    pthread_t threads[RBH_HESTIA_MAX_CONCURRENCY];
+    bool started[RBH_HESTIA_MAX_CONCURRENCY];
+    size_t workers;
+    size_t count;
+
+    for (count = 0; count < window; count++) {
+        struct prefetched_object *prefetched = &hestia_iter->prefetched[count];
+
+        prefetched->id = get_next_object(hestia_iter);
+        if (prefetched->id == NULL)
+            break;
+
+        memset(&prefetched->object, 0, sizeof(prefetched->object));
+    }
+
+    hestia_iter->prefetched_count = count;
+    hestia_iter->prefetched_index = 0;
+    if (count == 0)
+        /* errno was set by get_next_object() */
+        return -1;
+
+    workers = MIN(hestia_iter->concurrency, count);
+    for (size_t i = 0; i < workers; i++) {
+        fetchers[i].objects = hestia_iter->prefetched;
+        fetchers[i].count = count;
+        fetchers[i].first = i;
+        fetchers[i].stride = workers;
+
+        /* The calling thread does its share of the work too */
+        started[i] = i > 0
+                  && pthread_create(&threads[i], NULL, fetch_attrs,
+                                    &fetchers[i]) == 0;
+    }
+
+    /* If a thread could not be started, its share is fetched here */
+    for (size_t i = 0; i < workers; i++) {
+        if (!started[i])
+            fetch_attrs(&fetchers[i]);
+    }
+
+    for (size_t i = 0; i < workers; i++) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+    }
+
+    return 0;
+}
+
 static void
 fill_statx(struct rbh_statx *statx, HestiaObject *obj)
 {
@@ -82,6 +195,22 @@ fill_statx(struct rbh_statx *statx, HestiaObject *obj)
     statx->stx_mtime.tv_nsec = 0;
 }
 
+/* Strings are padded so that what is pushed after them remains aligned */
+static char *
+push_string(struct rbh_sstack *values, const char *string)
+{
+    size_t length = strlen(string) + 1;
+    char *copy;
+
+    copy = rbh_sstack_push(values, NULL,
+                           (length + sizeof(void *) - 1)
+                         & ~(sizeof(void *) - 1));
+    if (copy == NULL)
+        return NULL;
+
+    return memcpy(copy, string, length);
+}
+
 static int
 fill_path(char *path, struct rbh_value_pair **_pairs, struct rbh_sstack *values)
 {
@@ -205,14 +334,12 @@ fill_user_attributes(HestiaObject *obj, struct rbh_value_pair *pairs,
                   "rbh_sstack_push on attr_value in fill_user_attributes");
 
         attr_value->type = RBH_VT_STRING;
-        attr_value->string = rbh_sstack_push(values, attr->m_value,
-                                             strlen(attr->m_value) + 1);
+        attr_value->string = push_string(values, attr->m_value);
         if (attr_value->string == NULL)
             error(EXIT_FAILURE, ENOMEM,
                   "rbh_sstack_push on value string in fill_user_attributes");
 
-        user_pairs[i].key = rbh_sstack_push(values, attr->m_key,
-                                            strlen(attr->m_key) + 1);
+        user_pairs[i].key = push_string(values, attr->m_key);
         if (user_pairs[i].key == NULL)
             error(EXIT_FAILURE, ENOMEM,
                   "rbh_sstack_push on key pair in fill_user_attributes");
@@ -241,19 +368,28 @@ hestia_iter_next(void *iterator)
     struct rbh_value_map ns_xattrs;
     struct rbh_statx statx = {0};
     struct rbh_id parent_id;
-    HestiaObject obj = {0};
+    struct prefetched_object *prefetched;
+    HestiaObject obj;
     struct rbh_id id;
     HestiaId *obj_id;
     char *name;
     int rc;
 
-    obj_id = get_next_object(hestia_iter);
-    if (obj_id == NULL)
+    if (hestia_iter->prefetched_index == hestia_iter->prefetched_count
+     && prefetch(hestia_iter))
+        return NULL;
+
+    prefetched = &hestia_iter->prefetched[hestia_iter->prefetched_index++];
+    if (prefetched->rc) {
+        errno = prefetched->error;
         return NULL;
+    }
+
+    obj_id = prefetched->id;
+    obj = prefetched->object;
 
     /* Use the hestia_id of each file as rbh_id */
-    id.data = rbh_sstack_push(hestia_iter->values, obj_id->m_uuid,
-                              strlen(obj_id->m_uuid) + 1);
+    id.data = push_string(hestia_iter->values, obj_id->m_uuid);
     if (id.data == NULL)
         return NULL;
 
@@ -262,10 +398,6 @@ hestia_iter_next(void *iterator)
     /* All objects have no parent */
     parent_id.size = 0;
 
-    rc = hestia_object_get_attrs(obj_id, &obj);
-    if (rc)
-        return NULL;
-
     fill_statx(&statx, &obj);
 
     // TODO: register the name of the object
@@ -308,6 +440,7 @@ hestia_iter_destroy(void *iterator)
     rbh_sstack_destroy(hestia_iter->values);
 
     hestia_free_tier_ids(&hestia_iter->tier_ids);
+    free(hestia_iter->prefetched);
     free(hestia_iter->tiers);
     free(hestia_iter);
 }
@@ -321,11 +454,83 @@ static const struct rbh_mut_iterator HESTIA_ITER = {
     .ops = &HESTIA_ITER_OPS,
 };
 
+/* Tiers are listed concurrently, each by a thread of its own */
+struct tier_lister {
+    uint8_t tier;
+    struct tier_objects *objects;
+    int rc;
+    int error;
+};
+
+static void *
+list_tier(void *arg)
+{
+    struct tier_lister *lister = arg;
+
+    errno = 0;
+    lister->rc = hestia_object_list(lister->tier, &lister->objects->ids,
+                                    &lister->objects->ids_length);
+    lister->error = errno ? : EIO;
+    lister->objects->current_id = 0;
+
+    return NULL;
+}
+
+static int
+list_tiers(struct hestia_iterator *hestia_iter)
+{
+    size_t tiers_length = hestia_iter->tiers_length;
+    struct tier_lister *listers;
+    pthread_t *threads;
+    bool *started;
+    int rc = 0;
+
+    listers = calloc(tiers_length, sizeof(*listers));
+    threads = calloc(tiers_length, sizeof(*threads));
+    started = calloc(tiers_length, sizeof(*started));
+    if (listers == NULL || threads == NULL || started == NULL) {
+        rc = -1;
+        goto out;
+    }
+
+    for (size_t i = 0; i < tiers_length; i++) {
+        listers[i].tier = hestia_iter->tier_ids[i];
+        listers[i].objects = &hestia_iter->tiers[i];
+
+        started[i] = hestia_iter->concurrency > 1 && i > 0
+                  && pthread_create(&threads[i], NULL, list_tier,
+                                    &listers[i]) == 0;
+    }
+
+    for (size_t i = 0; i < tiers_length; i++) {
+        if (!started[i])
+            list_tier(&listers[i]);
+    }
+
+    for (size_t i = 0; i < tiers_length; i++) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+    }
+
+    for (size_t i = 0; i < tiers_length; i++) {
+        if (listers[i].rc) {
+            errno = listers[i].error;
+            rc = -1;
+            break;
+        }
+    }
+
+out:
+    free(started);
+    free(threads);
+    free(listers);
+    return rc;
+}
+
 struct hestia_iterator *
-hestia_iterator_new()
+hestia_iterator_new(size_t concurrency)
 {
     struct hestia_iterator *hestia_iter = NULL;
-    struct hestia_id *ids = NULL;
     size_t tiers_len;
     int save_errno;
     uint8_t *tiers;
@@ -335,30 +540,28 @@ hestia_iterator_new()
     if (hestia_iter == NULL)
         return NULL;
 
+    hestia_iter->concurrency = concurrency;
+    hestia_iter->prefetched = calloc(concurrency * PREFETCH_DEPTH,
+                                     sizeof(*hestia_iter->prefetched));
+    if (hestia_iter->prefetched == NULL)
+        goto err;
+    hestia_iter->prefetched_count = 0;
+    hestia_iter->prefetched_index = 0;
+
     rc = hestia_list_tiers(&tiers, &tiers_len);
     if (rc)
-        goto err;
+        goto err_prefetched;
 
     hestia_iter->tiers_length = tiers_len;
     hestia_iter->tier_ids = tiers;
     hestia_iter->current_tier = 0;
 
-    hestia_iter->tiers = malloc(sizeof(*hestia_iter->tiers) * tiers_len);
+    hestia_iter->tiers = calloc(tiers_len, sizeof(*hestia_iter->tiers));
     if (hestia_iter->tiers == NULL)
         goto err_tiers;
 
-    for (size_t i = 0; i < tiers_len; ++i) {
-        HestiaId *object_ids;
-        size_t num_ids;
-
-        rc = hestia_object_list(tiers[i], &object_ids, &num_ids);
-        if (rc)
-            goto err_objects;
-
-        hestia_iter->tiers[i].ids = object_ids;
-        hestia_iter->tiers[i].ids_length = num_ids;
-        hestia_iter->tiers[i].current_id = 0;
-    }
+    if (list_tiers(hestia_iter))
+        goto err_objects;
 
     hestia_iter->iterator = HESTIA_ITER;
 
@@ -378,9 +581,13 @@ err_tiers:
     hestia_free_tier_ids(&tiers);
     errno = save_errno;
 
+err_prefetched:
+    save_errno = errno;
+    free(hestia_iter->prefetched);
+    errno = save_errno;
+
 err:
     save_errno = errno;
-    free(ids);
     free(hestia_iter);
     errno = save_errno;
     return NULL;
@@ -392,9 +599,69 @@ err:
 
 struct hestia_backend {
     struct rbh_backend backend;
-    struct hestia_iterator *(*iter_new)();
+    struct hestia_iterator *(*iter_new)(size_t concurrency);
+    size_t concurrency;
 };
 
+    /*--------------------------------------------------------------------*
+     |                            get_option()                            |
+     *--------------------------------------------------------------------*/
+
+static int
+hestia_backend_get_option(void *backend, unsigned int option, void *data,
+                          size_t *data_size)
+{
+    struct hestia_backend *hestia = backend;
+
+    switch (option) {
+    case RBH_HBO_CONCURRENCY:
+        if (*data_size < sizeof(hestia->concurrency)) {
+            *data_size = sizeof(hestia->concurrency);
+            errno = EOVERFLOW;
+            return -1;
+        }
+
+        memcpy(data, &hestia->concurrency, sizeof(hestia->concurrency));
+        *data_size = sizeof(hestia->concurrency);
+        return 0;
+    }
+
+    errno = ENOPROTOOPT;
+    return -1;
+}
+
+    /*--------------------------------------------------------------------*
+     |                            set_option()                            |
+     *--------------------------------------------------------------------*/
+
+static int
+hestia_backend_set_option(void *backend, unsigned int option, const void *data,
+                          size_t data_size)
+{
+    struct hestia_backend *hestia = backend;
+    size_t concurrency;
+
+    switch (option) {
+    case RBH_HBO_CONCURRENCY:
+        if (data_size != sizeof(concurrency)) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        memcpy(&concurrency, data, sizeof(concurrency));
+        if (concurrency == 0 || concurrency > RBH_HESTIA_MAX_CONCURRENCY) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        hestia->concurrency = concurrency;
+        return 0;
+    }
+
+    errno = ENOPROTOOPT;
+    return -1;
+}
+
     /*--------------------------------------------------------------------*
      |                              filter()                              |
      *--------------------------------------------------------------------*/
@@ -416,7 +683,7 @@ hestia_backend_filter(void *backend, const struct rbh_filter *filter,
         return NULL;
     }
 
-    hestia_iter = hestia->iter_new();
+    hestia_iter = hestia->iter_new(hestia->concurrency);
     if (hestia_iter == NULL)
         return NULL;
 
@@ -437,6 +704,8 @@ hestia_backend_destroy(void *backend)
 }
 
 static const struct rbh_backend_operations HESTIA_BACKEND_OPS = {
+    .get_option = hestia_backend_get_option,
+    .set_option = hestia_backend_set_option,
     .filter = hestia_backend_filter,
     .destroy = hestia_backend_destroy,
 };
@@ -457,6 +726,7 @@ rbh_hestia_backend_new(__attribute__((unused)) const char *path)
         return NULL;
 
     hestia->iter_new = hestia_iterator_new;
+    hestia->concurrency = DEFAULT_CONCURRENCY;
     hestia->backend = HESTIA_BACKEND;
 
     hestia_initialize("/etc/hestia/hestiad.yaml", NULL, NULL);
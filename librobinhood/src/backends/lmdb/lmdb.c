@@ -0,0 +1,2771 @@
+/* This file is part of RobinHood 4
+ * Copyright (C) 2024 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: LGPL-3.0-or-later
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+
+#include <lmdb.h>
+
+#include "robinhood/backends/lmdb.h"
+#include "robinhood/filter.h"
+#include "robinhood/fsentry.h"
+#include "robinhood/fsevent.h"
+#include "robinhood/hashmap.h"
+#include "robinhood/id.h"
+#include "robinhood/iterator.h"
+#include "robinhood/sstack.h"
+#include "robinhood/statx.h"
+#include "robinhood/value.h"
+
+/*----------------------------------------------------------------------------*
+ |                                  catalog                                   |
+ *----------------------------------------------------------------------------*/
+
+/* The catalog is made of four databases:
+ *   - entries: id -> record (cf. the records section);
+ *   - parents: parent id -> the id of every entry with a link in it;
+ *   - indexes: statx field + value -> the id of every entry with this value;
+ *   - meta: the settings of the catalog.
+ *
+ * Parents and indexes are sorted-duplicates databases: each key maps to a
+ * sorted set of ids.
+ */
+
+#define LMDB_DEFAULT_INDEXES (RBH_STATX_SIZE | RBH_STATX_ATIME_SEC \
+                            | RBH_STATX_MTIME_SEC | RBH_STATX_CTIME_SEC)
+#define LMDB_DEFAULT_BATCH_SIZE 4096
+#define LMDB_DEFAULT_MAP_SIZE ((size_t)1 << 36)
+
+/* Records are decoded on an sstack, arrays of pairs/values/links have to fit
+ * in one of its chunks
+ */
+#define LMDB_SCRATCH_SIZE (1 << 18)
+
+struct lmdb_catalog {
+    unsigned int refcount;
+    MDB_env *env;
+    MDB_dbi entries;
+    MDB_dbi parents;
+    MDB_dbi indexes;
+    MDB_dbi meta;
+    uint32_t indexed;
+    size_t batch_size;
+    size_t map_size;
+};
+
+static const char INDEXES_KEY[] = "indexes";
+
+/* Convert an error code of LMDB to an errno value */
+static int
+lmdb_error(int rc)
+{
+    switch (rc) {
+    case MDB_NOTFOUND:
+        errno = ENOENT;
+        break;
+    case MDB_KEYEXIST:
+        errno = EEXIST;
+        break;
+    case MDB_MAP_FULL:
+    case MDB_TXN_FULL:
+        errno = ENOSPC;
+        break;
+    case MDB_BAD_VALSIZE:
+        errno = EINVAL;
+        break;
+    case MDB_READERS_FULL:
+        errno = EAGAIN;
+        break;
+    default:
+        /* Other errors of LMDB are negative, system errors are positive */
+        errno = rc > 0 ? rc : EIO;
+        break;
+    }
+    return -1;
+}
+
+static MDB_val
+id2val(const struct rbh_id *id)
+{
+    return (MDB_val){
+        .mv_size = id->size,
+        .mv_data = (void *)id->data,
+    };
+}
+
+static void
+val2id(const MDB_val *val, struct rbh_id *id)
+{
+    id->data = val->mv_data;
+    id->size = val->mv_size;
+}
+
+/*----------------------------------------------------------------------------*
+ |                                  records                                   |
+ *----------------------------------------------------------------------------*/
+
+/* A record holds the inode attributes of an fsentry and each of its links, in
+ * the host's byte order:
+ *   - a version (u8);
+ *   - whether the record has a statx (u8), followed by a struct rbh_statx;
+ *   - a symlink (string);
+ *   - inode xattrs (map);
+ *   - a number of links (u64), followed by each link's parent id (buffer),
+ *     name (string), and namespace xattrs (map).
+ *
+ * Buffers are a size (u64) followed by as many bytes, strings are buffers
+ * that include their terminating '\0' (NULL is encoded as an empty buffer).
+ *
+ * Records are decoded in place: strings and binaries of decoded records point
+ * into the encoded record, only arrays (of pairs, values, and links) are
+ * allocated, on an sstack.
+ */
+
+#define LMDB_RECORD_VERSION 1
+
+struct lmdb_link {
+    struct rbh_id parent_id;
+    const char *name;
+    struct rbh_value_map xattrs;
+};
+
+struct lmdb_record {
+    struct rbh_id id;
+    bool has_statx;
+    struct rbh_statx statx;
+    const char *symlink;
+    struct rbh_value_map xattrs;
+    struct lmdb_link *links;
+    size_t link_count;
+};
+
+static void
+record_init(struct lmdb_record *record, const struct rbh_id *id)
+{
+    memset(record, 0, sizeof(*record));
+    record->id = *id;
+}
+
+    /*--------------------------------------------------------------------*
+     |                              encoding                              |
+     *--------------------------------------------------------------------*/
+
+struct writer {
+    char *data;
+    size_t length;
+    size_t size;
+};
+
+static bool
+write_bytes(struct writer *writer, const void *data, size_t size)
+{
+    if (size == 0)
+        return true;
+
+    if (writer->size - writer->length < size) {
+        size_t new_size = writer->size ? writer->size : 256;
+        char *tmp;
+
+        while (new_size - writer->length < size)
+            new_size *= 2;
+
+        tmp = realloc(writer->data, new_size);
+        if (tmp == NULL)
+            return false;
+
+        writer->data = tmp;
+        writer->size = new_size;
+    }
+
+    memcpy(writer->data + writer->length, data, size);
+    writer->length += size;
+    return true;
+}
+
+static bool
+write_u64(struct writer *writer, uint64_t u64)
+{
+    return write_bytes(writer, &u64, sizeof(u64));
+}
+
+static bool
+write_u8(struct writer *writer, uint8_t u8)
+{
+    return write_bytes(writer, &u8, sizeof(u8));
+}
+
+static bool
+write_buffer(struct writer *writer, const void *data, size_t size)
+{
+    return write_u64(writer, size) && write_bytes(writer, data, size);
+}
+
+static bool
+write_string(struct writer *writer, const char *string)
+{
+    return write_buffer(writer, string, string ? strlen(string) + 1 : 0);
+}
+
+static bool
+write_value(struct writer *writer, const struct rbh_value *value);
+
+static bool
+write_map(struct writer *writer, const struct rbh_value_map *map)
+{
+    if (!write_u8(writer, RBH_VT_MAP) || !write_u64(writer, map->count))
+        return false;
+
+    for (size_t i = 0; i < map->count; i++) {
+        const struct rbh_value_pair *pair = &map->pairs[i];
+
+        if (!write_string(writer, pair->key)
+         || !write_u8(writer, pair->value != NULL)
+         || (pair->value && !write_value(writer, pair->value)))
+            return false;
+    }
+    return true;
+}
+
+static bool
+write_value(struct writer *writer, const struct rbh_value *value)
+{
+    if (value->type == RBH_VT_MAP)
+        return write_map(writer, &value->map);
+
+    if (!write_u8(writer, value->type))
+        return false;
+
+    switch (value->type) {
+    case RBH_VT_BOOLEAN:
+        return write_u8(writer, value->boolean);
+    case RBH_VT_INT32:
+        return write_bytes(writer, &value->int32, sizeof(value->int32));
+    case RBH_VT_UINT32:
+        return write_bytes(writer, &value->uint32, sizeof(value->uint32));
+    case RBH_VT_INT64:
+        return write_bytes(writer, &value->int64, sizeof(value->int64));
+    case RBH_VT_UINT64:
+        return write_u64(writer, value->uint64);
+    case RBH_VT_STRING:
+        return write_string(writer, value->string);
+    case RBH_VT_BINARY:
+        return write_buffer(writer, value->binary.data, value->binary.size);
+    case RBH_VT_REGEX:
+        return write_string(writer, value->regex.string)
+            && write_u64(writer, value->regex.options);
+    case RBH_VT_SEQUENCE:
+        if (!write_u64(writer, value->sequence.count))
+            return false;
+        for (size_t i = 0; i < value->sequence.count; i++) {
+            if (!write_value(writer, &value->sequence.values[i]))
+                return false;
+        }
+        return true;
+    case RBH_VT_MAP:
+        break;
+    }
+
+    errno = EINVAL;
+    return false;
+}
+
+static bool
+write_record(struct writer *writer, const struct lmdb_record *record)
+{
+    writer->length = 0;
+
+    if (!write_u8(writer, LMDB_RECORD_VERSION)
+     || !write_u8(writer, record->has_statx)
+     || (record->has_statx
+      && !write_bytes(writer, &record->statx, sizeof(record->statx)))
+     || !write_string(writer, record->symlink)
+     || !write_map(writer, &record->xattrs)
+     || !write_u64(writer, record->link_count))
+        return false;
+
+    for (size_t i = 0; i < record->link_count; i++) {
+        const struct lmdb_link *link = &record->links[i];
+
+        if (!write_buffer(writer, link->parent_id.data, link->parent_id.size)
+         || !write_string(writer, link->name)
+         || !write_map(writer, &link->xattrs))
+            return false;
+    }
+
+    return true;
+}
+
+    /*--------------------------------------------------------------------*
+     |                              decoding                              |
+     *--------------------------------------------------------------------*/
+
+struct cursor {
+    const char *data;
+    size_t size;
+};
+
+static const void *
+load_bytes(struct cursor *cursor, size_t size)
+{
+    const char *data = cursor->data;
+
+    if (size > cursor->size) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    cursor->data += size;
+    cursor->size -= size;
+    return data;
+}
+
+static int
+load_u64(struct cursor *cursor, uint64_t *u64)
+{
+    const void *data = load_bytes(cursor, sizeof(*u64));
+
+    if (data == NULL)
+        return -1;
+    memcpy(u64, data, sizeof(*u64));
+    return 0;
+}
+
+static int
+load_u8(struct cursor *cursor, uint8_t *u8)
+{
+    const uint8_t *data = load_bytes(cursor, sizeof(*u8));
+
+    if (data == NULL)
+        return -1;
+    *u8 = *data;
+    return 0;
+}
+
+static int
+load_buffer(struct cursor *cursor, const char **data, size_t *size)
+{
+    uint64_t u64;
+
+    if (load_u64(cursor, &u64))
+        return -1;
+
+    *data = load_bytes(cursor, u64);
+    if (*data == NULL)
+        return -1;
+
+    *size = u64;
+    return 0;
+}
+
+static int
+load_string(struct cursor *cursor, const char **string)
+{
+    size_t size;
+
+    if (load_buffer(cursor, string, &size))
+        return -1;
+
+    if (size == 0) {
+        *string = NULL;
+        return 0;
+    }
+
+    if ((*string)[size - 1] != '\0') {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+static void *
+scratch_array(struct rbh_sstack *scratch, uint64_t count, size_t size)
+{
+    if (count > LMDB_SCRATCH_SIZE / size) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return rbh_sstack_push(scratch, NULL, count * size);
+}
+
+static void
+scratch_clear(struct rbh_sstack *scratch)
+{
+    while (true) {
+        size_t readable;
+        int rc;
+
+        rbh_sstack_peek(scratch, &readable);
+        if (readable == 0)
+            break;
+
+        rc = rbh_sstack_pop(scratch, readable);
+        assert(rc == 0);
+        (void)rc;
+    }
+}
+
+static int
+load_value(struct cursor *cursor, struct rbh_sstack *scratch,
+           struct rbh_value *value);
+
+static int
+load_map(struct cursor *cursor, struct rbh_sstack *scratch,
+         struct rbh_value_map *map)
+{
+    struct rbh_value_pair *pairs;
+    uint64_t count;
+
+    if (load_u64(cursor, &count))
+        return -1;
+
+    map->pairs = NULL;
+    map->count = 0;
+    if (count == 0)
+        return 0;
+
+    pairs = scratch_array(scratch, count, sizeof(*pairs));
+    if (pairs == NULL)
+        return -1;
+
+    for (size_t i = 0; i < count; i++) {
+        struct rbh_value *value;
+        uint8_t has_value;
+
+        if (load_string(cursor, &pairs[i].key) || load_u8(cursor, &has_value))
+            return -1;
+
+        if (pairs[i].key == NULL) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        pairs[i].value = NULL;
+        if (!has_value)
+            continue;
+
+        value = scratch_array(scratch, 1, sizeof(*value));
+        if (value == NULL || load_value(cursor, scratch, value))
+            return -1;
+        pairs[i].value = value;
+    }
+
+    map->pairs = pairs;
+    map->count = count;
+    return 0;
+}
+
+static int
+load_sequence(struct cursor *cursor, struct rbh_sstack *scratch,
+              struct rbh_value *value)
+{
+    struct rbh_value *values;
+    uint64_t count;
+
+    if (load_u64(cursor, &count))
+        return -1;
+
+    value->sequence.values = NULL;
+    value->sequence.count = 0;
+    if (count == 0)
+        return 0;
+
+    values = scratch_array(scratch, count, sizeof(*values));
+    if (values == NULL)
+        return -1;
+
+    for (size_t i = 0; i < count; i++) {
+        if (load_value(cursor, scratch, &values[i]))
+            return -1;
+    }
+
+    value->sequence.values = values;
+    value->sequence.count = count;
+    return 0;
+}
+
+static int
+load_value(struct cursor *cursor, struct rbh_sstack *scratch,
+           struct rbh_value *value)
+{
+    const void *data;
+    uint64_t options;
+    uint8_t type;
+    uint8_t u8;
+
+    if (load_u8(cursor, &type))
+        return -1;
+
+    value->type = type;
+    switch (type) {
+    case RBH_VT_BOOLEAN:
+        if (load_u8(cursor, &u8))
+            return -1;
+        value->boolean = u8;
+        return 0;
+    case RBH_VT_INT32:
+    case RBH_VT_UINT32:
+        data = load_bytes(cursor, sizeof(value->int32));
+        if (data == NULL)
+            return -1;
+        memcpy(&value->int32, data, sizeof(value->int32));
+        return 0;
+    case RBH_VT_INT64:
+    case RBH_VT_UINT64:
+        data = load_bytes(cursor, sizeof(value->int64));
+        if (data == NULL)
+            return -1;
+        memcpy(&value->int64, data, sizeof(value->int64));
+        return 0;
+    case RBH_VT_STRING:
+        if (load_string(cursor, &value->string))
+            return -1;
+        break;
+    case RBH_VT_BINARY:
+        return load_buffer(cursor, &value->binary.data, &value->binary.size);
+    case RBH_VT_REGEX:
+        if (load_string(cursor, &value->regex.string)
+         || load_u64(cursor, &options))
+            return -1;
+        value->regex.options = options;
+        break;
+    case RBH_VT_SEQUENCE:
+        return load_sequence(cursor, scratch, value);
+    case RBH_VT_MAP:
+        return load_map(cursor, scratch, &value->map);
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Strings and regexes cannot be NULL */
+    if (value->string == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+static int
+load_xattrs(struct cursor *cursor, struct rbh_sstack *scratch,
+            struct rbh_value_map *xattrs)
+{
+    uint8_t type;
+
+    if (load_u8(cursor, &type))
+        return -1;
+
+    if (type != RBH_VT_MAP) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return load_map(cursor, scratch, xattrs);
+}
+
+/* Only decode whether a record has a statx, and the statx itself */
+static int
+load_record_statx(struct cursor *cursor, struct lmdb_record *record)
+{
+    const struct rbh_statx *statx;
+    uint8_t version;
+    uint8_t u8;
+
+    if (load_u8(cursor, &version) || load_u8(cursor, &u8))
+        return -1;
+
+    if (version != LMDB_RECORD_VERSION) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    record->has_statx = u8;
+    if (!record->has_statx)
+        return 0;
+
+    statx = load_bytes(cursor, sizeof(*statx));
+    if (statx == NULL)
+        return -1;
+
+    /* Records are not aligned in the map */
+    memcpy(&record->statx, statx, sizeof(*statx));
+    return 0;
+}
+
+static int
+load_record(const MDB_val *key, const MDB_val *data,
+            struct rbh_sstack *scratch, struct lmdb_record *record)
+{
+    struct cursor cursor = {
+        .data = data->mv_data,
+        .size = data->mv_size,
+    };
+    struct lmdb_link *links = NULL;
+    uint64_t count;
+
+    val2id(key, &record->id);
+    if (load_record_statx(&cursor, record)
+     || load_string(&cursor, &record->symlink)
+     || load_xattrs(&cursor, scratch, &record->xattrs)
+     || load_u64(&cursor, &count))
+        return -1;
+
+    if (count > 0) {
+        links = scratch_array(scratch, count, sizeof(*links));
+        if (links == NULL)
+            return -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        struct lmdb_link *link = &links[i];
+
+        if (load_buffer(&cursor, &link->parent_id.data, &link->parent_id.size)
+         || load_string(&cursor, &link->name)
+         || load_xattrs(&cursor, scratch, &link->xattrs))
+            return -1;
+
+        if (link->name == NULL) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    record->links = links;
+    record->link_count = count;
+    return 0;
+}
+
+/*----------------------------------------------------------------------------*
+ |                                    keys                                    |
+ *----------------------------------------------------------------------------*/
+
+/* LMDB does not support empty keys, and the parent id of a root is empty: keys
+ * of the parents database are prefixed with a byte.
+ */
+#define LMDB_PARENT_PREFIX 'p'
+
+static bool
+parent_key(struct writer *writer, const struct rbh_id *parent_id, MDB_val *key)
+{
+    writer->length = 0;
+    if (!write_u8(writer, LMDB_PARENT_PREFIX)
+     || !write_bytes(writer, parent_id->data, parent_id->size))
+        return false;
+
+    key->mv_data = writer->data;
+    key->mv_size = writer->length;
+    return true;
+}
+
+/* Keys of the indexes database are the position of a statx field in the
+ * RBH_STATX_* masks, followed by the value of the field as a big-endian
+ * integer, made unsigned so that keys sort like values.
+ */
+#define LMDB_INDEX_KEY_SIZE 9
+
+static bool
+is_signed_field(uint32_t field)
+{
+    return field & (RBH_STATX_ATIME_SEC | RBH_STATX_BTIME_SEC
+                  | RBH_STATX_CTIME_SEC | RBH_STATX_MTIME_SEC);
+}
+
+static uint64_t
+signed2key(int64_t value)
+{
+    return (uint64_t)value ^ (UINT64_C(1) << 63);
+}
+
+static uint64_t
+statx_field2key(const struct rbh_statx *statx, uint32_t field)
+{
+    switch (field) {
+    case RBH_STATX_TYPE:
+        return statx->stx_mode & S_IFMT;
+    case RBH_STATX_MODE:
+        return statx->stx_mode & ~S_IFMT;
+    case RBH_STATX_NLINK:
+        return statx->stx_nlink;
+    case RBH_STATX_UID:
+        return statx->stx_uid;
+    case RBH_STATX_GID:
+        return statx->stx_gid;
+    case RBH_STATX_ATIME_SEC:
+        return signed2key(statx->stx_atime.tv_sec);
+    case RBH_STATX_MTIME_SEC:
+        return signed2key(statx->stx_mtime.tv_sec);
+    case RBH_STATX_CTIME_SEC:
+        return signed2key(statx->stx_ctime.tv_sec);
+    case RBH_STATX_INO:
+        return statx->stx_ino;
+    case RBH_STATX_SIZE:
+        return statx->stx_size;
+    case RBH_STATX_BLOCKS:
+        return statx->stx_blocks;
+    case RBH_STATX_BTIME_SEC:
+        return signed2key(statx->stx_btime.tv_sec);
+    case RBH_STATX_MNT_ID:
+        return statx->stx_mnt_id;
+    case RBH_STATX_BLKSIZE:
+        return statx->stx_blksize;
+    case RBH_STATX_ATTRIBUTES:
+        return statx->stx_attributes;
+    case RBH_STATX_ATIME_NSEC:
+        return statx->stx_atime.tv_nsec;
+    case RBH_STATX_BTIME_NSEC:
+        return statx->stx_btime.tv_nsec;
+    case RBH_STATX_CTIME_NSEC:
+        return statx->stx_ctime.tv_nsec;
+    case RBH_STATX_MTIME_NSEC:
+        return statx->stx_mtime.tv_nsec;
+    case RBH_STATX_RDEV_MAJOR:
+        return statx->stx_rdev_major;
+    case RBH_STATX_RDEV_MINOR:
+        return statx->stx_rdev_minor;
+    case RBH_STATX_DEV_MAJOR:
+        return statx->stx_dev_major;
+    case RBH_STATX_DEV_MINOR:
+        return statx->stx_dev_minor;
+    }
+
+    return 0;
+}
+
+/* The smallest key of \p field's index that a value greater than or equal to
+ * \p value may have
+ */
+static uint64_t
+value2key(const struct rbh_value *value, uint32_t field)
+{
+    bool negative = false;
+    uint64_t u64 = 0;
+    int64_t i64 = 0;
+
+    switch (value->type) {
+    case RBH_VT_INT32:
+        i64 = value->int32;
+        negative = i64 < 0;
+        u64 = i64;
+        break;
+    case RBH_VT_INT64:
+        i64 = value->int64;
+        negative = i64 < 0;
+        u64 = i64;
+        break;
+    case RBH_VT_UINT32:
+        u64 = value->uint32;
+        i64 = u64;
+        break;
+    case RBH_VT_UINT64:
+        u64 = value->uint64;
+        i64 = u64 > INT64_MAX ? INT64_MAX : (int64_t)u64;
+        break;
+    default:
+        break;
+    }
+
+    if (is_signed_field(field))
+        return signed2key(i64);
+    return negative ? 0 : u64;
+}
+
+static void
+index_key(unsigned char key[LMDB_INDEX_KEY_SIZE], uint32_t field,
+          uint64_t value)
+{
+    key[0] = __builtin_ctz(field);
+    for (int i = 8; i > 0; i--) {
+        key[i] = value & 0xff;
+        value >>= 8;
+    }
+}
+
+static bool
+record_index_key(const struct lmdb_record *record, uint32_t field,
+                 unsigned char key[LMDB_INDEX_KEY_SIZE])
+{
+    if (record == NULL || !record->has_statx
+     || !(record->statx.stx_mask & field))
+        return false;
+
+    index_key(key, field, statx_field2key(&record->statx, field));
+    return true;
+}
+
+/*----------------------------------------------------------------------------*
+ |                                   update                                   |
+ *----------------------------------------------------------------------------*/
+
+struct lmdb_update {
+    struct lmdb_catalog *catalog;
+    MDB_txn *txn;
+    struct rbh_sstack *scratch;
+    struct writer copy;             /* a copy of the record being updated */
+    struct writer record;           /* the updated record, encoded */
+    struct writer key;
+};
+
+static int
+update_put(struct lmdb_update *update, MDB_dbi dbi, MDB_val *key,
+           MDB_val *data, unsigned int flags)
+{
+    int rc = mdb_put(update->txn, dbi, key, data, flags);
+
+    /* MDB_NODUPDATA makes putting an existing duplicate fail */
+    if (rc == MDB_KEYEXIST && (flags & MDB_NODUPDATA))
+        return 0;
+    return rc ? lmdb_error(rc) : 0;
+}
+
+static int
+update_del(struct lmdb_update *update, MDB_dbi dbi, MDB_val *key,
+           MDB_val *data)
+{
+    int rc = mdb_del(update->txn, dbi, key, data);
+
+    return rc && rc != MDB_NOTFOUND ? lmdb_error(rc) : 0;
+}
+
+/* Fetch the record of \p id, or initialize an empty one
+ *
+ * @return          1 if the record exists, 0 if it does not, -1 on error
+ */
+static int
+update_fetch(struct lmdb_update *update, const struct rbh_id *id,
+             struct lmdb_record *record)
+{
+    MDB_val key = id2val(id);
+    MDB_val data;
+    int rc;
+
+    rc = mdb_get(update->txn, update->catalog->entries, &key, &data);
+    if (rc == MDB_NOTFOUND) {
+        record_init(record, id);
+        return 0;
+    }
+    if (rc)
+        return lmdb_error(rc);
+
+    /* Writing to the database may move the record, decode a copy of it */
+    update->copy.length = 0;
+    if (!write_bytes(&update->copy, data.mv_data, data.mv_size))
+        return -1;
+    data.mv_data = update->copy.data;
+
+    if (load_record(&key, &data, update->scratch, record))
+        return -1;
+
+    record->id = *id;
+    return 1;
+}
+
+static bool
+record_has_parent(const struct lmdb_record *record,
+                  const struct rbh_id *parent_id)
+{
+    if (record == NULL)
+        return false;
+
+    for (size_t i = 0; i < record->link_count; i++) {
+        if (rbh_id_equal(&record->links[i].parent_id, parent_id))
+            return true;
+    }
+    return false;
+}
+
+/* Update the indexes from \p old to \p record (either may be NULL) */
+static int
+update_indexes(struct lmdb_update *update, const struct lmdb_record *old,
+               const struct lmdb_record *record, const struct rbh_id *id)
+{
+    uint32_t indexed = update->catalog->indexed;
+    MDB_val data = id2val(id);
+
+    while (indexed) {
+        unsigned char old_key[LMDB_INDEX_KEY_SIZE];
+        unsigned char new_key[LMDB_INDEX_KEY_SIZE];
+        uint32_t field = indexed & -indexed;
+        bool had, has;
+        MDB_val key;
+
+        indexed &= indexed - 1;
+        had = record_index_key(old, field, old_key);
+        has = record_index_key(record, field, new_key);
+        if (had && has && memcmp(old_key, new_key, sizeof(old_key)) == 0)
+            continue;
+
+        key.mv_size = LMDB_INDEX_KEY_SIZE;
+        key.mv_data = old_key;
+        if (had && update_del(update, update->catalog->indexes, &key, &data))
+            return -1;
+
+        key.mv_data = new_key;
+        if (has && update_put(update, update->catalog->indexes, &key, &data,
+                              MDB_NODUPDATA))
+            return -1;
+    }
+
+    return 0;
+}
+
+/* Update the parents database from \p old to \p record (either may be NULL) */
+static int
+update_parents(struct lmdb_update *update, const struct lmdb_record *old,
+               const struct lmdb_record *record, const struct rbh_id *id)
+{
+    MDB_dbi parents = update->catalog->parents;
+    MDB_val data = id2val(id);
+    MDB_val key;
+
+    for (size_t i = 0; old && i < old->link_count; i++) {
+        const struct rbh_id *parent_id = &old->links[i].parent_id;
+
+        if (record_has_parent(record, parent_id))
+            continue;
+
+        if (!parent_key(&update->key, parent_id, &key)
+         || update_del(update, parents, &key, &data))
+            return -1;
+    }
+
+    for (size_t i = 0; record && i < record->link_count; i++) {
+        const struct rbh_id *parent_id = &record->links[i].parent_id;
+
+        if (record_has_parent(old, parent_id))
+            continue;
+
+        if (!parent_key(&update->key, parent_id, &key)
+         || update_put(update, parents, &key, &data, MDB_NODUPDATA))
+            return -1;
+    }
+
+    return 0;
+}
+
+static int
+update_store(struct lmdb_update *update, const struct lmdb_record *old,
+             const struct lmdb_record *record)
+{
+    MDB_val key = id2val(&record->id);
+    MDB_val data;
+
+    if (!write_record(&update->record, record))
+        return -1;
+
+    data.mv_data = update->record.data;
+    data.mv_size = update->record.length;
+    if (update_put(update, update->catalog->entries, &key, &data, 0))
+        return -1;
+
+    if (update_indexes(update, old, record, &record->id))
+        return -1;
+    return update_parents(update, old, record, &record->id);
+}
+
+static bool
+update_sets(const struct rbh_value_map *update, size_t index)
+{
+    const char *key = update->pairs[index].key;
+
+    /* Only the last occurrence of a key is applied */
+    for (size_t i = index + 1; i < update->count; i++) {
+        if (strcmp(update->pairs[i].key, key) == 0)
+            return false;
+    }
+    return update->pairs[index].value != NULL;
+}
+
+static bool
+update_has_key(const struct rbh_value_map *update, const char *key)
+{
+    for (size_t i = 0; i < update->count; i++) {
+        if (strcmp(update->pairs[i].key, key) == 0)
+            return true;
+    }
+    return false;
+}
+
+/* Set (or unset, for NULL values) the xattrs of \p update in \p xattrs */
+static int
+xattrs_update(struct rbh_sstack *scratch, struct rbh_value_map *xattrs,
+              const struct rbh_value_map *update)
+{
+    struct rbh_value_pair *pairs;
+    size_t count = 0;
+
+    if (update->count == 0)
+        return 0;
+
+    pairs = scratch_array(scratch, xattrs->count + update->count,
+                          sizeof(*pairs));
+    if (pairs == NULL)
+        return -1;
+
+    for (size_t i = 0; i < xattrs->count; i++) {
+        if (!update_has_key(update, xattrs->pairs[i].key))
+            pairs[count++] = xattrs->pairs[i];
+    }
+
+    for (size_t i = 0; i < update->count; i++) {
+        if (update_sets(update, i))
+            pairs[count++] = update->pairs[i];
+    }
+
+    xattrs->pairs = pairs;
+    xattrs->count = count;
+    return 0;
+}
+
+static int
+record_copy_links(struct rbh_sstack *scratch, struct lmdb_record *record,
+                  size_t extra)
+{
+    struct lmdb_link *links;
+
+    links = scratch_array(scratch, record->link_count + extra, sizeof(*links));
+    if (links == NULL)
+        return -1;
+
+    if (record->link_count > 0)
+        memcpy(links, record->links, record->link_count * sizeof(*links));
+    record->links = links;
+    return 0;
+}
+
+static ssize_t
+record_find_link(const struct lmdb_record *record,
+                 const struct rbh_id *parent_id, const char *name)
+{
+    for (size_t i = 0; i < record->link_count; i++) {
+        const struct lmdb_link *link = &record->links[i];
+
+        if (rbh_id_equal(&link->parent_id, parent_id)
+         && strcmp(link->name, name) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+static void
+record_remove_link(struct lmdb_record *record, size_t index)
+{
+    record->links[index] = record->links[--record->link_count];
+}
+
+static int
+lmdb_upsert(struct lmdb_update *update, const struct rbh_fsevent *fsevent)
+{
+    const struct rbh_statx *statx = fsevent->upsert.statx;
+    struct lmdb_record old, record;
+    int found;
+
+    found = update_fetch(update, &fsevent->id, &old);
+    if (found < 0)
+        return -1;
+    record = old;
+
+    if (statx) {
+        if (!record.has_statx) {
+            memset(&record.statx, 0, sizeof(record.statx));
+            record.has_statx = true;
+        }
+
+        /* merge_statx() combines the bits of the type and the mode */
+        if (statx->stx_mask & RBH_STATX_TYPE)
+            record.statx.stx_mode &= ~S_IFMT;
+        if (statx->stx_mask & RBH_STATX_MODE)
+            record.statx.stx_mode &= S_IFMT;
+
+        merge_statx(&record.statx, statx);
+    }
+
+    if (fsevent->upsert.symlink)
+        record.symlink = fsevent->upsert.symlink;
+
+    if (xattrs_update(update->scratch, &record.xattrs, &fsevent->xattrs))
+        return -1;
+
+    return update_store(update, found ? &old : NULL, &record);
+}
+
+static int
+lmdb_link(struct lmdb_update *update, const struct rbh_fsevent *fsevent)
+{
+    struct lmdb_record old, record;
+    ssize_t index;
+    int found;
+
+    found = update_fetch(update, &fsevent->id, &old);
+    if (found < 0)
+        return -1;
+
+    record = old;
+    if (record_copy_links(update->scratch, &record, 1))
+        return -1;
+
+    /* Like the mongo backend, replace any link with the same parent and name */
+    index = record_find_link(&record, fsevent->link.parent_id,
+                             fsevent->link.name);
+    if (index >= 0)
+        record_remove_link(&record, index);
+
+    record.links[record.link_count++] = (struct lmdb_link){
+        .parent_id = *fsevent->link.parent_id,
+        .name = fsevent->link.name,
+        .xattrs = fsevent->xattrs,
+    };
+
+    return update_store(update, found ? &old : NULL, &record);
+}
+
+static int
+lmdb_unlink(struct lmdb_update *update, const struct rbh_fsevent *fsevent)
+{
+    struct lmdb_record old, record;
+    ssize_t index;
+    int found;
+
+    found = update_fetch(update, &fsevent->id, &old);
+    if (found <= 0)
+        return found;
+
+    index = record_find_link(&old, fsevent->link.parent_id,
+                             fsevent->link.name);
+    if (index < 0)
+        return 0;
+
+    record = old;
+    if (record_copy_links(update->scratch, &record, 0))
+        return -1;
+
+    record_remove_link(&record, index);
+    return update_store(update, &old, &record);
+}
+
+static int
+lmdb_delete(struct lmdb_update *update, const struct rbh_fsevent *fsevent)
+{
+    MDB_val key = id2val(&fsevent->id);
+    struct lmdb_record old;
+    int found;
+
+    found = update_fetch(update, &fsevent->id, &old);
+    if (found <= 0)
+        return found;
+
+    if (update_del(update, update->catalog->entries, &key, NULL))
+        return -1;
+
+    if (update_indexes(update, &old, NULL, &fsevent->id))
+        return -1;
+    return update_parents(update, &old, NULL, &fsevent->id);
+}
+
+static int
+lmdb_xattr(struct lmdb_update *update, const struct rbh_fsevent *fsevent)
+{
+    struct lmdb_record old, record;
+    struct rbh_value_map *xattrs;
+    ssize_t index;
+    int found;
+
+    found = update_fetch(update, &fsevent->id, &old);
+    if (found <= 0)
+        return found;
+
+    record = old;
+    if (fsevent->ns.parent_id == NULL) {
+        xattrs = &record.xattrs;
+    } else {
+        index = record_find_link(&old, fsevent->ns.parent_id, fsevent->ns.name);
+        if (index < 0)
+            return 0;
+
+        if (record_copy_links(update->scratch, &record, 0))
+            return -1;
+        xattrs = &record.links[index].xattrs;
+    }
+
+    if (xattrs_update(update->scratch, xattrs, &fsevent->xattrs))
+        return -1;
+
+    return update_store(update, &old, &record);
+}
+
+static int
+lmdb_apply(struct lmdb_update *update, const struct rbh_fsevent *fsevent)
+{
+    switch (fsevent->type) {
+    case RBH_FET_UPSERT:
+        return lmdb_upsert(update, fsevent);
+    case RBH_FET_LINK:
+        return lmdb_link(update, fsevent);
+    case RBH_FET_UNLINK:
+        return lmdb_unlink(update, fsevent);
+    case RBH_FET_DELETE:
+        return lmdb_delete(update, fsevent);
+    case RBH_FET_XATTR:
+        return lmdb_xattr(update, fsevent);
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+static void
+update_fini(struct lmdb_update *update)
+{
+    free(update->key.data);
+    free(update->record.data);
+    free(update->copy.data);
+    rbh_sstack_destroy(update->scratch);
+}
+
+static ssize_t
+catalog_update(struct lmdb_catalog *catalog, struct rbh_iterator *fsevents,
+               bool skip_error)
+{
+    struct lmdb_update update = {
+        .catalog = catalog,
+    };
+    int save_errno = errno;
+    size_t pending = 0;
+    size_t count = 0;
+    int rc;
+
+    update.scratch = rbh_sstack_new(LMDB_SCRATCH_SIZE);
+    if (update.scratch == NULL)
+        return -1;
+
+    do {
+        const struct rbh_fsevent *fsevent;
+
+        errno = 0;
+        fsevent = rbh_iter_next(fsevents);
+        if (fsevent == NULL) {
+            if (errno == ENODATA)
+                break;
+
+            /* Same as the mongo backend: entries that disappeared while they
+             * were being enriched are skipped
+             */
+            if (skip_error && (errno == ESTALE || errno == ENOENT))
+                continue;
+            goto out_abort;
+        }
+
+        if (update.txn == NULL) {
+            rc = mdb_txn_begin(catalog->env, NULL, 0, &update.txn);
+            if (rc) {
+                update.txn = NULL;
+                lmdb_error(rc);
+                goto out_abort;
+            }
+        }
+
+        rc = lmdb_apply(&update, fsevent);
+        scratch_clear(update.scratch);
+        if (rc)
+            goto out_abort;
+        count++;
+
+        if (++pending != catalog->batch_size)
+            continue;
+
+        /* mdb_txn_commit() frees the transaction, even when it fails */
+        rc = mdb_txn_commit(update.txn);
+        update.txn = NULL;
+        pending = 0;
+        if (rc) {
+            lmdb_error(rc);
+            goto out_abort;
+        }
+    } while (true);
+
+    if (update.txn) {
+        rc = mdb_txn_commit(update.txn);
+        update.txn = NULL;
+        if (rc) {
+            lmdb_error(rc);
+            goto out_abort;
+        }
+    }
+
+    update_fini(&update);
+    errno = save_errno;
+    return count;
+
+out_abort:
+    save_errno = errno;
+    /* The fsevents applied since the last commit are lost */
+    if (update.txn)
+        mdb_txn_abort(update.txn);
+    update_fini(&update);
+    errno = save_errno;
+    return -1;
+}
+
+/*----------------------------------------------------------------------------*
+ |                                  fsentry                                   |
+ *----------------------------------------------------------------------------*/
+
+/* A struct rbh_fsentry that points into a record (plus a copy of the symlink),
+ * which filters are evaluated on
+ */
+struct lmdb_view {
+    struct rbh_fsentry *fsentry;
+    size_t size;
+};
+
+static const struct rbh_fsentry *
+view_fill(struct lmdb_view *view, const struct lmdb_record *record,
+          const struct lmdb_link *link)
+{
+    size_t size = sizeof(*view->fsentry);
+    struct rbh_fsentry *fsentry;
+
+    if (record->symlink)
+        size += strlen(record->symlink) + 1;
+
+    if (size > view->size) {
+        fsentry = realloc(view->fsentry, size);
+        if (fsentry == NULL)
+            return NULL;
+
+        view->fsentry = fsentry;
+        view->size = size;
+    }
+
+    fsentry = view->fsentry;
+    fsentry->mask = RBH_FP_ID | RBH_FP_PARENT_ID | RBH_FP_NAME
+                  | RBH_FP_NAMESPACE_XATTRS | RBH_FP_INODE_XATTRS;
+    fsentry->id = record->id;
+    fsentry->parent_id = link->parent_id;
+    fsentry->name = link->name;
+    fsentry->xattrs.ns = link->xattrs;
+    fsentry->xattrs.inode = record->xattrs;
+
+    fsentry->statx = record->has_statx ? &record->statx : NULL;
+    if (record->has_statx)
+        fsentry->mask |= RBH_FP_STATX;
+
+    if (record->symlink) {
+        strcpy(fsentry->symlink, record->symlink);
+        fsentry->mask |= RBH_FP_SYMLINK;
+    }
+
+    return fsentry;
+}
+
+/* Keep the xattrs of \p xattrs whose key is in \p keys (every one of them if
+ * \p keys is NULL or empty)
+ */
+static struct rbh_value_map
+xattrs_project(const struct rbh_value_map *xattrs, const struct rbh_value *keys,
+               struct rbh_value_pair *pairs)
+{
+    struct rbh_value_map map = {};
+
+    if (keys == NULL || keys->map.count == 0)
+        return *xattrs;
+
+    map.pairs = pairs;
+    for (size_t i = 0; i < xattrs->count; i++) {
+        for (size_t j = 0; j < keys->map.count; j++) {
+            if (strcmp(xattrs->pairs[i].key, keys->map.pairs[j].key))
+                continue;
+
+            pairs[map.count++] = xattrs->pairs[i];
+            break;
+        }
+    }
+    return map;
+}
+
+struct lmdb_projection {
+    unsigned int fsentry_mask;
+    unsigned int statx_mask;
+    struct rbh_value *ns;           /* the keys of ns xattrs to keep */
+    struct rbh_value *inode;        /* the keys of inode xattrs to keep */
+};
+
+static const struct lmdb_projection PROJECT_ALL = {
+    .fsentry_mask = RBH_FP_ALL,
+    .statx_mask = UINT32_MAX,
+};
+
+static int
+projection_init(struct lmdb_projection *dest,
+                const struct rbh_filter_projection *src)
+{
+    dest->fsentry_mask = src->fsentry_mask;
+    dest->statx_mask = src->statx_mask;
+
+    dest->ns = rbh_value_map_new(src->xattrs.ns.pairs, src->xattrs.ns.count);
+    if (dest->ns == NULL)
+        return -1;
+
+    dest->inode = rbh_value_map_new(src->xattrs.inode.pairs,
+                                    src->xattrs.inode.count);
+    if (dest->inode == NULL) {
+        int save_errno = errno;
+
+        free(dest->ns);
+        errno = save_errno;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+projection_fini(struct lmdb_projection *projection)
+{
+    free(projection->inode);
+    free(projection->ns);
+}
+
+static struct rbh_fsentry *
+fsentry_project(const struct rbh_fsentry *fsentry,
+                const struct lmdb_projection *projection)
+{
+    unsigned int mask = projection->fsentry_mask & fsentry->mask;
+    struct rbh_value_map ns_xattrs, xattrs;
+    struct rbh_value_pair *pairs;
+    struct rbh_fsentry *projected;
+    struct rbh_statx statx;
+    size_t count;
+
+    count = fsentry->xattrs.ns.count + fsentry->xattrs.inode.count;
+    pairs = reallocarray(NULL, count ? count : 1, sizeof(*pairs));
+    if (pairs == NULL)
+        return NULL;
+
+    ns_xattrs = xattrs_project(&fsentry->xattrs.ns, projection->ns, pairs);
+    xattrs = xattrs_project(&fsentry->xattrs.inode, projection->inode,
+                            pairs + ns_xattrs.count);
+
+    if (mask & RBH_FP_STATX) {
+        statx = *fsentry->statx;
+        statx.stx_mask &= projection->statx_mask;
+    }
+
+    projected = rbh_fsentry_new(
+            mask & RBH_FP_ID ? &fsentry->id : NULL,
+            mask & RBH_FP_PARENT_ID ? &fsentry->parent_id : NULL,
+            mask & RBH_FP_NAME ? fsentry->name : NULL,
+            mask & RBH_FP_STATX ? &statx : NULL,
+            mask & RBH_FP_NAMESPACE_XATTRS ? &ns_xattrs : NULL,
+            mask & RBH_FP_INODE_XATTRS ? &xattrs : NULL,
+            mask & RBH_FP_SYMLINK ? fsentry->symlink : NULL
+            );
+    free(pairs);
+    return projected;
+}
+
+/*----------------------------------------------------------------------------*
+ |                                   filter                                   |
+ *----------------------------------------------------------------------------*/
+
+/* How to enumerate the candidates of a filter, from cheapest to costliest */
+enum lmdb_plan_type {
+    LPT_ID,         /* lookup one record by id */
+    LPT_PARENT,     /* lookup the children of a parent */
+    LPT_INDEX,      /* walk a range of a statx index */
+    LPT_SUBTREE,    /* walk the records of a branch */
+    LPT_SCAN,       /* walk every record */
+};
+
+struct lmdb_plan {
+    enum lmdb_plan_type type;
+    const struct rbh_filter *filter; /* the comparison the plan relies on */
+};
+
+static bool
+is_id_comparison(const struct rbh_filter *filter)
+{
+    return filter->op == RBH_FOP_EQUAL
+        && filter->compare.value.type == RBH_VT_BINARY;
+}
+
+static bool
+is_range_comparison(const struct rbh_filter *filter)
+{
+    switch (filter->op) {
+    case RBH_FOP_EQUAL:
+    case RBH_FOP_STRICTLY_LOWER:
+    case RBH_FOP_LOWER_OR_EQUAL:
+    case RBH_FOP_STRICTLY_GREATER:
+    case RBH_FOP_GREATER_OR_EQUAL:
+        break;
+    default:
+        return false;
+    }
+
+    switch (filter->compare.value.type) {
+    case RBH_VT_INT32:
+    case RBH_VT_UINT32:
+    case RBH_VT_INT64:
+    case RBH_VT_UINT64:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static struct lmdb_plan
+plan_filter(uint32_t indexed, const struct rbh_filter *filter)
+{
+    struct lmdb_plan plan = {
+        .type = LPT_SCAN,
+    };
+
+    if (filter == NULL)
+        return plan;
+
+    if (filter->op == RBH_FOP_AND) {
+        for (size_t i = 0; i < filter->logical.count; i++) {
+            struct lmdb_plan candidate;
+
+            candidate = plan_filter(indexed, filter->logical.filters[i]);
+            if (candidate.type < plan.type)
+                plan = candidate;
+        }
+        return plan;
+    }
+
+    if (!rbh_is_comparison_operator(filter->op))
+        return plan;
+
+    switch (filter->compare.field.fsentry) {
+    case RBH_FP_ID:
+        if (is_id_comparison(filter))
+            plan = (struct lmdb_plan){ .type = LPT_ID, .filter = filter };
+        break;
+    case RBH_FP_PARENT_ID:
+        if (is_id_comparison(filter))
+            plan = (struct lmdb_plan){ .type = LPT_PARENT, .filter = filter };
+        break;
+    case RBH_FP_STATX:
+        if (__builtin_popcount(filter->compare.field.statx) == 1
+         && indexed & filter->compare.field.statx
+         && is_range_comparison(filter))
+            plan = (struct lmdb_plan){ .type = LPT_INDEX, .filter = filter };
+        break;
+    default:
+        break;
+    }
+
+    return plan;
+}
+
+    /*--------------------------------------------------------------------*
+     |                              subtree                               |
+     *--------------------------------------------------------------------*/
+
+/* The ids of the entries of a branch, the first one being its root */
+struct lmdb_subtree {
+    struct rbh_id **ids;
+    size_t count;
+    size_t size;
+    struct rbh_hashmap *set;        /* the same ids, for lookups */
+    size_t set_size;
+};
+
+/* Keep hashmaps at most 70% full (they use open addressing) */
+#define LMDB_MIN_SLOTS (1 << 10)
+
+static size_t
+slots_for(size_t count)
+{
+    size_t slots = count * 10 / 7 + 1;
+
+    return slots < LMDB_MIN_SLOTS ? LMDB_MIN_SLOTS : slots;
+}
+
+static size_t
+id_hash(const void *key)
+{
+    const struct rbh_id *id = key;
+    size_t hash = 5381;
+
+    /* djb2 */
+    for (size_t i = 0; i < id->size; i++)
+        hash = ((hash << 5) + hash) + (unsigned char)id->data[i];
+
+    return hash;
+}
+
+static bool
+id_equals(const void *first, const void *second)
+{
+    return rbh_id_equal(first, second);
+}
+
+static void
+subtree_destroy(struct lmdb_subtree *subtree)
+{
+    for (size_t i = 0; i < subtree->count; i++)
+        free(subtree->ids[i]);
+    free(subtree->ids);
+    if (subtree->set)
+        rbh_hashmap_destroy(subtree->set);
+    free(subtree);
+}
+
+/* rbh_hashmaps cannot be resized, they are rebuilt instead */
+static int
+subtree_grow(struct lmdb_subtree *subtree)
+{
+    struct rbh_hashmap *set;
+    size_t size;
+
+    if (subtree->count == subtree->size) {
+        size_t new_size = subtree->size ? 2 * subtree->size : 64;
+        struct rbh_id **ids;
+
+        ids = reallocarray(subtree->ids, new_size, sizeof(*ids));
+        if (ids == NULL)
+            return -1;
+
+        subtree->ids = ids;
+        subtree->size = new_size;
+    }
+
+    if (subtree->set && subtree->count + 1 <= subtree->set_size * 7 / 10)
+        return 0;
+
+    size = slots_for(2 * subtree->count);
+    set = rbh_hashmap_new(id_equals, id_hash, size);
+    if (set == NULL)
+        return -1;
+
+    for (size_t i = 0; i < subtree->count; i++) {
+        int rc = rbh_hashmap_set(set, subtree->ids[i], subtree->ids[i]);
+
+        assert(rc == 0);
+        (void)rc;
+    }
+
+    if (subtree->set)
+        rbh_hashmap_destroy(subtree->set);
+    subtree->set = set;
+    subtree->set_size = size;
+    return 0;
+}
+
+static bool
+subtree_has(struct lmdb_subtree *subtree, const struct rbh_id *id)
+{
+    return subtree->set && rbh_hashmap_get(subtree->set, id) != NULL;
+}
+
+static int
+subtree_add(struct lmdb_subtree *subtree, const struct rbh_id *id)
+{
+    struct rbh_id *copy;
+    int rc;
+
+    if (subtree_grow(subtree))
+        return -1;
+
+    copy = rbh_id_new(id->data, id->size);
+    if (copy == NULL)
+        return -1;
+
+    rc = rbh_hashmap_set(subtree->set, copy, copy);
+    assert(rc == 0);
+    (void)rc;
+
+    subtree->ids[subtree->count++] = copy;
+    return 0;
+}
+
+/* Collect the ids of the subtree rooted at \p root_id, breadth first */
+static struct lmdb_subtree *
+subtree_new(struct lmdb_catalog *catalog, MDB_txn *txn,
+            const struct rbh_id *root_id)
+{
+    struct lmdb_subtree *subtree;
+    struct writer writer = {};
+    MDB_cursor *cursor;
+    int save_errno;
+    MDB_val key;
+    int rc;
+
+    subtree = calloc(1, sizeof(*subtree));
+    if (subtree == NULL)
+        return NULL;
+
+    /* The root of a branch may come and go with updates, when it is missing
+     * the subtree is empty, and nothing matches
+     */
+    key = id2val(root_id);
+    rc = mdb_get(txn, catalog->entries, &key, &(MDB_val){});
+    if (rc == MDB_NOTFOUND)
+        return subtree;
+    if (rc) {
+        lmdb_error(rc);
+        goto out_destroy;
+    }
+
+    if (subtree_add(subtree, root_id))
+        goto out_destroy;
+
+    rc = mdb_cursor_open(txn, catalog->parents, &cursor);
+    if (rc) {
+        lmdb_error(rc);
+        goto out_destroy;
+    }
+
+    for (size_t i = 0; i < subtree->count; i++) {
+        MDB_val data;
+
+        if (!parent_key(&writer, subtree->ids[i], &key))
+            goto out_close;
+
+        rc = mdb_cursor_get(cursor, &key, &data, MDB_SET_KEY);
+        while (rc == 0) {
+            struct rbh_id id;
+
+            val2id(&data, &id);
+            if (!subtree_has(subtree, &id) && subtree_add(subtree, &id))
+                goto out_close;
+
+            rc = mdb_cursor_get(cursor, &key, &data, MDB_NEXT_DUP);
+        }
+
+        if (rc != MDB_NOTFOUND) {
+            lmdb_error(rc);
+            goto out_close;
+        }
+    }
+
+    mdb_cursor_close(cursor);
+    free(writer.data);
+    return subtree;
+
+out_close:
+    save_errno = errno;
+    mdb_cursor_close(cursor);
+    errno = save_errno;
+out_destroy:
+    save_errno = errno;
+    free(writer.data);
+    subtree_destroy(subtree);
+    errno = save_errno;
+    return NULL;
+}
+
+/* Whether \p link of \p record belongs to \p subtree */
+static bool
+subtree_contains(struct lmdb_subtree *subtree, const struct lmdb_record *record,
+                 const struct lmdb_link *link)
+{
+    if (subtree->count == 0)
+        return false;
+
+    return rbh_id_equal(&record->id, subtree->ids[0])
+        || subtree_has(subtree, &link->parent_id);
+}
+
+    /*--------------------------------------------------------------------*
+     |                              iterator                              |
+     *--------------------------------------------------------------------*/
+
+struct lmdb_iterator {
+    struct rbh_mut_iterator iterator;
+    struct lmdb_catalog *catalog;
+
+    /* Records are read straight from the map of this transaction */
+    MDB_txn *txn;
+    MDB_cursor *cursor;
+    bool started;
+    bool done;
+
+    struct rbh_filter *filter;
+    struct lmdb_plan plan;
+    struct lmdb_subtree *subtree;   /* NULL, or the branch to restrict to */
+    size_t position;                /* in `subtree', for LPT_SUBTREE */
+    struct writer key;
+
+    struct rbh_sstack *scratch;
+    struct lmdb_record record;      /* the current candidate */
+    size_t link;                    /* the next link of `record' to match */
+    struct lmdb_view view;
+
+    struct lmdb_projection projection;
+    size_t skip;
+    size_t remaining;
+
+    /* Sorted results are collected upfront */
+    struct rbh_fsentry **sorted;
+    size_t index;
+    size_t count;
+};
+
+static int
+iter_get_record(struct lmdb_iterator *iter, MDB_val *key)
+{
+    MDB_val data;
+    int rc;
+
+    /* LMDB does not support empty keys, no record has an empty id */
+    if (key->mv_size == 0)
+        return 0;
+
+    rc = mdb_get(iter->txn, iter->catalog->entries, key, &data);
+    if (rc)
+        return rc == MDB_NOTFOUND ? 0 : lmdb_error(rc);
+
+    if (load_record(key, &data, iter->scratch, &iter->record))
+        return -1;
+    return 1;
+}
+
+/* The key of the first index entry \p filter may match */
+static void
+iter_index_start(const struct rbh_filter *filter,
+                 unsigned char key[LMDB_INDEX_KEY_SIZE])
+{
+    uint32_t field = filter->compare.field.statx;
+
+    switch (filter->op) {
+    case RBH_FOP_STRICTLY_LOWER:
+    case RBH_FOP_LOWER_OR_EQUAL:
+        index_key(key, field, 0);
+        break;
+    default:
+        index_key(key, field, value2key(&filter->compare.value, field));
+        break;
+    }
+}
+
+/* Move the cursor of an LPT_INDEX plan to the next record, decoded in
+ * `iter->record' (or not, if the plan is over)
+ */
+static int
+iter_next_indexed(struct lmdb_iterator *iter)
+{
+    unsigned char start[LMDB_INDEX_KEY_SIZE];
+    const struct rbh_filter *filter = iter->plan.filter;
+    MDB_val key, data;
+    int rc;
+
+    if (!iter->started) {
+        iter_index_start(filter, start);
+        key.mv_size = sizeof(start);
+        key.mv_data = start;
+        rc = mdb_cursor_get(iter->cursor, &key, &data, MDB_SET_RANGE);
+        iter->started = true;
+    } else {
+        rc = mdb_cursor_get(iter->cursor, &key, &data, MDB_NEXT);
+    }
+
+    while (rc == 0) {
+        const unsigned char *bytes = key.mv_data;
+        struct rbh_fsentry fsentry = {
+            .mask = RBH_FP_STATX,
+        };
+        int found;
+
+        if (key.mv_size != LMDB_INDEX_KEY_SIZE
+         || bytes[0] != __builtin_ctz(filter->compare.field.statx))
+            return 0;
+
+        found = iter_get_record(iter, &data);
+        if (found <= 0)
+            return found;
+
+        /* The index sorts records by the value of the field: past the end of
+         * the range, no record matches anymore
+         */
+        fsentry.statx = &iter->record.statx;
+        if (rbh_filter_matches(filter, &fsentry))
+            return 1;
+
+        switch (filter->op) {
+        case RBH_FOP_STRICTLY_LOWER:
+        case RBH_FOP_LOWER_OR_EQUAL:
+        case RBH_FOP_EQUAL:
+            return 0;
+        default:
+            break;
+        }
+
+        scratch_clear(iter->scratch);
+        rc = mdb_cursor_get(iter->cursor, &key, &data, MDB_NEXT);
+    }
+
+    return rc == MDB_NOTFOUND ? 0 : lmdb_error(rc);
+}
+
+/* Decode the next candidate of the plan in `iter->record'
+ *
+ * @return          1 if there is one, 0 if there is none, -1 on error
+ */
+static int
+iter_next_candidate(struct lmdb_iterator *iter)
+{
+    const struct rbh_value *value;
+    MDB_val key, data;
+    struct rbh_id id;
+    int rc;
+
+    scratch_clear(iter->scratch);
+    iter->record.link_count = 0;
+    iter->link = 0;
+
+    if (iter->done)
+        return 0;
+
+    switch (iter->plan.type) {
+    case LPT_ID:
+        iter->done = true;
+        value = &iter->plan.filter->compare.value;
+        key.mv_data = (void *)value->binary.data;
+        key.mv_size = value->binary.size;
+        return iter_get_record(iter, &key);
+    case LPT_PARENT:
+        if (!iter->started) {
+            value = &iter->plan.filter->compare.value;
+            id.data = value->binary.data;
+            id.size = value->binary.size;
+            if (!parent_key(&iter->key, &id, &key))
+                return -1;
+
+            rc = mdb_cursor_get(iter->cursor, &key, &data, MDB_SET_KEY);
+            iter->started = true;
+        } else {
+            rc = mdb_cursor_get(iter->cursor, &key, &data, MDB_NEXT_DUP);
+        }
+
+        while (rc == 0) {
+            int found = iter_get_record(iter, &data);
+
+            if (found)
+                return found;
+            rc = mdb_cursor_get(iter->cursor, &key, &data, MDB_NEXT_DUP);
+        }
+        break;
+    case LPT_INDEX:
+        return iter_next_indexed(iter);
+    case LPT_SUBTREE:
+        while (iter->position < iter->subtree->count) {
+            int found;
+
+            key = id2val(iter->subtree->ids[iter->position++]);
+            found = iter_get_record(iter, &key);
+            if (found)
+                return found;
+        }
+        return 0;
+    case LPT_SCAN:
+        rc = mdb_cursor_get(iter->cursor, &key, &data,
+                            iter->started ? MDB_NEXT : MDB_FIRST);
+        iter->started = true;
+        if (rc == 0)
+            return load_record(&key, &data, iter->scratch, &iter->record)
+                 ? -1 : 1;
+        break;
+    }
+
+    iter->done = true;
+    return rc == MDB_NOTFOUND ? 0 : lmdb_error(rc);
+}
+
+/* The next fsentry that matches the filter of \p iter, as a view */
+static const struct rbh_fsentry *
+iter_next_match(struct lmdb_iterator *iter)
+{
+    do {
+        while (iter->link < iter->record.link_count) {
+            const struct lmdb_link *link = &iter->record.links[iter->link++];
+            const struct rbh_fsentry *fsentry;
+
+            if (iter->subtree
+             && !subtree_contains(iter->subtree, &iter->record, link))
+                continue;
+
+            fsentry = view_fill(&iter->view, &iter->record, link);
+            if (fsentry == NULL)
+                return NULL;
+
+            if (rbh_filter_matches(iter->filter, fsentry))
+                return fsentry;
+        }
+
+        switch (iter_next_candidate(iter)) {
+        case -1:
+            return NULL;
+        case 0:
+            errno = ENODATA;
+            return NULL;
+        }
+    } while (true);
+}
+
+static void *
+lmdb_iter_next(void *iterator)
+{
+    struct lmdb_iterator *lmdb_iter = iterator;
+    const struct rbh_fsentry *fsentry;
+
+    if (lmdb_iter->sorted) {
+        if (lmdb_iter->index >= lmdb_iter->count) {
+            errno = ENODATA;
+            return NULL;
+        }
+        return fsentry_project(lmdb_iter->sorted[lmdb_iter->index++],
+                               &lmdb_iter->projection);
+    }
+
+    for (; lmdb_iter->skip > 0; lmdb_iter->skip--) {
+        if (iter_next_match(lmdb_iter) == NULL)
+            return NULL;
+    }
+
+    if (lmdb_iter->remaining == 0) {
+        errno = ENODATA;
+        return NULL;
+    }
+
+    fsentry = iter_next_match(lmdb_iter);
+    if (fsentry == NULL)
+        return NULL;
+
+    lmdb_iter->remaining--;
+    return fsentry_project(fsentry, &lmdb_iter->projection);
+}
+
+static void
+catalog_release(struct lmdb_catalog *catalog);
+
+/* Release what is only needed to read from the database */
+static void
+iter_close(struct lmdb_iterator *iter)
+{
+    if (iter->cursor)
+        mdb_cursor_close(iter->cursor);
+    iter->cursor = NULL;
+    if (iter->txn)
+        mdb_txn_abort(iter->txn);
+    iter->txn = NULL;
+}
+
+static void
+lmdb_iter_destroy(void *iterator)
+{
+    struct lmdb_iterator *lmdb_iter = iterator;
+
+    for (size_t i = 0; i < lmdb_iter->count; i++)
+        free(lmdb_iter->sorted[i]);
+    free(lmdb_iter->sorted);
+    iter_close(lmdb_iter);
+    projection_fini(&lmdb_iter->projection);
+    free(lmdb_iter->view.fsentry);
+    if (lmdb_iter->scratch)
+        rbh_sstack_destroy(lmdb_iter->scratch);
+    free(lmdb_iter->key.data);
+    if (lmdb_iter->subtree)
+        subtree_destroy(lmdb_iter->subtree);
+    free(lmdb_iter->filter);
+    catalog_release(lmdb_iter->catalog);
+    free(lmdb_iter);
+}
+
+static const struct rbh_mut_iterator_operations LMDB_ITER_OPS = {
+    .next = lmdb_iter_next,
+    .destroy = lmdb_iter_destroy,
+};
+
+static const struct rbh_mut_iterator LMDB_ITER = {
+    .ops = &LMDB_ITER_OPS,
+};
+
+struct sort_context {
+    const struct rbh_filter_sort *items;
+    size_t count;
+};
+
+static int
+fsentry_compare(const void *first, const void *second, void *arg)
+{
+    const struct rbh_fsentry *x = *(struct rbh_fsentry * const *)first;
+    const struct rbh_fsentry *y = *(struct rbh_fsentry * const *)second;
+    struct sort_context *context = arg;
+
+    for (size_t i = 0; i < context->count; i++) {
+        const struct rbh_filter_sort *item = &context->items[i];
+        int rc = rbh_filter_field_compare(&item->field, x, y);
+
+        if (rc)
+            return item->ascending ? rc : -rc;
+    }
+    return 0;
+}
+
+/* Collect, sort, then skip and limit every match of \p iter */
+static int
+iter_sort(struct lmdb_iterator *iter, const struct rbh_filter_options *options)
+{
+    struct sort_context context = {
+        .items = options->sort.items,
+        .count = options->sort.count,
+    };
+    const struct rbh_fsentry *fsentry;
+    size_t size = 0;
+    size_t skip;
+
+    while ((fsentry = iter_next_match(iter)) != NULL) {
+        if (iter->count == size) {
+            size_t new_size = size ? 2 * size : 64;
+            struct rbh_fsentry **sorted;
+
+            sorted = reallocarray(iter->sorted, new_size, sizeof(*sorted));
+            if (sorted == NULL)
+                return -1;
+
+            iter->sorted = sorted;
+            size = new_size;
+        }
+
+        iter->sorted[iter->count] = fsentry_project(fsentry, &PROJECT_ALL);
+        if (iter->sorted[iter->count] == NULL)
+            return -1;
+        iter->count++;
+    }
+
+    if (errno != ENODATA)
+        return -1;
+
+    /* Every result is in memory, there is no need to hold a snapshot */
+    iter_close(iter);
+
+    if (iter->sorted == NULL) {
+        /* An empty but non-NULL array, to tell sorted iterators apart */
+        iter->sorted = malloc(sizeof(*iter->sorted));
+        if (iter->sorted == NULL)
+            return -1;
+    }
+
+    qsort_r(iter->sorted, iter->count, sizeof(*iter->sorted), fsentry_compare,
+            &context);
+
+    skip = iter->skip < iter->count ? iter->skip : iter->count;
+    iter->index = skip;
+    if (iter->remaining < iter->count - skip) {
+        for (size_t i = skip + iter->remaining; i < iter->count; i++)
+            free(iter->sorted[i]);
+        iter->count = skip + iter->remaining;
+    }
+    return 0;
+}
+
+static struct rbh_mut_iterator *
+catalog_filter(struct lmdb_catalog *catalog, const struct rbh_filter *filter,
+               const struct rbh_filter_options *options,
+               const struct rbh_id *root_id)
+{
+    struct lmdb_iterator *lmdb_iter;
+    bool walk = true;
+    MDB_dbi dbi = 0;
+    int save_errno;
+    int rc;
+
+    if (rbh_filter_validate(filter))
+        return NULL;
+
+    lmdb_iter = calloc(1, sizeof(*lmdb_iter));
+    if (lmdb_iter == NULL)
+        return NULL;
+
+    lmdb_iter->iterator = LMDB_ITER;
+    lmdb_iter->catalog = catalog;
+    catalog->refcount++;
+
+    if (projection_init(&lmdb_iter->projection, &options->projection)) {
+        save_errno = errno;
+        catalog_release(catalog);
+        free(lmdb_iter);
+        errno = save_errno;
+        return NULL;
+    }
+
+    lmdb_iter->skip = options->skip;
+    lmdb_iter->remaining = options->limit > 0 ? options->limit : SIZE_MAX;
+
+    lmdb_iter->filter = rbh_filter_clone(filter);
+    if (filter != NULL && lmdb_iter->filter == NULL)
+        goto out_destroy;
+
+    lmdb_iter->scratch = rbh_sstack_new(LMDB_SCRATCH_SIZE);
+    if (lmdb_iter->scratch == NULL)
+        goto out_destroy;
+
+    rc = mdb_txn_begin(catalog->env, NULL, MDB_RDONLY, &lmdb_iter->txn);
+    if (rc) {
+        lmdb_iter->txn = NULL;
+        lmdb_error(rc);
+        goto out_destroy;
+    }
+
+    lmdb_iter->plan = plan_filter(catalog->indexed, lmdb_iter->filter);
+    if (root_id) {
+        lmdb_iter->subtree = subtree_new(catalog, lmdb_iter->txn, root_id);
+        if (lmdb_iter->subtree == NULL)
+            goto out_destroy;
+
+        /* Only walk the branch, rather than the whole catalog */
+        if (lmdb_iter->plan.type == LPT_SCAN)
+            lmdb_iter->plan.type = LPT_SUBTREE;
+    }
+
+    switch (lmdb_iter->plan.type) {
+    case LPT_PARENT:
+        dbi = catalog->parents;
+        break;
+    case LPT_INDEX:
+        dbi = catalog->indexes;
+        break;
+    case LPT_SCAN:
+        dbi = catalog->entries;
+        break;
+    default:
+        walk = false;
+        break;
+    }
+
+    if (walk) {
+        rc = mdb_cursor_open(lmdb_iter->txn, dbi, &lmdb_iter->cursor);
+        if (rc) {
+            lmdb_iter->cursor = NULL;
+            lmdb_error(rc);
+            goto out_destroy;
+        }
+    }
+
+    if (options->sort.count > 0 && iter_sort(lmdb_iter, options))
+        goto out_destroy;
+
+    return &lmdb_iter->iterator;
+
+out_destroy:
+    save_errno = errno;
+    lmdb_iter_destroy(lmdb_iter);
+    errno = save_errno;
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*
+ |                                  catalog                                   |
+ *----------------------------------------------------------------------------*/
+
+static void
+catalog_release(struct lmdb_catalog *catalog)
+{
+    if (--catalog->refcount > 0)
+        return;
+
+    mdb_env_close(catalog->env);
+    free(catalog);
+}
+
+/* Rebuild every index, for the fields of \p indexed */
+static int
+catalog_reindex(struct lmdb_catalog *catalog, uint32_t indexed)
+{
+    MDB_val meta_key = {
+        .mv_size = sizeof(INDEXES_KEY),
+        .mv_data = (void *)INDEXES_KEY,
+    };
+    MDB_val meta_data = {
+        .mv_size = sizeof(indexed),
+        .mv_data = &indexed,
+    };
+    MDB_val key, data;
+    MDB_cursor *cursor;
+    int save_errno;
+    MDB_txn *txn;
+    int rc;
+
+    rc = mdb_txn_begin(catalog->env, NULL, 0, &txn);
+    if (rc)
+        return lmdb_error(rc);
+
+    rc = mdb_drop(txn, catalog->indexes, 0);
+    if (rc)
+        goto out_abort;
+
+    rc = mdb_cursor_open(txn, catalog->entries, &cursor);
+    if (rc)
+        goto out_abort;
+
+    for (rc = mdb_cursor_get(cursor, &key, &data, MDB_FIRST); rc == 0;
+         rc = mdb_cursor_get(cursor, &key, &data, MDB_NEXT)) {
+        struct cursor record_cursor = {
+            .data = data.mv_data,
+            .size = data.mv_size,
+        };
+        struct lmdb_record record;
+        uint32_t fields = indexed;
+
+        if (load_record_statx(&record_cursor, &record)) {
+            rc = EINVAL;
+            break;
+        }
+
+        while (fields) {
+            unsigned char index[LMDB_INDEX_KEY_SIZE];
+            uint32_t field = fields & -fields;
+            MDB_val index_val = {
+                .mv_size = sizeof(index),
+                .mv_data = index,
+            };
+
+            fields &= fields - 1;
+            if (!record_index_key(&record, field, index))
+                continue;
+
+            rc = mdb_put(txn, catalog->indexes, &index_val, &key,
+                         MDB_NODUPDATA);
+            if (rc == MDB_KEYEXIST)
+                rc = 0;
+            if (rc)
+                break;
+        }
+        if (rc)
+            break;
+    }
+    mdb_cursor_close(cursor);
+
+    if (rc != MDB_NOTFOUND)
+        goto out_abort;
+
+    rc = mdb_put(txn, catalog->meta, &meta_key, &meta_data, 0);
+    if (rc)
+        goto out_abort;
+
+    rc = mdb_txn_commit(txn);
+    if (rc)
+        return lmdb_error(rc);
+
+    catalog->indexed = indexed;
+    return 0;
+
+out_abort:
+    lmdb_error(rc);
+    save_errno = errno;
+    mdb_txn_abort(txn);
+    errno = save_errno;
+    return -1;
+}
+
+static int
+catalog_init(struct lmdb_catalog *catalog)
+{
+    MDB_val key = {
+        .mv_size = sizeof(INDEXES_KEY),
+        .mv_data = (void *)INDEXES_KEY,
+    };
+    MDB_val data;
+    MDB_txn *txn;
+    int rc;
+
+    rc = mdb_txn_begin(catalog->env, NULL, 0, &txn);
+    if (rc)
+        return lmdb_error(rc);
+
+    rc = mdb_dbi_open(txn, "entries", MDB_CREATE, &catalog->entries);
+    if (rc)
+        goto out_abort;
+
+    rc = mdb_dbi_open(txn, "parents", MDB_CREATE | MDB_DUPSORT,
+                      &catalog->parents);
+    if (rc)
+        goto out_abort;
+
+    rc = mdb_dbi_open(txn, "indexes", MDB_CREATE | MDB_DUPSORT,
+                      &catalog->indexes);
+    if (rc)
+        goto out_abort;
+
+    rc = mdb_dbi_open(txn, "meta", MDB_CREATE, &catalog->meta);
+    if (rc)
+        goto out_abort;
+
+    rc = mdb_get(txn, catalog->meta, &key, &data);
+    if (rc == 0 && data.mv_size == sizeof(catalog->indexed)) {
+        memcpy(&catalog->indexed, data.mv_data, sizeof(catalog->indexed));
+    } else if (rc == MDB_NOTFOUND) {
+        data.mv_size = sizeof(catalog->indexed);
+        data.mv_data = &catalog->indexed;
+        rc = mdb_put(txn, catalog->meta, &key, &data, 0);
+        if (rc)
+            goto out_abort;
+    } else {
+        rc = rc ? rc : EINVAL;
+        goto out_abort;
+    }
+
+    rc = mdb_txn_commit(txn);
+    return rc ? lmdb_error(rc) : 0;
+
+out_abort:
+    mdb_txn_abort(txn);
+    return lmdb_error(rc);
+}
+
+static struct lmdb_catalog *
+catalog_open(const char *path)
+{
+    struct lmdb_catalog *catalog;
+    int save_errno;
+    int rc;
+
+    if (mkdir(path, 0777) && errno != EEXIST)
+        return NULL;
+
+    catalog = malloc(sizeof(*catalog));
+    if (catalog == NULL)
+        return NULL;
+
+    catalog->refcount = 1;
+    catalog->indexed = LMDB_DEFAULT_INDEXES;
+    catalog->batch_size = LMDB_DEFAULT_BATCH_SIZE;
+    catalog->map_size = LMDB_DEFAULT_MAP_SIZE;
+
+    rc = mdb_env_create(&catalog->env);
+    if (rc) {
+        lmdb_error(rc);
+        goto out_free;
+    }
+
+    rc = mdb_env_set_maxdbs(catalog->env, 4);
+    if (rc == 0)
+        rc = mdb_env_set_mapsize(catalog->env, catalog->map_size);
+    /* Iterators each hold a read transaction, possibly in the same thread */
+    if (rc == 0)
+        rc = mdb_env_open(catalog->env, path, MDB_NOTLS, 0666);
+    if (rc) {
+        lmdb_error(rc);
+        goto out_close;
+    }
+
+    if (catalog_init(catalog))
+        goto out_close;
+
+    return catalog;
+
+out_close:
+    save_errno = errno;
+    mdb_env_close(catalog->env);
+    errno = save_errno;
+out_free:
+    save_errno = errno;
+    free(catalog);
+    errno = save_errno;
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*
+ |                                lmdb_backend                                |
+ *----------------------------------------------------------------------------*/
+
+struct lmdb_backend {
+    struct rbh_backend backend;
+    struct lmdb_catalog *catalog;
+    struct rbh_id *root_id;         /* NULL, or the root of a branch */
+};
+
+    /*--------------------------------------------------------------------*
+     |                             get_option                             |
+     *--------------------------------------------------------------------*/
+
+static int
+copy_option(void *data, size_t *data_size, const void *value, size_t size)
+{
+    if (*data_size < size) {
+        *data_size = size;
+        errno = EOVERFLOW;
+        return -1;
+    }
+    memcpy(data, value, size);
+    *data_size = size;
+    return 0;
+}
+
+static int
+lmdb_get_option(void *backend, unsigned int option, void *data,
+                size_t *data_size)
+{
+    struct lmdb_backend *lmdb = backend;
+    struct lmdb_catalog *catalog = lmdb->catalog;
+
+    switch (option) {
+    case RBH_LMBO_INDEXES:
+        return copy_option(data, data_size, &catalog->indexed,
+                           sizeof(catalog->indexed));
+    case RBH_LMBO_BATCH_SIZE:
+        return copy_option(data, data_size, &catalog->batch_size,
+                           sizeof(catalog->batch_size));
+    case RBH_LMBO_MAP_SIZE:
+        return copy_option(data, data_size, &catalog->map_size,
+                           sizeof(catalog->map_size));
+    }
+
+    errno = ENOPROTOOPT;
+    return -1;
+}
+
+    /*--------------------------------------------------------------------*
+     |                             set_option                             |
+     *--------------------------------------------------------------------*/
+
+static int
+lmdb_set_option(void *backend, unsigned int option, const void *data,
+                size_t data_size)
+{
+    struct lmdb_backend *lmdb = backend;
+    struct lmdb_catalog *catalog = lmdb->catalog;
+    uint32_t indexed;
+    size_t size;
+    int rc;
+
+    switch (option) {
+    case RBH_LMBO_INDEXES:
+        if (data_size != sizeof(indexed)) {
+            errno = EINVAL;
+            return -1;
+        }
+        memcpy(&indexed, data, sizeof(indexed));
+        return catalog_reindex(catalog, indexed);
+    case RBH_LMBO_BATCH_SIZE:
+        if (data_size != sizeof(size)) {
+            errno = EINVAL;
+            return -1;
+        }
+        memcpy(&catalog->batch_size, data, sizeof(size));
+        return 0;
+    case RBH_LMBO_MAP_SIZE:
+        if (data_size != sizeof(size)) {
+            errno = EINVAL;
+            return -1;
+        }
+        memcpy(&size, data, sizeof(size));
+
+        rc = mdb_env_set_mapsize(catalog->env, size);
+        if (rc)
+            return lmdb_error(rc);
+        catalog->map_size = size;
+        return 0;
+    }
+
+    errno = ENOPROTOOPT;
+    return -1;
+}
+
+    /*--------------------------------------------------------------------*
+     |                               update                               |
+     *--------------------------------------------------------------------*/
+
+static ssize_t
+lmdb_backend_update(void *backend, struct rbh_iterator *fsevents,
+                    bool skip_error)
+{
+    struct lmdb_backend *lmdb = backend;
+
+    return catalog_update(lmdb->catalog, fsevents, skip_error);
+}
+
+    /*--------------------------------------------------------------------*
+     |                               filter                               |
+     *--------------------------------------------------------------------*/
+
+static struct rbh_mut_iterator *
+lmdb_backend_filter(void *backend, const struct rbh_filter *filter,
+                    const struct rbh_filter_options *options)
+{
+    struct lmdb_backend *lmdb = backend;
+
+    return catalog_filter(lmdb->catalog, filter, options, lmdb->root_id);
+}
+
+    /*--------------------------------------------------------------------*
+     |                                root                                |
+     *--------------------------------------------------------------------*/
+
+static const struct rbh_filter ROOT_FILTER = {
+    .op = RBH_FOP_EQUAL,
+    .compare = {
+        .field = {
+            .fsentry = RBH_FP_PARENT_ID,
+        },
+        .value = {
+            .type = RBH_VT_BINARY,
+            .binary = {
+                .size = 0,
+            },
+        },
+    },
+};
+
+static struct rbh_fsentry *
+lmdb_root(void *backend, const struct rbh_filter_projection *projection)
+{
+    struct lmdb_backend *lmdb = backend;
+    const struct rbh_filter ID_FILTER = {
+        .op = RBH_FOP_EQUAL,
+        .compare = {
+            .field = {
+                .fsentry = RBH_FP_ID,
+            },
+            .value = {
+                .type = RBH_VT_BINARY,
+                .binary = {
+                    .data = lmdb->root_id ? lmdb->root_id->data : NULL,
+                    .size = lmdb->root_id ? lmdb->root_id->size : 0,
+                },
+            },
+        },
+    };
+
+    return rbh_backend_filter_one(backend, lmdb->root_id ? &ID_FILTER
+                                                         : &ROOT_FILTER,
+                                  projection);
+}
+
+    /*--------------------------------------------------------------------*
+     |                               branch                               |
+     *--------------------------------------------------------------------*/
+
+static const struct rbh_backend LMDB_BACKEND;
+
+static struct rbh_backend *
+lmdb_backend_branch(void *backend, const struct rbh_id *id, const char *path)
+{
+    const struct rbh_filter_projection ID_ONLY = {
+        .fsentry_mask = RBH_FP_ID,
+    };
+    struct lmdb_backend *lmdb = backend;
+    struct rbh_fsentry *fsentry = NULL;
+    struct lmdb_backend *branch;
+    int save_errno;
+
+    if (id == NULL) {
+        if (path == NULL) {
+            errno = EINVAL;
+            return NULL;
+        }
+
+        fsentry = rbh_backend_fsentry_from_path(backend, path, &ID_ONLY);
+        if (fsentry == NULL)
+            return NULL;
+
+        if (!(fsentry->mask & RBH_FP_ID)) {
+            free(fsentry);
+            errno = ENODATA;
+            return NULL;
+        }
+        id = &fsentry->id;
+    }
+
+    branch = malloc(sizeof(*branch));
+    if (branch == NULL)
+        goto out_free_fsentry;
+
+    branch->root_id = rbh_id_new(id->data, id->size);
+    if (branch->root_id == NULL)
+        goto out_free_branch;
+
+    free(fsentry);
+    branch->backend = LMDB_BACKEND;
+    branch->catalog = lmdb->catalog;
+    branch->catalog->refcount++;
+    return &branch->backend;
+
+out_free_branch:
+    save_errno = errno;
+    free(branch);
+    errno = save_errno;
+out_free_fsentry:
+    save_errno = errno;
+    free(fsentry);
+    errno = save_errno;
+    return NULL;
+}
+
+    /*--------------------------------------------------------------------*
+     |                              destroy()                             |
+     *--------------------------------------------------------------------*/
+
+static void
+lmdb_backend_destroy(void *backend)
+{
+    struct lmdb_backend *lmdb = backend;
+
+    catalog_release(lmdb->catalog);
+    free(lmdb->root_id);
+    free(lmdb);
+}
+
+static const struct rbh_backend_operations LMDB_BACKEND_OPS = {
+    .get_option = lmdb_get_option,
+    .set_option = lmdb_set_option,
+    .update = lmdb_backend_update,
+    .branch = lmdb_backend_branch,
+    .root = lmdb_root,
+    .filter = lmdb_backend_filter,
+    .destroy = lmdb_backend_destroy,
+};
+
+static const struct rbh_backend LMDB_BACKEND = {
+    .id = RBH_BI_LMDB,
+    .name = RBH_LMDB_BACKEND_NAME,
+    .ops = &LMDB_BACKEND_OPS,
+};
+
+/*----------------------------------------------------------------------------*
+ |                           rbh_lmdb_backend_new()                           |
+ *----------------------------------------------------------------------------*/
+
+struct rbh_backend *
+rbh_lmdb_backend_new(const char *path)
+{
+    struct lmdb_backend *lmdb;
+    int save_errno;
+
+    if (path == NULL || *path == '\0') {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    lmdb = malloc(sizeof(*lmdb));
+    if (lmdb == NULL)
+        return NULL;
+
+    lmdb->catalog = catalog_open(path);
+    if (lmdb->catalog == NULL) {
+        save_errno = errno;
+        free(lmdb);
+        errno = save_errno;
+        return NULL;
+    }
+
+    lmdb->backend = LMDB_BACKEND;
+    lmdb->root_id = NULL;
+    return &lmdb->backend;
+}
@@ -11,7 +11,9 @@
 #endif
 
 #include <fcntl.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
@@ -26,6 +28,7 @@
 #include "robinhood/backends/posix.h"
 #include "robinhood/backends/posix_internal.h"
 #include "robinhood/backends/lustre.h"
+#include "robinhood/lustre_utils.h"
 #include "robinhood/statx.h"
 
 #ifndef HAVE_LUSTRE_FILE_HANDLE
@@ -608,7 +611,6 @@ xattrs_get_magic_and_gen(int fd, struct rbh_value_pair *pairs)
 {
     char buffer[XATTR_VALUE_MAX_VFS_SIZE];
     const char *lov_buf = NULL;
-    int save_errno;
 
     if (_inode_xattrs != NULL) {
         for (int i = 0; i < *_inode_xattrs_count; ++i) {
@@ -624,12 +626,8 @@ xattrs_get_magic_and_gen(int fd, struct rbh_value_pair *pairs)
         ssize_t length = XATTR_VALUE_MAX_VFS_SIZE;
 
         length = fgetxattr(fd, XATTR_LUSTRE_LOV, buffer, length);
-        if (length == -1) {
-            save_errno = errno;
-            free(buffer);
-            errno = save_errno;
+        if (length == -1)
             return -1;
-        }
 
         lov_buf = buffer;
     }
@@ -641,62 +639,78 @@ xattrs_get_magic_and_gen(int fd, struct rbh_value_pair *pairs)
 }
 
 /**
- * Retrieve a directory's layout by using an ioctl.
+ * Fetch the raw layout of a file
  *
- * @param fd        file descriptor of the directory we want the layout of
+ * @param fd        file descriptor of the file
+ * @param buffer    a buffer of XATTR_SIZE_MAX bytes
+ * @param size      set to the size of the layout on success
  *
- * @return          layout of the directory, or NULL
+ * @return          the file's "lustre.lov" xattr (the default striping of
+ *                  directories), either in \p buffer or among the inode
+ *                  xattrs already retrieved, NULL on error and errno is set
+ *                  appropriately
  */
-static struct llapi_layout *
-xattrs_get_dir_data_striping(int fd)
+static const char *
+layout_fetch(int fd, char *buffer, size_t *size)
 {
-    char tmp[XATTR_SIZE_MAX] = {0};
-    struct llapi_layout *layout;
-    struct lov_user_md *lum;
-    int lum_size;
-    int rc = 0;
+    ssize_t length;
+
+    if (S_ISDIR(mode)) {
+        /* Directories have a default striping that children can inherit
+         * from, it is fetched through an ioctl.
+         */
+        struct lov_user_md *lum = (struct lov_user_md *)buffer;
 
-    lum = (struct lov_user_md *)tmp;
+        memset(buffer, 0, XATTR_SIZE_MAX);
+        if (ioctl(fd, LL_IOC_LOV_GETSTRIPE, (void *)lum))
+            return NULL;
 
-    rc = ioctl(fd, LL_IOC_LOV_GETSTRIPE, (void *)lum);
-    if (rc)
-        return NULL;
+        switch (lum->lmm_magic) {
+        case LOV_USER_MAGIC_COMP_V1:
+#ifdef HAVE_LOV_USER_MAGIC_SEL
+        case LOV_USER_MAGIC_SEL:
+#endif
+            *size = ((struct lov_comp_md_v1 *)lum)->lcm_size;
+            break;
+        default:
+            *size = lov_user_md_size(lum->lmm_stripe_count, lum->lmm_magic);
+        }
+        *size = MIN(*size, XATTR_SIZE_MAX);
+        return buffer;
+    }
+
+    if (_inode_xattrs != NULL) {
+        for (int i = 0; i < *_inode_xattrs_count; ++i) {
+            if (!strcmp(_inode_xattrs[i].key, XATTR_LUSTRE_LOV)) {
+                *size = _inode_xattrs[i].value->binary.size;
+                return _inode_xattrs[i].value->binary.data;
+            }
+        }
+    }
 
-    lum_size = lov_user_md_size(lum->lmm_stripe_count, lum->lmm_magic);
-    layout = llapi_layout_get_by_xattr(lum, lum_size, 0);
-    if (!layout)
+    length = fgetxattr(fd, XATTR_LUSTRE_LOV, buffer, XATTR_SIZE_MAX);
+    if (length == -1)
         return NULL;
 
-    return layout;
+    *size = length;
+    return buffer;
 }
 
 /**
- * Record a file's layout attributes:
- *  - main flags
- *  - magic number and layout generation if the file is regular
- *  - mirror_count if the file is composite
- *  - per component:
- *    - stripe_count
- *    - stripe_size
- *    - pattern
- *    - component flags
- *    - pool
- *    - ost
- *    - if the file is composite, 3 more attributes:
- *      - mirror_id
- *      - begin
- *      - end
+ * Record the attributes of a decoded layout in \p pairs
  *
- * @param fd        file descriptor to check
+ * @param fd        file descriptor of the file \p layout belongs to
+ * @param layout    the layout to record (it is freed)
+ * @param lov       the raw layout \p layout was decoded from, if known
  * @param pairs     list of pairs to fill
  *
- * @return          number of filled \p pairs
+ * @return          number of filled \p pairs, -1 on error
  */
 static int
-xattrs_get_layout(int fd, struct rbh_value_pair *pairs)
+layout_decode(int fd, struct llapi_layout *layout, const char *lov,
+              struct rbh_value_pair *pairs)
 {
     struct iterator_data data = { .comp_index = 0 };
-    struct llapi_layout *layout;
     uint16_t mirror_count = 0;
     uint32_t nb_comp = 1;
     /**
@@ -709,28 +723,6 @@ xattrs_get_layout(int fd, struct rbh_value_pair *pairs)
     uint32_t flags;
     int rc;
 
-    if (S_ISLNK(mode))
-        /* no layout to fetch for links */
-        return 0;
-
-    if (S_ISDIR(mode)) {
-        /* Directories have a default striping that children can inherit from.
-         * These information can be manipulated as a regular file layout but
-         * they are fetched differently through the Lustre API.
-         */
-        layout = xattrs_get_dir_data_striping(fd);
-        /* If layout is NULL and errno is ENODATA, that means the ioctl failed
-         * because there is no default striping on the directory.
-         */
-        if (layout == NULL && errno == ENODATA)
-            return 0;
-    } else {
-        layout = llapi_layout_get_by_fd(fd, 0);
-    }
-
-    if (layout == NULL)
-        return -1;
-
     rc = llapi_layout_flags_get(layout, &flags);
     if (rc)
         goto err;
@@ -743,7 +735,10 @@ xattrs_get_layout(int fd, struct rbh_value_pair *pairs)
         /* Magic number and generation are only meaningful for actual layouts,
          * not the default layout stored in the directory.
          */
-        rc = xattrs_get_magic_and_gen(fd, &pairs[subcount]);
+        if (lov)
+            rc = _xattrs_get_magic_and_gen(fd, lov, &pairs[subcount]);
+        else
+            rc = xattrs_get_magic_and_gen(fd, &pairs[subcount]);
         if (rc < 0)
             goto err;
 
@@ -800,6 +795,302 @@ err:
     return rc ? rc : subcount;
 }
 
+    /*--------------------------------------------------------------------*
+     |                          layout interning                          |
+     *--------------------------------------------------------------------*/
+
+/* Most files of a directory share the layout they inherited from it. The pairs
+ * a layout is recorded as are memoized (per thread), keyed by the raw layout
+ * stripped of what is specific to each file (object IDs and mirror
+ * timestamps): files with the same layout skip its decoding, and share its
+ * values.
+ */
+
+struct layout {
+    /** The type of the files the layout belongs to (S_IFMT bits) */
+    uint16_t type;
+    /** The raw layout, stripped of what is specific to each file */
+    const char *lov;
+    size_t size;
+
+    const struct rbh_value_pair *pairs;
+    int count;
+};
+
+/* How many layouts to remember at once, they are all forgotten past that */
+#define LAYOUT_CACHE_SIZE (1 << 10)
+
+static __thread struct rbh_hashmap *layouts;
+/* Stores every struct layout, and what they point at */
+static __thread struct rbh_sstack *layout_values;
+static __thread size_t layout_count;
+
+static bool
+layout_equals(const void *first, const void *second)
+{
+    const struct layout *x = first;
+    const struct layout *y = second;
+
+    return x->type == y->type && x->size == y->size
+        && memcmp(x->lov, y->lov, x->size) == 0;
+}
+
+static size_t
+layout_hash(const void *key)
+{
+    const struct layout *layout = key;
+    /* FNV-1a */
+    uint64_t hash = 0xcbf29ce484222325ULL ^ layout->type;
+
+    for (size_t i = 0; i < layout->size; i++) {
+        hash ^= (unsigned char)layout->lov[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+static void
+layouts_destroy(void)
+{
+    if (layouts)
+        rbh_hashmap_destroy(layouts);
+    if (layout_values)
+        rbh_sstack_destroy(layout_values);
+    layouts = NULL;
+    layout_values = NULL;
+    layout_count = 0;
+}
+
+__attribute__((destructor))
+static void
+free_layouts(void)
+{
+    layouts_destroy();
+}
+
+static int
+layouts_init(void)
+{
+    if (layouts != NULL && layout_count < LAYOUT_CACHE_SIZE)
+        return 0;
+
+    layouts_destroy();
+
+    /* Keep the load factor of the hashmap under 50% */
+    layouts = rbh_hashmap_new(layout_equals, layout_hash,
+                              2 * LAYOUT_CACHE_SIZE);
+    if (layouts == NULL)
+        return -1;
+
+    layout_values = rbh_sstack_new(XATTR_SIZE_MAX);
+    if (layout_values == NULL) {
+        int save_errno = errno;
+
+        layouts_destroy();
+        errno = save_errno;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+lov_user_md_strip(char *lov, size_t size)
+{
+    struct lov_user_md *lum = (struct lov_user_md *)lov;
+    struct lov_user_ost_data_v1 *objects;
+    size_t header;
+
+    if (size < sizeof(struct lov_user_md_v1))
+        return;
+
+    switch (lum->lmm_magic) {
+    case LOV_USER_MAGIC_V1:
+        header = sizeof(struct lov_user_md_v1);
+        objects = ((struct lov_user_md_v1 *)lum)->lmm_objects;
+        break;
+    case LOV_USER_MAGIC_V3:
+    case LOV_USER_MAGIC_SPECIFIC:
+        header = sizeof(struct lov_user_md_v3);
+        objects = ((struct lov_user_md_v3 *)lum)->lmm_objects;
+        break;
+    default:
+        return;
+    }
+
+    memset(&lum->lmm_oi, 0, sizeof(lum->lmm_oi));
+    /* Components that are not instantiated have no object */
+    for (size_t i = 0; i < lum->lmm_stripe_count; i++) {
+        if (header + (i + 1) * sizeof(*objects) > size)
+            break;
+
+        memset(&objects[i].l_ost_oi, 0, sizeof(objects[i].l_ost_oi));
+        objects[i].l_ost_gen = 0;
+    }
+}
+
+static void
+lov_strip(char *lov, size_t size)
+{
+    struct lov_comp_md_v1 *comp = (struct lov_comp_md_v1 *)lov;
+
+    if (size < sizeof(comp->lcm_magic))
+        return;
+
+    switch (comp->lcm_magic) {
+    case LOV_USER_MAGIC_COMP_V1:
+#ifdef HAVE_LOV_USER_MAGIC_SEL
+    case LOV_USER_MAGIC_SEL:
+#endif
+        break;
+    default:
+        lov_user_md_strip(lov, size);
+        return;
+    }
+
+    if (size < sizeof(*comp))
+        return;
+
+    for (size_t i = 0; i < comp->lcm_entry_count; i++) {
+        struct lov_comp_md_entry_v1 *entry = &comp->lcm_entries[i];
+
+        if ((char *)(entry + 1) > lov + size)
+            break;
+
+        entry->lcme_timestamp = 0;
+        if (entry->lcme_offset > size
+         || entry->lcme_size > size - entry->lcme_offset)
+            continue;
+
+        lov_user_md_strip(lov + entry->lcme_offset, entry->lcme_size);
+    }
+}
+
+/* Keep what is pushed onto `layout_values' aligned */
+static size_t
+layout_align(size_t size)
+{
+    return (size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+}
+
+/**
+ * Record a file's layout attributes:
+ *  - main flags
+ *  - magic number and layout generation if the file is regular
+ *  - mirror_count if the file is composite
+ *  - per component:
+ *    - stripe_count
+ *    - stripe_size
+ *    - pattern
+ *    - component flags
+ *    - pool
+ *    - ost
+ *    - if the file is composite, 3 more attributes:
+ *      - mirror_id
+ *      - begin
+ *      - end
+ *
+ * @param fd        file descriptor to check
+ * @param pairs     list of pairs to fill
+ *
+ * @return          number of filled \p pairs
+ */
+static int
+xattrs_get_layout(int fd, struct rbh_value_pair *pairs)
+{
+    char buffer[XATTR_SIZE_MAX];
+    struct llapi_layout *layout;
+    const struct layout *cached;
+    struct rbh_sstack *values;
+    struct layout *entry;
+    const char *lov;
+    size_t aligned;
+    int save_errno;
+    char *stripped;
+    size_t size;
+    int count;
+
+    if (S_ISLNK(mode))
+        /* no layout to fetch for links */
+        return 0;
+
+    lov = layout_fetch(fd, buffer, &size);
+    if (lov == NULL) {
+        if (S_ISDIR(mode))
+            /* ENODATA means there is no default striping on the directory */
+            return errno == ENODATA ? 0 : -1;
+
+        /* Let liblustreapi make sense of files without a "lustre.lov" */
+        layout = llapi_layout_get_by_fd(fd, 0);
+        if (layout == NULL)
+            return -1;
+
+        return layout_decode(fd, layout, NULL, pairs);
+    }
+
+    if (layouts_init())
+        return -1;
+
+    /* Build the key in place, it becomes the layout's if it is not known */
+    aligned = layout_align(MAX(size, 1));
+    stripped = rbh_sstack_push(layout_values, NULL, aligned);
+    if (stripped == NULL)
+        return -1;
+    memcpy(stripped, lov, size);
+    lov_strip(stripped, size);
+
+    entry = rbh_sstack_push(layout_values, NULL, sizeof(*entry));
+    if (entry == NULL)
+        return -1;
+    entry->type = mode & S_IFMT;
+    entry->lov = stripped;
+    entry->size = size;
+
+    cached = rbh_hashmap_get(layouts, entry);
+    if (cached != NULL) {
+        rbh_sstack_pop(layout_values, sizeof(*entry));
+        rbh_sstack_pop(layout_values, aligned);
+        memcpy(pairs, cached->pairs, cached->count * sizeof(*pairs));
+        return cached->count;
+    }
+
+    /* The pairs of the layout outlive the file's */
+    values = _values;
+    _values = layout_values;
+
+    /* Whatever is pushed onto `layout_values' from here on is only reclaimed
+     * when the cache is flushed, failures count towards it
+     */
+    layout_count++;
+
+    /* liblustreapi wants a buffer it can write to */
+    if (lov != buffer)
+        memcpy(buffer, lov, size);
+
+    layout = llapi_layout_get_by_xattr(buffer, size, 0);
+    count = layout ? layout_decode(fd, layout, buffer, pairs) : -1;
+    if (count < 0)
+        goto out_restore_values;
+
+    entry->pairs = rbh_sstack_push(layout_values, pairs,
+                                   count * sizeof(*pairs));
+    if (entry->pairs == NULL) {
+        count = -1;
+        goto out_restore_values;
+    }
+    entry->count = count;
+
+    /* The hashmap cannot be full, layouts are flushed first */
+    rbh_hashmap_set(layouts, entry, entry);
+
+out_restore_values:
+    save_errno = errno;
+    _values = values;
+    errno = save_errno;
+    return count;
+}
+
 static int
 xattrs_get_mdt_info(int fd, struct rbh_value_pair *pairs)
 {
@@ -1063,10 +1354,86 @@ lustre_iterator_new(const char *root, const char *entry, int statx_sync_type)
     return lustre_iter;
 }
 
+    /*--------------------------------------------------------------------*
+     |                             lazy size                              |
+     *--------------------------------------------------------------------*/
+
+static int
+lustre_backend_get_option(void *backend, unsigned int option, void *data,
+                          size_t *data_size)
+{
+    struct posix_backend *lustre = backend;
+    bool lazy;
+
+    if (option != RBH_LBO_LAZY_SIZE)
+        return posix_backend_get_option(backend, option, data, data_size);
+
+    if (*data_size < sizeof(lazy)) {
+        *data_size = sizeof(lazy);
+        errno = EOVERFLOW;
+        return -1;
+    }
+
+    lazy = lustre->get_statx == rbh_lustre_lazy_statx;
+    memcpy(data, &lazy, sizeof(lazy));
+    *data_size = sizeof(lazy);
+    return 0;
+}
+
+static int
+lustre_backend_set_option(void *backend, unsigned int option, const void *data,
+                          size_t data_size)
+{
+    struct posix_backend *lustre = backend;
+    bool lazy;
+
+    if (option != RBH_LBO_LAZY_SIZE)
+        return posix_backend_set_option(backend, option, data, data_size);
+
+    if (data_size != sizeof(lazy)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memcpy(&lazy, data, sizeof(lazy));
+    lustre->get_statx = lazy ? rbh_lustre_lazy_statx : rbh_statx;
+    return 0;
+}
+
+static struct rbh_backend *
+lustre_backend_branch(void *backend, const struct rbh_id *id, const char *path);
+
+static const struct rbh_backend_operations LUSTRE_BRANCH_BACKEND_OPS = {
+    .get_option = lustre_backend_get_option,
+    .set_option = lustre_backend_set_option,
+    .branch = lustre_backend_branch,
+    .root = posix_root,
+    .filter = posix_branch_backend_filter,
+    .get_attribute = lustre_backend_get_attribute,
+    .destroy = posix_branch_backend_destroy,
+};
+
+/* Branches inherit the lustre iterator and the lazy size of their backend */
+static struct rbh_backend *
+lustre_backend_branch(void *backend, const struct rbh_id *id, const char *path)
+{
+    struct rbh_backend *branch;
+
+    branch = posix_backend_branch(backend, id, path);
+    if (branch == NULL)
+        return NULL;
+
+    branch->id = RBH_BI_LUSTRE;
+    branch->name = RBH_LUSTRE_BACKEND_NAME;
+    branch->ops = &LUSTRE_BRANCH_BACKEND_OPS;
+
+    return branch;
+}
+
 static const struct rbh_backend_operations LUSTRE_BACKEND_OPS = {
-    .get_option = posix_backend_get_option,
-    .set_option = posix_backend_set_option,
-    .branch = posix_backend_branch,
+    .get_option = lustre_backend_get_option,
+    .set_option = lustre_backend_set_option,
+    .branch = lustre_backend_branch,
     .root = posix_root,
     .filter = posix_backend_filter,
     .get_attribute = lustre_backend_get_attribute,
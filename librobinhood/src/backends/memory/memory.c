@@ -0,0 +1,2362 @@
+/* This file is part of RobinHood 4
+ * Copyright (C) 2024 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: LGPL-3.0-or-later
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+
+#include "robinhood/backends/memory.h"
+#include "robinhood/filter.h"
+#include "robinhood/fsentry.h"
+#include "robinhood/fsevent.h"
+#include "robinhood/hashmap.h"
+#include "robinhood/id.h"
+#include "robinhood/iterator.h"
+#include "robinhood/list.h"
+#include "robinhood/statx.h"
+#include "robinhood/value.h"
+
+/*----------------------------------------------------------------------------*
+ |                                  catalog                                   |
+ *----------------------------------------------------------------------------*/
+
+/* The catalog mirrors the layout of the mongo backend's documents: an entry
+ * holds the inode attributes of an fsentry, and each of its links holds a
+ * parent id, a name, and namespace xattrs.
+ */
+
+struct memory_link {
+    struct rbh_list_node siblings;  /* in memory_children.links */
+    struct memory_entry *entry;
+    struct rbh_id *parent_id;
+    char *name;
+    struct rbh_value *xattrs;       /* a map, or NULL */
+    unsigned long visit;            /* cf. memory_catalog.visit */
+};
+
+struct memory_entry {
+    struct rbh_list_node entries;   /* in memory_catalog.entries */
+    struct rbh_id *id;
+    struct rbh_statx *statx;        /* NULL until an upsert provides one */
+    char *symlink;
+    struct rbh_value *xattrs;       /* a map, or NULL */
+    struct memory_link **links;
+    size_t link_count;
+    unsigned long visit;            /* cf. memory_catalog.visit */
+};
+
+/* The links of every entry whose parent is `parent_id' */
+struct memory_children {
+    struct rbh_list_node parents;   /* in memory_catalog.parents */
+    struct rbh_id *parent_id;
+    struct rbh_list_node links;
+};
+
+/* Entries that have a given statx field, sorted by the value of this field */
+struct memory_index {
+    struct memory_entry **entries;
+    size_t count;
+    bool stale;
+};
+
+#define MEMORY_DEFAULT_INDEXES (RBH_STATX_SIZE | RBH_STATX_ATIME_SEC \
+                              | RBH_STATX_MTIME_SEC | RBH_STATX_CTIME_SEC)
+
+struct memory_catalog {
+    unsigned int refcount;
+    char *path;
+    bool modified;
+
+    struct rbh_list_node entries;
+    size_t entry_count;
+    struct rbh_hashmap *ids;        /* rbh_id -> memory_entry */
+    size_t ids_size;
+
+    struct rbh_list_node parents;
+    size_t parent_count;
+    struct rbh_hashmap *children;   /* rbh_id -> memory_children */
+    size_t children_size;
+
+    uint32_t indexed;
+    struct memory_index indexes[32]; /* one per bit of `indexed' */
+
+    size_t symlink_max;             /* the length of the longest symlink */
+    unsigned long visit;            /* used to mark entries/links in walks */
+};
+
+/* Keep hashmaps at most 70% full (they use open addressing) */
+#define MEMORY_MIN_SLOTS (1 << 10)
+
+static size_t
+slots_for(size_t count)
+{
+    size_t slots = count * 10 / 7 + 1;
+
+    return slots < MEMORY_MIN_SLOTS ? MEMORY_MIN_SLOTS : slots;
+}
+
+static size_t
+id_hash(const void *key)
+{
+    const struct rbh_id *id = key;
+    size_t hash = 5381;
+
+    /* djb2 */
+    for (size_t i = 0; i < id->size; i++)
+        hash = ((hash << 5) + hash) + (unsigned char)id->data[i];
+
+    return hash;
+}
+
+static bool
+id_equals(const void *first, const void *second)
+{
+    return rbh_id_equal(first, second);
+}
+
+static const struct rbh_value EMPTY_MAP = {
+    .type = RBH_VT_MAP,
+};
+
+static void
+link_free(struct memory_link *link)
+{
+    free(link->xattrs);
+    free(link->name);
+    free(link->parent_id);
+    free(link);
+}
+
+static void
+entry_free(struct memory_entry *entry)
+{
+    for (size_t i = 0; i < entry->link_count; i++)
+        link_free(entry->links[i]);
+    free(entry->links);
+    free(entry->xattrs);
+    free(entry->symlink);
+    free(entry->statx);
+    free(entry->id);
+    free(entry);
+}
+
+static void
+catalog_indexes_mark_stale(struct memory_catalog *catalog)
+{
+    for (size_t i = 0; i < 32; i++)
+        catalog->indexes[i].stale = true;
+}
+
+static void
+catalog_modified(struct memory_catalog *catalog)
+{
+    catalog->modified = true;
+    catalog_indexes_mark_stale(catalog);
+}
+
+static struct memory_catalog *
+catalog_new(void)
+{
+    struct memory_catalog *catalog;
+    int save_errno;
+
+    catalog = calloc(1, sizeof(*catalog));
+    if (catalog == NULL)
+        return NULL;
+
+    catalog->ids_size = slots_for(0);
+    catalog->ids = rbh_hashmap_new(id_equals, id_hash, catalog->ids_size);
+    if (catalog->ids == NULL)
+        goto out_free_catalog;
+
+    catalog->children_size = slots_for(0);
+    catalog->children = rbh_hashmap_new(id_equals, id_hash,
+                                        catalog->children_size);
+    if (catalog->children == NULL)
+        goto out_destroy_ids;
+
+    rbh_list_init(&catalog->entries);
+    rbh_list_init(&catalog->parents);
+    catalog->indexed = MEMORY_DEFAULT_INDEXES;
+    catalog_indexes_mark_stale(catalog);
+    catalog->refcount = 1;
+    return catalog;
+
+out_destroy_ids:
+    save_errno = errno;
+    rbh_hashmap_destroy(catalog->ids);
+    errno = save_errno;
+out_free_catalog:
+    save_errno = errno;
+    free(catalog);
+    errno = save_errno;
+    return NULL;
+}
+
+static void
+catalog_destroy(struct memory_catalog *catalog)
+{
+    struct memory_children *children, *ctmp;
+    struct memory_entry *entry, *etmp;
+
+    rbh_list_foreach_safe(&catalog->parents, children, ctmp, parents) {
+        free(children->parent_id);
+        free(children);
+    }
+
+    rbh_list_foreach_safe(&catalog->entries, entry, etmp, entries)
+        entry_free(entry);
+
+    for (size_t i = 0; i < 32; i++)
+        free(catalog->indexes[i].entries);
+
+    rbh_hashmap_destroy(catalog->children);
+    rbh_hashmap_destroy(catalog->ids);
+    free(catalog->path);
+    free(catalog);
+}
+
+/* rbh_hashmaps cannot be resized, they are rebuilt instead */
+static int
+catalog_grow_ids(struct memory_catalog *catalog)
+{
+    struct rbh_hashmap *ids;
+    struct memory_entry *entry;
+    size_t size;
+
+    if (catalog->entry_count + 1 <= catalog->ids_size * 7 / 10)
+        return 0;
+
+    size = slots_for(2 * catalog->entry_count);
+    ids = rbh_hashmap_new(id_equals, id_hash, size);
+    if (ids == NULL)
+        return -1;
+
+    rbh_list_foreach(&catalog->entries, entry, entries) {
+        int rc = rbh_hashmap_set(ids, entry->id, entry);
+
+        assert(rc == 0);
+        (void)rc;
+    }
+
+    rbh_hashmap_destroy(catalog->ids);
+    catalog->ids = ids;
+    catalog->ids_size = size;
+    return 0;
+}
+
+static int
+catalog_grow_children(struct memory_catalog *catalog)
+{
+    struct memory_children *children;
+    struct rbh_hashmap *map;
+    size_t size;
+
+    if (catalog->parent_count + 1 <= catalog->children_size * 7 / 10)
+        return 0;
+
+    size = slots_for(2 * catalog->parent_count);
+    map = rbh_hashmap_new(id_equals, id_hash, size);
+    if (map == NULL)
+        return -1;
+
+    rbh_list_foreach(&catalog->parents, children, parents) {
+        int rc = rbh_hashmap_set(map, children->parent_id, children);
+
+        assert(rc == 0);
+        (void)rc;
+    }
+
+    rbh_hashmap_destroy(catalog->children);
+    catalog->children = map;
+    catalog->children_size = size;
+    return 0;
+}
+
+static struct memory_entry *
+catalog_entry(struct memory_catalog *catalog, const struct rbh_id *id)
+{
+    return (struct memory_entry *)rbh_hashmap_get(catalog->ids, id);
+}
+
+static struct memory_entry *
+catalog_entry_get_or_create(struct memory_catalog *catalog,
+                            const struct rbh_id *id)
+{
+    struct memory_entry *entry;
+    int save_errno;
+
+    entry = catalog_entry(catalog, id);
+    if (entry != NULL)
+        return entry;
+
+    if (catalog_grow_ids(catalog))
+        return NULL;
+
+    entry = calloc(1, sizeof(*entry));
+    if (entry == NULL)
+        return NULL;
+
+    entry->id = rbh_id_new(id->data, id->size);
+    if (entry->id == NULL)
+        goto out_free_entry;
+
+    if (rbh_hashmap_set(catalog->ids, entry->id, entry))
+        goto out_free_id;
+
+    rbh_list_add_tail(&catalog->entries, &entry->entries);
+    catalog->entry_count++;
+    catalog_modified(catalog);
+    return entry;
+
+out_free_id:
+    save_errno = errno;
+    free(entry->id);
+    errno = save_errno;
+out_free_entry:
+    save_errno = errno;
+    free(entry);
+    errno = save_errno;
+    return NULL;
+}
+
+static struct memory_children *
+catalog_children(struct memory_catalog *catalog, const struct rbh_id *parent_id)
+{
+    return (struct memory_children *)rbh_hashmap_get(catalog->children,
+                                                     parent_id);
+}
+
+static struct memory_children *
+catalog_children_get_or_create(struct memory_catalog *catalog,
+                               const struct rbh_id *parent_id)
+{
+    struct memory_children *children;
+    int save_errno;
+
+    children = catalog_children(catalog, parent_id);
+    if (children != NULL)
+        return children;
+
+    if (catalog_grow_children(catalog))
+        return NULL;
+
+    children = malloc(sizeof(*children));
+    if (children == NULL)
+        return NULL;
+
+    children->parent_id = rbh_id_new(parent_id->data, parent_id->size);
+    if (children->parent_id == NULL)
+        goto out_free_children;
+
+    if (rbh_hashmap_set(catalog->children, children->parent_id, children))
+        goto out_free_parent_id;
+
+    rbh_list_init(&children->links);
+    rbh_list_add_tail(&catalog->parents, &children->parents);
+    catalog->parent_count++;
+    return children;
+
+out_free_parent_id:
+    save_errno = errno;
+    free(children->parent_id);
+    errno = save_errno;
+out_free_children:
+    save_errno = errno;
+    free(children);
+    errno = save_errno;
+    return NULL;
+}
+
+static void
+catalog_unlink(struct memory_catalog *catalog, struct memory_entry *entry,
+               size_t index)
+{
+    struct memory_link *link = entry->links[index];
+    struct memory_children *children;
+
+    rbh_list_del(&link->siblings);
+    children = catalog_children(catalog, link->parent_id);
+    if (children != NULL && rbh_list_empty(&children->links)) {
+        rbh_hashmap_pop(catalog->children, children->parent_id);
+        rbh_list_del(&children->parents);
+        catalog->parent_count--;
+        free(children->parent_id);
+        free(children);
+    }
+
+    entry->links[index] = entry->links[--entry->link_count];
+    link_free(link);
+    catalog_modified(catalog);
+}
+
+static void
+catalog_delete(struct memory_catalog *catalog, struct memory_entry *entry)
+{
+    while (entry->link_count > 0)
+        catalog_unlink(catalog, entry, entry->link_count - 1);
+
+    rbh_hashmap_pop(catalog->ids, entry->id);
+    rbh_list_del(&entry->entries);
+    catalog->entry_count--;
+    entry_free(entry);
+    catalog_modified(catalog);
+}
+
+static ssize_t
+entry_find_link(const struct memory_entry *entry, const struct rbh_id *parent_id,
+                const char *name)
+{
+    for (size_t i = 0; i < entry->link_count; i++) {
+        const struct memory_link *link = entry->links[i];
+
+        if (rbh_id_equal(link->parent_id, parent_id)
+         && strcmp(link->name, name) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+/* Takes ownership of `xattrs' */
+static struct memory_link *
+catalog_link(struct memory_catalog *catalog, struct memory_entry *entry,
+             const struct rbh_id *parent_id, const char *name,
+             struct rbh_value *xattrs)
+{
+    struct memory_children *children;
+    struct memory_link **links;
+    struct memory_link *link;
+    int save_errno;
+
+    children = catalog_children_get_or_create(catalog, parent_id);
+    if (children == NULL)
+        return NULL;
+
+    links = reallocarray(entry->links, entry->link_count + 1, sizeof(*links));
+    if (links == NULL)
+        return NULL;
+    entry->links = links;
+
+    link = calloc(1, sizeof(*link));
+    if (link == NULL)
+        return NULL;
+
+    link->parent_id = rbh_id_new(parent_id->data, parent_id->size);
+    if (link->parent_id == NULL)
+        goto out_free_link;
+
+    link->name = strdup(name);
+    if (link->name == NULL)
+        goto out_free_link;
+
+    link->entry = entry;
+    link->xattrs = xattrs;
+    rbh_list_add_tail(&children->links, &link->siblings);
+    entry->links[entry->link_count++] = link;
+    catalog_modified(catalog);
+    return link;
+
+out_free_link:
+    save_errno = errno;
+    free(link->parent_id);
+    free(link);
+    errno = save_errno;
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*
+ |                                   update                                   |
+ *----------------------------------------------------------------------------*/
+
+static bool
+update_sets(const struct rbh_value_map *update, size_t index)
+{
+    const char *key = update->pairs[index].key;
+
+    /* Only the last occurrence of a key is applied */
+    for (size_t i = index + 1; i < update->count; i++) {
+        if (strcmp(update->pairs[i].key, key) == 0)
+            return false;
+    }
+    return update->pairs[index].value != NULL;
+}
+
+static bool
+update_has_key(const struct rbh_value_map *update, const char *key)
+{
+    for (size_t i = 0; i < update->count; i++) {
+        if (strcmp(update->pairs[i].key, key) == 0)
+            return true;
+    }
+    return false;
+}
+
+/* Set (or unset, for NULL values) the xattrs of \p update in \p xattrs */
+static int
+xattrs_update(struct rbh_value **xattrs, const struct rbh_value_map *update)
+{
+    const struct rbh_value_map *map = *xattrs ? &(*xattrs)->map : NULL;
+    struct rbh_value_pair *pairs;
+    struct rbh_value *value;
+    size_t count = 0;
+
+    if (update->count == 0)
+        return 0;
+
+    pairs = reallocarray(NULL, (map ? map->count : 0) + update->count,
+                         sizeof(*pairs));
+    if (pairs == NULL)
+        return -1;
+
+    for (size_t i = 0; map && i < map->count; i++) {
+        if (!update_has_key(update, map->pairs[i].key))
+            pairs[count++] = map->pairs[i];
+    }
+
+    for (size_t i = 0; i < update->count; i++) {
+        if (update_sets(update, i))
+            pairs[count++] = update->pairs[i];
+    }
+
+    value = rbh_value_map_new(pairs, count);
+    free(pairs);
+    if (value == NULL)
+        return -1;
+
+    free(*xattrs);
+    *xattrs = value;
+    return 0;
+}
+
+static int
+entry_upsert_statx(struct memory_entry *entry, const struct rbh_statx *statx)
+{
+    if (entry->statx == NULL) {
+        entry->statx = calloc(1, sizeof(*entry->statx));
+        if (entry->statx == NULL)
+            return -1;
+    }
+
+    /* merge_statx() combines the bits of the type and the mode */
+    if (statx->stx_mask & RBH_STATX_TYPE)
+        entry->statx->stx_mode &= ~S_IFMT;
+    if (statx->stx_mask & RBH_STATX_MODE)
+        entry->statx->stx_mode &= S_IFMT;
+
+    merge_statx(entry->statx, statx);
+    return 0;
+}
+
+static int
+memory_upsert(struct memory_catalog *catalog, const struct rbh_fsevent *fsevent)
+{
+    struct memory_entry *entry;
+
+    entry = catalog_entry_get_or_create(catalog, &fsevent->id);
+    if (entry == NULL)
+        return -1;
+
+    if (fsevent->upsert.statx && entry_upsert_statx(entry,
+                                                    fsevent->upsert.statx))
+        return -1;
+
+    if (fsevent->upsert.symlink) {
+        size_t length = strlen(fsevent->upsert.symlink);
+        char *symlink;
+
+        symlink = strdup(fsevent->upsert.symlink);
+        if (symlink == NULL)
+            return -1;
+
+        free(entry->symlink);
+        entry->symlink = symlink;
+        if (length > catalog->symlink_max)
+            catalog->symlink_max = length;
+    }
+
+    if (xattrs_update(&entry->xattrs, &fsevent->xattrs))
+        return -1;
+
+    catalog_modified(catalog);
+    return 0;
+}
+
+static int
+memory_link(struct memory_catalog *catalog, const struct rbh_fsevent *fsevent)
+{
+    struct memory_entry *entry;
+    struct rbh_value *xattrs;
+    ssize_t index;
+
+    entry = catalog_entry_get_or_create(catalog, &fsevent->id);
+    if (entry == NULL)
+        return -1;
+
+    xattrs = rbh_value_map_new(fsevent->xattrs.pairs, fsevent->xattrs.count);
+    if (xattrs == NULL)
+        return -1;
+
+    /* Like the mongo backend, replace any link with the same parent and name */
+    index = entry_find_link(entry, fsevent->link.parent_id,
+                            fsevent->link.name);
+    if (index >= 0)
+        catalog_unlink(catalog, entry, index);
+
+    if (catalog_link(catalog, entry, fsevent->link.parent_id,
+                     fsevent->link.name, xattrs) == NULL) {
+        int save_errno = errno;
+
+        free(xattrs);
+        errno = save_errno;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+memory_unlink(struct memory_catalog *catalog, const struct rbh_fsevent *fsevent)
+{
+    struct memory_entry *entry;
+    ssize_t index;
+
+    entry = catalog_entry(catalog, &fsevent->id);
+    if (entry == NULL)
+        return 0;
+
+    index = entry_find_link(entry, fsevent->link.parent_id,
+                            fsevent->link.name);
+    if (index >= 0)
+        catalog_unlink(catalog, entry, index);
+    return 0;
+}
+
+static int
+memory_xattr(struct memory_catalog *catalog, const struct rbh_fsevent *fsevent)
+{
+    struct memory_entry *entry;
+    ssize_t index;
+
+    entry = catalog_entry(catalog, &fsevent->id);
+    if (entry == NULL)
+        return 0;
+
+    catalog_modified(catalog);
+    if (fsevent->ns.parent_id == NULL)
+        return xattrs_update(&entry->xattrs, &fsevent->xattrs);
+
+    index = entry_find_link(entry, fsevent->ns.parent_id, fsevent->ns.name);
+    if (index < 0)
+        return 0;
+
+    return xattrs_update(&entry->links[index]->xattrs, &fsevent->xattrs);
+}
+
+static int
+memory_apply(struct memory_catalog *catalog, const struct rbh_fsevent *fsevent)
+{
+    struct memory_entry *entry;
+
+    switch (fsevent->type) {
+    case RBH_FET_UPSERT:
+        return memory_upsert(catalog, fsevent);
+    case RBH_FET_LINK:
+        return memory_link(catalog, fsevent);
+    case RBH_FET_UNLINK:
+        return memory_unlink(catalog, fsevent);
+    case RBH_FET_DELETE:
+        entry = catalog_entry(catalog, &fsevent->id);
+        if (entry != NULL)
+            catalog_delete(catalog, entry);
+        return 0;
+    case RBH_FET_XATTR:
+        return memory_xattr(catalog, fsevent);
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+static ssize_t
+catalog_update(struct memory_catalog *catalog, struct rbh_iterator *fsevents,
+               bool skip_error)
+{
+    int save_errno = errno;
+    size_t count = 0;
+
+    do {
+        const struct rbh_fsevent *fsevent;
+
+        errno = 0;
+        fsevent = rbh_iter_next(fsevents);
+        if (fsevent == NULL) {
+            if (errno == ENODATA || !skip_error)
+                break;
+
+            /* Same as the mongo backend: entries that disappeared while they
+             * were being enriched are skipped
+             */
+            if (errno == ESTALE || errno == ENOENT)
+                continue;
+            return -1;
+        }
+
+        if (memory_apply(catalog, fsevent))
+            return -1;
+        count++;
+    } while (true);
+
+    if (errno != ENODATA)
+        return -1;
+
+    errno = save_errno;
+    return count;
+}
+
+/*----------------------------------------------------------------------------*
+ |                                  fsentry                                   |
+ *----------------------------------------------------------------------------*/
+
+/* A struct rbh_fsentry that points into the catalog (plus a copy of the
+ * symlink), which filters are evaluated on
+ */
+struct memory_view {
+    struct rbh_fsentry *fsentry;
+    size_t size;
+};
+
+static int
+view_init(struct memory_view *view, const struct memory_catalog *catalog)
+{
+    view->size = sizeof(*view->fsentry) + catalog->symlink_max + 1;
+    view->fsentry = malloc(view->size);
+    return view->fsentry == NULL ? -1 : 0;
+}
+
+static const struct rbh_fsentry *
+view_fill(struct memory_view *view, const struct memory_entry *entry,
+          const struct memory_link *link)
+{
+    struct rbh_fsentry *fsentry = view->fsentry;
+    const struct rbh_value *ns_xattrs;
+    const struct rbh_value *xattrs;
+
+    ns_xattrs = link->xattrs ? link->xattrs : &EMPTY_MAP;
+    xattrs = entry->xattrs ? entry->xattrs : &EMPTY_MAP;
+
+    fsentry->mask = RBH_FP_ID | RBH_FP_PARENT_ID | RBH_FP_NAME
+                  | RBH_FP_NAMESPACE_XATTRS | RBH_FP_INODE_XATTRS;
+    fsentry->id = *entry->id;
+    fsentry->parent_id = *link->parent_id;
+    fsentry->name = link->name;
+    fsentry->xattrs.ns = ns_xattrs->map;
+    fsentry->xattrs.inode = xattrs->map;
+
+    fsentry->statx = entry->statx;
+    if (entry->statx)
+        fsentry->mask |= RBH_FP_STATX;
+
+    if (entry->symlink) {
+        assert(strlen(entry->symlink) < view->size - sizeof(*fsentry));
+        strcpy(fsentry->symlink, entry->symlink);
+        fsentry->mask |= RBH_FP_SYMLINK;
+    }
+
+    return fsentry;
+}
+
+/* Keep the xattrs of \p xattrs whose key is in \p keys (every one of them if
+ * \p keys is empty)
+ */
+static struct rbh_value_map
+xattrs_project(const struct rbh_value *xattrs, const struct rbh_value *keys,
+               struct rbh_value_pair *pairs)
+{
+    struct rbh_value_map map = {};
+
+    if (xattrs == NULL)
+        return map;
+
+    if (keys == NULL || keys->map.count == 0)
+        return xattrs->map;
+
+    map.pairs = pairs;
+    for (size_t i = 0; i < xattrs->map.count; i++) {
+        for (size_t j = 0; j < keys->map.count; j++) {
+            if (strcmp(xattrs->map.pairs[i].key, keys->map.pairs[j].key))
+                continue;
+
+            pairs[map.count++] = xattrs->map.pairs[i];
+            break;
+        }
+    }
+    return map;
+}
+
+struct memory_projection {
+    unsigned int fsentry_mask;
+    unsigned int statx_mask;
+    struct rbh_value *ns;           /* the keys of ns xattrs to keep */
+    struct rbh_value *inode;        /* the keys of inode xattrs to keep */
+};
+
+static int
+projection_init(struct memory_projection *dest,
+                const struct rbh_filter_projection *src)
+{
+    dest->fsentry_mask = src->fsentry_mask;
+    dest->statx_mask = src->statx_mask;
+
+    dest->ns = rbh_value_map_new(src->xattrs.ns.pairs, src->xattrs.ns.count);
+    if (dest->ns == NULL)
+        return -1;
+
+    dest->inode = rbh_value_map_new(src->xattrs.inode.pairs,
+                                    src->xattrs.inode.count);
+    if (dest->inode == NULL) {
+        int save_errno = errno;
+
+        free(dest->ns);
+        errno = save_errno;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+projection_fini(struct memory_projection *projection)
+{
+    free(projection->inode);
+    free(projection->ns);
+}
+
+static struct rbh_fsentry *
+fsentry_from_link(const struct memory_link *link,
+                  const struct memory_projection *projection)
+{
+    const struct memory_entry *entry = link->entry;
+    unsigned int mask = projection->fsentry_mask;
+    struct rbh_value_map ns_xattrs, xattrs;
+    struct rbh_value_pair *pairs;
+    struct rbh_fsentry *fsentry;
+    struct rbh_statx statx;
+    size_t count = 0;
+
+    if (link->xattrs)
+        count += link->xattrs->map.count;
+    if (entry->xattrs)
+        count += entry->xattrs->map.count;
+
+    pairs = reallocarray(NULL, count ? count : 1, sizeof(*pairs));
+    if (pairs == NULL)
+        return NULL;
+
+    ns_xattrs = xattrs_project(link->xattrs, projection->ns, pairs);
+    xattrs = xattrs_project(entry->xattrs, projection->inode,
+                            pairs + ns_xattrs.count);
+
+    if (entry->statx) {
+        statx = *entry->statx;
+        statx.stx_mask &= projection->statx_mask;
+    }
+
+    fsentry = rbh_fsentry_new(
+            mask & RBH_FP_ID ? entry->id : NULL,
+            mask & RBH_FP_PARENT_ID ? link->parent_id : NULL,
+            mask & RBH_FP_NAME ? link->name : NULL,
+            (mask & RBH_FP_STATX) && entry->statx ? &statx : NULL,
+            mask & RBH_FP_NAMESPACE_XATTRS ? &ns_xattrs : NULL,
+            mask & RBH_FP_INODE_XATTRS ? &xattrs : NULL,
+            mask & RBH_FP_SYMLINK ? entry->symlink : NULL
+            );
+    free(pairs);
+    return fsentry;
+}
+
+/*----------------------------------------------------------------------------*
+ |                                  indexes                                   |
+ *----------------------------------------------------------------------------*/
+
+static size_t
+field2index(uint32_t field)
+{
+    return __builtin_ctz(field);
+}
+
+static int
+index_compare(const void *first, const void *second, void *arg)
+{
+    const struct memory_entry *x = *(struct memory_entry * const *)first;
+    const struct memory_entry *y = *(struct memory_entry * const *)second;
+    const struct rbh_filter_field *field = arg;
+    const struct rbh_fsentry X = {
+        .mask = RBH_FP_STATX,
+        .statx = x->statx,
+    };
+    const struct rbh_fsentry Y = {
+        .mask = RBH_FP_STATX,
+        .statx = y->statx,
+    };
+
+    return rbh_filter_field_compare(field, &X, &Y);
+}
+
+static struct memory_index *
+catalog_index(struct memory_catalog *catalog, uint32_t field)
+{
+    struct memory_index *index = &catalog->indexes[field2index(field)];
+    struct rbh_filter_field sort_field = {
+        .fsentry = RBH_FP_STATX,
+        .statx = field,
+    };
+    struct memory_entry **entries;
+    struct memory_entry *entry;
+    size_t count = 0;
+
+    if (!index->stale)
+        return index;
+
+    entries = reallocarray(NULL, catalog->entry_count ? catalog->entry_count : 1,
+                           sizeof(*entries));
+    if (entries == NULL)
+        return NULL;
+
+    rbh_list_foreach(&catalog->entries, entry, entries) {
+        if (entry->statx && entry->statx->stx_mask & field)
+            entries[count++] = entry;
+    }
+
+    qsort_r(entries, count, sizeof(*entries), index_compare, &sort_field);
+
+    free(index->entries);
+    index->entries = entries;
+    index->count = count;
+    index->stale = false;
+    return index;
+}
+
+static bool
+index_entry_matches(const struct memory_entry *entry,
+                    const struct rbh_filter *filter)
+{
+    const struct rbh_fsentry FSENTRY = {
+        .mask = RBH_FP_STATX,
+        .statx = entry->statx,
+    };
+
+    return rbh_filter_matches(filter, &FSENTRY);
+}
+
+/* The first position in \p index where \p filter stops matching (\p filter
+ * must match a prefix of \p index)
+ */
+static size_t
+index_partition(const struct memory_index *index,
+                const struct rbh_filter *filter)
+{
+    size_t low = 0, high = index->count;
+
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+
+        if (index_entry_matches(index->entries[middle], filter))
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+/* Compute the range [*begin, *end) of \p index that \p filter may match */
+static void
+index_range(const struct memory_index *index, const struct rbh_filter *filter,
+            size_t *begin, size_t *end)
+{
+    struct rbh_filter bound = *filter;
+
+    *begin = 0;
+    *end = index->count;
+
+    switch (filter->op) {
+    case RBH_FOP_STRICTLY_LOWER:
+    case RBH_FOP_LOWER_OR_EQUAL:
+        *end = index_partition(index, filter);
+        break;
+    case RBH_FOP_EQUAL:
+        bound.op = RBH_FOP_LOWER_OR_EQUAL;
+        *end = index_partition(index, &bound);
+        __attribute__((fallthrough));
+    case RBH_FOP_GREATER_OR_EQUAL:
+        bound.op = RBH_FOP_STRICTLY_LOWER;
+        *begin = index_partition(index, &bound);
+        break;
+    case RBH_FOP_STRICTLY_GREATER:
+        bound.op = RBH_FOP_LOWER_OR_EQUAL;
+        *begin = index_partition(index, &bound);
+        break;
+    default:
+        break;
+    }
+
+    if (*begin > *end)
+        *begin = *end;
+}
+
+/*----------------------------------------------------------------------------*
+ |                                   filter                                   |
+ *----------------------------------------------------------------------------*/
+
+/* How to enumerate the candidates of a filter, from cheapest to costliest */
+enum memory_plan_type {
+    MPT_ID,         /* lookup one entry by id */
+    MPT_PARENT,     /* lookup the children of a parent */
+    MPT_INDEX,      /* walk a range of a statx index */
+    MPT_SCAN,       /* walk every entry */
+};
+
+struct memory_plan {
+    enum memory_plan_type type;
+    const struct rbh_filter *filter; /* the comparison the plan relies on */
+};
+
+static bool
+is_id_comparison(const struct rbh_filter *filter)
+{
+    return filter->op == RBH_FOP_EQUAL
+        && filter->compare.value.type == RBH_VT_BINARY;
+}
+
+static bool
+is_range_comparison(const struct rbh_filter *filter)
+{
+    switch (filter->op) {
+    case RBH_FOP_EQUAL:
+    case RBH_FOP_STRICTLY_LOWER:
+    case RBH_FOP_LOWER_OR_EQUAL:
+    case RBH_FOP_STRICTLY_GREATER:
+    case RBH_FOP_GREATER_OR_EQUAL:
+        break;
+    default:
+        return false;
+    }
+
+    switch (filter->compare.value.type) {
+    case RBH_VT_INT32:
+    case RBH_VT_UINT32:
+    case RBH_VT_INT64:
+    case RBH_VT_UINT64:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static struct memory_plan
+plan_filter(const struct memory_catalog *catalog,
+            const struct rbh_filter *filter)
+{
+    struct memory_plan plan = {
+        .type = MPT_SCAN,
+    };
+
+    if (filter == NULL)
+        return plan;
+
+    if (filter->op == RBH_FOP_AND) {
+        for (size_t i = 0; i < filter->logical.count; i++) {
+            struct memory_plan candidate;
+
+            candidate = plan_filter(catalog, filter->logical.filters[i]);
+            if (candidate.type < plan.type)
+                plan = candidate;
+        }
+        return plan;
+    }
+
+    if (!rbh_is_comparison_operator(filter->op))
+        return plan;
+
+    switch (filter->compare.field.fsentry) {
+    case RBH_FP_ID:
+        if (is_id_comparison(filter))
+            plan = (struct memory_plan){ .type = MPT_ID, .filter = filter };
+        break;
+    case RBH_FP_PARENT_ID:
+        if (is_id_comparison(filter))
+            plan = (struct memory_plan){ .type = MPT_PARENT, .filter = filter };
+        break;
+    case RBH_FP_STATX:
+        if (__builtin_popcount(filter->compare.field.statx) == 1
+         && catalog->indexed & filter->compare.field.statx
+         && is_range_comparison(filter))
+            plan = (struct memory_plan){ .type = MPT_INDEX, .filter = filter };
+        break;
+    default:
+        break;
+    }
+
+    return plan;
+}
+
+struct memory_matches {
+    struct memory_link **links;
+    size_t count;
+    size_t size;
+};
+
+static int
+matches_push(struct memory_matches *matches, struct memory_link *link)
+{
+    if (matches->count == matches->size) {
+        size_t size = matches->size ? 2 * matches->size : 64;
+        struct memory_link **links;
+
+        links = reallocarray(matches->links, size, sizeof(*links));
+        if (links == NULL)
+            return -1;
+
+        matches->links = links;
+        matches->size = size;
+    }
+
+    matches->links[matches->count++] = link;
+    return 0;
+}
+
+struct memory_query {
+    const struct rbh_filter *filter;
+    unsigned long visit;            /* if not 0, restrict to marked links */
+    struct memory_view view;
+    struct memory_matches matches;
+};
+
+static int
+query_link(struct memory_query *query, struct memory_link *link)
+{
+    const struct rbh_fsentry *fsentry;
+
+    if (query->visit != 0 && link->visit != query->visit)
+        return 0;
+
+    fsentry = view_fill(&query->view, link->entry, link);
+    if (!rbh_filter_matches(query->filter, fsentry))
+        return 0;
+
+    return matches_push(&query->matches, link);
+}
+
+static int
+query_entry(struct memory_query *query, struct memory_entry *entry)
+{
+    for (size_t i = 0; i < entry->link_count; i++) {
+        if (query_link(query, entry->links[i]))
+            return -1;
+    }
+    return 0;
+}
+
+static int
+query_run(struct memory_catalog *catalog, struct memory_query *query)
+{
+    struct memory_plan plan = plan_filter(catalog, query->filter);
+    struct memory_children *children;
+    struct memory_index *index;
+    struct memory_entry *entry;
+    struct memory_link *link;
+    struct rbh_id id;
+    size_t begin, end;
+
+    switch (plan.type) {
+    case MPT_ID:
+        id.data = plan.filter->compare.value.binary.data;
+        id.size = plan.filter->compare.value.binary.size;
+        entry = catalog_entry(catalog, &id);
+        return entry ? query_entry(query, entry) : 0;
+    case MPT_PARENT:
+        id.data = plan.filter->compare.value.binary.data;
+        id.size = plan.filter->compare.value.binary.size;
+        children = catalog_children(catalog, &id);
+        if (children == NULL)
+            return 0;
+
+        rbh_list_foreach(&children->links, link, siblings) {
+            if (query_link(query, link))
+                return -1;
+        }
+        return 0;
+    case MPT_INDEX:
+        index = catalog_index(catalog, plan.filter->compare.field.statx);
+        if (index == NULL)
+            return -1;
+
+        index_range(index, plan.filter, &begin, &end);
+        for (size_t i = begin; i < end; i++) {
+            if (query_entry(query, index->entries[i]))
+                return -1;
+        }
+        return 0;
+    case MPT_SCAN:
+        rbh_list_foreach(&catalog->entries, entry, entries) {
+            if (query_entry(query, entry))
+                return -1;
+        }
+        return 0;
+    }
+
+    return 0;
+}
+
+struct sort_context {
+    const struct rbh_filter_sort *items;
+    size_t count;
+    struct memory_view first;
+    struct memory_view second;
+};
+
+static int
+link_compare(const void *first, const void *second, void *arg)
+{
+    const struct memory_link *x = *(struct memory_link * const *)first;
+    const struct memory_link *y = *(struct memory_link * const *)second;
+    const struct rbh_fsentry *X, *Y;
+    struct sort_context *context = arg;
+
+    X = view_fill(&context->first, x->entry, x);
+    Y = view_fill(&context->second, y->entry, y);
+    for (size_t i = 0; i < context->count; i++) {
+        const struct rbh_filter_sort *item = &context->items[i];
+        int rc = rbh_filter_field_compare(&item->field, X, Y);
+
+        if (rc)
+            return item->ascending ? rc : -rc;
+    }
+    return 0;
+}
+
+static int
+matches_sort(struct memory_matches *matches,
+             const struct memory_catalog *catalog,
+             const struct rbh_filter_options *options)
+{
+    struct sort_context context = {
+        .items = options->sort.items,
+        .count = options->sort.count,
+    };
+    int save_errno;
+
+    if (options->sort.count == 0)
+        return 0;
+
+    if (view_init(&context.first, catalog))
+        return -1;
+    if (view_init(&context.second, catalog))
+        goto out_free_first;
+
+    qsort_r(matches->links, matches->count, sizeof(*matches->links),
+            link_compare, &context);
+    free(context.second.fsentry);
+    free(context.first.fsentry);
+    return 0;
+
+out_free_first:
+    save_errno = errno;
+    free(context.first.fsentry);
+    errno = save_errno;
+    return -1;
+}
+
+struct memory_iterator {
+    struct rbh_mut_iterator iterator;
+    struct memory_catalog *catalog;
+    struct memory_projection projection;
+    struct memory_link **links;
+    size_t index;
+    size_t count;
+};
+
+static void *
+memory_iter_next(void *iterator)
+{
+    struct memory_iterator *memory_iter = iterator;
+
+    if (memory_iter->index >= memory_iter->count) {
+        errno = ENODATA;
+        return NULL;
+    }
+
+    return fsentry_from_link(memory_iter->links[memory_iter->index++],
+                             &memory_iter->projection);
+}
+
+static void
+catalog_release(struct memory_catalog *catalog);
+
+static void
+memory_iter_destroy(void *iterator)
+{
+    struct memory_iterator *memory_iter = iterator;
+
+    projection_fini(&memory_iter->projection);
+    catalog_release(memory_iter->catalog);
+    free(memory_iter->links);
+    free(memory_iter);
+}
+
+static const struct rbh_mut_iterator_operations MEMORY_ITER_OPS = {
+    .next = memory_iter_next,
+    .destroy = memory_iter_destroy,
+};
+
+static const struct rbh_mut_iterator MEMORY_ITER = {
+    .ops = &MEMORY_ITER_OPS,
+};
+
+static struct rbh_mut_iterator *
+catalog_filter(struct memory_catalog *catalog, const struct rbh_filter *filter,
+               const struct rbh_filter_options *options, unsigned long visit)
+{
+    struct memory_iterator *memory_iter;
+    struct memory_query query = {
+        .filter = filter,
+        .visit = visit,
+    };
+    size_t skip, count;
+    int save_errno;
+
+    if (rbh_filter_validate(filter))
+        return NULL;
+
+    memory_iter = malloc(sizeof(*memory_iter));
+    if (memory_iter == NULL)
+        return NULL;
+
+    if (projection_init(&memory_iter->projection, &options->projection))
+        goto out_free_iter;
+
+    if (view_init(&query.view, catalog))
+        goto out_fini_projection;
+
+    if (query_run(catalog, &query))
+        goto out_free_matches;
+
+    if (matches_sort(&query.matches, catalog, options))
+        goto out_free_matches;
+
+    free(query.view.fsentry);
+
+    skip = options->skip < query.matches.count ? options->skip
+                                               : query.matches.count;
+    count = query.matches.count - skip;
+    if (options->limit > 0 && options->limit < count)
+        count = options->limit;
+
+    memory_iter->iterator = MEMORY_ITER;
+    memory_iter->catalog = catalog;
+    catalog->refcount++;
+    memory_iter->links = query.matches.links;
+    memory_iter->index = skip;
+    memory_iter->count = skip + count;
+    return &memory_iter->iterator;
+
+out_free_matches:
+    save_errno = errno;
+    free(query.matches.links);
+    free(query.view.fsentry);
+    errno = save_errno;
+out_fini_projection:
+    save_errno = errno;
+    projection_fini(&memory_iter->projection);
+    errno = save_errno;
+out_free_iter:
+    save_errno = errno;
+    free(memory_iter);
+    errno = save_errno;
+    return NULL;
+}
+
+/* Mark the links of the subtree rooted at \p root, \p visit is set to the mark */
+static int
+catalog_mark_subtree(struct memory_catalog *catalog, struct memory_entry *root,
+                     unsigned long *visit)
+{
+    struct memory_entry **queue;
+    size_t head = 0, tail = 0;
+    size_t size = 64;
+
+    queue = reallocarray(NULL, size, sizeof(*queue));
+    if (queue == NULL)
+        return -1;
+
+    *visit = ++catalog->visit;
+    root->visit = *visit;
+    for (size_t i = 0; i < root->link_count; i++)
+        root->links[i]->visit = *visit;
+    queue[tail++] = root;
+
+    while (head < tail) {
+        struct memory_entry *entry = queue[head++];
+        struct memory_children *children;
+        struct memory_link *link;
+
+        children = catalog_children(catalog, entry->id);
+        if (children == NULL)
+            continue;
+
+        rbh_list_foreach(&children->links, link, siblings) {
+            link->visit = *visit;
+            if (link->entry->visit == *visit)
+                continue;
+
+            link->entry->visit = *visit;
+            if (tail == size) {
+                struct memory_entry **tmp;
+
+                tmp = reallocarray(queue, 2 * size, sizeof(*queue));
+                if (tmp == NULL) {
+                    free(queue);
+                    return -1;
+                }
+                queue = tmp;
+                size *= 2;
+            }
+            queue[tail++] = link->entry;
+        }
+    }
+
+    free(queue);
+    return 0;
+}
+
+/*----------------------------------------------------------------------------*
+ |                                persistence                                 |
+ *----------------------------------------------------------------------------*/
+
+/* Dumps are a sequence of entries, each with its links, encoded in the host's
+ * byte order: they are meant to be reloaded on the same machine (or at least
+ * the same architecture), not to be exchanged.
+ */
+
+static const char MEMORY_MAGIC[8] = "rbhmem01";
+
+static bool
+dump_bytes(FILE *file, const void *data, size_t size)
+{
+    return size == 0 || fwrite(data, size, 1, file) == 1;
+}
+
+static bool
+dump_u64(FILE *file, uint64_t u64)
+{
+    return dump_bytes(file, &u64, sizeof(u64));
+}
+
+static bool
+dump_u8(FILE *file, uint8_t u8)
+{
+    return dump_bytes(file, &u8, sizeof(u8));
+}
+
+static bool
+dump_buffer(FILE *file, const void *data, size_t size)
+{
+    return dump_u64(file, size) && dump_bytes(file, data, size);
+}
+
+/* Strings are dumped with their terminating '\0', NULL is dumped as "" */
+static bool
+dump_string(FILE *file, const char *string)
+{
+    return dump_buffer(file, string, string ? strlen(string) + 1 : 0);
+}
+
+static bool
+dump_id(FILE *file, const struct rbh_id *id)
+{
+    return dump_buffer(file, id->data, id->size);
+}
+
+static bool
+dump_value(FILE *file, const struct rbh_value *value)
+{
+    if (!dump_u8(file, value->type))
+        return false;
+
+    switch (value->type) {
+    case RBH_VT_BOOLEAN:
+        return dump_u8(file, value->boolean);
+    case RBH_VT_INT32:
+        return dump_bytes(file, &value->int32, sizeof(value->int32));
+    case RBH_VT_UINT32:
+        return dump_bytes(file, &value->uint32, sizeof(value->uint32));
+    case RBH_VT_INT64:
+        return dump_bytes(file, &value->int64, sizeof(value->int64));
+    case RBH_VT_UINT64:
+        return dump_u64(file, value->uint64);
+    case RBH_VT_STRING:
+        return dump_string(file, value->string);
+    case RBH_VT_BINARY:
+        return dump_buffer(file, value->binary.data, value->binary.size);
+    case RBH_VT_REGEX:
+        return dump_string(file, value->regex.string)
+            && dump_u64(file, value->regex.options);
+    case RBH_VT_SEQUENCE:
+        if (!dump_u64(file, value->sequence.count))
+            return false;
+        for (size_t i = 0; i < value->sequence.count; i++) {
+            if (!dump_value(file, &value->sequence.values[i]))
+                return false;
+        }
+        return true;
+    case RBH_VT_MAP:
+        if (!dump_u64(file, value->map.count))
+            return false;
+        for (size_t i = 0; i < value->map.count; i++) {
+            const struct rbh_value_pair *pair = &value->map.pairs[i];
+
+            if (!dump_string(file, pair->key)
+             || !dump_u8(file, pair->value != NULL)
+             || (pair->value && !dump_value(file, pair->value)))
+                return false;
+        }
+        return true;
+    }
+
+    return false;
+}
+
+static bool
+dump_xattrs(FILE *file, const struct rbh_value *xattrs)
+{
+    return dump_value(file, xattrs ? xattrs : &EMPTY_MAP);
+}
+
+static bool
+dump_entry(FILE *file, const struct memory_entry *entry)
+{
+    if (!dump_id(file, entry->id)
+     || !dump_u8(file, entry->statx != NULL)
+     || (entry->statx && !dump_bytes(file, entry->statx, sizeof(*entry->statx)))
+     || !dump_string(file, entry->symlink)
+     || !dump_xattrs(file, entry->xattrs)
+     || !dump_u64(file, entry->link_count))
+        return false;
+
+    for (size_t i = 0; i < entry->link_count; i++) {
+        const struct memory_link *link = entry->links[i];
+
+        if (!dump_id(file, link->parent_id)
+         || !dump_string(file, link->name)
+         || !dump_xattrs(file, link->xattrs))
+            return false;
+    }
+
+    return true;
+}
+
+static int
+catalog_dump(const struct memory_catalog *catalog)
+{
+    const struct memory_entry *entry;
+    int save_errno;
+    char *tmp;
+    FILE *file;
+
+    if (asprintf(&tmp, "%s.tmp", catalog->path) < 0)
+        return -1;
+
+    file = fopen(tmp, "w");
+    if (file == NULL)
+        goto out_free_tmp;
+
+    if (!dump_bytes(file, MEMORY_MAGIC, sizeof(MEMORY_MAGIC))
+     || !dump_u64(file, catalog->entry_count))
+        goto out_close;
+
+    rbh_list_foreach(&catalog->entries, entry, entries) {
+        if (!dump_entry(file, entry))
+            goto out_close;
+    }
+
+    if (fclose(file))
+        goto out_unlink;
+
+    if (rename(tmp, catalog->path))
+        goto out_unlink;
+
+    free(tmp);
+    return 0;
+
+out_close:
+    save_errno = errno;
+    fclose(file);
+    errno = save_errno;
+out_unlink:
+    save_errno = errno;
+    remove(tmp);
+    errno = save_errno;
+out_free_tmp:
+    save_errno = errno;
+    free(tmp);
+    errno = save_errno;
+    return -1;
+}
+
+/* Loading parses a copy of the whole dump: strings and binaries point into it,
+ * values are then copied into the catalog with rbh_value_map_new().
+ */
+struct cursor {
+    const char *data;
+    size_t size;
+};
+
+static const void *
+load_bytes(struct cursor *cursor, size_t size)
+{
+    const char *data = cursor->data;
+
+    if (size > cursor->size) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    cursor->data += size;
+    cursor->size -= size;
+    return data;
+}
+
+static int
+load_u64(struct cursor *cursor, uint64_t *u64)
+{
+    const void *data = load_bytes(cursor, sizeof(*u64));
+
+    if (data == NULL)
+        return -1;
+    memcpy(u64, data, sizeof(*u64));
+    return 0;
+}
+
+static int
+load_u8(struct cursor *cursor, uint8_t *u8)
+{
+    const uint8_t *data = load_bytes(cursor, sizeof(*u8));
+
+    if (data == NULL)
+        return -1;
+    *u8 = *data;
+    return 0;
+}
+
+static int
+load_buffer(struct cursor *cursor, const char **data, size_t *size)
+{
+    uint64_t u64;
+
+    if (load_u64(cursor, &u64))
+        return -1;
+
+    *data = load_bytes(cursor, u64);
+    if (*data == NULL)
+        return -1;
+
+    *size = u64;
+    return 0;
+}
+
+static int
+load_string(struct cursor *cursor, const char **string)
+{
+    size_t size;
+
+    if (load_buffer(cursor, string, &size))
+        return -1;
+
+    if (size == 0) {
+        *string = NULL;
+        return 0;
+    }
+
+    if ((*string)[size - 1] != '\0') {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+static int
+load_id(struct cursor *cursor, struct rbh_id *id)
+{
+    return load_buffer(cursor, &id->data, &id->size);
+}
+
+/* Check \p count items of at least \p size bytes each may follow */
+static int
+load_check_count(const struct cursor *cursor, uint64_t count, size_t size)
+{
+    if (count > cursor->size / size) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+static void
+value_fini(struct rbh_value *value)
+{
+    switch (value->type) {
+    case RBH_VT_SEQUENCE:
+        for (size_t i = 0; i < value->sequence.count; i++)
+            value_fini((struct rbh_value *)&value->sequence.values[i]);
+        free((void *)value->sequence.values);
+        break;
+    case RBH_VT_MAP:
+        for (size_t i = 0; i < value->map.count; i++) {
+            struct rbh_value *pair_value;
+
+            pair_value = (struct rbh_value *)value->map.pairs[i].value;
+            if (pair_value == NULL)
+                continue;
+            value_fini(pair_value);
+            free(pair_value);
+        }
+        free((void *)value->map.pairs);
+        break;
+    default:
+        break;
+    }
+}
+
+static int
+load_value(struct cursor *cursor, struct rbh_value *value);
+
+static int
+load_sequence(struct cursor *cursor, struct rbh_value *value)
+{
+    struct rbh_value *values;
+    uint64_t count;
+
+    if (load_u64(cursor, &count) || load_check_count(cursor, count, 1))
+        return -1;
+
+    values = calloc(count ? count : 1, sizeof(*values));
+    if (values == NULL)
+        return -1;
+
+    /* calloc() makes every value a boolean, which value_fini() ignores */
+    value->sequence.values = values;
+    value->sequence.count = count;
+    for (size_t i = 0; i < count; i++) {
+        if (load_value(cursor, &values[i]))
+            return -1;
+    }
+    return 0;
+}
+
+static int
+load_map(struct cursor *cursor, struct rbh_value *value)
+{
+    struct rbh_value_pair *pairs;
+    uint64_t count;
+
+    if (load_u64(cursor, &count) || load_check_count(cursor, count, 9))
+        return -1;
+
+    pairs = calloc(count ? count : 1, sizeof(*pairs));
+    if (pairs == NULL)
+        return -1;
+
+    value->map.pairs = pairs;
+    value->map.count = 0;
+    for (size_t i = 0; i < count; i++) {
+        struct rbh_value *pair_value;
+        uint8_t has_value;
+
+        if (load_string(cursor, &pairs[i].key) || load_u8(cursor, &has_value))
+            return -1;
+
+        if (pairs[i].key == NULL) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        value->map.count++;
+        if (!has_value)
+            continue;
+
+        pair_value = malloc(sizeof(*pair_value));
+        if (pair_value == NULL)
+            return -1;
+
+        /* So that value_fini() does not look into it */
+        pair_value->type = RBH_VT_BOOLEAN;
+        pairs[i].value = pair_value;
+        if (load_value(cursor, pair_value))
+            return -1;
+    }
+    return 0;
+}
+
+/* On error, \p value is left in a state value_fini() can deal with */
+static int
+load_value(struct cursor *cursor, struct rbh_value *value)
+{
+    const void *data;
+    uint64_t options;
+    uint8_t type;
+    uint8_t u8;
+
+    value->type = RBH_VT_BOOLEAN;
+    if (load_u8(cursor, &type))
+        return -1;
+
+    switch (type) {
+    case RBH_VT_BOOLEAN:
+        if (load_u8(cursor, &u8))
+            return -1;
+        value->boolean = u8;
+        return 0;
+    case RBH_VT_INT32:
+    case RBH_VT_UINT32:
+        data = load_bytes(cursor, sizeof(value->int32));
+        if (data == NULL)
+            return -1;
+        value->type = type;
+        memcpy(&value->int32, data, sizeof(value->int32));
+        return 0;
+    case RBH_VT_INT64:
+    case RBH_VT_UINT64:
+        data = load_bytes(cursor, sizeof(value->int64));
+        if (data == NULL)
+            return -1;
+        value->type = type;
+        memcpy(&value->int64, data, sizeof(value->int64));
+        return 0;
+    case RBH_VT_STRING:
+        if (load_string(cursor, &value->string))
+            return -1;
+        if (value->string == NULL) {
+            errno = EINVAL;
+            return -1;
+        }
+        value->type = type;
+        return 0;
+    case RBH_VT_BINARY:
+        if (load_buffer(cursor, &value->binary.data, &value->binary.size))
+            return -1;
+        value->type = type;
+        return 0;
+    case RBH_VT_REGEX:
+        if (load_string(cursor, &value->regex.string)
+         || load_u64(cursor, &options))
+            return -1;
+        if (value->regex.string == NULL) {
+            errno = EINVAL;
+            return -1;
+        }
+        value->type = type;
+        value->regex.options = options;
+        return 0;
+    case RBH_VT_SEQUENCE:
+        value->type = type;
+        value->sequence.values = NULL;
+        value->sequence.count = 0;
+        return load_sequence(cursor, value);
+    case RBH_VT_MAP:
+        value->type = type;
+        value->map.pairs = NULL;
+        value->map.count = 0;
+        return load_map(cursor, value);
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+static struct rbh_value *
+load_xattrs(struct cursor *cursor)
+{
+    struct rbh_value *xattrs = NULL;
+    struct rbh_value value;
+    int save_errno;
+
+    if (load_value(cursor, &value))
+        goto out_fini;
+
+    if (value.type != RBH_VT_MAP) {
+        errno = EINVAL;
+        goto out_fini;
+    }
+
+    xattrs = rbh_value_map_new(value.map.pairs, value.map.count);
+
+out_fini:
+    save_errno = errno;
+    value_fini(&value);
+    errno = save_errno;
+    return xattrs;
+}
+
+static int
+load_link(struct memory_catalog *catalog, struct memory_entry *entry,
+          struct cursor *cursor)
+{
+    struct rbh_id parent_id;
+    struct rbh_value *xattrs;
+    const char *name;
+
+    if (load_id(cursor, &parent_id) || load_string(cursor, &name))
+        return -1;
+
+    if (name == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    xattrs = load_xattrs(cursor);
+    if (xattrs == NULL)
+        return -1;
+
+    if (catalog_link(catalog, entry, &parent_id, name, xattrs) == NULL) {
+        int save_errno = errno;
+
+        free(xattrs);
+        errno = save_errno;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+load_entry(struct memory_catalog *catalog, struct cursor *cursor)
+{
+    struct memory_entry *entry;
+    const struct rbh_statx *statx;
+    const char *symlink;
+    struct rbh_id id;
+    uint64_t count;
+    uint8_t u8;
+
+    if (load_id(cursor, &id) || load_u8(cursor, &u8))
+        return -1;
+
+    entry = catalog_entry_get_or_create(catalog, &id);
+    if (entry == NULL)
+        return -1;
+
+    if (u8) {
+        statx = load_bytes(cursor, sizeof(*statx));
+        if (statx == NULL)
+            return -1;
+
+        entry->statx = malloc(sizeof(*entry->statx));
+        if (entry->statx == NULL)
+            return -1;
+        memcpy(entry->statx, statx, sizeof(*statx));
+    }
+
+    if (load_string(cursor, &symlink))
+        return -1;
+
+    if (symlink) {
+        entry->symlink = strdup(symlink);
+        if (entry->symlink == NULL)
+            return -1;
+
+        if (strlen(symlink) > catalog->symlink_max)
+            catalog->symlink_max = strlen(symlink);
+    }
+
+    entry->xattrs = load_xattrs(cursor);
+    if (entry->xattrs == NULL)
+        return -1;
+
+    if (load_u64(cursor, &count))
+        return -1;
+
+    for (uint64_t i = 0; i < count; i++) {
+        if (load_link(catalog, entry, cursor))
+            return -1;
+    }
+
+    return 0;
+}
+
+static int
+catalog_load(struct memory_catalog *catalog, FILE *file)
+{
+    struct cursor cursor;
+    const char *magic;
+    struct stat st;
+    int save_errno;
+    uint64_t count;
+    char *data;
+
+    if (fstat(fileno(file), &st))
+        return -1;
+
+    data = malloc(st.st_size ? st.st_size : 1);
+    if (data == NULL)
+        return -1;
+
+    if (st.st_size > 0 && fread(data, st.st_size, 1, file) != 1) {
+        errno = ferror(file) ? EIO : EINVAL;
+        goto out_free;
+    }
+
+    cursor.data = data;
+    cursor.size = st.st_size;
+    magic = load_bytes(&cursor, sizeof(MEMORY_MAGIC));
+    if (magic == NULL)
+        goto out_free;
+
+    if (memcmp(magic, MEMORY_MAGIC, sizeof(MEMORY_MAGIC))) {
+        errno = EINVAL;
+        goto out_free;
+    }
+
+    if (load_u64(&cursor, &count))
+        goto out_free;
+
+    for (uint64_t i = 0; i < count; i++) {
+        if (load_entry(catalog, &cursor))
+            goto out_free;
+    }
+
+    free(data);
+    return 0;
+
+out_free:
+    save_errno = errno;
+    free(data);
+    errno = save_errno;
+    return -1;
+}
+
+static void
+catalog_release(struct memory_catalog *catalog)
+{
+    if (--catalog->refcount > 0)
+        return;
+
+    if (catalog->path && catalog->modified && catalog_dump(catalog))
+        fprintf(stderr, "Failed to dump the memory backend to '%s': %s\n",
+                catalog->path, strerror(errno));
+
+    catalog_destroy(catalog);
+}
+
+/*----------------------------------------------------------------------------*
+ |                               memory_backend                               |
+ *----------------------------------------------------------------------------*/
+
+struct memory_backend {
+    struct rbh_backend backend;
+    struct memory_catalog *catalog;
+    struct rbh_id *root_id;         /* NULL, or the root of a branch */
+};
+
+    /*--------------------------------------------------------------------*
+     |                             get_option                             |
+     *--------------------------------------------------------------------*/
+
+static int
+memory_get_option(void *backend, unsigned int option, void *data,
+                  size_t *data_size)
+{
+    struct memory_backend *memory = backend;
+    uint32_t indexed = memory->catalog->indexed;
+
+    switch (option) {
+    case RBH_MEMBO_INDEXES:
+        if (*data_size < sizeof(indexed)) {
+            *data_size = sizeof(indexed);
+            errno = EOVERFLOW;
+            return -1;
+        }
+        memcpy(data, &indexed, sizeof(indexed));
+        *data_size = sizeof(indexed);
+        return 0;
+    }
+
+    errno = ENOPROTOOPT;
+    return -1;
+}
+
+    /*--------------------------------------------------------------------*
+     |                             set_option                             |
+     *--------------------------------------------------------------------*/
+
+static int
+memory_set_option(void *backend, unsigned int option, const void *data,
+                  size_t data_size)
+{
+    struct memory_backend *memory = backend;
+    uint32_t indexed;
+
+    switch (option) {
+    case RBH_MEMBO_INDEXES:
+        if (data_size != sizeof(indexed)) {
+            errno = EINVAL;
+            return -1;
+        }
+        memcpy(&indexed, data, sizeof(indexed));
+
+        memory->catalog->indexed = indexed;
+        catalog_indexes_mark_stale(memory->catalog);
+        return 0;
+    }
+
+    errno = ENOPROTOOPT;
+    return -1;
+}
+
+    /*--------------------------------------------------------------------*
+     |                               update                               |
+     *--------------------------------------------------------------------*/
+
+static ssize_t
+memory_backend_update(void *backend, struct rbh_iterator *fsevents,
+                      bool skip_error)
+{
+    struct memory_backend *memory = backend;
+
+    return catalog_update(memory->catalog, fsevents, skip_error);
+}
+
+    /*--------------------------------------------------------------------*
+     |                               filter                               |
+     *--------------------------------------------------------------------*/
+
+static struct rbh_mut_iterator *
+memory_backend_filter(void *backend, const struct rbh_filter *filter,
+                      const struct rbh_filter_options *options)
+{
+    struct memory_backend *memory = backend;
+    struct memory_catalog *catalog = memory->catalog;
+    struct memory_entry *root;
+    unsigned long visit;
+
+    if (memory->root_id == NULL)
+        return catalog_filter(catalog, filter, options, 0);
+
+    /* The root of a branch may come and go with updates, when it is missing
+     * nothing is marked, and so nothing matches
+     */
+    root = catalog_entry(catalog, memory->root_id);
+    if (root == NULL)
+        visit = ++catalog->visit;
+    else if (catalog_mark_subtree(catalog, root, &visit))
+        return NULL;
+
+    return catalog_filter(catalog, filter, options, visit);
+}
+
+    /*--------------------------------------------------------------------*
+     |                                root                                |
+     *--------------------------------------------------------------------*/
+
+static const struct rbh_filter ROOT_FILTER = {
+    .op = RBH_FOP_EQUAL,
+    .compare = {
+        .field = {
+            .fsentry = RBH_FP_PARENT_ID,
+        },
+        .value = {
+            .type = RBH_VT_BINARY,
+            .binary = {
+                .size = 0,
+            },
+        },
+    },
+};
+
+static struct rbh_fsentry *
+memory_root(void *backend, const struct rbh_filter_projection *projection)
+{
+    struct memory_backend *memory = backend;
+    const struct rbh_filter ID_FILTER = {
+        .op = RBH_FOP_EQUAL,
+        .compare = {
+            .field = {
+                .fsentry = RBH_FP_ID,
+            },
+            .value = {
+                .type = RBH_VT_BINARY,
+                .binary = {
+                    .data = memory->root_id ? memory->root_id->data : NULL,
+                    .size = memory->root_id ? memory->root_id->size : 0,
+                },
+            },
+        },
+    };
+
+    return rbh_backend_filter_one(backend, memory->root_id ? &ID_FILTER
+                                                           : &ROOT_FILTER,
+                                  projection);
+}
+
+    /*--------------------------------------------------------------------*
+     |                               branch                               |
+     *--------------------------------------------------------------------*/
+
+static const struct rbh_backend MEMORY_BACKEND;
+
+static struct rbh_backend *
+memory_backend_branch(void *backend, const struct rbh_id *id, const char *path)
+{
+    const struct rbh_filter_projection ID_ONLY = {
+        .fsentry_mask = RBH_FP_ID,
+    };
+    struct memory_backend *memory = backend;
+    struct rbh_fsentry *fsentry = NULL;
+    struct memory_backend *branch;
+    int save_errno;
+
+    if (id == NULL) {
+        if (path == NULL) {
+            errno = EINVAL;
+            return NULL;
+        }
+
+        fsentry = rbh_backend_fsentry_from_path(backend, path, &ID_ONLY);
+        if (fsentry == NULL)
+            return NULL;
+
+        if (!(fsentry->mask & RBH_FP_ID)) {
+            free(fsentry);
+            errno = ENODATA;
+            return NULL;
+        }
+        id = &fsentry->id;
+    }
+
+    branch = malloc(sizeof(*branch));
+    if (branch == NULL)
+        goto out_free_fsentry;
+
+    branch->root_id = rbh_id_new(id->data, id->size);
+    if (branch->root_id == NULL)
+        goto out_free_branch;
+
+    free(fsentry);
+    branch->backend = MEMORY_BACKEND;
+    branch->catalog = memory->catalog;
+    branch->catalog->refcount++;
+    return &branch->backend;
+
+out_free_branch:
+    save_errno = errno;
+    free(branch);
+    errno = save_errno;
+out_free_fsentry:
+    save_errno = errno;
+    free(fsentry);
+    errno = save_errno;
+    return NULL;
+}
+
+    /*--------------------------------------------------------------------*
+     |                              destroy()                             |
+     *--------------------------------------------------------------------*/
+
+static void
+memory_backend_destroy(void *backend)
+{
+    struct memory_backend *memory = backend;
+
+    catalog_release(memory->catalog);
+    free(memory->root_id);
+    free(memory);
+}
+
+static const struct rbh_backend_operations MEMORY_BACKEND_OPS = {
+    .get_option = memory_get_option,
+    .set_option = memory_set_option,
+    .update = memory_backend_update,
+    .branch = memory_backend_branch,
+    .root = memory_root,
+    .filter = memory_backend_filter,
+    .destroy = memory_backend_destroy,
+};
+
+static const struct rbh_backend MEMORY_BACKEND = {
+    .id = RBH_BI_MEMORY,
+    .name = RBH_MEMORY_BACKEND_NAME,
+    .ops = &MEMORY_BACKEND_OPS,
+};
+
+/*----------------------------------------------------------------------------*
+ |                          rbh_memory_backend_new()                          |
+ *----------------------------------------------------------------------------*/
+
+static int
+catalog_init_from_path(struct memory_catalog *catalog, const char *path)
+{
+    FILE *file;
+    int rc;
+
+    catalog->path = strdup(path);
+    if (catalog->path == NULL)
+        return -1;
+
+    file = fopen(path, "r");
+    if (file == NULL)
+        return errno == ENOENT ? 0 : -1;
+
+    rc = catalog_load(catalog, file);
+    fclose(file);
+    /* Nothing to dump until the catalog is updated */
+    catalog->modified = false;
+    return rc;
+}
+
+struct rbh_backend *
+rbh_memory_backend_new(const char *path)
+{
+    struct memory_backend *memory;
+    int save_errno;
+
+    memory = malloc(sizeof(*memory));
+    if (memory == NULL)
+        return NULL;
+
+    memory->catalog = catalog_new();
+    if (memory->catalog == NULL)
+        goto out_free_memory;
+
+    if (path != NULL && *path != '\0'
+     && catalog_init_from_path(memory->catalog, path)) {
+        save_errno = errno;
+        /* Do not overwrite a dump that could not be loaded */
+        free(memory->catalog->path);
+        memory->catalog->path = NULL;
+        catalog_destroy(memory->catalog);
+        errno = save_errno;
+        goto out_free_memory;
+    }
+
+    memory->backend = MEMORY_BACKEND;
+    memory->root_id = NULL;
+    return &memory->backend;
+
+out_free_memory:
+    save_errno = errno;
+    free(memory);
+    errno = save_errno;
+    return NULL;
+}
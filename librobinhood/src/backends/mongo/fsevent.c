@@ -21,7 +21,8 @@
 
 static bson_t *
 bson_from_upsert(const struct rbh_value_map *xattrs,
-                 const struct rbh_statx *statxbuf, const char *symlink)
+                 const struct rbh_statx *statxbuf, const char *symlink,
+                 uint64_t generation)
 {
     bson_t *bson = bson_new();
     int save_errno = ENOBUFS;
@@ -41,6 +42,11 @@ bson_from_upsert(const struct rbh_value_map *xattrs,
             goto out_destroy_set;
     }
 
+    if (generation) {
+        if (!BSON_APPEND_INT64(&set, MFF_GENERATION, generation))
+            goto out_destroy_set;
+    }
+
     if (!bson_append_setxattrs(&set, MFF_XATTRS, xattrs)) {
         save_errno = errno;
         goto out_destroy_set;
@@ -76,7 +82,8 @@ out_destroy_set:
 
 static bson_t *
 bson_from_link(const struct rbh_value_map *xattrs,
-               const struct rbh_id *parent_id, const char *name)
+               const struct rbh_id *parent_id, const char *name,
+               uint64_t generation)
 {
     bson_t *bson = bson_new();
     bson_t document;
@@ -87,6 +94,8 @@ bson_from_link(const struct rbh_value_map *xattrs,
      && BSON_APPEND_RBH_ID(&subdoc, MFF_PARENT_ID, parent_id)
      && BSON_APPEND_UTF8(&subdoc, MFF_NAME, name)
      && BSON_APPEND_RBH_VALUE_MAP(&subdoc, MFF_XATTRS, xattrs)
+     && (generation == 0
+      || BSON_APPEND_INT64(&subdoc, MFF_GENERATION, generation))
      && bson_append_document_end(&document, &subdoc)
      && bson_append_document_end(bson, &document))
         return bson;
@@ -172,15 +181,16 @@ bson_from_inode_xattrs(const struct rbh_value_map *xattrs)
 }
 
 bson_t *
-bson_update_from_fsevent(const struct rbh_fsevent *fsevent)
+bson_update_from_fsevent(const struct rbh_fsevent *fsevent,
+                         uint64_t generation)
 {
     switch (fsevent->type) {
     case RBH_FET_UPSERT:
         return bson_from_upsert(&fsevent->xattrs, fsevent->upsert.statx,
-                                fsevent->upsert.symlink);
+                                fsevent->upsert.symlink, generation);
     case RBH_FET_LINK:
         return bson_from_link(&fsevent->xattrs, fsevent->link.parent_id,
-                              fsevent->link.name);
+                              fsevent->link.name, generation);
     case RBH_FET_UNLINK:
         return bson_from_unlink(fsevent->link.parent_id, fsevent->link.name);
     case RBH_FET_XATTR:
@@ -10,7 +10,10 @@
 #endif
 
 #include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 /* This backend uses libmongoc, from the "mongo-c-driver" project to interact
  * with a MongoDB database.
@@ -137,27 +140,135 @@ bson_pipeline_from_filter_and_options(const struct rbh_filter *filter,
  |                               mongo_iterator                               |
  *----------------------------------------------------------------------------*/
 
+/* The clients the iterators that read ahead create their cursor on. It is
+ * shared by a backend and those iterators (which may outlive it).
+ */
+struct mongo_pool {
+    mongoc_client_pool_t *pool;
+    size_t refcount;
+};
+
+static struct mongo_pool *
+mongo_pool_new(const mongoc_uri_t *uri)
+{
+    struct mongo_pool *pool;
+
+    pool = malloc(sizeof(*pool));
+    if (pool == NULL)
+        return NULL;
+
+    pool->pool = mongoc_client_pool_new(uri);
+    if (pool->pool == NULL) {
+        free(pool);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+#if MONGOC_CHECK_VERSION(1, 4, 0)
+    if (!mongoc_client_pool_set_error_api(pool->pool,
+                                          MONGOC_ERROR_API_VERSION_2)) {
+        /* Should never happen */
+        mongoc_client_pool_destroy(pool->pool);
+        free(pool);
+        errno = EINVAL;
+        return NULL;
+    }
+#endif
+
+    pool->refcount = 1;
+    return pool;
+}
+
+static void
+mongo_pool_release(struct mongo_pool *pool)
+{
+    if (--pool->refcount > 0)
+        return;
+
+    mongoc_client_pool_destroy(pool->pool);
+    free(pool);
+}
+
+/* Fsentries fetched and decoded by a background thread, ahead of the consumer
+ * of an iterator. The thread owns the client the cursor was created on: a
+ * mongoc client may not be used by several threads at once.
+ */
+struct read_ahead {
+    struct mongo_pool *pool;
+    mongoc_client_t *client;            /* popped from `pool' */
+    mongoc_collection_t *entries;
+    pthread_t thread;
+
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    struct rbh_fsentry **fsentries;     /* a ring of `capacity' fsentries */
+    size_t capacity;
+    size_t first;
+    size_t count;
+
+    /* Set when the cursor is exhausted (or failed) */
+    bool done;
+    int error;
+    char backend_error[sizeof(rbh_backend_error)];
+    /* Set when the iterator is destroyed */
+    bool stop;
+};
+
 struct mongo_iterator {
     struct rbh_mut_iterator iterator;
     mongoc_cursor_t *cursor;
+    struct read_ahead *read_ahead;
+
+    /* Added to `total' when the iterator is destroyed */
+    struct rbh_mongo_stats stats;
+    struct rbh_mongo_stats *total;
 };
 
-static void *
-mongo_iter_next(void *iterator)
+static uint64_t
+elapsed_ns(const struct timespec *start)
 {
-    struct mongo_iterator *mongo_iter = iterator;
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000000ULL
+         + now.tv_nsec - start->tv_nsec;
+}
+
+static void
+mongo_stats_add(struct rbh_mongo_stats *total,
+                const struct rbh_mongo_stats *stats)
+{
+    total->documents += stats->documents;
+    total->bytes += stats->bytes;
+    total->fetch_ns += stats->fetch_ns;
+    total->decode_ns += stats->decode_ns;
+}
+
+/* Fetch the next document of a cursor, or set errno (ENODATA at the end) */
+static const bson_t *
+cursor_next(mongoc_cursor_t *cursor, struct rbh_mongo_stats *stats)
+{
+    struct timespec start;
     bson_error_t error;
     const bson_t *doc;
+    bool fetched;
 
-    if (!mongoc_cursor_more(mongo_iter->cursor)) {
+    if (!mongoc_cursor_more(cursor)) {
         errno = ENODATA;
         return NULL;
     }
 
-    if (mongoc_cursor_next(mongo_iter->cursor, &doc))
-        return fsentry_from_bson(doc);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    fetched = mongoc_cursor_next(cursor, &doc);
+    stats->fetch_ns += elapsed_ns(&start);
+    if (fetched) {
+        stats->documents++;
+        stats->bytes += doc->len;
+        return doc;
+    }
 
-    if (!mongoc_cursor_error(mongo_iter->cursor, &error)) {
+    if (!mongoc_cursor_error(cursor, &error)) {
         errno = ENODATA;
         return NULL;
     }
@@ -178,12 +289,149 @@ mongo_iter_next(void *iterator)
     return NULL;
 }
 
+static struct rbh_fsentry *
+cursor_next_fsentry(mongoc_cursor_t *cursor, struct rbh_mongo_stats *stats)
+{
+    struct rbh_fsentry *fsentry;
+    struct timespec start;
+    const bson_t *doc;
+
+    doc = cursor_next(cursor, stats);
+    if (doc == NULL)
+        return NULL;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    fsentry = fsentry_from_bson(doc);
+    stats->decode_ns += elapsed_ns(&start);
+    return fsentry;
+}
+
+static void *
+read_ahead(void *iterator)
+{
+    struct mongo_iterator *mongo_iter = iterator;
+    struct read_ahead *ahead = mongo_iter->read_ahead;
+
+    while (true) {
+        struct rbh_fsentry *fsentry;
+        int save_errno;
+
+        /* Fetching and decoding happen outside of the lock */
+        fsentry = cursor_next_fsentry(mongo_iter->cursor, &mongo_iter->stats);
+        save_errno = errno;
+
+        pthread_mutex_lock(&ahead->lock);
+        while (ahead->count == ahead->capacity && !ahead->stop)
+            pthread_cond_wait(&ahead->not_full, &ahead->lock);
+
+        if (ahead->stop) {
+            pthread_mutex_unlock(&ahead->lock);
+            free(fsentry);
+            return NULL;
+        }
+
+        if (fsentry == NULL) {
+            ahead->done = true;
+            ahead->error = save_errno;
+            if (save_errno == RBH_BACKEND_ERROR)
+                /* rbh_backend_error is thread-local */
+                memcpy(ahead->backend_error, rbh_backend_error,
+                       sizeof(ahead->backend_error));
+        } else {
+            ahead->fsentries[(ahead->first + ahead->count) % ahead->capacity] =
+                fsentry;
+            ahead->count++;
+        }
+
+        pthread_cond_signal(&ahead->not_empty);
+        pthread_mutex_unlock(&ahead->lock);
+
+        if (fsentry == NULL)
+            return NULL;
+    }
+}
+
+static struct rbh_fsentry *
+read_ahead_next(struct read_ahead *ahead)
+{
+    struct rbh_fsentry *fsentry;
+
+    pthread_mutex_lock(&ahead->lock);
+    while (ahead->count == 0 && !ahead->done)
+        pthread_cond_wait(&ahead->not_empty, &ahead->lock);
+
+    if (ahead->count == 0) {
+        if (ahead->error == RBH_BACKEND_ERROR)
+            memcpy(rbh_backend_error, ahead->backend_error,
+                   sizeof(rbh_backend_error));
+        errno = ahead->error;
+        pthread_mutex_unlock(&ahead->lock);
+        return NULL;
+    }
+
+    fsentry = ahead->fsentries[ahead->first];
+    ahead->first = (ahead->first + 1) % ahead->capacity;
+    ahead->count--;
+
+    pthread_cond_signal(&ahead->not_full);
+    pthread_mutex_unlock(&ahead->lock);
+    return fsentry;
+}
+
+static void
+read_ahead_destroy(struct read_ahead *ahead)
+{
+    pthread_mutex_lock(&ahead->lock);
+    ahead->stop = true;
+    pthread_cond_signal(&ahead->not_full);
+    pthread_mutex_unlock(&ahead->lock);
+
+    /* The thread may still be waiting on a round trip to the server */
+    pthread_join(ahead->thread, NULL);
+
+    for (size_t i = 0; i < ahead->count; i++)
+        free(ahead->fsentries[(ahead->first + i) % ahead->capacity]);
+    free(ahead->fsentries);
+
+    pthread_cond_destroy(&ahead->not_full);
+    pthread_cond_destroy(&ahead->not_empty);
+    pthread_mutex_destroy(&ahead->lock);
+}
+
+/* Give the client of \p ahead back to its pool */
+static void
+read_ahead_free(struct read_ahead *ahead)
+{
+    mongoc_collection_destroy(ahead->entries);
+    mongoc_client_pool_push(ahead->pool->pool, ahead->client);
+    mongo_pool_release(ahead->pool);
+    free(ahead);
+}
+
+static void *
+mongo_iter_next(void *iterator)
+{
+    struct mongo_iterator *mongo_iter = iterator;
+
+    if (mongo_iter->read_ahead)
+        return read_ahead_next(mongo_iter->read_ahead);
+
+    return cursor_next_fsentry(mongo_iter->cursor, &mongo_iter->stats);
+}
+
 static void
 mongo_iter_destroy(void *iterator)
 {
     struct mongo_iterator *mongo_iter = iterator;
+    struct read_ahead *ahead = mongo_iter->read_ahead;
 
+    if (ahead)
+        read_ahead_destroy(ahead);
+    /* The thread that read ahead is gone, stats are no longer updated */
+    mongo_stats_add(mongo_iter->total, &mongo_iter->stats);
     mongoc_cursor_destroy(mongo_iter->cursor);
+    if (ahead)
+        read_ahead_free(ahead);
     free(mongo_iter);
 }
 
@@ -197,7 +445,7 @@ static const struct rbh_mut_iterator MONGO_ITER = {
 };
 
 static struct mongo_iterator *
-mongo_iterator_new(mongoc_cursor_t *cursor)
+mongo_iterator_new(mongoc_cursor_t *cursor, struct rbh_mongo_stats *total)
 {
     struct mongo_iterator *mongo_iter;
 
@@ -207,10 +455,49 @@ mongo_iterator_new(mongoc_cursor_t *cursor)
 
     mongo_iter->iterator = MONGO_ITER;
     mongo_iter->cursor = cursor;
+    mongo_iter->read_ahead = NULL;
+    memset(&mongo_iter->stats, 0, sizeof(mongo_iter->stats));
+    mongo_iter->total = total;
 
     return mongo_iter;
 }
 
+/* On success, \p ahead (and the client it holds) belongs to \p mongo_iter */
+static int
+mongo_iter_read_ahead(struct mongo_iterator *mongo_iter,
+                      struct read_ahead *ahead, size_t capacity)
+{
+    int rc;
+
+    ahead->fsentries = malloc(capacity * sizeof(*ahead->fsentries));
+    if (ahead->fsentries == NULL)
+        return -1;
+
+    ahead->capacity = capacity;
+    ahead->first = 0;
+    ahead->count = 0;
+    ahead->done = false;
+    ahead->error = 0;
+    ahead->stop = false;
+    pthread_mutex_init(&ahead->lock, NULL);
+    pthread_cond_init(&ahead->not_empty, NULL);
+    pthread_cond_init(&ahead->not_full, NULL);
+
+    mongo_iter->read_ahead = ahead;
+    rc = pthread_create(&ahead->thread, NULL, read_ahead, mongo_iter);
+    if (rc) {
+        mongo_iter->read_ahead = NULL;
+        pthread_cond_destroy(&ahead->not_full);
+        pthread_cond_destroy(&ahead->not_empty);
+        pthread_mutex_destroy(&ahead->lock);
+        free(ahead->fsentries);
+        errno = rc;
+        return -1;
+    }
+
+    return 0;
+}
+
 /*----------------------------------------------------------------------------*
  |                             MONGO_BACKEND_OPS                              |
  *----------------------------------------------------------------------------*/
@@ -219,6 +506,16 @@ struct mongo_backend {
     struct rbh_backend backend;
     mongoc_client_t *client;
     mongoc_collection_t *entries;
+    uint64_t generation;
+    /* The last work queue whose indexes were created */
+    char *indexed_queue;
+    /* How many fsentries iterators fetch ahead of their consumer (or 0) */
+    size_t read_ahead;
+    /* Created the first time an iterator reads ahead */
+    struct mongo_pool *pool;
+    struct rbh_mongo_stats stats;
+    /* Whether rollups are maintained (-1 until it is looked up) */
+    int rollups;
 };
 
 static int
@@ -229,6 +526,98 @@ static int
 mongo_set_option(void *backend, unsigned int option, const void *data,
                  size_t data_size);
 
+/* Reading a single fsentry ahead is not worth a thread of its own */
+static bool
+mongo_reads_ahead(const struct mongo_backend *mongo,
+                  const struct rbh_filter_options *options)
+{
+    return mongo->read_ahead > 0 && options->limit != 1;
+}
+
+/* The collection to create the cursor of an iterator on: iterators that read
+ * ahead use a client of their own, from the pool of \p mongo.
+ *
+ * If the pool has no client left, the iterator does not read ahead.
+ */
+static mongoc_collection_t *
+mongo_cursor_entries(struct mongo_backend *mongo, bool read_ahead,
+                     struct read_ahead **ahead)
+{
+    const mongoc_uri_t *uri = mongoc_client_get_uri(mongo->client);
+    mongoc_client_t *client;
+
+    *ahead = NULL;
+    if (!read_ahead)
+        return mongo->entries;
+
+    if (mongo->pool == NULL) {
+        mongo->pool = mongo_pool_new(uri);
+        if (mongo->pool == NULL)
+            return NULL;
+    }
+
+    client = mongoc_client_pool_try_pop(mongo->pool->pool);
+    if (client == NULL)
+        return mongo->entries;
+
+    *ahead = malloc(sizeof(**ahead));
+    if (*ahead == NULL) {
+        mongoc_client_pool_push(mongo->pool->pool, client);
+        return NULL;
+    }
+
+    (*ahead)->entries = mongoc_client_get_collection(
+            client, mongoc_uri_get_database(uri), "entries"
+            );
+    if ((*ahead)->entries == NULL) {
+        mongoc_client_pool_push(mongo->pool->pool, client);
+        free(*ahead);
+        *ahead = NULL;
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    (*ahead)->client = client;
+    (*ahead)->pool = mongo->pool;
+    mongo->pool->refcount++;
+    return (*ahead)->entries;
+}
+
+/* Wrap a cursor (created on the collection mongo_cursor_entries() returned) in
+ * an iterator, \p cursor may be NULL if it could not be created (and errno is
+ * set).
+ */
+static struct rbh_mut_iterator *
+mongo_iter_from_cursor(struct mongo_backend *mongo, mongoc_cursor_t *cursor,
+                       struct read_ahead *ahead)
+{
+    struct mongo_iterator *mongo_iter;
+    int save_errno;
+
+    if (cursor == NULL)
+        goto out_destroy_reader;
+
+    mongo_iter = mongo_iterator_new(cursor, &mongo->stats);
+    if (mongo_iter == NULL)
+        goto out_destroy_cursor;
+
+    if (ahead == NULL
+     || mongo_iter_read_ahead(mongo_iter, ahead, mongo->read_ahead) == 0)
+        return &mongo_iter->iterator;
+
+    free(mongo_iter);
+out_destroy_cursor:
+    save_errno = errno;
+    mongoc_cursor_destroy(cursor);
+    errno = save_errno;
+out_destroy_reader:
+    save_errno = errno;
+    if (ahead)
+        read_ahead_free(ahead);
+    errno = save_errno;
+    return NULL;
+}
+
     /*--------------------------------------------------------------------*
      |                               update                               |
      *--------------------------------------------------------------------*/
@@ -298,6 +687,34 @@ _mongoc_bulk_operation_remove_one(mongoc_bulk_operation_t *bulk,
 #endif
 }
 
+static bool
+_mongoc_bulk_operation_update_many(mongoc_bulk_operation_t *bulk,
+                                   const bson_t *selector, const bson_t *update)
+{
+#if MONGOC_CHECK_VERSION(1, 7, 0)
+    /* TODO: handle errors */
+    return mongoc_bulk_operation_update_many_with_opts(bulk, selector, update,
+                                                       NULL, NULL);
+#else
+    mongoc_bulk_operation_update(bulk, selector, update, false);
+    return true;
+#endif
+}
+
+static bool
+_mongoc_bulk_operation_remove_many(mongoc_bulk_operation_t *bulk,
+                                   const bson_t *selector)
+{
+#if MONGOC_CHECK_VERSION(1, 7, 0)
+    /* TODO: handle errors */
+    return mongoc_bulk_operation_remove_many_with_opts(bulk, selector, NULL,
+                                                       NULL);
+#else
+    mongoc_bulk_operation_remove(bulk, selector);
+    return true;
+#endif
+}
+
 static bson_t *
 bson_selector_from_fsevent(const struct rbh_fsevent *fsevent)
 {
@@ -328,7 +745,8 @@ out_bson_destroy:
 
 static bool
 mongo_bulk_append_fsevent(mongoc_bulk_operation_t *bulk,
-                          const struct rbh_fsevent *fsevent);
+                          const struct rbh_fsevent *fsevent,
+                          uint64_t generation);
 
 static bool
 mongo_bulk_append_unlink_from_link(mongoc_bulk_operation_t *bulk,
@@ -346,12 +764,13 @@ mongo_bulk_append_unlink_from_link(mongoc_bulk_operation_t *bulk,
         },
     };
 
-    return mongo_bulk_append_fsevent(bulk, &unlink);
+    return mongo_bulk_append_fsevent(bulk, &unlink, 0);
 }
 
 static bool
 mongo_bulk_append_fsevent(mongoc_bulk_operation_t *bulk,
-                          const struct rbh_fsevent *fsevent)
+                          const struct rbh_fsevent *fsevent,
+                          uint64_t generation)
 {
     bool upsert = false;
     bson_t *selector;
@@ -375,7 +794,7 @@ mongo_bulk_append_fsevent(mongoc_bulk_operation_t *bulk,
         upsert = true;
         __attribute__((fallthrough));
     default:
-        update = bson_update_from_fsevent(fsevent);
+        update = bson_update_from_fsevent(fsevent, generation);
         if (update == NULL) {
             int save_errno = errno;
 
@@ -399,7 +818,8 @@ mongo_bulk_append_fsevent(mongoc_bulk_operation_t *bulk,
 static ssize_t
 mongo_bulk_init_from_fsevents(mongoc_bulk_operation_t *bulk,
                               struct rbh_iterator *fsevents,
-                              bool skip_error)
+                              bool skip_error, uint64_t generation,
+                              struct rollup_batch *rollups)
 {
     int save_errno = errno;
     size_t count = 0;
@@ -423,7 +843,10 @@ mongo_bulk_init_from_fsevents(mongoc_bulk_operation_t *bulk,
             return -1;
         }
 
-        if (!mongo_bulk_append_fsevent(bulk, fsevent))
+        if (rollups && rollup_batch_add(rollups, fsevent))
+            return -1;
+
+        if (!mongo_bulk_append_fsevent(bulk, fsevent, generation))
             return -1;
         count++;
     } while (true);
@@ -432,20 +855,45 @@ mongo_bulk_init_from_fsevents(mongoc_bulk_operation_t *bulk,
     return count;
 }
 
+/* How an update changes rollups, cf. the "rollups" section below */
+struct mongo_rollups {
+    mongoc_collection_t *entries;
+    mongoc_collection_t *rollups;
+    struct rollup_batch *batch;
+};
+
+static int
+mongo_rollups_begin(struct mongo_backend *mongo, struct mongo_rollups *context);
+
+static int
+mongo_rollups_commit(struct mongo_rollups *context);
+
+static void
+mongo_rollups_end(struct mongo_rollups *context);
+
+static void
+mongo_rollups_invalidate(struct mongo_backend *mongo);
+
 static ssize_t
 mongo_backend_update(void *backend, struct rbh_iterator *fsevents,
                      bool skip_error)
 {
     struct mongo_backend *mongo = backend;
+    struct mongo_rollups rollups;
     mongoc_bulk_operation_t *bulk;
     bson_error_t error;
+    int save_errno;
     ssize_t count;
     bson_t reply;
     uint32_t rc;
 
+    if (mongo_rollups_begin(mongo, &rollups))
+        return -1;
+
     bulk = _mongoc_collection_create_bulk_operation(mongo->entries, false,
                                                     NULL);
     if (bulk == NULL) {
+        mongo_rollups_end(&rollups);
         /* XXX: from libmongoc's documentation:
          *      > "Errors are propagated when executing the bulk operation"
          *
@@ -455,14 +903,16 @@ mongo_backend_update(void *backend, struct rbh_iterator *fsevents,
         return -1;
     }
 
-    count = mongo_bulk_init_from_fsevents(bulk, fsevents, skip_error);
+    count = mongo_bulk_init_from_fsevents(bulk, fsevents, skip_error,
+                                          mongo->generation, rollups.batch);
     if (count <= 0) {
-        int save_errno = errno;
+        save_errno = errno;
 
         /* Executing an empty bulk operation is considered an error by mongoc,
          * which is why we return early in this case too
          */
         mongoc_bulk_operation_destroy(bulk);
+        mongo_rollups_end(&rollups);
         errno = save_errno;
         return count;
     }
@@ -479,11 +929,22 @@ mongo_backend_update(void *backend, struct rbh_iterator *fsevents,
             errnum = EAGAIN;
 #endif
         bson_destroy(&reply);
+        /* Some of the fsevents may have been applied */
+        if (rollups.batch)
+            mongo_rollups_invalidate(mongo);
+        mongo_rollups_end(&rollups);
         errno = errnum;
         return -1;
     }
     bson_destroy(&reply);
 
+    /* The fsevents were applied, failing to maintain rollups should not
+     * prevent the caller from moving on.
+     */
+    if (mongo_rollups_commit(&rollups))
+        mongo_rollups_invalidate(mongo);
+    mongo_rollups_end(&rollups);
+
     return count;
 }
 
@@ -506,80 +967,1779 @@ static const struct rbh_filter ROOT_FILTER = {
     },
 };
 
+/* Like rbh_backend_filter_one(), but the query is limited to a single document
+ * (which is not read ahead)
+ */
+static struct rbh_fsentry *
+mongo_backend_filter_one(struct rbh_backend *backend,
+                         const struct rbh_filter *filter,
+                         const struct rbh_filter_projection *projection)
+{
+    const struct rbh_filter_options options = {
+        .projection = *projection,
+        .limit = 1,
+    };
+    struct rbh_mut_iterator *fsentries;
+    struct rbh_fsentry *fsentry;
+    int save_errno = errno;
+
+    fsentries = rbh_backend_filter(backend, filter, &options);
+    if (fsentries == NULL)
+        return NULL;
+
+    errno = 0;
+    fsentry = rbh_mut_iter_next(fsentries);
+    if (fsentry == NULL) {
+        assert(errno);
+        save_errno = errno == ENODATA ? ENOENT : errno;
+    }
+
+    rbh_mut_iter_destroy(fsentries);
+    errno = save_errno;
+    return fsentry;
+}
+
 static struct rbh_fsentry *
 mongo_root(void *backend, const struct rbh_filter_projection *projection)
 {
-    return rbh_backend_filter_one(backend, &ROOT_FILTER, projection);
+    return mongo_backend_filter_one(backend, &ROOT_FILTER, projection);
 }
 
     /*--------------------------------------------------------------------*
      |                               filter                               |
      *--------------------------------------------------------------------*/
 
-static struct rbh_mut_iterator *
-mongo_backend_filter(void *backend, const struct rbh_filter *filter,
-                     const struct rbh_filter_options *options)
+static mongoc_cursor_t *
+mongo_aggregate(mongoc_collection_t *entries, const struct rbh_filter *filter,
+                const struct rbh_filter_options *options)
 {
-    struct mongo_backend *mongo = backend;
-    struct mongo_iterator *mongo_iter;
     mongoc_cursor_t *cursor;
     bson_t *pipeline;
     bson_t *opts;
 
-    if (rbh_filter_validate(filter))
-        return NULL;
-
     pipeline = bson_pipeline_from_filter_and_options(filter, options);
     if (pipeline == NULL)
         return NULL;
 
     opts = options->sort.count > 0 ? BCON_NEW("allowDiskUse", BCON_BOOL(true))
                                    : NULL;
-    cursor = mongoc_collection_aggregate(mongo->entries, MONGOC_QUERY_NONE,
-                                         pipeline, opts, NULL);
+    cursor = mongoc_collection_aggregate(entries, MONGOC_QUERY_NONE, pipeline,
+                                         opts, NULL);
     bson_destroy(opts);
     bson_destroy(pipeline);
-    if (cursor == NULL) {
+    if (cursor == NULL)
         errno = EINVAL;
-        return NULL;
-    }
 
-    mongo_iter = mongo_iterator_new(cursor);
-    if (mongo_iter == NULL) {
-        int save_errno = errno;
+    return cursor;
+}
 
-        mongoc_cursor_destroy(cursor);
-        errno = save_errno;
+static struct rbh_mut_iterator *
+mongo_filter(void *backend, const struct rbh_filter *filter,
+             const struct rbh_filter_options *options, bool read_ahead)
+{
+    struct mongo_backend *mongo = backend;
+    mongoc_collection_t *entries;
+    struct read_ahead *ahead;
+
+    if (rbh_filter_validate(filter))
         return NULL;
-    }
 
-    return &mongo_iter->iterator;
-}
+    entries = mongo_cursor_entries(mongo, read_ahead, &ahead);
+    if (entries == NULL)
+        return NULL;
 
-    /*--------------------------------------------------------------------*
-     |                              destroy                               |
-     *--------------------------------------------------------------------*/
+    return mongo_iter_from_cursor(mongo, mongo_aggregate(entries, filter,
+                                                         options),
+                                  ahead);
+}
 
-static void
-mongo_backend_destroy(void *backend)
+static struct rbh_mut_iterator *
+mongo_backend_filter(void *backend, const struct rbh_filter *filter,
+                     const struct rbh_filter_options *options)
 {
     struct mongo_backend *mongo = backend;
 
-    mongoc_collection_destroy(mongo->entries);
-    mongoc_client_destroy(mongo->client);
-    free(mongo);
+    return mongo_filter(mongo, filter, options,
+                        mongo_reads_ahead(mongo, options));
 }
 
-static struct rbh_backend *
-mongo_backend_branch(void *backend, const struct rbh_id *id, const char *path);
+    /*--------------------------------------------------------------------*
+     |                               export                               |
+     *--------------------------------------------------------------------*/
 
-static const struct rbh_backend_operations MONGO_BACKEND_OPS = {
-    .get_option = mongo_get_option,
-    .set_option = mongo_set_option,
-    .branch = mongo_backend_branch,
-    .root = mongo_root,
-    .update = mongo_backend_update,
-    .filter = mongo_backend_filter,
+struct document_iterator {
+    struct rbh_iterator iterator;
+    mongoc_cursor_t *cursor;
+    enum rbh_document_format format;
+    struct rbh_mongo_stats stats;
+    struct rbh_mongo_stats *total;
+
+    struct rbh_document document;
+    /* The last document, in JSON */
+    char *json;
+};
+
+static const void *
+document_iter_next(void *iterator)
+{
+    struct document_iterator *documents = iterator;
+    const bson_t *doc;
+    size_t length;
+
+    bson_free(documents->json);
+    documents->json = NULL;
+
+    doc = cursor_next(documents->cursor, &documents->stats);
+    if (doc == NULL)
+        return NULL;
+
+    switch (documents->format) {
+    case RBH_DF_JSON:
+        documents->json = bson_as_relaxed_extended_json(doc, &length);
+        if (documents->json == NULL) {
+            /* The document is not valid UTF-8 */
+            errno = EILSEQ;
+            return NULL;
+        }
+        documents->document.data = documents->json;
+        documents->document.size = length;
+        break;
+    case RBH_DF_BSON:
+        documents->document.data = bson_get_data(doc);
+        documents->document.size = doc->len;
+        break;
+    }
+
+    return &documents->document;
+}
+
+static void
+document_iter_destroy(void *iterator)
+{
+    struct document_iterator *documents = iterator;
+
+    bson_free(documents->json);
+    mongo_stats_add(documents->total, &documents->stats);
+    mongoc_cursor_destroy(documents->cursor);
+    free(documents);
+}
+
+static const struct rbh_iterator_operations DOCUMENT_ITER_OPS = {
+    .next = document_iter_next,
+    .destroy = document_iter_destroy,
+};
+
+static const struct rbh_iterator DOCUMENT_ITER = {
+    .ops = &DOCUMENT_ITER_OPS,
+};
+
+static struct rbh_iterator *
+mongo_backend_export(void *backend, const struct rbh_filter *filter,
+                     const struct rbh_filter_options *options,
+                     enum rbh_document_format format)
+{
+    struct document_iterator *documents;
+    struct mongo_backend *mongo = backend;
+
+    switch (format) {
+    case RBH_DF_JSON:
+    case RBH_DF_BSON:
+        break;
+    default:
+        errno = ENOTSUP;
+        return NULL;
+    }
+
+    if (rbh_filter_validate(filter))
+        return NULL;
+
+    documents = malloc(sizeof(*documents));
+    if (documents == NULL)
+        return NULL;
+
+    /* Documents point into the buffers of the cursor, they cannot be read
+     * ahead
+     */
+    documents->cursor = mongo_aggregate(mongo->entries, filter, options);
+    if (documents->cursor == NULL) {
+        int save_errno = errno;
+
+        free(documents);
+        errno = save_errno;
+        return NULL;
+    }
+
+    documents->iterator = DOCUMENT_ITER;
+    documents->format = format;
+    documents->json = NULL;
+    memset(&documents->stats, 0, sizeof(documents->stats));
+    documents->total = &mongo->stats;
+    return &documents->iterator;
+}
+
+    /*--------------------------------------------------------------------*
+     |                              explain                               |
+     *--------------------------------------------------------------------*/
+
+/* The pipeline filters would run, and the server's plan to run it */
+static char *
+mongo_backend_explain(void *backend, const struct rbh_filter *filter,
+                      const struct rbh_filter_options *options)
+{
+    struct mongo_backend *mongo = backend;
+    bson_t command = BSON_INITIALIZER;
+    bson_t result = BSON_INITIALIZER;
+    bson_error_t error;
+    char *string = NULL;
+    bson_t *pipeline;
+    bson_iter_t iter;
+    bson_t reply;
+    char *json;
+
+    if (rbh_filter_validate(filter))
+        return NULL;
+
+    pipeline = bson_pipeline_from_filter_and_options(filter, options);
+    if (pipeline == NULL)
+        return NULL;
+
+    if (!bson_iter_init_find(&iter, pipeline, "pipeline")
+     || !BSON_APPEND_UTF8(&command, "aggregate",
+                          mongoc_collection_get_name(mongo->entries))
+     || !bson_append_iter(&command, "pipeline", -1, &iter)
+     || !BSON_APPEND_BOOL(&command, "explain", true)
+     || !(options->sort.count == 0
+       || BSON_APPEND_BOOL(&command, "allowDiskUse", true))) {
+        errno = ENOBUFS;
+        goto out;
+    }
+
+    if (!mongoc_collection_command_simple(mongo->entries, &command, NULL,
+                                          &reply, &error)) {
+        snprintf(rbh_backend_error, sizeof(rbh_backend_error), "mongoc: %s",
+                 error.message);
+        bson_destroy(&reply);
+        errno = RBH_BACKEND_ERROR;
+        goto out;
+    }
+
+    if (!bson_append_iter(&result, "pipeline", -1, &iter)
+     || !BSON_APPEND_DOCUMENT(&result, "explain", &reply)) {
+        bson_destroy(&reply);
+        errno = ENOBUFS;
+        goto out;
+    }
+    bson_destroy(&reply);
+
+    json = bson_as_relaxed_extended_json(&result, NULL);
+    if (json == NULL) {
+        errno = EILSEQ;
+        goto out;
+    }
+
+    /* Callers free() the result, bson_free() is not guaranteed to be free() */
+    string = strdup(json);
+    bson_free(json);
+
+out:
+    bson_destroy(&result);
+    bson_destroy(&command);
+    bson_destroy(pipeline);
+    return string;
+}
+
+    /*--------------------------------------------------------------------*
+     |                              rollups                               |
+     *--------------------------------------------------------------------*/
+
+static mongoc_collection_t *
+mongo_get_rollups(struct mongo_backend *mongo)
+{
+    const mongoc_uri_t *uri = mongoc_client_get_uri(mongo->client);
+    mongoc_collection_t *collection;
+
+    collection = mongoc_client_get_collection(mongo->client,
+                                              mongoc_uri_get_database(uri),
+                                              MONGO_ROLLUPS_COLLECTION);
+    if (collection == NULL)
+        errno = ENOMEM;
+
+    return collection;
+}
+
+/* Return 1 if a document matched `filter' (and copy it in `document'), 0 if
+ * none did, and -1 on error.
+ */
+static int
+mongo_find_one(mongoc_collection_t *collection, const bson_t *filter,
+               const bson_t *opts, bson_t *document)
+{
+    mongoc_cursor_t *cursor;
+    const bson_t *found;
+    bson_error_t error;
+    int rc = 0;
+
+    cursor = mongoc_collection_find_with_opts(collection, filter, opts, NULL);
+    if (cursor == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (mongoc_cursor_next(cursor, &found)) {
+        bson_copy_to(found, document);
+        rc = 1;
+    } else if (mongoc_cursor_error(cursor, &error)) {
+        snprintf(rbh_backend_error, sizeof(rbh_backend_error), "mongoc: %s",
+                 error.message);
+        errno = RBH_BACKEND_ERROR;
+        rc = -1;
+    }
+
+    mongoc_cursor_destroy(cursor);
+    return rc;
+}
+
+/* Return 1 if rollups are maintained, 0 if not, and -1 on error
+ *
+ * This is only looked up once per backend.
+ */
+static int
+mongo_rollups_enabled(struct mongo_backend *mongo)
+{
+    mongoc_collection_t *rollups;
+    bson_t document;
+    bson_t *filter;
+    int save_errno;
+    int rc;
+
+    if (mongo->rollups >= 0)
+        return mongo->rollups;
+
+    rollups = mongo_get_rollups(mongo);
+    if (rollups == NULL)
+        return -1;
+
+    filter = BCON_NEW(MFF_ID, BCON_UTF8(MONGO_ROLLUPS_MARKER));
+    rc = mongo_find_one(rollups, filter, NULL, &document);
+    save_errno = errno;
+    bson_destroy(filter);
+    mongoc_collection_destroy(rollups);
+    if (rc < 0) {
+        errno = save_errno;
+        return -1;
+    }
+
+    if (rc > 0)
+        bson_destroy(&document);
+    mongo->rollups = rc;
+    return rc;
+}
+
+/* Remove every document of `collection' that matches `selector' */
+static int
+mongo_remove(mongoc_collection_t *collection, const bson_t *selector)
+{
+    mongoc_bulk_operation_t *bulk;
+    bson_error_t error;
+    bson_t reply;
+    uint32_t rc;
+
+    bulk = _mongoc_collection_create_bulk_operation(collection, false, NULL);
+    if (bulk == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if (!_mongoc_bulk_operation_remove_many(bulk, selector)) {
+        mongoc_bulk_operation_destroy(bulk);
+        errno = EINVAL;
+        return -1;
+    }
+
+    rc = mongoc_bulk_operation_execute(bulk, &reply, &error);
+    mongoc_bulk_operation_destroy(bulk);
+    bson_destroy(&reply);
+    if (!rc) {
+        snprintf(rbh_backend_error, sizeof(rbh_backend_error), "mongoc: %s",
+                 error.message);
+        errno = RBH_BACKEND_ERROR;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Rollups that could not be maintained are dropped rather than left wrong
+ * (only the marker is removed), until they are built again.
+ */
+static void
+mongo_rollups_invalidate(struct mongo_backend *mongo)
+{
+    mongoc_collection_t *rollups;
+    int save_errno = errno;
+    bson_t *selector;
+
+    mongo->rollups = 0;
+
+    rollups = mongo_get_rollups(mongo);
+    if (rollups == NULL)
+        goto out;
+
+    selector = BCON_NEW(MFF_ID, BCON_UTF8(MONGO_ROLLUPS_MARKER));
+    mongo_remove(rollups, selector);
+    bson_destroy(selector);
+    mongoc_collection_destroy(rollups);
+
+out:
+    errno = save_errno;
+}
+
+static bool
+bson_iter_rbh_id(bson_iter_t *iter, struct rbh_id *id)
+{
+    const uint8_t *data;
+    uint32_t size;
+
+    if (!BSON_ITER_HOLDS_BINARY(iter))
+        return false;
+
+    bson_iter_binary(iter, NULL, &size, &data);
+    id->data = (const char *)data;
+    id->size = size;
+    return true;
+}
+
+/* Any of the integer fields of a document, 0 if it is missing */
+static int64_t
+bson_get_int64(const bson_t *document, const char *dotkey)
+{
+    bson_iter_t descendant;
+    bson_iter_t iter;
+
+    if (!bson_iter_init(&iter, document)
+     || !bson_iter_find_descendant(&iter, dotkey, &descendant)
+     || !BSON_ITER_HOLDS_NUMBER(&descendant))
+        return 0;
+
+    return bson_iter_as_int64(&descendant);
+}
+
+static bool
+bson_append_rollup_fields(bson_t *bson, const struct rollup *rollup)
+{
+    return BSON_APPEND_INT64(bson, MRF_SIZE, rollup->size)
+        && BSON_APPEND_INT64(bson, MRF_BLOCKS, rollup->blocks)
+        && BSON_APPEND_INT64(bson, MRF_FILES, rollup->files)
+        && BSON_APPEND_INT64(bson, MRF_DIRECTORIES, rollup->directories);
+}
+
+static bool
+bson_append_rollup(bson_t *bson, const char *key, size_t key_length,
+                   const struct rollup *rollup)
+{
+    bson_t document;
+
+    return bson_append_document_begin(bson, key, key_length, &document)
+        && bson_append_rollup_fields(&document, rollup)
+        && bson_append_document_end(bson, &document);
+}
+
+#define BSON_APPEND_ROLLUP(bson, key, rollup) \
+    bson_append_rollup(bson, key, strlen(key), rollup)
+
+static void
+rollup_from_bson(struct rollup *rollup, const bson_t *document)
+{
+    rollup->size = bson_get_int64(document, MRF_SIZE);
+    rollup->blocks = bson_get_int64(document, MRF_BLOCKS);
+    rollup->files = bson_get_int64(document, MRF_FILES);
+    rollup->directories = bson_get_int64(document, MRF_DIRECTORIES);
+}
+
+/* Call `callback' on every namespace entry of a document */
+static int
+bson_foreach_link(const bson_t *document,
+                  int (*callback)(void *arg, const struct rbh_id *parent_id,
+                                  const char *name),
+                  void *arg)
+{
+    bson_iter_t namespace;
+    bson_iter_t iter;
+
+    if (!bson_iter_init_find(&iter, document, MFF_NAMESPACE))
+        return 0;
+
+    if (!BSON_ITER_HOLDS_ARRAY(&iter) || !bson_iter_recurse(&iter, &namespace)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    while (bson_iter_next(&namespace)) {
+        struct rbh_id parent_id;
+        bool has_parent = false;
+        const char *name = "";
+        bson_iter_t link;
+
+        if (!BSON_ITER_HOLDS_DOCUMENT(&namespace)
+         || !bson_iter_recurse(&namespace, &link)) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        while (bson_iter_next(&link)) {
+            const char *key = bson_iter_key(&link);
+
+            if (strcmp(key, MFF_PARENT_ID) == 0)
+                has_parent = bson_iter_rbh_id(&link, &parent_id);
+            else if (strcmp(key, MFF_NAME) == 0 && BSON_ITER_HOLDS_UTF8(&link))
+                name = bson_iter_utf8(&link, NULL);
+        }
+
+        if (has_parent && callback(arg, &parent_id, name))
+            return -1;
+    }
+
+    return 0;
+}
+
+        /*------------------------------------------------------------*
+         |                       rollups-update                       |
+         *------------------------------------------------------------*/
+
+static int
+rollup_entry_add_link_cb(void *entry, const struct rbh_id *parent_id,
+                         const char *name)
+{
+    return rollup_entry_add_link(entry, parent_id, name);
+}
+
+static int
+mongo_rollups_load_entry(void *arg, struct rollup_entry *entry)
+{
+    struct mongo_rollups *context = arg;
+    bson_t document;
+    bson_t *filter;
+    bson_t *opts;
+    int rc;
+
+    filter = bson_new();
+    if (!BSON_APPEND_RBH_ID(filter, MFF_ID, &entry->node.id)) {
+        bson_destroy(filter);
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    opts = BCON_NEW(
+            "projection", "{",
+                MFF_STATX "." MFF_STATX_TYPE, BCON_BOOL(true),
+                MFF_STATX "." MFF_STATX_SIZE, BCON_BOOL(true),
+                MFF_STATX "." MFF_STATX_BLOCKS, BCON_BOOL(true),
+                MFF_NAMESPACE "." MFF_PARENT_ID, BCON_BOOL(true),
+                MFF_NAMESPACE "." MFF_NAME, BCON_BOOL(true),
+            "}"
+            );
+
+    rc = mongo_find_one(context->entries, filter, opts, &document);
+    bson_destroy(opts);
+    bson_destroy(filter);
+    if (rc <= 0)
+        return rc;
+
+    entry->type = bson_get_int64(&document, MFF_STATX "." MFF_STATX_TYPE);
+    entry->size = bson_get_int64(&document, MFF_STATX "." MFF_STATX_SIZE);
+    entry->blocks = bson_get_int64(&document, MFF_STATX "." MFF_STATX_BLOCKS);
+    rc = bson_foreach_link(&document, rollup_entry_add_link_cb, entry);
+    bson_destroy(&document);
+    return rc;
+}
+
+static int
+mongo_rollups_load_rollup(void *arg, const struct rbh_id *id,
+                          struct rollup *rollup)
+{
+    struct mongo_rollups *context = arg;
+    bson_t document;
+    bson_t *filter;
+    int rc;
+
+    memset(rollup, 0, sizeof(*rollup));
+
+    filter = bson_new();
+    if (!BSON_APPEND_RBH_ID(filter, MFF_ID, id)) {
+        bson_destroy(filter);
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    rc = mongo_find_one(context->rollups, filter, NULL, &document);
+    bson_destroy(filter);
+    if (rc <= 0)
+        return rc;
+
+    rollup_from_bson(rollup, &document);
+    bson_destroy(&document);
+    return 0;
+}
+
+static const struct rollup_loader MONGO_ROLLUPS_LOADER = {
+    .entry = mongo_rollups_load_entry,
+    .rollup = mongo_rollups_load_rollup,
+};
+
+/* Prepare to track how an update changes rollups (if they are maintained) */
+static int
+mongo_rollups_begin(struct mongo_backend *mongo, struct mongo_rollups *context)
+{
+    int save_errno;
+
+    context->batch = NULL;
+    switch (mongo_rollups_enabled(mongo)) {
+    case -1:
+        return -1;
+    case 0:
+        return 0;
+    }
+
+    context->entries = mongo->entries;
+    context->rollups = mongo_get_rollups(mongo);
+    if (context->rollups == NULL)
+        return -1;
+
+    context->batch = rollup_batch_new(&MONGO_ROLLUPS_LOADER, context);
+    if (context->batch == NULL) {
+        save_errno = errno;
+        mongoc_collection_destroy(context->rollups);
+        errno = save_errno;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+mongo_rollups_end(struct mongo_rollups *context)
+{
+    if (context->batch == NULL)
+        return;
+
+    rollup_batch_destroy(context->batch);
+    mongoc_collection_destroy(context->rollups);
+}
+
+static bool
+mongo_bulk_append_rollup(mongoc_bulk_operation_t *bulk,
+                         const struct rollup_entry *entry)
+{
+    struct rollup total = entry->stored;
+    bson_t *selector;
+    bson_t *update;
+    bool success;
+
+    selector = bson_new();
+    if (!BSON_APPEND_RBH_ID(selector, MFF_ID, &entry->node.id)) {
+        bson_destroy(selector);
+        errno = ENOBUFS;
+        return false;
+    }
+
+    if (entry->reset && entry->deleted) {
+        success = _mongoc_bulk_operation_remove_one(bulk, selector);
+        bson_destroy(selector);
+        if (!success)
+            errno = EINVAL;
+        return success;
+    }
+
+    update = bson_new();
+    rollup_add(&total, &entry->delta, 1);
+    if (entry->reset ? !BSON_APPEND_ROLLUP(update, "$set", &total)
+                     : !BSON_APPEND_ROLLUP(update, "$inc", &entry->delta)) {
+        bson_destroy(update);
+        bson_destroy(selector);
+        errno = ENOBUFS;
+        return false;
+    }
+
+    success = _mongoc_bulk_operation_update_one(bulk, selector, update, true);
+    bson_destroy(update);
+    bson_destroy(selector);
+    if (!success)
+        errno = EINVAL;
+    return success;
+}
+
+/* Apply the changes to rollups of an update that was applied */
+static int
+mongo_rollups_commit(struct mongo_rollups *context)
+{
+    mongoc_bulk_operation_t *bulk;
+    struct rollup_node *node;
+    bson_error_t error;
+    size_t count = 0;
+    bson_t reply;
+    uint32_t rc;
+
+    if (context->batch == NULL)
+        return 0;
+
+    bulk = _mongoc_collection_create_bulk_operation(context->rollups, false,
+                                                    NULL);
+    if (bulk == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (node = context->batch->entries.first; node; node = node->next) {
+        struct rollup_entry *entry = (struct rollup_entry *)node;
+
+        if (!entry->reset && rollup_is_empty(&entry->delta))
+            continue;
+
+        if (!mongo_bulk_append_rollup(bulk, entry)) {
+            int save_errno = errno;
+
+            mongoc_bulk_operation_destroy(bulk);
+            errno = save_errno;
+            return -1;
+        }
+        count++;
+    }
+
+    if (count == 0) {
+        /* mongoc refuses to execute empty bulk operations */
+        mongoc_bulk_operation_destroy(bulk);
+        return 0;
+    }
+
+    rc = mongoc_bulk_operation_execute(bulk, &reply, &error);
+    mongoc_bulk_operation_destroy(bulk);
+    bson_destroy(&reply);
+    if (!rc) {
+        snprintf(rbh_backend_error, sizeof(rbh_backend_error), "mongoc: %s",
+                 error.message);
+        errno = RBH_BACKEND_ERROR;
+        return -1;
+    }
+
+    return 0;
+}
+
+        /*------------------------------------------------------------*
+         |                       rollups-build                        |
+         *------------------------------------------------------------*/
+
+/* Call `callback' on every document of the entries collection that matches
+ * `filter'
+ */
+static int
+mongo_foreach_entry(mongoc_collection_t *entries, const bson_t *filter,
+                    const bson_t *opts,
+                    int (*callback)(void *arg, const bson_t *document),
+                    void *arg)
+{
+    mongoc_cursor_t *cursor;
+    const bson_t *document;
+    bson_error_t error;
+
+    cursor = mongoc_collection_find_with_opts(entries, filter, opts, NULL);
+    if (cursor == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    while (mongoc_cursor_next(cursor, &document)) {
+        if (callback(arg, document)) {
+            int save_errno = errno;
+
+            mongoc_cursor_destroy(cursor);
+            errno = save_errno;
+            return -1;
+        }
+    }
+
+    if (mongoc_cursor_error(cursor, &error)) {
+        snprintf(rbh_backend_error, sizeof(rbh_backend_error), "mongoc: %s",
+                 error.message);
+        mongoc_cursor_destroy(cursor);
+        errno = RBH_BACKEND_ERROR;
+        return -1;
+    }
+
+    mongoc_cursor_destroy(cursor);
+    return 0;
+}
+
+static int
+rollup_tree_add_directory_cb(void *tree, const bson_t *document)
+{
+    struct rbh_id parent_id = { .size = 0 };
+    bson_iter_t descendant;
+    bson_iter_t iter;
+    struct rbh_id id;
+
+    if (!bson_iter_init_find(&iter, document, MFF_ID)
+     || !bson_iter_rbh_id(&iter, &id)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Directories have at most one namespace entry */
+    if (bson_iter_init(&iter, document)
+     && bson_iter_find_descendant(&iter, MFF_NAMESPACE ".0." MFF_PARENT_ID,
+                                  &descendant))
+        bson_iter_rbh_id(&descendant, &parent_id);
+
+    return rollup_tree_add_directory(tree, &id, &parent_id);
+}
+
+struct rollup_tree_entry {
+    struct rollup_tree *tree;
+    int32_t type;
+    int64_t size;
+    int64_t blocks;
+};
+
+static int
+rollup_tree_add_entry_cb(void *arg, const struct rbh_id *parent_id,
+                         const char *name)
+{
+    struct rollup_tree_entry *entry = arg;
+
+    (void) name;
+
+    return rollup_tree_add_entry(entry->tree, parent_id, entry->type,
+                                 entry->size, entry->blocks);
+}
+
+static int
+rollup_tree_add_links_cb(void *tree, const bson_t *document)
+{
+    struct rollup_tree_entry entry = {
+        .tree = tree,
+        .type = bson_get_int64(document, MFF_STATX "." MFF_STATX_TYPE),
+        .size = bson_get_int64(document, MFF_STATX "." MFF_STATX_SIZE),
+        .blocks = bson_get_int64(document, MFF_STATX "." MFF_STATX_BLOCKS),
+    };
+
+    return bson_foreach_link(document, rollup_tree_add_entry_cb, &entry);
+}
+
+/* Replace whatever is in the rollups collection with the rollups of `tree' */
+static int
+mongo_rollups_store(mongoc_collection_t *rollups, struct rollup_tree *tree)
+{
+    mongoc_bulk_operation_t *bulk;
+    struct rollup_node *node;
+    bson_error_t error;
+    bson_t document;
+    bson_t reply;
+    uint32_t rc;
+
+    /* Ordered, for the marker to be inserted last */
+    bulk = _mongoc_collection_create_bulk_operation(rollups, true, NULL);
+    if (bulk == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    bson_init(&document);
+    if (!_mongoc_bulk_operation_remove_many(bulk, &document))
+        goto out_destroy_bulk;
+
+    for (node = tree->directories.first; node; node = node->next) {
+        struct rollup_directory *directory = (struct rollup_directory *)node;
+
+        /* Directories without a document have an empty rollup */
+        if (rollup_is_empty(&directory->rollup))
+            continue;
+
+        bson_reinit(&document);
+        if (!BSON_APPEND_RBH_ID(&document, MFF_ID, &node->id)
+         || !bson_append_rollup_fields(&document, &directory->rollup))
+            goto out_destroy_bulk;
+        mongoc_bulk_operation_insert(bulk, &document);
+    }
+
+    bson_reinit(&document);
+    if (!BSON_APPEND_UTF8(&document, MFF_ID, MONGO_ROLLUPS_MARKER))
+        goto out_destroy_bulk;
+    mongoc_bulk_operation_insert(bulk, &document);
+    bson_destroy(&document);
+
+    rc = mongoc_bulk_operation_execute(bulk, &reply, &error);
+    mongoc_bulk_operation_destroy(bulk);
+    bson_destroy(&reply);
+    if (!rc) {
+        snprintf(rbh_backend_error, sizeof(rbh_backend_error), "mongoc: %s",
+                 error.message);
+        errno = RBH_BACKEND_ERROR;
+        return -1;
+    }
+
+    return 0;
+
+out_destroy_bulk:
+    bson_destroy(&document);
+    mongoc_bulk_operation_destroy(bulk);
+    errno = ENOBUFS;
+    return -1;
+}
+
+/* Build the rollup of every directory from scratch, in two passes over the
+ * entries collection: one to map directories to their parent, and one to add
+ * every entry to the rollups of its ancestors.
+ */
+static int
+mongo_rollups_build(struct mongo_backend *mongo)
+{
+    mongoc_collection_t *rollups;
+    struct rollup_tree *tree;
+    int save_errno;
+    bson_t *filter;
+    bson_t *opts;
+    int rc = -1;
+
+    tree = rollup_tree_new();
+    if (tree == NULL)
+        return -1;
+
+    filter = BCON_NEW(MFF_STATX "." MFF_STATX_TYPE, BCON_INT32(S_IFDIR));
+    opts = BCON_NEW(
+            "projection", "{",
+                MFF_ID, BCON_BOOL(true),
+                MFF_NAMESPACE "." MFF_PARENT_ID, BCON_BOOL(true),
+            "}"
+            );
+    rc = mongo_foreach_entry(mongo->entries, filter, opts,
+                             rollup_tree_add_directory_cb, tree);
+    bson_destroy(opts);
+    bson_destroy(filter);
+    if (rc)
+        goto out_destroy_tree;
+
+    filter = bson_new();
+    opts = BCON_NEW(
+            "projection", "{",
+                MFF_STATX "." MFF_STATX_TYPE, BCON_BOOL(true),
+                MFF_STATX "." MFF_STATX_SIZE, BCON_BOOL(true),
+                MFF_STATX "." MFF_STATX_BLOCKS, BCON_BOOL(true),
+                MFF_NAMESPACE "." MFF_PARENT_ID, BCON_BOOL(true),
+            "}"
+            );
+    rc = mongo_foreach_entry(mongo->entries, filter, opts,
+                             rollup_tree_add_links_cb, tree);
+    bson_destroy(opts);
+    bson_destroy(filter);
+    if (rc)
+        goto out_destroy_tree;
+
+    rollups = mongo_get_rollups(mongo);
+    if (rollups == NULL) {
+        rc = -1;
+        goto out_destroy_tree;
+    }
+
+    rc = mongo_rollups_store(rollups, tree);
+    save_errno = errno;
+    mongoc_collection_destroy(rollups);
+    errno = save_errno;
+
+out_destroy_tree:
+    save_errno = errno;
+    rollup_tree_destroy(tree);
+    errno = save_errno;
+    return rc;
+}
+
+/* Drop every rollup, along with the marker */
+static int
+mongo_rollups_drop(struct mongo_backend *mongo)
+{
+    mongoc_collection_t *rollups;
+    int save_errno;
+    bson_t filter;
+    int rc;
+
+    rollups = mongo_get_rollups(mongo);
+    if (rollups == NULL)
+        return -1;
+
+    bson_init(&filter);
+    rc = mongo_remove(rollups, &filter);
+    save_errno = errno;
+    bson_destroy(&filter);
+    mongoc_collection_destroy(rollups);
+    errno = save_errno;
+    return rc;
+}
+
+        /*------------------------------------------------------------*
+         |                       rollups-lookup                       |
+         *------------------------------------------------------------*/
+
+static int
+mongo_get_rollup(struct mongo_backend *mongo, const struct rbh_id *id,
+                 struct rbh_mongo_rollup *rollup)
+{
+    struct mongo_rollups context;
+    struct rollup stored;
+    int save_errno;
+    int rc;
+
+    switch (mongo_rollups_enabled(mongo)) {
+    case -1:
+        return -1;
+    case 0:
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    context.rollups = mongo_get_rollups(mongo);
+    if (context.rollups == NULL)
+        return -1;
+
+    rc = mongo_rollups_load_rollup(&context, id, &stored);
+    save_errno = errno;
+    mongoc_collection_destroy(context.rollups);
+    errno = save_errno;
+    if (rc)
+        return -1;
+
+    rollup->size = stored.size;
+    rollup->blocks = stored.blocks;
+    rollup->files = stored.files;
+    rollup->directories = stored.directories;
+    return 0;
+}
+
+static int
+mongo_backend_get_attribute(void *backend, const char *attr_name, void *arg,
+                            struct rbh_value_pair *data)
+{
+    const struct rbh_filter_projection projection = {
+        .fsentry_mask = RBH_FP_ID,
+    };
+    struct rbh_mongo_rollup *rollup = arg;
+    struct rbh_fsentry *root;
+    int save_errno;
+    int rc;
+
+    (void) data;
+
+    if (strcmp(attr_name, RBH_MONGO_ROLLUP_ATTRIBUTE) != 0) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    if (rollup->id != NULL)
+        return mongo_get_rollup(backend, rollup->id, rollup);
+
+    root = mongo_root(backend, &projection);
+    if (root == NULL)
+        return -1;
+
+    rc = mongo_get_rollup(backend, &root->id, rollup);
+    save_errno = errno;
+    free(root);
+    errno = save_errno;
+    return rc;
+}
+
+    /*--------------------------------------------------------------------*
+     |                               sweep                                |
+     *--------------------------------------------------------------------*/
+
+/* A namespace entry, or an fsentry, is stale if it is not tagged with (at
+ * least) the generation of the last complete scan. Untagged ones are stale too.
+ */
+static bool
+bson_append_stale(bson_t *bson, const char *key, size_t key_length,
+                  uint64_t generation)
+{
+    bson_t document;
+    bson_t not;
+
+    return bson_append_document_begin(bson, key, key_length, &document)
+        && BSON_APPEND_DOCUMENT_BEGIN(&document, "$not", &not)
+        && BSON_APPEND_INT64(&not, "$gte", generation)
+        && bson_append_document_end(&document, &not)
+        && bson_append_document_end(bson, &document);
+}
+
+#define BSON_APPEND_STALE(bson, key, generation) \
+    bson_append_stale(bson, key, strlen(key), generation)
+
+static bool
+bson_append_in(bson_t *bson, const char *key, size_t key_length,
+               const bson_t *array)
+{
+    bson_t document;
+
+    return bson_append_document_begin(bson, key, key_length, &document)
+        && BSON_APPEND_ARRAY(&document, "$in", array)
+        && bson_append_document_end(bson, &document);
+}
+
+#define BSON_APPEND_IN(bson, key, array) \
+    bson_append_in(bson, key, strlen(key), array)
+
+/* { [parent: {$in: parents},] generation: <stale> } */
+static bool
+bson_append_stale_namespace(bson_t *bson, const char *key, size_t key_length,
+                            const bson_t *parents, uint64_t generation)
+{
+    bson_t document;
+
+    return bson_append_document_begin(bson, key, key_length, &document)
+        && (parents == NULL
+         || BSON_APPEND_IN(&document, MFF_PARENT_ID, parents))
+        && BSON_APPEND_STALE(&document, MFF_GENERATION, generation)
+        && bson_append_document_end(bson, &document);
+}
+
+#define BSON_APPEND_STALE_NAMESPACE(bson, key, parents, generation) \
+    bson_append_stale_namespace(bson, key, strlen(key), parents, generation)
+
+static bool
+mongo_bulk_append_sweep(mongoc_bulk_operation_t *bulk, const bson_t *ids,
+                        const bson_t *parents, uint64_t generation)
+{
+    bson_t *selector = bson_new();
+    bson_t *update = bson_new();
+    bson_t *orphans = bson_new();
+    bson_t namespace;
+    bson_t document;
+    bool success;
+
+    /* Pull stale namespace entries... */
+    success = (ids == NULL || BSON_APPEND_IN(selector, MFF_ID, ids))
+           && BSON_APPEND_DOCUMENT_BEGIN(selector, MFF_NAMESPACE, &namespace)
+           && BSON_APPEND_STALE_NAMESPACE(&namespace, "$elemMatch", parents,
+                                          generation)
+           && bson_append_document_end(selector, &namespace)
+           && BSON_APPEND_DOCUMENT_BEGIN(update, "$pull", &document)
+           && BSON_APPEND_STALE_NAMESPACE(&document, MFF_NAMESPACE, parents,
+                                          generation)
+           && bson_append_document_end(update, &document)
+    /* ... then remove stale fsentries that are left without any */
+           && (ids == NULL || BSON_APPEND_IN(orphans, MFF_ID, ids))
+           && BSON_APPEND_DOCUMENT_BEGIN(orphans, MFF_NAMESPACE ".0", &document)
+           && BSON_APPEND_BOOL(&document, "$exists", false)
+           && bson_append_document_end(orphans, &document)
+           && BSON_APPEND_STALE(orphans, MFF_GENERATION, generation);
+    if (!success) {
+        errno = ENOBUFS;
+        goto out;
+    }
+
+    success = _mongoc_bulk_operation_update_many(bulk, selector, update)
+           && _mongoc_bulk_operation_remove_many(bulk, orphans);
+    if (!success)
+        /* > returns false if passed invalid arguments */
+        errno = EINVAL;
+
+out:
+    bson_destroy(orphans);
+    bson_destroy(update);
+    bson_destroy(selector);
+    return success;
+}
+
+static int
+mongo_sweep(mongoc_collection_t *entries, const bson_t *ids,
+            const bson_t *parents, uint64_t generation)
+{
+    mongoc_bulk_operation_t *bulk;
+    bson_error_t error;
+    bson_t reply;
+    uint32_t rc;
+
+    /* The order matters: fsentries are only removed once they are unlinked */
+    bulk = _mongoc_collection_create_bulk_operation(entries, true, NULL);
+    if (bulk == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if (!mongo_bulk_append_sweep(bulk, ids, parents, generation)) {
+        int save_errno = errno;
+
+        mongoc_bulk_operation_destroy(bulk);
+        errno = save_errno;
+        return -1;
+    }
+
+    rc = mongoc_bulk_operation_execute(bulk, &reply, &error);
+    mongoc_bulk_operation_destroy(bulk);
+    bson_destroy(&reply);
+    if (!rc) {
+        snprintf(rbh_backend_error, sizeof(rbh_backend_error), "mongoc: %s",
+                 error.message);
+        errno = RBH_BACKEND_ERROR;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+mongo_backend_sweep(void *backend, uint64_t generation)
+{
+    struct mongo_backend *mongo = backend;
+
+    if (generation == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (mongo_sweep(mongo->entries, NULL, NULL, generation))
+        return -1;
+
+    /* Sweeping removes entries without fsevents to account for it */
+    if (mongo->rollups != 0)
+        mongo_rollups_invalidate(mongo);
+    return 0;
+}
+
+    /*--------------------------------------------------------------------*
+     |                               queue                                |
+     *--------------------------------------------------------------------*/
+
+/* Work queues are stored in their own collection ("queue.<name>"), with one
+ * document per item:
+ *
+ * {
+ *     _id: the item (UTF8)
+ *     state: one of enum queue_state (INT32)
+ *     owner: the owner of the last lease on the item (UTF8)
+ *     expires: the time at which this lease expires (DATE_TIME)
+ *     attempts: the number of times the item was leased (INT32)
+ * }
+ *
+ * Leases are timestamped with the clock of the workers: those are expected to
+ * be (roughly) synchronized.
+ */
+
+#define MQF_STATE       "state"
+#define MQF_OWNER       "owner"
+#define MQF_EXPIRES     "expires"
+#define MQF_ATTEMPTS    "attempts"
+
+/* Items that were leased this many times are given up on */
+#ifndef MONGO_QUEUE_MAX_ATTEMPTS
+# define MONGO_QUEUE_MAX_ATTEMPTS 3
+#endif
+
+enum queue_state {
+    QS_PENDING,
+    QS_LEASED,
+    QS_DONE,
+    QS_FAILED,
+};
+
+static int64_t
+queue_now(void)
+{
+    return (int64_t)time(NULL) * 1000;
+}
+
+/* Leasing an item looks up (state, expires), make sure it is indexed */
+static int
+mongo_create_queue_indexes(mongoc_collection_t *collection)
+{
+    bson_error_t error;
+    bson_t *command;
+    bool success;
+
+    command = BCON_NEW(
+            "createIndexes", BCON_UTF8(mongoc_collection_get_name(collection)),
+            "indexes", "[",
+                "{",
+                    "key", "{",
+                        MQF_STATE, BCON_INT32(1),
+                        MQF_EXPIRES, BCON_INT32(1),
+                    "}",
+                    "name", BCON_UTF8(MQF_STATE "_" MQF_EXPIRES),
+                "}",
+            "]"
+            );
+    if (command == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    success = mongoc_collection_command_simple(collection, command, NULL, NULL,
+                                               &error);
+    bson_destroy(command);
+    if (!success) {
+        snprintf(rbh_backend_error, sizeof(rbh_backend_error), "mongoc: %s",
+                 error.message);
+        errno = RBH_BACKEND_ERROR;
+        return -1;
+    }
+
+    return 0;
+}
+
+static mongoc_collection_t *
+mongo_get_queue(struct mongo_backend *mongo, const char *queue)
+{
+    const mongoc_uri_t *uri = mongoc_client_get_uri(mongo->client);
+    mongoc_collection_t *collection;
+    char *name;
+
+    if (asprintf(&name, "queue.%s", queue) < 0) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    collection = mongoc_client_get_collection(mongo->client,
+                                              mongoc_uri_get_database(uri),
+                                              name);
+    free(name);
+    if (collection == NULL)
+        errno = ENOMEM;
+
+    return collection;
+}
+
+/* Return 1 if a document matched `query' (and was updated), 0 if none did, and
+ * -1 on error. If `item' is not NULL, it is set to a copy of the document's id.
+ */
+static int
+queue_find_and_modify(mongoc_collection_t *collection, const bson_t *query,
+                      const bson_t *update, char **item)
+{
+    bson_iter_t document;
+    bson_error_t error;
+    bson_iter_t iter;
+    bson_t reply;
+    int rc = 0;
+
+    if (!mongoc_collection_find_and_modify(collection, query, NULL, update,
+                                           NULL, false, false, true, &reply,
+                                           &error)) {
+        snprintf(rbh_backend_error, sizeof(rbh_backend_error), "mongoc: %s",
+                 error.message);
+        bson_destroy(&reply);
+        errno = RBH_BACKEND_ERROR;
+        return -1;
+    }
+
+    /* When no document matches `query', "value" is null */
+    if (!bson_iter_init_find(&iter, &reply, "value")
+     || !BSON_ITER_HOLDS_DOCUMENT(&iter))
+        goto out;
+
+    rc = 1;
+    if (item == NULL)
+        goto out;
+
+    if (!bson_iter_recurse(&iter, &document)
+     || !bson_iter_find(&document, MFF_ID)
+     || !BSON_ITER_HOLDS_UTF8(&document)) {
+        errno = EINVAL;
+        rc = -1;
+        goto out;
+    }
+
+    *item = strdup(bson_iter_utf8(&document, NULL));
+    if (*item == NULL)
+        rc = -1;
+
+out:
+    bson_destroy(&reply);
+    return rc;
+}
+
+static ssize_t
+mongo_queue_push(void *backend, const char *queue, const char * const *items,
+                 size_t count)
+{
+    struct mongo_backend *mongo = backend;
+    mongoc_collection_t *collection;
+    mongoc_bulk_operation_t *bulk;
+    ssize_t pushed = -1;
+    bson_error_t error;
+    bson_iter_t iter;
+    bson_t *update;
+    bson_t reply;
+
+    if (count == 0)
+        return 0;
+
+    collection = mongo_get_queue(mongo, queue);
+    if (collection == NULL)
+        return -1;
+
+    if (mongo->indexed_queue == NULL || strcmp(mongo->indexed_queue, queue)) {
+        free(mongo->indexed_queue);
+        mongo->indexed_queue = NULL;
+
+        if (mongo_create_queue_indexes(collection))
+            goto out_destroy_collection;
+
+        /* This is only an optimization, it does not matter if it fails */
+        mongo->indexed_queue = strdup(queue);
+    }
+
+    bulk = _mongoc_collection_create_bulk_operation(collection, false, NULL);
+    if (bulk == NULL) {
+        errno = ENOMEM;
+        goto out_destroy_collection;
+    }
+
+    /* Items that are already in the queue are left untouched */
+    update = BCON_NEW("$setOnInsert", "{",
+                          MQF_STATE, BCON_INT32(QS_PENDING),
+                          MQF_ATTEMPTS, BCON_INT32(0),
+                      "}");
+    for (size_t i = 0; i < count; i++) {
+        bson_t *selector = BCON_NEW(MFF_ID, BCON_UTF8(items[i]));
+        bool success;
+
+        success = _mongoc_bulk_operation_update_one(bulk, selector, update,
+                                                    true);
+        bson_destroy(selector);
+        if (!success) {
+            bson_destroy(update);
+            errno = EINVAL;
+            goto out_destroy_bulk;
+        }
+    }
+    bson_destroy(update);
+
+    if (!mongoc_bulk_operation_execute(bulk, &reply, &error)) {
+        snprintf(rbh_backend_error, sizeof(rbh_backend_error), "mongoc: %s",
+                 error.message);
+        bson_destroy(&reply);
+        errno = RBH_BACKEND_ERROR;
+        goto out_destroy_bulk;
+    }
+
+    pushed = 0;
+    if (bson_iter_init_find(&iter, &reply, "nUpserted"))
+        pushed = bson_iter_as_int64(&iter);
+    bson_destroy(&reply);
+
+out_destroy_bulk:
+    mongoc_bulk_operation_destroy(bulk);
+out_destroy_collection:
+    mongoc_collection_destroy(collection);
+    return pushed;
+}
+
+/* Return 1 if some items of `collection' may still be leased, 0 otherwise, and
+ * -1 on error.
+ */
+static int
+queue_has_work_left(mongoc_collection_t *collection, int64_t now)
+{
+    mongoc_cursor_t *cursor;
+    const bson_t *document;
+    bson_error_t error;
+    bson_t *filter;
+    bson_t *opts;
+    int rc;
+
+    /* Pending items, and leased items that may yet be processed or retried */
+    filter = BCON_NEW(
+            "$or", "[",
+                "{", MQF_STATE, BCON_INT32(QS_PENDING), "}",
+                "{",
+                    MQF_STATE, BCON_INT32(QS_LEASED),
+                    MQF_EXPIRES, "{", "$gte", BCON_DATE_TIME(now), "}",
+                "}",
+                "{",
+                    MQF_STATE, BCON_INT32(QS_LEASED),
+                    MQF_ATTEMPTS, "{",
+                        "$lt", BCON_INT32(MONGO_QUEUE_MAX_ATTEMPTS),
+                    "}",
+                "}",
+            "]"
+            );
+    opts = BCON_NEW("limit", BCON_INT64(1),
+                    "projection", "{", MFF_ID, BCON_BOOL(true), "}");
+
+    cursor = mongoc_collection_find_with_opts(collection, filter, opts, NULL);
+    bson_destroy(opts);
+    bson_destroy(filter);
+    if (cursor == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    rc = mongoc_cursor_next(cursor, &document) ? 1 : 0;
+    if (mongoc_cursor_error(cursor, &error)) {
+        snprintf(rbh_backend_error, sizeof(rbh_backend_error), "mongoc: %s",
+                 error.message);
+        errno = RBH_BACKEND_ERROR;
+        rc = -1;
+    }
+
+    mongoc_cursor_destroy(cursor);
+    return rc;
+}
+
+static char *
+mongo_queue_lease(void *backend, const char *queue, const char *owner,
+                  unsigned int duration)
+{
+    struct mongo_backend *mongo = backend;
+    mongoc_collection_t *collection;
+    int64_t now = queue_now();
+    bson_t *update;
+    bson_t *query;
+    char *item;
+    int rc;
+
+    collection = mongo_get_queue(mongo, queue);
+    if (collection == NULL)
+        return NULL;
+
+    /* Pending items, and items whose lease expired (ie. whose worker failed) */
+    query = BCON_NEW(
+            MQF_ATTEMPTS, "{", "$lt", BCON_INT32(MONGO_QUEUE_MAX_ATTEMPTS), "}",
+            "$or", "[",
+                "{", MQF_STATE, BCON_INT32(QS_PENDING), "}",
+                "{",
+                    MQF_STATE, BCON_INT32(QS_LEASED),
+                    MQF_EXPIRES, "{", "$lt", BCON_DATE_TIME(now), "}",
+                "}",
+            "]"
+            );
+    update = BCON_NEW(
+            "$set", "{",
+                MQF_STATE, BCON_INT32(QS_LEASED),
+                MQF_OWNER, BCON_UTF8(owner),
+                MQF_EXPIRES, BCON_DATE_TIME(now + (int64_t)duration * 1000),
+            "}",
+            "$inc", "{", MQF_ATTEMPTS, BCON_INT32(1), "}"
+            );
+
+    rc = queue_find_and_modify(collection, query, update, &item);
+    bson_destroy(update);
+    bson_destroy(query);
+    if (rc == 0) {
+        rc = queue_has_work_left(collection, now);
+        if (rc >= 0)
+            errno = rc ? EAGAIN : ENODATA;
+        item = NULL;
+    } else if (rc < 0) {
+        item = NULL;
+    }
+
+    mongoc_collection_destroy(collection);
+    return item;
+}
+
+static int
+mongo_queue_ack(void *backend, const char *queue, const char *item,
+                const char *owner, enum rbh_queue_ack ack)
+{
+    struct mongo_backend *mongo = backend;
+    mongoc_collection_t *collection;
+    bson_t *update;
+    bson_t *query;
+    int rc;
+
+    if (ack != RBH_QA_DONE && ack != RBH_QA_RETRY) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    collection = mongo_get_queue(mongo, queue);
+    if (collection == NULL)
+        return -1;
+
+    query = BCON_NEW(MFF_ID, BCON_UTF8(item),
+                     MQF_STATE, BCON_INT32(QS_LEASED),
+                     MQF_OWNER, BCON_UTF8(owner));
+    update = BCON_NEW("$set", "{", MQF_STATE, BCON_INT32(QS_DONE), "}");
+
+    if (ack == RBH_QA_RETRY) {
+        /* Items that were leased too many times are given up on */
+        bson_t *failed = BCON_NEW(
+                MFF_ID, BCON_UTF8(item),
+                MQF_STATE, BCON_INT32(QS_LEASED),
+                MQF_OWNER, BCON_UTF8(owner),
+                MQF_ATTEMPTS, "{",
+                    "$gte", BCON_INT32(MONGO_QUEUE_MAX_ATTEMPTS),
+                "}"
+                );
+
+        bson_destroy(update);
+        update = BCON_NEW("$set", "{", MQF_STATE, BCON_INT32(QS_FAILED), "}");
+        rc = queue_find_and_modify(collection, failed, update, NULL);
+        bson_destroy(failed);
+        if (rc != 0)
+            goto out;
+
+        bson_destroy(update);
+        update = BCON_NEW("$set", "{", MQF_STATE, BCON_INT32(QS_PENDING), "}");
+    }
+
+    rc = queue_find_and_modify(collection, query, update, NULL);
+
+out:
+    bson_destroy(update);
+    bson_destroy(query);
+    mongoc_collection_destroy(collection);
+
+    switch (rc) {
+    case -1:
+        return -1;
+    case 0:
+        /* Someone else leased `item' after our lease expired */
+        errno = ESTALE;
+        return -1;
+    }
+    return 0;
+}
+
+struct queue_iterator {
+    struct rbh_mut_iterator iterator;
+    mongoc_collection_t *collection;
+    mongoc_cursor_t *cursor;
+    struct rbh_mongo_stats stats;
+};
+
+static void *
+queue_iter_next(void *iterator)
+{
+    struct queue_iterator *queue_iter = iterator;
+    const bson_t *document;
+    bson_iter_t iter;
+    char *item;
+
+    document = cursor_next(queue_iter->cursor, &queue_iter->stats);
+    if (document == NULL)
+        return NULL;
+
+    if (!bson_iter_init_find(&iter, document, MFF_ID)
+     || !BSON_ITER_HOLDS_UTF8(&iter)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    item = strdup(bson_iter_utf8(&iter, NULL));
+    if (item == NULL)
+        errno = ENOMEM;
+    return item;
+}
+
+static void
+queue_iter_destroy(void *iterator)
+{
+    struct queue_iterator *queue_iter = iterator;
+
+    mongoc_cursor_destroy(queue_iter->cursor);
+    mongoc_collection_destroy(queue_iter->collection);
+    free(queue_iter);
+}
+
+static const struct rbh_mut_iterator_operations QUEUE_ITER_OPS = {
+    .next = queue_iter_next,
+    .destroy = queue_iter_destroy,
+};
+
+static const struct rbh_mut_iterator QUEUE_ITER = {
+    .ops = &QUEUE_ITER_OPS,
+};
+
+static struct rbh_mut_iterator *
+mongo_queue_abandoned(void *backend, const char *queue)
+{
+    struct mongo_backend *mongo = backend;
+    struct queue_iterator *queue_iter;
+    int64_t now = queue_now();
+    bson_t *filter;
+    bson_t *opts;
+
+    queue_iter = malloc(sizeof(*queue_iter));
+    if (queue_iter == NULL)
+        return NULL;
+
+    queue_iter->collection = mongo_get_queue(mongo, queue);
+    if (queue_iter->collection == NULL) {
+        int save_errno = errno;
+
+        free(queue_iter);
+        errno = save_errno;
+        return NULL;
+    }
+
+    /* Items that failed too many times, and those whose last lease expired
+     * (the workers that leased them died)
+     */
+    filter = BCON_NEW(
+            "$or", "[",
+                "{", MQF_STATE, BCON_INT32(QS_FAILED), "}",
+                "{",
+                    MQF_STATE, BCON_INT32(QS_LEASED),
+                    MQF_EXPIRES, "{", "$lt", BCON_DATE_TIME(now), "}",
+                    MQF_ATTEMPTS, "{",
+                        "$gte", BCON_INT32(MONGO_QUEUE_MAX_ATTEMPTS),
+                    "}",
+                "}",
+            "]"
+            );
+    opts = BCON_NEW("sort", "{", MFF_ID, BCON_INT32(1), "}",
+                    "projection", "{", MFF_ID, BCON_BOOL(true), "}");
+
+    queue_iter->cursor = mongoc_collection_find_with_opts(
+            queue_iter->collection, filter, opts, NULL
+            );
+    bson_destroy(opts);
+    bson_destroy(filter);
+    if (queue_iter->cursor == NULL) {
+        mongoc_collection_destroy(queue_iter->collection);
+        free(queue_iter);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    queue_iter->iterator = QUEUE_ITER;
+    memset(&queue_iter->stats, 0, sizeof(queue_iter->stats));
+    return &queue_iter->iterator;
+}
+
+    /*--------------------------------------------------------------------*
+     |                              destroy                               |
+     *--------------------------------------------------------------------*/
+
+static void
+mongo_backend_destroy(void *backend)
+{
+    struct mongo_backend *mongo = backend;
+
+    free(mongo->indexed_queue);
+    /* Iterators that read ahead may still hold a reference on the pool */
+    if (mongo->pool)
+        mongo_pool_release(mongo->pool);
+    mongoc_collection_destroy(mongo->entries);
+    mongoc_client_destroy(mongo->client);
+    free(mongo);
+}
+
+static struct rbh_backend *
+mongo_backend_branch(void *backend, const struct rbh_id *id, const char *path);
+
+static const struct rbh_backend_operations MONGO_BACKEND_OPS = {
+    .get_option = mongo_get_option,
+    .set_option = mongo_set_option,
+    .branch = mongo_backend_branch,
+    .root = mongo_root,
+    .update = mongo_backend_update,
+    .filter = mongo_backend_filter,
+    .export_entries = mongo_backend_export,
+    .explain = mongo_backend_explain,
+    .get_attribute = mongo_backend_get_attribute,
+    .sweep = mongo_backend_sweep,
+    .queue_push = mongo_queue_push,
+    .queue_lease = mongo_queue_lease,
+    .queue_ack = mongo_queue_ack,
+    .queue_abandoned = mongo_queue_abandoned,
     .destroy = mongo_backend_destroy,
 };
 
@@ -645,7 +2805,8 @@ mongo_gc_backend_filter(void *backend, const struct rbh_filter *filter_,
         RBH_FP_PARENT_ID | RBH_FP_NAME | RBH_FP_NAMESPACE_XATTRS;
     struct rbh_filter_options options = *options_;
     struct mongo_backend *mongo = backend;
-    struct mongo_iterator *mongo_iter;
+    mongoc_collection_t *entries;
+    struct read_ahead *ahead;
     mongoc_cursor_t *cursor;
     bson_t *filter;
     bson_t *opts;
@@ -668,24 +2829,24 @@ mongo_gc_backend_filter(void *backend, const struct rbh_filter *filter_,
         return NULL;
     }
 
-    cursor = mongoc_collection_find_with_opts(mongo->entries, filter, opts,
-                                              NULL);
-    bson_destroy(filter);
-    bson_destroy(opts);
-    if (cursor == NULL) {
-        errno = EINVAL;
-        return NULL;
-    }
-
-    mongo_iter = mongo_iterator_new(cursor);
-    if (mongo_iter == NULL) {
+    entries = mongo_cursor_entries(mongo, mongo_reads_ahead(mongo, &options),
+                                   &ahead);
+    if (entries == NULL) {
         int save_errno = errno;
 
-        mongoc_cursor_destroy(cursor);
+        bson_destroy(filter);
+        bson_destroy(opts);
         errno = save_errno;
+        return NULL;
     }
 
-    return &mongo_iter->iterator;
+    cursor = mongoc_collection_find_with_opts(entries, filter, opts, NULL);
+    bson_destroy(filter);
+    bson_destroy(opts);
+    if (cursor == NULL)
+        errno = EINVAL;
+
+    return mongo_iter_from_cursor(mongo, cursor, ahead);
 }
 
 static const struct rbh_backend_operations MONGO_GC_BACKEND_OPS = {
@@ -716,6 +2877,104 @@ mongo_get_gc_option(struct mongo_backend *mongo, void *data, size_t *data_size)
     return 0;
 }
 
+/* The greatest generation the documents of the backend were tagged with */
+static int
+mongo_latest_generation(struct mongo_backend *mongo, uint64_t *generation)
+{
+    bson_t document;
+    bson_t *filter;
+    bson_t *opts;
+    int rc;
+
+    filter = BCON_NEW(MFF_GENERATION, "{", "$exists", BCON_BOOL(true), "}");
+    opts = BCON_NEW("sort", "{", MFF_GENERATION, BCON_INT32(-1), "}",
+                    "limit", BCON_INT64(1),
+                    "projection", "{", MFF_GENERATION, BCON_BOOL(true), "}");
+    rc = mongo_find_one(mongo->entries, filter, opts, &document);
+    bson_destroy(opts);
+    bson_destroy(filter);
+    if (rc < 0)
+        return -1;
+
+    *generation = 0;
+    if (rc > 0) {
+        *generation = bson_get_int64(&document, MFF_GENERATION);
+        bson_destroy(&document);
+    }
+    return 0;
+}
+
+static int
+mongo_get_generation_option(struct mongo_backend *mongo, void *data,
+                            size_t *data_size)
+{
+    uint64_t generation = mongo->generation;
+
+    if (*data_size < sizeof(generation)) {
+        *data_size = sizeof(generation);
+        errno = EOVERFLOW;
+        return -1;
+    }
+
+    if (generation == 0 && mongo_latest_generation(mongo, &generation))
+        return -1;
+
+    memcpy(data, &generation, sizeof(generation));
+    *data_size = sizeof(generation);
+    return 0;
+}
+
+static int
+mongo_get_read_ahead_option(struct mongo_backend *mongo, void *data,
+                            size_t *data_size)
+{
+    if (*data_size < sizeof(mongo->read_ahead)) {
+        *data_size = sizeof(mongo->read_ahead);
+        errno = EOVERFLOW;
+        return -1;
+    }
+    memcpy(data, &mongo->read_ahead, sizeof(mongo->read_ahead));
+    *data_size = sizeof(mongo->read_ahead);
+    return 0;
+}
+
+static int
+mongo_get_stats_option(struct mongo_backend *mongo, void *data,
+                       size_t *data_size)
+{
+    if (*data_size < sizeof(mongo->stats)) {
+        *data_size = sizeof(mongo->stats);
+        errno = EOVERFLOW;
+        return -1;
+    }
+    memcpy(data, &mongo->stats, sizeof(mongo->stats));
+    *data_size = sizeof(mongo->stats);
+    return 0;
+}
+
+static int
+mongo_get_rollups_option(struct mongo_backend *mongo, void *data,
+                         size_t *data_size)
+{
+    bool rollups;
+    int rc;
+
+    if (*data_size < sizeof(rollups)) {
+        *data_size = sizeof(rollups);
+        errno = EOVERFLOW;
+        return -1;
+    }
+
+    rc = mongo_rollups_enabled(mongo);
+    if (rc < 0)
+        return -1;
+
+    rollups = rc;
+    memcpy(data, &rollups, sizeof(rollups));
+    *data_size = sizeof(rollups);
+    return 0;
+}
+
 static int
 mongo_get_option(void *backend, unsigned int option, void *data,
                  size_t *data_size)
@@ -725,29 +2984,157 @@ mongo_get_option(void *backend, unsigned int option, void *data,
     switch (option) {
     case RBH_GBO_GC:
         return mongo_get_gc_option(mongo, data, data_size);
+    case RBH_GBO_GENERATION:
+        return mongo_get_generation_option(mongo, data, data_size);
+    case RBH_MBO_READ_AHEAD:
+        return mongo_get_read_ahead_option(mongo, data, data_size);
+    case RBH_MBO_STATS:
+        return mongo_get_stats_option(mongo, data, data_size);
+    case RBH_MBO_ROLLUPS:
+        return mongo_get_rollups_option(mongo, data, data_size);
     }
 
     errno = ENOPROTOOPT;
     return -1;
 }
 
-    /*--------------------------------------------------------------------*
-     |                             set_option                             |
-     *--------------------------------------------------------------------*/
+    /*--------------------------------------------------------------------*
+     |                             set_option                             |
+     *--------------------------------------------------------------------*/
+
+static int
+mongo_set_gc_option(struct mongo_backend *mongo, const void *data,
+                    size_t data_size)
+{
+    bool is_gc;
+
+    if (data_size != sizeof(is_gc)) {
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy(&is_gc, data, sizeof(is_gc));
+
+    mongo->backend.ops = is_gc ? &MONGO_GC_BACKEND_OPS : &MONGO_BACKEND_OPS;
+    return 0;
+}
+
+/* Sweeping relies on both of these indexes to stay cheap on large catalogs */
+static int
+mongo_create_generation_indexes(struct mongo_backend *mongo)
+{
+    const char *collection = mongoc_collection_get_name(mongo->entries);
+    bson_error_t error;
+    bson_t *command;
+    bool success;
+
+    command = BCON_NEW(
+            "createIndexes", BCON_UTF8(collection),
+            "indexes", "[",
+                "{",
+                    "key", "{", MFF_GENERATION, BCON_INT32(1), "}",
+                    "name", BCON_UTF8(MFF_GENERATION),
+                "}",
+                "{",
+                    "key", "{",
+                        MFF_NAMESPACE "." MFF_GENERATION, BCON_INT32(1),
+                    "}",
+                    "name", BCON_UTF8(MFF_NAMESPACE "." MFF_GENERATION),
+                "}",
+            "]"
+            );
+    if (command == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    success = mongoc_collection_command_simple(mongo->entries, command, NULL,
+                                               NULL, &error);
+    bson_destroy(command);
+    if (!success) {
+        snprintf(rbh_backend_error, sizeof(rbh_backend_error), "mongoc: %s",
+                 error.message);
+        errno = RBH_BACKEND_ERROR;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+mongo_set_generation_option(struct mongo_backend *mongo, const void *data,
+                            size_t data_size)
+{
+    uint64_t generation;
+
+    if (data_size != sizeof(generation)) {
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy(&generation, data, sizeof(generation));
+
+    if (generation > INT64_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (generation != 0 && mongo_create_generation_indexes(mongo))
+        return -1;
+
+    mongo->generation = generation;
+    return 0;
+}
+
+static int
+mongo_set_read_ahead_option(struct mongo_backend *mongo, const void *data,
+                            size_t data_size)
+{
+    size_t read_ahead;
+
+    if (data_size != sizeof(read_ahead)) {
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy(&read_ahead, data, sizeof(read_ahead));
+
+    if (read_ahead > RBH_MONGO_MAX_READ_AHEAD) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    mongo->read_ahead = read_ahead;
+    return 0;
+}
+
+static int
+mongo_set_stats_option(struct mongo_backend *mongo, const void *data,
+                       size_t data_size)
+{
+    if (data_size != sizeof(mongo->stats)) {
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy(&mongo->stats, data, sizeof(mongo->stats));
+    return 0;
+}
 
 static int
-mongo_set_gc_option(struct mongo_backend *mongo, const void *data,
-                    size_t data_size)
+mongo_set_rollups_option(struct mongo_backend *mongo, const void *data,
+                         size_t data_size)
 {
-    bool is_gc;
+    bool rollups;
 
-    if (data_size != sizeof(is_gc)) {
+    if (data_size != sizeof(rollups)) {
         errno = EINVAL;
         return -1;
     }
-    memcpy(&is_gc, data, sizeof(is_gc));
+    memcpy(&rollups, data, sizeof(rollups));
 
-    mongo->backend.ops = is_gc ? &MONGO_GC_BACKEND_OPS : &MONGO_BACKEND_OPS;
+    if (rollups ? mongo_rollups_build(mongo) : mongo_rollups_drop(mongo)) {
+        mongo_rollups_invalidate(mongo);
+        return -1;
+    }
+
+    mongo->rollups = rollups;
     return 0;
 }
 
@@ -760,6 +3147,14 @@ mongo_set_option(void *backend, unsigned int option, const void *data,
     switch (option) {
     case RBH_GBO_GC:
         return mongo_set_gc_option(mongo, data, data_size);
+    case RBH_GBO_GENERATION:
+        return mongo_set_generation_option(mongo, data, data_size);
+    case RBH_MBO_READ_AHEAD:
+        return mongo_set_read_ahead_option(mongo, data, data_size);
+    case RBH_MBO_STATS:
+        return mongo_set_stats_option(mongo, data, data_size);
+    case RBH_MBO_ROLLUPS:
+        return mongo_set_rollups_option(mongo, data, data_size);
     }
 
     errno = ENOPROTOOPT;
@@ -803,7 +3198,7 @@ mongo_branch_root(void *backend, const struct rbh_filter_projection *projection)
 
     /* To avoid the infinite recursion root -> branch_filter -> root -> ... */
     branch->mongo.backend.ops = &MONGO_BACKEND_OPS;
-    root = rbh_backend_filter_one(backend, &id_filter, projection);
+    root = mongo_backend_filter_one(backend, &id_filter, projection);
     branch->mongo.backend.ops = ops;
     return root;
 }
@@ -813,11 +3208,11 @@ mongo_branch_root(void *backend, const struct rbh_filter_projection *projection)
          *------------------------------------------------------------*/
 
 /* This implementation is almost generic, except for the calls to
- * mongo_backend_filter() (calling rbh_backend_filter() instead is not an option
- * as it would lead to an infinite recursion).
+ * mongo_filter() (calling rbh_backend_filter() instead is not an option as it
+ * would lead to an infinite recursion).
  *
  * If another backend ever needs this code, one should consider putting it in
- * a separate source file, replace calls to mongo_backend_filter() with
+ * a separate source file, replace calls to mongo_filter() with
  * BACKEND_NAME ## _backend_filter(), and include the code both here and in the
  * other backend's sources, after approprately defining the BACKEND_NAME macro.
  */
@@ -887,7 +3282,8 @@ _filter_child_fsentries(struct rbh_backend *backend, size_t id_count,
         },
     };
 
-    return mongo_backend_filter(backend, &and_filter, options);
+    /* Sub-queries are too many and too short-lived to read ahead */
+    return mongo_filter(backend, &and_filter, options, false);
 }
 
 static struct rbh_mut_iterator *
@@ -1134,35 +3530,356 @@ static const struct rbh_mut_iterator_operations BRANCH_ITER_OPS = {
     .destroy = branch_iter_destroy,
 };
 
-static const struct rbh_mut_iterator BRANCH_ITERATOR = {
-    .ops = &BRANCH_ITER_OPS,
-};
+static const struct rbh_mut_iterator BRANCH_ITERATOR = {
+    .ops = &BRANCH_ITER_OPS,
+};
+
+/* Unlike rbh_backend_filter_one(), this function is about applying a filter to
+ * a specific entry (identified by its ID) and see if it matches.
+ */
+static struct rbh_mut_iterator *
+filter_one(void *backend, const struct rbh_id *id,
+           const struct rbh_filter *filter,
+           const struct rbh_filter_options *options)
+{
+    const struct rbh_filter id_filter = {
+        .op = RBH_FOP_EQUAL,
+        .compare = {
+            .field = {
+                .fsentry = RBH_FP_ID,
+            },
+            .value = {
+                .type = RBH_VT_BINARY,
+                .binary = {
+                    .data = id->data,
+                    .size = id->size,
+                },
+            },
+        },
+    };
+    const struct rbh_filter *filters[2] = {
+        &id_filter,
+        filter,
+    };
+    const struct rbh_filter and_filter = {
+        .op = RBH_FOP_AND,
+        .logical = {
+            .count = 2,
+            .filters = filters,
+        },
+    };
+
+    /* Sub-queries are too many and too short-lived to read ahead */
+    return mongo_filter(backend, &and_filter, options, false);
+}
+
+#define VALUE_RING_SIZE (1 << 14) /* 16MB */
+#define ID_RING_SIZE (1 << 14) /* 16MB */
+
+struct rbh_mut_iterator *
+generic_branch_backend_filter(void *backend, const struct rbh_filter *filter,
+                              const struct rbh_filter_options *options)
+{
+    const struct rbh_filter_projection ID_ONLY = {
+        .fsentry_mask = RBH_FP_ID,
+    };
+    struct branch_iterator *iter;
+    int save_errno = errno;
+
+    /* The recursive traversal of the branch prevents a few features from
+     * working out of the box.
+     */
+    if (options->skip || options->limit || options->sort.count) {
+        errno = ENOTSUP;
+        return NULL;
+    }
+
+    iter = malloc(sizeof(*iter));
+    if (iter == NULL)
+        return NULL;
+
+    iter->directory = rbh_backend_root(backend, &ID_ONLY);
+    if (iter->directory == NULL) {
+        save_errno = errno;
+        goto out_free_iter;
+    }
+
+    assert(iter->directory->mask & RBH_FP_ID);
+    iter->fsentries = filter_one(backend, &iter->directory->id,
+                                 filter, options);
+    if (iter->fsentries == NULL) {
+        save_errno = errno;
+        goto out_free_directory;
+    }
+
+    errno = 0;
+    iter->filter = filter ? rbh_filter_clone(filter) : NULL;
+    if (iter->filter == NULL && errno != 0) {
+        save_errno = errno;
+        goto out_destroy_fsentries;
+    }
+    errno = save_errno;
+
+    iter->values[0] = rbh_ringr_new(VALUE_RING_SIZE);
+    if (iter->values[0] == NULL) {
+        save_errno = errno;
+        goto out_free_filter;
+    }
+
+    iter->values[1] = rbh_ringr_dup(iter->values[0]);
+    if (iter->values[1] == NULL) {
+        save_errno = errno;
+        goto out_free_first_values_ringr;
+    }
+
+    iter->ids[0] = rbh_ringr_new(ID_RING_SIZE);
+    if (iter->ids[0] == NULL) {
+        save_errno = errno;
+        goto out_free_second_values_ringr;
+    }
+
+    iter->ids[1] = rbh_ringr_dup(iter->ids[0]);
+    if (iter->ids[1] == NULL) {
+        save_errno = errno;
+        goto out_free_first_ids_ringr;
+    }
+
+    iter->options = *options;
+    iter->backend = backend;
+    iter->iterator = BRANCH_ITERATOR;
+
+    /* Setup `iter->value' for the first run of branch_next_fsentries() */
+    iter->directories = rbh_mut_iter_array(NULL, 0, 0); /* Empty iterator */
+    iter->value.type = RBH_VT_BINARY;
+    iter->value.binary.data = NULL;
+
+    return &iter->iterator;
+
+out_free_first_ids_ringr:
+    rbh_ringr_destroy(iter->ids[0]);
+out_free_second_values_ringr:
+    rbh_ringr_destroy(iter->values[1]);
+out_free_first_values_ringr:
+    rbh_ringr_destroy(iter->values[0]);
+out_free_filter:
+    free(iter->filter);
+out_destroy_fsentries:
+    rbh_mut_iter_destroy(iter->fsentries);
+out_free_directory:
+    free(iter->directory);
+out_free_iter:
+    free(iter);
+    errno = save_errno;
+    return NULL;
+}
+
+        /*------------------------------------------------------------*
+         |                       branch-export                        |
+         *------------------------------------------------------------*/
+
+/* The documents of a branch are exported in batches: the ids of (up to)
+ * EXPORT_BATCH_SIZE fsentries the filter of the branch yields, and then the
+ * documents with those ids.
+ */
+#define EXPORT_BATCH_SIZE 256
+
+struct branch_document_iterator {
+    struct rbh_iterator iterator;
+
+    struct rbh_backend *backend;
+    struct rbh_filter_options options;
+    enum rbh_document_format format;
+
+    /* The fsentries (only their ID) that match the filter in the branch */
+    struct rbh_mut_iterator *fsentries;
+    /* The documents of the current batch */
+    struct rbh_iterator *documents;
+};
+
+static struct rbh_iterator *
+branch_export_batch(struct branch_document_iterator *iter)
+{
+    struct rbh_fsentry *fsentries[EXPORT_BATCH_SIZE];
+    struct rbh_value ids[EXPORT_BATCH_SIZE];
+    struct rbh_filter id_filter = {
+        .op = RBH_FOP_IN,
+        .compare = {
+            .field = {
+                .fsentry = RBH_FP_ID,
+            },
+            .value = {
+                .type = RBH_VT_SEQUENCE,
+                .sequence = {
+                    .values = ids,
+                },
+            },
+        },
+    };
+    struct rbh_iterator *documents = NULL;
+    size_t count = 0;
+    int save_errno;
+
+    do {
+        struct rbh_fsentry *fsentry;
+
+        fsentry = rbh_mut_iter_next(iter->fsentries);
+        if (fsentry == NULL) {
+            if (errno != ENODATA)
+                goto out_free_fsentries;
+            break;
+        }
+
+        assert(fsentry->mask & RBH_FP_ID);
+        ids[count].type = RBH_VT_BINARY;
+        ids[count].binary.data = fsentry->id.data;
+        ids[count].binary.size = fsentry->id.size;
+        fsentries[count++] = fsentry;
+    } while (count < EXPORT_BATCH_SIZE);
+
+    if (count == 0) {
+        errno = ENODATA;
+        return NULL;
+    }
+
+    id_filter.compare.value.sequence.count = count;
+    documents = mongo_backend_export(iter->backend, &id_filter, &iter->options,
+                                     iter->format);
+
+out_free_fsentries:
+    save_errno = errno;
+    for (size_t i = 0; i < count; i++)
+        free(fsentries[i]);
+    errno = save_errno;
+    return documents;
+}
+
+static const void *
+branch_document_iter_next(void *iterator)
+{
+    struct branch_document_iterator *iter = iterator;
+
+    while (true) {
+        const void *document;
+
+        if (iter->documents == NULL) {
+            iter->documents = branch_export_batch(iter);
+            if (iter->documents == NULL)
+                return NULL;
+        }
+
+        document = rbh_iter_next(iter->documents);
+        if (document != NULL || errno != ENODATA)
+            return document;
+
+        rbh_iter_destroy(iter->documents);
+        iter->documents = NULL;
+    }
+}
+
+static void
+branch_document_iter_destroy(void *iterator)
+{
+    struct branch_document_iterator *iter = iterator;
+
+    if (iter->documents)
+        rbh_iter_destroy(iter->documents);
+    rbh_mut_iter_destroy(iter->fsentries);
+    free(iter);
+}
+
+static const struct rbh_iterator_operations BRANCH_DOCUMENT_ITER_OPS = {
+    .next = branch_document_iter_next,
+    .destroy = branch_document_iter_destroy,
+};
+
+static const struct rbh_iterator BRANCH_DOCUMENT_ITER = {
+    .ops = &BRANCH_DOCUMENT_ITER_OPS,
+};
+
+static struct rbh_iterator *
+mongo_branch_export(void *backend, const struct rbh_filter *filter,
+                    const struct rbh_filter_options *options,
+                    enum rbh_document_format format)
+{
+    const struct rbh_filter_options ID_ONLY = {
+        .projection = {
+            .fsentry_mask = RBH_FP_ID,
+        },
+    };
+    struct branch_document_iterator *iter;
+
+    switch (format) {
+    case RBH_DF_JSON:
+    case RBH_DF_BSON:
+        break;
+    default:
+        errno = ENOTSUP;
+        return NULL;
+    }
+
+    /* Like generic_branch_backend_filter() */
+    if (options->skip || options->limit || options->sort.count) {
+        errno = ENOTSUP;
+        return NULL;
+    }
+
+    iter = malloc(sizeof(*iter));
+    if (iter == NULL)
+        return NULL;
+
+    iter->fsentries = generic_branch_backend_filter(backend, filter, &ID_ONLY);
+    if (iter->fsentries == NULL) {
+        int save_errno = errno;
+
+        free(iter);
+        errno = save_errno;
+        return NULL;
+    }
+
+    iter->iterator = BRANCH_DOCUMENT_ITER;
+    iter->backend = backend;
+    iter->options = *options;
+    iter->format = format;
+    iter->documents = NULL;
+    return &iter->iterator;
+}
+
+        /*------------------------------------------------------------*
+         |                       branch-explain                       |
+         *------------------------------------------------------------*/
 
-/* Unlike rbh_backend_filter_one(), this function is about applying a filter to
- * a specific entry (identified by its ID) and see if it matches.
+/* The filter of a branch is made of many queries: one per batch of the
+ * directories it walks (level by level). Explain the first of those that is
+ * about the children of the root of the branch, the others only differ by the
+ * ids of the directories.
  */
-static struct rbh_mut_iterator *
-filter_one(void *backend, const struct rbh_id *id,
-           const struct rbh_filter *filter,
-           const struct rbh_filter_options *options)
+static char *
+mongo_branch_explain(void *backend, const struct rbh_filter *filter,
+                     const struct rbh_filter_options *options)
 {
-    const struct rbh_filter id_filter = {
-        .op = RBH_FOP_EQUAL,
+    const struct rbh_filter_projection ID_ONLY = {
+        .fsentry_mask = RBH_FP_ID,
+    };
+    struct rbh_value root_id = {
+        .type = RBH_VT_BINARY,
+    };
+    const struct rbh_filter parent_id_filter = {
+        .op = RBH_FOP_IN,
         .compare = {
             .field = {
-                .fsentry = RBH_FP_ID,
+                .fsentry = RBH_FP_PARENT_ID,
             },
             .value = {
-                .type = RBH_VT_BINARY,
-                .binary = {
-                    .data = id->data,
-                    .size = id->size,
+                .type = RBH_VT_SEQUENCE,
+                .sequence = {
+                    .count = 1,
+                    .values = &root_id,
                 },
             },
         },
     };
     const struct rbh_filter *filters[2] = {
-        &id_filter,
+        &parent_id_filter,
         filter,
     };
     const struct rbh_filter and_filter = {
@@ -1172,115 +3889,316 @@ filter_one(void *backend, const struct rbh_id *id,
             .filters = filters,
         },
     };
+    struct rbh_fsentry *root;
+    int save_errno;
+    char *string;
+
+    /* Like generic_branch_backend_filter() */
+    if (options->skip || options->limit || options->sort.count) {
+        errno = ENOTSUP;
+        return NULL;
+    }
+
+    root = rbh_backend_root(backend, &ID_ONLY);
+    if (root == NULL)
+        return NULL;
+
+    assert(root->mask & RBH_FP_ID);
+    root_id.binary.data = root->id.data;
+    root_id.binary.size = root->id.size;
 
-    return mongo_backend_filter(backend, &and_filter, options);
+    string = mongo_backend_explain(backend, &and_filter, options);
+    save_errno = errno;
+    free(root);
+    errno = save_errno;
+    return string;
 }
 
-#define VALUE_RING_SIZE (1 << 14) /* 16MB */
-#define ID_RING_SIZE (1 << 14) /* 16MB */
+        /*------------------------------------------------------------*
+         |                        branch-sweep                        |
+         *------------------------------------------------------------*/
 
-struct rbh_mut_iterator *
-generic_branch_backend_filter(void *backend, const struct rbh_filter *filter,
-                              const struct rbh_filter_options *options)
+/* Sweeping a branch cannot rely on server-side bulk operations alone: the
+ * fsentries of a branch are only known once the branch has been walked.
+ *
+ * Directories are walked breadth first, in batches of SWEEP_BATCH_SIZE ids.
+ * For each batch, the namespace entries the batch's directories contain are
+ * swept (and so are the fsentries this leaves without any namespace entry).
+ */
+
+#define SWEEP_BATCH_SIZE (1 << 12)
+
+struct sweep_batch {
+    struct sweep_batch *next;
+    bson_t *ids;
+    uint32_t count;
+};
+
+struct sweep_queue {
+    struct sweep_batch *head;
+    struct sweep_batch *tail;
+};
+
+static void
+sweep_batch_destroy(struct sweep_batch *batch)
 {
-    const struct rbh_filter_projection ID_ONLY = {
-        .fsentry_mask = RBH_FP_ID,
-    };
-    struct branch_iterator *iter;
-    int save_errno = errno;
+    bson_destroy(batch->ids);
+    free(batch);
+}
 
-    /* The recursive traversal of the branch prevents a few features from
-     * working out of the box.
-     */
-    if (options->skip || options->limit || options->sort.count) {
-        errno = ENOTSUP;
-        return NULL;
+static int
+sweep_queue_push(struct sweep_queue *queue, const struct rbh_id *id)
+{
+    struct sweep_batch *batch = queue->tail;
+    const char *key;
+    char tmp[16];
+    size_t length;
+
+    if (batch == NULL || batch->count == SWEEP_BATCH_SIZE) {
+        batch = malloc(sizeof(*batch));
+        if (batch == NULL)
+            return -1;
+
+        batch->next = NULL;
+        batch->ids = bson_new();
+        batch->count = 0;
+
+        if (queue->tail == NULL)
+            queue->head = batch;
+        else
+            queue->tail->next = batch;
+        queue->tail = batch;
     }
 
-    iter = malloc(sizeof(*iter));
-    if (iter == NULL)
+    length = bson_uint32_to_string(batch->count, &key, tmp, sizeof(tmp));
+    if (!bson_append_rbh_id(batch->ids, key, length, id)) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    batch->count++;
+
+    return 0;
+}
+
+static struct sweep_batch *
+sweep_queue_pop(struct sweep_queue *queue)
+{
+    struct sweep_batch *batch = queue->head;
+
+    if (batch == NULL)
         return NULL;
 
-    iter->directory = rbh_backend_root(backend, &ID_ONLY);
-    if (iter->directory == NULL) {
-        save_errno = errno;
-        goto out_free_iter;
+    queue->head = batch->next;
+    if (queue->head == NULL)
+        queue->tail = NULL;
+    return batch;
+}
+
+static void
+sweep_queue_clear(struct sweep_queue *queue)
+{
+    struct sweep_batch *batch;
+
+    while ((batch = sweep_queue_pop(queue)) != NULL)
+        sweep_batch_destroy(batch);
+}
+
+/* Push the _id of every document that matches `filter' in `queue' */
+static int
+mongo_find_ids(mongoc_collection_t *entries, const bson_t *filter,
+               struct sweep_queue *queue)
+{
+    mongoc_cursor_t *cursor;
+    const bson_t *document;
+    bson_error_t error;
+    bson_t *opts;
+
+    opts = BCON_NEW("projection", "{", MFF_ID, BCON_BOOL(true), "}");
+    cursor = mongoc_collection_find_with_opts(entries, filter, opts, NULL);
+    bson_destroy(opts);
+    if (cursor == NULL) {
+        errno = EINVAL;
+        return -1;
     }
 
-    assert(iter->directory->mask & RBH_FP_ID);
-    iter->fsentries = filter_one(backend, &iter->directory->id,
-                                 filter, options);
-    if (iter->fsentries == NULL) {
-        save_errno = errno;
-        goto out_free_directory;
+    while (mongoc_cursor_next(cursor, &document)) {
+        const uint8_t *data;
+        struct rbh_id id;
+        bson_iter_t iter;
+        uint32_t size;
+
+        if (!bson_iter_init_find(&iter, document, MFF_ID)
+         || !BSON_ITER_HOLDS_BINARY(&iter)) {
+            mongoc_cursor_destroy(cursor);
+            errno = EINVAL;
+            return -1;
+        }
+
+        bson_iter_binary(&iter, NULL, &size, &data);
+        id.data = (const char *)data;
+        id.size = size;
+        if (sweep_queue_push(queue, &id)) {
+            int save_errno = errno;
+
+            mongoc_cursor_destroy(cursor);
+            errno = save_errno;
+            return -1;
+        }
     }
 
-    errno = 0;
-    iter->filter = filter ? rbh_filter_clone(filter) : NULL;
-    if (iter->filter == NULL && errno != 0) {
-        save_errno = errno;
-        goto out_destroy_fsentries;
+    if (mongoc_cursor_error(cursor, &error)) {
+        snprintf(rbh_backend_error, sizeof(rbh_backend_error), "mongoc: %s",
+                 error.message);
+        mongoc_cursor_destroy(cursor);
+        errno = RBH_BACKEND_ERROR;
+        return -1;
     }
-    errno = save_errno;
 
-    iter->values[0] = rbh_ringr_new(VALUE_RING_SIZE);
-    if (iter->values[0] == NULL) {
-        save_errno = errno;
-        goto out_free_filter;
+    mongoc_cursor_destroy(cursor);
+    return 0;
+}
+
+static int
+mongo_sweep_directories(mongoc_collection_t *entries, const bson_t *parents,
+                        uint64_t generation, struct sweep_queue *directories)
+{
+    struct sweep_queue stale = {};
+    struct sweep_batch *batch;
+    bson_t *filter = bson_new();
+    bson_t namespace;
+    int rc = -1;
+
+    /* Stale directories are walked too: whatever they contain is stale */
+    if (!BSON_APPEND_IN(filter, MFF_NAMESPACE "." MFF_PARENT_ID, parents)
+     || !BSON_APPEND_INT32(filter, MFF_STATX "." MFF_STATX_TYPE, S_IFDIR)) {
+        errno = ENOBUFS;
+        goto out_destroy_filter;
     }
 
-    iter->values[1] = rbh_ringr_dup(iter->values[0]);
-    if (iter->values[1] == NULL) {
-        save_errno = errno;
-        goto out_free_first_values_ringr;
+    if (mongo_find_ids(entries, filter, directories))
+        goto out_destroy_filter;
+
+    bson_reinit(filter);
+    if (!BSON_APPEND_DOCUMENT_BEGIN(filter, MFF_NAMESPACE, &namespace)
+     || !BSON_APPEND_STALE_NAMESPACE(&namespace, "$elemMatch", parents,
+                                     generation)
+     || !bson_append_document_end(filter, &namespace)) {
+        errno = ENOBUFS;
+        goto out_destroy_filter;
     }
 
-    iter->ids[0] = rbh_ringr_new(ID_RING_SIZE);
-    if (iter->ids[0] == NULL) {
+    if (mongo_find_ids(entries, filter, &stale))
+        goto out_clear_stale;
+
+    while ((batch = sweep_queue_pop(&stale)) != NULL) {
+        int save_errno;
+
+        rc = mongo_sweep(entries, batch->ids, parents, generation);
         save_errno = errno;
-        goto out_free_second_values_ringr;
+        sweep_batch_destroy(batch);
+        errno = save_errno;
+        if (rc)
+            goto out_clear_stale;
     }
+    rc = 0;
 
-    iter->ids[1] = rbh_ringr_dup(iter->ids[0]);
-    if (iter->ids[1] == NULL) {
-        save_errno = errno;
-        goto out_free_first_ids_ringr;
+out_clear_stale:
+    sweep_queue_clear(&stale);
+out_destroy_filter:
+    bson_destroy(filter);
+    return rc;
+}
+
+static int
+mongo_branch_sweep(void *backend, uint64_t generation)
+{
+    struct mongo_branch_backend *branch = backend;
+    struct sweep_queue directories = {};
+    struct sweep_batch *batch;
+    int save_errno;
+    int rc;
+
+    if (generation == 0) {
+        errno = EINVAL;
+        return -1;
     }
 
-    iter->options = *options;
-    iter->backend = backend;
-    iter->iterator = BRANCH_ITERATOR;
+    if (sweep_queue_push(&directories, &branch->id))
+        goto out_clear_directories;
 
-    /* Setup `iter->value' for the first run of branch_next_fsentries() */
-    iter->directories = rbh_mut_iter_array(NULL, 0, 0); /* Empty iterator */
-    iter->value.type = RBH_VT_BINARY;
-    iter->value.binary.data = NULL;
+    while ((batch = sweep_queue_pop(&directories)) != NULL) {
+        rc = mongo_sweep_directories(branch->mongo.entries, batch->ids,
+                                     generation, &directories);
+        save_errno = errno;
+        sweep_batch_destroy(batch);
+        errno = save_errno;
+        if (rc)
+            goto out_clear_directories;
+    }
 
-    return &iter->iterator;
+    /* Sweeping removes entries without fsevents to account for it */
+    if (branch->mongo.rollups != 0)
+        mongo_rollups_invalidate(&branch->mongo);
+    return 0;
 
-out_free_first_ids_ringr:
-    rbh_ringr_destroy(iter->ids[0]);
-out_free_second_values_ringr:
-    rbh_ringr_destroy(iter->values[1]);
-out_free_first_values_ringr:
-    rbh_ringr_destroy(iter->values[0]);
-out_free_filter:
-    free(iter->filter);
-out_destroy_fsentries:
-    rbh_mut_iter_destroy(iter->fsentries);
-out_free_directory:
-    free(iter->directory);
-out_free_iter:
-    free(iter);
+out_clear_directories:
+    save_errno = errno;
+    sweep_queue_clear(&directories);
     errno = save_errno;
-    return NULL;
+    return -1;
+}
+
+        /*------------------------------------------------------------*
+         |                    branch-get_attribute                    |
+         *------------------------------------------------------------*/
+
+static int
+mongo_branch_get_attribute(void *backend, const char *attr_name, void *arg,
+                           struct rbh_value_pair *data)
+{
+    struct mongo_branch_backend *branch = backend;
+    struct rbh_mongo_rollup *rollup = arg;
+
+    (void) data;
+
+    if (strcmp(attr_name, RBH_MONGO_ROLLUP_ATTRIBUTE) != 0) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    /* The rollup of a branch is that of its root */
+    return mongo_get_rollup(&branch->mongo,
+                            rollup->id ? rollup->id : &branch->id, rollup);
+}
+
+        /*------------------------------------------------------------*
+         |                       branch-options                       |
+         *------------------------------------------------------------*/
+
+static int
+mongo_branch_set_option(void *backend, unsigned int option, const void *data,
+                        size_t data_size)
+{
+    /* Switching to "garbage collecting" mode would discard the branch's ops */
+    if (option == RBH_GBO_GC) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    return mongo_set_option(backend, option, data, data_size);
 }
 
 static const struct rbh_backend_operations MONGO_BRANCH_BACKEND_OPS = {
+    .get_option = mongo_get_option,
+    .set_option = mongo_branch_set_option,
     .branch = mongo_backend_branch,
     .root = mongo_branch_root,
     .update = mongo_backend_update,
     .filter = generic_branch_backend_filter,
+    .export_entries = mongo_branch_export,
+    .explain = mongo_branch_explain,
+    .get_attribute = mongo_branch_get_attribute,
+    .sweep = mongo_branch_sweep,
     .destroy = mongo_backend_destroy,
 };
 
@@ -1332,32 +4250,65 @@ mongo_backend_init_from_uri(struct mongo_backend *mongo,
 static struct rbh_backend *
 mongo_backend_branch(void *backend, const struct rbh_id *id, const char *path)
 {
+    const struct rbh_filter_projection ID_ONLY = {
+        .fsentry_mask = RBH_FP_ID,
+    };
     struct mongo_backend *mongo = backend;
+    struct rbh_fsentry *fsentry = NULL;
     struct mongo_branch_backend *branch;
     size_t data_size;
+    int save_errno;
     char *data;
 
-    (void) path;
+    if (id == NULL) {
+        if (path == NULL) {
+            errno = EINVAL;
+            return NULL;
+        }
+
+        fsentry = rbh_backend_fsentry_from_path(backend, path, &ID_ONLY);
+        if (fsentry == NULL)
+            return NULL;
+
+        if (!(fsentry->mask & RBH_FP_ID)) {
+            free(fsentry);
+            errno = ENODATA;
+            return NULL;
+        }
+        id = &fsentry->id;
+    }
 
     data_size = id->size;
     branch = malloc(sizeof(*branch) + data_size);
     if (branch == NULL)
-        return NULL;
+        goto out_free_fsentry;
     data = (char *)branch + sizeof(*branch);
 
     if (mongo_backend_init_from_uri(&branch->mongo,
-                                    mongoc_client_get_uri(mongo->client))) {
-        int save_errno = errno;
-
-        free(branch);
-        errno = save_errno;
-        return NULL;
-    }
+                                    mongoc_client_get_uri(mongo->client)))
+        goto out_free_branch;
 
     rbh_id_copy(&branch->id, id, &data, &data_size);
+    free(fsentry);
     branch->mongo.backend = MONGO_BRANCH_BACKEND;
+    branch->mongo.generation = mongo->generation;
+    branch->mongo.indexed_queue = NULL;
+    branch->mongo.read_ahead = mongo->read_ahead;
+    branch->mongo.pool = NULL;
+    memset(&branch->mongo.stats, 0, sizeof(branch->mongo.stats));
+    branch->mongo.rollups = mongo->rollups;
 
     return &branch->mongo.backend;
+
+out_free_branch:
+    save_errno = errno;
+    free(branch);
+    errno = save_errno;
+out_free_fsentry:
+    save_errno = errno;
+    free(fsentry);
+    errno = save_errno;
+    return NULL;
 }
 
 /*----------------------------------------------------------------------------*
@@ -1418,6 +4369,12 @@ rbh_mongo_backend_new(const char *fsname)
     }
 
     mongo->backend = MONGO_BACKEND;
+    mongo->generation = 0;
+    mongo->indexed_queue = NULL;
+    mongo->read_ahead = 0;
+    mongo->pool = NULL;
+    memset(&mongo->stats, 0, sizeof(mongo->stats));
+    mongo->rollups = -1;
 
     return &mongo->backend;
 }
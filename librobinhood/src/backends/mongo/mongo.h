@@ -18,6 +18,7 @@
 struct rbh_filter;
 struct rbh_fsentry;
 struct rbh_fsevent;
+struct rbh_hashmap;
 struct rbh_value;
 struct rbh_value_map;
 
@@ -37,6 +38,7 @@ struct rbh_value_map;
  *             <key>: <value> (RBH_VALUE)
  *             ...
  *         }
+ *         generation: scan generation (INT64)
  *     }, ...]
  *
  *     symlink: fsentry.symlink (UTF8)
@@ -92,8 +94,14 @@ struct rbh_value_map;
  *         <key>: <value> (RBH_VALUE)
  *         ...
  *     }
+ *
+ *     generation: scan generation (INT64)
  * }
  *
+ * The "generation" fields (at the root of the document, and in each element of
+ * "ns") are only set when the backend's RBH_GBO_GENERATION option is, and they
+ * are never decoded into fsentries.
+ *
  * Note that when they are fetched _from_ the database, the "ns" field is
  * unwinded so that we do not have to unwind it ourselves.
  */
@@ -116,6 +124,9 @@ struct rbh_value_map;
 /* symlink */
 #define MFF_SYMLINK                 "symlink"
 
+/* scan generation (inode & namespace) */
+#define MFF_GENERATION              "generation"
+
 /* statx */
 #define MFF_STATX                   "statx"
 #define MFF_STATX_BLKSIZE           "blksize"
@@ -252,7 +263,144 @@ bson_append_rbh_filter_projection(
      *--------------------------------------------------------------------*/
 
 bson_t *
-bson_update_from_fsevent(const struct rbh_fsevent *fsevent);
+bson_update_from_fsevent(const struct rbh_fsevent *fsevent,
+                         uint64_t generation);
+
+    /*--------------------------------------------------------------------*
+     |                              rollups                               |
+     *--------------------------------------------------------------------*/
+
+/* Rollups are stored in their own collection, with the following layout:
+ *
+ * {
+ *     _id: the id of a directory (BINARY, SUBTYPE_BINARY)
+ *     size: the sum of the sizes of the entries under it (INT64)
+ *     blocks: the sum of their blocks (INT64)
+ *     files: how many of them are not directories (INT64)
+ *     directories: how many of them are directories (INT64)
+ * }
+ *
+ * The directory itself is not accounted for in its rollup. A directory without
+ * a document has an empty rollup. An entry with several links is accounted for
+ * once per link.
+ *
+ * A document whose _id is MONGO_ROLLUPS_MARKER (UTF8) indicates rollups were
+ * built, and should be maintained.
+ */
+#define MRF_SIZE                    "size"
+#define MRF_BLOCKS                  "blocks"
+#define MRF_FILES                   "files"
+#define MRF_DIRECTORIES             "directories"
+
+#define MONGO_ROLLUPS_COLLECTION    "rollups"
+#define MONGO_ROLLUPS_MARKER        "built"
+
+struct rollup {
+    int64_t size;
+    int64_t blocks;
+    int64_t files;
+    int64_t directories;
+};
+
+void
+rollup_add(struct rollup *rollup, const struct rollup *delta, int sign);
+
+bool
+rollup_is_empty(const struct rollup *rollup);
+
+/* Rollups are kept in maps of nodes that all start with this */
+struct rollup_node {
+    struct rollup_node *next;
+    struct rbh_id id;
+};
+
+struct rollup_map {
+    struct rbh_hashmap *nodes;
+    size_t slots;
+    size_t count;
+    struct rollup_node *first;
+};
+
+struct rollup_link {
+    struct rbh_id *parent_id;
+    char *name;
+};
+
+/* An entry, as a batch of fsevents leaves it */
+struct rollup_entry {
+    struct rollup_node node;
+
+    int32_t type;
+    int64_t size;
+    int64_t blocks;
+    struct rollup_link *links;
+    size_t link_count;
+
+    /* For directories, their rollup is `stored' + `delta' */
+    bool stored_loaded;
+    struct rollup stored;
+    struct rollup delta;
+    /* The stored rollup is to be replaced (or removed if `deleted') */
+    bool reset;
+    bool deleted;
+};
+
+struct rollup_loader {
+    /* Set the type, size, blocks and links of an entry as they are stored,
+     * (leave them unset if the entry is not stored)
+     */
+    int (*entry)(void *arg, struct rollup_entry *entry);
+    /* Set the rollup of a directory as it is stored */
+    int (*rollup)(void *arg, const struct rbh_id *id, struct rollup *rollup);
+};
+
+/* Tracks how a batch of fsevents changes the rollups of directories */
+struct rollup_batch {
+    const struct rollup_loader *loader;
+    void *arg;
+    struct rollup_map entries;
+};
+
+struct rollup_batch *
+rollup_batch_new(const struct rollup_loader *loader, void *arg);
+
+int
+rollup_batch_add(struct rollup_batch *batch, const struct rbh_fsevent *fsevent);
+
+void
+rollup_batch_destroy(struct rollup_batch *batch);
+
+int
+rollup_entry_add_link(struct rollup_entry *entry, const struct rbh_id *parent_id,
+                      const char *name);
+
+/* A directory, when rollups are built from scratch */
+struct rollup_directory {
+    struct rollup_node node;
+    struct rbh_id *parent_id;
+    struct rollup rollup;
+};
+
+/* Rollups are built in two passes: every directory is added first, then every
+ * entry (directories included).
+ */
+struct rollup_tree {
+    struct rollup_map directories;
+};
+
+struct rollup_tree *
+rollup_tree_new(void);
+
+int
+rollup_tree_add_directory(struct rollup_tree *tree, const struct rbh_id *id,
+                          const struct rbh_id *parent_id);
+
+int
+rollup_tree_add_entry(struct rollup_tree *tree, const struct rbh_id *parent_id,
+                      int32_t type, int64_t size, int64_t blocks);
+
+void
+rollup_tree_destroy(struct rollup_tree *tree);
 
     /*--------------------------------------------------------------------*
      |                               value                                |
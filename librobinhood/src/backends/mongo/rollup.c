@@ -0,0 +1,584 @@
+/* This file is part of RobinHood 4
+ * Copyright (C) 2024 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: LGPL-3.0-or-later
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "robinhood/fsevent.h"
+#include "robinhood/hashmap.h"
+#include "robinhood/statx.h"
+
+#include "mongo.h"
+
+/* Propagating a change to more ancestors than this means there is a cycle */
+#define ROLLUP_MAX_DEPTH 4096
+
+/*----------------------------------------------------------------------------*
+ |                                 rollup_map                                 |
+ *----------------------------------------------------------------------------*/
+
+#define ROLLUP_MIN_SLOTS 1024
+
+static size_t
+id_hash(const void *key)
+{
+    const struct rbh_id *id = key;
+    size_t hash = 5381;
+
+    /* djb2 */
+    for (size_t i = 0; i < id->size; i++)
+        hash = ((hash << 5) + hash) + (unsigned char)id->data[i];
+
+    return hash;
+}
+
+static bool
+id_equals(const void *first, const void *second)
+{
+    return rbh_id_equal(first, second);
+}
+
+static int
+rollup_map_init(struct rollup_map *map)
+{
+    map->nodes = rbh_hashmap_new(id_equals, id_hash, ROLLUP_MIN_SLOTS);
+    if (map->nodes == NULL)
+        return -1;
+
+    map->slots = ROLLUP_MIN_SLOTS;
+    map->count = 0;
+    map->first = NULL;
+    return 0;
+}
+
+static void
+rollup_map_fini(struct rollup_map *map, void (*node_free)(struct rollup_node *))
+{
+    struct rollup_node *node = map->first;
+
+    while (node != NULL) {
+        struct rollup_node *next = node->next;
+
+        node_free(node);
+        node = next;
+    }
+    rbh_hashmap_destroy(map->nodes);
+}
+
+static struct rollup_node *
+rollup_map_get(struct rollup_map *map, const struct rbh_id *id)
+{
+    return (struct rollup_node *)rbh_hashmap_get(map->nodes, id);
+}
+
+/* rbh_hashmaps have a fixed number of slots, nodes are moved to a larger one
+ * when they fill more than 70% of them.
+ */
+static int
+rollup_map_grow(struct rollup_map *map)
+{
+    size_t slots = map->slots * 2;
+    struct rbh_hashmap *nodes;
+
+    nodes = rbh_hashmap_new(id_equals, id_hash, slots);
+    if (nodes == NULL)
+        return -1;
+
+    for (struct rollup_node *node = map->first; node; node = node->next) {
+        if (rbh_hashmap_set(nodes, &node->id, node)) {
+            int save_errno = errno;
+
+            rbh_hashmap_destroy(nodes);
+            errno = save_errno;
+            return -1;
+        }
+    }
+
+    rbh_hashmap_destroy(map->nodes);
+    map->nodes = nodes;
+    map->slots = slots;
+    return 0;
+}
+
+static int
+rollup_map_add(struct rollup_map *map, struct rollup_node *node)
+{
+    if ((map->count + 1) * 10 > map->slots * 7 && rollup_map_grow(map))
+        return -1;
+
+    if (rbh_hashmap_set(map->nodes, &node->id, node))
+        return -1;
+
+    node->next = map->first;
+    map->first = node;
+    map->count++;
+    return 0;
+}
+
+/* Allocate a zeroed node of \p size bytes, followed by the data of \p id */
+static void *
+rollup_node_new(size_t size, const struct rbh_id *id)
+{
+    struct rollup_node *node;
+    char *data;
+
+    node = calloc(1, size + id->size);
+    if (node == NULL)
+        return NULL;
+
+    data = (char *)node + size;
+    memcpy(data, id->data, id->size);
+    node->id.data = data;
+    node->id.size = id->size;
+    return node;
+}
+
+/*----------------------------------------------------------------------------*
+ |                                   rollup                                   |
+ *----------------------------------------------------------------------------*/
+
+void
+rollup_add(struct rollup *rollup, const struct rollup *delta, int sign)
+{
+    rollup->size += sign * delta->size;
+    rollup->blocks += sign * delta->blocks;
+    rollup->files += sign * delta->files;
+    rollup->directories += sign * delta->directories;
+}
+
+bool
+rollup_is_empty(const struct rollup *rollup)
+{
+    return rollup->size == 0 && rollup->blocks == 0 && rollup->files == 0
+        && rollup->directories == 0;
+}
+
+/* What an entry adds to the rollup of its parent, its own rollup aside */
+static struct rollup
+rollup_of_type(int32_t type, int64_t size, int64_t blocks)
+{
+    return (struct rollup){
+        .size = size,
+        .blocks = blocks,
+        .files = type != 0 && type != S_IFDIR,
+        .directories = type == S_IFDIR,
+    };
+}
+
+/*----------------------------------------------------------------------------*
+ |                                rollup_entry                                |
+ *----------------------------------------------------------------------------*/
+
+int
+rollup_entry_add_link(struct rollup_entry *entry, const struct rbh_id *parent_id,
+                      const char *name)
+{
+    struct rollup_link *links;
+    struct rollup_link *link;
+
+    links = reallocarray(entry->links, entry->link_count + 1, sizeof(*links));
+    if (links == NULL)
+        return -1;
+    entry->links = links;
+    link = &links[entry->link_count];
+
+    link->parent_id = rbh_id_new(parent_id->data, parent_id->size);
+    if (link->parent_id == NULL)
+        return -1;
+
+    link->name = strdup(name);
+    if (link->name == NULL) {
+        free(link->parent_id);
+        return -1;
+    }
+
+    entry->link_count++;
+    return 0;
+}
+
+static ssize_t
+rollup_entry_find_link(const struct rollup_entry *entry,
+                       const struct rbh_id *parent_id, const char *name)
+{
+    for (size_t i = 0; i < entry->link_count; i++) {
+        if (rbh_id_equal(entry->links[i].parent_id, parent_id)
+         && strcmp(entry->links[i].name, name) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+static void
+rollup_entry_remove_link(struct rollup_entry *entry, size_t index)
+{
+    free(entry->links[index].parent_id);
+    free(entry->links[index].name);
+    entry->links[index] = entry->links[--entry->link_count];
+}
+
+static void
+rollup_entry_free(struct rollup_node *node)
+{
+    struct rollup_entry *entry = (struct rollup_entry *)node;
+
+    while (entry->link_count > 0)
+        rollup_entry_remove_link(entry, 0);
+    free(entry->links);
+    free(entry);
+}
+
+/*----------------------------------------------------------------------------*
+ |                                rollup_batch                                |
+ *----------------------------------------------------------------------------*/
+
+struct rollup_batch *
+rollup_batch_new(const struct rollup_loader *loader, void *arg)
+{
+    struct rollup_batch *batch;
+
+    batch = malloc(sizeof(*batch));
+    if (batch == NULL)
+        return NULL;
+
+    if (rollup_map_init(&batch->entries)) {
+        free(batch);
+        return NULL;
+    }
+
+    batch->loader = loader;
+    batch->arg = arg;
+    return batch;
+}
+
+void
+rollup_batch_destroy(struct rollup_batch *batch)
+{
+    rollup_map_fini(&batch->entries, rollup_entry_free);
+    free(batch);
+}
+
+/* Entries are loaded the first time a batch needs them, their state then
+ * follows the fsevents of the batch.
+ */
+static struct rollup_entry *
+rollup_batch_get(struct rollup_batch *batch, const struct rbh_id *id)
+{
+    struct rollup_entry *entry;
+    int save_errno;
+
+    entry = (struct rollup_entry *)rollup_map_get(&batch->entries, id);
+    if (entry != NULL)
+        return entry;
+
+    entry = rollup_node_new(sizeof(*entry), id);
+    if (entry == NULL)
+        return NULL;
+
+    if (batch->loader->entry(batch->arg, entry))
+        goto out_free_entry;
+
+    if (rollup_map_add(&batch->entries, &entry->node))
+        goto out_free_entry;
+
+    return entry;
+
+out_free_entry:
+    save_errno = errno;
+    rollup_entry_free(&entry->node);
+    errno = save_errno;
+    return NULL;
+}
+
+/* What an entry adds to the rollup of its parent */
+static int
+rollup_batch_contribution(struct rollup_batch *batch,
+                          struct rollup_entry *entry,
+                          struct rollup *contribution)
+{
+    *contribution = rollup_of_type(entry->type, entry->size, entry->blocks);
+
+    /* The type of an entry may not be known yet, but files have no rollup */
+    if (entry->type != 0 && entry->type != S_IFDIR)
+        return 0;
+
+    if (!entry->stored_loaded) {
+        if (batch->loader->rollup(batch->arg, &entry->node.id, &entry->stored))
+            return -1;
+        entry->stored_loaded = true;
+    }
+
+    rollup_add(contribution, &entry->stored, 1);
+    rollup_add(contribution, &entry->delta, 1);
+    return 0;
+}
+
+/* Add \p delta to the rollup of a directory, and those of its ancestors */
+static int
+rollup_batch_propagate(struct rollup_batch *batch,
+                       const struct rbh_id *parent_id,
+                       const struct rollup *delta, int sign)
+{
+    /* The root's parent ID is empty */
+    for (size_t depth = 0; parent_id->size > 0; depth++) {
+        struct rollup_entry *parent;
+
+        if (depth == ROLLUP_MAX_DEPTH) {
+            errno = ELOOP;
+            return -1;
+        }
+
+        parent = rollup_batch_get(batch, parent_id);
+        if (parent == NULL)
+            return -1;
+
+        rollup_add(&parent->delta, delta, sign);
+
+        /* Directories have at most one link */
+        if (parent->link_count == 0)
+            break;
+        parent_id = parent->links[0].parent_id;
+    }
+
+    return 0;
+}
+
+static int
+rollup_batch_upsert(struct rollup_batch *batch, struct rollup_entry *entry,
+                    const struct rbh_statx *statx)
+{
+    struct rollup before;
+    struct rollup after;
+
+    before = rollup_of_type(entry->type, entry->size, entry->blocks);
+    if (statx->stx_mask & RBH_STATX_TYPE)
+        entry->type = statx->stx_mode & S_IFMT;
+    if (statx->stx_mask & RBH_STATX_SIZE)
+        entry->size = statx->stx_size;
+    if (statx->stx_mask & RBH_STATX_BLOCKS)
+        entry->blocks = statx->stx_blocks;
+    entry->deleted = false;
+
+    after = rollup_of_type(entry->type, entry->size, entry->blocks);
+    rollup_add(&after, &before, -1);
+    if (rollup_is_empty(&after))
+        return 0;
+
+    for (size_t i = 0; i < entry->link_count; i++) {
+        if (rollup_batch_propagate(batch, entry->links[i].parent_id, &after, 1))
+            return -1;
+    }
+
+    return 0;
+}
+
+static int
+rollup_batch_link(struct rollup_batch *batch, struct rollup_entry *entry,
+                  const struct rbh_id *parent_id, const char *name)
+{
+    struct rollup contribution;
+
+    /* The backend replaces a link with the same parent and name */
+    if (rollup_entry_find_link(entry, parent_id, name) >= 0)
+        return 0;
+
+    if (rollup_batch_contribution(batch, entry, &contribution)
+     || rollup_entry_add_link(entry, parent_id, name))
+        return -1;
+    entry->deleted = false;
+
+    return rollup_batch_propagate(batch, parent_id, &contribution, 1);
+}
+
+static int
+rollup_batch_unlink(struct rollup_batch *batch, struct rollup_entry *entry,
+                    const struct rbh_id *parent_id, const char *name)
+{
+    struct rollup contribution;
+    ssize_t index;
+
+    index = rollup_entry_find_link(entry, parent_id, name);
+    if (index < 0)
+        return 0;
+
+    if (rollup_batch_contribution(batch, entry, &contribution)
+     || rollup_batch_propagate(batch, parent_id, &contribution, -1))
+        return -1;
+
+    rollup_entry_remove_link(entry, index);
+    return 0;
+}
+
+static int
+rollup_batch_delete(struct rollup_batch *batch, struct rollup_entry *entry)
+{
+    struct rollup contribution;
+
+    if (rollup_batch_contribution(batch, entry, &contribution))
+        return -1;
+
+    while (entry->link_count > 0) {
+        if (rollup_batch_propagate(batch, entry->links[0].parent_id,
+                                   &contribution, -1))
+            return -1;
+        rollup_entry_remove_link(entry, 0);
+    }
+
+    /* Only directories have a stored rollup to remove */
+    entry->reset = entry->type == 0 || entry->type == S_IFDIR;
+    entry->deleted = true;
+    entry->type = 0;
+    entry->size = 0;
+    entry->blocks = 0;
+    memset(&entry->stored, 0, sizeof(entry->stored));
+    memset(&entry->delta, 0, sizeof(entry->delta));
+    entry->stored_loaded = true;
+    return 0;
+}
+
+int
+rollup_batch_add(struct rollup_batch *batch, const struct rbh_fsevent *fsevent)
+{
+    struct rollup_entry *entry;
+
+    switch (fsevent->type) {
+    case RBH_FET_UPSERT:
+        if (fsevent->upsert.statx == NULL)
+            return 0;
+        break;
+    case RBH_FET_LINK:
+    case RBH_FET_UNLINK:
+    case RBH_FET_DELETE:
+        break;
+    default:
+        return 0;
+    }
+
+    entry = rollup_batch_get(batch, &fsevent->id);
+    if (entry == NULL)
+        return -1;
+
+    switch (fsevent->type) {
+    case RBH_FET_UPSERT:
+        return rollup_batch_upsert(batch, entry, fsevent->upsert.statx);
+    case RBH_FET_LINK:
+        return rollup_batch_link(batch, entry, fsevent->link.parent_id,
+                                 fsevent->link.name);
+    case RBH_FET_UNLINK:
+        return rollup_batch_unlink(batch, entry, fsevent->link.parent_id,
+                                   fsevent->link.name);
+    case RBH_FET_DELETE:
+        return rollup_batch_delete(batch, entry);
+    default:
+        __builtin_unreachable();
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ |                                rollup_tree                                 |
+ *----------------------------------------------------------------------------*/
+
+static void
+rollup_directory_free(struct rollup_node *node)
+{
+    struct rollup_directory *directory = (struct rollup_directory *)node;
+
+    free(directory->parent_id);
+    free(directory);
+}
+
+struct rollup_tree *
+rollup_tree_new(void)
+{
+    struct rollup_tree *tree;
+
+    tree = malloc(sizeof(*tree));
+    if (tree == NULL)
+        return NULL;
+
+    if (rollup_map_init(&tree->directories)) {
+        free(tree);
+        return NULL;
+    }
+
+    return tree;
+}
+
+void
+rollup_tree_destroy(struct rollup_tree *tree)
+{
+    rollup_map_fini(&tree->directories, rollup_directory_free);
+    free(tree);
+}
+
+int
+rollup_tree_add_directory(struct rollup_tree *tree, const struct rbh_id *id,
+                          const struct rbh_id *parent_id)
+{
+    struct rollup_directory *directory;
+    int save_errno;
+
+    /* Directories have at most one link */
+    if (rollup_map_get(&tree->directories, id) != NULL)
+        return 0;
+
+    directory = rollup_node_new(sizeof(*directory), id);
+    if (directory == NULL)
+        return -1;
+
+    if (parent_id != NULL && parent_id->size > 0) {
+        directory->parent_id = rbh_id_new(parent_id->data, parent_id->size);
+        if (directory->parent_id == NULL)
+            goto out_free_directory;
+    }
+
+    if (rollup_map_add(&tree->directories, &directory->node))
+        goto out_free_directory;
+
+    return 0;
+
+out_free_directory:
+    save_errno = errno;
+    rollup_directory_free(&directory->node);
+    errno = save_errno;
+    return -1;
+}
+
+int
+rollup_tree_add_entry(struct rollup_tree *tree, const struct rbh_id *parent_id,
+                      int32_t type, int64_t size, int64_t blocks)
+{
+    const struct rollup own = rollup_of_type(type, size, blocks);
+
+    for (size_t depth = 0; parent_id != NULL; depth++) {
+        struct rollup_directory *directory;
+
+        if (depth == ROLLUP_MAX_DEPTH) {
+            errno = ELOOP;
+            return -1;
+        }
+
+        directory = (struct rollup_directory *)
+            rollup_map_get(&tree->directories, parent_id);
+        if (directory == NULL)
+            /* The root, or an entry whose parent is not known */
+            break;
+
+        rollup_add(&directory->rollup, &own, 1);
+        parent_id = directory->parent_id;
+    }
+
+    return 0;
+}
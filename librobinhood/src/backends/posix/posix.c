@@ -10,9 +10,11 @@
 #endif
 
 #include <assert.h>
+#include <fnmatch.h>
 #include <fts.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <regex.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -145,8 +147,39 @@ ceil2(size_t number)
     return shift >= sizeof(number) * 8 ? number : 1 << shift;
 }
 
+    /*--------------------------------------------------------------------*
+     |                               xattrs                               |
+     *--------------------------------------------------------------------*/
+
+/* Where to read the xattrs of an entry from
+ *
+ * f*xattr() do not support file descriptors opened with O_PATH, the xattrs of
+ * such entries are read through their /proc/self/fd/ path instead.
+ */
+struct xattr_source {
+    int fd;
+    const char *path;
+};
+
+static ssize_t
+source_listxattr(const struct xattr_source *source, char *list, size_t size)
+{
+    if (source->path)
+        return listxattr(source->path, list, size);
+    return flistxattr(source->fd, list, size);
+}
+
+static ssize_t
+source_getxattr(const struct xattr_source *source, const char *name,
+                void *value, size_t size)
+{
+    if (source->path)
+        return getxattr(source->path, name, value, size);
+    return fgetxattr(source->fd, name, value, size);
+}
+
 static ssize_t
-flistxattrs(char *proc_fd_path, char **buffer, size_t *size)
+flistxattrs(const struct xattr_source *source, char **buffer, size_t *size)
 {
     size_t buflen = *size;
     char *keys = *buffer;
@@ -154,7 +187,7 @@ flistxattrs(char *proc_fd_path, char **buffer, size_t *size)
     ssize_t length;
 
 retry:
-    length = listxattr(proc_fd_path, keys, buflen);
+    length = source_listxattr(source, keys, buflen);
     if (length == -1) {
         void *tmp;
 
@@ -164,7 +197,7 @@ retry:
             /* Not much we can do */
             return 0;
         case ERANGE:
-            length = listxattr(proc_fd_path, NULL, 0);
+            length = source_listxattr(source, NULL, 0);
             if (length == -1) {
                 switch (errno) {
                 case E2BIG:
@@ -200,6 +233,106 @@ retry:
 /* The Linux VFS does not allow values of more than 64KiB */
 static const size_t XATTR_VALUE_MAX_VFS_SIZE = 1 << 16;
 
+/* Most values are much smaller than that: they are first read into a buffer of
+ * this size, only the larger ones are read straight into the sstack, once their
+ * size is known.
+ */
+#define XATTR_VALUE_GUESS_SIZE 256
+
+static ssize_t
+getxattr_value(const struct xattr_source *source, const char *name,
+               struct rbh_sstack *xattrs, const char **data)
+{
+    char buffer[XATTR_VALUE_GUESS_SIZE];
+    ssize_t length;
+
+    length = source_getxattr(source, name, buffer, sizeof(buffer));
+    if (length >= 0) {
+        *data = rbh_sstack_push(xattrs, buffer, length);
+        return *data == NULL ? -1 : length;
+    }
+
+    while (errno == ERANGE) {
+        size_t size;
+        char *value;
+
+        length = source_getxattr(source, name, NULL, 0);
+        if (length == -1)
+            return -1;
+        size = length;
+
+        value = rbh_sstack_push(xattrs, NULL, size);
+        if (value == NULL)
+            return -1;
+
+        length = source_getxattr(source, name, value, size);
+        if (length == -1) {
+            int save_errno = errno;
+
+            /* The value may have grown in between both calls */
+            rbh_sstack_pop(xattrs, size);
+            errno = save_errno;
+            continue;
+        }
+
+        if (length < size) {
+            /* ... or shrunk, sstacks grow downwards: move the value to the
+             * top of the sstack
+             */
+            char *top;
+
+            rbh_sstack_pop(xattrs, size);
+            top = rbh_sstack_push(xattrs, NULL, length);
+            assert(top != NULL);
+            memmove(top, value, length);
+            value = top;
+        }
+
+        *data = value;
+        return length;
+    }
+
+    return -1;
+}
+
+static bool
+xattr_rule_matches(const struct posix_xattr_rule *rule, const char *name)
+{
+    if (rule->name[rule->length - 1] == '.')
+        return strncmp(name, rule->name, rule->length) == 0;
+    return strcmp(name, rule->name) == 0;
+}
+
+static bool
+xattr_rules_select(const struct posix_xattr_rule *rules, size_t count,
+                   const char *name)
+{
+    bool inclusions = false;
+    bool included = false;
+
+    for (size_t i = 0; i < count; i++) {
+        if (rules[i].exclude) {
+            if (xattr_rule_matches(&rules[i], name))
+                return false;
+        } else {
+            inclusions = true;
+            included = included || xattr_rule_matches(&rules[i], name);
+        }
+    }
+
+    /* When there are inclusions, only the xattrs that match one are selected */
+    return !inclusions || included;
+}
+
+static bool
+posix_iter_selects_xattr(struct posix_iterator *posix_iter, const char *name)
+{
+    return xattr_rules_select(posix_iter->xattr_rules,
+                              posix_iter->xattr_rule_count, name)
+        && xattr_rules_select(posix_iter->projected_xattrs,
+                              posix_iter->projected_xattr_count, name);
+}
+
 static __thread size_t names_length = 1 << 12;
 static __thread char *names;
 
@@ -211,8 +344,8 @@ free_names(void)
 }
 
 static ssize_t
-getxattrs(char *proc_fd_path, struct rbh_value_pair **_pairs,
-          size_t *_pairs_count,
+getxattrs(struct posix_iterator *posix_iter, const struct xattr_source *source,
+          struct rbh_value_pair **_pairs, size_t *_pairs_count,
           struct rbh_sstack *values, struct rbh_sstack *xattrs)
 {
     struct rbh_value_pair *pairs = *_pairs;
@@ -227,19 +360,23 @@ getxattrs(char *proc_fd_path, struct rbh_value_pair **_pairs,
             return -1;
     }
 
-    count = flistxattrs(proc_fd_path, &names, &names_length);
+    count = flistxattrs(source, &names, &names_length);
     if (count == -1)
         return -1;
 
     name = names;
     for (size_t i = 0; i < count; i++, name += strlen(name) + 1) {
         struct rbh_value_pair *pair = &pairs[i - skipped];
-        char buffer[XATTR_VALUE_MAX_VFS_SIZE];
         struct rbh_value value = {
             .type = RBH_VT_BINARY,
         };
         ssize_t length;
 
+        if (!posix_iter_selects_xattr(posix_iter, name)) {
+            skipped++;
+            continue;
+        }
+
         if (i - skipped == pairs_count) {
             void *tmp;
 
@@ -248,11 +385,12 @@ getxattrs(char *proc_fd_path, struct rbh_value_pair **_pairs,
                 return -1;
             *_pairs = pairs = tmp;
             *_pairs_count = pairs_count *= 2;
+            pair = &pairs[i - skipped];
         }
         assert(i - skipped < pairs_count);
 
         pair->key = name;
-        length = getxattr(proc_fd_path, name, &buffer, sizeof(buffer));
+        length = getxattr_value(source, name, xattrs, &value.binary.data);
         if (length == -1) {
             switch (errno) {
             case E2BIG:
@@ -269,11 +407,7 @@ getxattrs(char *proc_fd_path, struct rbh_value_pair **_pairs,
                 return -1;
             }
         }
-        assert(length <= sizeof(buffer));
-
-        value.binary.data = rbh_sstack_push(xattrs, buffer, length);
-        if (value.binary.data == NULL)
-            return -1;
+        assert(length <= XATTR_VALUE_MAX_VFS_SIZE);
         value.binary.size = length;
 
         pair->value = rbh_sstack_push(values, &value, sizeof(value));
@@ -323,21 +457,190 @@ free_ns_data(void)
         rbh_sstack_destroy(xattrs);
 }
 
+    /*--------------------------------------------------------------------*
+     |                             hardlinks                              |
+     *--------------------------------------------------------------------*/
+
+struct posix_hardlink {
+    struct rbh_list_node link;
+    /** How many names of the file were not returned yet */
+    uint32_t remaining;
+    struct rbh_id id;
+    char data[];
+};
+
+static size_t
+djb2(const char *data, size_t size)
+{
+    size_t hash = 5381;
+
+    for (size_t i = 0; i < size; i++)
+        hash = ((hash << 5) + hash) + data[i];
+
+    return hash;
+}
+
+static size_t
+hardlink_hash(const void *key)
+{
+    const struct rbh_id *id = key;
+
+    return djb2(id->data, id->size);
+}
+
+static bool
+hardlink_equals(const void *first, const void *second)
+{
+    return rbh_id_equal(first, second);
+}
+
+static struct posix_hardlinks *
+hardlinks_new(size_t capacity)
+{
+    struct posix_hardlinks *hardlinks;
+
+    hardlinks = malloc(sizeof(*hardlinks));
+    if (hardlinks == NULL)
+        return NULL;
+
+    /* Keep the load factor of the hashmap under 70% */
+    hardlinks->map = rbh_hashmap_new(hardlink_equals, hardlink_hash,
+                                     capacity * 100 / 70 + 1);
+    if (hardlinks->map == NULL) {
+        int save_errno = errno;
+
+        free(hardlinks);
+        errno = save_errno;
+        return NULL;
+    }
+
+    rbh_list_init(&hardlinks->fifo);
+    hardlinks->count = 0;
+    hardlinks->capacity = capacity;
+    return hardlinks;
+}
+
+static void
+hardlinks_forget(struct posix_hardlinks *hardlinks,
+                 struct posix_hardlink *hardlink)
+{
+    rbh_hashmap_pop(hardlinks->map, &hardlink->id);
+    rbh_list_del(&hardlink->link);
+    hardlinks->count--;
+    free(hardlink);
+}
+
+/* Whether another name of the file designated by `id' was already returned */
+static bool
+hardlinks_seen(struct posix_hardlinks *hardlinks, const struct rbh_id *id)
+{
+    struct posix_hardlink *hardlink;
+    int save_errno = errno;
+
+    hardlink = (struct posix_hardlink *)rbh_hashmap_get(hardlinks->map, id);
+    errno = save_errno;
+    if (hardlink == NULL)
+        return false;
+
+    /* Once every name of the file was returned, there is no need to keep
+     * track of it anymore.
+     */
+    if (--hardlink->remaining == 0)
+        hardlinks_forget(hardlinks, hardlink);
+    return true;
+}
+
+static int
+hardlinks_remember(struct posix_iterator *posix_iter, const struct rbh_id *id,
+                   uint32_t nlink)
+{
+    struct posix_hardlinks *hardlinks = posix_iter->hardlinks;
+    struct posix_hardlink *hardlink;
+    size_t data_size = id->size;
+    char *data;
+
+    if (hardlinks == NULL) {
+        hardlinks = hardlinks_new(posix_iter->hardlink_cache);
+        if (hardlinks == NULL)
+            return -1;
+        posix_iter->hardlinks = hardlinks;
+    }
+
+    if (hardlinks->count == hardlinks->capacity)
+        /* Make room by evicting the file that was seen first */
+        hardlinks_forget(hardlinks, rbh_list_first(&hardlinks->fifo,
+                                                   struct posix_hardlink,
+                                                   link));
+
+    hardlink = malloc(sizeof(*hardlink) + data_size);
+    if (hardlink == NULL)
+        return -1;
+
+    data = hardlink->data;
+    rbh_id_copy(&hardlink->id, id, &data, &data_size);
+    hardlink->remaining = nlink - 1;
+
+    /* The hashmap has more slots than the cache has entries, this cannot fail
+     */
+    rbh_hashmap_set(hardlinks->map, &hardlink->id, hardlink);
+    rbh_list_add_tail(&hardlinks->fifo, &hardlink->link);
+    hardlinks->count++;
+    return 0;
+}
+
+static void
+hardlinks_destroy(struct posix_hardlinks *hardlinks)
+{
+    struct posix_hardlink *hardlink, *tmp;
+
+    rbh_list_foreach_safe(&hardlinks->fifo, hardlink, tmp, link)
+        free(hardlink);
+    rbh_hashmap_destroy(hardlinks->map);
+    free(hardlinks);
+}
+
+/* Build an fsentry that only links the file to its parent, for files whose
+ * inode data was returned along with another of their names.
+ */
 static struct rbh_fsentry *
-fsentry_from_ftsent(FTSENT *ftsent, int statx_sync_type, size_t prefix_len,
-                    int (*inode_xattrs_callback)(const int,
-                                                 const struct rbh_statx *,
-                                                 struct rbh_value_pair *,
-                                                 ssize_t *,
-                                                 struct rbh_value_pair *,
-                                                 struct rbh_sstack *))
+link_fsentry_from_ftsent(FTSENT *ftsent, struct rbh_id *id,
+                         const struct rbh_value *path)
 {
+    struct rbh_value_map ns_xattrs;
+    struct rbh_fsentry *fsentry;
+    struct rbh_value_pair *pair;
+    int save_errno;
+
+    pair = &ns_pairs[0];
+    pair->key = "path";
+    pair->value = rbh_sstack_push(ns_values, path, sizeof(*path));
+    if (pair->value == NULL)
+        return NULL;
+
+    ns_xattrs.count = 1;
+    ns_xattrs.pairs = ns_pairs;
+
+    fsentry = rbh_fsentry_new(id, ftsent->fts_parent->fts_pointer,
+                              ftsent->fts_name, NULL, &ns_xattrs, NULL, NULL);
+    save_errno = errno;
+    sstack_clear(ns_values);
+    errno = save_errno;
+    return fsentry;
+}
+
+static struct rbh_fsentry *
+fsentry_from_ftsent(struct posix_iterator *posix_iter, FTSENT *ftsent)
+{
+    int (*inode_xattrs_callback)(const int, const struct rbh_statx *,
+                                 struct rbh_value_pair *, ssize_t *,
+                                 struct rbh_value_pair *, struct rbh_sstack *) =
+        posix_iter->inode_xattrs_callback;
     const int statx_flags =
         AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT;
     const struct rbh_value path = {
         .type = RBH_VT_STRING,
-        .string = ftsent->fts_pathlen == prefix_len ?
-            "/" : ftsent->fts_path + prefix_len,
+        .string = ftsent->fts_pathlen == posix_iter->prefix_len ?
+            "/" : ftsent->fts_path + posix_iter->prefix_len,
     };
     struct rbh_value_map inode_xattrs;
     struct rbh_value_map ns_xattrs;
@@ -345,6 +648,7 @@ fsentry_from_ftsent(FTSENT *ftsent, int statx_sync_type, size_t prefix_len,
     struct rbh_fsentry *fsentry;
     size_t pairs_count = 1 << 7;
     struct rbh_statx statxbuf;
+    struct xattr_source source;
     char proc_fd_path[64];
     char *symlink = NULL;
     struct rbh_id *id;
@@ -387,14 +691,17 @@ fsentry_from_ftsent(FTSENT *ftsent, int statx_sync_type, size_t prefix_len,
             return NULL;
     }
 
+    source.path = NULL;
     fd = openat(AT_FDCWD, ftsent->fts_accpath,
                 O_RDONLY | O_CLOEXEC | O_NOFOLLOW | O_NONBLOCK);
-    if (fd < 0 && (errno == ELOOP || errno == ENXIO))
+    if (fd < 0 && (errno == ELOOP || errno == ENXIO)) {
         /* The open will fail with ENXIO if the entry is a socket, so open
          * it again but with O_PATH
          */
         fd = openat(AT_FDCWD, ftsent->fts_accpath,
                     O_PATH | O_CLOEXEC | O_NOFOLLOW | O_NONBLOCK);
+        source.path = proc_fd_path;
+    }
 
     if (fd < 0) {
         fprintf(stderr, "Failed to open '%s': %s (%d)\n",
@@ -406,7 +713,8 @@ fsentry_from_ftsent(FTSENT *ftsent, int statx_sync_type, size_t prefix_len,
         return NULL;
     }
 
-    if (sprintf(proc_fd_path, "/proc/self/fd/%d", fd) == -1) {
+    source.fd = fd;
+    if (source.path && sprintf(proc_fd_path, "/proc/self/fd/%d", fd) == -1) {
         errno = ENOMEM;
         return NULL;
     }
@@ -420,9 +728,23 @@ fsentry_from_ftsent(FTSENT *ftsent, int statx_sync_type, size_t prefix_len,
         goto out_close;
     }
 
-    if (rbh_statx(fd, "", statx_flags | statx_sync_type,
-                  RBH_STATX_BASIC_STATS | RBH_STATX_BTIME | RBH_STATX_MNT_ID,
-                  &statxbuf)) {
+    if (posix_iter->hardlinks != NULL
+     && hardlinks_seen(posix_iter->hardlinks, id)) {
+        /* Another name of this file was already returned, along with its
+         * inode data: skip statx(), xattrs, ...
+         */
+        fsentry = link_fsentry_from_ftsent(ftsent, id, &path);
+        save_errno = errno;
+        free(id);
+        /* Ignore errors on close */
+        close(fd);
+        errno = save_errno;
+        return fsentry;
+    }
+
+    if (posix_iter->get_statx(fd, "", statx_flags | posix_iter->statx_sync_type,
+                              RBH_STATX_BASIC_STATS | RBH_STATX_BTIME
+                            | RBH_STATX_MNT_ID, &statxbuf)) {
         fprintf(stderr, "Failed to stat '%s': %s (%d)\n",
                 path.string, strerror(errno), errno);
         /* Set errno to ESTALE to not stop the iterator for a single failed
@@ -454,7 +776,11 @@ fsentry_from_ftsent(FTSENT *ftsent, int statx_sync_type, size_t prefix_len,
         }
     }
 
-    count = getxattrs(proc_fd_path, &pairs, &pairs_count, values, xattrs);
+    if (posix_iter->inode_xattrs)
+        count = getxattrs(posix_iter, &source, &pairs, &pairs_count, values,
+                          xattrs);
+    else
+        count = 0;
     if (count == -1) {
         if (errno != ENOMEM) {
             fprintf(stderr, "Failed to get xattrs of '%s': %s (%d)\n",
@@ -479,7 +805,7 @@ fsentry_from_ftsent(FTSENT *ftsent, int statx_sync_type, size_t prefix_len,
     ns_xattrs.count = 1;
     ns_xattrs.pairs = ns_pairs;
 
-    if (inode_xattrs_callback != NULL) {
+    if (inode_xattrs_callback != NULL && posix_iter->inode_xattrs) {
         int callback_xattrs_count = inode_xattrs_callback(fd, &statxbuf, pairs,
                                                           &count, &pairs[count],
                                                           values);
@@ -505,12 +831,22 @@ fsentry_from_ftsent(FTSENT *ftsent, int statx_sync_type, size_t prefix_len,
 
     fsentry = rbh_fsentry_new(id, ftsent->fts_parent->fts_pointer,
                               ftsent->fts_name, &statxbuf, &ns_xattrs,
-                              &inode_xattrs, symlink);
+                              posix_iter->inode_xattrs ? &inode_xattrs : NULL,
+                              symlink);
     if (fsentry == NULL) {
         save_errno = errno;
         goto out_clear_sstacks;
     }
 
+    if (posix_iter->hardlink_cache > 0
+     && statxbuf.stx_mask & RBH_STATX_TYPE && !S_ISDIR(statxbuf.stx_mode)
+     && statxbuf.stx_mask & RBH_STATX_NLINK && statxbuf.stx_nlink > 1
+     && hardlinks_remember(posix_iter, id, statxbuf.stx_nlink)) {
+        save_errno = errno;
+        free(fsentry);
+        goto out_clear_sstacks;
+    }
+
     sstack_clear(values);
     sstack_clear(xattrs);
     sstack_clear(ns_values);
@@ -544,6 +880,369 @@ out_close:
     return NULL;
 }
 
+static int
+strcmp_ptr(const void *first, const void *second)
+{
+    return strcmp(*(char * const *)first, *(char * const *)second);
+}
+
+static int
+strcmp_key(const void *key, const void *element)
+{
+    return strcmp(key, *(char * const *)element);
+}
+
+static bool
+posix_iter_skips(struct posix_iterator *posix_iter, FTSENT *ftsent)
+{
+    const char *path = ftsent->fts_pathlen == posix_iter->prefix_len ?
+        "/" : ftsent->fts_path + posix_iter->prefix_len;
+
+    return bsearch(path, posix_iter->skip_subtrees, posix_iter->skip_count,
+                   sizeof(*posix_iter->skip_subtrees), strcmp_key) != NULL;
+}
+
+    /*--------------------------------------------------------------------*
+     |                              exclude                               |
+     *--------------------------------------------------------------------*/
+
+struct posix_exclude {
+    enum {
+        PE_GLOB,
+        PE_REGEX,
+        PE_UID,
+    } type;
+    /** The rule, as it was set */
+    char *rule;
+    union {
+        const char *glob;
+        regex_t regex;
+        uid_t uid;
+    };
+};
+
+static int
+exclude_init(struct posix_exclude *exclude, const char *rule)
+{
+    const char *value;
+
+    exclude->rule = strdup(rule);
+    if (exclude->rule == NULL)
+        return -1;
+
+    if (strncmp(rule, "regex:", strlen("regex:")) == 0) {
+        value = exclude->rule + strlen("regex:");
+        exclude->type = PE_REGEX;
+        if (regcomp(&exclude->regex, value, REG_EXTENDED | REG_NOSUB))
+            goto out_free_rule;
+    } else if (strncmp(rule, "uid:", strlen("uid:")) == 0) {
+        unsigned long uid;
+        char *end;
+
+        value = exclude->rule + strlen("uid:");
+        errno = 0;
+        uid = strtoul(value, &end, 10);
+        if (errno || *end != '\0' || end == value || uid != (uid_t)uid)
+            goto out_free_rule;
+        exclude->type = PE_UID;
+        exclude->uid = uid;
+    } else {
+        if (strncmp(rule, "glob:", strlen("glob:")) == 0)
+            exclude->glob = exclude->rule + strlen("glob:");
+        else
+            exclude->glob = exclude->rule;
+        exclude->type = PE_GLOB;
+    }
+
+    return 0;
+
+out_free_rule:
+    free(exclude->rule);
+    errno = EINVAL;
+    return -1;
+}
+
+static void
+exclude_fini(struct posix_exclude *exclude)
+{
+    if (exclude->type == PE_REGEX)
+        regfree(&exclude->regex);
+    free(exclude->rule);
+}
+
+static void
+free_excludes(struct posix_exclude *excludes, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        exclude_fini(&excludes[i]);
+    free(excludes);
+}
+
+static bool
+posix_iter_excludes(struct posix_iterator *posix_iter, FTSENT *ftsent)
+{
+    const char *path = ftsent->fts_path + posix_iter->prefix_len;
+    int save_errno = errno;
+    bool stated = false;
+    struct stat st;
+
+    for (size_t i = 0; i < posix_iter->exclude_count; i++) {
+        const struct posix_exclude *exclude = &posix_iter->excludes[i];
+
+        switch (exclude->type) {
+        case PE_GLOB:
+            /* Globs without a '/' apply to names, like find's -name */
+            if (strchr(exclude->glob, '/') ?
+                    fnmatch(exclude->glob, path, FNM_PATHNAME) == 0 :
+                    fnmatch(exclude->glob, ftsent->fts_name, 0) == 0)
+                return true;
+            break;
+        case PE_REGEX:
+            if (regexec(&exclude->regex, path, 0, NULL, 0) == 0)
+                return true;
+            break;
+        case PE_UID:
+            /* Entries are not stat()ed by fts (cf. FTS_NOSTAT) */
+            if (!stated) {
+                if (fstatat(AT_FDCWD, ftsent->fts_accpath, &st,
+                            AT_SYMLINK_NOFOLLOW)) {
+                    /* Let fsentry_from_ftsent() report the error */
+                    errno = save_errno;
+                    continue;
+                }
+                stated = true;
+            }
+            if (st.st_uid == exclude->uid)
+                return true;
+            break;
+        }
+    }
+
+    return false;
+}
+
+    /*--------------------------------------------------------------------*
+     |                            xattr rules                             |
+     *--------------------------------------------------------------------*/
+
+static int
+xattr_rule_init(struct posix_xattr_rule *xattr_rule, const char *rule)
+{
+    xattr_rule->rule = strdup(rule);
+    if (xattr_rule->rule == NULL)
+        return -1;
+
+    xattr_rule->exclude = *rule == '!';
+    xattr_rule->name = xattr_rule->rule + xattr_rule->exclude;
+    xattr_rule->length = strlen(xattr_rule->name);
+    if (xattr_rule->length == 0) {
+        free(xattr_rule->rule);
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+free_xattr_rules(struct posix_xattr_rule *rules, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        free(rules[i].rule);
+    free(rules);
+}
+
+/* Set `*copy' to a copy of `rules' (NULL if `count' is 0) */
+static int
+copy_xattr_rules(struct posix_xattr_rule **copy,
+                 const struct posix_xattr_rule *rules, size_t count)
+{
+    struct posix_xattr_rule *xattr_rules = NULL;
+
+    if (count > 0) {
+        xattr_rules = reallocarray(NULL, count, sizeof(*xattr_rules));
+        if (xattr_rules == NULL)
+            return -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (xattr_rule_init(&xattr_rules[i], rules[i].rule)) {
+            int save_errno = errno;
+
+            free_xattr_rules(xattr_rules, i);
+            errno = save_errno;
+            return -1;
+        }
+    }
+
+    *copy = xattr_rules;
+    return 0;
+}
+
+/* Convert the inode xattrs of a projection into inclusions */
+static int
+posix_iter_project(struct posix_iterator *posix_iter,
+                   const struct rbh_filter_projection *projection)
+{
+    const struct rbh_value_map *map = &projection->xattrs.inode;
+    struct posix_xattr_rule *rules;
+
+    posix_iter->inode_xattrs = projection->fsentry_mask & RBH_FP_INODE_XATTRS;
+    if (!posix_iter->inode_xattrs || map->count == 0)
+        return 0;
+
+    rules = reallocarray(NULL, map->count, sizeof(*rules));
+    if (rules == NULL)
+        return -1;
+
+    for (size_t i = 0; i < map->count; i++) {
+        const char *key = map->pairs[i].key;
+
+        /* Keys are names (or namespaces), never exclusions */
+        rules[i].rule = *key == '\0' ? NULL : strdup(key);
+        if (rules[i].rule == NULL) {
+            int save_errno = *key == '\0' ? EINVAL : errno;
+
+            free_xattr_rules(rules, i);
+            errno = save_errno;
+            return -1;
+        }
+        rules[i].name = rules[i].rule;
+        rules[i].length = strlen(key);
+        rules[i].exclude = false;
+    }
+
+    posix_iter->projected_xattrs = rules;
+    posix_iter->projected_xattr_count = map->count;
+    return 0;
+}
+
+    /*--------------------------------------------------------------------*
+     |                              throttle                              |
+     *--------------------------------------------------------------------*/
+
+/* The rate of adaptive throttles is adjusted at most this often (in ms) */
+#define THROTTLE_ADJUST_INTERVAL 100
+/* Adaptive throttles never go below this rate (in entries per second) */
+#define THROTTLE_MIN_RATE 1.
+/* The weight of a new sample in the moving average of the latency */
+#define THROTTLE_LATENCY_WEIGHT (1. / 16)
+
+static double
+timespec_diff(const struct timespec *end, const struct timespec *start)
+{
+    return (end->tv_sec - start->tv_sec)
+         + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Must be called with throttle->lock held */
+static void
+throttle_reset(struct posix_throttle *throttle)
+{
+    throttle->enabled = throttle->rate_limit || throttle->latency_target;
+    throttle->rate = throttle->rate_limit;
+    throttle->tokens = 0.;
+    clock_gettime(CLOCK_MONOTONIC, &throttle->refilled_at);
+    throttle->adjusted_at = throttle->refilled_at;
+    throttle->latency = 0.;
+}
+
+static void
+throttle_init(struct posix_throttle *throttle, uint64_t rate_limit,
+              uint64_t latency_target)
+{
+    pthread_mutex_init(&throttle->lock, NULL);
+    throttle->rate_limit = rate_limit;
+    throttle->latency_target = latency_target;
+    throttle->backoffs = 0;
+    throttle_reset(throttle);
+}
+
+/* Wait until the next entry may be read */
+static void
+throttle_acquire(struct posix_throttle *throttle)
+{
+    int save_errno = errno;
+    struct timespec delay;
+    double seconds = 0.;
+
+    pthread_mutex_lock(&throttle->lock);
+    if (throttle->rate > 0.) {
+        struct timespec now;
+        double burst;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        throttle->tokens += timespec_diff(&now, &throttle->refilled_at)
+                          * throttle->rate;
+        throttle->refilled_at = now;
+
+        /* Allow bursts of (at most) a second worth of entries */
+        burst = throttle->rate < 1. ? 1. : throttle->rate;
+        if (throttle->tokens > burst)
+            throttle->tokens = burst;
+
+        /* Concurrent readers each reserve a token, and wait for their turn */
+        throttle->tokens -= 1.;
+        if (throttle->tokens < 0.)
+            seconds = -throttle->tokens / throttle->rate;
+    }
+    pthread_mutex_unlock(&throttle->lock);
+
+    if (seconds > 0.) {
+        delay.tv_sec = seconds;
+        delay.tv_nsec = (seconds - delay.tv_sec) * 1e9;
+        while (nanosleep(&delay, &delay) && errno == EINTR);
+    }
+    errno = save_errno;
+}
+
+/* Account for an entry whose metadata took since `start' to fetch */
+static void
+throttle_record(struct posix_throttle *throttle, const struct timespec *start)
+{
+    struct timespec now;
+    double latency;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    latency = timespec_diff(&now, start) * 1e6;
+
+    pthread_mutex_lock(&throttle->lock);
+    if (throttle->latency == 0.)
+        throttle->latency = latency;
+    else
+        throttle->latency += (latency - throttle->latency)
+                           * THROTTLE_LATENCY_WEIGHT;
+
+    if (throttle->latency_target == 0
+     || timespec_diff(&now, &throttle->adjusted_at) * 1000
+            < THROTTLE_ADJUST_INTERVAL)
+        goto out_unlock;
+    throttle->adjusted_at = now;
+
+    if (throttle->latency > throttle->latency_target) {
+        /* Back off quickly... */
+        if (throttle->rate == 0.)
+            /* Start from the rate a single reader gets at this latency */
+            throttle->rate = 1e6 / throttle->latency;
+        throttle->rate /= 2;
+        if (throttle->rate < THROTTLE_MIN_RATE)
+            throttle->rate = THROTTLE_MIN_RATE;
+        throttle->backoffs++;
+    } else if (throttle->rate > 0.) {
+        /* ... and recover slowly */
+        if (throttle->rate_limit) {
+            throttle->rate += throttle->rate_limit / 20.;
+            if (throttle->rate > throttle->rate_limit)
+                throttle->rate = throttle->rate_limit;
+        } else {
+            throttle->rate += throttle->rate / 10.;
+        }
+    }
+
+out_unlock:
+    pthread_mutex_unlock(&throttle->lock);
+}
+
 static void *
 posix_iter_next(void *iterator)
 {
@@ -551,6 +1250,7 @@ posix_iter_next(void *iterator)
     bool skip_error = posix_iter->skip_error;
     struct rbh_fsentry *fsentry;
     int save_errno = errno;
+    struct timespec start;
     FTSENT *ftsent;
 
 skip:
@@ -587,6 +1287,20 @@ skip:
         return NULL;
     }
 
+    if ((posix_iter->skip_count > 0 && posix_iter_skips(posix_iter, ftsent))
+     || (posix_iter->exclude_count > 0 && ftsent->fts_level > FTS_ROOTLEVEL
+      && posix_iter_excludes(posix_iter, ftsent))) {
+        /* Do not even read the content of skipped directories */
+        if (ftsent->fts_info == FTS_D)
+            fts_set(posix_iter->fts_handle, ftsent, FTS_SKIP);
+        goto skip;
+    }
+
+    /* Do not read the content of directories at the maximum depth */
+    if (ftsent->fts_level == posix_iter->max_depth
+     && ftsent->fts_info == FTS_D)
+        fts_set(posix_iter->fts_handle, ftsent, FTS_SKIP);
+
     /* This condition checks if the entry has no parent, which indicates whether
      * the current ftsent is the root of our iterator or not, and if the first
      * character of its path is a '/', which indicates whether we are in a
@@ -619,18 +1333,25 @@ skip:
             return NULL;
         }
 
-        ftsent->fts_parent->fts_pointer = id_from_fd(fd);
+        posix_iter->branch_parent_id = id_from_fd(fd);
         save_errno = errno;
         close(fd);
         free(path_dup);
         errno = save_errno;
-        if (ftsent->fts_parent->fts_pointer == NULL)
+        if (posix_iter->branch_parent_id == NULL)
             return NULL;
+        ftsent->fts_parent->fts_pointer = posix_iter->branch_parent_id;
+    }
+
+    if (posix_iter->throttle) {
+        throttle_acquire(posix_iter->throttle);
+        clock_gettime(CLOCK_MONOTONIC, &start);
     }
 
-    fsentry = fsentry_from_ftsent(ftsent, posix_iter->statx_sync_type,
-                                  posix_iter->prefix_len,
-                                  posix_iter->inode_xattrs_callback);
+    fsentry = fsentry_from_ftsent(posix_iter, ftsent);
+    if (posix_iter->throttle)
+        throttle_record(posix_iter->throttle, &start);
+
     if (fsentry == NULL && (errno == ENOENT || errno == ESTALE)) {
         /* The entry moved from under our feet */
         if (skip_error) {
@@ -662,6 +1383,12 @@ posix_iter_destroy(void *iterator)
         }
     }
     fts_close(posix_iter->fts_handle);
+    free(posix_iter->branch_parent_id);
+    if (posix_iter->hardlinks)
+        hardlinks_destroy(posix_iter->hardlinks);
+    free_xattr_rules(posix_iter->xattr_rules, posix_iter->xattr_rule_count);
+    free_xattr_rules(posix_iter->projected_xattrs,
+                     posix_iter->projected_xattr_count);
     free(posix_iter);
 }
 
@@ -710,7 +1437,22 @@ posix_iterator_new(const char *root, const char *entry, int statx_sync_type)
     posix_iter->iterator = POSIX_ITER;
     posix_iter->inode_xattrs_callback = NULL;
     posix_iter->statx_sync_type = statx_sync_type;
+    posix_iter->get_statx = rbh_statx;
+    posix_iter->branch_parent_id = NULL;
     posix_iter->prefix_len = strcmp(root, "/") ? strlen(root) : 0;
+    posix_iter->skip_subtrees = NULL;
+    posix_iter->skip_count = 0;
+    posix_iter->excludes = NULL;
+    posix_iter->exclude_count = 0;
+    posix_iter->max_depth = -1;
+    posix_iter->throttle = NULL;
+    posix_iter->hardlink_cache = 0;
+    posix_iter->hardlinks = NULL;
+    posix_iter->inode_xattrs = true;
+    posix_iter->xattr_rules = NULL;
+    posix_iter->xattr_rule_count = 0;
+    posix_iter->projected_xattrs = NULL;
+    posix_iter->projected_xattr_count = 0;
     posix_iter->fts_handle =
         fts_open(paths, FTS_PHYSICAL | FTS_NOSTAT | FTS_XDEV, NULL);
     save_errno = errno;
@@ -748,6 +1490,122 @@ posix_get_statx_sync_type(struct posix_backend *posix, void *data,
     return 0;
 }
 
+static int
+posix_get_skip_subtrees(struct posix_backend *posix, void *data,
+                        size_t *data_size)
+{
+    size_t size = posix->skip_count * sizeof(*posix->skip_subtrees);
+
+    if (*data_size < size) {
+        *data_size = size;
+        errno = EOVERFLOW;
+        return -1;
+    }
+    if (size > 0)
+        memcpy(data, posix->skip_subtrees, size);
+    *data_size = size;
+    return 0;
+}
+
+static int
+posix_get_excludes(struct posix_backend *posix, void *data, size_t *data_size)
+{
+    size_t size = posix->exclude_count * sizeof(char *);
+    const char **rules = data;
+
+    if (*data_size < size) {
+        *data_size = size;
+        errno = EOVERFLOW;
+        return -1;
+    }
+    for (size_t i = 0; i < posix->exclude_count; i++)
+        rules[i] = posix->excludes[i].rule;
+    *data_size = size;
+    return 0;
+}
+
+static int
+posix_get_xattr_rules(struct posix_backend *posix, void *data,
+                      size_t *data_size)
+{
+    size_t size = posix->xattr_rule_count * sizeof(char *);
+    const char **rules = data;
+
+    if (*data_size < size) {
+        *data_size = size;
+        errno = EOVERFLOW;
+        return -1;
+    }
+    for (size_t i = 0; i < posix->xattr_rule_count; i++)
+        rules[i] = posix->xattr_rules[i].rule;
+    *data_size = size;
+    return 0;
+}
+
+static int
+posix_get_max_depth(struct posix_backend *posix, void *data, size_t *data_size)
+{
+    int max_depth = posix->max_depth;
+
+    if (*data_size < sizeof(max_depth)) {
+        *data_size = sizeof(max_depth);
+        errno = EOVERFLOW;
+        return -1;
+    }
+    memcpy(data, &max_depth, sizeof(max_depth));
+    *data_size = sizeof(max_depth);
+    return 0;
+}
+
+static int
+posix_get_uint64(uint64_t value, void *data, size_t *data_size)
+{
+    if (*data_size < sizeof(value)) {
+        *data_size = sizeof(value);
+        errno = EOVERFLOW;
+        return -1;
+    }
+    memcpy(data, &value, sizeof(value));
+    *data_size = sizeof(value);
+    return 0;
+}
+
+static int
+posix_get_size(size_t value, void *data, size_t *data_size)
+{
+    if (*data_size < sizeof(value)) {
+        *data_size = sizeof(value);
+        errno = EOVERFLOW;
+        return -1;
+    }
+    memcpy(data, &value, sizeof(value));
+    *data_size = sizeof(value);
+    return 0;
+}
+
+static int
+posix_get_throttle(struct posix_backend *posix, void *data, size_t *data_size)
+{
+    struct posix_throttle *throttle = &posix->throttle;
+    struct rbh_throttle_state state;
+
+    if (*data_size < sizeof(state)) {
+        *data_size = sizeof(state);
+        errno = EOVERFLOW;
+        return -1;
+    }
+
+    pthread_mutex_lock(&throttle->lock);
+    state.rate = throttle->rate;
+    state.latency = throttle->latency;
+    state.backoffs = throttle->backoffs;
+    pthread_mutex_unlock(&throttle->lock);
+
+    memcpy(data, &state, sizeof(state));
+    *data_size = sizeof(state);
+    return 0;
+}
+
 int
 posix_backend_get_option(void *backend, unsigned int option, void *data,
                          size_t *data_size)
@@ -757,6 +1615,23 @@ posix_backend_get_option(void *backend, unsigned int option, void *data,
     switch (option) {
     case RBH_PBO_STATX_SYNC_TYPE:
         return posix_get_statx_sync_type(posix, data, data_size);
+    case RBH_GBO_SKIP_SUBTREES:
+        return posix_get_skip_subtrees(posix, data, data_size);
+    case RBH_GBO_EXCLUDE:
+        return posix_get_excludes(posix, data, data_size);
+    case RBH_GBO_MAX_DEPTH:
+        return posix_get_max_depth(posix, data, data_size);
+    case RBH_GBO_RATE_LIMIT:
+        return posix_get_uint64(posix->throttle.rate_limit, data, data_size);
+    case RBH_GBO_LATENCY_TARGET:
+        return posix_get_uint64(posix->throttle.latency_target, data,
+                                data_size);
+    case RBH_GBO_THROTTLE:
+        return posix_get_throttle(posix, data, data_size);
+    case RBH_GBO_HARDLINK_CACHE:
+        return posix_get_size(posix->hardlink_cache, data, data_size);
+    case RBH_GBO_XATTRS:
+        return posix_get_xattr_rules(posix, data, data_size);
     }
 
     errno = ENOPROTOOPT;
@@ -801,6 +1676,187 @@ posix_set_statx_sync_type(struct posix_backend *posix, const void *data,
     return -1;
 }
 
+static void
+free_skip_subtrees(char **paths, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        free(paths[i]);
+    free(paths);
+}
+
+static int
+posix_set_skip_subtrees(struct posix_backend *posix, const void *data,
+                        size_t data_size)
+{
+    const char * const *paths = data;
+    char **skip_subtrees = NULL;
+    size_t count;
+
+    if (data_size % sizeof(*paths) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    count = data_size / sizeof(*paths);
+
+    if (count > 0) {
+        skip_subtrees = reallocarray(NULL, count, sizeof(*skip_subtrees));
+        if (skip_subtrees == NULL)
+            return -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        skip_subtrees[i] = strdup(paths[i]);
+        if (skip_subtrees[i] == NULL) {
+            int save_errno = errno;
+
+            free_skip_subtrees(skip_subtrees, i);
+            errno = save_errno;
+            return -1;
+        }
+    }
+
+    /* posix_iter_next() looks entries up with bsearch() */
+    qsort(skip_subtrees, count, sizeof(*skip_subtrees), strcmp_ptr);
+
+    free_skip_subtrees(posix->skip_subtrees, posix->skip_count);
+    posix->skip_subtrees = skip_subtrees;
+    posix->skip_count = count;
+    return 0;
+}
+
+static int
+posix_set_excludes(struct posix_backend *posix, const void *data,
+                   size_t data_size)
+{
+    const char * const *rules = data;
+    struct posix_exclude *excludes = NULL;
+    size_t count;
+
+    if (data_size % sizeof(*rules) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    count = data_size / sizeof(*rules);
+
+    if (count > 0) {
+        excludes = reallocarray(NULL, count, sizeof(*excludes));
+        if (excludes == NULL)
+            return -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (exclude_init(&excludes[i], rules[i])) {
+            int save_errno = errno;
+
+            free_excludes(excludes, i);
+            errno = save_errno;
+            return -1;
+        }
+    }
+
+    free_excludes(posix->excludes, posix->exclude_count);
+    posix->excludes = excludes;
+    posix->exclude_count = count;
+    return 0;
+}
+
+static int
+posix_set_xattr_rules(struct posix_backend *posix, const void *data,
+                      size_t data_size)
+{
+    struct posix_xattr_rule *xattr_rules = NULL;
+    const char * const *rules = data;
+    size_t count;
+
+    if (data_size % sizeof(*rules) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    count = data_size / sizeof(*rules);
+
+    if (count > 0) {
+        xattr_rules = reallocarray(NULL, count, sizeof(*xattr_rules));
+        if (xattr_rules == NULL)
+            return -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (xattr_rule_init(&xattr_rules[i], rules[i])) {
+            int save_errno = errno;
+
+            free_xattr_rules(xattr_rules, i);
+            errno = save_errno;
+            return -1;
+        }
+    }
+
+    free_xattr_rules(posix->xattr_rules, posix->xattr_rule_count);
+    posix->xattr_rules = xattr_rules;
+    posix->xattr_rule_count = count;
+    return 0;
+}
+
+static int
+posix_set_max_depth(struct posix_backend *posix, const void *data,
+                    size_t data_size)
+{
+    int max_depth;
+
+    if (data_size != sizeof(max_depth)) {
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy(&max_depth, data, sizeof(max_depth));
+
+    posix->max_depth = max_depth < 0 ? -1 : max_depth;
+    return 0;
+}
+
+static int
+posix_set_throttle_option(struct posix_backend *posix, unsigned int option,
+                          const void *data, size_t data_size)
+{
+    struct posix_throttle *throttle = &posix->throttle;
+    uint64_t value;
+
+    if (data_size != sizeof(value)) {
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy(&value, data, sizeof(value));
+
+    pthread_mutex_lock(&throttle->lock);
+    if (option == RBH_GBO_RATE_LIMIT)
+        throttle->rate_limit = value;
+    else
+        throttle->latency_target = value;
+    throttle_reset(throttle);
+    pthread_mutex_unlock(&throttle->lock);
+    return 0;
+}
+
+static int
+posix_set_hardlink_cache(struct posix_backend *posix, const void *data,
+                         size_t data_size)
+{
+    size_t hardlink_cache;
+
+    if (data_size != sizeof(hardlink_cache)) {
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy(&hardlink_cache, data, sizeof(hardlink_cache));
+
+    /* Leave room for the hashmap to keep its load factor under 70% */
+    if (hardlink_cache > SIZE_MAX / 100) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    posix->hardlink_cache = hardlink_cache;
+    return 0;
+}
+
 int
 posix_backend_set_option(void *backend, unsigned int option, const void *data,
                          size_t data_size)
@@ -810,6 +1866,23 @@ posix_backend_set_option(void *backend, unsigned int option, const void *data,
     switch (option) {
     case RBH_PBO_STATX_SYNC_TYPE:
         return posix_set_statx_sync_type(posix, data, data_size);
+    case RBH_GBO_SKIP_SUBTREES:
+        return posix_set_skip_subtrees(posix, data, data_size);
+    case RBH_GBO_EXCLUDE:
+        return posix_set_excludes(posix, data, data_size);
+    case RBH_GBO_MAX_DEPTH:
+        return posix_set_max_depth(posix, data, data_size);
+    case RBH_GBO_RATE_LIMIT:
+    case RBH_GBO_LATENCY_TARGET:
+        return posix_set_throttle_option(posix, option, data, data_size);
+    case RBH_GBO_THROTTLE:
+        /* Read-only */
+        errno = EINVAL;
+        return -1;
+    case RBH_GBO_HARDLINK_CACHE:
+        return posix_set_hardlink_cache(posix, data, data_size);
+    case RBH_GBO_XATTRS:
+        return posix_set_xattr_rules(posix, data, data_size);
     }
 
     errno = ENOPROTOOPT;
@@ -888,6 +1961,22 @@ posix_backend_filter(void *backend, const struct rbh_filter *filter,
     if (posix_iter == NULL)
         return NULL;
     posix_iter->skip_error = options->skip_error;
+    posix_iter->get_statx = posix->get_statx;
+    posix_iter->skip_subtrees = posix->skip_subtrees;
+    posix_iter->skip_count = posix->skip_count;
+    posix_iter->excludes = posix->excludes;
+    posix_iter->exclude_count = posix->exclude_count;
+    posix_iter->max_depth = posix->max_depth;
+    posix_iter->throttle = posix->throttle.enabled ? &posix->throttle : NULL;
+    posix_iter->hardlink_cache = posix->hardlink_cache;
+    /* Rules may change while the iterator is alive, it keeps its own */
+    if (copy_xattr_rules(&posix_iter->xattr_rules, posix->xattr_rules,
+                         posix->xattr_rule_count))
+        goto out_destroy_iter;
+    posix_iter->xattr_rule_count = posix->xattr_rule_count;
+    if (posix_iter_project(posix_iter, &options->projection))
+        goto out_destroy_iter;
+
     fsentry = rbh_mut_iter_next(&posix_iter->iterator);
     if (fsentry == NULL)
         goto out_destroy_iter;
@@ -916,6 +2005,10 @@ posix_backend_destroy(void *backend)
 {
     struct posix_backend *posix = backend;
 
+    free_skip_subtrees(posix->skip_subtrees, posix->skip_count);
+    free_excludes(posix->excludes, posix->exclude_count);
+    free_xattr_rules(posix->xattr_rules, posix->xattr_rule_count);
+    pthread_mutex_destroy(&posix->throttle.lock);
     free(posix->root);
     free(posix);
 }
@@ -1014,11 +2107,11 @@ posix_branch_backend_destroy(void *backend)
 {
     struct posix_branch_backend *branch = backend;
 
+    free(branch->path);
     posix_backend_destroy(&branch->posix);
-    free(branch);
 }
 
-static struct rbh_mut_iterator *
+struct rbh_mut_iterator *
 posix_branch_backend_filter(void *backend, const struct rbh_filter *filter,
                             const struct rbh_filter_options *options)
 {
@@ -1042,15 +2135,22 @@ posix_branch_backend_filter(void *backend, const struct rbh_filter *filter,
         return NULL;
 
     if (branch->path) {
-        path = branch->path;
+        const char *entry = branch->path;
+
+        /* Avoid a double '/' when `root' is "/" */
+        if (strcmp(root, "/") == 0 && *entry == '/')
+            entry++;
+
+        if (asprintf(&path, "%s%s", root, entry) < 0)
+            path = NULL;
     } else {
         path = id2path(root, &branch->id);
+    }
+    if (path == NULL) {
         save_errno = errno;
-        if (path == NULL) {
-            free(root);
-            errno = save_errno;
-            return NULL;
-        }
+        free(root);
+        errno = save_errno;
+        return NULL;
     }
 
     assert(strncmp(root, path, strlen(root)) == 0);
@@ -1060,15 +2160,42 @@ posix_branch_backend_filter(void *backend, const struct rbh_filter *filter,
     free(path);
     free(root);
     errno = save_errno;
+    if (posix_iter == NULL)
+        return NULL;
+
+    posix_iter->skip_error = options->skip_error;
+    posix_iter->get_statx = branch->posix.get_statx;
+    posix_iter->skip_subtrees = branch->posix.skip_subtrees;
+    posix_iter->skip_count = branch->posix.skip_count;
+    posix_iter->excludes = branch->posix.excludes;
+    posix_iter->exclude_count = branch->posix.exclude_count;
+    posix_iter->max_depth = branch->posix.max_depth;
+    posix_iter->throttle =
+        branch->posix.throttle.enabled ? &branch->posix.throttle : NULL;
+    posix_iter->hardlink_cache = branch->posix.hardlink_cache;
+    if (copy_xattr_rules(&posix_iter->xattr_rules, branch->posix.xattr_rules,
+                         branch->posix.xattr_rule_count))
+        goto out_destroy_iter;
+    posix_iter->xattr_rule_count = branch->posix.xattr_rule_count;
+    if (posix_iter_project(posix_iter, &options->projection))
+        goto out_destroy_iter;
 
     return (struct rbh_mut_iterator *)posix_iter;
+
+out_destroy_iter:
+    save_errno = errno;
+    rbh_mut_iter_destroy(&posix_iter->iterator);
+    errno = save_errno;
+    return NULL;
 }
 
 static const struct rbh_backend_operations POSIX_BRANCH_BACKEND_OPS = {
+    .get_option = posix_backend_get_option,
+    .set_option = posix_backend_set_option,
     .root = posix_root,
     .branch = posix_backend_branch,
     .filter = posix_branch_backend_filter,
-    .destroy = posix_backend_destroy,
+    .destroy = posix_branch_backend_destroy,
 };
 
 static const struct rbh_backend POSIX_BRANCH_BACKEND = {
@@ -1112,15 +2239,23 @@ posix_backend_branch(void *backend, const struct rbh_id *id, const char *path)
     }
 
     if (path) {
-        branch->path = strdup(path);
-        if (branch->path == NULL) {
-            int save_errno = errno;
+        size_t length;
 
-            free(branch);
+        /* `path' is relative to the root of `backend' */
+        while (*path == '/')
+            path++;
+
+        if (asprintf(&branch->path, "/%s", path) < 0) {
             free(branch->posix.root);
-            errno = save_errno;
+            free(branch);
+            errno = ENOMEM;
             return NULL;
         }
+
+        /* "/" is the root of `backend' itself */
+        length = strlen(branch->path);
+        while (length > 0 && branch->path[length - 1] == '/')
+            branch->path[--length] = '\0';
     } else {
         branch->path = NULL;
     }
@@ -1130,8 +2265,28 @@ posix_backend_branch(void *backend, const struct rbh_id *id, const char *path)
     else
         branch->id.size = 0;
 
-    branch->posix.iter_new = posix_iterator_new;
+    branch->posix.iter_new = posix->iter_new;
     branch->posix.statx_sync_type = posix->statx_sync_type;
+    branch->posix.get_statx = posix->get_statx;
+    branch->posix.skip_subtrees = NULL;
+    branch->posix.skip_count = 0;
+    branch->posix.excludes = NULL;
+    branch->posix.exclude_count = 0;
+    branch->posix.max_depth = -1;
+    branch->posix.hardlink_cache = posix->hardlink_cache;
+    if (copy_xattr_rules(&branch->posix.xattr_rules, posix->xattr_rules,
+                         posix->xattr_rule_count)) {
+        int save_errno = errno;
+
+        free(branch->path);
+        free(branch->posix.root);
+        free(branch);
+        errno = save_errno;
+        return NULL;
+    }
+    branch->posix.xattr_rule_count = posix->xattr_rule_count;
+    throttle_init(&branch->posix.throttle, posix->throttle.rate_limit,
+                  posix->throttle.latency_target);
     branch->posix.backend = POSIX_BRANCH_BACKEND;
 
     return &branch->posix.backend;
@@ -1186,6 +2341,16 @@ rbh_posix_backend_new(const char *path)
 
     posix->iter_new = posix_iterator_new;
     posix->statx_sync_type = AT_RBH_STATX_SYNC_AS_STAT;
+    posix->get_statx = rbh_statx;
+    posix->skip_subtrees = NULL;
+    posix->skip_count = 0;
+    posix->excludes = NULL;
+    posix->exclude_count = 0;
+    posix->max_depth = -1;
+    throttle_init(&posix->throttle, 0, 0);
+    posix->hardlink_cache = 0;
+    posix->xattr_rules = NULL;
+    posix->xattr_rule_count = 0;
     posix->backend = POSIX_BACKEND;
 
     return &posix->backend;
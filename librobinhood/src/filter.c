@@ -11,9 +11,12 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <regex.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <sys/stat.h>
+
 #include "robinhood/filter.h"
 #include "robinhood/statx.h"
 
@@ -569,3 +572,578 @@ rbh_filter_validate(const struct rbh_filter *filter)
     errno = EINVAL;
     return -1;
 }
+
+/*----------------------------------------------------------------------------*
+ |                            rbh_filter_matches()                            |
+ *----------------------------------------------------------------------------*/
+
+/* The following helpers implement the semantics of filters as the mongo
+ * backend does, so that backends which cannot delegate filtering to a database
+ * (or that cache part of one) return the same fsentries.
+ */
+
+static bool
+statx_field_value(const struct rbh_statx *statx, uint32_t field,
+                  struct rbh_value *value)
+{
+    if (statx == NULL || !(statx->stx_mask & field))
+        return false;
+
+    value->type = RBH_VT_UINT64;
+    switch (field) {
+    case RBH_STATX_TYPE:
+        value->type = RBH_VT_INT32;
+        value->int32 = statx->stx_mode & S_IFMT;
+        break;
+    case RBH_STATX_MODE:
+        value->type = RBH_VT_INT32;
+        value->int32 = statx->stx_mode & ~S_IFMT;
+        break;
+    case RBH_STATX_NLINK:
+        value->uint64 = statx->stx_nlink;
+        break;
+    case RBH_STATX_UID:
+        value->uint64 = statx->stx_uid;
+        break;
+    case RBH_STATX_GID:
+        value->uint64 = statx->stx_gid;
+        break;
+    case RBH_STATX_ATIME_SEC:
+        value->type = RBH_VT_INT64;
+        value->int64 = statx->stx_atime.tv_sec;
+        break;
+    case RBH_STATX_MTIME_SEC:
+        value->type = RBH_VT_INT64;
+        value->int64 = statx->stx_mtime.tv_sec;
+        break;
+    case RBH_STATX_CTIME_SEC:
+        value->type = RBH_VT_INT64;
+        value->int64 = statx->stx_ctime.tv_sec;
+        break;
+    case RBH_STATX_BTIME_SEC:
+        value->type = RBH_VT_INT64;
+        value->int64 = statx->stx_btime.tv_sec;
+        break;
+    case RBH_STATX_ATIME_NSEC:
+        value->uint64 = statx->stx_atime.tv_nsec;
+        break;
+    case RBH_STATX_MTIME_NSEC:
+        value->uint64 = statx->stx_mtime.tv_nsec;
+        break;
+    case RBH_STATX_CTIME_NSEC:
+        value->uint64 = statx->stx_ctime.tv_nsec;
+        break;
+    case RBH_STATX_BTIME_NSEC:
+        value->uint64 = statx->stx_btime.tv_nsec;
+        break;
+    case RBH_STATX_INO:
+        value->uint64 = statx->stx_ino;
+        break;
+    case RBH_STATX_SIZE:
+        value->uint64 = statx->stx_size;
+        break;
+    case RBH_STATX_BLOCKS:
+        value->uint64 = statx->stx_blocks;
+        break;
+    case RBH_STATX_MNT_ID:
+        value->uint64 = statx->stx_mnt_id;
+        break;
+    case RBH_STATX_BLKSIZE:
+        value->uint64 = statx->stx_blksize;
+        break;
+    case RBH_STATX_ATTRIBUTES:
+        value->uint64 = statx->stx_attributes;
+        break;
+    case RBH_STATX_RDEV_MAJOR:
+        value->uint64 = statx->stx_rdev_major;
+        break;
+    case RBH_STATX_RDEV_MINOR:
+        value->uint64 = statx->stx_rdev_minor;
+        break;
+    case RBH_STATX_DEV_MAJOR:
+        value->uint64 = statx->stx_dev_major;
+        break;
+    case RBH_STATX_DEV_MINOR:
+        value->uint64 = statx->stx_dev_minor;
+        break;
+    default:
+        return false;
+    }
+
+    return true;
+}
+
+static const struct rbh_value *
+value_map_lookup(const struct rbh_value_map *map, const char *key,
+                 size_t length)
+{
+    for (size_t i = 0; i < map->count; i++) {
+        const struct rbh_value_pair *pair = &map->pairs[i];
+
+        if (strncmp(pair->key, key, length) == 0 && pair->key[length] == '\0')
+            return pair->value;
+    }
+
+    return NULL;
+}
+
+/* Xattrs are looked up by their full key first, then as a dotted path through
+ * nested maps ("a.b" designates key "b" in the map stored under key "a").
+ */
+static const struct rbh_value *
+xattrs_field_value(const struct rbh_value_map *xattrs, const char *key)
+{
+    const struct rbh_value *value;
+    const char *dot;
+
+    value = value_map_lookup(xattrs, key, strlen(key));
+    if (value != NULL)
+        return value;
+
+    dot = strchr(key, '.');
+    if (dot == NULL)
+        return NULL;
+
+    value = value_map_lookup(xattrs, key, dot - key);
+    if (value == NULL || value->type != RBH_VT_MAP || value->map.pairs == NULL)
+        return NULL;
+
+    return xattrs_field_value(&value->map, dot + 1);
+}
+
+/* Returns a pointer to the value of \p field in \p fsentry (\p buffer may be
+ * used to store it), or NULL if \p fsentry does not have this field.
+ */
+static const struct rbh_value *
+fsentry_field_value(const struct rbh_fsentry *fsentry,
+                    const struct rbh_filter_field *field,
+                    struct rbh_value *buffer)
+{
+    const struct rbh_value_map *xattrs;
+
+    switch (field->fsentry) {
+    case RBH_FP_ID:
+    case RBH_FP_PARENT_ID:
+        if (!(fsentry->mask & field->fsentry))
+            return NULL;
+
+        buffer->type = RBH_VT_BINARY;
+        if (field->fsentry == RBH_FP_ID) {
+            buffer->binary.data = fsentry->id.data;
+            buffer->binary.size = fsentry->id.size;
+        } else {
+            buffer->binary.data = fsentry->parent_id.data;
+            buffer->binary.size = fsentry->parent_id.size;
+        }
+        return buffer;
+    case RBH_FP_NAME:
+        if (!(fsentry->mask & RBH_FP_NAME))
+            return NULL;
+
+        buffer->type = RBH_VT_STRING;
+        buffer->string = fsentry->name;
+        return buffer;
+    case RBH_FP_SYMLINK:
+        if (!(fsentry->mask & RBH_FP_SYMLINK))
+            return NULL;
+
+        buffer->type = RBH_VT_STRING;
+        buffer->string = fsentry->symlink;
+        return buffer;
+    case RBH_FP_STATX:
+        if (!(fsentry->mask & RBH_FP_STATX))
+            return NULL;
+        return statx_field_value(fsentry->statx, field->statx, buffer) ?
+            buffer : NULL;
+    case RBH_FP_NAMESPACE_XATTRS:
+    case RBH_FP_INODE_XATTRS:
+        if (!(fsentry->mask & field->fsentry))
+            return NULL;
+
+        xattrs = field->fsentry == RBH_FP_NAMESPACE_XATTRS ?
+            &fsentry->xattrs.ns : &fsentry->xattrs.inode;
+        if (field->xattr != NULL)
+            return xattrs_field_value(xattrs, field->xattr);
+
+        buffer->type = RBH_VT_MAP;
+        buffer->map = *xattrs;
+        return buffer;
+    }
+
+    return NULL;
+}
+
+/* Values of different types are ordered by "bracket", like in MongoDB, and
+ * comparisons only ever match values of the same bracket.
+ */
+static int
+value_bracket(const struct rbh_value *value)
+{
+    if (value == NULL)
+        return 0;
+
+    switch (value->type) {
+    case RBH_VT_INT32:
+    case RBH_VT_UINT32:
+    case RBH_VT_INT64:
+    case RBH_VT_UINT64:
+        return 1;
+    case RBH_VT_STRING:
+        return 2;
+    case RBH_VT_MAP:
+        return 3;
+    case RBH_VT_SEQUENCE:
+        return 4;
+    case RBH_VT_BINARY:
+        return 5;
+    case RBH_VT_BOOLEAN:
+        return 6;
+    case RBH_VT_REGEX:
+        return 7;
+    }
+
+    return 8;
+}
+
+struct integer {
+    bool negative;
+    union {
+        int64_t s;
+        uint64_t u;
+    };
+};
+
+static struct integer
+value2integer(const struct rbh_value *value)
+{
+    switch (value->type) {
+    case RBH_VT_INT32:
+        return (struct integer){ .negative = value->int32 < 0,
+                                 .s = value->int32 };
+    case RBH_VT_INT64:
+        return (struct integer){ .negative = value->int64 < 0,
+                                 .s = value->int64 };
+    case RBH_VT_UINT32:
+        return (struct integer){ .negative = false, .u = value->uint32 };
+    case RBH_VT_UINT64:
+        return (struct integer){ .negative = false, .u = value->uint64 };
+    default:
+        assert(false);
+        __builtin_unreachable();
+    }
+}
+
+static int
+integer_compare(const struct rbh_value *first, const struct rbh_value *second)
+{
+    struct integer x = value2integer(first);
+    struct integer y = value2integer(second);
+
+    if (x.negative != y.negative)
+        return x.negative ? -1 : 1;
+
+    if (x.negative)
+        return (x.s > y.s) - (x.s < y.s);
+    return (x.u > y.u) - (x.u < y.u);
+}
+
+static int
+value_compare(const struct rbh_value *first, const struct rbh_value *second);
+
+static int
+map_compare(const struct rbh_value_map *first,
+            const struct rbh_value_map *second)
+{
+    for (size_t i = 0; i < first->count && i < second->count; i++) {
+        int rc;
+
+        rc = strcmp(first->pairs[i].key, second->pairs[i].key);
+        if (rc)
+            return rc;
+
+        rc = value_compare(first->pairs[i].value, second->pairs[i].value);
+        if (rc)
+            return rc;
+    }
+
+    return (first->count > second->count) - (first->count < second->count);
+}
+
+/* Total order over values (NULL, ie. a missing value, sorts first) */
+static int
+value_compare(const struct rbh_value *first, const struct rbh_value *second)
+{
+    int x = value_bracket(first);
+    int y = value_bracket(second);
+    size_t size;
+    int rc;
+
+    if (x != y)
+        return x < y ? -1 : 1;
+
+    if (first == NULL)
+        return 0;
+
+    switch (first->type) {
+    case RBH_VT_INT32:
+    case RBH_VT_UINT32:
+    case RBH_VT_INT64:
+    case RBH_VT_UINT64:
+        return integer_compare(first, second);
+    case RBH_VT_STRING:
+        return strcmp(first->string, second->string);
+    case RBH_VT_MAP:
+        return map_compare(&first->map, &second->map);
+    case RBH_VT_SEQUENCE:
+        for (size_t i = 0; i < first->sequence.count; i++) {
+            if (i >= second->sequence.count)
+                return 1;
+
+            rc = value_compare(&first->sequence.values[i],
+                               &second->sequence.values[i]);
+            if (rc)
+                return rc;
+        }
+        return first->sequence.count < second->sequence.count ? -1 : 0;
+    case RBH_VT_BINARY:
+        if (first->binary.size != second->binary.size)
+            return first->binary.size < second->binary.size ? -1 : 1;
+
+        size = first->binary.size;
+        return size ? memcmp(first->binary.data, second->binary.data, size)
+                    : 0;
+    case RBH_VT_BOOLEAN:
+        return first->boolean - second->boolean;
+    case RBH_VT_REGEX:
+        rc = strcmp(first->regex.string, second->regex.string);
+        if (rc)
+            return rc;
+        return (first->regex.options > second->regex.options)
+             - (first->regex.options < second->regex.options);
+    }
+
+    return 0;
+}
+
+static bool
+value_is_integer(const struct rbh_value *value)
+{
+    return value_bracket(value) == 1;
+}
+
+/* POSIX extended regular expressions stand in for PCREs: the only construct
+ * rbh-find generates that they do not support is the "(?!\n)" before the final
+ * anchor (which prevents '$' from matching before a trailing newline).
+ */
+static char *
+pcre2ere(const char *pcre)
+{
+    static const char SUFFIX[] = "(?!\n)$";
+    size_t length = strlen(pcre);
+    char *ere;
+
+    ere = strdup(pcre);
+    if (ere == NULL)
+        return NULL;
+
+    if (length >= sizeof(SUFFIX) - 1
+     && strcmp(ere + length - (sizeof(SUFFIX) - 1), SUFFIX) == 0)
+        strcpy(ere + length - (sizeof(SUFFIX) - 1), "$");
+
+    return ere;
+}
+
+/* Compiled regexes are cached (one per thread), filters are usually evaluated
+ * many times in a row
+ */
+static __thread struct {
+    char *pattern;
+    unsigned int options;
+    regex_t regex;
+} regex_cache;
+
+static const regex_t *
+regex_compile(const struct rbh_value *value)
+{
+    int cflags = REG_EXTENDED | REG_NOSUB;
+    char *pattern;
+    char *ere;
+
+    if (regex_cache.pattern != NULL
+     && regex_cache.options == value->regex.options
+     && strcmp(regex_cache.pattern, value->regex.string) == 0)
+        return &regex_cache.regex;
+
+    pattern = strdup(value->regex.string);
+    if (pattern == NULL)
+        return NULL;
+
+    ere = pcre2ere(value->regex.string);
+    if (ere == NULL) {
+        free(pattern);
+        return NULL;
+    }
+
+    if (regex_cache.pattern != NULL) {
+        regfree(&regex_cache.regex);
+        free(regex_cache.pattern);
+        regex_cache.pattern = NULL;
+    }
+
+    if (value->regex.options & RBH_RO_CASE_INSENSITIVE)
+        cflags |= REG_ICASE;
+
+    if (regcomp(&regex_cache.regex, ere, cflags)) {
+        free(ere);
+        free(pattern);
+        errno = EINVAL;
+        return NULL;
+    }
+    free(ere);
+
+    regex_cache.pattern = pattern;
+    regex_cache.options = value->regex.options;
+    return &regex_cache.regex;
+}
+
+static bool
+bits_match(enum rbh_filter_operator op, uint64_t bits, uint64_t mask)
+{
+    switch (op) {
+    case RBH_FOP_BITS_ANY_SET:
+        return bits & mask;
+    case RBH_FOP_BITS_ALL_SET:
+        return (bits & mask) == mask;
+    case RBH_FOP_BITS_ANY_CLEAR:
+        return (bits & mask) != mask;
+    case RBH_FOP_BITS_ALL_CLEAR:
+        return !(bits & mask);
+    default:
+        return false;
+    }
+}
+
+static uint64_t
+value2bits(const struct rbh_value *value)
+{
+    struct integer integer = value2integer(value);
+
+    return integer.u;
+}
+
+/* Match a single (non-sequence, or whole sequence) value against a comparison */
+static bool
+value_matches(enum rbh_filter_operator op, const struct rbh_value *field,
+              const struct rbh_value *value)
+{
+    const regex_t *regex;
+
+    switch (op) {
+    case RBH_FOP_EQUAL:
+        return value_compare(field, value) == 0;
+    case RBH_FOP_STRICTLY_LOWER:
+        return value_bracket(field) == value_bracket(value)
+            && value_compare(field, value) < 0;
+    case RBH_FOP_LOWER_OR_EQUAL:
+        return value_bracket(field) == value_bracket(value)
+            && value_compare(field, value) <= 0;
+    case RBH_FOP_STRICTLY_GREATER:
+        return value_bracket(field) == value_bracket(value)
+            && value_compare(field, value) > 0;
+    case RBH_FOP_GREATER_OR_EQUAL:
+        return value_bracket(field) == value_bracket(value)
+            && value_compare(field, value) >= 0;
+    case RBH_FOP_IN:
+        for (size_t i = 0; i < value->sequence.count; i++) {
+            if (value_compare(field, &value->sequence.values[i]) == 0)
+                return true;
+        }
+        return false;
+    case RBH_FOP_REGEX:
+        if (field->type != RBH_VT_STRING)
+            return false;
+
+        regex = regex_compile(value);
+        if (regex == NULL)
+            return false;
+        return regexec(regex, field->string, 0, NULL, 0) == 0;
+    case RBH_FOP_BITS_ANY_SET:
+    case RBH_FOP_BITS_ALL_SET:
+    case RBH_FOP_BITS_ANY_CLEAR:
+    case RBH_FOP_BITS_ALL_CLEAR:
+        if (!value_is_integer(field))
+            return false;
+        return bits_match(op, value2bits(field), value2bits(value));
+    default:
+        return false;
+    }
+}
+
+static bool
+comparison_filter_matches(const struct rbh_filter *filter,
+                          const struct rbh_fsentry *fsentry)
+{
+    const struct rbh_value *value;
+    struct rbh_value buffer;
+
+    value = fsentry_field_value(fsentry, &filter->compare.field, &buffer);
+    if (filter->op == RBH_FOP_EXISTS)
+        return (value != NULL) == filter->compare.value.boolean;
+
+    if (value == NULL)
+        return false;
+
+    if (value_matches(filter->op, value, &filter->compare.value))
+        return true;
+
+    /* Like in MongoDB, a sequence matches if any of its elements does */
+    if (value->type != RBH_VT_SEQUENCE)
+        return false;
+
+    for (size_t i = 0; i < value->sequence.count; i++) {
+        if (value_matches(filter->op, &value->sequence.values[i],
+                          &filter->compare.value))
+            return true;
+    }
+    return false;
+}
+
+bool
+rbh_filter_matches(const struct rbh_filter *filter,
+                   const struct rbh_fsentry *fsentry)
+{
+    if (filter == NULL)
+        return true;
+
+    switch (filter->op) {
+    case RBH_FOP_COMPARISON_MIN ... RBH_FOP_COMPARISON_MAX:
+        return comparison_filter_matches(filter, fsentry);
+    case RBH_FOP_AND:
+        for (size_t i = 0; i < filter->logical.count; i++) {
+            if (!rbh_filter_matches(filter->logical.filters[i], fsentry))
+                return false;
+        }
+        return true;
+    case RBH_FOP_OR:
+        for (size_t i = 0; i < filter->logical.count; i++) {
+            if (rbh_filter_matches(filter->logical.filters[i], fsentry))
+                return true;
+        }
+        return false;
+    case RBH_FOP_NOT:
+        return !rbh_filter_matches(filter->logical.filters[0], fsentry);
+    }
+
+    return false;
+}
+
+int
+rbh_filter_field_compare(const struct rbh_filter_field *field,
+                         const struct rbh_fsentry *first,
+                         const struct rbh_fsentry *second)
+{
+    struct rbh_value x, y;
+
+    return value_compare(fsentry_field_value(first, field, &x),
+                         fsentry_field_value(second, field, &y));
+}
@@ -0,0 +1,626 @@
+/* This file is part of RobinHood 4
+ * Copyright (C) 2024 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: LGPL-3.0-or-later
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "robinhood/stats.h"
+
+/*----------------------------------------------------------------------------*
+ |                                 histogram                                  |
+ *----------------------------------------------------------------------------*/
+
+/* Values are counted in power of 2 buckets: bucket 0 counts zeroes, bucket i
+ * counts values in [2^(i-1), 2^i).
+ */
+#define HISTOGRAM_BUCKETS 65
+
+struct histogram {
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+};
+
+static void
+histogram_add(struct histogram *histogram, uint64_t value)
+{
+    histogram->buckets[value ? 64 - __builtin_clzll(value) : 0]++;
+    histogram->count++;
+    histogram->sum += value;
+    if (value > histogram->max)
+        histogram->max = value;
+}
+
+/* An upper bound of the \p quantile-th quantile of \p histogram */
+static uint64_t
+histogram_quantile(const struct histogram *histogram, double quantile)
+{
+    uint64_t rank = histogram->count * quantile;
+    uint64_t seen = 0;
+
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        uint64_t bound = i == 0 ? 0 : UINT64_MAX >> (64 - i);
+
+        seen += histogram->buckets[i];
+        if (seen > rank)
+            return bound < histogram->max ? bound : histogram->max;
+    }
+
+    return histogram->max;
+}
+
+/*----------------------------------------------------------------------------*
+ |                                   stats                                    |
+ *----------------------------------------------------------------------------*/
+
+enum stats_operation {
+    SO_FILTER,
+    SO_NEXT,
+    SO_UPDATE,
+    SO_ROOT,
+    SO_BRANCH,
+    SO_GET_ATTRIBUTE,
+    SO_COUNT,
+};
+
+static const char *STATS_OPERATIONS[] = {
+    [SO_FILTER]         = "filter",
+    [SO_NEXT]           = "next",
+    [SO_UPDATE]         = "update",
+    [SO_ROOT]           = "root",
+    [SO_BRANCH]         = "branch",
+    [SO_GET_ATTRIBUTE]  = "get_attribute",
+};
+
+/* The counters of a backend, shared with its branches and iterators */
+struct stats {
+    pthread_mutex_t lock;
+    char *name;
+    /* The number of backends and iterators that reference these counters */
+    size_t references;
+    /* The last report request these counters were reported for */
+    sig_atomic_t request;
+
+    struct {
+        uint64_t errors;
+        /* In nanoseconds */
+        struct histogram latency;
+    } operations[SO_COUNT];
+    /* The number of fsevents each call to update applied */
+    struct histogram fsevents;
+};
+
+/* Incremented on every SIGUSR1 */
+static volatile sig_atomic_t report_request;
+
+static void
+on_sigusr1(int signum)
+{
+    (void)signum;
+    report_request++;
+}
+
+static void
+handle_sigusr1(void)
+{
+    struct sigaction action = {
+        .sa_handler = on_sigusr1,
+        .sa_flags = SA_RESTART,
+    };
+    struct sigaction previous;
+
+    /* Do not get in the way of applications that use SIGUSR1 */
+    if (sigaction(SIGUSR1, NULL, &previous) || previous.sa_handler != SIG_DFL)
+        return;
+
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR1, &action, NULL);
+}
+
+static struct stats *
+stats_new(const char *name)
+{
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    struct stats *stats;
+
+    stats = calloc(1, sizeof(*stats));
+    if (stats == NULL)
+        return NULL;
+
+    stats->name = strdup(name);
+    if (stats->name == NULL) {
+        free(stats);
+        return NULL;
+    }
+
+    pthread_once(&once, handle_sigusr1);
+    pthread_mutex_init(&stats->lock, NULL);
+    stats->references = 1;
+    stats->request = report_request;
+    return stats;
+}
+
+static void
+stats_report(struct stats *stats, FILE *file)
+{
+    fprintf(file, "%s:\n", stats->name);
+    fprintf(file, "  %-14s %10s %8s %10s %10s %10s %10s %10s\n", "operation",
+            "calls", "errors", "total(s)", "mean(us)", "p50(us)", "p99(us)",
+            "max(us)");
+
+    for (size_t i = 0; i < SO_COUNT; i++) {
+        const struct histogram *latency = &stats->operations[i].latency;
+
+        if (latency->count == 0)
+            continue;
+
+        fprintf(file, "  %-14s %10lu %8lu %10.3f %10.1f %10.1f %10.1f %10.1f\n",
+                STATS_OPERATIONS[i], latency->count,
+                stats->operations[i].errors, latency->sum / 1e9,
+                latency->sum / 1e3 / latency->count,
+                histogram_quantile(latency, 0.5) / 1e3,
+                histogram_quantile(latency, 0.99) / 1e3, latency->max / 1e3);
+    }
+
+    if (stats->fsevents.count == 0)
+        return;
+
+    fprintf(file, "  %lu fsevents, per update: mean %.1f, p50 %lu, p99 %lu, "
+            "max %lu\n", stats->fsevents.sum,
+            (double)stats->fsevents.sum / stats->fsevents.count,
+            histogram_quantile(&stats->fsevents, 0.5),
+            histogram_quantile(&stats->fsevents, 0.99), stats->fsevents.max);
+}
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * UINT64_C(1000000000) + now.tv_nsec;
+}
+
+/* Record a call to \p operation that started at \p start */
+static void
+stats_record(struct stats *stats, enum stats_operation operation,
+             uint64_t start, bool failed)
+{
+    uint64_t latency = now_ns() - start;
+    int save_errno = errno;
+
+    pthread_mutex_lock(&stats->lock);
+    histogram_add(&stats->operations[operation].latency, latency);
+    if (failed)
+        stats->operations[operation].errors++;
+
+    if (stats->request != report_request) {
+        stats->request = report_request;
+        stats_report(stats, stderr);
+    }
+    pthread_mutex_unlock(&stats->lock);
+
+    errno = save_errno;
+}
+
+static struct stats *
+stats_ref(struct stats *stats)
+{
+    pthread_mutex_lock(&stats->lock);
+    stats->references++;
+    pthread_mutex_unlock(&stats->lock);
+    return stats;
+}
+
+static void
+stats_unref(struct stats *stats)
+{
+    size_t references;
+
+    pthread_mutex_lock(&stats->lock);
+    references = --stats->references;
+    pthread_mutex_unlock(&stats->lock);
+
+    if (references > 0)
+        return;
+
+    stats_report(stats, stderr);
+    pthread_mutex_destroy(&stats->lock);
+    free(stats->name);
+    free(stats);
+}
+
+/*----------------------------------------------------------------------------*
+ |                               stats_iterator                               |
+ *----------------------------------------------------------------------------*/
+
+struct stats_iterator {
+    struct rbh_mut_iterator iterator;
+    struct rbh_mut_iterator *fsentries;
+    struct stats *stats;
+};
+
+static void *
+stats_iter_next(void *iterator)
+{
+    struct stats_iterator *stats_iter = iterator;
+    uint64_t start = now_ns();
+    void *fsentry;
+
+    fsentry = rbh_mut_iter_next(stats_iter->fsentries);
+    stats_record(stats_iter->stats, SO_NEXT, start,
+                 fsentry == NULL && errno != ENODATA && errno != EAGAIN);
+    return fsentry;
+}
+
+static void
+stats_iter_destroy(void *iterator)
+{
+    struct stats_iterator *stats_iter = iterator;
+
+    rbh_mut_iter_destroy(stats_iter->fsentries);
+    stats_unref(stats_iter->stats);
+    free(stats_iter);
+}
+
+static const struct rbh_mut_iterator_operations STATS_ITER_OPS = {
+    .next = stats_iter_next,
+    .destroy = stats_iter_destroy,
+};
+
+static const struct rbh_mut_iterator STATS_ITER = {
+    .ops = &STATS_ITER_OPS,
+};
+
+/*----------------------------------------------------------------------------*
+ |                               stats_backend                                |
+ *----------------------------------------------------------------------------*/
+
+struct stats_backend {
+    struct rbh_backend backend;
+    struct rbh_backend *instrumented;
+    struct stats *stats;
+};
+
+static struct rbh_backend *
+stats_backend_from_stats(struct rbh_backend *instrumented, struct stats *stats);
+
+    /*--------------------------------------------------------------------*
+     |                          get_option()                              |
+     *--------------------------------------------------------------------*/
+
+static int
+stats_backend_get_option(void *backend, unsigned int option, void *data,
+                         size_t *data_size)
+{
+    struct stats_backend *stats = backend;
+
+    if (stats->instrumented->ops->get_option == NULL) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    return stats->instrumented->ops->get_option(stats->instrumented, option,
+                                                data, data_size);
+}
+
+    /*--------------------------------------------------------------------*
+     |                          set_option()                              |
+     *--------------------------------------------------------------------*/
+
+static int
+stats_backend_set_option(void *backend, unsigned int option, const void *data,
+                         size_t data_size)
+{
+    struct stats_backend *stats = backend;
+
+    if (stats->instrumented->ops->set_option == NULL) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    return stats->instrumented->ops->set_option(stats->instrumented, option,
+                                                data, data_size);
+}
+
+    /*--------------------------------------------------------------------*
+     |                            update()                                |
+     *--------------------------------------------------------------------*/
+
+static ssize_t
+stats_backend_update(void *backend, struct rbh_iterator *fsevents,
+                     bool skip_error)
+{
+    struct stats_backend *stats = backend;
+    uint64_t start = now_ns();
+    ssize_t rc;
+
+    rc = rbh_backend_update(stats->instrumented, fsevents, skip_error);
+    if (rc >= 0) {
+        pthread_mutex_lock(&stats->stats->lock);
+        histogram_add(&stats->stats->fsevents, rc);
+        pthread_mutex_unlock(&stats->stats->lock);
+    }
+    stats_record(stats->stats, SO_UPDATE, start, rc < 0);
+
+    return rc;
+}
+
+    /*--------------------------------------------------------------------*
+     |                            branch()                                |
+     *--------------------------------------------------------------------*/
+
+static struct rbh_backend *
+stats_backend_branch(void *backend, const struct rbh_id *id, const char *path)
+{
+    struct stats_backend *stats = backend;
+    struct rbh_backend *instrumented;
+    struct rbh_backend *branch;
+    uint64_t start = now_ns();
+
+    instrumented = rbh_backend_branch(stats->instrumented, id, path);
+    stats_record(stats->stats, SO_BRANCH, start, instrumented == NULL);
+    if (instrumented == NULL)
+        return NULL;
+
+    branch = stats_backend_from_stats(instrumented, stats_ref(stats->stats));
+    if (branch == NULL) {
+        int save_errno = errno;
+
+        stats_unref(stats->stats);
+        rbh_backend_destroy(instrumented);
+        errno = save_errno;
+    }
+
+    return branch;
+}
+
+    /*--------------------------------------------------------------------*
+     |                             root()                                 |
+     *--------------------------------------------------------------------*/
+
+static struct rbh_fsentry *
+stats_backend_root(void *backend,
+                   const struct rbh_filter_projection *projection)
+{
+    struct stats_backend *stats = backend;
+    uint64_t start = now_ns();
+    struct rbh_fsentry *root;
+
+    root = rbh_backend_root(stats->instrumented, projection);
+    stats_record(stats->stats, SO_ROOT, start, root == NULL);
+    return root;
+}
+
+    /*--------------------------------------------------------------------*
+     |                            filter()                                |
+     *--------------------------------------------------------------------*/
+
+static struct rbh_mut_iterator *
+stats_backend_filter(void *backend, const struct rbh_filter *filter,
+                     const struct rbh_filter_options *options)
+{
+    struct stats_backend *stats = backend;
+    struct stats_iterator *stats_iter;
+    struct rbh_mut_iterator *fsentries;
+    uint64_t start = now_ns();
+
+    fsentries = rbh_backend_filter(stats->instrumented, filter, options);
+    stats_record(stats->stats, SO_FILTER, start, fsentries == NULL);
+    if (fsentries == NULL)
+        return NULL;
+
+    stats_iter = malloc(sizeof(*stats_iter));
+    if (stats_iter == NULL) {
+        int save_errno = errno;
+
+        rbh_mut_iter_destroy(fsentries);
+        errno = save_errno;
+        return NULL;
+    }
+
+    stats_iter->iterator = STATS_ITER;
+    stats_iter->fsentries = fsentries;
+    stats_iter->stats = stats_ref(stats->stats);
+    return &stats_iter->iterator;
+}
+
+    /*--------------------------------------------------------------------*
+     |                            export()                                |
+     *--------------------------------------------------------------------*/
+
+static struct rbh_iterator *
+stats_backend_export(void *backend, const struct rbh_filter *filter,
+                     const struct rbh_filter_options *options,
+                     enum rbh_document_format format)
+{
+    struct stats_backend *stats = backend;
+
+    return rbh_backend_export(stats->instrumented, filter, options, format);
+}
+
+    /*--------------------------------------------------------------------*
+     |                            explain()                               |
+     *--------------------------------------------------------------------*/
+
+static char *
+stats_backend_explain(void *backend, const struct rbh_filter *filter,
+                      const struct rbh_filter_options *options)
+{
+    struct stats_backend *stats = backend;
+
+    return rbh_backend_explain(stats->instrumented, filter, options);
+}
+
+    /*--------------------------------------------------------------------*
+     |                         get_attribute()                            |
+     *--------------------------------------------------------------------*/
+
+static int
+stats_backend_get_attribute(void *backend, const char *attr_name, void *arg,
+                            struct rbh_value_pair *data)
+{
+    struct stats_backend *stats = backend;
+    uint64_t start = now_ns();
+    int rc;
+
+    rc = rbh_backend_get_attribute(stats->instrumented, attr_name, arg, data);
+    stats_record(stats->stats, SO_GET_ATTRIBUTE, start, rc < 0);
+    return rc;
+}
+
+    /*--------------------------------------------------------------------*
+     |                             sweep()                                |
+     *--------------------------------------------------------------------*/
+
+static int
+stats_backend_sweep(void *backend, uint64_t generation)
+{
+    struct stats_backend *stats = backend;
+
+    return rbh_backend_sweep(stats->instrumented, generation);
+}
+
+    /*--------------------------------------------------------------------*
+     |                            queue_*()                               |
+     *--------------------------------------------------------------------*/
+
+static ssize_t
+stats_backend_queue_push(void *backend, const char *queue,
+                         const char * const *items, size_t count)
+{
+    struct stats_backend *stats = backend;
+
+    return rbh_backend_queue_push(stats->instrumented, queue, items, count);
+}
+
+static char *
+stats_backend_queue_lease(void *backend, const char *queue, const char *owner,
+                          unsigned int duration)
+{
+    struct stats_backend *stats = backend;
+
+    return rbh_backend_queue_lease(stats->instrumented, queue, owner,
+                                   duration);
+}
+
+static int
+stats_backend_queue_ack(void *backend, const char *queue, const char *item,
+                        const char *owner, enum rbh_queue_ack ack)
+{
+    struct stats_backend *stats = backend;
+
+    return rbh_backend_queue_ack(stats->instrumented, queue, item, owner, ack);
+}
+
+static struct rbh_mut_iterator *
+stats_backend_queue_abandoned(void *backend, const char *queue)
+{
+    struct stats_backend *stats = backend;
+
+    return rbh_backend_queue_abandoned(stats->instrumented, queue);
+}
+
+    /*--------------------------------------------------------------------*
+     |                            destroy()                               |
+     *--------------------------------------------------------------------*/
+
+static void
+stats_backend_destroy(void *backend)
+{
+    struct stats_backend *stats = backend;
+
+    rbh_backend_destroy(stats->instrumented);
+    stats_unref(stats->stats);
+    free(stats);
+}
+
+static const struct rbh_backend_operations STATS_BACKEND_OPS = {
+    .get_option = stats_backend_get_option,
+    .set_option = stats_backend_set_option,
+    .update = stats_backend_update,
+    .branch = stats_backend_branch,
+    .root = stats_backend_root,
+    .filter = stats_backend_filter,
+    .export_entries = stats_backend_export,
+    .explain = stats_backend_explain,
+    .get_attribute = stats_backend_get_attribute,
+    .sweep = stats_backend_sweep,
+    .queue_push = stats_backend_queue_push,
+    .queue_lease = stats_backend_queue_lease,
+    .queue_ack = stats_backend_queue_ack,
+    .queue_abandoned = stats_backend_queue_abandoned,
+    .destroy = stats_backend_destroy,
+};
+
+static struct rbh_backend *
+stats_backend_from_stats(struct rbh_backend *instrumented, struct stats *stats)
+{
+    struct stats_backend *backend;
+
+    backend = malloc(sizeof(*backend));
+    if (backend == NULL)
+        return NULL;
+
+    /* Callers check the ID of a backend to know which options it supports */
+    backend->backend.id = instrumented->id;
+    backend->backend.name = instrumented->name;
+    backend->backend.ops = &STATS_BACKEND_OPS;
+    backend->instrumented = instrumented;
+    backend->stats = stats;
+    return &backend->backend;
+}
+
+struct rbh_backend *
+rbh_stats_backend_new(struct rbh_backend *instrumented, const char *name)
+{
+    struct rbh_backend *backend;
+    struct stats *stats;
+    int save_errno;
+
+    stats = stats_new(name);
+    if (stats == NULL)
+        return NULL;
+
+    backend = stats_backend_from_stats(instrumented, stats);
+    if (backend == NULL) {
+        save_errno = errno;
+        pthread_mutex_destroy(&stats->lock);
+        free(stats->name);
+        free(stats);
+        errno = save_errno;
+    }
+
+    return backend;
+}
+
+int
+rbh_stats_backend_report(struct rbh_backend *backend, FILE *file)
+{
+    struct stats_backend *stats = (struct stats_backend *)backend;
+
+    if (backend->ops != &STATS_BACKEND_OPS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pthread_mutex_lock(&stats->stats->lock);
+    stats_report(stats->stats, file);
+    pthread_mutex_unlock(&stats->stats->lock);
+    return 0;
+}
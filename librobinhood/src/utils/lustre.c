@@ -0,0 +1,106 @@
+/* This file is part of the RobinHood Library
+ * Copyright (C) 2019 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: LGPL-3.0-or-later
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/xattr.h>
+
+#include "robinhood/lustre_utils.h"
+
+/*----------------------------------------------------------------------------*
+ |                                 lazy size                                  |
+ *----------------------------------------------------------------------------*/
+
+/* MDTs maintain the size and blocks of files in "trusted.som" (cf. struct
+ * lustre_som_attrs, which is only defined since Lustre 2.12), little endian
+ */
+#define XATTR_LUSTRE_SOM "trusted.som"
+
+struct lazy_size {
+    uint16_t valid;
+    uint16_t reserved[3];
+    uint64_t size;
+    uint64_t blocks;
+};
+
+enum lazy_size_flags {
+    LSF_STRICT = 0x1,
+    LSF_STALE  = 0x2,
+    LSF_LAZY   = 0x4,
+};
+
+static int
+lazy_size_get(int fd, struct lazy_size *lazy_size)
+{
+    ssize_t length;
+
+    length = fgetxattr(fd, XATTR_LUSTRE_SOM, lazy_size, sizeof(*lazy_size));
+    if (length == -1 && errno == EBADF) {
+        /* `fd' was opened with O_PATH */
+        char path[sizeof("/proc/self/fd/") + 10];
+
+        sprintf(path, "/proc/self/fd/%d", fd);
+        length = getxattr(path, XATTR_LUSTRE_SOM, lazy_size,
+                          sizeof(*lazy_size));
+    }
+    if (length == -1)
+        return -1;
+
+    if (length < (ssize_t)sizeof(*lazy_size)) {
+        errno = ENODATA;
+        return -1;
+    }
+
+    lazy_size->valid = le16toh(lazy_size->valid);
+    if (!(lazy_size->valid & (LSF_STRICT | LSF_LAZY))
+     || lazy_size->valid & LSF_STALE) {
+        errno = ENODATA;
+        return -1;
+    }
+
+    lazy_size->size = le64toh(lazy_size->size);
+    lazy_size->blocks = le64toh(lazy_size->blocks);
+    return 0;
+}
+
+/*----------------------------------------------------------------------------*
+ |                          rbh_lustre_lazy_statx()                           |
+ *----------------------------------------------------------------------------*/
+
+int
+rbh_lustre_lazy_statx(int dirfd, const char *pathname, int flags,
+                      unsigned int mask, struct rbh_statx *statxbuf)
+{
+    const unsigned int GLIMPSED = RBH_STATX_SIZE | RBH_STATX_BLOCKS;
+    struct lazy_size lazy_size;
+
+    /* Only regular files have a lazy size, it is missing for the others */
+    if (!(mask & GLIMPSED) || !(flags & AT_EMPTY_PATH) || *pathname != '\0'
+     || lazy_size_get(dirfd, &lazy_size))
+        return rbh_statx(dirfd, pathname, flags, mask, statxbuf);
+
+    if (rbh_statx(dirfd, pathname, flags, mask & ~GLIMPSED, statxbuf))
+        return -1;
+
+    if (mask & RBH_STATX_SIZE) {
+        statxbuf->stx_size = lazy_size.size;
+        statxbuf->stx_mask |= RBH_STATX_SIZE;
+    }
+    if (mask & RBH_STATX_BLOCKS) {
+        statxbuf->stx_blocks = lazy_size.blocks;
+        statxbuf->stx_mask |= RBH_STATX_BLOCKS;
+    }
+
+    return 0;
+}
@@ -18,6 +18,7 @@
 #include <unistd.h>
 
 #include "robinhood/plugins/backend.h"
+#include "robinhood/stats.h"
 #include "robinhood/utils.h"
 #include "robinhood/uri.h"
 
@@ -56,34 +57,6 @@ backend_new(const char *type, const char *fsname)
     return backend;
 }
 
-static struct rbh_backend *
-posix_backend_branch_from_path(struct rbh_backend *backend, const char *fsname,
-                               const char *path)
-{
-    char full_path[PATH_MAX];
-
-    /* Discard every leading '/' in `path' */
-    while (*path == '/')
-        path++;
-
-    if (fsname[0] != '/') {
-        if (getcwd(full_path, sizeof(full_path)) == NULL)
-            error(EXIT_FAILURE, errno, "getcwd");
-
-        if (snprintf(full_path + strlen(full_path),
-                     PATH_MAX - strlen(full_path),
-                     "/%s/%s", fsname, path) == -1)
-            error(EXIT_FAILURE, errno, "snprintf with '%s', '%s' and '%s'",
-                  full_path, fsname, path);
-    } else {
-        if (snprintf(full_path, PATH_MAX, "%s/%s", fsname, path) == -1)
-            error(EXIT_FAILURE, errno, "snprintf with '%s' and '%s'",
-                  fsname, path);
-    }
-
-    return rbh_backend_branch(backend, NULL, full_path);
-}
-
 static struct rbh_backend *
 backend_branch_from_path(struct rbh_backend *backend, const char *path)
 {
@@ -122,10 +95,9 @@ backend_from_uri(const struct rbh_uri *uri)
         branch = rbh_backend_branch(backend, uri->id, NULL);
         break;
     case RBH_UT_PATH:
-        /* The posix backend does not support filtering, treat it differently */
-        if (backend->id == RBH_BI_POSIX)
-            branch = posix_backend_branch_from_path(backend, uri->fsname,
-                                                    uri->path);
+        /* Posix backends do not support filtering, but branch on paths */
+        if (backend->id == RBH_BI_POSIX || backend->id == RBH_BI_LUSTRE)
+            branch = rbh_backend_branch(backend, NULL, uri->path);
         else
             branch = backend_branch_from_path(backend, uri->path);
         break;
@@ -140,13 +112,33 @@ backend_from_uri(const struct rbh_uri *uri)
     return branch;
 }
 
+/* "rbh:stats:<backend>:..." is an instrumented "rbh:<backend>:..." */
+static const char *
+strip_stats_prefix(const char *string, char **stripped)
+{
+    const char *prefix = RBH_SCHEME ":" RBH_STATS_BACKEND_NAME ":";
+    size_t length = strlen(prefix);
+
+    *stripped = NULL;
+    if (strncmp(string, prefix, length))
+        return string;
+
+    if (asprintf(stripped, "%s:%s", RBH_SCHEME, string + length) < 0)
+        error(EXIT_FAILURE, errno, "asprintf");
+
+    return *stripped;
+}
+
 struct rbh_backend *
 rbh_backend_from_uri(const char *string)
 {
+    const char *instrument = getenv(RBH_STATS_ENV);
     struct rbh_backend *backend;
     struct rbh_raw_uri *raw_uri;
     struct rbh_uri *uri;
+    char *stripped;
 
+    string = strip_stats_prefix(string, &stripped);
     raw_uri = rbh_raw_uri_from_string(string);
     if (raw_uri == NULL)
         error(EXIT_FAILURE, errno, "rbh_raw_uri_from_string");
@@ -158,5 +150,13 @@ rbh_backend_from_uri(const char *string)
 
     backend = backend_from_uri(uri);
     free(uri);
+
+    if (stripped != NULL || (instrument != NULL && *instrument != '\0')) {
+        backend = rbh_stats_backend_new(backend, string);
+        if (backend == NULL)
+            error(EXIT_FAILURE, errno, "rbh_stats_backend_new");
+    }
+    free(stripped);
+
     return backend;
 }
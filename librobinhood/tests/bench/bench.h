@@ -0,0 +1,77 @@
+/* This file is part of the RobinHood Library
+ * Copyright (C) 2024 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: LGPL-3.0-or-later
+ */
+
+#ifndef RBH_BENCH_H
+#define RBH_BENCH_H
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Helpers shared by every benchmark
+ *
+ * Each benchmark prints one JSON object per line on stdout:
+ *
+ *     {"suite": "hashmap", "benchmark": "set/50%", "iterations": 100000,
+ *      "ns": 1234567, "ns_per_op": 12.35}
+ *
+ * The keys and their order are stable, so that the outputs of two builds can
+ * be compared line by line.
+ *
+ * The number of iterations of every benchmark can be scaled with the
+ * RBH_BENCH_SCALE environment variable (a floating point number, defaults to
+ * 1).
+ */
+
+static inline uint64_t
+bench_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static inline size_t
+bench_iterations(size_t iterations)
+{
+    const char *scale = getenv("RBH_BENCH_SCALE");
+    double factor;
+
+    if (scale == NULL)
+        return iterations;
+
+    factor = strtod(scale, NULL);
+    if (factor <= 0)
+        return iterations;
+
+    iterations *= factor;
+    return iterations ? iterations : 1;
+}
+
+static inline void
+bench_report(const char *suite, const char *name, size_t iterations,
+             uint64_t ns)
+{
+    printf("{\"suite\": \"%s\", \"benchmark\": \"%s\", \"iterations\": %zu, "
+           "\"ns\": %" PRIu64 ", \"ns_per_op\": %.2f}\n", suite, name,
+           iterations, ns, (double)ns / iterations);
+    fflush(stdout);
+}
+
+/* Benchmarks are not tests, but they should not measure a failing path */
+#define bench_assert(expr) \
+    do { \
+        if (!(expr)) { \
+            fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #expr); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+#endif
@@ -0,0 +1,158 @@
+/* This file is part of the RobinHood Library
+ * Copyright (C) 2024 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: LGPL-3.0-or-later
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+
+#include "robinhood/filter.h"
+#include "robinhood/fsentry.h"
+#include "robinhood/fsevent.h"
+
+#include "bench.h"
+#include "fixture.h"
+
+static void
+bench_fsentry_new(void)
+{
+    size_t count = bench_iterations(1 << 18);
+    uint64_t start;
+
+    start = bench_now();
+    for (size_t i = 0; i < count; i++) {
+        struct rbh_fsentry *fsentry;
+
+        fsentry = rbh_fsentry_new(&FIXTURE_ID, &FIXTURE_PARENT_ID,
+                                  FIXTURE_NAME, &FIXTURE_STATX,
+                                  &FIXTURE_NS_XATTRS, &FIXTURE_XATTRS, NULL);
+        bench_assert(fsentry);
+        free(fsentry);
+    }
+    bench_report("fsentry", "rbh_fsentry_new", count, bench_now() - start);
+}
+
+/* fsevent_clone() is private: it is measured through the constructors, which
+ * do little else than call it.
+ */
+static void
+bench_fsevent_new(void)
+{
+    size_t count = bench_iterations(1 << 18);
+    uint64_t start;
+
+    start = bench_now();
+    for (size_t i = 0; i < count; i++) {
+        struct rbh_fsevent *fsevent;
+
+        fsevent = rbh_fsevent_upsert_new(&FIXTURE_ID, &FIXTURE_XATTRS,
+                                         &FIXTURE_STATX, NULL);
+        bench_assert(fsevent);
+        free(fsevent);
+    }
+    bench_report("fsevent", "upsert", count, bench_now() - start);
+
+    start = bench_now();
+    for (size_t i = 0; i < count; i++) {
+        struct rbh_fsevent *fsevent;
+
+        fsevent = rbh_fsevent_link_new(&FIXTURE_ID, &FIXTURE_NS_XATTRS,
+                                       &FIXTURE_PARENT_ID, FIXTURE_NAME);
+        bench_assert(fsevent);
+        free(fsevent);
+    }
+    bench_report("fsevent", "link", count, bench_now() - start);
+
+    start = bench_now();
+    for (size_t i = 0; i < count; i++) {
+        struct rbh_fsevent *fsevent;
+
+        fsevent = rbh_fsevent_xattr_new(&FIXTURE_ID, &FIXTURE_XATTRS);
+        bench_assert(fsevent);
+        free(fsevent);
+    }
+    bench_report("fsevent", "xattr", count, bench_now() - start);
+}
+
+static struct rbh_filter *
+filter_new(void)
+{
+    const struct rbh_filter_field size = {
+        .fsentry = RBH_FP_STATX,
+        .statx = RBH_STATX_SIZE,
+    };
+    const struct rbh_filter_field uid = {
+        .fsentry = RBH_FP_STATX,
+        .statx = RBH_STATX_UID,
+    };
+    const struct rbh_filter_field name = {
+        .fsentry = RBH_FP_NAME,
+    };
+    const struct rbh_filter_field path = {
+        .fsentry = RBH_FP_NAMESPACE_XATTRS,
+        .xattr = "path",
+    };
+    const struct rbh_filter *filters[4];
+    const struct rbh_filter *or[2];
+    struct rbh_filter *filter;
+
+    /* -size +1M -uid 1000 (-name '*.dat' -o -not -path '/tmp/...') */
+    filters[0] = rbh_filter_compare_uint64_new(RBH_FOP_STRICTLY_GREATER,
+                                               &size, 1 << 20);
+    filters[1] = rbh_filter_compare_uint32_new(RBH_FOP_EQUAL, &uid, 1000);
+    or[0] = rbh_filter_compare_regex_new(RBH_FOP_REGEX, &name, "^.*\\.dat$",
+                                         0);
+    filters[3] = rbh_filter_compare_regex_new(RBH_FOP_REGEX, &path,
+                                              "^/tmp/.*$", 0);
+    or[1] = rbh_filter_not_new(filters[3]);
+    filters[2] = rbh_filter_or_new(or, 2);
+    bench_assert(filters[0] && filters[1] && filters[2]);
+
+    filter = rbh_filter_and_new(filters, 3);
+    bench_assert(filter);
+
+    free((void *)filters[0]);
+    free((void *)filters[1]);
+    free((void *)filters[2]);
+    free((void *)filters[3]);
+    free((void *)or[0]);
+    free((void *)or[1]);
+    return filter;
+}
+
+static void
+bench_filter_clone(void)
+{
+    size_t count = bench_iterations(1 << 18);
+    struct rbh_filter *filter;
+    uint64_t start;
+
+    filter = filter_new();
+
+    start = bench_now();
+    for (size_t i = 0; i < count; i++) {
+        struct rbh_filter *clone;
+
+        clone = rbh_filter_clone(filter);
+        bench_assert(clone);
+        free(clone);
+    }
+    bench_report("filter", "rbh_filter_clone", count, bench_now() - start);
+
+    free(filter);
+}
+
+int
+main(void)
+{
+    bench_fsentry_new();
+    bench_fsevent_new();
+    bench_filter_clone();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,92 @@
+/* This file is part of the RobinHood Library
+ * Copyright (C) 2024 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: LGPL-3.0-or-later
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "robinhood/hashmap.h"
+
+#include "bench.h"
+
+#define HASHMAP_SIZE (1 << 16)
+
+static bool
+u64equals(const void *x, const void *y)
+{
+    return *(const uint64_t *)x == *(const uint64_t *)y;
+}
+
+static size_t
+u64hash(const void *key)
+{
+    uint64_t hash = *(const uint64_t *)key;
+
+    /* splitmix64's finalizer */
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+    return hash ^ (hash >> 31);
+}
+
+static void
+bench_load_factor(const uint64_t *keys, unsigned int load_factor)
+{
+    size_t count = HASHMAP_SIZE * load_factor / 100;
+    size_t rounds = bench_iterations(100);
+    uint64_t set = 0, get = 0, pop = 0;
+    char name[32];
+
+    for (size_t round = 0; round < rounds; round++) {
+        struct rbh_hashmap *hashmap;
+        uint64_t start;
+
+        hashmap = rbh_hashmap_new(u64equals, u64hash, HASHMAP_SIZE);
+        bench_assert(hashmap);
+
+        start = bench_now();
+        for (size_t i = 0; i < count; i++)
+            bench_assert(rbh_hashmap_set(hashmap, &keys[i], &keys[i]) == 0);
+        set += bench_now() - start;
+
+        start = bench_now();
+        for (size_t i = 0; i < count; i++)
+            bench_assert(rbh_hashmap_get(hashmap, &keys[i]) == &keys[i]);
+        get += bench_now() - start;
+
+        start = bench_now();
+        for (size_t i = 0; i < count; i++)
+            bench_assert(rbh_hashmap_pop(hashmap, &keys[i]) == &keys[i]);
+        pop += bench_now() - start;
+
+        rbh_hashmap_destroy(hashmap);
+    }
+
+    snprintf(name, sizeof(name), "set/%u%%", load_factor);
+    bench_report("hashmap", name, rounds * count, set);
+    snprintf(name, sizeof(name), "get/%u%%", load_factor);
+    bench_report("hashmap", name, rounds * count, get);
+    snprintf(name, sizeof(name), "pop/%u%%", load_factor);
+    bench_report("hashmap", name, rounds * count, pop);
+}
+
+int
+main(void)
+{
+    static const unsigned int LOAD_FACTORS[] = { 25, 50, 75, 90 };
+    static uint64_t keys[HASHMAP_SIZE];
+
+    for (size_t i = 0; i < HASHMAP_SIZE; i++)
+        keys[i] = i * 2654435761U;
+
+    for (size_t i = 0; i < sizeof(LOAD_FACTORS) / sizeof(*LOAD_FACTORS); i++)
+        bench_load_factor(keys, LOAD_FACTORS[i]);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,127 @@
+/* This file is part of the RobinHood Library
+ * Copyright (C) 2024 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: LGPL-3.0-or-later
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include "robinhood/fsentry.h"
+#include "robinhood/fsevent.h"
+
+#include "mongo.h"
+
+#include "bench.h"
+#include "fixture.h"
+
+/* The mongo backend never encodes fsentries, it only ever writes fsevents
+ * (bson_update_from_fsevent()) and reads fsentries back (fsentry_from_bson()).
+ */
+
+static void
+bench_encode(const char *name, const struct rbh_fsevent *fsevent)
+{
+    size_t count = bench_iterations(1 << 17);
+    uint64_t start;
+
+    start = bench_now();
+    for (size_t i = 0; i < count; i++) {
+        bson_t *update;
+
+        update = bson_update_from_fsevent(fsevent, i);
+        bench_assert(update);
+        bson_destroy(update);
+    }
+    bench_report("mongo", name, count, bench_now() - start);
+}
+
+static void
+bench_fsevent_encode(void)
+{
+    struct rbh_fsevent *fsevent;
+
+    fsevent = rbh_fsevent_upsert_new(&FIXTURE_ID, &FIXTURE_XATTRS,
+                                     &FIXTURE_STATX, NULL);
+    bench_assert(fsevent);
+    bench_encode("encode/upsert", fsevent);
+    free(fsevent);
+
+    fsevent = rbh_fsevent_link_new(&FIXTURE_ID, &FIXTURE_NS_XATTRS,
+                                   &FIXTURE_PARENT_ID, FIXTURE_NAME);
+    bench_assert(fsevent);
+    bench_encode("encode/link", fsevent);
+    free(fsevent);
+
+    fsevent = rbh_fsevent_unlink_new(&FIXTURE_ID, &FIXTURE_PARENT_ID,
+                                     FIXTURE_NAME);
+    bench_assert(fsevent);
+    bench_encode("encode/unlink", fsevent);
+    free(fsevent);
+
+    fsevent = rbh_fsevent_xattr_new(&FIXTURE_ID, &FIXTURE_XATTRS);
+    bench_assert(fsevent);
+    bench_encode("encode/xattr", fsevent);
+    free(fsevent);
+}
+
+/* A document, as returned by the aggregation pipeline of rbh_backend_filter()
+ * (namespace entries are unwound).
+ */
+static bson_t *
+fsentry_document_new(void)
+{
+    bson_t *document = bson_new();
+    bson_t ns;
+
+    bench_assert(BSON_APPEND_RBH_ID(document, MFF_ID, &FIXTURE_ID));
+
+    bench_assert(BSON_APPEND_DOCUMENT_BEGIN(document, MFF_NAMESPACE, &ns));
+    bench_assert(BSON_APPEND_RBH_ID(&ns, MFF_PARENT_ID, &FIXTURE_PARENT_ID));
+    bench_assert(BSON_APPEND_UTF8(&ns, MFF_NAME, FIXTURE_NAME));
+    bench_assert(BSON_APPEND_RBH_VALUE_MAP(&ns, MFF_XATTRS,
+                                           &FIXTURE_NS_XATTRS));
+    bench_assert(bson_append_document_end(document, &ns));
+
+    bench_assert(BSON_APPEND_STATX(document, MFF_STATX, &FIXTURE_STATX));
+    bench_assert(BSON_APPEND_RBH_VALUE_MAP(document, MFF_XATTRS,
+                                           &FIXTURE_XATTRS));
+    return document;
+}
+
+static void
+bench_fsentry_decode(void)
+{
+    size_t count = bench_iterations(1 << 17);
+    bson_t *document;
+    uint64_t start;
+
+    document = fsentry_document_new();
+
+    start = bench_now();
+    for (size_t i = 0; i < count; i++) {
+        struct rbh_fsentry *fsentry;
+
+        fsentry = fsentry_from_bson(document);
+        bench_assert(fsentry);
+        bench_assert(fsentry->mask == (RBH_FP_ALL & ~RBH_FP_SYMLINK));
+        free(fsentry);
+    }
+    bench_report("mongo", "decode/fsentry", count, bench_now() - start);
+
+    bson_destroy(document);
+}
+
+int
+main(void)
+{
+    bench_fsevent_encode();
+    bench_fsentry_decode();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,143 @@
+/* This file is part of the RobinHood Library
+ * Copyright (C) 2024 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: LGPL-3.0-or-later
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "robinhood/ring.h"
+#include "robinhood/ringr.h"
+
+#include "bench.h"
+
+static void
+bench_ring(size_t element_size)
+{
+    size_t size = sysconf(_SC_PAGESIZE) * 16;
+    size_t count = bench_iterations(1 << 20);
+    uint64_t push = 0, peek = 0, pop = 0;
+    char element[element_size];
+    struct rbh_ring *ring;
+    char name[32];
+
+    memset(element, 'x', element_size);
+    ring = rbh_ring_new(size);
+    bench_assert(ring);
+
+    for (size_t done = 0; done < count; ) {
+        size_t batch = size / element_size;
+        size_t readable;
+        uint64_t start;
+
+        if (batch > count - done)
+            batch = count - done;
+
+        start = bench_now();
+        for (size_t i = 0; i < batch; i++)
+            bench_assert(rbh_ring_push(ring, element, element_size));
+        push += bench_now() - start;
+
+        /* Peek a full ring without popping, the way consumers poll it */
+        start = bench_now();
+        for (size_t i = 0; i < batch; i++)
+            bench_assert(rbh_ring_peek(ring, &readable));
+        peek += bench_now() - start;
+
+        start = bench_now();
+        for (size_t i = 0; i < batch; i++) {
+            bench_assert(rbh_ring_peek(ring, &readable));
+            bench_assert(readable >= element_size);
+            bench_assert(rbh_ring_pop(ring, element_size) == 0);
+        }
+        pop += bench_now() - start;
+
+        done += batch;
+    }
+
+    rbh_ring_destroy(ring);
+
+    snprintf(name, sizeof(name), "push/%zuB", element_size);
+    bench_report("ring", name, count, push);
+    snprintf(name, sizeof(name), "peek/%zuB", element_size);
+    bench_report("ring", name, count, peek);
+    snprintf(name, sizeof(name), "peek+pop/%zuB", element_size);
+    bench_report("ring", name, count, pop);
+}
+
+static void
+bench_ringr(size_t readers, size_t element_size)
+{
+    size_t size = sysconf(_SC_PAGESIZE) * 16;
+    size_t count = bench_iterations(1 << 20);
+    struct rbh_ringr *ringrs[readers];
+    uint64_t push = 0, ack = 0;
+    char element[element_size];
+    char name[32];
+
+    memset(element, 'x', element_size);
+    ringrs[0] = rbh_ringr_new(size);
+    bench_assert(ringrs[0]);
+    for (size_t i = 1; i < readers; i++) {
+        ringrs[i] = rbh_ringr_dup(ringrs[0]);
+        bench_assert(ringrs[i]);
+    }
+
+    for (size_t done = 0; done < count; ) {
+        size_t batch = size / element_size;
+        uint64_t start;
+
+        if (batch > count - done)
+            batch = count - done;
+
+        start = bench_now();
+        for (size_t i = 0; i < batch; i++)
+            bench_assert(rbh_ringr_push(ringrs[0], element, element_size));
+        push += bench_now() - start;
+
+        start = bench_now();
+        for (size_t i = 0; i < batch; i++) {
+            for (size_t j = 0; j < readers; j++) {
+                size_t readable;
+
+                bench_assert(rbh_ringr_peek(ringrs[j], &readable));
+                bench_assert(readable >= element_size);
+                bench_assert(rbh_ringr_ack(ringrs[j], element_size) == 0);
+            }
+        }
+        ack += bench_now() - start;
+
+        done += batch;
+    }
+
+    for (size_t i = 0; i < readers; i++)
+        rbh_ringr_destroy(ringrs[i]);
+
+    snprintf(name, sizeof(name), "push/%zur/%zuB", readers, element_size);
+    bench_report("ringr", name, count, push);
+    snprintf(name, sizeof(name), "peek+ack/%zur/%zuB", readers, element_size);
+    bench_report("ringr", name, count * readers, ack);
+}
+
+int
+main(void)
+{
+    static const size_t SIZES[] = { 8, 64, 512 };
+
+    for (size_t i = 0; i < sizeof(SIZES) / sizeof(*SIZES); i++)
+        bench_ring(SIZES[i]);
+
+    for (size_t i = 0; i < sizeof(SIZES) / sizeof(*SIZES); i++) {
+        bench_ringr(1, SIZES[i]);
+        bench_ringr(4, SIZES[i]);
+    }
+
+    return EXIT_SUCCESS;
+}
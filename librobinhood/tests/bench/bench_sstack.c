@@ -0,0 +1,72 @@
+/* This file is part of the RobinHood Library
+ * Copyright (C) 2024 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: LGPL-3.0-or-later
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include "robinhood/sstack.h"
+
+#include "bench.h"
+
+#define CHUNK_SIZE (1 << 16)
+
+static void
+bench_sstack(size_t element_size)
+{
+    size_t count = bench_iterations(1 << 20);
+    size_t depth = 4 * CHUNK_SIZE / element_size;
+    uint64_t push = 0, pop = 0;
+    char element[element_size];
+    struct rbh_sstack *sstack;
+    char name[32];
+
+    memset(element, 'x', element_size);
+    sstack = rbh_sstack_new(CHUNK_SIZE);
+    bench_assert(sstack);
+
+    /* Push several chunks worth of data and pop it back, the first round
+     * allocates the chunks, the others reuse them.
+     */
+    for (size_t done = 0; done < count; ) {
+        size_t batch = depth < count - done ? depth : count - done;
+        uint64_t start;
+
+        start = bench_now();
+        for (size_t i = 0; i < batch; i++)
+            bench_assert(rbh_sstack_push(sstack, element, element_size));
+        push += bench_now() - start;
+
+        start = bench_now();
+        for (size_t i = 0; i < batch; i++)
+            bench_assert(rbh_sstack_pop(sstack, element_size) == 0);
+        pop += bench_now() - start;
+
+        done += batch;
+    }
+
+    rbh_sstack_destroy(sstack);
+
+    snprintf(name, sizeof(name), "push/%zuB", element_size);
+    bench_report("sstack", name, count, push);
+    snprintf(name, sizeof(name), "pop/%zuB", element_size);
+    bench_report("sstack", name, count, pop);
+}
+
+int
+main(void)
+{
+    static const size_t SIZES[] = { 8, 64, 512, 4096 };
+
+    for (size_t i = 0; i < sizeof(SIZES) / sizeof(*SIZES); i++)
+        bench_sstack(SIZES[i]);
+
+    return EXIT_SUCCESS;
+}
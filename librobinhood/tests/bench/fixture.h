@@ -0,0 +1,81 @@
+/* This file is part of the RobinHood Library
+ * Copyright (C) 2024 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: LGPL-3.0-or-later
+ */
+
+#ifndef RBH_BENCH_FIXTURE_H
+#define RBH_BENCH_FIXTURE_H
+
+#include <sys/stat.h>
+
+#include "robinhood/id.h"
+#include "robinhood/statx.h"
+#include "robinhood/value.h"
+
+/* A typical regular file, as rbh-sync would record it */
+
+static const struct rbh_id FIXTURE_ID = {
+    .data = "0123456789abcdef",
+    .size = 16,
+};
+
+static const struct rbh_id FIXTURE_PARENT_ID = {
+    .data = "fedcba9876543210",
+    .size = 16,
+};
+
+static const char FIXTURE_NAME[] = "fixture.dat";
+
+static const struct rbh_statx FIXTURE_STATX = {
+    .stx_mask = RBH_STATX_BASIC_STATS | RBH_STATX_BLKSIZE | RBH_STATX_ATTRIBUTES
+              | RBH_STATX_DEV,
+    .stx_blksize = 4096,
+    .stx_nlink = 1,
+    .stx_uid = 1000,
+    .stx_gid = 1000,
+    .stx_mode = S_IFREG | 0644,
+    .stx_ino = 123456789,
+    .stx_size = 1 << 20,
+    .stx_blocks = 2048,
+    .stx_atime = { .tv_sec = 1700000000, .tv_nsec = 1 },
+    .stx_btime = { .tv_sec = 1700000000, .tv_nsec = 2 },
+    .stx_ctime = { .tv_sec = 1700000000, .tv_nsec = 3 },
+    .stx_mtime = { .tv_sec = 1700000000, .tv_nsec = 4 },
+    .stx_dev_major = 8,
+    .stx_dev_minor = 1,
+};
+
+static const struct rbh_value FIXTURE_PATH = {
+    .type = RBH_VT_STRING,
+    .string = "/a/b/c/fixture.dat",
+};
+
+static const struct rbh_value_pair FIXTURE_NS_PAIRS[] = {
+    { .key = "path", .value = &FIXTURE_PATH },
+};
+
+static const struct rbh_value_map FIXTURE_NS_XATTRS = {
+    .pairs = FIXTURE_NS_PAIRS,
+    .count = 1,
+};
+
+static const struct rbh_value FIXTURE_XATTR_VALUES[] = {
+    { .type = RBH_VT_UINT64, .uint64 = 42 },
+    { .type = RBH_VT_STRING, .string = "archived" },
+    { .type = RBH_VT_BINARY, .binary = { .data = "\x01\x02\x03\x04", .size = 4 } },
+};
+
+static const struct rbh_value_pair FIXTURE_XATTR_PAIRS[] = {
+    { .key = "hsm_archive_id", .value = &FIXTURE_XATTR_VALUES[0] },
+    { .key = "hsm_state", .value = &FIXTURE_XATTR_VALUES[1] },
+    { .key = "user.blob", .value = &FIXTURE_XATTR_VALUES[2] },
+};
+
+static const struct rbh_value_map FIXTURE_XATTRS = {
+    .pairs = FIXTURE_XATTR_PAIRS,
+    .count = 3,
+};
+
+#endif
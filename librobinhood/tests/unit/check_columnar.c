@@ -0,0 +1,701 @@
+/* This file is part of the RobinHood Library
+ * Copyright (C) 2024 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: LGPL-3.0-or-later
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "check-compat.h"
+#include "robinhood/backends/columnar.h"
+#include "robinhood/filter.h"
+#include "robinhood/fsevent.h"
+#include "robinhood/itertools.h"
+#include "robinhood/statx.h"
+
+/*----------------------------------------------------------------------------*
+ |                                tests helpers                               |
+ *----------------------------------------------------------------------------*/
+
+/* A tree of 4 entries, one of which has 2 links:
+ *
+ *     /            (root)
+ *     /dir         (directory)
+ *     /dir/file    (10 bytes, a hardlink of /link)
+ *     /link        (10 bytes, a hardlink of /dir/file)
+ *     /big         (1000 bytes)
+ */
+static const struct rbh_id ROOT_ID = { .data = "root", .size = 4 };
+static const struct rbh_id DIR_ID = { .data = "dir", .size = 3 };
+static const struct rbh_id FILE_ID = { .data = "file", .size = 4 };
+static const struct rbh_id BIG_ID = { .data = "big", .size = 3 };
+static const struct rbh_id NO_PARENT_ID = { .data = NULL, .size = 0 };
+
+static const struct rbh_statx DIR_STATX = {
+    .stx_mask = RBH_STATX_TYPE | RBH_STATX_MODE | RBH_STATX_SIZE,
+    .stx_mode = S_IFDIR | 0755,
+    .stx_size = 4096,
+};
+
+static const struct rbh_statx FILE_STATX = {
+    .stx_mask = RBH_STATX_TYPE | RBH_STATX_MODE | RBH_STATX_SIZE,
+    .stx_mode = S_IFREG | 0644,
+    .stx_size = 10,
+};
+
+static const struct rbh_statx BIG_STATX = {
+    .stx_mask = RBH_STATX_TYPE | RBH_STATX_MODE | RBH_STATX_SIZE,
+    .stx_mode = S_IFREG | 0600,
+    .stx_size = 1000,
+};
+
+static const struct rbh_value TIER = {
+    .type = RBH_VT_STRING,
+    .string = "fast",
+};
+
+static const struct rbh_value_pair TIER_PAIR = {
+    .key = "tier",
+    .value = &TIER,
+};
+
+static const struct rbh_fsevent TREE[] = {
+    {
+        .type = RBH_FET_UPSERT,
+        .id = ROOT_ID,
+        .upsert = {
+            .statx = &DIR_STATX,
+        },
+    },
+    {
+        .type = RBH_FET_LINK,
+        .id = ROOT_ID,
+        .link = {
+            .parent_id = &NO_PARENT_ID,
+            .name = "",
+        },
+    },
+    {
+        .type = RBH_FET_UPSERT,
+        .id = DIR_ID,
+        .upsert = {
+            .statx = &DIR_STATX,
+        },
+    },
+    {
+        .type = RBH_FET_LINK,
+        .id = DIR_ID,
+        .link = {
+            .parent_id = &ROOT_ID,
+            .name = "dir",
+        },
+    },
+    {
+        .type = RBH_FET_UPSERT,
+        .id = FILE_ID,
+        .xattrs = {
+            .pairs = &TIER_PAIR,
+            .count = 1,
+        },
+        .upsert = {
+            .statx = &FILE_STATX,
+        },
+    },
+    {
+        .type = RBH_FET_LINK,
+        .id = FILE_ID,
+        .link = {
+            .parent_id = &DIR_ID,
+            .name = "file",
+        },
+    },
+    {
+        .type = RBH_FET_LINK,
+        .id = FILE_ID,
+        .link = {
+            .parent_id = &ROOT_ID,
+            .name = "link",
+        },
+    },
+    {
+        .type = RBH_FET_UPSERT,
+        .id = BIG_ID,
+        .upsert = {
+            .statx = &BIG_STATX,
+        },
+    },
+    {
+        .type = RBH_FET_LINK,
+        .id = BIG_ID,
+        .link = {
+            .parent_id = &ROOT_ID,
+            .name = "big",
+        },
+    },
+};
+
+static void
+update(struct rbh_backend *backend, const struct rbh_fsevent *fsevents,
+       size_t count)
+{
+    struct rbh_iterator *iterator;
+
+    iterator = rbh_iter_array(fsevents, sizeof(*fsevents), count);
+    ck_assert_ptr_nonnull(iterator);
+    ck_assert_int_eq(rbh_backend_update(backend, iterator, false), count);
+    rbh_iter_destroy(iterator);
+}
+
+/* A path to a snapshot that does not exist yet */
+static char *
+snapshot_path(void)
+{
+    char *path = strdup("/tmp/rbh-columnar.XXXXXX");
+    int fd;
+
+    ck_assert_ptr_nonnull(path);
+    fd = mkstemp(path);
+    ck_assert_int_ge(fd, 0);
+    close(fd);
+    unlink(path);
+    return path;
+}
+
+static void
+snapshot_remove(char *path)
+{
+    unlink(path);
+    free(path);
+}
+
+/* Write a snapshot of TREE at \p path, and open it */
+static struct rbh_backend *
+tree_new(const char *path)
+{
+    struct rbh_backend *backend;
+
+    backend = rbh_columnar_backend_new(path);
+    ck_assert_ptr_nonnull(backend);
+    update(backend, TREE, sizeof(TREE) / sizeof(*TREE));
+    rbh_backend_destroy(backend);
+
+    backend = rbh_columnar_backend_new(path);
+    ck_assert_ptr_nonnull(backend);
+    return backend;
+}
+
+static const struct rbh_filter_options OPTIONS = {
+    .projection = {
+        .fsentry_mask = RBH_FP_ALL,
+        .statx_mask = RBH_STATX_ALL,
+    },
+};
+
+/* Concatenate the names of the fsentries \p filter matches */
+static void
+filter_names(struct rbh_backend *backend, const struct rbh_filter *filter,
+             const struct rbh_filter_options *options, char *names,
+             size_t size)
+{
+    struct rbh_mut_iterator *fsentries;
+    struct rbh_fsentry *fsentry;
+    size_t count = 0;
+
+    fsentries = rbh_backend_filter(backend, filter, options);
+    ck_assert_ptr_nonnull(fsentries);
+
+    *names = '\0';
+    while ((fsentry = rbh_mut_iter_next(fsentries)) != NULL) {
+        ck_assert(fsentry->mask & RBH_FP_NAME);
+        if (count++ > 0)
+            strncat(names, ",", size - strlen(names) - 1);
+        strncat(names, fsentry->name, size - strlen(names) - 1);
+        free(fsentry);
+    }
+    ck_assert_int_eq(errno, ENODATA);
+    rbh_mut_iter_destroy(fsentries);
+}
+
+/*----------------------------------------------------------------------------*
+ |                                   filter                                   |
+ *----------------------------------------------------------------------------*/
+
+static const struct rbh_filter_field SIZE = {
+    .fsentry = RBH_FP_STATX,
+    .statx = RBH_STATX_SIZE,
+};
+
+START_TEST(cf_empty)
+{
+    struct rbh_mut_iterator *fsentries;
+    struct rbh_backend *backend;
+    char *path = snapshot_path();
+
+    backend = rbh_columnar_backend_new(path);
+    ck_assert_ptr_nonnull(backend);
+
+    fsentries = rbh_backend_filter(backend, NULL, &OPTIONS);
+    ck_assert_ptr_nonnull(fsentries);
+
+    errno = 0;
+    ck_assert_ptr_null(rbh_mut_iter_next(fsentries));
+    ck_assert_int_eq(errno, ENODATA);
+
+    rbh_mut_iter_destroy(fsentries);
+    rbh_backend_destroy(backend);
+
+    /* There was nothing to write */
+    ck_assert_int_eq(access(path, F_OK), -1);
+    snapshot_remove(path);
+}
+END_TEST
+
+START_TEST(cf_tree)
+{
+    const struct rbh_filter_field NAME = {
+        .fsentry = RBH_FP_NAME,
+    };
+    const struct rbh_filter_field MODE = {
+        .fsentry = RBH_FP_STATX,
+        .statx = RBH_STATX_MODE,
+    };
+    const struct rbh_filter_sort BY_SIZE_THEN_NAME[] = {
+        {
+            .field = SIZE,
+            .ascending = false,
+        },
+        {
+            .field = NAME,
+            .ascending = true,
+        },
+    };
+    struct rbh_filter_options options = OPTIONS;
+    const struct rbh_filter *filters[2];
+    struct rbh_backend *backend;
+    struct rbh_fsentry *fsentry;
+    struct rbh_filter *filter;
+    char *path = snapshot_path();
+    char names[64];
+
+    backend = tree_new(path);
+
+    fsentry = rbh_backend_root(backend, &OPTIONS.projection);
+    ck_assert_ptr_nonnull(fsentry);
+    ck_assert_int_eq(fsentry->id.size, ROOT_ID.size);
+    ck_assert_mem_eq(fsentry->id.data, ROOT_ID.data, ROOT_ID.size);
+    ck_assert_uint_eq(fsentry->statx->stx_mode, DIR_STATX.stx_mode);
+    free(fsentry);
+
+    /* Every link of every entry */
+    filter_names(backend, NULL, &OPTIONS, names, sizeof(names));
+    ck_assert_str_eq(names, ",dir,file,link,big");
+
+    /* Comparisons on a column */
+    filter = rbh_filter_compare_uint64_new(RBH_FOP_STRICTLY_GREATER, &SIZE,
+                                           10);
+    ck_assert_ptr_nonnull(filter);
+    filter_names(backend, filter, &OPTIONS, names, sizeof(names));
+    ck_assert_str_eq(names, ",dir,big");
+    free(filter);
+
+    filter = rbh_filter_compare_int32_new(RBH_FOP_LOWER_OR_EQUAL, &MODE, 0644);
+    ck_assert_ptr_nonnull(filter);
+    filter_names(backend, filter, &OPTIONS, names, sizeof(names));
+    ck_assert_str_eq(names, "file,link,big");
+    free(filter);
+
+    /* Comparisons on a view of each row, combined with columns */
+    filters[0] = rbh_filter_compare_regex_new(RBH_FOP_REGEX, &NAME, "^[bl]",
+                                              0);
+    ck_assert_ptr_nonnull(filters[0]);
+    filters[1] = rbh_filter_compare_uint64_new(RBH_FOP_EQUAL, &SIZE, 10);
+    ck_assert_ptr_nonnull(filters[1]);
+
+    filter = rbh_filter_and_new(filters, 2);
+    ck_assert_ptr_nonnull(filter);
+    filter_names(backend, filter, &OPTIONS, names, sizeof(names));
+    ck_assert_str_eq(names, "link");
+    free(filter);
+
+    filter = rbh_filter_or_new(filters, 2);
+    ck_assert_ptr_nonnull(filter);
+    filter_names(backend, filter, &OPTIONS, names, sizeof(names));
+    ck_assert_str_eq(names, "file,link,big");
+    free(filter);
+
+    filter = rbh_filter_not_new(filters[1]);
+    ck_assert_ptr_nonnull(filter);
+    filter_names(backend, filter, &OPTIONS, names, sizeof(names));
+    ck_assert_str_eq(names, ",dir,big");
+    free(filter);
+
+    free((void *)filters[0]);
+    free((void *)filters[1]);
+
+    /* Sort, skip, and limit */
+    options.sort.items = BY_SIZE_THEN_NAME;
+    options.sort.count = 2;
+    options.skip = 1;
+    options.limit = 2;
+    filter = rbh_filter_compare_uint64_new(RBH_FOP_GREATER_OR_EQUAL, &SIZE,
+                                           1000);
+    ck_assert_ptr_nonnull(filter);
+    filter_names(backend, filter, &options, names, sizeof(names));
+    ck_assert_str_eq(names, "dir,big");
+    free(filter);
+
+    rbh_backend_destroy(backend);
+    snapshot_remove(path);
+}
+END_TEST
+
+/* Many files, over many blocks: file i is i bytes, and belongs to user i % 3 */
+#define FILE_COUNT 1000
+
+static struct rbh_backend *
+files_new(const char *path, uint32_t block_size)
+{
+    struct rbh_backend *backend;
+
+    backend = rbh_columnar_backend_new(path);
+    ck_assert_ptr_nonnull(backend);
+    ck_assert_int_eq(rbh_backend_set_option(backend, RBH_CBO_BLOCK_SIZE,
+                                            &block_size, sizeof(block_size)),
+                     0);
+
+    update(backend, TREE, 2);
+    for (int i = 0; i < FILE_COUNT; i++) {
+        const struct rbh_statx statx = {
+            .stx_mask = RBH_STATX_TYPE | RBH_STATX_UID | RBH_STATX_SIZE,
+            .stx_mode = S_IFREG,
+            .stx_uid = i % 3,
+            .stx_size = i,
+        };
+        char name[16];
+
+        snprintf(name, sizeof(name), "%d", i);
+        const struct rbh_id id = {
+            .data = name,
+            .size = strlen(name),
+        };
+        const struct rbh_fsevent fsevents[] = {
+            {
+                .type = RBH_FET_UPSERT,
+                .id = id,
+                .upsert = {
+                    .statx = &statx,
+                },
+            },
+            {
+                .type = RBH_FET_LINK,
+                .id = id,
+                .link = {
+                    .parent_id = &ROOT_ID,
+                    .name = name,
+                },
+            },
+        };
+
+        update(backend, fsevents, 2);
+    }
+
+    rbh_backend_destroy(backend);
+    backend = rbh_columnar_backend_new(path);
+    ck_assert_ptr_nonnull(backend);
+    return backend;
+}
+
+static size_t
+filter_count(struct rbh_backend *backend, const struct rbh_filter *filter)
+{
+    struct rbh_mut_iterator *fsentries;
+    struct rbh_fsentry *fsentry;
+    size_t count = 0;
+
+    fsentries = rbh_backend_filter(backend, filter, &OPTIONS);
+    ck_assert_ptr_nonnull(fsentries);
+
+    while ((fsentry = rbh_mut_iter_next(fsentries)) != NULL) {
+        count++;
+        free(fsentry);
+    }
+    ck_assert_int_eq(errno, ENODATA);
+    rbh_mut_iter_destroy(fsentries);
+    return count;
+}
+
+START_TEST(cf_blocks)
+{
+    const struct rbh_filter_field UID = {
+        .fsentry = RBH_FP_STATX,
+        .statx = RBH_STATX_UID,
+    };
+    const struct rbh_filter *filters[2];
+    struct rbh_backend *backend;
+    struct rbh_filter *filter;
+    uint32_t block_size = 0;
+    char *path = snapshot_path();
+    size_t size = sizeof(block_size);
+
+    backend = files_new(path, 64);
+
+    /* The setting is stored in the snapshot */
+    ck_assert_int_eq(rbh_backend_get_option(backend, RBH_CBO_BLOCK_SIZE,
+                                            &block_size, &size), 0);
+    ck_assert_uint_eq(block_size, 64);
+
+    /* Ranges that span, start, and end in the middle of blocks */
+    filters[0] = rbh_filter_compare_uint64_new(RBH_FOP_GREATER_OR_EQUAL, &SIZE,
+                                               100);
+    ck_assert_ptr_nonnull(filters[0]);
+    filters[1] = rbh_filter_compare_int64_new(RBH_FOP_STRICTLY_LOWER, &SIZE,
+                                              300);
+    ck_assert_ptr_nonnull(filters[1]);
+
+    filter = rbh_filter_and_new(filters, 2);
+    ck_assert_ptr_nonnull(filter);
+    ck_assert_uint_eq(filter_count(backend, filter), 200);
+    free(filter);
+    free((void *)filters[0]);
+    free((void *)filters[1]);
+
+    /* Out of range values, on either side */
+    filter = rbh_filter_compare_int32_new(RBH_FOP_STRICTLY_GREATER, &SIZE, -1);
+    ck_assert_ptr_nonnull(filter);
+    /* And the root */
+    ck_assert_uint_eq(filter_count(backend, filter), FILE_COUNT + 1);
+    free(filter);
+
+    filter = rbh_filter_compare_uint64_new(RBH_FOP_STRICTLY_GREATER, &SIZE,
+                                           UINT64_MAX);
+    ck_assert_ptr_nonnull(filter);
+    ck_assert_uint_eq(filter_count(backend, filter), 0);
+    free(filter);
+
+    /* A dictionary encoded column */
+    filter = rbh_filter_compare_uint32_new(RBH_FOP_EQUAL, &UID, 1);
+    ck_assert_ptr_nonnull(filter);
+    ck_assert_uint_eq(filter_count(backend, filter), FILE_COUNT / 3);
+    free(filter);
+
+    filter = rbh_filter_compare_uint32_new(RBH_FOP_EQUAL, &UID, 3);
+    ck_assert_ptr_nonnull(filter);
+    ck_assert_uint_eq(filter_count(backend, filter), 0);
+    free(filter);
+
+    /* The root does not have a uid */
+    filter = rbh_filter_exists_new(&UID);
+    ck_assert_ptr_nonnull(filter);
+    ck_assert_uint_eq(filter_count(backend, filter), FILE_COUNT);
+    free(filter);
+
+    rbh_backend_destroy(backend);
+    snapshot_remove(path);
+}
+END_TEST
+
+START_TEST(cf_invalid)
+{
+    char *path = snapshot_path();
+    FILE *file;
+
+    file = fopen(path, "w");
+    ck_assert_ptr_nonnull(file);
+    ck_assert_int_eq(fputs("not a snapshot, but long enough", file), 1);
+    ck_assert_int_eq(fclose(file), 0);
+
+    errno = 0;
+    ck_assert_ptr_null(rbh_columnar_backend_new(path));
+    ck_assert_int_eq(errno, EINVAL);
+
+    snapshot_remove(path);
+}
+END_TEST
+
+/*----------------------------------------------------------------------------*
+ |                                   update                                   |
+ *----------------------------------------------------------------------------*/
+
+START_TEST(cu_snapshot)
+{
+    const struct rbh_fsevent FSEVENTS[] = {
+        {
+            .type = RBH_FET_UNLINK,
+            .id = FILE_ID,
+            .link = {
+                .parent_id = &ROOT_ID,
+                .name = "link",
+            },
+        },
+        {
+            .type = RBH_FET_DELETE,
+            .id = BIG_ID,
+        },
+    };
+    struct rbh_backend *backend;
+    struct rbh_filter *filter;
+    char *path = snapshot_path();
+    char names[64];
+
+    backend = tree_new(path);
+
+    /* Updates apply to the content of the snapshot */
+    update(backend, FSEVENTS, sizeof(FSEVENTS) / sizeof(*FSEVENTS));
+    filter_names(backend, NULL, &OPTIONS, names, sizeof(names));
+    ck_assert_str_eq(names, ",dir,file");
+
+    filter = rbh_filter_compare_uint64_new(RBH_FOP_EQUAL, &SIZE, 10);
+    ck_assert_ptr_nonnull(filter);
+    filter_names(backend, filter, &OPTIONS, names, sizeof(names));
+    ck_assert_str_eq(names, "file");
+    free(filter);
+
+    rbh_backend_destroy(backend);
+    snapshot_remove(path);
+}
+END_TEST
+
+/*----------------------------------------------------------------------------*
+ |                                   branch                                   |
+ *----------------------------------------------------------------------------*/
+
+START_TEST(cb_subtree)
+{
+    struct rbh_backend *backend;
+    struct rbh_fsentry *fsentry;
+    struct rbh_backend *branch;
+    char *path = snapshot_path();
+    char names[64];
+
+    backend = tree_new(path);
+
+    branch = rbh_backend_branch(backend, NULL, "/dir");
+    ck_assert_ptr_nonnull(branch);
+    rbh_backend_destroy(backend);
+
+    /* "link" is a hardlink of "file", but it is not in the subtree */
+    filter_names(branch, NULL, &OPTIONS, names, sizeof(names));
+    ck_assert_str_eq(names, "dir,file");
+
+    fsentry = rbh_backend_root(branch, &OPTIONS.projection);
+    ck_assert_ptr_nonnull(fsentry);
+    ck_assert_str_eq(fsentry->name, "dir");
+    free(fsentry);
+
+    rbh_backend_destroy(branch);
+    snapshot_remove(path);
+}
+END_TEST
+
+/*----------------------------------------------------------------------------*
+ |                                 histogram                                  |
+ *----------------------------------------------------------------------------*/
+
+START_TEST(ch_sizes)
+{
+    const int64_t BOUNDS[] = { 10, 100, 1000 };
+    const struct rbh_filter_field UID = {
+        .fsentry = RBH_FP_STATX,
+        .statx = RBH_STATX_UID,
+    };
+    struct rbh_columnar_bucket buckets[4];
+    struct rbh_backend *backend;
+    struct rbh_filter *filter;
+    char *path = snapshot_path();
+
+    backend = files_new(path, 128);
+
+    ck_assert_int_eq(rbh_columnar_backend_histogram(backend, NULL,
+                                                    RBH_STATX_SIZE, BOUNDS, 3,
+                                                    buckets), 0);
+    ck_assert_uint_eq(buckets[0].count, 10);
+    ck_assert_uint_eq(buckets[0].size, 45);
+    ck_assert_uint_eq(buckets[1].count, 90);
+    ck_assert_uint_eq(buckets[2].count, 900);
+    /* The root */
+    ck_assert_uint_eq(buckets[3].count, 1);
+    ck_assert_uint_eq(buckets[3].size, 4096);
+
+    filter = rbh_filter_compare_uint32_new(RBH_FOP_EQUAL, &UID, 0);
+    ck_assert_ptr_nonnull(filter);
+    ck_assert_int_eq(rbh_columnar_backend_histogram(backend, filter,
+                                                    RBH_STATX_SIZE, BOUNDS, 1,
+                                                    buckets), 0);
+    /* 0, 3, 6, and 9 */
+    ck_assert_uint_eq(buckets[0].count, 4);
+    ck_assert_uint_eq(buckets[0].size, 18);
+    ck_assert_uint_eq(buckets[1].count, FILE_COUNT / 3 + 1 - 4);
+    free(filter);
+
+    errno = 0;
+    ck_assert_int_eq(rbh_columnar_backend_histogram(backend, NULL,
+                                                    RBH_STATX_SIZE
+                                                  | RBH_STATX_UID, BOUNDS, 3,
+                                                    buckets), -1);
+    ck_assert_int_eq(errno, EINVAL);
+
+    rbh_backend_destroy(backend);
+    snapshot_remove(path);
+}
+END_TEST
+
+static Suite *
+unit_suite(void)
+{
+    Suite *suite;
+    TCase *tests;
+
+    suite = suite_create("columnar backend");
+    tests = tcase_create("filter");
+    tcase_add_test(tests, cf_empty);
+    tcase_add_test(tests, cf_tree);
+    tcase_add_test(tests, cf_blocks);
+    tcase_add_test(tests, cf_invalid);
+
+    suite_add_tcase(suite, tests);
+
+    tests = tcase_create("update");
+    tcase_add_test(tests, cu_snapshot);
+
+    suite_add_tcase(suite, tests);
+
+    tests = tcase_create("branch");
+    tcase_add_test(tests, cb_subtree);
+
+    suite_add_tcase(suite, tests);
+
+    tests = tcase_create("histogram");
+    tcase_add_test(tests, ch_sizes);
+
+    suite_add_tcase(suite, tests);
+
+    return suite;
+}
+
+int
+main(void)
+{
+    int number_failed;
+    Suite *suite;
+    SRunner *runner;
+
+    suite = unit_suite();
+    runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
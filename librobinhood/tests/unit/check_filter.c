@@ -1024,6 +1024,341 @@ START_TEST(rfc_basic)
 }
 END_TEST
 
+/*----------------------------------------------------------------------------*
+ |                            rbh_filter_matches()                            |
+ *----------------------------------------------------------------------------*/
+
+static struct rbh_fsentry *
+matches_fsentry_new(void)
+{
+    const struct rbh_id ID = {
+        .data = "abcd",
+        .size = 4,
+    };
+    const struct rbh_id PARENT_ID = {
+        .data = "efgh",
+        .size = 4,
+    };
+    const struct rbh_statx STATX = {
+        .stx_mask = RBH_STATX_TYPE | RBH_STATX_MODE | RBH_STATX_SIZE
+                  | RBH_STATX_MTIME_SEC,
+        .stx_mode = S_IFREG | 0640,
+        .stx_size = 1024,
+        .stx_mtime = {
+            .tv_sec = -1,
+        },
+    };
+    const struct rbh_value PATH = {
+        .type = RBH_VT_STRING,
+        .string = "/dir/file.c",
+    };
+    const struct rbh_value_pair NS_PAIRS[] = {
+        { .key = "path", .value = &PATH },
+    };
+    const struct rbh_value TAGS[] = {
+        {
+            .type = RBH_VT_STRING,
+            .string = "red",
+        },
+        {
+            .type = RBH_VT_STRING,
+            .string = "blue",
+        },
+    };
+    const struct rbh_value STRIPE_COUNT = {
+        .type = RBH_VT_UINT32,
+        .uint32 = 4,
+    };
+    const struct rbh_value_pair LAYOUT_PAIRS[] = {
+        { .key = "stripe_count", .value = &STRIPE_COUNT },
+    };
+    const struct rbh_value INODE_VALUES[] = {
+        {
+            .type = RBH_VT_SEQUENCE,
+            .sequence = {
+                .values = TAGS,
+                .count = 2,
+            },
+        },
+        {
+            .type = RBH_VT_MAP,
+            .map = {
+                .pairs = LAYOUT_PAIRS,
+                .count = 1,
+            },
+        },
+    };
+    const struct rbh_value_pair INODE_PAIRS[] = {
+        { .key = "tags", .value = &INODE_VALUES[0] },
+        { .key = "layout", .value = &INODE_VALUES[1] },
+    };
+    const struct rbh_value_map NS_XATTRS = {
+        .pairs = NS_PAIRS,
+        .count = 1,
+    };
+    const struct rbh_value_map INODE_XATTRS = {
+        .pairs = INODE_PAIRS,
+        .count = 2,
+    };
+
+    return rbh_fsentry_new(&ID, &PARENT_ID, "file.c", &STATX, &NS_XATTRS,
+                           &INODE_XATTRS, NULL);
+}
+
+START_TEST(rfm_null)
+{
+    struct rbh_fsentry *fsentry;
+
+    fsentry = matches_fsentry_new();
+    ck_assert_ptr_nonnull(fsentry);
+
+    ck_assert(rbh_filter_matches(NULL, fsentry));
+    free(fsentry);
+}
+END_TEST
+
+START_TEST(rfm_statx)
+{
+    const struct rbh_filter_field TYPE = {
+        .fsentry = RBH_FP_STATX,
+        .statx = RBH_STATX_TYPE,
+    };
+    const struct rbh_filter_field SIZE = {
+        .fsentry = RBH_FP_STATX,
+        .statx = RBH_STATX_SIZE,
+    };
+    const struct rbh_filter_field MTIME = {
+        .fsentry = RBH_FP_STATX,
+        .statx = RBH_STATX_MTIME_SEC,
+    };
+    const struct rbh_filter_field MODE = {
+        .fsentry = RBH_FP_STATX,
+        .statx = RBH_STATX_MODE,
+    };
+    const struct rbh_filter_field UID = {
+        .fsentry = RBH_FP_STATX,
+        .statx = RBH_STATX_UID,
+    };
+    struct rbh_fsentry *fsentry;
+    struct rbh_filter *filter;
+
+    fsentry = matches_fsentry_new();
+    ck_assert_ptr_nonnull(fsentry);
+
+    filter = rbh_filter_compare_int32_new(RBH_FOP_EQUAL, &TYPE, S_IFREG);
+    ck_assert_ptr_nonnull(filter);
+    ck_assert(rbh_filter_matches(filter, fsentry));
+    free(filter);
+
+    filter = rbh_filter_compare_int32_new(RBH_FOP_EQUAL, &TYPE, S_IFDIR);
+    ck_assert_ptr_nonnull(filter);
+    ck_assert(!rbh_filter_matches(filter, fsentry));
+    free(filter);
+
+    /* Integers of different types compare with one another */
+    filter = rbh_filter_compare_int64_new(RBH_FOP_STRICTLY_GREATER, &SIZE,
+                                          -1);
+    ck_assert_ptr_nonnull(filter);
+    ck_assert(rbh_filter_matches(filter, fsentry));
+    free(filter);
+
+    filter = rbh_filter_compare_uint64_new(RBH_FOP_STRICTLY_LOWER, &MTIME, 0);
+    ck_assert_ptr_nonnull(filter);
+    ck_assert(rbh_filter_matches(filter, fsentry));
+    free(filter);
+
+    filter = rbh_filter_compare_uint32_new(RBH_FOP_BITS_ALL_SET, &MODE, 0600);
+    ck_assert_ptr_nonnull(filter);
+    ck_assert(rbh_filter_matches(filter, fsentry));
+    free(filter);
+
+    filter = rbh_filter_compare_uint32_new(RBH_FOP_BITS_ANY_SET, &MODE, 0007);
+    ck_assert_ptr_nonnull(filter);
+    ck_assert(!rbh_filter_matches(filter, fsentry));
+    free(filter);
+
+    /* Missing fields never match comparisons */
+    filter = rbh_filter_compare_uint32_new(RBH_FOP_GREATER_OR_EQUAL, &UID, 0);
+    ck_assert_ptr_nonnull(filter);
+    ck_assert(!rbh_filter_matches(filter, fsentry));
+    free(filter);
+
+    filter = rbh_filter_exists_new(&UID);
+    ck_assert_ptr_nonnull(filter);
+    ck_assert(!rbh_filter_matches(filter, fsentry));
+    free(filter);
+
+    free(fsentry);
+}
+END_TEST
+
+START_TEST(rfm_regex)
+{
+    const struct rbh_filter_field NAME = {
+        .fsentry = RBH_FP_NAME,
+    };
+    const struct rbh_filter_field PATH = {
+        .fsentry = RBH_FP_NAMESPACE_XATTRS,
+        .xattr = "path",
+    };
+    struct rbh_fsentry *fsentry;
+    struct rbh_filter *filter;
+
+    fsentry = matches_fsentry_new();
+    ck_assert_ptr_nonnull(fsentry);
+
+    /* This is what rbh-find generates for -name '*.c' */
+    filter = rbh_filter_compare_regex_new(RBH_FOP_REGEX, &NAME,
+                                          "^.*\\.c(?!\n)$", 0);
+    ck_assert_ptr_nonnull(filter);
+    ck_assert(rbh_filter_matches(filter, fsentry));
+    free(filter);
+
+    filter = rbh_filter_compare_regex_new(RBH_FOP_REGEX, &PATH, "^/DIR/",
+                                          RBH_RO_CASE_INSENSITIVE);
+    ck_assert_ptr_nonnull(filter);
+    ck_assert(rbh_filter_matches(filter, fsentry));
+    free(filter);
+
+    filter = rbh_filter_compare_regex_new(RBH_FOP_REGEX, &PATH, "^/DIR/", 0);
+    ck_assert_ptr_nonnull(filter);
+    ck_assert(!rbh_filter_matches(filter, fsentry));
+    free(filter);
+
+    free(fsentry);
+}
+END_TEST
+
+START_TEST(rfm_xattrs)
+{
+    const struct rbh_filter_field TAGS = {
+        .fsentry = RBH_FP_INODE_XATTRS,
+        .xattr = "tags",
+    };
+    const struct rbh_filter_field STRIPE_COUNT = {
+        .fsentry = RBH_FP_INODE_XATTRS,
+        .xattr = "layout.stripe_count",
+    };
+    const struct rbh_value VALUES[] = {
+        {
+            .type = RBH_VT_STRING,
+            .string = "green",
+        },
+        {
+            .type = RBH_VT_STRING,
+            .string = "blue",
+        },
+    };
+    struct rbh_fsentry *fsentry;
+    struct rbh_filter *filter;
+
+    fsentry = matches_fsentry_new();
+    ck_assert_ptr_nonnull(fsentry);
+
+    /* A sequence matches if any of its elements does */
+    filter = rbh_filter_compare_string_new(RBH_FOP_EQUAL, &TAGS, "red");
+    ck_assert_ptr_nonnull(filter);
+    ck_assert(rbh_filter_matches(filter, fsentry));
+    free(filter);
+
+    filter = rbh_filter_compare_sequence_new(RBH_FOP_IN, &TAGS, VALUES, 2);
+    ck_assert_ptr_nonnull(filter);
+    ck_assert(rbh_filter_matches(filter, fsentry));
+    free(filter);
+
+    filter = rbh_filter_compare_sequence_new(RBH_FOP_IN, &TAGS, VALUES, 1);
+    ck_assert_ptr_nonnull(filter);
+    ck_assert(!rbh_filter_matches(filter, fsentry));
+    free(filter);
+
+    filter = rbh_filter_compare_int32_new(RBH_FOP_EQUAL, &STRIPE_COUNT, 4);
+    ck_assert_ptr_nonnull(filter);
+    ck_assert(rbh_filter_matches(filter, fsentry));
+    free(filter);
+
+    /* Strings never compare with integers */
+    filter = rbh_filter_compare_string_new(RBH_FOP_STRICTLY_GREATER,
+                                           &STRIPE_COUNT, "");
+    ck_assert_ptr_nonnull(filter);
+    ck_assert(!rbh_filter_matches(filter, fsentry));
+    free(filter);
+
+    free(fsentry);
+}
+END_TEST
+
+START_TEST(rfm_logical)
+{
+    const struct rbh_filter_field NAME = {
+        .fsentry = RBH_FP_NAME,
+    };
+    struct rbh_filter *filters[2];
+    struct rbh_fsentry *fsentry;
+    struct rbh_filter *filter;
+    struct rbh_filter *not;
+
+    fsentry = matches_fsentry_new();
+    ck_assert_ptr_nonnull(fsentry);
+
+    filters[0] = rbh_filter_compare_string_new(RBH_FOP_EQUAL, &NAME, "file.c");
+    ck_assert_ptr_nonnull(filters[0]);
+    filters[1] = rbh_filter_compare_string_new(RBH_FOP_EQUAL, &NAME, "file.h");
+    ck_assert_ptr_nonnull(filters[1]);
+
+    filter = rbh_filter_and_new((const struct rbh_filter * const *)filters, 2);
+    ck_assert_ptr_nonnull(filter);
+    ck_assert(!rbh_filter_matches(filter, fsentry));
+    free(filter);
+
+    filter = rbh_filter_or_new((const struct rbh_filter * const *)filters, 2);
+    ck_assert_ptr_nonnull(filter);
+    ck_assert(rbh_filter_matches(filter, fsentry));
+
+    not = rbh_filter_not_new(filter);
+    ck_assert_ptr_nonnull(not);
+    ck_assert(!rbh_filter_matches(not, fsentry));
+    free(not);
+    free(filter);
+
+    free(filters[1]);
+    free(filters[0]);
+    free(fsentry);
+}
+END_TEST
+
+/*----------------------------------------------------------------------------*
+ |                         rbh_filter_field_compare()                         |
+ *----------------------------------------------------------------------------*/
+
+START_TEST(rffc_basic)
+{
+    const struct rbh_filter_field SIZE = {
+        .fsentry = RBH_FP_STATX,
+        .statx = RBH_STATX_SIZE,
+    };
+    const struct rbh_filter_field NAME = {
+        .fsentry = RBH_FP_NAME,
+    };
+    const struct rbh_statx STATX = {
+        .stx_mask = RBH_STATX_SIZE,
+        .stx_size = 2048,
+    };
+    struct rbh_fsentry *first, *second;
+
+    first = matches_fsentry_new();
+    ck_assert_ptr_nonnull(first);
+    second = rbh_fsentry_new(NULL, NULL, "another", &STATX, NULL, NULL, NULL);
+    ck_assert_ptr_nonnull(second);
+
+    ck_assert_int_lt(rbh_filter_field_compare(&SIZE, first, second), 0);
+    ck_assert_int_gt(rbh_filter_field_compare(&NAME, first, second), 0);
+    ck_assert_int_eq(rbh_filter_field_compare(&NAME, first, first), 0);
+
+    free(second);
+    free(first);
+}
+END_TEST
+
 static Suite *
 unit_suite(void)
 {
@@ -1081,6 +1416,20 @@ unit_suite(void)
 
     suite_add_tcase(suite, tests);
 
+    tests = tcase_create("rbh_filter_matches");
+    tcase_add_test(tests, rfm_null);
+    tcase_add_test(tests, rfm_statx);
+    tcase_add_test(tests, rfm_regex);
+    tcase_add_test(tests, rfm_xattrs);
+    tcase_add_test(tests, rfm_logical);
+
+    suite_add_tcase(suite, tests);
+
+    tests = tcase_create("rbh_filter_field_compare");
+    tcase_add_test(tests, rffc_basic);
+
+    suite_add_tcase(suite, tests);
+
     return suite;
 }
 
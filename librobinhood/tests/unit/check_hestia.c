@@ -0,0 +1,235 @@
+/* This file is part of the RobinHood Library
+ * Copyright (C) 2024 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: LGPL-3.0-or-later
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check-compat.h"
+#include "robinhood/backends/hestia.h"
+#include "robinhood/statx.h"
+
+#include "hestia/hestia_iosea.h"
+
+/* The hestia backend is built against a mock of Hestia (cf. mock_hestia.c) */
+
+/*----------------------------------------------------------------------------*
+ |                                tests helpers                               |
+ *----------------------------------------------------------------------------*/
+
+static const struct rbh_filter_options OPTIONS = {
+    .projection = {
+        .fsentry_mask = RBH_FP_ALL,
+        .statx_mask = RBH_STATX_ALL,
+    },
+};
+
+static struct rbh_backend *
+hestia_with_concurrency(size_t concurrency)
+{
+    struct rbh_backend *hestia;
+
+    hestia = rbh_hestia_backend_new("");
+    ck_assert_ptr_nonnull(hestia);
+
+    ck_assert_int_eq(rbh_backend_set_option(hestia, RBH_HBO_CONCURRENCY,
+                                            &concurrency,
+                                            sizeof(concurrency)), 0);
+    return hestia;
+}
+
+/* Check that `hestia' yields every object of the mock, in order */
+static void
+check_objects(struct rbh_backend *hestia, size_t tiers, size_t objects)
+{
+    struct rbh_mut_iterator *fsentries;
+    struct rbh_fsentry *fsentry;
+
+    fsentries = rbh_backend_filter(hestia, NULL, &OPTIONS);
+    ck_assert_ptr_nonnull(fsentries);
+
+    for (size_t t = 0; t < tiers; t++) {
+        for (size_t n = 0; n < objects; n++) {
+            const struct rbh_value_pair *user;
+            char uuid[sizeof(((HestiaId *)NULL)->m_uuid)];
+            char tier[4];
+
+            snprintf(uuid, sizeof(uuid), "t%zu-o%zu", t, n);
+            snprintf(tier, sizeof(tier), "%zu", t);
+
+            fsentry = rbh_mut_iter_next(fsentries);
+            ck_assert_ptr_nonnull(fsentry);
+
+            ck_assert_uint_eq(fsentry->id.size, strlen(uuid) + 1);
+            ck_assert_str_eq(fsentry->id.data, uuid);
+            ck_assert_str_eq(fsentry->name, uuid);
+            ck_assert(fsentry->statx->stx_mask & RBH_STATX_SIZE);
+            ck_assert_uint_eq(fsentry->statx->stx_size, n);
+
+            ck_assert_uint_eq(fsentry->xattrs.inode.count, 2);
+            user = &fsentry->xattrs.inode.pairs[1];
+            ck_assert_str_eq(user->key, "user_metadata");
+            ck_assert_uint_eq(user->value->map.count, 1);
+            ck_assert_str_eq(user->value->map.pairs[0].key, "tier");
+            ck_assert_str_eq(user->value->map.pairs[0].value->string, tier);
+            free(fsentry);
+        }
+    }
+
+    errno = 0;
+    ck_assert_ptr_null(rbh_mut_iter_next(fsentries));
+    ck_assert_int_eq(errno, ENODATA);
+
+    rbh_mut_iter_destroy(fsentries);
+}
+
+/*----------------------------------------------------------------------------*
+ |                                   tests                                    |
+ *----------------------------------------------------------------------------*/
+
+START_TEST(hf_empty)
+{
+    struct rbh_backend *hestia;
+
+    mock_hestia_reset(0, 0, 0);
+    hestia = hestia_with_concurrency(4);
+    check_objects(hestia, 0, 0);
+    rbh_backend_destroy(hestia);
+}
+END_TEST
+
+static const size_t CONCURRENCIES[] = { 1, 3, RBH_HESTIA_MAX_CONCURRENCY };
+
+START_TEST(hf_objects)
+{
+    struct rbh_backend *hestia;
+
+    /* 3 tiers, one of which is empty, and windows that are not full */
+    mock_hestia_reset(3, 101, 0);
+    hestia = hestia_with_concurrency(CONCURRENCIES[_i]);
+    check_objects(hestia, 3, 101);
+    ck_assert_uint_eq(mock_hestia_get_attrs_calls(), 3 * 101);
+    rbh_backend_destroy(hestia);
+}
+END_TEST
+
+START_TEST(hf_concurrent)
+{
+    struct rbh_backend *hestia;
+
+    mock_hestia_reset(2, 32, 1000);
+    hestia = hestia_with_concurrency(8);
+    check_objects(hestia, 2, 32);
+    ck_assert_uint_ge(mock_hestia_max_in_flight(), 2);
+    ck_assert_uint_ge(8, mock_hestia_max_in_flight());
+    rbh_backend_destroy(hestia);
+
+    mock_hestia_reset(2, 32, 100);
+    hestia = hestia_with_concurrency(1);
+    check_objects(hestia, 2, 32);
+    ck_assert_uint_eq(mock_hestia_max_in_flight(), 1);
+    rbh_backend_destroy(hestia);
+}
+END_TEST
+
+START_TEST(hbo_concurrency)
+{
+    struct rbh_backend *hestia;
+    size_t concurrency;
+    size_t size;
+
+    hestia = rbh_hestia_backend_new("");
+    ck_assert_ptr_nonnull(hestia);
+
+    size = 0;
+    ck_assert_int_eq(rbh_backend_get_option(hestia, RBH_HBO_CONCURRENCY,
+                                            &concurrency, &size), -1);
+    ck_assert_int_eq(errno, EOVERFLOW);
+    ck_assert_uint_eq(size, sizeof(concurrency));
+
+    ck_assert_int_eq(rbh_backend_get_option(hestia, RBH_HBO_CONCURRENCY,
+                                            &concurrency, &size), 0);
+    ck_assert_uint_eq(concurrency, 16);
+
+    concurrency = 0;
+    ck_assert_int_eq(rbh_backend_set_option(hestia, RBH_HBO_CONCURRENCY,
+                                            &concurrency, sizeof(concurrency)),
+                     -1);
+    ck_assert_int_eq(errno, EINVAL);
+
+    concurrency = RBH_HESTIA_MAX_CONCURRENCY + 1;
+    ck_assert_int_eq(rbh_backend_set_option(hestia, RBH_HBO_CONCURRENCY,
+                                            &concurrency, sizeof(concurrency)),
+                     -1);
+    ck_assert_int_eq(errno, EINVAL);
+
+    ck_assert_int_eq(rbh_backend_set_option(hestia, RBH_HBO_CONCURRENCY,
+                                            &concurrency, 1), -1);
+    ck_assert_int_eq(errno, EINVAL);
+
+    concurrency = 4;
+    ck_assert_int_eq(rbh_backend_set_option(hestia, RBH_HBO_CONCURRENCY,
+                                            &concurrency, sizeof(concurrency)),
+                     0);
+    concurrency = 0;
+    ck_assert_int_eq(rbh_backend_get_option(hestia, RBH_HBO_CONCURRENCY,
+                                            &concurrency, &size), 0);
+    ck_assert_uint_eq(concurrency, 4);
+
+    ck_assert_int_eq(rbh_backend_set_option(hestia, RBH_HBO_CONCURRENCY + 1,
+                                            &concurrency, sizeof(concurrency)),
+                     -1);
+    ck_assert_int_eq(errno, ENOPROTOOPT);
+
+    rbh_backend_destroy(hestia);
+}
+END_TEST
+
+static Suite *
+unit_suite(void)
+{
+    Suite *suite;
+    TCase *tests;
+
+    suite = suite_create("hestia backend");
+    tests = tcase_create("filter");
+    tcase_add_test(tests, hf_empty);
+    tcase_add_loop_test(tests, hf_objects, 0,
+                        sizeof(CONCURRENCIES) / sizeof(*CONCURRENCIES));
+    tcase_add_test(tests, hf_concurrent);
+
+    suite_add_tcase(suite, tests);
+
+    tests = tcase_create("options");
+    tcase_add_test(tests, hbo_concurrency);
+
+    suite_add_tcase(suite, tests);
+
+    return suite;
+}
+
+int
+main(void)
+{
+    int number_failed;
+    Suite *suite;
+    SRunner *runner;
+
+    suite = unit_suite();
+    runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -120,6 +120,50 @@ START_TEST(lf_empty_root)
 }
 END_TEST
 
+/*----------------------------------------------------------------------------*
+ |                               lustre branch                                |
+ *----------------------------------------------------------------------------*/
+
+START_TEST(lb_lazy_size)
+{
+    static const char *DIRECTORY = "dir";
+    struct rbh_backend *branch;
+    struct rbh_backend *lustre;
+    size_t size = sizeof(bool);
+    bool lazy = true;
+
+    ck_assert_int_eq(mkdir(DIRECTORY, S_IRWXU), 0);
+
+    lustre = rbh_lustre_backend_new(".");
+    ck_assert_ptr_nonnull(lustre);
+    ck_assert_int_eq(
+            rbh_backend_set_option(lustre, RBH_LBO_LAZY_SIZE, &lazy,
+                                   sizeof(lazy)),
+            0);
+
+    branch = rbh_backend_branch(lustre, NULL, DIRECTORY);
+    ck_assert_ptr_nonnull(branch);
+    ck_assert_int_eq(branch->id, RBH_BI_LUSTRE);
+
+    /* Branches inherit the lazy size of their backend... */
+    lazy = false;
+    ck_assert_int_eq(
+            rbh_backend_get_option(branch, RBH_LBO_LAZY_SIZE, &lazy, &size),
+            0);
+    ck_assert(lazy);
+
+    /* ... and support the option themselves */
+    ck_assert_int_eq(
+            rbh_backend_set_option(branch, RBH_LBO_LAZY_SIZE, &lazy,
+                                   sizeof(lazy)),
+            0);
+
+    rbh_backend_destroy(branch);
+    rbh_backend_destroy(lustre);
+    ck_assert_int_eq(rmdir(DIRECTORY), 0);
+}
+END_TEST
+
 static Suite *
 unit_suite(void)
 {
@@ -135,6 +179,13 @@ unit_suite(void)
 
     suite_add_tcase(suite, tests);
 
+    tests = tcase_create("branch");
+    tcase_add_unchecked_fixture(tests, unchecked_setup_tmpdir,
+                                unchecked_teardown_tmpdir);
+    tcase_add_test(tests, lb_lazy_size);
+
+    suite_add_tcase(suite, tests);
+
     return suite;
 }
 
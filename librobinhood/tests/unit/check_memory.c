@@ -0,0 +1,522 @@
+/* This file is part of the RobinHood Library
+ * Copyright (C) 2024 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: LGPL-3.0-or-later
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "check-compat.h"
+#include "robinhood/backends/memory.h"
+#include "robinhood/fsevent.h"
+#include "robinhood/itertools.h"
+#include "robinhood/statx.h"
+
+/*----------------------------------------------------------------------------*
+ |                                tests helpers                               |
+ *----------------------------------------------------------------------------*/
+
+/* A tree of 4 entries, one of which has 2 links:
+ *
+ *     /            (root)
+ *     /dir         (directory)
+ *     /dir/file    (10 bytes, a hardlink of /link)
+ *     /link        (10 bytes, a hardlink of /dir/file)
+ *     /big         (1000 bytes)
+ */
+static const struct rbh_id ROOT_ID = { .data = "root", .size = 4 };
+static const struct rbh_id DIR_ID = { .data = "dir", .size = 3 };
+static const struct rbh_id FILE_ID = { .data = "file", .size = 4 };
+static const struct rbh_id BIG_ID = { .data = "big", .size = 3 };
+static const struct rbh_id NO_PARENT_ID = { .data = NULL, .size = 0 };
+
+static const struct rbh_statx DIR_STATX = {
+    .stx_mask = RBH_STATX_TYPE | RBH_STATX_MODE | RBH_STATX_SIZE,
+    .stx_mode = S_IFDIR | 0755,
+    .stx_size = 4096,
+};
+
+static const struct rbh_statx FILE_STATX = {
+    .stx_mask = RBH_STATX_TYPE | RBH_STATX_MODE | RBH_STATX_SIZE,
+    .stx_mode = S_IFREG | 0644,
+    .stx_size = 10,
+};
+
+static const struct rbh_statx BIG_STATX = {
+    .stx_mask = RBH_STATX_TYPE | RBH_STATX_MODE | RBH_STATX_SIZE,
+    .stx_mode = S_IFREG | 0600,
+    .stx_size = 1000,
+};
+
+static const struct rbh_value TIER = {
+    .type = RBH_VT_STRING,
+    .string = "fast",
+};
+
+static const struct rbh_value_pair TIER_PAIR = {
+    .key = "tier",
+    .value = &TIER,
+};
+
+static const struct rbh_fsevent TREE[] = {
+    {
+        .type = RBH_FET_UPSERT,
+        .id = ROOT_ID,
+        .upsert = {
+            .statx = &DIR_STATX,
+        },
+    },
+    {
+        .type = RBH_FET_LINK,
+        .id = ROOT_ID,
+        .link = {
+            .parent_id = &NO_PARENT_ID,
+            .name = "",
+        },
+    },
+    {
+        .type = RBH_FET_UPSERT,
+        .id = DIR_ID,
+        .upsert = {
+            .statx = &DIR_STATX,
+        },
+    },
+    {
+        .type = RBH_FET_LINK,
+        .id = DIR_ID,
+        .link = {
+            .parent_id = &ROOT_ID,
+            .name = "dir",
+        },
+    },
+    {
+        .type = RBH_FET_UPSERT,
+        .id = FILE_ID,
+        .xattrs = {
+            .pairs = &TIER_PAIR,
+            .count = 1,
+        },
+        .upsert = {
+            .statx = &FILE_STATX,
+        },
+    },
+    {
+        .type = RBH_FET_LINK,
+        .id = FILE_ID,
+        .link = {
+            .parent_id = &DIR_ID,
+            .name = "file",
+        },
+    },
+    {
+        .type = RBH_FET_LINK,
+        .id = FILE_ID,
+        .link = {
+            .parent_id = &ROOT_ID,
+            .name = "link",
+        },
+    },
+    {
+        .type = RBH_FET_UPSERT,
+        .id = BIG_ID,
+        .upsert = {
+            .statx = &BIG_STATX,
+        },
+    },
+    {
+        .type = RBH_FET_LINK,
+        .id = BIG_ID,
+        .link = {
+            .parent_id = &ROOT_ID,
+            .name = "big",
+        },
+    },
+};
+
+static void
+update(struct rbh_backend *backend, const struct rbh_fsevent *fsevents,
+       size_t count)
+{
+    struct rbh_iterator *iterator;
+
+    iterator = rbh_iter_array(fsevents, sizeof(*fsevents), count);
+    ck_assert_ptr_nonnull(iterator);
+    ck_assert_int_eq(rbh_backend_update(backend, iterator, false), count);
+    rbh_iter_destroy(iterator);
+}
+
+static struct rbh_backend *
+tree_new(const char *path)
+{
+    struct rbh_backend *backend;
+
+    backend = rbh_memory_backend_new(path);
+    ck_assert_ptr_nonnull(backend);
+    update(backend, TREE, sizeof(TREE) / sizeof(*TREE));
+    return backend;
+}
+
+static const struct rbh_filter_options OPTIONS = {
+    .projection = {
+        .fsentry_mask = RBH_FP_ALL,
+        .statx_mask = RBH_STATX_ALL,
+    },
+};
+
+/* Concatenate the names of the fsentries \p filter matches */
+static void
+filter_names(struct rbh_backend *backend, const struct rbh_filter *filter,
+             const struct rbh_filter_options *options, char *names,
+             size_t size)
+{
+    struct rbh_mut_iterator *fsentries;
+    struct rbh_fsentry *fsentry;
+    size_t count = 0;
+
+    fsentries = rbh_backend_filter(backend, filter, options);
+    ck_assert_ptr_nonnull(fsentries);
+
+    *names = '\0';
+    while ((fsentry = rbh_mut_iter_next(fsentries)) != NULL) {
+        ck_assert(fsentry->mask & RBH_FP_NAME);
+        if (count++ > 0)
+            strncat(names, ",", size - strlen(names) - 1);
+        strncat(names, fsentry->name, size - strlen(names) - 1);
+        free(fsentry);
+    }
+    ck_assert_int_eq(errno, ENODATA);
+    rbh_mut_iter_destroy(fsentries);
+}
+
+/*----------------------------------------------------------------------------*
+ |                                   filter                                   |
+ *----------------------------------------------------------------------------*/
+
+START_TEST(mf_empty)
+{
+    struct rbh_mut_iterator *fsentries;
+    struct rbh_backend *backend;
+
+    backend = rbh_memory_backend_new(NULL);
+    ck_assert_ptr_nonnull(backend);
+
+    fsentries = rbh_backend_filter(backend, NULL, &OPTIONS);
+    ck_assert_ptr_nonnull(fsentries);
+
+    errno = 0;
+    ck_assert_ptr_null(rbh_mut_iter_next(fsentries));
+    ck_assert_int_eq(errno, ENODATA);
+
+    rbh_mut_iter_destroy(fsentries);
+    rbh_backend_destroy(backend);
+}
+END_TEST
+
+START_TEST(mf_tree)
+{
+    const struct rbh_filter_field SIZE = {
+        .fsentry = RBH_FP_STATX,
+        .statx = RBH_STATX_SIZE,
+    };
+    const struct rbh_filter_field TIER_FIELD = {
+        .fsentry = RBH_FP_INODE_XATTRS,
+        .xattr = "tier",
+    };
+    const struct rbh_filter_sort BY_NAME = {
+        .field = {
+            .fsentry = RBH_FP_NAME,
+        },
+        .ascending = true,
+    };
+    const struct rbh_filter_sort BY_SIZE_THEN_NAME[] = {
+        {
+            .field = SIZE,
+            .ascending = false,
+        },
+        BY_NAME,
+    };
+    struct rbh_filter_options options = OPTIONS;
+    struct rbh_backend *backend;
+    struct rbh_fsentry *fsentry;
+    struct rbh_filter *filter;
+    char names[64];
+
+    backend = tree_new(NULL);
+
+    fsentry = rbh_backend_root(backend, &OPTIONS.projection);
+    ck_assert_ptr_nonnull(fsentry);
+    ck_assert_int_eq(fsentry->id.size, ROOT_ID.size);
+    ck_assert_mem_eq(fsentry->id.data, ROOT_ID.data, ROOT_ID.size);
+    free(fsentry);
+
+    /* Every link of every entry */
+    filter_names(backend, NULL, &OPTIONS, names, sizeof(names));
+    ck_assert_str_eq(names, ",dir,file,link,big");
+
+    /* An index lookup */
+    options.sort.items = &BY_NAME;
+    options.sort.count = 1;
+    filter = rbh_filter_compare_uint64_new(RBH_FOP_STRICTLY_GREATER, &SIZE,
+                                           10);
+    ck_assert_ptr_nonnull(filter);
+    filter_names(backend, filter, &options, names, sizeof(names));
+    ck_assert_str_eq(names, ",big,dir");
+    free(filter);
+
+    filter = rbh_filter_compare_uint64_new(RBH_FOP_EQUAL, &SIZE, 10);
+    ck_assert_ptr_nonnull(filter);
+    filter_names(backend, filter, &OPTIONS, names, sizeof(names));
+    ck_assert_str_eq(names, "file,link");
+    free(filter);
+
+    /* A parent lookup */
+    filter = rbh_filter_compare_binary_new(RBH_FOP_EQUAL,
+                                           &(struct rbh_filter_field){
+                                               .fsentry = RBH_FP_PARENT_ID,
+                                           },
+                                           DIR_ID.data, DIR_ID.size);
+    ck_assert_ptr_nonnull(filter);
+    filter_names(backend, filter, &OPTIONS, names, sizeof(names));
+    ck_assert_str_eq(names, "file");
+    free(filter);
+
+    /* A scan */
+    filter = rbh_filter_compare_string_new(RBH_FOP_EQUAL, &TIER_FIELD, "fast");
+    ck_assert_ptr_nonnull(filter);
+    filter_names(backend, filter, &OPTIONS, names, sizeof(names));
+    ck_assert_str_eq(names, "file,link");
+    free(filter);
+
+    /* Sort, skip, and limit */
+    options.sort.items = BY_SIZE_THEN_NAME;
+    options.sort.count = 2;
+    options.skip = 1;
+    options.limit = 2;
+    filter = rbh_filter_compare_uint64_new(RBH_FOP_GREATER_OR_EQUAL, &SIZE,
+                                           1000);
+    ck_assert_ptr_nonnull(filter);
+    filter_names(backend, filter, &options, names, sizeof(names));
+    ck_assert_str_eq(names, "dir,big");
+    free(filter);
+
+    rbh_backend_destroy(backend);
+}
+END_TEST
+
+/*----------------------------------------------------------------------------*
+ |                                   update                                   |
+ *----------------------------------------------------------------------------*/
+
+START_TEST(mu_unlink_delete)
+{
+    const struct rbh_fsevent FSEVENTS[] = {
+        {
+            .type = RBH_FET_UNLINK,
+            .id = FILE_ID,
+            .link = {
+                .parent_id = &ROOT_ID,
+                .name = "link",
+            },
+        },
+        {
+            .type = RBH_FET_DELETE,
+            .id = BIG_ID,
+        },
+        {
+            .type = RBH_FET_XATTR,
+            .id = FILE_ID,
+            .xattrs = {
+                .pairs = &(struct rbh_value_pair){ .key = "tier" },
+                .count = 1,
+            },
+        },
+    };
+    const struct rbh_filter_field TIER_FIELD = {
+        .fsentry = RBH_FP_INODE_XATTRS,
+        .xattr = "tier",
+    };
+    struct rbh_backend *backend;
+    struct rbh_filter *filter;
+    char names[64];
+
+    backend = tree_new(NULL);
+    update(backend, FSEVENTS, sizeof(FSEVENTS) / sizeof(*FSEVENTS));
+
+    filter_names(backend, NULL, &OPTIONS, names, sizeof(names));
+    ck_assert_str_eq(names, ",dir,file");
+
+    filter = rbh_filter_exists_new(&TIER_FIELD);
+    ck_assert_ptr_nonnull(filter);
+    filter_names(backend, filter, &OPTIONS, names, sizeof(names));
+    ck_assert_str_eq(names, "");
+    free(filter);
+
+    rbh_backend_destroy(backend);
+}
+END_TEST
+
+/*----------------------------------------------------------------------------*
+ |                                   branch                                   |
+ *----------------------------------------------------------------------------*/
+
+START_TEST(mb_subtree)
+{
+    struct rbh_backend *backend;
+    struct rbh_fsentry *fsentry;
+    struct rbh_backend *branch;
+    char names[64];
+
+    backend = tree_new(NULL);
+
+    branch = rbh_backend_branch(backend, NULL, "/dir");
+    ck_assert_ptr_nonnull(branch);
+    rbh_backend_destroy(backend);
+
+    /* "link" is a hardlink of "file", but it is not in the subtree */
+    filter_names(branch, NULL, &OPTIONS, names, sizeof(names));
+    ck_assert_str_eq(names, "dir,file");
+
+    fsentry = rbh_backend_root(branch, &OPTIONS.projection);
+    ck_assert_ptr_nonnull(fsentry);
+    ck_assert_str_eq(fsentry->name, "dir");
+    free(fsentry);
+
+    rbh_backend_destroy(branch);
+}
+END_TEST
+
+/*----------------------------------------------------------------------------*
+ |                                persistence                                 |
+ *----------------------------------------------------------------------------*/
+
+START_TEST(mp_dump_load)
+{
+    char path[] = "/tmp/rbh-memory.XXXXXX";
+    struct rbh_backend *backend;
+    char names[64];
+    int fd;
+
+    fd = mkstemp(path);
+    ck_assert_int_ge(fd, 0);
+    close(fd);
+    /* A missing file is an empty catalog */
+    ck_assert_int_eq(unlink(path), 0);
+
+    backend = tree_new(path);
+    rbh_backend_destroy(backend);
+
+    backend = rbh_memory_backend_new(path);
+    ck_assert_ptr_nonnull(backend);
+    filter_names(backend, NULL, &OPTIONS, names, sizeof(names));
+    ck_assert_str_eq(names, ",dir,file,link,big");
+    rbh_backend_destroy(backend);
+
+    ck_assert_int_eq(truncate(path, 12), 0);
+    errno = 0;
+    ck_assert_ptr_null(rbh_memory_backend_new(path));
+    ck_assert_int_eq(errno, EINVAL);
+
+    ck_assert_int_eq(unlink(path), 0);
+}
+END_TEST
+
+/*----------------------------------------------------------------------------*
+ |                                  options                                   |
+ *----------------------------------------------------------------------------*/
+
+START_TEST(mbo_indexes)
+{
+    const struct rbh_filter_field MODE = {
+        .fsentry = RBH_FP_STATX,
+        .statx = RBH_STATX_MODE,
+    };
+    uint32_t indexes = RBH_STATX_MODE;
+    size_t size = sizeof(indexes);
+    struct rbh_backend *backend;
+    struct rbh_filter *filter;
+    char names[64];
+
+    backend = tree_new(NULL);
+
+    ck_assert_int_eq(rbh_backend_get_option(backend, RBH_MEMBO_INDEXES,
+                                            &indexes, &size), 0);
+    ck_assert_uint_eq(indexes & RBH_STATX_SIZE, RBH_STATX_SIZE);
+
+    indexes = RBH_STATX_MODE;
+    ck_assert_int_eq(rbh_backend_set_option(backend, RBH_MEMBO_INDEXES,
+                                            &indexes, sizeof(indexes)), 0);
+
+    /* Results come in the order of the index */
+    filter = rbh_filter_compare_int32_new(RBH_FOP_LOWER_OR_EQUAL, &MODE, 0644);
+    ck_assert_ptr_nonnull(filter);
+    filter_names(backend, filter, &OPTIONS, names, sizeof(names));
+    ck_assert_str_eq(names, "big,file,link");
+    free(filter);
+
+    rbh_backend_destroy(backend);
+}
+END_TEST
+
+static Suite *
+unit_suite(void)
+{
+    Suite *suite;
+    TCase *tests;
+
+    suite = suite_create("memory backend");
+    tests = tcase_create("filter");
+    tcase_add_test(tests, mf_empty);
+    tcase_add_test(tests, mf_tree);
+
+    suite_add_tcase(suite, tests);
+
+    tests = tcase_create("update");
+    tcase_add_test(tests, mu_unlink_delete);
+
+    suite_add_tcase(suite, tests);
+
+    tests = tcase_create("branch");
+    tcase_add_test(tests, mb_subtree);
+
+    suite_add_tcase(suite, tests);
+
+    tests = tcase_create("persistence");
+    tcase_add_test(tests, mp_dump_load);
+
+    suite_add_tcase(suite, tests);
+
+    tests = tcase_create("options");
+    tcase_add_test(tests, mbo_indexes);
+
+    suite_add_tcase(suite, tests);
+
+    return suite;
+}
+
+int
+main(void)
+{
+    int number_failed;
+    Suite *suite;
+    SRunner *runner;
+
+    suite = unit_suite();
+    runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -15,10 +15,14 @@
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
+#include <sys/xattr.h>
+
 #include "check-compat.h"
 #include "robinhood/backends/posix.h"
+#include "robinhood/statx.h"
 #ifndef HAVE_STATX
 # include "robinhood/statx-compat.h"
 #endif
@@ -115,6 +119,306 @@ START_TEST(pf_empty_root)
 }
 END_TEST
 
+START_TEST(pf_hardlinks)
+{
+    static const char *TREE = "tree";
+    static const char * const NAMES[] = {
+        "tree/file", "tree/link-1", "tree/link-2",
+    };
+    const struct rbh_filter_options OPTIONS = {};
+    const size_t HARDLINK_CACHE = 16;
+    struct rbh_mut_iterator *fsentries;
+    struct rbh_fsentry *fsentry;
+    struct rbh_backend *posix;
+    size_t inodes = 0;
+    size_t links = 0;
+    int fd;
+
+    ck_assert_int_eq(mkdir(TREE, S_IRWXU), 0);
+    fd = open(NAMES[0], O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    ck_assert_int_ge(fd, 0);
+    ck_assert_int_eq(close(fd), 0);
+    for (size_t i = 1; i < sizeof(NAMES) / sizeof(*NAMES); i++)
+        ck_assert_int_eq(link(NAMES[0], NAMES[i]), 0);
+
+    posix = rbh_posix_backend_new(TREE);
+    ck_assert_ptr_nonnull(posix);
+    ck_assert_int_eq(
+            rbh_backend_set_option(posix, RBH_GBO_HARDLINK_CACHE,
+                                   &HARDLINK_CACHE, sizeof(HARDLINK_CACHE)),
+            0);
+
+    fsentries = rbh_backend_filter(posix, NULL, &OPTIONS);
+    ck_assert_ptr_nonnull(fsentries);
+
+    /* Skip the root */
+    fsentry = rbh_mut_iter_next(fsentries);
+    ck_assert_ptr_nonnull(fsentry);
+    free(fsentry);
+
+    while ((fsentry = rbh_mut_iter_next(fsentries)) != NULL) {
+        ck_assert(fsentry->mask & RBH_FP_ID);
+        ck_assert(fsentry->mask & RBH_FP_PARENT_ID);
+        ck_assert(fsentry->mask & RBH_FP_NAME);
+        ck_assert(fsentry->mask & RBH_FP_NAMESPACE_XATTRS);
+
+        if (fsentry->mask & RBH_FP_STATX) {
+            ck_assert_uint_eq(fsentry->statx->stx_nlink, 3);
+            inodes++;
+        } else {
+            ck_assert(!(fsentry->mask & RBH_FP_INODE_XATTRS));
+            links++;
+        }
+        free(fsentry);
+    }
+    ck_assert_int_eq(errno, ENODATA);
+    ck_assert_uint_eq(inodes, 1);
+    ck_assert_uint_eq(links, 2);
+
+    rbh_mut_iter_destroy(fsentries);
+    rbh_backend_destroy(posix);
+    for (size_t i = 0; i < sizeof(NAMES) / sizeof(*NAMES); i++)
+        ck_assert_int_eq(unlink(NAMES[i]), 0);
+    ck_assert_int_eq(rmdir(TREE), 0);
+}
+END_TEST
+
+START_TEST(pf_exclude)
+{
+    static const char * const DIRECTORIES[] = {
+        "tree", "tree/.snapshot", "tree/jobs", "tree/jobs/42",
+    };
+    static const char * const RULES[] = {
+        ".snapshot", "regex:^/jobs/[0-9]+$",
+    };
+    const struct rbh_filter_options OPTIONS = {
+        .projection = {
+            .fsentry_mask = RBH_FP_NAME,
+        },
+    };
+    const size_t DIRECTORY_COUNT = sizeof(DIRECTORIES) / sizeof(*DIRECTORIES);
+    struct rbh_mut_iterator *fsentries;
+    struct rbh_fsentry *fsentry;
+    struct rbh_backend *posix;
+
+    for (size_t i = 0; i < DIRECTORY_COUNT; i++)
+        ck_assert_int_eq(mkdir(DIRECTORIES[i], S_IRWXU), 0);
+
+    posix = rbh_posix_backend_new(DIRECTORIES[0]);
+    ck_assert_ptr_nonnull(posix);
+    ck_assert_int_eq(
+            rbh_backend_set_option(posix, RBH_GBO_EXCLUDE, RULES,
+                                   sizeof(RULES)),
+            0);
+
+    fsentries = rbh_backend_filter(posix, NULL, &OPTIONS);
+    ck_assert_ptr_nonnull(fsentries);
+
+    /* Only the root and "jobs" are left */
+    fsentry = rbh_mut_iter_next(fsentries);
+    ck_assert_ptr_nonnull(fsentry);
+    ck_assert_str_eq(fsentry->name, "");
+    free(fsentry);
+
+    fsentry = rbh_mut_iter_next(fsentries);
+    ck_assert_ptr_nonnull(fsentry);
+    ck_assert_str_eq(fsentry->name, "jobs");
+    free(fsentry);
+
+    errno = 0;
+    ck_assert_ptr_null(rbh_mut_iter_next(fsentries));
+    ck_assert_int_eq(errno, ENODATA);
+
+    rbh_mut_iter_destroy(fsentries);
+    rbh_backend_destroy(posix);
+    for (size_t i = DIRECTORY_COUNT; i > 0; i--)
+        ck_assert_int_eq(rmdir(DIRECTORIES[i - 1]), 0);
+}
+END_TEST
+
+static const struct rbh_value *
+inode_xattr(const struct rbh_fsentry *fsentry, const char *name)
+{
+    for (size_t i = 0; i < fsentry->xattrs.inode.count; i++) {
+        if (strcmp(fsentry->xattrs.inode.pairs[i].key, name) == 0)
+            return fsentry->xattrs.inode.pairs[i].value;
+    }
+    return NULL;
+}
+
+static struct rbh_fsentry *
+filter_file(struct rbh_backend *posix, const struct rbh_filter_options *options)
+{
+    struct rbh_mut_iterator *fsentries;
+    struct rbh_fsentry *fsentry;
+
+    fsentries = rbh_backend_filter(posix, NULL, options);
+    ck_assert_ptr_nonnull(fsentries);
+
+    /* Skip the root */
+    fsentry = rbh_mut_iter_next(fsentries);
+    ck_assert_ptr_nonnull(fsentry);
+    free(fsentry);
+
+    fsentry = rbh_mut_iter_next(fsentries);
+    ck_assert_ptr_nonnull(fsentry);
+
+    errno = 0;
+    ck_assert_ptr_null(rbh_mut_iter_next(fsentries));
+    ck_assert_int_eq(errno, ENODATA);
+
+    rbh_mut_iter_destroy(fsentries);
+    return fsentry;
+}
+
+START_TEST(pf_xattrs)
+{
+    static const char *TREE = "tree";
+    static const char *FILE_ = "tree/file";
+    static const char * const RULES[] = {
+        "user.", "!user.skipped",
+    };
+    const struct rbh_value_pair PROJECTED[] = {
+        { .key = "user.big" },
+    };
+    struct rbh_filter_options options = {
+        .projection = {
+            .fsentry_mask = RBH_FP_INODE_XATTRS,
+        },
+    };
+    const struct rbh_value *value;
+    struct rbh_fsentry *fsentry;
+    struct rbh_backend *posix;
+    char big[1024];
+    int fd;
+
+    memset(big, 'x', sizeof(big));
+    ck_assert_int_eq(mkdir(TREE, S_IRWXU), 0);
+    fd = open(FILE_, O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    ck_assert_int_ge(fd, 0);
+    if (fsetxattr(fd, "user.small", "abc", 3, 0)) {
+        /* The filesystem does not support user xattrs */
+        ck_assert_int_eq(errno, ENOTSUP);
+        goto out_close;
+    }
+    ck_assert_int_eq(fsetxattr(fd, "user.big", big, sizeof(big), 0), 0);
+    ck_assert_int_eq(fsetxattr(fd, "user.skipped", "", 0, 0), 0);
+
+    posix = rbh_posix_backend_new(TREE);
+    ck_assert_ptr_nonnull(posix);
+    ck_assert_int_eq(
+            rbh_backend_set_option(posix, RBH_GBO_XATTRS, RULES, sizeof(RULES)),
+            0);
+
+    /* Small and big values are both fetched, excluded ones are not */
+    fsentry = filter_file(posix, &options);
+    ck_assert(fsentry->mask & RBH_FP_INODE_XATTRS);
+    ck_assert_uint_eq(fsentry->xattrs.inode.count, 2);
+    value = inode_xattr(fsentry, "user.small");
+    ck_assert_ptr_nonnull(value);
+    ck_assert_uint_eq(value->binary.size, 3);
+    ck_assert_mem_eq(value->binary.data, "abc", 3);
+    value = inode_xattr(fsentry, "user.big");
+    ck_assert_ptr_nonnull(value);
+    ck_assert_uint_eq(value->binary.size, sizeof(big));
+    ck_assert_mem_eq(value->binary.data, big, sizeof(big));
+    ck_assert_ptr_null(inode_xattr(fsentry, "user.skipped"));
+    free(fsentry);
+
+    /* The projection further restricts the xattrs that are fetched */
+    options.projection.xattrs.inode.pairs = PROJECTED;
+    options.projection.xattrs.inode.count = 1;
+    fsentry = filter_file(posix, &options);
+    ck_assert_uint_eq(fsentry->xattrs.inode.count, 1);
+    ck_assert_str_eq(fsentry->xattrs.inode.pairs[0].key, "user.big");
+    free(fsentry);
+
+    /* ... and may not ask for any */
+    options.projection.fsentry_mask = RBH_FP_NAME;
+    fsentry = filter_file(posix, &options);
+    ck_assert(!(fsentry->mask & RBH_FP_INODE_XATTRS));
+    free(fsentry);
+
+    rbh_backend_destroy(posix);
+out_close:
+    ck_assert_int_eq(close(fd), 0);
+    ck_assert_int_eq(unlink(FILE_), 0);
+    ck_assert_int_eq(rmdir(TREE), 0);
+}
+END_TEST
+
+START_TEST(pf_xattrs_change)
+{
+    static const char *TREE = "tree";
+    static const char *FILE_ = "tree/file";
+    static const char * const BEFORE[] = {
+        "!user.skipped",
+    };
+    static const char * const AFTER[] = {
+        "user.skipped",
+    };
+    const struct rbh_filter_options OPTIONS = {
+        .projection = {
+            .fsentry_mask = RBH_FP_INODE_XATTRS,
+        },
+    };
+    struct rbh_mut_iterator *fsentries;
+    struct rbh_fsentry *fsentry;
+    struct rbh_backend *posix;
+    int fd;
+
+    ck_assert_int_eq(mkdir(TREE, S_IRWXU), 0);
+    fd = open(FILE_, O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    ck_assert_int_ge(fd, 0);
+    if (fsetxattr(fd, "user.kept", "abc", 3, 0)) {
+        /* The filesystem does not support user xattrs */
+        ck_assert_int_eq(errno, ENOTSUP);
+        goto out_close;
+    }
+    ck_assert_int_eq(fsetxattr(fd, "user.skipped", "", 0, 0), 0);
+
+    posix = rbh_posix_backend_new(TREE);
+    ck_assert_ptr_nonnull(posix);
+    ck_assert_int_eq(
+            rbh_backend_set_option(posix, RBH_GBO_XATTRS, BEFORE,
+                                   sizeof(BEFORE)),
+            0);
+
+    fsentries = rbh_backend_filter(posix, NULL, &OPTIONS);
+    ck_assert_ptr_nonnull(fsentries);
+
+    /* Skip the root */
+    fsentry = rbh_mut_iter_next(fsentries);
+    ck_assert_ptr_nonnull(fsentry);
+    free(fsentry);
+
+    /* Iterators keep the rules they were created with */
+    ck_assert_int_eq(
+            rbh_backend_set_option(posix, RBH_GBO_XATTRS, AFTER, sizeof(AFTER)),
+            0);
+
+    fsentry = rbh_mut_iter_next(fsentries);
+    ck_assert_ptr_nonnull(fsentry);
+    ck_assert_uint_eq(fsentry->xattrs.inode.count, 1);
+    ck_assert_str_eq(fsentry->xattrs.inode.pairs[0].key, "user.kept");
+    free(fsentry);
+
+    rbh_mut_iter_destroy(fsentries);
+
+    /* New iterators use the new rules */
+    fsentry = filter_file(posix, &OPTIONS);
+    ck_assert_uint_eq(fsentry->xattrs.inode.count, 1);
+    ck_assert_str_eq(fsentry->xattrs.inode.pairs[0].key, "user.skipped");
+    free(fsentry);
+
+    rbh_backend_destroy(posix);
+out_close:
+    ck_assert_int_eq(close(fd), 0);
+    ck_assert_int_eq(unlink(FILE_), 0);
+    ck_assert_int_eq(rmdir(TREE), 0);
+}
+END_TEST
+
 /*----------------------------------------------------------------------------*
  |                               posix options                                |
  *----------------------------------------------------------------------------*/
@@ -343,6 +647,128 @@ START_TEST(pbo_set_valids)
 }
 END_TEST
 
+/*----------------------------------------------------------------------------*
+ |                                posix branch                                |
+ *----------------------------------------------------------------------------*/
+
+START_TEST(pb_xattrs)
+{
+    static const char * const DIRECTORIES[] = {
+        "tree", "tree/dir",
+    };
+    static const char *FILE_ = "tree/dir/file";
+    static const char * const RULES[] = {
+        "!user.skipped",
+    };
+    const struct rbh_filter_options OPTIONS = {
+        .projection = {
+            .fsentry_mask = RBH_FP_INODE_XATTRS,
+        },
+    };
+    const size_t DIRECTORY_COUNT = sizeof(DIRECTORIES) / sizeof(*DIRECTORIES);
+    struct rbh_backend *branch;
+    struct rbh_fsentry *fsentry;
+    struct rbh_backend *posix;
+    int fd;
+
+    for (size_t i = 0; i < DIRECTORY_COUNT; i++)
+        ck_assert_int_eq(mkdir(DIRECTORIES[i], S_IRWXU), 0);
+    fd = open(FILE_, O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    ck_assert_int_ge(fd, 0);
+    if (fsetxattr(fd, "user.kept", "abc", 3, 0)) {
+        /* The filesystem does not support user xattrs */
+        ck_assert_int_eq(errno, ENOTSUP);
+        goto out_close;
+    }
+    ck_assert_int_eq(fsetxattr(fd, "user.skipped", "", 0, 0), 0);
+
+    posix = rbh_posix_backend_new(DIRECTORIES[0]);
+    ck_assert_ptr_nonnull(posix);
+    ck_assert_int_eq(
+            rbh_backend_set_option(posix, RBH_GBO_XATTRS, RULES, sizeof(RULES)),
+            0);
+
+    branch = rbh_backend_branch(posix, NULL, "/dir");
+    ck_assert_ptr_nonnull(branch);
+
+    /* Branches inherit the rules of their backend, and outlive them */
+    rbh_backend_destroy(posix);
+
+    fsentry = filter_file(branch, &OPTIONS);
+    ck_assert_uint_eq(fsentry->xattrs.inode.count, 1);
+    ck_assert_str_eq(fsentry->xattrs.inode.pairs[0].key, "user.kept");
+    free(fsentry);
+
+    rbh_backend_destroy(branch);
+out_close:
+    ck_assert_int_eq(close(fd), 0);
+    ck_assert_int_eq(unlink(FILE_), 0);
+    for (size_t i = DIRECTORY_COUNT; i > 0; i--)
+        ck_assert_int_eq(rmdir(DIRECTORIES[i - 1]), 0);
+}
+END_TEST
+
+START_TEST(pb_path)
+{
+    static const char * const DIRECTORIES[] = {
+        "tree", "tree/dir",
+    };
+    static const char *FILENAME = "tree/dir/file";
+    const struct rbh_filter_options OPTIONS = {
+        .projection = {
+            .fsentry_mask = RBH_FP_NAME,
+        },
+    };
+    const size_t DIRECTORY_COUNT = sizeof(DIRECTORIES) / sizeof(*DIRECTORIES);
+    struct rbh_mut_iterator *fsentries;
+    struct rbh_backend *branch;
+    struct rbh_fsentry *fsentry;
+    struct rbh_backend *posix;
+    int fd;
+
+    for (size_t i = 0; i < DIRECTORY_COUNT; i++)
+        ck_assert_int_eq(mkdir(DIRECTORIES[i], S_IRWXU), 0);
+    fd = open(FILENAME, O_WRONLY | O_CREAT | O_EXCL, S_IRWXU);
+    ck_assert_int_ge(fd, 0);
+    ck_assert_int_eq(close(fd), 0);
+
+    posix = rbh_posix_backend_new(DIRECTORIES[0]);
+    ck_assert_ptr_nonnull(posix);
+
+    /* The path of a branch is relative to the root of the backend */
+    branch = rbh_backend_branch(posix, NULL, "/dir/");
+    ck_assert_ptr_nonnull(branch);
+
+    /* A branch can be filtered more than once */
+    for (int i = 0; i < 2; i++) {
+        fsentries = rbh_backend_filter(branch, NULL, &OPTIONS);
+        ck_assert_ptr_nonnull(fsentries);
+
+        /* Skip the root */
+        fsentry = rbh_mut_iter_next(fsentries);
+        ck_assert_ptr_nonnull(fsentry);
+        free(fsentry);
+
+        fsentry = rbh_mut_iter_next(fsentries);
+        ck_assert_ptr_nonnull(fsentry);
+        ck_assert_str_eq(fsentry->name, "file");
+        free(fsentry);
+
+        errno = 0;
+        ck_assert_ptr_null(rbh_mut_iter_next(fsentries));
+        ck_assert_int_eq(errno, ENODATA);
+
+        rbh_mut_iter_destroy(fsentries);
+    }
+
+    rbh_backend_destroy(branch);
+    rbh_backend_destroy(posix);
+    ck_assert_int_eq(unlink(FILENAME), 0);
+    for (size_t i = DIRECTORY_COUNT; i > 0; i--)
+        ck_assert_int_eq(rmdir(DIRECTORIES[i - 1]), 0);
+}
+END_TEST
+
 static Suite *
 unit_suite(void)
 {
@@ -355,6 +781,18 @@ unit_suite(void)
                                 unchecked_teardown_tmpdir);
     tcase_add_test(tests, pf_missing_root);
     tcase_add_test(tests, pf_empty_root);
+    tcase_add_test(tests, pf_hardlinks);
+    tcase_add_test(tests, pf_exclude);
+    tcase_add_test(tests, pf_xattrs);
+    tcase_add_test(tests, pf_xattrs_change);
+
+    suite_add_tcase(suite, tests);
+
+    tests = tcase_create("branch");
+    tcase_add_unchecked_fixture(tests, unchecked_setup_tmpdir,
+                                unchecked_teardown_tmpdir);
+    tcase_add_test(tests, pb_path);
+    tcase_add_test(tests, pb_xattrs);
 
     suite_add_tcase(suite, tests);
 
@@ -0,0 +1,282 @@
+/* This file is part of the RobinHood Library
+ * Copyright (C) 2024 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: LGPL-3.0-or-later
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+
+#include "check-compat.h"
+#include "robinhood/backends/memory.h"
+#include "robinhood/fsevent.h"
+#include "robinhood/itertools.h"
+#include "robinhood/stats.h"
+#include "robinhood/statx.h"
+
+/*----------------------------------------------------------------------------*
+ |                                tests helpers                               |
+ *----------------------------------------------------------------------------*/
+
+static const struct rbh_id ROOT_ID = { .data = "root", .size = 4 };
+static const struct rbh_id FILE_ID = { .data = "file", .size = 4 };
+static const struct rbh_id NO_PARENT_ID = { .data = NULL, .size = 0 };
+
+static const struct rbh_statx DIR_STATX = {
+    .stx_mask = RBH_STATX_TYPE | RBH_STATX_MODE,
+    .stx_mode = S_IFDIR | 0755,
+};
+
+static const struct rbh_statx FILE_STATX = {
+    .stx_mask = RBH_STATX_TYPE | RBH_STATX_MODE,
+    .stx_mode = S_IFREG | 0644,
+};
+
+static const struct rbh_fsevent TREE[] = {
+    {
+        .type = RBH_FET_UPSERT,
+        .id = ROOT_ID,
+        .upsert = {
+            .statx = &DIR_STATX,
+        },
+    },
+    {
+        .type = RBH_FET_LINK,
+        .id = ROOT_ID,
+        .link = {
+            .parent_id = &NO_PARENT_ID,
+            .name = "",
+        },
+    },
+    {
+        .type = RBH_FET_UPSERT,
+        .id = FILE_ID,
+        .upsert = {
+            .statx = &FILE_STATX,
+        },
+    },
+    {
+        .type = RBH_FET_LINK,
+        .id = FILE_ID,
+        .link = {
+            .parent_id = &ROOT_ID,
+            .name = "file",
+        },
+    },
+};
+
+static const struct rbh_filter_options OPTIONS = {
+    .projection = {
+        .fsentry_mask = RBH_FP_ALL,
+        .statx_mask = RBH_STATX_ALL,
+    },
+};
+
+static struct rbh_backend *
+stats_new(void)
+{
+    struct rbh_backend *memory;
+    struct rbh_backend *backend;
+
+    memory = rbh_memory_backend_new(NULL);
+    ck_assert_ptr_nonnull(memory);
+
+    backend = rbh_stats_backend_new(memory, "rbh:memory:test");
+    ck_assert_ptr_nonnull(backend);
+    return backend;
+}
+
+/* The line of the report of \p backend that starts with \p prefix */
+static char *
+report_line(struct rbh_backend *backend, const char *prefix, char *line,
+            size_t size)
+{
+    FILE *report;
+
+    report = tmpfile();
+    ck_assert_ptr_nonnull(report);
+    ck_assert_int_eq(rbh_stats_backend_report(backend, report), 0);
+    rewind(report);
+
+    while (fgets(line, size, report)) {
+        if (strncmp(line, prefix, strlen(prefix)) == 0) {
+            fclose(report);
+            return line;
+        }
+    }
+
+    fclose(report);
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*
+ |                                   tests                                    |
+ *----------------------------------------------------------------------------*/
+
+START_TEST(sb_forward)
+{
+    struct rbh_mut_iterator *fsentries;
+    struct rbh_iterator *fsevents;
+    struct rbh_backend *backend;
+    struct rbh_fsentry *fsentry;
+    size_t count = 0;
+
+    backend = stats_new();
+    ck_assert_uint_eq(backend->id, RBH_BI_MEMORY);
+
+    fsevents = rbh_iter_array(TREE, sizeof(*TREE), sizeof(TREE) / sizeof(*TREE));
+    ck_assert_ptr_nonnull(fsevents);
+    ck_assert_int_eq(rbh_backend_update(backend, fsevents, false),
+                     sizeof(TREE) / sizeof(*TREE));
+    rbh_iter_destroy(fsevents);
+
+    fsentries = rbh_backend_filter(backend, NULL, &OPTIONS);
+    ck_assert_ptr_nonnull(fsentries);
+    while ((fsentry = rbh_mut_iter_next(fsentries)) != NULL) {
+        free(fsentry);
+        count++;
+    }
+    ck_assert_int_eq(errno, ENODATA);
+    ck_assert_uint_eq(count, 2);
+    rbh_mut_iter_destroy(fsentries);
+
+    fsentry = rbh_backend_root(backend, &OPTIONS.projection);
+    ck_assert_ptr_nonnull(fsentry);
+    ck_assert_str_eq(fsentry->name, "");
+    free(fsentry);
+
+    rbh_backend_destroy(backend);
+}
+END_TEST
+
+START_TEST(sb_counters)
+{
+    struct rbh_mut_iterator *fsentries;
+    struct rbh_iterator *fsevents;
+    struct rbh_backend *backend;
+    struct rbh_fsentry *fsentry;
+    char line[256];
+
+    backend = stats_new();
+
+    fsevents = rbh_iter_array(TREE, sizeof(*TREE), sizeof(TREE) / sizeof(*TREE));
+    ck_assert_ptr_nonnull(fsevents);
+    ck_assert_int_eq(rbh_backend_update(backend, fsevents, false),
+                     sizeof(TREE) / sizeof(*TREE));
+    rbh_iter_destroy(fsevents);
+
+    fsentries = rbh_backend_filter(backend, NULL, &OPTIONS);
+    ck_assert_ptr_nonnull(fsentries);
+    while ((fsentry = rbh_mut_iter_next(fsentries)) != NULL)
+        free(fsentry);
+    rbh_mut_iter_destroy(fsentries);
+
+    /* The memory backend does not support get_attribute */
+    ck_assert_int_eq(rbh_backend_get_attribute(backend, "x", NULL, NULL), -1);
+    ck_assert_int_eq(errno, ENOTSUP);
+
+    ck_assert_ptr_nonnull(report_line(backend, "  update ", line,
+                                      sizeof(line)));
+    ck_assert_uint_eq(strtoul(line + 16, NULL, 10), 1);
+
+    /* 2 fsentries, and the end of the iteration */
+    ck_assert_ptr_nonnull(report_line(backend, "  next ", line, sizeof(line)));
+    ck_assert_uint_eq(strtoul(line + 16, NULL, 10), 3);
+    ck_assert_uint_eq(strtoul(line + 27, NULL, 10), 0);
+
+    ck_assert_ptr_nonnull(report_line(backend, "  get_attribute ", line,
+                                      sizeof(line)));
+    ck_assert_uint_eq(strtoul(line + 16, NULL, 10), 1);
+    ck_assert_uint_eq(strtoul(line + 27, NULL, 10), 1);
+
+    ck_assert_ptr_nonnull(report_line(backend, "  4 fsevents", line,
+                                      sizeof(line)));
+    ck_assert_ptr_null(report_line(backend, "  root ", line, sizeof(line)));
+
+    rbh_backend_destroy(backend);
+}
+END_TEST
+
+START_TEST(sb_branch)
+{
+    struct rbh_backend *backend;
+    struct rbh_backend *branch;
+    char line[256];
+
+    backend = stats_new();
+    branch = rbh_backend_branch(backend, &ROOT_ID, NULL);
+    ck_assert_ptr_nonnull(branch);
+    ck_assert_uint_eq(branch->id, RBH_BI_MEMORY);
+
+    ck_assert_ptr_null(rbh_backend_root(branch, &OPTIONS.projection));
+
+    /* Branches share the counters of the backend they come from */
+    ck_assert_ptr_nonnull(report_line(backend, "  root ", line, sizeof(line)));
+    ck_assert_uint_eq(strtoul(line + 16, NULL, 10), 1);
+    ck_assert_ptr_nonnull(report_line(branch, "  branch ", line,
+                                      sizeof(line)));
+    ck_assert_uint_eq(strtoul(line + 16, NULL, 10), 1);
+
+    rbh_backend_destroy(backend);
+    rbh_backend_destroy(branch);
+}
+END_TEST
+
+START_TEST(sb_not_instrumented)
+{
+    struct rbh_backend *backend;
+
+    backend = rbh_memory_backend_new(NULL);
+    ck_assert_ptr_nonnull(backend);
+
+    errno = 0;
+    ck_assert_int_eq(rbh_stats_backend_report(backend, stderr), -1);
+    ck_assert_int_eq(errno, EINVAL);
+
+    rbh_backend_destroy(backend);
+}
+END_TEST
+
+static Suite *
+unit_suite(void)
+{
+    Suite *suite;
+    TCase *tests;
+
+    suite = suite_create("stats backend");
+    tests = tcase_create("operations");
+    tcase_add_test(tests, sb_forward);
+    tcase_add_test(tests, sb_counters);
+    tcase_add_test(tests, sb_branch);
+    tcase_add_test(tests, sb_not_instrumented);
+
+    suite_add_tcase(suite, tests);
+
+    return suite;
+}
+
+int
+main(void)
+{
+    int number_failed;
+    Suite *suite;
+    SRunner *runner;
+
+    suite = unit_suite();
+    runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
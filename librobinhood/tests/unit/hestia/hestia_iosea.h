@@ -0,0 +1,88 @@
+/* This file is part of the RobinHood Library
+ * Copyright (C) 2024 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: LGPL-3.0-or-later
+ */
+
+#ifndef MOCK_HESTIA_IOSEA_H
+#define MOCK_HESTIA_IOSEA_H
+
+/* A mock of the subset of Hestia's C API the hestia backend uses, so that it
+ * can be tested without a Hestia server (cf. mock_hestia.c).
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+typedef struct HestiaId {
+    char m_uuid[37];
+} HestiaId;
+
+typedef struct HestiaKeyValuePair {
+    char *m_key;
+    char *m_value;
+} HestiaKeyValuePair;
+
+typedef struct HestiaTierExtent {
+    uint8_t m_tier_index;
+    size_t m_size;
+} HestiaTierExtent;
+
+typedef struct HestiaObject {
+    char m_uuid[37];
+    size_t m_size;
+    time_t m_atime;
+    time_t m_ctime;
+    time_t m_mtime;
+    time_t m_creation_time;
+    HestiaTierExtent *m_tier_extents;
+    size_t m_num_tier_extents;
+    HestiaKeyValuePair *m_attrs;
+    size_t m_num_attrs;
+} HestiaObject;
+
+int
+hestia_initialize(const char *config_path, const char *token,
+                  const char *extra_config);
+
+int
+hestia_finish(void);
+
+int
+hestia_list_tiers(uint8_t **tier_ids, size_t *len);
+
+int
+hestia_free_tier_ids(uint8_t **tier_ids);
+
+int
+hestia_object_list(uint8_t tier_id, HestiaId **object_ids, size_t *num_ids);
+
+int
+hestia_object_get_attrs(HestiaId *object_id, HestiaObject *object);
+
+/*----------------------------------------------------------------------------*
+ |                                 mock only                                  |
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Replace the content of the mock with \p tiers tiers of \p objects objects
+ *
+ * The n-th object of tier t is named "t<t>-o<n>", it is n bytes large, and it
+ * has a single user attribute: "tier" = "<t>".
+ *
+ * Each call to hestia_object_get_attrs() takes \p latency microseconds.
+ */
+void
+mock_hestia_reset(size_t tiers, size_t objects, unsigned int latency);
+
+/** The number of calls to hestia_object_get_attrs() since the last reset */
+size_t
+mock_hestia_get_attrs_calls(void);
+
+/** The most calls to hestia_object_get_attrs() that were ever in flight */
+size_t
+mock_hestia_max_in_flight(void);
+
+#endif
@@ -0,0 +1,183 @@
+/* This file is part of the RobinHood Library
+ * Copyright (C) 2024 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: LGPL-3.0-or-later
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hestia/hestia_iosea.h"
+
+struct mock_object {
+    HestiaObject object;
+    HestiaTierExtent extent;
+    HestiaKeyValuePair attr;
+    char tier[4];
+};
+
+static struct {
+    size_t tiers;
+    size_t objects;
+    unsigned int latency;
+    HestiaId *ids;
+    struct mock_object *store;
+
+    pthread_mutex_t lock;
+    size_t calls;
+    size_t in_flight;
+    size_t max_in_flight;
+} mock = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void __attribute__((destructor))
+mock_hestia_destroy(void)
+{
+    free(mock.ids);
+    free(mock.store);
+}
+
+void
+mock_hestia_reset(size_t tiers, size_t objects, unsigned int latency)
+{
+    size_t count = tiers * objects;
+
+    mock_hestia_destroy();
+
+    mock.ids = calloc(count ? : 1, sizeof(*mock.ids));
+    mock.store = calloc(count ? : 1, sizeof(*mock.store));
+    if (mock.ids == NULL || mock.store == NULL)
+        abort();
+
+    for (size_t t = 0; t < tiers; t++) {
+        for (size_t n = 0; n < objects; n++) {
+            struct mock_object *mock_object = &mock.store[t * objects + n];
+            HestiaObject *object = &mock_object->object;
+
+            snprintf(mock.ids[t * objects + n].m_uuid,
+                     sizeof(mock.ids->m_uuid), "t%zu-o%zu", t, n);
+            strcpy(object->m_uuid, mock.ids[t * objects + n].m_uuid);
+            object->m_size = n;
+            object->m_atime = n;
+            object->m_ctime = n;
+            object->m_mtime = n;
+            object->m_creation_time = n;
+
+            mock_object->extent.m_tier_index = t;
+            mock_object->extent.m_size = n;
+            object->m_tier_extents = &mock_object->extent;
+            object->m_num_tier_extents = 1;
+
+            snprintf(mock_object->tier, sizeof(mock_object->tier), "%zu", t);
+            mock_object->attr.m_key = "tier";
+            mock_object->attr.m_value = mock_object->tier;
+            object->m_attrs = &mock_object->attr;
+            object->m_num_attrs = 1;
+        }
+    }
+
+    mock.tiers = tiers;
+    mock.objects = objects;
+    mock.latency = latency;
+    mock.calls = 0;
+    mock.in_flight = 0;
+    mock.max_in_flight = 0;
+}
+
+size_t
+mock_hestia_get_attrs_calls(void)
+{
+    return mock.calls;
+}
+
+size_t
+mock_hestia_max_in_flight(void)
+{
+    return mock.max_in_flight;
+}
+
+int
+hestia_initialize(const char *config_path, const char *token,
+                  const char *extra_config)
+{
+    (void)config_path;
+    (void)token;
+    (void)extra_config;
+    return 0;
+}
+
+int
+hestia_finish(void)
+{
+    return 0;
+}
+
+int
+hestia_list_tiers(uint8_t **tier_ids, size_t *len)
+{
+    *tier_ids = malloc(mock.tiers ? : 1);
+    if (*tier_ids == NULL)
+        return -1;
+
+    for (size_t t = 0; t < mock.tiers; t++)
+        (*tier_ids)[t] = t;
+    *len = mock.tiers;
+    return 0;
+}
+
+int
+hestia_free_tier_ids(uint8_t **tier_ids)
+{
+    free(*tier_ids);
+    *tier_ids = NULL;
+    return 0;
+}
+
+int
+hestia_object_list(uint8_t tier_id, HestiaId **object_ids, size_t *num_ids)
+{
+    if (tier_id >= mock.tiers) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    *object_ids = &mock.ids[tier_id * mock.objects];
+    *num_ids = mock.objects;
+    return 0;
+}
+
+int
+hestia_object_get_attrs(HestiaId *object_id, HestiaObject *object)
+{
+    size_t index = object_id - mock.ids;
+
+    pthread_mutex_lock(&mock.lock);
+    mock.calls++;
+    if (++mock.in_flight > mock.max_in_flight)
+        mock.max_in_flight = mock.in_flight;
+    pthread_mutex_unlock(&mock.lock);
+
+    usleep(mock.latency);
+
+    pthread_mutex_lock(&mock.lock);
+    mock.in_flight--;
+    pthread_mutex_unlock(&mock.lock);
+
+    if (index >= mock.tiers * mock.objects) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    *object = mock.store[index].object;
+    return 0;
+}
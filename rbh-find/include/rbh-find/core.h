@@ -36,6 +36,9 @@ struct find_context {
     /** If an action was already executed in this specific execution */
     bool action_done;
 
+    /** If the time spent in each phase of a query should be reported */
+    bool stats;
+
     /** The file that should contain the results of an action, if specified */
     FILE *action_file;
 
@@ -19,6 +19,8 @@ enum command_line_token {
     CLT_ACTION,
     CLT_SORT,
     CLT_RSORT,
+    CLT_STATS,
+    CLT_READ_AHEAD,
 };
 
 enum predicate {
@@ -97,12 +99,16 @@ predicate2str(enum predicate);
 enum action {
     ACT_COUNT,
     ACT_DELETE,
+    ACT_DU,
     ACT_EXEC,
     ACT_EXECDIR,
+    ACT_EXPLAIN,
     ACT_FLS,
     ACT_FPRINT,
     ACT_FPRINT0,
     ACT_FPRINTF,
+    ACT_FPRINT_BSON,
+    ACT_FPRINT_JSON,
     ACT_LS,
     ACT_OK,
     ACT_OKDIR,
@@ -9,10 +9,15 @@
 # include <config.h>
 #endif
 
+#include <inttypes.h>
 #include <string.h>
 #include <sysexits.h>
+#include <time.h>
+
+#include <robinhood/backends/mongo.h>
 
 #include "rbh-find/core.h"
+#include "rbh-find/utils.h"
 
 void
 ctx_finish(struct find_context *ctx)
@@ -55,10 +60,14 @@ str2command_line_token(struct find_context *ctx, const char *string)
         case 'r':
             if (strcmp(&string[2], "sort") == 0)
                 return CLT_RSORT;
+            if (strcmp(&string[2], "ead-ahead") == 0)
+                return CLT_READ_AHEAD;
             break;
         case 's':
             if (strcmp(&string[2], "ort") == 0)
                 return CLT_SORT;
+            if (strcmp(&string[2], "tats") == 0)
+                return CLT_STATS;
             break;
         }
         return ctx->pred_or_action_callback(string);
@@ -66,6 +75,74 @@ str2command_line_token(struct find_context *ctx, const char *string)
     return CLT_URI;
 }
 
+struct find_stats {
+    size_t entries;
+    uint64_t setup_ns;
+    uint64_t iterate_ns;
+    uint64_t actions_ns;
+};
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000UL + now.tv_nsec;
+}
+
+static void
+stats_reset(struct rbh_backend *backend)
+{
+    const struct rbh_mongo_stats ZERO = {};
+
+    if (backend->id == RBH_BI_MONGO)
+        /* Setting the stats resets them */
+        rbh_backend_set_option(backend, RBH_MBO_STATS, &ZERO, sizeof(ZERO));
+}
+
+static void
+stats_report(const char *uri, struct rbh_backend *backend,
+             const struct find_stats *stats)
+{
+    struct rbh_mongo_stats mongo;
+    size_t size = sizeof(mongo);
+
+    fprintf(stderr, "%s: %zu entries, setup %.3fs, iterate %.3fs, "
+            "actions %.3fs\n", uri, stats->entries, stats->setup_ns / 1e9,
+            stats->iterate_ns / 1e9, stats->actions_ns / 1e9);
+
+    if (backend->id != RBH_BI_MONGO
+     || rbh_backend_get_option(backend, RBH_MBO_STATS, &mongo, &size))
+        return;
+
+    /* Filtering happens on the server, while the documents are fetched */
+    fprintf(stderr, "%s: %" PRIu64 " documents, %" PRIu64 " bytes, "
+            "fetch %.3fs, decode %.3fs\n", uri, mongo.documents, mongo.bytes,
+            mongo.fetch_ns / 1e9, mongo.decode_ns / 1e9);
+}
+
+static void
+read_ahead(struct find_context *ctx, const char *_depth)
+{
+    uint64_t depth;
+    size_t size;
+
+    if (str2uint64_t(_depth, &depth) || depth > RBH_MONGO_MAX_READ_AHEAD)
+        error(EX_USAGE, 0, "invalid argument `%s' to -read-ahead", _depth);
+    size = depth;
+
+    /* Only mongo backends can read ahead */
+    for (size_t i = 0; i < ctx->backend_count; i++) {
+        struct rbh_backend *backend = ctx->backends[i];
+
+        if (backend->id == RBH_BI_MONGO
+         && rbh_backend_set_option(backend, RBH_MBO_READ_AHEAD, &size,
+                                   sizeof(size)))
+            error(EXIT_FAILURE, errno, "%s: cannot read ahead", ctx->uris[i]);
+    }
+}
+
 size_t
 _find(struct find_context *ctx, int backend_index, enum action action,
       const struct rbh_filter *filter, const struct rbh_filter_sort *sorts,
@@ -81,39 +158,190 @@ _find(struct find_context *ctx, int backend_index, enum action action,
             .count = sorts_count
         },
     };
+    struct rbh_backend *backend = ctx->backends[backend_index];
+    struct find_stats stats = {};
     struct rbh_mut_iterator *fsentries;
+    uint64_t start = 0;
     size_t count = 0;
 
-    fsentries = rbh_backend_filter(ctx->backends[backend_index], filter,
-                                   &OPTIONS);
+    if (ctx->stats) {
+        stats_reset(backend);
+        start = now_ns();
+    }
+
+    fsentries = rbh_backend_filter(backend, filter, &OPTIONS);
     if (fsentries == NULL)
         error_at_line(EXIT_FAILURE, errno, __FILE__, __LINE__,
                       "filter_fsentries");
 
+    if (ctx->stats)
+        stats.setup_ns = now_ns() - start;
+
     do {
         struct rbh_fsentry *fsentry;
 
+        if (ctx->stats)
+            start = now_ns();
+
         do {
             errno = 0;
             fsentry = rbh_mut_iter_next(fsentries);
         } while (fsentry == NULL && errno == EAGAIN);
 
+        if (ctx->stats)
+            stats.iterate_ns += now_ns() - start;
+
         if (fsentry == NULL)
             break;
 
+        if (ctx->stats)
+            start = now_ns();
+
         count += ctx->exec_action_callback(ctx, backend_index, action, fsentry);
         free(fsentry);
+
+        if (ctx->stats) {
+            stats.actions_ns += now_ns() - start;
+            stats.entries++;
+        }
     } while (true);
 
     if (errno != ENODATA)
         error_at_line(EXIT_FAILURE, errno, __FILE__, __LINE__,
                       "rbh_mut_iter_next");
 
+    /* Backends account for their own work when the iterator is destroyed */
     rbh_mut_iter_destroy(fsentries);
 
+    if (ctx->stats)
+        stats_report(ctx->uris[backend_index], backend, &stats);
+
     return count;
 }
 
+static void
+explain(struct find_context *ctx, int backend_index,
+        const struct rbh_filter *filter, const struct rbh_filter_sort *sorts,
+        size_t sorts_count)
+{
+    const struct rbh_filter_options OPTIONS = {
+        .projection = {
+            .fsentry_mask = RBH_FP_ALL,
+            .statx_mask = RBH_STATX_ALL,
+        },
+        .sort = {
+            .items = sorts,
+            .count = sorts_count
+        },
+    };
+    char *plan;
+
+    plan = rbh_backend_explain(ctx->backends[backend_index], filter, &OPTIONS);
+    if (plan == NULL)
+        error(EXIT_FAILURE, errno, "%s: cannot explain the query",
+              ctx->uris[backend_index]);
+
+    printf("%s\n", plan);
+    free(plan);
+}
+
+/* Whether a filter matches every fsentry, as the ones the parser builds when
+ * there is no predicate do
+ */
+static bool
+filter_is_empty(const struct rbh_filter *filter)
+{
+    if (filter == NULL)
+        return true;
+
+    if (filter->op != RBH_FOP_AND)
+        return false;
+
+    for (size_t i = 0; i < filter->logical.count; i++) {
+        if (!filter_is_empty(filter->logical.filters[i]))
+            return false;
+    }
+
+    return true;
+}
+
+/* Rollups are only maintained for directories: the whole backend (or branch)
+ * is summed up, predicates cannot narrow it down.
+ */
+static void
+du(struct find_context *ctx, int backend_index, const struct rbh_filter *filter)
+{
+    struct rbh_backend *backend = ctx->backends[backend_index];
+    struct rbh_mongo_rollup rollup = {
+        .id = NULL,
+    };
+
+    if (!filter_is_empty(filter))
+        error(EX_USAGE, 0, "predicates cannot be combined with `-du'");
+
+    if (backend->id != RBH_BI_MONGO)
+        error(EXIT_FAILURE, ENOTSUP, "%s: cannot sum up the backend",
+              ctx->uris[backend_index]);
+
+    if (rbh_backend_get_attribute(backend, RBH_MONGO_ROLLUP_ATTRIBUTE, &rollup,
+                                  NULL)) {
+        if (errno == RBH_BACKEND_ERROR)
+            error(EXIT_FAILURE, 0, "unhandled error: %s", rbh_backend_error);
+        error(EXIT_FAILURE, errno, "%s: cannot sum up the backend",
+              ctx->uris[backend_index]);
+    }
+
+    printf("%s: %" PRIu64 " bytes, %" PRIu64 " blocks, %" PRIu64 " files, "
+           "%" PRIu64 " directories\n", ctx->uris[backend_index], rollup.size,
+           rollup.blocks, rollup.files, rollup.directories);
+}
+
+/* Documents are written as they are exported by the backend, without being
+ * decoded into fsentries
+ */
+static void
+export(struct find_context *ctx, int backend_index,
+       enum rbh_document_format format, const struct rbh_filter *filter,
+       const struct rbh_filter_sort *sorts, size_t sorts_count)
+{
+    const struct rbh_filter_options OPTIONS = {
+        .projection = {
+            .fsentry_mask = RBH_FP_ALL,
+            .statx_mask = RBH_STATX_ALL,
+        },
+        .sort = {
+            .items = sorts,
+            .count = sorts_count
+        },
+    };
+    struct rbh_iterator *documents;
+
+    documents = rbh_backend_export(ctx->backends[backend_index], filter,
+                                   &OPTIONS, format);
+    if (documents == NULL)
+        error(EXIT_FAILURE, errno, "%s: cannot export documents",
+              ctx->uris[backend_index]);
+
+    do {
+        const struct rbh_document *document;
+
+        errno = 0;
+        document = rbh_iter_next(documents);
+        if (document == NULL)
+            break;
+
+        if (fwrite(document->data, document->size, 1, ctx->action_file) != 1
+         || (format == RBH_DF_JSON && putc('\n', ctx->action_file) == EOF))
+            error(EXIT_FAILURE, errno, "fwrite");
+    } while (true);
+
+    if (errno != ENODATA)
+        error_at_line(EXIT_FAILURE, errno, __FILE__, __LINE__,
+                      "rbh_iter_next");
+
+    rbh_iter_destroy(documents);
+}
+
 void
 find(struct find_context *ctx, enum action action, int *arg_idx,
      const struct rbh_filter *filter, const struct rbh_filter_sort *sorts,
@@ -126,8 +354,25 @@ find(struct find_context *ctx, enum action action, int *arg_idx,
 
     i += ctx->pre_action_callback(ctx, i, action);
 
-    for (size_t i = 0; i < ctx->backend_count; i++)
-        count += _find(ctx, i, action, filter, sorts, sorts_count);
+    for (size_t i = 0; i < ctx->backend_count; i++) {
+        switch (action) {
+        case ACT_DU:
+            du(ctx, i, filter);
+            break;
+        case ACT_EXPLAIN:
+            explain(ctx, i, filter, sorts, sorts_count);
+            break;
+        case ACT_FPRINT_BSON:
+            export(ctx, i, RBH_DF_BSON, filter, sorts, sorts_count);
+            break;
+        case ACT_FPRINT_JSON:
+            export(ctx, i, RBH_DF_JSON, filter, sorts, sorts_count);
+            break;
+        default:
+            count += _find(ctx, i, action, filter, sorts, sorts_count);
+            break;
+        }
+    }
 
     ctx->post_action_callback(ctx, i, action, count);
 
@@ -266,6 +511,16 @@ parse_expression(struct find_context *ctx, int *arg_idx,
             *sorts = sort_options_append(*sorts, (*sorts_count)++,
                                          str2field(ctx->argv[++i]), ascending);
             break;
+        case CLT_STATS:
+            /* Only applies to the actions that follow */
+            ctx->stats = true;
+            break;
+        case CLT_READ_AHEAD:
+            /* Only applies to the actions that follow */
+            if (i + 1 >= ctx->argc)
+                error(EX_USAGE, 0, "missing argument to '%s'", ctx->argv[i]);
+            read_ahead(ctx, ctx->argv[++i]);
+            break;
         case CLT_PREDICATE:
             /* Build a filter from the predicate and its arguments */
             tmp = ctx->parse_predicate_callback(ctx, &i);
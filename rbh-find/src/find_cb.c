@@ -73,6 +73,8 @@ find_pre_action(struct find_context *ctx, const int index,
     case ACT_FLS:
     case ACT_FPRINT:
     case ACT_FPRINT0:
+    case ACT_FPRINT_BSON:
+    case ACT_FPRINT_JSON:
         if (index + 1 >= ctx->argc)
             error(EX_USAGE, 0, "missing argument to `%s'", action2str(action));
 
@@ -253,6 +255,8 @@ find_post_action(struct find_context *ctx, const int index,
     case ACT_FLS:
     case ACT_FPRINT:
     case ACT_FPRINT0:
+    case ACT_FPRINT_BSON:
+    case ACT_FPRINT_JSON:
         filename = ctx->argv[index];
         if (fclose(ctx->action_file))
             error(EXIT_FAILURE, errno, "fclose: %s", filename);
@@ -346,6 +350,9 @@ find_predicate_or_action(const char *string)
             return CLT_PREDICATE;
         return CLT_ACTION;
     case 'e':
+        if (strcmp(&string[2], "xplain") == 0)
+            return CLT_ACTION;
+
         if (strncmp(&string[2], "xec", 3))
             return CLT_PREDICATE;
 
@@ -364,8 +364,13 @@ str2action(const char *string)
     case 'd':
         if (strcmp(&string[2], "elete") == 0)
             return ACT_DELETE;
+        if (strcmp(&string[2], "u") == 0)
+            return ACT_DU;
         break;
     case 'e':
+        if (strcmp(&string[2], "xplain") == 0)
+            return ACT_EXPLAIN;
+
         if (strncmp(&string[2], "xec", 3))
             break;
 
@@ -399,6 +404,12 @@ str2action(const char *string)
                 if (string[8] == '\0')
                     return ACT_FPRINTF;
                 break;
+            case '-':
+                if (strcmp(&string[8], "bson") == 0)
+                    return ACT_FPRINT_BSON;
+                if (strcmp(&string[8], "json") == 0)
+                    return ACT_FPRINT_JSON;
+                break;
             }
             break;
         }
@@ -460,12 +471,16 @@ str2action(const char *string)
 static const char *__action2str[] = {
     [ACT_COUNT]     = "-count",
     [ACT_DELETE]    = "-delete",
+    [ACT_DU]        = "-du",
     [ACT_EXEC]      = "-exec",
     [ACT_EXECDIR]   = "-execdir",
+    [ACT_EXPLAIN]   = "-explain",
     [ACT_FLS]       = "-fls",
     [ACT_FPRINT]    = "-fprint",
     [ACT_FPRINT0]   = "-fprint0",
     [ACT_FPRINTF]   = "-fprintf",
+    [ACT_FPRINT_BSON] = "-fprint-bson",
+    [ACT_FPRINT_JSON] = "-fprint-json",
     [ACT_LS]        = "-ls",
     [ACT_OK]        = "-ok",
     [ACT_OKDIR]     = "-okdir",
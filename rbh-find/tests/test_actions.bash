@@ -47,11 +47,124 @@ test_delete()
     fi
 }
 
+test_fprint_json()
+{
+    touch file
+    rbh-sync "rbh:posix:." "rbh:mongo:$testdb"
+
+    rbh_find "rbh:mongo:$testdb" -name file -fprint-json out
+    wc -l < out | difflines 1
+    grep -q '"file"' out || error "'file' should have been exported"
+}
+
+test_fprint_json_branch()
+{
+    mkdir -p dir/subdir
+    touch file dir/file dir/subdir/file
+    rbh-sync "rbh:posix:." "rbh:mongo:$testdb"
+
+    # Only the entries of the branch that match the filter
+    rbh_find "rbh:mongo:$testdb#dir" -name file -fprint-json out
+    wc -l < out | difflines 2
+
+    rbh_find "rbh:mongo:$testdb#dir" -fprint-json out
+    wc -l < out | difflines 4
+}
+
+test_explain_branch()
+{
+    mkdir dir
+    touch dir/file
+    rbh-sync "rbh:posix:." "rbh:mongo:$testdb"
+
+    # The query on the children of the root of the branch
+    rbh_find "rbh:mongo:$testdb#dir" -name file -explain > plan
+    grep -q '"ns.parent"' plan ||
+        error "the branch should be explained from the children of its root"
+    grep -q '"explain"' plan || error "the plan of the server is missing"
+}
+
+test_fprint_bson()
+{
+    touch file
+    rbh-sync "rbh:posix:." "rbh:mongo:$testdb"
+
+    rbh_find "rbh:mongo:$testdb" -name file -fprint-bson out
+
+    # A single document, that starts with its own length
+    od --address-radix=n --format=u4 --read-bytes=4 out | tr -d ' ' |
+        difflines "$(stat -c %s out)"
+}
+
+test_du()
+{
+    mkdir dir
+    echo "test data" > dir/file
+    touch file
+    rbh-sync --rollups "rbh:posix:." "rbh:mongo:$testdb"
+
+    rbh_find "rbh:mongo:$testdb" -du | grep -o '[0-9]* files, [0-9]* dir.*' |
+        difflines "2 files, 1 directories"
+    rbh_find "rbh:mongo:$testdb#dir" -du | grep -o '[0-9]* bytes' |
+        difflines "10 bytes"
+
+    rbh_find "rbh:mongo:$testdb" -name file -du &&
+        error "-du should not accept predicates"
+    return 0
+}
+
+test_read_ahead()
+{
+    for i in $(seq 64); do
+        truncate --size $i file$i
+    done
+    rbh-sync "rbh:posix:." "rbh:mongo:$testdb"
+
+    # Many more fsentries than are read ahead, in the order of the query
+    rbh_find "rbh:mongo:$testdb" -read-ahead 4 -type f -sort size -printf '%s\n' |
+        difflines $(seq 64)
+
+    rbh_find "rbh:mongo:$testdb" -read-ahead 0 -type f -count |
+        difflines "64 matching entries"
+    rbh_find "rbh:mongo:$testdb" -read-ahead -1 -count &&
+        error "-read-ahead should not accept negative depths"
+    return 0
+}
+
+test_read_ahead_error()
+{
+    touch file
+    rbh-sync "rbh:posix:." "rbh:mongo:$testdb"
+
+    # The server rejects the (invalid) regex once the query is sent, which the
+    # thread that reads ahead does
+    rbh_find "rbh:mongo:$testdb" -name '[' 2> expected &&
+        error "an invalid regex should be rejected"
+    rbh_find "rbh:mongo:$testdb" -read-ahead 4 -name '[' 2> actual &&
+        error "an invalid regex should be rejected while reading ahead"
+    diff expected actual
+}
+
+test_read_ahead_quit()
+{
+    for i in $(seq 64); do
+        touch file$i
+    done
+    rbh-sync "rbh:posix:." "rbh:mongo:$testdb"
+
+    # The backend is destroyed while its iterator still reads ahead
+    timeout 10 "$__rbh_find" "rbh:mongo:$testdb" -read-ahead 2 -quit ||
+        error "rbh-find should quit while the thread reading ahead waits"
+}
+
 ################################################################################
 #                                     MAIN                                     #
 ################################################################################
 
-declare -a tests=(test_exec test_delete)
+declare -a tests=(test_exec test_delete test_fprint_json
+                 test_fprint_json_branch test_explain_branch test_fprint_bson
+                 test_du test_read_ahead test_read_ahead_error
+                 test_read_ahead_quit)
 
 tmpdir=$(mktemp --directory)
 trap -- "rm -rf '$tmpdir'" EXIT
@@ -12,4 +12,54 @@
 struct rbh_mut_iterator *
 deduplicator_new(size_t batch_size, size_t flush_size, struct source *source);
 
+/**
+ * Keep the ids that are frequently updated longer in a deduplicator
+ *
+ * @param deduplicator  a deduplicator (with a non-zero batch size)
+ * @param max_age       how long (in seconds) a frequently updated id may stay
+ *                      in the deduplicator
+ *
+ * @return              0 on success, -1 on error and errno is set appropriately
+ *
+ * @error EINVAL        \p deduplicator does not deduplicate or \p max_age is 0
+ *
+ * By default, the least recently updated ids are flushed first. With this
+ * option, ids that keep receiving fsevents (eg. log files that are appended to)
+ * are flushed after the others, until they have been in the deduplicator for
+ * \p max_age seconds. Their fsevents are merged rather than committed over and
+ * over.
+ */
+int
+deduplicator_keep_hot(struct rbh_mut_iterator *deduplicator,
+                      unsigned int max_age);
+
+/**
+ * Create a deduplicator whose batch size varies with the fsevents it sees
+ *
+ * @param max_batch_size    the maximum number of ids to keep in memory
+ * @param flush_size        the number of ids to flush when \p max_batch_size
+ *                          ids are in memory (the ratio of the flush size to
+ *                          the batch size is kept as the batch size varies)
+ * @param latency           how long (in milliseconds) fsevents may wait
+ *                          before they are committed
+ * @param source            the source of the fsevents to deduplicate
+ *
+ * @return                  a pointer to a newly allocated deduplicator on
+ *                          success, NULL on error and errno is set
+ *                          appropriately
+ *
+ * @error EINVAL            any of \p max_batch_size, \p flush_size, or
+ *                          \p latency is 0, or \p flush_size is greater than
+ *                          \p max_batch_size
+ * @error ENOMEM            there was not enough memory available
+ *
+ * The batch size starts small and doubles as long as deduplication pays off,
+ * and it takes less than \p latency to fill a batch and commit the previous
+ * one. It is halved when that takes longer than \p latency, or when there is
+ * nothing to deduplicate. Every change is reported on stderr.
+ */
+struct rbh_mut_iterator *
+adaptive_deduplicator_new(size_t max_batch_size, size_t flush_size,
+                          unsigned int latency, struct source *source);
+
 #endif
@@ -0,0 +1,79 @@
+/* SPDX-License-Identifer: LGPL-3.0-or-later */
+
+#ifndef RBH_FSEVENTS_LUSTRE_IGNORE_H
+#define RBH_FSEVENTS_LUSTRE_IGNORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <linux/limits.h>
+#include <lustre/lustreapi.h>
+
+#include <robinhood/hashmap.h>
+#include <robinhood/sstack.h>
+
+enum ignore_reason {
+    IR_TYPE,
+    IR_JOBID,
+    IR_XATTR,
+    IR_SUBTREE,
+    IR_COUNT,
+};
+
+/* Resolve the path of \p fid, relative to the root of \p fsname ("" for the
+ * root itself)
+ */
+typedef int (*fid_path_t)(const char *fsname, const struct lu_fid *fid,
+                          char path[PATH_MAX]);
+
+struct ignore_rules {
+    const char *mdtname;
+    /* The name of the filesystem, to resolve the path of fids */
+    char *fsname;
+    fid_path_t fid_path;
+
+    /* A bitmap of the CL_* types of records to ignore */
+    uint64_t types;
+    /* fnmatch(3) patterns of jobids and xattr names */
+    const char **jobids;
+    size_t jobid_count;
+    const char **xattrs;
+    size_t xattr_count;
+    /* The paths (relative to the root of the filesystem) of the subtrees */
+    char **subtrees;
+    size_t subtree_count;
+
+    /* Whether fids are in one of the subtrees */
+    struct rbh_hashmap *ancestry;
+    struct rbh_sstack *fids;
+    size_t cached;
+
+    uint64_t dropped[IR_COUNT];
+    uint64_t dropped_types[CL_LAST];
+};
+
+/* The fid_path_t of a mounted filesystem, through llapi_fid2path() */
+int
+lustre_fid_path(const char *fsname, const struct lu_fid *fid,
+                char path[PATH_MAX]);
+
+/* Parse the \p ignore rules of a changelog reader (cf. source.h), exits on
+ * invalid rules
+ */
+void
+ignore_rules_init(struct ignore_rules *rules, const char *mdtname,
+                  const char * const *ignore, size_t count,
+                  fid_path_t fid_path);
+
+/* Whether \p record matches any of \p rules, in which case it is accounted for
+ * in rules->dropped
+ */
+bool
+ignore_record(struct ignore_rules *rules, struct changelog_rec *record);
+
+/* Report how many records were dropped, and why, then release \p rules */
+void
+ignore_rules_fini(struct ignore_rules *rules);
+
+#endif
@@ -38,4 +38,20 @@ sink_from_backend(struct rbh_backend *rbh_backend);
 struct sink *
 sink_from_file(FILE *file);
 
+/**
+ * Spread fsevents over several sinks, processed concurrently
+ *
+ * @param sinks     an array of \p count sinks (the returned sink takes
+ *                  ownership of them)
+ * @param count     the number of sinks in \p sinks (at least 1)
+ *
+ * @return          a pointer to a newly allocated sink
+ *
+ * Fsevents are partitioned by a hash of their id, so that every fsevent about
+ * an entry goes to the same sink, in order. Each batch is committed by every
+ * sink before the next one is processed.
+ */
+struct sink *
+sink_from_sinks(struct sink **sinks, size_t count);
+
 #endif
@@ -3,6 +3,7 @@
 #ifndef RBH_FSEVENTS_SOURCE_H
 #define RBH_FSEVENTS_SOURCE_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <time.h>
@@ -12,15 +13,31 @@
 struct source {
     struct rbh_iterator fsevents;
     const char *name;
+    /* Whether the source watches a live filesystem, in which case ENODATA
+     * only means there are no fsevents *yet*
+     */
+    bool live;
 };
 
 struct source *
 source_from_file(FILE *file);
 
+/* Records that match any of the \p ignore rules are dropped before they are
+ * turned into fsevents, the number of records dropped is reported on stderr
+ * when the source is destroyed. Rules are one of:
+ *   - type:TYPE, records of a given type (eg. CLOSE, ATIME);
+ *   - fid:FID, records about entries under a given directory;
+ *   - jobid:PATTERN, records whose jobid matches a fnmatch(3) pattern;
+ *   - xattr:PATTERN, SETXATTR records whose xattr matches a fnmatch(3) pattern.
+ */
 struct source *
-source_from_lustre_changelog(const char *mdtname);
+source_from_lustre_changelog(const char *mdtname, const char * const *ignore,
+                             size_t ignore_count);
 
 struct source *
 source_from_hestia_file(FILE *file);
 
+struct source *
+source_from_posix(const char *mount_path);
+
 #endif
@@ -26,6 +26,24 @@ struct rbh_value_map
 build_enrich_map(struct rbh_value *(*part_builder)(void *),
                  void *part_builder_arg);
 
+/* BSON results:
+ * { key : builder(arg) }
+ */
+struct rbh_value *
+fill_enrich(const char *key, struct rbh_value *(*builder)(void *), void *arg);
+
+/* BSON results:
+ * { "statx" : *(uint32_t *)arg }
+ */
+struct rbh_value *
+fill_statx(void *arg);
+
+/* BSON results:
+ * { "symlink" : "symlink" }
+ */
+struct rbh_value *
+build_symlink_enrich_map(void *arg);
+
 void *
 source_stack_alloc(const void *data, size_t size);
 
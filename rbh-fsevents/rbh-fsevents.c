@@ -17,6 +17,7 @@
 #include <sysexits.h>
 #include <unistd.h>
 
+#include <robinhood/backends/lustre.h>
 #include <robinhood/uri.h>
 #include <robinhood/utils.h>
 
@@ -28,10 +29,16 @@
 struct deduplicator_options {
     size_t batch_size;
     size_t flush_size;
+    /* How long fsevents may wait to be committed, 0 for a static batch size */
+    size_t latency;
+    /* How long hot ids may stay in the pool, 0 to flush the oldest first */
+    size_t max_age;
 };
 
 static const size_t DEFAULT_BATCH_SIZE = 100;
 static const size_t DEFAULT_FLUSH_SIZE = 50; /* 50% */
+/* Each worker has its own connection to the backend */
+#define MAX_WORKERS 256
 
 static void
 usage(void)
@@ -47,12 +54,18 @@ usage(void)
         "                        '-' for stdin;\n"
         "                        a Source URI (eg. src:file:/path/to/test, \n"
         "                        src:lustre:lustre-MDT0000,\n"
-        "                        src:hestia:/path/to/file).\n"
+        "                        src:hestia:/path/to/file,\n"
+        "                        src:posix:/mnt/fs).\n"
         "    DESTINATION     can be one of:\n"
         "                        '-' for stdout;\n"
         "                        a RobinHood URI (eg. rbh:mongo:test).\n"
         "\n"
         "Optional arguments:\n"
+        "    -a, --adaptive MILLISECONDS\n"
+        "                    let the batch size vary (up to --batch-size) with how\n"
+        "                    much fsevents deduplicate, so that they wait at most\n"
+        "                    MILLISECONDS to be committed, report every change on\n"
+        "                    stderr\n"
         "    -b, --batch-size NUMBER\n"
         "                    the number of fsevents to keep in memory for deduplication\n"
         "                    default: %lu\n"
@@ -64,8 +77,33 @@ usage(void)
         "                    (i.e. when we have reached the batch size)\n"
         "                    default: %lu\n"
         "    -h, --help      print this message and exit\n"
+        "    -i, --ignore RULE\n"
+        "                    drop the changelog records of a lustre SOURCE that match\n"
+        "                    RULE before they are processed (can be repeated), RULE\n"
+        "                    is one of:\n"
+        "                        type:TYPE, records of a type (eg. type:CLOSE);\n"
+        "                        fid:FID, records about entries under the\n"
+        "                        directory FID;\n"
+        "                        jobid:PATTERN, records whose jobid matches PATTERN;\n"
+        "                        xattr:PATTERN, SETXATTR records of xattrs whose\n"
+        "                        name matches PATTERN.\n"
+        "    -k, --keep-hot SECONDS\n"
+        "                    flush the entries that are updated frequently after the\n"
+        "                    others, unless they have been waiting for SECONDS\n"
+        "    -L, --lazy-size read the size of files from their LSOM rather than\n"
+        "                    from OSTs, when it is not stale (requires a lustre\n"
+        "                    MOUNTPOINT)\n"
         "    -l, --lustre    consider SOURCE is an MDT name\n"
         "    -r, --raw       do not enrich changelog records (default)\n"
+        "    -w, --workers NUMBER\n"
+        "                    the number of connections to a RobinHood DESTINATION to\n"
+        "                    commit fsevents with, concurrently (fsevents are\n"
+        "                    spread by entry)\n"
+        "                    default: 1\n"
+        "\n"
+        "A posix SOURCE watches the (local) filesystem mounted at /mnt/fs with fanotify\n"
+        "(or inotify, on older kernels) until rbh-fsevents is interrupted. Enrich its\n"
+        "records with the same mount point (eg. rbh:posix:/mnt/fs).\n"
         "\n"
         "Note that uploading raw records to a RobinHood backend will fail, they have to\n"
         "be enriched first.\n";
@@ -111,6 +149,16 @@ source_from_file_uri(const char *file_path,
     __builtin_unreachable();
 }
 
+/* The --ignore rules of a lustre source */
+static const char **ignore_rules;
+static size_t ignore_count;
+
+static void __attribute__((destructor))
+ignore_rules_exit(void)
+{
+    free(ignore_rules);
+}
+
 static struct source *
 source_from_uri(const char *uri)
 {
@@ -140,7 +188,7 @@ source_from_uri(const char *uri)
         source = source_from_file_uri(name, source_from_file);
     } else if (strcmp(raw_uri->path, "lustre") == 0) {
 #ifdef HAVE_LUSTRE
-        source = source_from_lustre_changelog(name);
+        source = source_from_lustre_changelog(name, ignore_rules, ignore_count);
 #else
         free(raw_uri);
         error(EX_USAGE, EINVAL, "MDT source is not available");
@@ -148,6 +196,8 @@ source_from_uri(const char *uri)
 #endif
     } else if (strcmp(raw_uri->path, "hestia") == 0) {
         source = source_from_file_uri(name, source_from_hestia_file);
+    } else if (strcmp(raw_uri->path, "posix") == 0) {
+        source = source_from_posix(name);
     }
 
     free(raw_uri);
@@ -183,7 +233,7 @@ source_exit(void)
 }
 
 static struct sink *
-sink_from_uri(const char *uri)
+sink_from_uri(const char *uri, size_t workers)
 {
     struct rbh_raw_uri *raw_uri;
 
@@ -192,8 +242,16 @@ sink_from_uri(const char *uri)
         error(EXIT_FAILURE, errno, "cannot parse URI '%s'", uri);
 
     if (strcmp(raw_uri->scheme, "rbh") == 0) {
+        struct sink *sinks[workers];
+
         free(raw_uri);
-        return (void *) sink_from_backend(rbh_backend_from_uri(uri));
+        if (workers == 1)
+            return sink_from_backend(rbh_backend_from_uri(uri));
+
+        /* One backend (ie. one connection) per worker */
+        for (size_t i = 0; i < workers; i++)
+            sinks[i] = sink_from_backend(rbh_backend_from_uri(uri));
+        return sink_from_sinks(sinks, workers);
     }
 
     free(raw_uri);
@@ -202,14 +260,17 @@ sink_from_uri(const char *uri)
 }
 
 static struct sink *
-sink_new(const char *arg)
+sink_new(const char *arg, size_t workers)
 {
-    if (strcmp(arg, "-") == 0)
+    if (strcmp(arg, "-") == 0) {
         /* DESTINATION is '-' (stdout) */
+        if (workers > 1)
+            error(EX_USAGE, 0, "--workers requires a RobinHood DESTINATION");
         return sink_from_file(stdout);
+    }
 
     if (is_uri(arg))
-        return sink_from_uri(arg);
+        return sink_from_uri(arg, workers);
 
     error(EX_USAGE, EINVAL, "%s", arg);
     __builtin_unreachable();
@@ -300,19 +361,32 @@ feed(struct sink *sink, struct source *source,
 {
     struct rbh_mut_iterator *deduplicator;
 
-    deduplicator = deduplicator_new(dedup_opts->batch_size,
-                                    dedup_opts->flush_size,
-                                    source);
+    if (dedup_opts->latency)
+        deduplicator = adaptive_deduplicator_new(dedup_opts->batch_size,
+                                                 dedup_opts->flush_size,
+                                                 dedup_opts->latency, source);
+    else
+        deduplicator = deduplicator_new(dedup_opts->batch_size,
+                                        dedup_opts->flush_size,
+                                        source);
     if (deduplicator == NULL)
         error(EXIT_FAILURE, errno, "deduplicator_new");
 
+    if (dedup_opts->max_age
+     && deduplicator_keep_hot(deduplicator, dedup_opts->max_age))
+        error(EXIT_FAILURE, errno, "deduplicator_keep_hot");
+
     while (true) {
         struct rbh_iterator *fsevents;
 
         errno = 0;
         fsevents = rbh_mut_iter_next(deduplicator);
-        if (fsevents == NULL)
+        if (fsevents == NULL) {
+            if (errno == ENODATA && source->live)
+                /* The filesystem is idle, wait for more events */
+                continue;
             break;
+        }
 
         if (builder != NULL)
             fsevents = build_enrich_iter(builder, fsevents);
@@ -364,6 +438,11 @@ int
 main(int argc, char *argv[])
 {
     const struct option LONG_OPTIONS[] = {
+        {
+            .name = "adaptive",
+            .has_arg = required_argument,
+            .val = 'a',
+        },
         {
             .name = "batch-size",
             .has_arg = required_argument,
@@ -383,21 +462,51 @@ main(int argc, char *argv[])
             .name = "help",
             .val = 'h',
         },
+        {
+            .name = "ignore",
+            .has_arg = required_argument,
+            .val = 'i',
+        },
+        {
+            .name = "keep-hot",
+            .has_arg = required_argument,
+            .val = 'k',
+        },
+        {
+            .name = "lazy-size",
+            .val = 'L',
+        },
         {
             .name = "raw",
             .val = 'r',
         },
+        {
+            .name = "workers",
+            .has_arg = required_argument,
+            .val = 'w',
+        },
         {}
     };
     struct deduplicator_options dedup_opts = {
         .batch_size = DEFAULT_BATCH_SIZE,
         .flush_size = DEFAULT_FLUSH_SIZE,
+        .latency = 0,
+        .max_age = 0,
     };
+    bool lazy_size = false;
+    size_t workers = 1;
     char c;
 
     /* Parse the command line */
-    while ((c = getopt_long(argc, argv, "b:e:f:hlr", LONG_OPTIONS, NULL)) != -1) {
+    while ((c = getopt_long(argc, argv, "a:b:e:f:hi:k:Llrw:", LONG_OPTIONS,
+                            NULL)) != -1) {
         switch (c) {
+        case 'a':
+            if (!str2size_t(optarg, &dedup_opts.latency)
+             || dedup_opts.latency == 0 || dedup_opts.latency > UINT_MAX)
+                error(EX_USAGE, 0, "'%s' is not a valid latency", optarg);
+
+            break;
         case 'b':
             if (!str2size_t(optarg, &dedup_opts.batch_size))
                 error(EXIT_FAILURE, 0, "'%s' is not an integer", optarg);
@@ -416,11 +525,39 @@ main(int argc, char *argv[])
         case 'h':
             usage();
             return 0;
+        case 'i': {
+            void *tmp;
+
+            tmp = reallocarray(ignore_rules, ignore_count + 1,
+                               sizeof(*ignore_rules));
+            if (tmp == NULL)
+                error(EXIT_FAILURE, errno, "reallocarray");
+
+            ignore_rules = tmp;
+            ignore_rules[ignore_count++] = optarg;
+            break;
+        }
+        case 'k':
+            if (!str2size_t(optarg, &dedup_opts.max_age)
+             || dedup_opts.max_age == 0 || dedup_opts.max_age > UINT_MAX)
+                error(EX_USAGE, 0, "'%s' is not a valid age", optarg);
+
+            break;
+        case 'L':
+            lazy_size = true;
+            break;
         case 'r':
             /* Ignore errors on close */
             mount_fd_exit();
             mount_fd = -1;
             break;
+        case 'w':
+            if (!str2size_t(optarg, &workers) || workers == 0
+             || workers > MAX_WORKERS)
+                error(EX_USAGE, 0, "'%s' is not a valid number of workers",
+                      optarg);
+
+            break;
         case '?':
         default:
             /* getopt_long() prints meaningful error messages itself */
@@ -434,13 +571,30 @@ main(int argc, char *argv[])
     if (dedup_opts.flush_size > dedup_opts.batch_size)
         dedup_opts.flush_size = dedup_opts.batch_size;
 
+    if (dedup_opts.latency && dedup_opts.batch_size == 0)
+        error(EX_USAGE, 0, "--adaptive requires deduplication (--batch-size)");
+    if (dedup_opts.max_age && dedup_opts.batch_size == 0)
+        error(EX_USAGE, 0, "--keep-hot requires deduplication (--batch-size)");
+
+    if (lazy_size) {
+        if (enrich_builder == NULL
+         || enrich_builder->backend->id != RBH_BI_LUSTRE)
+            error(EX_USAGE, 0, "--lazy-size requires a lustre MOUNTPOINT");
+
+        if (rbh_backend_set_option(enrich_builder->backend, RBH_LBO_LAZY_SIZE,
+                                   &lazy_size, sizeof(lazy_size)))
+            error(EXIT_FAILURE, errno, "cannot use lazy sizes");
+    }
+
     if (argc - optind < 2)
         error(EX_USAGE, 0, "not enough arguments");
     if (argc - optind > 2)
         error(EX_USAGE, 0, "too many arguments");
 
     source = source_new(argv[optind++]);
-    sink = sink_new(argv[optind++]);
+    if (ignore_count && strcmp(source->name, "lustre"))
+        error(EX_USAGE, 0, "--ignore requires a lustre SOURCE");
+    sink = sink_new(argv[optind++], workers);
 
     feed(sink, source, enrich_builder, strcmp(sink->name, "backend"),
          &dedup_opts);
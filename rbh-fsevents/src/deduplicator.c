@@ -5,7 +5,11 @@
 #endif
 
 #include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include <robinhood/itertools.h>
 #include <robinhood/ring.h>
@@ -13,12 +17,127 @@
 #include "deduplicator.h"
 #include "deduplicator/fsevent_pool.h"
 
+struct adaptive_sizing {
+    /* The bounds of the batch size */
+    size_t min_batch_size;
+    size_t max_batch_size;
+    /* The current batch and flush sizes */
+    size_t batch_size;
+    size_t flush_size;
+    /* The ratio of the flush size to the batch size (in percent) */
+    size_t flush_ratio;
+    /* How long fsevents may wait before they are committed (in ms) */
+    double latency;
+
+    /* When the current batch started filling up (ie. when the previous one
+     * was returned) and when it was full
+     */
+    struct timespec returned;
+    struct timespec filling;
+    /* How many fsevents were pushed in the pool since the last flush */
+    size_t pushed;
+};
+
 struct deduplicator {
     struct rbh_mut_iterator batches;
     struct rbh_fsevent_pool *pool;
     struct source *source;
+    struct adaptive_sizing *adaptive;
 };
 
+/*----------------------------------------------------------------------------*
+ |                              adaptive sizing                               |
+ *----------------------------------------------------------------------------*/
+
+/* The smallest batch size adaptive deduplicators use */
+static const size_t ADAPTIVE_MIN_BATCH_SIZE = 16;
+
+/* Below this ratio of pushed to flushed fsevents, batches are too small to
+ * deduplicate much (or there is nothing to deduplicate).
+ */
+static const double DEDUP_RATIO_LOW = 1.05;
+/* Above this ratio, bigger batches are worth it */
+static const double DEDUP_RATIO_HIGH = 1.25;
+
+static double
+elapsed_ms(const struct timespec *start, const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e3
+         + (end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static void
+adaptive_sizing_resize(struct adaptive_sizing *adaptive, size_t batch_size)
+{
+    if (batch_size < adaptive->min_batch_size)
+        batch_size = adaptive->min_batch_size;
+    if (batch_size > adaptive->max_batch_size)
+        batch_size = adaptive->max_batch_size;
+
+    adaptive->batch_size = batch_size;
+    adaptive->flush_size = batch_size * adaptive->flush_ratio / 100;
+    if (adaptive->flush_size == 0)
+        adaptive->flush_size = 1;
+}
+
+/* Grow or shrink the pool, from what the last batches tell about fsevents:
+ *   - if it took longer than `latency' to fill the pool and commit the last
+ *     batch, halve the pool so that fsevents do not wait as much;
+ *   - if deduplication pays off and there is room within the latency bound,
+ *     double the pool to deduplicate more;
+ *   - if there is (almost) nothing to deduplicate, halve the pool, a bigger
+ *     pool would only cost memory and delay fsevents.
+ *
+ * The time it took the sink to commit the last batch is that between the
+ * moment it was returned and the moment the deduplicator was asked for the next
+ * one. The deduplication ratio compares the fsevents pushed in the pool since
+ * the last flush to the number of fsevents that flush returned.
+ *
+ * This is called right before the pool is flushed, so that the flush makes room
+ * for the next batch if the pool shrank.
+ */
+static int
+adaptive_sizing_update(struct adaptive_sizing *adaptive,
+                       struct rbh_fsevent_pool *pool, bool idle)
+{
+    size_t flushed = rbh_fsevent_pool_flushed(pool);
+    size_t previous = adaptive->batch_size;
+    size_t batch_size = previous;
+    double fill, commit, rate, ratio;
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    fill = elapsed_ms(&adaptive->filling, &now);
+    commit = elapsed_ms(&adaptive->returned, &adaptive->filling);
+    /* Before the first flush, there is no telling */
+    ratio = flushed ? (double)adaptive->pushed / flushed : DEDUP_RATIO_LOW;
+    rate = fill > 0 ? adaptive->pushed * 1e3 / fill : 0.;
+
+    if (fill + commit > adaptive->latency)
+        batch_size /= 2;
+    /* An idle source flushes the pool before it is full, there is no point in
+     * growing it
+     */
+    else if (!idle && ratio >= DEDUP_RATIO_HIGH
+          && 2 * (fill + commit) < adaptive->latency)
+        batch_size *= 2;
+    else if (ratio < DEDUP_RATIO_LOW)
+        batch_size /= 2;
+
+    adaptive->pushed = 0;
+    adaptive_sizing_resize(adaptive, batch_size);
+    if (adaptive->batch_size != previous)
+        /* Report the new sizes, to help tune the bounds */
+        fprintf(stderr,
+                "batch size: %zu, flush size: %zu (%.2f fsevents per flushed "
+                "fsevent, %.0f fsevents/s, last batch committed in %.0fms)\n",
+                adaptive->batch_size, adaptive->flush_size, ratio, rate,
+                commit);
+
+    return rbh_fsevent_pool_resize(pool, adaptive->batch_size,
+                                   adaptive->flush_size);
+}
+
 /*----------------------------------------------------------------------------*
  |                                deduplicator                                |
  *----------------------------------------------------------------------------*/
@@ -27,15 +146,23 @@ static void *
 deduplicator_iter_next(void *iterator)
 {
     struct deduplicator *deduplicator = iterator;
+    struct adaptive_sizing *adaptive = deduplicator->adaptive;
     const struct rbh_fsevent *fsevent;
+    struct rbh_iterator *batch;
+    bool idle = false;
+
+    if (adaptive)
+        clock_gettime(CLOCK_MONOTONIC, &adaptive->filling);
 
     do {
         int rc;
 
         fsevent = rbh_iter_next(&deduplicator->source->fsevents);
         if (fsevent == NULL) {
-            if (errno == ENODATA)
+            if (errno == ENODATA) {
+                idle = true;
                 break;
+            }
 
             return NULL;
         }
@@ -50,7 +177,11 @@ deduplicator_iter_next(void *iterator)
             abort();
         } else if (rc == POOL_INSERT_FAILED) {
             return NULL;
-        } else if (rc == POOL_FULL) {
+        } else if (adaptive) {
+            adaptive->pushed++;
+        }
+
+        if (rc == POOL_FULL) {
             errno = 0;
             /* last insert filled the pool, flush it now */
             break;
@@ -64,7 +195,19 @@ deduplicator_iter_next(void *iterator)
      * be flushed. In the first case, it means that not enough events
      * were generated and we could not fill the pool completely.
      */
-    return rbh_fsevent_pool_flush(deduplicator->pool);
+    if (adaptive && adaptive->pushed > 0) {
+        int save_errno = errno;
+
+        if (adaptive_sizing_update(adaptive, deduplicator->pool, idle))
+            return NULL;
+        errno = save_errno;
+    }
+
+    batch = rbh_fsevent_pool_flush(deduplicator->pool);
+    if (adaptive)
+        clock_gettime(CLOCK_MONOTONIC, &adaptive->returned);
+
+    return batch;
 }
 
 static void
@@ -73,6 +216,7 @@ deduplicator_iter_destroy(void *iterator)
     struct deduplicator *deduplicator = iterator;
 
     rbh_fsevent_pool_destroy(deduplicator->pool);
+    free(deduplicator->adaptive);
     free(deduplicator);
 }
 
@@ -118,6 +262,7 @@ deduplicator_new(size_t batch_size, size_t flush_size,
         return NULL;
 
     deduplicator->source = source;
+    deduplicator->adaptive = NULL;
     if (batch_size == 0) {
         deduplicator->batches = NO_DEDUP_ITERATOR;
     } else {
@@ -128,3 +273,69 @@ deduplicator_new(size_t batch_size, size_t flush_size,
 
     return &deduplicator->batches;
 }
+
+int
+deduplicator_keep_hot(struct rbh_mut_iterator *batches, unsigned int max_age)
+{
+    struct deduplicator *deduplicator = (struct deduplicator *)batches;
+
+    if (batches->ops != &DEDUPLICATOR_ITER_OPS || max_age == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    rbh_fsevent_pool_keep_hot(deduplicator->pool, max_age);
+    return 0;
+}
+
+struct rbh_mut_iterator *
+adaptive_deduplicator_new(size_t max_batch_size, size_t flush_size,
+                          unsigned int latency, struct source *source)
+{
+    struct rbh_mut_iterator *batches;
+    struct deduplicator *deduplicator;
+    struct adaptive_sizing *adaptive;
+    int save_errno;
+
+    if (max_batch_size == 0 || flush_size == 0 || flush_size > max_batch_size
+     || latency == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    adaptive = malloc(sizeof(*adaptive));
+    if (adaptive == NULL)
+        return NULL;
+
+    batches = deduplicator_new(max_batch_size, flush_size, source);
+    if (batches == NULL) {
+        save_errno = errno;
+        free(adaptive);
+        errno = save_errno;
+        return NULL;
+    }
+    deduplicator = (struct deduplicator *)batches;
+
+    adaptive->min_batch_size = max_batch_size < ADAPTIVE_MIN_BATCH_SIZE ?
+        max_batch_size : ADAPTIVE_MIN_BATCH_SIZE;
+    adaptive->max_batch_size = max_batch_size;
+    adaptive->flush_ratio = flush_size * 100 / max_batch_size;
+    adaptive->latency = latency;
+    adaptive->pushed = 0;
+    clock_gettime(CLOCK_MONOTONIC, &adaptive->returned);
+    adaptive->filling = adaptive->returned;
+
+    /* Start small, and grow if it pays off */
+    adaptive_sizing_resize(adaptive, adaptive->min_batch_size);
+    if (rbh_fsevent_pool_resize(deduplicator->pool, adaptive->batch_size,
+                                adaptive->flush_size)) {
+        save_errno = errno;
+        free(adaptive);
+        rbh_mut_iter_destroy(batches);
+        errno = save_errno;
+        return NULL;
+    }
+
+    deduplicator->adaptive = adaptive;
+    return batches;
+}
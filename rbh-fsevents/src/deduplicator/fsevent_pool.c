@@ -13,9 +13,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sysexits.h>
+#include <time.h>
 
 struct rbh_fsevent_pool {
     size_t size; /* maximum number of ids allowed in the pool */
+    size_t capacity; /* maximum value of size (cf. rbh_fsevent_pool_resize) */
     struct rbh_hashmap *pool; /* container of lists of events per id */
     struct rbh_sstack *list_container; /* container of list elements */
     size_t flush_size; /* number of elements to be flushed when the pool is full
@@ -33,6 +35,11 @@ struct rbh_fsevent_pool {
     struct rbh_list_node free_ids; /* List of available struct rbh_id_node */
     struct rbh_list_node free_nodes; /* List of available struct rbh_list_node
                                       */
+    size_t flushed; /* number of fsevents returned by the last flush */
+    time_t max_age; /* how long hot ids may stay in the pool (in seconds), 0 if
+                     * ids are flushed oldest first regardless of their
+                     * frequency (cf. rbh_fsevent_pool_keep_hot)
+                     */
 };
 
 struct rbh_list_node_wrapper {
@@ -48,6 +55,8 @@ struct rbh_fsevent_node {
 struct rbh_id_node {
     const struct rbh_id *id;
     struct rbh_list_node link;
+    unsigned int hits; /* number of fsevents deduplicated into this id */
+    time_t inserted; /* when the id entered the pool */
 };
 
 static bool
@@ -114,6 +123,9 @@ rbh_fsevent_pool_new(size_t batch_size, size_t flush_size,
 
     pool->flush_size = flush_size;
     pool->size = batch_size;
+    pool->capacity = batch_size;
+    pool->flushed = 0;
+    pool->max_age = 0;
     rbh_list_init(&pool->ids);
     pool->count = 0;
     rbh_list_init(&pool->events);
@@ -151,7 +163,8 @@ rbh_fsevent_pool_destroy(struct rbh_fsevent_pool *pool)
 static bool
 rbh_fsevent_pool_is_full(struct rbh_fsevent_pool *pool)
 {
-    return pool->count == pool->size;
+    /* A pool may hold more ids than its size right after it shrank */
+    return pool->count >= pool->size;
 }
 
 static struct rbh_list_node *
@@ -220,11 +233,25 @@ fsevent_node_free(struct rbh_fsevent_pool *pool, struct rbh_fsevent_node *node)
     }
 }
 
+static time_t
+monotonic_seconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return now.tv_sec;
+}
+
 static struct rbh_id_node *
 id_node_alloc(struct rbh_fsevent_pool *pool)
 {
-    if (!rbh_list_empty(&pool->free_ids))
-        return rbh_list_first(&pool->free_ids, struct rbh_id_node, link);
+    if (!rbh_list_empty(&pool->free_ids)) {
+        struct rbh_id_node *id;
+
+        id = rbh_list_first(&pool->free_ids, struct rbh_id_node, link);
+        rbh_list_del(&id->link);
+        return id;
+    }
 
     return rbh_sstack_push(pool->list_container, NULL,
                            sizeof(struct rbh_id_node));
@@ -272,6 +299,8 @@ rbh_fsevent_pool_insert_new_entry(struct rbh_fsevent_pool *pool,
         return rc;
 
     id_node->id = &node->fsevent.id;
+    id_node->hits = 0;
+    id_node->inserted = pool->max_age ? monotonic_seconds() : 0;
 
     rbh_list_add_tail(&pool->ids, &id_node->link);
 
@@ -813,6 +842,7 @@ deduplicate_event(struct rbh_fsevent_pool *pool, struct rbh_list_node *events,
 
     id = id_list_find(pool, &event->id);
     move_list_node_at_tail(&pool->ids, &id->link);
+    id->hits++;
 
     switch (event->type) {
     case RBH_FET_UPSERT:
@@ -868,6 +898,8 @@ rbh_fsevent_pool_push(struct rbh_fsevent_pool *pool,
         if (rc)
             return POOL_INSERT_FAILED;
 
+        /* The lookups of deduplicate_event() may leave errno set */
+        errno = 0;
     } else {
         /* we do not insert NULL values in the map */
         assert(errno == ENOENT);
@@ -887,37 +919,113 @@ rbh_fsevent_pool_push(struct rbh_fsevent_pool *pool,
     return POOL_INSERT_OK;
 }
 
+static void
+flush_id(struct rbh_fsevent_pool *pool, struct rbh_id_node *id)
+{
+    struct rbh_fsevent_node *elem;
+    struct rbh_list_node *events;
+
+    events = (void *)rbh_hashmap_pop(pool->pool, id->id);
+    assert(events);
+
+    rbh_list_foreach(events, elem, link)
+        pool->flushed++;
+    rbh_list_splice_tail(&pool->events, events);
+
+    id_node_free(pool, id);
+    event_list_free(pool, events);
+    pool->count--;
+}
+
+/* Ids that were deduplicated at least this many times since they were last
+ * spared are hot
+ */
+#define HOT_HITS 2
+
+static bool
+id_is_hot(struct rbh_id_node *id, time_t now, time_t max_age)
+{
+    return id->hits >= HOT_HITS && now - id->inserted < max_age;
+}
+
+static bool
+needs_flushing(struct rbh_fsevent_pool *pool, size_t count)
+{
+    /* After the pool shrank, flush enough ids to make room for flush_size new
+     * ones, even if that means flushing more than flush_size ids.
+     */
+    return pool->count > 0 && (count < pool->flush_size
+                            || pool->count + pool->flush_size > pool->size);
+}
+
 struct rbh_iterator *
 rbh_fsevent_pool_flush(struct rbh_fsevent_pool *pool)
 {
     struct rbh_fsevent_node *elem, *tmp;
+    struct rbh_id_node *id, *next;
     size_t count = 0;
 
     rbh_list_foreach_safe(&pool->events, elem, tmp, link) {
         fsevent_node_free(pool, elem);
     }
 
+    pool->flushed = 0;
     if (pool->count == 0)
         return NULL;
 
-    while (pool->count > 0 && count < pool->flush_size) {
-        struct rbh_list_node *first_events;
-        struct rbh_id_node *first_id;
-        struct rbh_list_node *events;
+    if (pool->max_age) {
+        time_t now = monotonic_seconds();
 
-        first_id = rbh_list_first(&pool->ids, struct rbh_id_node, link);
-        first_events = (void *)rbh_hashmap_get(pool->pool, first_id->id);
-        assert(first_events);
+        /* Flush cold ids first, oldest first, and spare hot ones. Those have
+         * to keep receiving fsevents to be spared again.
+         */
+        rbh_list_foreach_safe(&pool->ids, id, next, link) {
+            if (!needs_flushing(pool, count))
+                break;
+
+            if (id_is_hot(id, now, pool->max_age)) {
+                id->hits /= 2;
+                continue;
+            }
 
-        rbh_list_splice_tail(&pool->events, first_events);
+            flush_id(pool, id);
+            count++;
+        }
+    }
 
-        id_node_free(pool, first_id);
-        events = (void *)rbh_hashmap_pop(pool->pool, first_id->id);
-        event_list_free(pool, events);
-        pool->count--;
+    /* Flush the oldest ids, whether they are hot or not */
+    while (needs_flushing(pool, count)) {
+        flush_id(pool, rbh_list_first(&pool->ids, struct rbh_id_node, link));
         count++;
     }
 
     return rbh_iter_list(&pool->events,
                          offsetof(struct rbh_fsevent_node, link));
 }
+
+void
+rbh_fsevent_pool_keep_hot(struct rbh_fsevent_pool *pool, unsigned int max_age)
+{
+    pool->max_age = max_age;
+}
+
+int
+rbh_fsevent_pool_resize(struct rbh_fsevent_pool *pool, size_t batch_size,
+                        size_t flush_size)
+{
+    if (batch_size > pool->capacity || flush_size == 0
+     || flush_size > batch_size) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pool->size = batch_size;
+    pool->flush_size = flush_size;
+    return 0;
+}
+
+size_t
+rbh_fsevent_pool_flushed(const struct rbh_fsevent_pool *pool)
+{
+    return pool->flushed;
+}
@@ -28,4 +28,23 @@ rbh_fsevent_pool_push(struct rbh_fsevent_pool *pool,
 struct rbh_iterator *
 rbh_fsevent_pool_flush(struct rbh_fsevent_pool *pool);
 
+/* Change the batch and flush sizes of a pool, the batch size cannot exceed the
+ * one the pool was created with. If the pool holds more ids than its new batch
+ * size, the next flush returns more than \p flush_size ids.
+ */
+int
+rbh_fsevent_pool_resize(struct rbh_fsevent_pool *pool, size_t batch_size,
+                        size_t flush_size);
+
+/* Flush ids that are frequently updated (hot) after the others, as long as they
+ * have been in the pool for less than \p max_age seconds (0 to flush the least
+ * recently updated ids first, regardless of how often they are updated)
+ */
+void
+rbh_fsevent_pool_keep_hot(struct rbh_fsevent_pool *pool, unsigned int max_age);
+
+/* The number of fsevents the last call to rbh_fsevent_pool_flush() returned */
+size_t
+rbh_fsevent_pool_flushed(const struct rbh_fsevent_pool *pool);
+
 #endif
@@ -3,8 +3,22 @@
 #ifndef ENRICHER_INTERNALS_H
 #define ENRICHER_INTERNALS_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include <robinhood.h>
 
+/* What enriching an fsevent requires of the entry it is about */
+struct entry_needs {
+    /* Whether to open the entry at all */
+    bool open;
+    /* Whether to open it for reading, rather than with O_PATH */
+    bool read;
+    /* Whether to statx() it, and with which mask */
+    bool statx;
+    uint32_t statx_mask;
+};
+
 struct enricher {
     struct rbh_iterator iterator;
     struct rbh_backend *backend;
@@ -19,20 +33,49 @@ struct enricher {
     struct rbh_fsevent fsevent;
     struct rbh_statx statx;
     char *symlink;
+
+    /* How to retrieve the statx metadata of entries (rbh_statx() usually) */
+    int (*get_statx)(int dirfd, const char *pathname, int flags,
+                     unsigned int mask, struct rbh_statx *statxbuf);
+
+    /* The entry the fsevent being enriched is about (cf. entry_open()) */
+    int entry_fd;
+    struct rbh_statx entry_statx;
 };
 
 int
 open_by_id(int mound_fd, const struct rbh_id *id, int flags);
 
+/**
+ * Open the entry an fsevent is about, and statx() it, as \p needs requires
+ *
+ * @param enricher  the enricher to store the resulting fd and statx in
+ * @param id        the id of the entry
+ * @param needs     the union of what each partial xattr of the fsevent needs
+ *
+ * @return          0 on success, -1 on error and errno is set appropriately
+ *
+ * Gathering what every partial xattr needs before enriching any of them
+ * ensures the entry is opened (and statx()'d) at most once per fsevent.
+ */
+int
+entry_open(struct enricher *enricher, const struct rbh_id *id,
+           const struct entry_needs *needs);
+
+void
+entry_close(struct enricher *enricher);
+
 /*----------------------------------------------------------------------------*
  *                              posix internals                               *
  *----------------------------------------------------------------------------*/
 
-int posix_enrich(const struct rbh_value_pair *partial,
-                 struct rbh_value_pair **pairs, size_t *pair_count,
-                 struct rbh_fsevent *enriched,
-                 const struct rbh_fsevent *original, int mount_fd,
-                 struct rbh_statx *statxbuf, char symlink[]);
+int
+posix_entry_needs(const struct rbh_value_pair *partial,
+                  struct entry_needs *needs);
+
+int
+posix_enrich(struct enricher *enricher, const struct rbh_value_pair *partial,
+             const struct rbh_fsevent *original);
 
 struct rbh_iterator *
 posix_iter_enrich(struct rbh_iterator *fsevents, int mount_fd,
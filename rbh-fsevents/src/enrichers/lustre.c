@@ -5,12 +5,17 @@
 #include <fcntl.h>
 #include <linux/limits.h>
 #include <lustre/lustreapi.h>
+#include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <robinhood/backends/lustre.h>
+#include <robinhood/lustre_utils.h>
+
 #include "enricher.h"
 #include "internals.h"
 
@@ -85,49 +90,36 @@ enrich_path(const char *mount_path, const struct rbh_id *id, const char *name,
 }
 
 static int
-enrich_lustre(struct rbh_backend *backend, int mount_fd,
-              const struct rbh_id *id, struct rbh_sstack *xattrs_values,
+enrich_lustre(struct enricher *enricher, struct rbh_sstack *xattrs_values,
               struct rbh_value_pair *pair)
 {
-    static const int STATX_FLAGS = AT_STATX_FORCE_SYNC | AT_EMPTY_PATH
-                                 | AT_NO_AUTOMOUNT | AT_SYMLINK_NOFOLLOW;
     struct {
         int fd;
         struct rbh_statx *statx;
         struct rbh_sstack *values;
     } arg;
-    struct rbh_statx statxbuf;
-    int save_errno;
-    int size;
-    int rc;
-
-    arg.fd = open_by_id(mount_fd, id, O_RDONLY | O_CLOEXEC | O_NOFOLLOW |
-                                      O_NONBLOCK);
-    if (arg.fd < 0 && errno == ELOOP)
-        /* If the file to open is a symlink, reopen it with O_PATH set */
-        arg.fd = open_by_id(mount_fd, id,
-                            O_RDONLY | O_CLOEXEC | O_NOFOLLOW | O_PATH);
-    if (arg.fd < 0)
-        return -1;
 
-    rc = rbh_statx(arg.fd, "", STATX_FLAGS, RBH_STATX_MODE, &statxbuf);
-    if (rc == -1) {
-        save_errno = errno;
-        close(arg.fd);
-        errno = save_errno;
-        return -1;
-    }
-
-    arg.statx = &statxbuf;
+    arg.fd = enricher->entry_fd;
+    arg.statx = &enricher->entry_statx;
     arg.values = xattrs_values;
 
-    size = rbh_backend_get_attribute(backend, "lustre", &arg, pair);
+    return rbh_backend_get_attribute(enricher->backend, "lustre", &arg, pair);
+}
 
-    save_errno = errno;
-    close(arg.fd);
-    errno = save_errno;
+static void
+lustre_entry_needs(const struct rbh_value_pair *partial,
+                   struct entry_needs *needs)
+{
+    if (strcmp(partial->key, "lustre"))
+        return;
 
-    return size;
+    /* The lustre backend reads the layout of the entry through its fd, and
+     * needs its type to know which attributes it has.
+     */
+    needs->open = true;
+    needs->read = true;
+    needs->statx = true;
+    needs->statx_mask |= RBH_STATX_MODE;
 }
 
 static int
@@ -160,8 +152,7 @@ lustre_enrich(struct enricher *enricher, const struct rbh_value_pair *attr,
     }
 
     if (strcmp(attr->key, "lustre") == 0) {
-        size = enrich_lustre(enricher->backend, enricher->mount_fd,
-                             &original->id, xattrs_values,
+        size = enrich_lustre(enricher, xattrs_values,
                              &pairs[enricher->fsevent.xattrs.count]);
         if (size == -1)
             return -1;
@@ -171,17 +162,42 @@ lustre_enrich(struct enricher *enricher, const struct rbh_value_pair *attr,
         return size;
     }
 
-    return posix_enrich(attr, &pairs, &enricher->pair_count, &enricher->fsevent,
-                        original, enricher->mount_fd, &enricher->statx,
-                        enricher->symlink);
+    return posix_enrich(enricher, attr, original);
 }
 
 static int
 enrich(struct enricher *enricher, const struct rbh_fsevent *original)
 {
     struct rbh_fsevent *enriched = &enricher->fsevent;
-    struct rbh_value_pair *pairs = enricher->pairs;
-    size_t pair_count = enricher->pair_count;
+    struct entry_needs needs = {};
+    int save_errno;
+    int rc = 0;
+
+    /* Gather what every partial xattr needs first, so that the entry is only
+     * opened, and statx()'d, once.
+     */
+    for (size_t i = 0; i < original->xattrs.count; i++) {
+        const struct rbh_value_pair *pair = &original->xattrs.pairs[i];
+        const struct rbh_value_map *partials;
+
+        if (strcmp(pair->key, "rbh-fsevents"))
+            continue;
+
+        if (pair->value == NULL || pair->value->type != RBH_VT_MAP) {
+            errno = EINVAL;
+            return -1;
+        }
+        partials = &pair->value->map;
+
+        for (size_t i = 0; i < partials->count; i++) {
+            lustre_entry_needs(&partials->pairs[i], &needs);
+            if (posix_entry_needs(&partials->pairs[i], &needs))
+                return -1;
+        }
+    }
+
+    if (entry_open(enricher, &original->id, &needs))
+        return -1;
 
     *enriched = *original;
     enriched->xattrs.count = 0;
@@ -191,37 +207,38 @@ enrich(struct enricher *enricher, const struct rbh_fsevent *original)
         const struct rbh_value_map *partials;
 
         if (strcmp(pair->key, "rbh-fsevents")) {
-            if (enriched->xattrs.count + 1 >= pair_count) {
+            if (enriched->xattrs.count + 1 >= enricher->pair_count) {
                 void *tmp;
 
-                tmp = reallocarray(pairs, pair_count << 1, sizeof(*pairs));
-                if (tmp == NULL)
-                    return -1;
-                enricher->pairs = pairs = tmp;
-                enricher->pair_count = pair_count = pair_count << 1;
+                tmp = reallocarray(enricher->pairs, enricher->pair_count << 1,
+                                   sizeof(*enricher->pairs));
+                if (tmp == NULL) {
+                    rc = -1;
+                    break;
+                }
+                enricher->pairs = tmp;
+                enricher->pair_count <<= 1;
             }
-            pairs[enriched->xattrs.count++] = original->xattrs.pairs[i];
+            enricher->pairs[enriched->xattrs.count++] = *pair;
             continue;
         }
 
-        if (pair->value == NULL || pair->value->type != RBH_VT_MAP) {
-            errno = EINVAL;
-            return -1;
-        }
         partials = &pair->value->map;
-
         for (size_t i = 0; i < partials->count; i++) {
-            int rc;
-
             rc = lustre_enrich(enricher, &partials->pairs[i], original);
             if (rc == -1)
-                return -1;
+                break;
+            rc = 0;
         }
-
+        if (rc)
+            break;
     }
-    enriched->xattrs.pairs = pairs;
+    enriched->xattrs.pairs = enricher->pairs;
 
-    return 0;
+    save_errno = errno;
+    entry_close(enricher);
+    errno = save_errno;
+    return rc;
 }
 
 static const void *
@@ -252,11 +269,19 @@ lustre_iter_enrich(struct rbh_backend *backend, struct rbh_iterator *fsevents,
     struct rbh_iterator *iter = posix_iter_enrich(fsevents, mount_fd,
                                                   mount_path);
     struct enricher *enricher = (struct enricher *)iter;
+    bool lazy = false;
+    size_t size = sizeof(lazy);
 
     if (iter == NULL)
         return NULL;
 
+    /* Older backends do not know about lazy sizes, they glimpse files */
+    if (rbh_backend_get_option(backend, RBH_LBO_LAZY_SIZE, &lazy, &size))
+        lazy = false;
+
     enricher->backend = backend;
+    if (lazy)
+        enricher->get_statx = rbh_lustre_lazy_statx;
     enricher->iterator.ops = &LUSTRE_ENRICHER_ITER_OPS;
 
     return iter;
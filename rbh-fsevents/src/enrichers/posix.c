@@ -7,6 +7,8 @@
 #include <errno.h>
 #include <error.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -340,6 +342,7 @@ parse_statx_mask(uint32_t *mask, const struct rbh_value *value)
  * for both posix and lustre. */
 enum partial_field {
     PF_UNKNOWN,
+    PF_PATH,
     PF_STATX,
     PF_SYMLINK,
     PF_XATTRS,
@@ -349,6 +352,12 @@ static enum partial_field __attribute__((pure))
 str2partial_field(const char *string)
 {
     switch (*string++) {
+    case 'p': /* path */
+        if (strcmp(string, "ath")) {
+            errno = ENOTSUP;
+            return -1;
+        }
+        return PF_PATH;
     case 's': /* statx, symlink */
         switch (*string++) {
         case 't': /* statx */
@@ -394,31 +403,65 @@ open_by_id(int mount_fd, const struct rbh_id *id, int flags)
     return fd;
 }
 
-static int
-enrich_statx(struct rbh_statx *dest, const struct rbh_id *id, int mount_fd,
-             uint32_t mask, const struct rbh_statx *original)
+static const int STATX_FLAGS = AT_STATX_FORCE_SYNC | AT_EMPTY_PATH
+                             | AT_NO_AUTOMOUNT | AT_SYMLINK_NOFOLLOW;
+
+int
+entry_open(struct enricher *enricher, const struct rbh_id *id,
+           const struct entry_needs *needs)
 {
-    static const int STATX_FLAGS = AT_STATX_FORCE_SYNC | AT_EMPTY_PATH
-                                 | AT_NO_AUTOMOUNT | AT_SYMLINK_NOFOLLOW;
-    struct rbh_statx statxbuf;
     int save_errno;
-    int rc;
-    int fd;
+    int fd = -1;
 
-    fd = open_by_id(mount_fd, id, O_RDONLY | O_CLOEXEC | O_NOFOLLOW | O_PATH);
-    if (fd == -1)
+    enricher->entry_fd = -1;
+    if (!needs->open)
+        return 0;
+
+    if (needs->read) {
+        /* O_NONBLOCK so that opening a fifo does not wait for a writer */
+        fd = open_by_id(enricher->mount_fd, id,
+                        O_RDONLY | O_CLOEXEC | O_NOFOLLOW | O_NONBLOCK);
+        if (fd < 0 && errno != ELOOP)
+            return -1;
+    }
+
+    if (fd < 0)
+        /* Symlinks can only be opened with O_PATH */
+        fd = open_by_id(enricher->mount_fd, id,
+                        O_RDONLY | O_CLOEXEC | O_NOFOLLOW | O_PATH);
+    if (fd < 0)
         return -1;
 
     /* FIXME: We should really use AT_RBH_STATX_FORCE_SYNC here */
-    rc = rbh_statx(fd, "", STATX_FLAGS, mask, &statxbuf);
-    save_errno = errno;
-    /* Ignore errors on close */
-    close(fd);
-    if (rc == -1) {
+    if (needs->statx && enricher->get_statx(fd, "", STATX_FLAGS,
+                                            needs->statx_mask,
+                                            &enricher->entry_statx)) {
+        save_errno = errno;
+        /* Ignore errors on close */
+        close(fd);
         errno = save_errno;
         return -1;
     }
 
+    enricher->entry_fd = fd;
+    return 0;
+}
+
+void
+entry_close(struct enricher *enricher)
+{
+    if (enricher->entry_fd < 0)
+        return;
+
+    /* Ignore errors on close */
+    close(enricher->entry_fd);
+    enricher->entry_fd = -1;
+}
+
+static void
+enrich_statx(struct rbh_statx *dest, const struct rbh_statx *statxbuf,
+             const struct rbh_statx *original)
+{
     if (original) {
         *dest = *original;
     } else {
@@ -426,8 +469,7 @@ enrich_statx(struct rbh_statx *dest, const struct rbh_id *id, int mount_fd,
         dest->stx_mode = 0;
     }
 
-    merge_statx(dest, &statxbuf);
-    return 0;
+    merge_statx(dest, statxbuf);
 }
 
 /* The Linux VFS does not allow values of more than 64KiB */
@@ -446,17 +488,13 @@ exit_xattrs_values(void)
 static int
 enrich_xattrs(const struct rbh_value *xattrs_to_enrich,
               struct rbh_value_pair **pairs, size_t *pair_count,
-              struct rbh_fsevent *enriched,
-              const struct rbh_id *id, int mount_fd)
+              struct rbh_fsevent *enriched, int fd)
 {
     char buffer[XATTR_VALUE_MAX_VFS_SIZE];
     const struct rbh_value *xattrs_seq;
     struct rbh_value *value;
     size_t xattrs_count;
     ssize_t length;
-    int save_errno;
-    int rc = 0;
-    int fd;
 
     if (xattrs_to_enrich->type != RBH_VT_SEQUENCE) {
         errno = EINVAL;
@@ -473,25 +511,12 @@ enrich_xattrs(const struct rbh_value *xattrs_to_enrich,
     xattrs_seq = xattrs_to_enrich->sequence.values;
     xattrs_count = xattrs_to_enrich->sequence.count;
 
-    fd = open_by_id(mount_fd, id, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
-    if (fd < 0 && errno == ELOOP)
-        /* If the file to open is a symlink, reopen it with O_PATH set */
-        fd = open_by_id(mount_fd, id, O_RDONLY | O_CLOEXEC | O_NOFOLLOW |
-                        O_PATH);
-
-    if (fd < 0) {
-        rc = -1;
-        goto err;
-    }
-
     if (enriched->xattrs.count + xattrs_count >= *pair_count) {
         void *tmp;
 
         tmp = reallocarray(*pairs, *pair_count + xattrs_count, sizeof(**pairs));
-        if (tmp == NULL) {
-            rc = -1;
-            goto err;
-        }
+        if (tmp == NULL)
+            return -1;
 
         *pairs = tmp;
         *pair_count = *pair_count + xattrs_count;
@@ -505,17 +530,13 @@ enrich_xattrs(const struct rbh_value *xattrs_to_enrich,
             value = NULL;
         } else {
             value = rbh_sstack_push(xattrs_values, NULL, sizeof(*value));
-            if (value == NULL) {
-                rc = -1;
-                goto err;
-            }
+            if (value == NULL)
+                return -1;
 
             value->type = RBH_VT_BINARY;
             value->binary.data = rbh_sstack_push(xattrs_values, buffer, length);
-            if (value->binary.data == NULL) {
-                rc = -1;
-                goto err;
-            }
+            if (value->binary.data == NULL)
+                return -1;
 
             value->binary.size = length;
         }
@@ -527,66 +548,180 @@ enrich_xattrs(const struct rbh_value *xattrs_to_enrich,
         enriched->xattrs.count++;
     }
 
-err:
-    save_errno = errno;
-    /* Ignore errors on close */
-    close(fd);
-    errno = save_errno;
-    return rc;
+    return 0;
 }
 
-/* The Linux VFS doesn't allow for symlinks of more than 64KiB */
-#define SYMLINK_MAX_SIZE (1 << 16)
+static ssize_t
+fd_path(int fd, char path[PATH_MAX])
+{
+    char proc_path[sizeof("/proc/self/fd/") + 10];
+    ssize_t length;
 
+    sprintf(proc_path, "/proc/self/fd/%d", fd);
+    length = readlink(proc_path, path, PATH_MAX - 1);
+    if (length != -1)
+        path[length] = '\0';
+
+    return length;
+}
+
+/* The path of an entry (relative to the mount point) is that of its parent,
+ * followed by its name
+ */
 static int
-enrich_symlink(char symlink[SYMLINK_MAX_SIZE], const struct rbh_id *id,
-               int mount_fd)
+enrich_path(struct rbh_value_pair **pairs, size_t *pair_count,
+            struct rbh_fsevent *enriched, const struct rbh_fsevent *original,
+            int mount_fd)
 {
+    char parent[PATH_MAX];
+    char root[PATH_MAX];
+    ssize_t root_length;
+    struct rbh_value *value;
+    ssize_t length;
     int save_errno;
-    ssize_t rc;
+    char *path;
     int fd;
 
-    fd = open_by_id(mount_fd, id, O_RDONLY | O_CLOEXEC | O_NOFOLLOW | O_PATH);
-    if (fd == -1)
+    if (xattrs_values == NULL) {
+        xattrs_values = rbh_sstack_new(MIN_XATTR_VALUES_ALLOC *
+                                       sizeof(struct rbh_value *));
+        if (xattrs_values == NULL)
+            return -1;
+    }
+
+    root_length = fd_path(mount_fd, root);
+    if (root_length == -1)
         return -1;
+    if (strcmp(root, "/") == 0)
+        root_length = 0;
 
-    rc = readlinkat(fd, "", symlink, SYMLINK_MAX_SIZE - 1);
-    if (rc != -1)
-        symlink[rc] = 0;
+    fd = open_by_id(mount_fd, original->link.parent_id,
+                    O_RDONLY | O_CLOEXEC | O_DIRECTORY | O_PATH);
+    if (fd == -1)
+        return -1;
 
+    length = fd_path(fd, parent);
     save_errno = errno;
     /* Ignore errors on close */
     close(fd);
     errno = save_errno;
-    return rc == -1 ? -1 : 0;
+    if (length == -1)
+        return -1;
+
+    if (strncmp(parent, root, root_length)
+     || (parent[root_length] != '/' && parent[root_length] != '\0')) {
+        /* The parent is not under the mount point */
+        errno = EXDEV;
+        return -1;
+    }
+
+    value = rbh_sstack_push(xattrs_values, NULL, sizeof(*value));
+    if (value == NULL)
+        return -1;
+
+    /* Keep the next values pushed on `xattrs_values' aligned */
+    length = length - root_length + 1 + strlen(original->link.name) + 1;
+    length = (length + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    path = rbh_sstack_push(xattrs_values, NULL, length);
+    if (path == NULL)
+        return -1;
+    sprintf(path, "%s/%s", parent + root_length, original->link.name);
+
+    value->type = RBH_VT_STRING;
+    value->string = path;
+
+    if (enriched->xattrs.count + 1 >= *pair_count) {
+        void *tmp;
+
+        tmp = reallocarray(*pairs, *pair_count << 1, sizeof(**pairs));
+        if (tmp == NULL)
+            return -1;
+
+        *pairs = tmp;
+        *pair_count = *pair_count << 1;
+    }
+
+    (*pairs)[enriched->xattrs.count].key = "path";
+    (*pairs)[enriched->xattrs.count].value = value;
+    enriched->xattrs.count++;
+    return 0;
+}
+
+/* The Linux VFS doesn't allow for symlinks of more than 64KiB */
+#define SYMLINK_MAX_SIZE (1 << 16)
+
+static int
+enrich_symlink(char symlink[SYMLINK_MAX_SIZE], int fd)
+{
+    ssize_t rc;
+
+    rc = readlinkat(fd, "", symlink, SYMLINK_MAX_SIZE - 1);
+    if (rc == -1)
+        return -1;
+
+    symlink[rc] = 0;
+    return 0;
 }
 
 int
-posix_enrich(const struct rbh_value_pair *partial,
-             struct rbh_value_pair **pairs, size_t *pair_count,
-             struct rbh_fsevent *enriched,
-             const struct rbh_fsevent *original, int mount_fd,
-             struct rbh_statx *statxbuf, char symlink[SYMLINK_MAX_SIZE])
+posix_entry_needs(const struct rbh_value_pair *partial,
+                  struct entry_needs *needs)
 {
     uint32_t statx_mask;
 
+    switch (str2partial_field(partial->key)) {
+    case PF_UNKNOWN:
+    case PF_PATH: /* only the parent of the entry is opened */
+        break;
+    case PF_STATX:
+        if (parse_statx_mask(&statx_mask, partial->value))
+            return -1;
+
+        needs->open = true;
+        needs->statx = true;
+        needs->statx_mask |= statx_mask;
+        break;
+    case PF_XATTRS:
+        needs->open = true;
+        needs->read = true;
+        break;
+    case PF_SYMLINK:
+        needs->open = true;
+        break;
+    }
+    return 0;
+}
+
+int
+posix_enrich(struct enricher *enricher, const struct rbh_value_pair *partial,
+             const struct rbh_fsevent *original)
+{
+    struct rbh_fsevent *enriched = &enricher->fsevent;
+
     switch (str2partial_field(partial->key)) {
     case PF_UNKNOWN:
         errno = ENOTSUP;
         return -1;
-    case PF_STATX:
-        if (original->type != RBH_FET_UPSERT) {
+    case PF_PATH:
+        if (original->type != RBH_FET_LINK) {
             errno = EINVAL;
             return -1;
         }
 
-        if (parse_statx_mask(&statx_mask, partial->value))
+        if (enrich_path(&enricher->pairs, &enricher->pair_count, enriched,
+                        original, enricher->mount_fd))
             return -1;
-        if (enrich_statx(statxbuf, &original->id, mount_fd, statx_mask,
-                         original->upsert.statx))
+
+        break;
+    case PF_STATX:
+        if (original->type != RBH_FET_UPSERT) {
+            errno = EINVAL;
             return -1;
+        }
 
-        enriched->upsert.statx = statxbuf;
+        enrich_statx(&enricher->statx, &enricher->entry_statx,
+                     original->upsert.statx);
+        enriched->upsert.statx = &enricher->statx;
         break;
     case PF_XATTRS:
         if (original->type != RBH_FET_XATTR && original->type != RBH_FET_LINK) {
@@ -594,8 +729,8 @@ posix_enrich(const struct rbh_value_pair *partial,
             return -1;
         }
 
-        if (enrich_xattrs(partial->value, pairs, pair_count, enriched,
-                          &original->id, mount_fd))
+        if (enrich_xattrs(partial->value, &enricher->pairs,
+                          &enricher->pair_count, enriched, enricher->entry_fd))
             return -1;
 
         break;
@@ -605,10 +740,10 @@ posix_enrich(const struct rbh_value_pair *partial,
             return -1;
         }
 
-        if (enrich_symlink(symlink, &original->id, mount_fd))
+        if (enrich_symlink(enricher->symlink, enricher->entry_fd))
             return -1;
 
-        enriched->upsert.symlink = symlink;
+        enriched->upsert.symlink = enricher->symlink;
         break;
     }
     return 0;
@@ -618,8 +753,31 @@ static int
 enrich(struct enricher *enricher, const struct rbh_fsevent *original)
 {
     struct rbh_fsevent *enriched = &enricher->fsevent;
-    struct rbh_value_pair *pairs = enricher->pairs;
-    size_t pair_count = enricher->pair_count;
+    struct entry_needs needs = {};
+    int save_errno;
+    int rc = 0;
+
+    for (size_t i = 0; i < original->xattrs.count; i++) {
+        const struct rbh_value_pair *pair = &original->xattrs.pairs[i];
+        const struct rbh_value_map *partials;
+
+        if (strcmp(pair->key, "rbh-fsevents"))
+            continue;
+
+        if (pair->value == NULL || pair->value->type != RBH_VT_MAP) {
+            errno = EINVAL;
+            return -1;
+        }
+        partials = &pair->value->map;
+
+        for (size_t i = 0; i < partials->count; i++) {
+            if (posix_entry_needs(&partials->pairs[i], &needs))
+                return -1;
+        }
+    }
+
+    if (entry_open(enricher, &original->id, &needs))
+        return -1;
 
     *enriched = *original;
     enriched->xattrs.count = 0;
@@ -632,36 +790,37 @@ enrich(struct enricher *enricher, const struct rbh_fsevent *original)
             /* XXX: this could be made more efficient by copying ranges of
              *      xattrs (ie. "pairs") after each occurence of "rbh-fsevents".
              */
-            if (enriched->xattrs.count + 1 >= pair_count) {
+            if (enriched->xattrs.count + 1 >= enricher->pair_count) {
                 void *tmp;
 
-                tmp = reallocarray(pairs, pair_count << 1, sizeof(*pairs));
-                if (tmp == NULL)
-                    return -1;
-                enricher->pairs = pairs = tmp;
-                enricher->pair_count = pair_count = pair_count << 1;
+                tmp = reallocarray(enricher->pairs, enricher->pair_count << 1,
+                                   sizeof(*enricher->pairs));
+                if (tmp == NULL) {
+                    rc = -1;
+                    break;
+                }
+                enricher->pairs = tmp;
+                enricher->pair_count <<= 1;
             }
-            pairs[enriched->xattrs.count++] = original->xattrs.pairs[i];
+            enricher->pairs[enriched->xattrs.count++] = *pair;
             continue;
         }
 
-        if (pair->value == NULL || pair->value->type != RBH_VT_MAP) {
-            errno = EINVAL;
-            return -1;
-        }
         partials = &pair->value->map;
-
         for (size_t i = 0; i < partials->count; i++) {
-            if (posix_enrich(&partials->pairs[i], &pairs, &pair_count, enriched,
-                             original, enricher->mount_fd, &enricher->statx,
-                             enricher->symlink))
-                return -1;
+            rc = posix_enrich(enricher, &partials->pairs[i], original);
+            if (rc)
+                break;
         }
-
+        if (rc)
+            break;
     }
-    enriched->xattrs.pairs = pairs;
+    enriched->xattrs.pairs = enricher->pairs;
 
-    return 0;
+    save_errno = errno;
+    entry_close(enricher);
+    errno = save_errno;
+    return rc;
 }
 
 static const void *
@@ -741,6 +900,8 @@ posix_iter_enrich(struct rbh_iterator *fsevents, int mount_fd,
     enricher->pairs = pairs;
     enricher->pair_count = INITIAL_PAIR_COUNT;
     enricher->symlink = symlink;
+    enricher->get_statx = rbh_statx;
+    enricher->entry_fd = -1;
 
     return &enricher->iterator;
 }
@@ -0,0 +1,241 @@
+/* SPDX-License-Identifer: LGPL-3.0-or-later */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <assert.h>
+#include <error.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <robinhood/backend.h>
+#include <robinhood/itertools.h>
+#include <robinhood/sstack.h>
+
+#include "sink.h"
+#include "src/deduplicator/hash.h"
+#include "src/deduplicator/rbh_fsevent_utils.h"
+
+/* The fsevents of a batch that are sent to one of the sinks */
+struct partition {
+    struct sink *sink;
+
+    struct rbh_fsevent *fsevents;
+    size_t count;
+    size_t capacity;
+    /* The deep copies of fsevents' fields */
+    struct rbh_sstack *values;
+
+    int rc;
+    int error;
+    char backend_error[sizeof(rbh_backend_error)];
+};
+
+struct parallel_sink {
+    struct sink sink;
+
+    struct partition *partitions;
+    size_t count;
+};
+
+static void
+partition_clear(struct partition *partition)
+{
+    while (true) {
+        size_t readable;
+
+        rbh_sstack_peek(partition->values, &readable);
+        if (readable == 0)
+            break;
+
+        rbh_sstack_pop(partition->values, readable);
+    }
+
+    partition->count = 0;
+    partition->rc = 0;
+    partition->error = 0;
+}
+
+static int
+partition_push(struct partition *partition, const struct rbh_fsevent *fsevent)
+{
+    if (partition->count == partition->capacity) {
+        size_t capacity = partition->capacity ? partition->capacity * 2 : 64;
+        void *tmp;
+
+        tmp = reallocarray(partition->fsevents, capacity,
+                           sizeof(*partition->fsevents));
+        if (tmp == NULL)
+            return -1;
+
+        partition->fsevents = tmp;
+        partition->capacity = capacity;
+    }
+
+    if (rbh_fsevent_deep_copy(&partition->fsevents[partition->count], fsevent,
+                              partition->values))
+        return -1;
+
+    partition->count++;
+    return 0;
+}
+
+static void *
+partition_process(void *_partition)
+{
+    struct partition *partition = _partition;
+    struct rbh_iterator *fsevents;
+
+    fsevents = rbh_iter_array(partition->fsevents, sizeof(*partition->fsevents),
+                              partition->count);
+    if (fsevents == NULL) {
+        partition->rc = -1;
+        partition->error = errno;
+        return NULL;
+    }
+
+    partition->rc = sink_process(partition->sink, fsevents);
+    partition->error = errno;
+    if (partition->rc && partition->error == RBH_BACKEND_ERROR)
+        /* rbh_backend_error is thread-local */
+        memcpy(partition->backend_error, rbh_backend_error,
+               sizeof(partition->backend_error));
+
+    rbh_iter_destroy(fsevents);
+    return NULL;
+}
+
+/* Fsevents are dispatched by id: every fsevent about an entry (including the
+ * link and unlink of a rename, which share the id of the renamed entry) is sent
+ * to the same sink, in order. Fsevents about different entries are independent
+ * within a batch (the deduplicator already reorders them), so the sinks only
+ * synchronize at the end of each batch: a batch is fully committed before the
+ * next one is processed.
+ */
+static int
+dispatch(struct parallel_sink *sink, struct rbh_iterator *fsevents)
+{
+    for (size_t i = 0; i < sink->count; i++)
+        partition_clear(&sink->partitions[i]);
+
+    while (true) {
+        const struct rbh_fsevent *fsevent;
+        struct partition *partition;
+
+        fsevent = rbh_iter_next(fsevents);
+        if (fsevent == NULL) {
+            if (errno == ESTALE || errno == ENOENT)
+                /* The entry is gone, there is nothing to update */
+                continue;
+            break;
+        }
+
+        partition = &sink->partitions[hash_id(&fsevent->id) % sink->count];
+        if (partition_push(partition, fsevent))
+            return -1;
+    }
+
+    return errno == ENODATA ? 0 : -1;
+}
+
+static int
+parallel_sink_process(void *_sink, struct rbh_iterator *fsevents)
+{
+    struct parallel_sink *sink = _sink;
+    pthread_t threads[sink->count];
+    bool started[sink->count];
+
+    if (dispatch(sink, fsevents))
+        return -1;
+
+    for (size_t i = 0; i < sink->count; i++) {
+        struct partition *partition = &sink->partitions[i];
+
+        /* The calling thread processes the first partition itself */
+        started[i] = i > 0 && partition->count > 0
+                  && pthread_create(&threads[i], NULL, partition_process,
+                                    partition) == 0;
+    }
+
+    /* If a thread could not be started, its partition is processed here */
+    for (size_t i = 0; i < sink->count; i++) {
+        if (!started[i] && sink->partitions[i].count > 0)
+            partition_process(&sink->partitions[i]);
+    }
+
+    for (size_t i = 0; i < sink->count; i++) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+    }
+
+    for (size_t i = 0; i < sink->count; i++) {
+        struct partition *partition = &sink->partitions[i];
+
+        if (partition->rc == 0)
+            continue;
+
+        if (partition->error == RBH_BACKEND_ERROR)
+            memcpy(rbh_backend_error, partition->backend_error,
+                   sizeof(rbh_backend_error));
+        errno = partition->error;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+parallel_sink_destroy(void *_sink)
+{
+    struct parallel_sink *sink = _sink;
+
+    for (size_t i = 0; i < sink->count; i++) {
+        struct partition *partition = &sink->partitions[i];
+
+        sink_destroy(partition->sink);
+        rbh_sstack_destroy(partition->values);
+        free(partition->fsevents);
+    }
+    free(sink->partitions);
+    free(sink);
+}
+
+static const struct sink_operations PARALLEL_SINK_OPS = {
+    .process = parallel_sink_process,
+    .destroy = parallel_sink_destroy,
+};
+
+struct sink *
+sink_from_sinks(struct sink **sinks, size_t count)
+{
+    struct parallel_sink *sink;
+
+    assert(count > 0);
+
+    sink = malloc(sizeof(*sink));
+    if (sink == NULL)
+        error(EXIT_FAILURE, errno, "malloc");
+
+    sink->partitions = calloc(count, sizeof(*sink->partitions));
+    if (sink->partitions == NULL)
+        error(EXIT_FAILURE, errno, "calloc");
+
+    for (size_t i = 0; i < count; i++) {
+        struct partition *partition = &sink->partitions[i];
+
+        partition->sink = sinks[i];
+        partition->values = rbh_sstack_new(1 << 16);
+        if (partition->values == NULL)
+            error(EXIT_FAILURE, errno, "rbh_sstack_new");
+    }
+
+    /* Callers check the name of a sink to know what it accepts */
+    sink->sink.name = sinks[0]->name;
+    sink->sink.ops = &PARALLEL_SINK_OPS;
+    sink->count = count;
+    return &sink->sink;
+}
@@ -17,14 +17,20 @@
 #include <robinhood/sstack.h>
 #include <robinhood/statx.h>
 
+#include "lustre_ignore.h"
 #include "source.h"
 #include "utils.h"
 
+/*----------------------------------------------------------------------------*
+ |                             changelog iterator                             |
+ *----------------------------------------------------------------------------*/
+
 struct lustre_changelog_iterator {
     struct rbh_iterator iterator;
 
     void *reader;
     struct rbh_iterator *fsevents_iterator;
+    struct ignore_rules ignore;
 };
 
 /* BSON results:
@@ -65,24 +71,6 @@ fill_ns_xattrs_fid(void *arg)
     return value;
 }
 
-static struct rbh_value *
-build_statx_mask(void *arg)
-{
-    uint32_t enrich_mask = *(uint32_t *)arg;
-    const struct rbh_value MASK = {
-        .type = RBH_VT_UINT32,
-        .uint32 = enrich_mask,
-    };
-    struct rbh_value *mask;
-
-    mask = source_stack_alloc(NULL, sizeof(*mask));
-    if (mask == NULL)
-        return NULL;
-    *mask = MASK;
-
-    return mask;
-}
-
 static struct rbh_value *
 build_xattrs(void *arg)
 {
@@ -111,68 +99,13 @@ build_xattrs(void *arg)
     return xattr_sequence;
 }
 
-static struct rbh_value *
-build_symlink_string(void *arg)
-{
-    const struct rbh_value SYMLINK = {
-        .type = RBH_VT_STRING,
-        .string = "symlink",
-    };
-
-    (void) arg;
-
-    return source_stack_alloc(&SYMLINK, sizeof(SYMLINK));
-}
-
-static struct rbh_value *
-_fill_enrich(const char *key, struct rbh_value *(*builder)(void *),
-             void *arg)
-{
-    const struct rbh_value ENRICH = {
-        .type = RBH_VT_MAP,
-        .map = {
-            .count = 1,
-            .pairs = build_pair(key, builder, arg),
-        },
-    };
-    struct rbh_value *enrich;
-
-    if (ENRICH.map.pairs == NULL)
-        return NULL;
-
-    enrich = source_stack_alloc(NULL, sizeof(*enrich));
-    if (enrich == NULL)
-        return NULL;
-    memcpy(enrich, &ENRICH, sizeof(*enrich));
-
-    return enrich;
-}
-
 /* BSON results:
  * { "xattrs" : { "rbh-fsevents" : { "xattrs" : [ a, b, c, ... ] } } }
  */
 static struct rbh_value *
 fill_inode_xattrs(void *arg)
 {
-    return _fill_enrich("xattrs", build_xattrs, arg);
-}
-
-/* BSON results:
- * { "xattrs" : { "rbh-fsevents" : { "statx" : 1234567 } } }
- */
-static struct rbh_value *
-fill_statx(void *arg)
-{
-    return _fill_enrich("statx", build_statx_mask, arg);
-}
-
-/* BSON results:
- * { "xattrs" : { "rbh-fsevents" : { "symlink" : "symlink" } } }
- */
-static struct rbh_value *
-build_symlink_enrich_map(void *arg)
-{
-    return _fill_enrich("symlink", build_symlink_string, arg);
+    return fill_enrich("xattrs", build_xattrs, arg);
 }
 
 /* The variadic arguments must be given by pairs -a string key and a rbh value-,
@@ -882,6 +815,11 @@ retry:
         return NULL;
     }
 
+    if (ignore_record(&records->ignore, record)) {
+        llapi_changelog_free(&record);
+        goto retry;
+    }
+
     id = build_id(&record->cr_tfid);
     if (id == NULL) {
         rc = -1;
@@ -984,6 +922,7 @@ lustre_changelog_iter_destroy(void *iterator)
     llapi_changelog_fini(&records->reader);
     if (records->fsevents_iterator)
         rbh_iter_destroy(records->fsevents_iterator);
+    ignore_rules_fini(&records->ignore);
 }
 
 static const struct rbh_iterator_operations LUSTRE_CHANGELOG_ITER_OPS = {
@@ -997,10 +936,14 @@ static const struct rbh_iterator LUSTRE_CHANGELOG_ITERATOR = {
 
 static void
 lustre_changelog_iter_init(struct lustre_changelog_iterator *events,
-                           const char *mdtname)
+                           const char *mdtname, const char * const *ignore,
+                           size_t ignore_count)
 {
     int rc;
 
+    ignore_rules_init(&events->ignore, mdtname, ignore, ignore_count,
+                      lustre_fid_path);
+
     rc = llapi_changelog_start(&events->reader,
                                CHANGELOG_FLAG_JOBID |
                                CHANGELOG_FLAG_EXTRA_FLAGS,
@@ -1056,7 +999,8 @@ static const struct source LUSTRE_SOURCE = {
 };
 
 struct source *
-source_from_lustre_changelog(const char *mdtname)
+source_from_lustre_changelog(const char *mdtname, const char * const *ignore,
+                             size_t ignore_count)
 {
     struct lustre_source *source;
 
@@ -1064,7 +1008,8 @@ source_from_lustre_changelog(const char *mdtname)
     if (source == NULL)
         error(EXIT_FAILURE, errno, "malloc");
 
-    lustre_changelog_iter_init(&source->events, mdtname);
+    lustre_changelog_iter_init(&source->events, mdtname, ignore,
+                               ignore_count);
 
     initialize_source_stack(sizeof(struct rbh_value_pair) * (1 << 7));
     source->source = LUSTRE_SOURCE;
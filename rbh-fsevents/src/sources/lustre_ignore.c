@@ -0,0 +1,345 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <error.h>
+#include <fnmatch.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+
+#include "lustre_ignore.h"
+
+/*----------------------------------------------------------------------------*
+ |                                ignore rules                                |
+ *----------------------------------------------------------------------------*/
+
+static const char * const IGNORE_REASONS[] = {
+    [IR_TYPE] = "type",
+    [IR_JOBID] = "jobid",
+    [IR_XATTR] = "xattr",
+    [IR_SUBTREE] = "subtree",
+};
+
+/* How many fids to remember the ancestry of (cf. fid_is_ignored()) */
+#define ANCESTRY_CACHE_SIZE (1 << 16)
+
+_Static_assert(CL_LAST <= 64, "changelog record types do not fit a uint64_t");
+
+static const char IGNORED;
+static const char KEPT;
+
+static bool
+lu_fid_equals(const void *first, const void *second)
+{
+    return memcmp(first, second, sizeof(struct lu_fid)) == 0;
+}
+
+static size_t
+lu_fid_hash(const void *key)
+{
+    const struct lu_fid *fid = key;
+
+    return (fid->f_seq * 0x9e3779b97f4a7c15ULL) ^ fid->f_oid ^
+           ((uint64_t)fid->f_ver << 32);
+}
+
+static void
+ancestry_reset(struct ignore_rules *rules)
+{
+    if (rules->ancestry)
+        rbh_hashmap_destroy(rules->ancestry);
+    if (rules->fids)
+        rbh_sstack_destroy(rules->fids);
+
+    rules->ancestry = rbh_hashmap_new(lu_fid_equals, lu_fid_hash,
+                                      ANCESTRY_CACHE_SIZE * 100 / 70);
+    if (rules->ancestry == NULL)
+        error(EXIT_FAILURE, errno, "rbh_hashmap_new");
+
+    rules->fids = rbh_sstack_new(sizeof(struct lu_fid) * (1 << 10));
+    if (rules->fids == NULL)
+        error(EXIT_FAILURE, errno, "rbh_sstack_new");
+
+    rules->cached = 0;
+}
+
+int
+lustre_fid_path(const char *fsname, const struct lu_fid *fid,
+                char path[PATH_MAX])
+{
+    char fid_str[FID_LEN];
+    long long recno = 0;
+    int linkno = 0;
+    int rc;
+
+    sprintf(fid_str, DFID, PFID(fid));
+    rc = llapi_fid2path(fsname, fid_str, path, PATH_MAX, &recno, &linkno);
+    if (rc) {
+        errno = -rc;
+        return -1;
+    }
+
+    if (strcmp(path, "/") == 0)
+        path[0] = '\0';
+    return 0;
+}
+
+static bool
+path_in_subtrees(const struct ignore_rules *rules, const char *path)
+{
+    for (size_t i = 0; i < rules->subtree_count; i++) {
+        size_t length = strlen(rules->subtrees[i]);
+
+        if (length == 0)
+            /* Everything is under the root */
+            return true;
+
+        if (strncmp(path, rules->subtrees[i], length) == 0
+         && (path[length] == '\0' || path[length] == '/'))
+            return true;
+    }
+
+    return false;
+}
+
+/* Resolving the path of a fid is expensive, the outcome is cached */
+static bool
+fid_is_ignored(struct ignore_rules *rules, const struct lu_fid *fid)
+{
+    char path[PATH_MAX];
+    const void *value;
+    struct lu_fid *key;
+    bool ignored;
+
+    value = rbh_hashmap_get(rules->ancestry, fid);
+    if (value != NULL)
+        return value == &IGNORED;
+
+    if (rules->fid_path(rules->fsname, fid, path))
+        /* The entry may already be gone, better keep the record */
+        return false;
+
+    ignored = path_in_subtrees(rules, path);
+
+    if (rules->cached == ANCESTRY_CACHE_SIZE)
+        ancestry_reset(rules);
+
+    key = rbh_sstack_push(rules->fids, fid, sizeof(*fid));
+    if (key == NULL)
+        error(EXIT_FAILURE, errno, "rbh_sstack_push");
+
+    if (rbh_hashmap_set(rules->ancestry, key, ignored ? &IGNORED : &KEPT))
+        error(EXIT_FAILURE, errno, "rbh_hashmap_set");
+    rules->cached++;
+
+    return ignored;
+}
+
+static bool
+record_in_subtrees(struct ignore_rules *rules, struct changelog_rec *record)
+{
+    /* Records about the namespace (create, unlink, ...) come with the fid of
+     * the parent, others only with the fid of their target.
+     */
+    const struct lu_fid *fid = fid_is_zero(&record->cr_pfid) ?
+        &record->cr_tfid : &record->cr_pfid;
+    bool ignored;
+
+    ignored = fid_is_ignored(rules, fid);
+
+    /* Entries renamed out of an ignored subtree must not be missed */
+    if (ignored && record->cr_type == CL_RENAME
+     && record->cr_flags & CLF_RENAME)
+        ignored = fid_is_ignored(rules,
+                                 &changelog_rec_rename(record)->cr_spfid);
+
+    /* A renamed directory takes its descendants along: what is cached about
+     * them may no longer hold. Records do not tell directories apart, any
+     * rename that is kept invalidates the cache.
+     */
+    if (!ignored && record->cr_type == CL_RENAME && rules->cached > 0)
+        ancestry_reset(rules);
+
+    return ignored;
+}
+
+static bool
+matches_any(const char **patterns, size_t count, const char *string)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (fnmatch(patterns[i], string, 0) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+bool
+ignore_record(struct ignore_rules *rules, struct changelog_rec *record)
+{
+    enum ignore_reason reason;
+
+    if (record->cr_type < CL_LAST && rules->types & (1ULL << record->cr_type)) {
+        rules->dropped_types[record->cr_type]++;
+        reason = IR_TYPE;
+    } else if (rules->jobid_count && record->cr_flags & CLF_JOBID
+            && matches_any(rules->jobids, rules->jobid_count,
+                           changelog_rec_jobid(record)->cr_jobid)) {
+        reason = IR_JOBID;
+    } else if (rules->xattr_count && record->cr_type == CL_SETXATTR
+            && matches_any(rules->xattrs, rules->xattr_count,
+                           changelog_rec_xattr(record)->cr_xattr)) {
+        reason = IR_XATTR;
+    } else if (rules->subtree_count && record_in_subtrees(rules, record)) {
+        reason = IR_SUBTREE;
+    } else {
+        return false;
+    }
+
+    rules->dropped[reason]++;
+    return true;
+}
+
+static void
+parse_ignored_type(struct ignore_rules *rules, const char *name)
+{
+    for (int type = 0; type < CL_LAST; type++) {
+        if (strcasecmp(changelog_type2str(type), name) == 0) {
+            rules->types |= 1ULL << type;
+            return;
+        }
+    }
+
+    error(EX_USAGE, 0, "%s: unknown changelog record type", name);
+}
+
+static void
+parse_ignored_subtree(struct ignore_rules *rules, const char *fid_str)
+{
+    char path[PATH_MAX];
+    struct lu_fid fid;
+    char end;
+    void *tmp;
+
+    if (*fid_str == '[')
+        fid_str++;
+    if (sscanf(fid_str, SFID "%c", RFID(&fid), &end) < 3)
+        error(EX_USAGE, 0, "%s: invalid fid", fid_str);
+
+    if (rules->fid_path(rules->fsname, &fid, path))
+        error(EXIT_FAILURE, errno, "cannot resolve the path of " DFID,
+              PFID(&fid));
+
+    tmp = reallocarray(rules->subtrees, rules->subtree_count + 1,
+                       sizeof(*rules->subtrees));
+    if (tmp == NULL)
+        error(EXIT_FAILURE, errno, "reallocarray");
+    rules->subtrees = tmp;
+
+    rules->subtrees[rules->subtree_count] = strdup(path);
+    if (rules->subtrees[rules->subtree_count] == NULL)
+        error(EXIT_FAILURE, errno, "strdup");
+    rules->subtree_count++;
+}
+
+static void
+parse_ignored_pattern(const char ***patterns, size_t *count,
+                      const char *pattern)
+{
+    void *tmp;
+
+    tmp = reallocarray(*patterns, *count + 1, sizeof(**patterns));
+    if (tmp == NULL)
+        error(EXIT_FAILURE, errno, "reallocarray");
+
+    *patterns = tmp;
+    (*patterns)[(*count)++] = pattern;
+}
+
+void
+ignore_rules_init(struct ignore_rules *rules, const char *mdtname,
+                  const char * const *ignore, size_t count,
+                  fid_path_t fid_path)
+{
+    char *dash;
+
+    memset(rules, 0, sizeof(*rules));
+    rules->mdtname = mdtname;
+    rules->fid_path = fid_path;
+    if (count == 0)
+        return;
+
+    /* lustre-MDT0000 -> lustre */
+    rules->fsname = strdup(mdtname);
+    if (rules->fsname == NULL)
+        error(EXIT_FAILURE, errno, "strdup");
+    dash = strrchr(rules->fsname, '-');
+    if (dash)
+        *dash = '\0';
+
+    for (size_t i = 0; i < count; i++) {
+        const char *value = strchr(ignore[i], ':');
+
+        if (value == NULL)
+            error(EX_USAGE, 0, "%s: invalid ignore rule", ignore[i]);
+        value++;
+
+        if (strncmp(ignore[i], "type:", value - ignore[i]) == 0)
+            parse_ignored_type(rules, value);
+        else if (strncmp(ignore[i], "fid:", value - ignore[i]) == 0)
+            parse_ignored_subtree(rules, value);
+        else if (strncmp(ignore[i], "jobid:", value - ignore[i]) == 0)
+            parse_ignored_pattern(&rules->jobids, &rules->jobid_count, value);
+        else if (strncmp(ignore[i], "xattr:", value - ignore[i]) == 0)
+            parse_ignored_pattern(&rules->xattrs, &rules->xattr_count, value);
+        else
+            error(EX_USAGE, 0, "%s: invalid ignore rule", ignore[i]);
+    }
+
+    if (rules->subtree_count)
+        ancestry_reset(rules);
+}
+
+void
+ignore_rules_fini(struct ignore_rules *rules)
+{
+    for (int reason = 0; reason < IR_COUNT; reason++) {
+        if (rules->dropped[reason] == 0)
+            continue;
+
+        fprintf(stderr, "%s: dropped %" PRIu64 " records by %s",
+                rules->mdtname, rules->dropped[reason],
+                IGNORE_REASONS[reason]);
+        if (reason == IR_TYPE) {
+            const char *separator = " (";
+
+            for (int type = 0; type < CL_LAST; type++) {
+                if (rules->dropped_types[type] == 0)
+                    continue;
+
+                fprintf(stderr, "%s%s: %" PRIu64, separator,
+                        changelog_type2str(type), rules->dropped_types[type]);
+                separator = ", ";
+            }
+            fprintf(stderr, ")");
+        }
+        fprintf(stderr, "\n");
+    }
+
+    if (rules->ancestry)
+        rbh_hashmap_destroy(rules->ancestry);
+    if (rules->fids)
+        rbh_sstack_destroy(rules->fids);
+    for (size_t i = 0; i < rules->subtree_count; i++)
+        free(rules->subtrees[i]);
+    free(rules->subtrees);
+    free(rules->jobids);
+    free(rules->xattrs);
+    free(rules->fsname);
+}
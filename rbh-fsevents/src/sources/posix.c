@@ -0,0 +1,1045 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <dirent.h>
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <fts.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/fanotify.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include <robinhood/fsevent.h>
+#include <robinhood/id.h>
+#include <robinhood/itertools.h>
+#include <robinhood/statx.h>
+
+#include "source.h"
+#include "utils.h"
+
+/* How long to wait for events before letting the deduplicator flush the
+ * fsevents it holds (cf. struct source's `live')
+ */
+#define IDLE_TIMEOUT 1000 /* ms */
+
+#define EVENT_BUFFER_SIZE (1 << 16)
+
+enum watch_event_flags {
+    WEF_CREATE      = 0x01,
+    WEF_MOVED_TO    = 0x02,
+    WEF_ATTRIB      = 0x04,
+    WEF_MODIFY      = 0x08,
+    WEF_MOVED_FROM  = 0x10,
+    WEF_DELETE      = 0x20,
+    WEF_DELETE_SELF = 0x40,
+};
+
+#define WEF_NEW_ENTRY (WEF_CREATE | WEF_MOVED_TO)
+#define WEF_OLD_ENTRY (WEF_MOVED_FROM | WEF_DELETE)
+
+/* What both fanotify and inotify events boil down to
+ *
+ * Every field but `flags' and `mode' lives on the source stack.
+ */
+struct watch_event {
+    uint32_t flags;
+    /* The directory `name' was created in, moved in or out of, or removed from;
+     * NULL if the event is about `id' itself
+     */
+    const struct rbh_id *parent;
+    const char *name;
+    /* The entry the event is about, NULL if it is not known */
+    const struct rbh_id *id;
+    /* The type of `id', only set for new entries */
+    mode_t mode;
+};
+
+/* An entry found in a directory inotify started watching after it was created,
+ * and for which no event will ever be read.
+ */
+struct pending_entry {
+    struct rbh_id parent;
+    const char *name;
+    char data[];
+};
+
+struct posix_source {
+    struct source source;
+
+    int fd;
+    int mount_fd;
+    int (*next_event)(struct posix_source *source, struct watch_event *event);
+
+    char buffer[EVENT_BUFFER_SIZE] __attribute__((aligned(8)));
+    size_t length;
+    size_t offset;
+
+    /* The fsevents of the last event read */
+    struct rbh_iterator *fsevents;
+
+    /* fanotify reports the id of the entries that are created, moved, and
+     * deleted (since Linux 5.17)
+     */
+    bool target_fid;
+
+    /* inotify: the id of watched directories, indexed by watch descriptor */
+    struct rbh_id **watches;
+    size_t watch_count;
+
+    /* inotify: a queue of entries to report the creation of */
+    struct pending_entry **pending;
+    size_t pending_head;
+    size_t pending_count;
+    size_t pending_size;
+};
+
+/*----------------------------------------------------------------------------*
+ |                                    ids                                     |
+ *----------------------------------------------------------------------------*/
+
+/* Keep whatever is pushed on the source stack next aligned */
+static void *
+stack_alloc(const void *data, size_t size)
+{
+    const size_t ALIGNMENT = sizeof(void *);
+    void *copy;
+
+    copy = source_stack_alloc(NULL, (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1));
+    if (copy != NULL && data != NULL)
+        memcpy(copy, data, size);
+
+    return copy;
+}
+
+static struct rbh_id *
+stack_id(const struct rbh_id *id)
+{
+    struct rbh_id *copy;
+    size_t data_size;
+    char *data;
+
+    data_size = id->size;
+    copy = stack_alloc(NULL, sizeof(*copy) + data_size);
+    if (copy == NULL)
+        return NULL;
+
+    data = (char *)(copy + 1);
+    if (rbh_id_copy(copy, id, &data, &data_size))
+        return NULL;
+
+    return copy;
+}
+
+static struct rbh_id *
+build_id(const struct file_handle *handle)
+{
+    struct rbh_id *tmp_id;
+    struct rbh_id *id;
+
+    tmp_id = rbh_id_from_file_handle(handle);
+    if (tmp_id == NULL)
+        return NULL;
+
+    id = stack_id(tmp_id);
+    free(tmp_id);
+    return id;
+}
+
+static struct rbh_id *
+id_from_fd(int fd)
+{
+    union {
+        struct file_handle handle;
+        char buffer[sizeof(struct file_handle) + MAX_HANDLE_SZ];
+    } u = {
+        .handle.handle_bytes = MAX_HANDLE_SZ,
+    };
+    int mount_id;
+
+    if (name_to_handle_at(fd, "", &u.handle, &mount_id, AT_EMPTY_PATH))
+        return NULL;
+
+    return build_id(&u.handle);
+}
+
+static int
+open_by_id(int mount_fd, const struct rbh_id *id, int flags)
+{
+    struct file_handle *handle;
+    int save_errno;
+    int fd;
+
+    handle = rbh_file_handle_from_id(id);
+    if (handle == NULL)
+        return -1;
+
+    fd = open_by_handle_at(mount_fd, handle, flags);
+    save_errno = errno;
+    free(handle);
+    errno = save_errno;
+    return fd;
+}
+
+static bool
+is_gone(int errnum)
+{
+    return errnum == ENOENT || errnum == ESTALE;
+}
+
+/* Open (with O_PATH) the entry \p event is about, and fill in its id and type
+ *
+ * The entry is looked up by id if it is known, by name otherwise.
+ */
+static int
+open_entry(int mount_fd, struct watch_event *event)
+{
+    const int FLAGS = O_PATH | O_NOFOLLOW | O_CLOEXEC;
+    struct stat statbuf;
+    int save_errno;
+    int fd;
+
+    if (event->id) {
+        fd = open_by_id(mount_fd, event->id, FLAGS);
+    } else {
+        int dirfd;
+
+        dirfd = open_by_id(mount_fd, event->parent, FLAGS | O_DIRECTORY);
+        if (dirfd < 0)
+            return -1;
+
+        fd = openat(dirfd, event->name, FLAGS);
+        save_errno = errno;
+        /* Ignore errors on close */
+        close(dirfd);
+        errno = save_errno;
+    }
+    if (fd < 0)
+        return -1;
+
+    if (fstatat(fd, "", &statbuf, AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW))
+        goto out_close;
+    event->mode = statbuf.st_mode;
+
+    if (event->id == NULL) {
+        event->id = id_from_fd(fd);
+        if (event->id == NULL)
+            goto out_close;
+    }
+
+    return fd;
+
+out_close:
+    save_errno = errno;
+    /* Ignore errors on close */
+    close(fd);
+    errno = save_errno;
+    return -1;
+}
+
+/*----------------------------------------------------------------------------*
+ |                                  fsevents                                  |
+ *----------------------------------------------------------------------------*/
+
+/* link + symlink + statx + unlink + parent + delete */
+#define MAX_FSEVENTS 6
+
+static void
+link_fsevent(struct rbh_fsevent *fsevent, enum rbh_fsevent_type type,
+             const struct watch_event *event)
+{
+    fsevent->type = type;
+    fsevent->link.parent_id = event->parent;
+    fsevent->link.name = event->name;
+}
+
+static int
+statx_fsevent(struct rbh_fsevent *fsevent, uint32_t statx_enrich_mask)
+{
+    fsevent->type = RBH_FET_UPSERT;
+    fsevent->xattrs = build_enrich_map(fill_statx, &statx_enrich_mask);
+    return fsevent->xattrs.pairs == NULL ? -1 : 0;
+}
+
+/* The fsevents are mostly the same as those of the equivalent Lustre
+ * changelog records: renames are split in an unlink (WEF_MOVED_FROM) and a
+ * link (WEF_MOVED_TO).
+ */
+static int
+build_fsevents(const struct watch_event *event,
+               struct rbh_iterator **fsevents_iterator)
+{
+    const uint32_t PARENT_MASK = RBH_STATX_ATIME | RBH_STATX_CTIME
+                               | RBH_STATX_MTIME;
+    struct rbh_fsevent *fsevents;
+    uint32_t statx_mask = 0;
+    size_t count = 0;
+
+    fsevents = stack_alloc(NULL, sizeof(*fsevents) * MAX_FSEVENTS);
+    if (fsevents == NULL)
+        return -1;
+    memset(fsevents, 0, sizeof(*fsevents) * MAX_FSEVENTS);
+
+    for (size_t i = 0; i < MAX_FSEVENTS && event->id; i++)
+        fsevents[i].id = *event->id;
+
+    if (event->flags & WEF_NEW_ENTRY) {
+        link_fsevent(&fsevents[count], RBH_FET_LINK, event);
+        fsevents[count].xattrs = build_enrich_map(build_empty_map, "path");
+        if (fsevents[count++].xattrs.pairs == NULL)
+            return -1;
+
+        statx_mask = RBH_STATX_ALL;
+        if (S_ISLNK(event->mode)) {
+            fsevents[count].type = RBH_FET_UPSERT;
+            fsevents[count].xattrs = build_enrich_map(build_symlink_enrich_map,
+                                                      NULL);
+            if (fsevents[count++].xattrs.pairs == NULL)
+                return -1;
+        }
+    }
+
+    if (event->flags & WEF_ATTRIB)
+        statx_mask |= RBH_STATX_ALL;
+    if (event->flags & WEF_MODIFY)
+        statx_mask |= RBH_STATX_MTIME | RBH_STATX_CTIME | RBH_STATX_SIZE
+                    | RBH_STATX_BLOCKS;
+    if (statx_mask && event->id) {
+        if (statx_fsevent(&fsevents[count++], statx_mask))
+            return -1;
+    }
+
+    /* Without an id, the unlinked entry will linger in the catalog until the
+     * next rbh-sync, or until its last link is removed (WEF_DELETE_SELF)
+     */
+    if (event->flags & WEF_OLD_ENTRY && event->id)
+        link_fsevent(&fsevents[count++], RBH_FET_UNLINK, event);
+
+    /* Update the parent information after adding or removing an entry */
+    if (event->flags & (WEF_NEW_ENTRY | WEF_OLD_ENTRY) && event->parent) {
+        fsevents[count].id = *event->parent;
+        if (statx_fsevent(&fsevents[count++], PARENT_MASK))
+            return -1;
+    }
+
+    if (event->flags & WEF_DELETE_SELF && event->id)
+        fsevents[count++].type = RBH_FET_DELETE;
+
+    *fsevents_iterator = count == 0 ? NULL :
+        rbh_iter_array(fsevents, sizeof(*fsevents), count);
+    if (count != 0 && *fsevents_iterator == NULL)
+        return -1;
+
+    return 0;
+}
+
+/* Wait at most IDLE_TIMEOUT for events to read, ENODATA if there are none */
+static int
+read_events(struct posix_source *source)
+{
+    struct pollfd pollfd = {
+        .fd = source->fd,
+        .events = POLLIN,
+    };
+    ssize_t length;
+    int rc;
+
+    rc = poll(&pollfd, 1, IDLE_TIMEOUT);
+    if (rc == -1)
+        return -1;
+    if (rc == 0) {
+        errno = ENODATA;
+        return -1;
+    }
+
+    length = read(source->fd, source->buffer, sizeof(source->buffer));
+    if (length == -1)
+        return -1;
+
+    source->length = length;
+    source->offset = 0;
+    return 0;
+}
+
+static void
+warn_overflow(void)
+{
+    error(0, 0, "the event queue overflowed: some fsevents were lost, run rbh-sync to catch up");
+}
+
+/*----------------------------------------------------------------------------*
+ |                                  fanotify                                  |
+ *----------------------------------------------------------------------------*/
+
+#ifdef FAN_REPORT_DFID_NAME
+
+#define FANOTIFY_MASK (FAN_CREATE | FAN_MOVED_TO | FAN_ATTRIB | FAN_MODIFY \
+                     | FAN_MOVED_FROM | FAN_DELETE | FAN_DELETE_SELF      \
+                     | FAN_ONDIR)
+
+static uint32_t
+fanotify2flags(uint64_t mask)
+{
+    uint32_t flags = 0;
+
+    if (mask & FAN_CREATE)
+        flags |= WEF_CREATE;
+    if (mask & FAN_MOVED_TO)
+        flags |= WEF_MOVED_TO;
+    if (mask & FAN_ATTRIB)
+        flags |= WEF_ATTRIB;
+    if (mask & FAN_MODIFY)
+        flags |= WEF_MODIFY;
+    if (mask & FAN_MOVED_FROM)
+        flags |= WEF_MOVED_FROM;
+    if (mask & FAN_DELETE)
+        flags |= WEF_DELETE;
+    if (mask & FAN_DELETE_SELF)
+        flags |= WEF_DELETE_SELF;
+
+    return flags;
+}
+
+static bool
+handle_equal(const struct file_handle *first, const struct file_handle *second)
+{
+    return first->handle_type == second->handle_type
+        && first->handle_bytes == second->handle_bytes
+        && memcmp(first->f_handle, second->f_handle, first->handle_bytes) == 0;
+}
+
+static int
+fanotify_event_parse(struct posix_source *source,
+                     const struct fanotify_event_metadata *metadata,
+                     const char *record, struct watch_event *event)
+{
+    const char *end = record + metadata->event_len;
+    const char *info = record + metadata->metadata_len;
+    const struct file_handle *object = NULL;
+    const struct file_handle *dir = NULL;
+    const char *name = NULL;
+    int fd;
+
+    while (info < end) {
+        const struct fanotify_event_info_fid *fid = (const void *)info;
+        const struct file_handle *handle = (const void *)fid->handle;
+
+        switch (fid->hdr.info_type) {
+        case FAN_EVENT_INFO_TYPE_FID:
+            object = handle;
+            break;
+        case FAN_EVENT_INFO_TYPE_DFID_NAME:
+            name = (const char *)handle->f_handle + handle->handle_bytes;
+            /* fall through */
+        case FAN_EVENT_INFO_TYPE_DFID:
+            dir = handle;
+            break;
+        }
+        info += fid->hdr.len;
+    }
+
+    event->flags = fanotify2flags(metadata->mask);
+    event->parent = NULL;
+    event->name = NULL;
+    event->id = NULL;
+    event->mode = 0;
+
+    if (name != NULL && strcmp(name, ".") == 0)
+        name = NULL;
+
+    if (name == NULL) {
+        /* The event is about `dir' itself */
+        if (object == NULL)
+            object = dir;
+        dir = NULL;
+    } else if (!source->target_fid && object != NULL
+            && event->flags & (WEF_NEW_ENTRY | WEF_OLD_ENTRY)
+            && handle_equal(object, dir)) {
+        object = NULL;
+    }
+
+    if (dir) {
+        event->parent = build_id(dir);
+        if (event->parent == NULL)
+            return -1;
+
+        event->name = stack_alloc(name, strlen(name) + 1);
+        if (event->name == NULL)
+            return -1;
+    }
+
+    if (object) {
+        event->id = build_id(object);
+        if (event->id == NULL)
+            return -1;
+    }
+
+    if (!(event->flags & WEF_NEW_ENTRY) || event->parent == NULL)
+        return 0;
+
+    fd = open_entry(source->mount_fd, event);
+    if (fd < 0) {
+        if (!is_gone(errno))
+            return -1;
+
+        /* The entry is already gone, there is nothing to link */
+        event->flags &= ~WEF_NEW_ENTRY;
+        return 0;
+    }
+
+    /* Ignore errors on close */
+    close(fd);
+    return 0;
+}
+
+static int
+fanotify_next_event(struct posix_source *source, struct watch_event *event)
+{
+    while (true) {
+        struct fanotify_event_metadata metadata;
+        const char *record;
+
+        if (source->offset >= source->length && read_events(source))
+            return -1;
+
+        /* Records are only aligned on 4 bytes */
+        record = &source->buffer[source->offset];
+        memcpy(&metadata, record, sizeof(metadata));
+        source->offset += metadata.event_len;
+
+        if (metadata.vers != FANOTIFY_METADATA_VERSION) {
+            errno = EPROTO;
+            return -1;
+        }
+
+        if (metadata.mask & FAN_Q_OVERFLOW) {
+            warn_overflow();
+            continue;
+        }
+
+        return fanotify_event_parse(source, &metadata, record, event);
+    }
+}
+
+static int
+fanotify_watch(struct posix_source *source, const char *mount_path)
+{
+    const unsigned int REPORT_FLAGS[] = {
+#ifdef FAN_REPORT_TARGET_FID
+        FAN_REPORT_DFID_NAME | FAN_REPORT_FID | FAN_REPORT_TARGET_FID,
+#endif
+        FAN_REPORT_DFID_NAME | FAN_REPORT_FID,
+    };
+    int save_errno;
+    size_t i;
+    int fd;
+
+    for (i = 0; i < sizeof(REPORT_FLAGS) / sizeof(*REPORT_FLAGS); i++) {
+        fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK
+                         | REPORT_FLAGS[i], O_RDONLY | O_CLOEXEC);
+        if (fd >= 0 || errno != EINVAL)
+            break;
+    }
+    if (fd < 0)
+        return -1;
+
+    /* Dirent events are only reported for whole filesystems (or directories) */
+    if (fanotify_mark(fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, FANOTIFY_MASK,
+                      AT_FDCWD, mount_path)) {
+        save_errno = errno;
+        close(fd);
+        errno = save_errno;
+        return -1;
+    }
+
+    source->fd = fd;
+    source->next_event = fanotify_next_event;
+#ifdef FAN_REPORT_TARGET_FID
+    source->target_fid = REPORT_FLAGS[i] & FAN_REPORT_TARGET_FID;
+#endif
+    return 0;
+}
+
+#else
+
+static int
+fanotify_watch(struct posix_source *source, const char *mount_path)
+{
+    (void)source;
+    (void)mount_path;
+
+    errno = ENOTSUP;
+    return -1;
+}
+
+#endif
+
+/*----------------------------------------------------------------------------*
+ |                                  inotify                                   |
+ *----------------------------------------------------------------------------*/
+
+#define INOTIFY_MASK (IN_CREATE | IN_MOVED_TO | IN_ATTRIB | IN_MODIFY \
+                    | IN_MOVED_FROM | IN_DELETE | IN_DELETE_SELF | IN_ONLYDIR)
+
+static uint32_t
+inotify2flags(uint32_t mask)
+{
+    uint32_t flags = 0;
+
+    if (mask & IN_CREATE)
+        flags |= WEF_CREATE;
+    if (mask & IN_MOVED_TO)
+        flags |= WEF_MOVED_TO;
+    if (mask & IN_ATTRIB)
+        flags |= WEF_ATTRIB;
+    if (mask & IN_MODIFY)
+        flags |= WEF_MODIFY;
+    if (mask & IN_MOVED_FROM)
+        flags |= WEF_MOVED_FROM;
+    if (mask & IN_DELETE)
+        flags |= WEF_DELETE;
+    if (mask & IN_DELETE_SELF)
+        flags |= WEF_DELETE_SELF;
+
+    return flags;
+}
+
+/* Returns whether \p wd was already watched, -1 on error */
+static int
+watch_set(struct posix_source *source, int wd, const struct rbh_id *id)
+{
+    struct rbh_id *copy;
+
+    if ((size_t)wd >= source->watch_count) {
+        size_t count = source->watch_count ? : 64;
+        struct rbh_id **tmp;
+
+        while (count <= (size_t)wd)
+            count *= 2;
+
+        tmp = reallocarray(source->watches, count, sizeof(*tmp));
+        if (tmp == NULL)
+            return -1;
+
+        memset(&tmp[source->watch_count], 0,
+               (count - source->watch_count) * sizeof(*tmp));
+        source->watches = tmp;
+        source->watch_count = count;
+    }
+
+    if (source->watches[wd])
+        return 1;
+
+    copy = rbh_id_new(id->data, id->size);
+    if (copy == NULL)
+        return -1;
+
+    source->watches[wd] = copy;
+    return 0;
+}
+
+static const struct rbh_id *
+watch_get(struct posix_source *source, int wd)
+{
+    if (wd < 0 || (size_t)wd >= source->watch_count)
+        return NULL;
+    return source->watches[wd];
+}
+
+static void
+watch_forget(struct posix_source *source, int wd)
+{
+    if (wd < 0 || (size_t)wd >= source->watch_count)
+        return;
+
+    free(source->watches[wd]);
+    source->watches[wd] = NULL;
+}
+
+static int
+pending_push(struct posix_source *source, const struct rbh_id *parent,
+             const char *name)
+{
+    size_t name_length = strlen(name) + 1;
+    struct pending_entry *entry;
+
+    if (source->pending_count == source->pending_size) {
+        size_t size = source->pending_size ? source->pending_size * 2 : 64;
+        void *tmp;
+
+        tmp = reallocarray(source->pending, size, sizeof(*source->pending));
+        if (tmp == NULL)
+            return -1;
+
+        source->pending = tmp;
+        source->pending_size = size;
+    }
+
+    entry = malloc(sizeof(*entry) + parent->size + name_length);
+    if (entry == NULL)
+        return -1;
+
+    memcpy(entry->data, parent->data, parent->size);
+    entry->parent.data = entry->data;
+    entry->parent.size = parent->size;
+    entry->name = memcpy(entry->data + parent->size, name, name_length);
+
+    source->pending[source->pending_count++] = entry;
+    return 0;
+}
+
+static struct pending_entry *
+pending_pop(struct posix_source *source)
+{
+    struct pending_entry *entry;
+
+    if (source->pending_head == source->pending_count)
+        return NULL;
+
+    entry = source->pending[source->pending_head++];
+    if (source->pending_head == source->pending_count)
+        source->pending_head = source->pending_count = 0;
+
+    return entry;
+}
+
+/* Watch the directory \p fd (an O_PATH file descriptor) is open on
+ *
+ * Returns whether the directory was already watched, -1 on error.
+ */
+static int
+watch_directory(struct posix_source *source, int fd, const struct rbh_id *id)
+{
+    char path[sizeof("/proc/self/fd/") + 10];
+    int wd;
+
+    sprintf(path, "/proc/self/fd/%d", fd);
+    wd = inotify_add_watch(source->fd, path, INOTIFY_MASK);
+    if (wd == -1) {
+        if (errno == ENOSPC)
+            error(0, 0, "too many directories to watch, consider raising fs.inotify.max_user_watches");
+        return -1;
+    }
+
+    return watch_set(source, wd, id);
+}
+
+/* Watch a new directory, and queue its entries (they may have been created
+ * before the watch was added)
+ */
+static int
+watch_new_directory(struct posix_source *source, int fd,
+                    const struct rbh_id *id)
+{
+    struct dirent *dirent;
+    int save_errno;
+    int dirfd;
+    DIR *dir;
+    int rc;
+
+    rc = watch_directory(source, fd, id);
+    if (rc == -1)
+        return is_gone(errno) ? 0 : -1;
+    if (rc == 1)
+        /* The directory was moved, its entries are already known */
+        return 0;
+
+    dirfd = openat(fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd < 0)
+        return is_gone(errno) ? 0 : -1;
+
+    dir = fdopendir(dirfd);
+    if (dir == NULL) {
+        save_errno = errno;
+        close(dirfd);
+        errno = save_errno;
+        return -1;
+    }
+
+    rc = 0;
+    errno = 0;
+    while ((dirent = readdir(dir)) != NULL) {
+        if (strcmp(dirent->d_name, ".") == 0
+         || strcmp(dirent->d_name, "..") == 0)
+            continue;
+
+        rc = pending_push(source, id, dirent->d_name);
+        if (rc)
+            break;
+    }
+    if (dirent == NULL && errno != 0)
+        rc = -1;
+
+    save_errno = errno;
+    closedir(dir);
+    errno = save_errno;
+    return rc;
+}
+
+static int
+inotify_event_parse(struct posix_source *source, struct watch_event *event)
+{
+    int fd;
+
+    if (!(event->flags & (WEF_NEW_ENTRY | WEF_ATTRIB | WEF_MODIFY))
+     || event->id != NULL)
+        return 0;
+
+    fd = open_entry(source->mount_fd, event);
+    if (fd < 0) {
+        if (!is_gone(errno))
+            return -1;
+
+        event->flags &= ~(WEF_NEW_ENTRY | WEF_ATTRIB | WEF_MODIFY);
+        return 0;
+    }
+
+    if (event->flags & WEF_NEW_ENTRY && S_ISDIR(event->mode)
+     && watch_new_directory(source, fd, event->id)) {
+        int save_errno = errno;
+
+        close(fd);
+        errno = save_errno;
+        return -1;
+    }
+
+    /* Ignore errors on close */
+    close(fd);
+    return 0;
+}
+
+static int
+inotify_next_event(struct posix_source *source, struct watch_event *event)
+{
+    struct pending_entry *entry;
+
+    event->parent = NULL;
+    event->name = NULL;
+    event->id = NULL;
+    event->mode = 0;
+
+    entry = pending_pop(source);
+    if (entry) {
+        event->flags = WEF_CREATE;
+        event->parent = stack_id(&entry->parent);
+        event->name = stack_alloc(entry->name, strlen(entry->name) + 1);
+        free(entry);
+        if (event->parent == NULL || event->name == NULL)
+            return -1;
+
+        return inotify_event_parse(source, event);
+    }
+
+    while (true) {
+        const struct inotify_event *ievent;
+        const struct rbh_id *watched;
+
+        if (source->offset >= source->length && read_events(source))
+            return -1;
+
+        ievent = (const void *)&source->buffer[source->offset];
+        source->offset += sizeof(*ievent) + ievent->len;
+
+        if (ievent->mask & IN_Q_OVERFLOW) {
+            warn_overflow();
+            continue;
+        }
+
+        watched = watch_get(source, ievent->wd);
+        if (watched == NULL)
+            continue;
+
+        event->flags = inotify2flags(ievent->mask);
+        if (ievent->len == 0) {
+            /* The event is about the watched directory itself */
+            event->id = stack_id(watched);
+            if (event->id == NULL)
+                return -1;
+        } else {
+            event->parent = stack_id(watched);
+            if (event->parent == NULL)
+                return -1;
+
+            event->name = stack_alloc(ievent->name, strlen(ievent->name) + 1);
+            if (event->name == NULL)
+                return -1;
+        }
+
+        if (ievent->mask & IN_IGNORED)
+            watch_forget(source, ievent->wd);
+
+        return inotify_event_parse(source, event);
+    }
+}
+
+/* inotify only watches single directories: watch every one of them */
+static int
+inotify_watch(struct posix_source *source, const char *mount_path)
+{
+    char *paths[] = { (char *)mount_path, NULL };
+    struct rbh_id *id;
+    FTSENT *ftsent;
+    int save_errno;
+    FTS *fts;
+    int rc = 0;
+
+    source->fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (source->fd < 0)
+        return -1;
+
+    fts = fts_open(paths, FTS_PHYSICAL | FTS_NOCHDIR | FTS_XDEV, NULL);
+    if (fts == NULL)
+        goto out_close;
+
+    while ((ftsent = fts_read(fts)) != NULL) {
+        int fd;
+
+        if (ftsent->fts_info != FTS_D)
+            continue;
+
+        fd = open(ftsent->fts_accpath,
+                  O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0) {
+            if (is_gone(errno))
+                continue;
+            rc = -1;
+            break;
+        }
+
+        id = id_from_fd(fd);
+        rc = id == NULL ? -1 : watch_directory(source, fd, id);
+        save_errno = errno;
+        /* Ignore errors on close */
+        close(fd);
+        errno = save_errno;
+
+        flush_source_stack();
+        if (rc == -1) {
+            if (is_gone(errno)) {
+                rc = 0;
+                continue;
+            }
+            break;
+        }
+        rc = 0;
+    }
+
+    save_errno = errno;
+    fts_close(fts);
+    errno = save_errno;
+    if (rc == 0) {
+        source->next_event = inotify_next_event;
+        return 0;
+    }
+
+out_close:
+    save_errno = errno;
+    close(source->fd);
+    errno = save_errno;
+    return -1;
+}
+
+/*----------------------------------------------------------------------------*
+ |                                   source                                   |
+ *----------------------------------------------------------------------------*/
+
+static const void *
+posix_source_iter_next(void *iterator)
+{
+    struct posix_source *source = iterator;
+
+    while (true) {
+        const struct rbh_fsevent *fsevent;
+        struct watch_event event;
+
+        if (source->fsevents) {
+            fsevent = rbh_iter_next(source->fsevents);
+            if (fsevent != NULL)
+                return fsevent;
+
+            rbh_iter_destroy(source->fsevents);
+            source->fsevents = NULL;
+        }
+
+        flush_source_stack();
+
+        if (source->next_event(source, &event))
+            return NULL;
+
+        if (build_fsevents(&event, &source->fsevents))
+            return NULL;
+    }
+}
+
+static void
+posix_source_iter_destroy(void *iterator)
+{
+    struct posix_source *source = iterator;
+    struct pending_entry *entry;
+
+    if (source->fsevents)
+        rbh_iter_destroy(source->fsevents);
+
+    while ((entry = pending_pop(source)) != NULL)
+        free(entry);
+    free(source->pending);
+
+    for (size_t i = 0; i < source->watch_count; i++)
+        free(source->watches[i]);
+    free(source->watches);
+
+    close(source->fd);
+    close(source->mount_fd);
+    free(source);
+}
+
+static const struct rbh_iterator_operations POSIX_SOURCE_ITER_OPS = {
+    .next = posix_source_iter_next,
+    .destroy = posix_source_iter_destroy,
+};
+
+static const struct source POSIX_SOURCE = {
+    .name = "posix",
+    .fsevents = {
+        .ops = &POSIX_SOURCE_ITER_OPS,
+    },
+    .live = true,
+};
+
+struct source *
+source_from_posix(const char *mount_path)
+{
+    struct posix_source *source;
+
+    source = calloc(1, sizeof(*source));
+    if (source == NULL)
+        error(EXIT_FAILURE, errno, "calloc");
+
+    source->mount_fd = open(mount_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (source->mount_fd < 0)
+        error(EXIT_FAILURE, errno, "open: %s", mount_path);
+
+    initialize_source_stack(sizeof(struct rbh_value_pair) * (1 << 7));
+
+    if (fanotify_watch(source, mount_path)) {
+        fprintf(stderr, "%s: fanotify: %s, falling back to inotify\n",
+                program_invocation_short_name, strerror(errno));
+
+        if (inotify_watch(source, mount_path))
+            error(EXIT_FAILURE, errno, "cannot watch '%s'", mount_path);
+    }
+
+    source->source = POSIX_SOURCE;
+    return &source->source;
+}
@@ -98,6 +98,79 @@ build_enrich_map(struct rbh_value *(*part_builder)(void *),
     return ENRICH;
 }
 
+static struct rbh_value *
+build_statx_mask(void *arg)
+{
+    uint32_t enrich_mask = *(uint32_t *)arg;
+    const struct rbh_value MASK = {
+        .type = RBH_VT_UINT32,
+        .uint32 = enrich_mask,
+    };
+    struct rbh_value *mask;
+
+    mask = source_stack_alloc(NULL, sizeof(*mask));
+    if (mask == NULL)
+        return NULL;
+    *mask = MASK;
+
+    return mask;
+}
+
+static struct rbh_value *
+build_symlink_string(void *arg)
+{
+    const struct rbh_value SYMLINK = {
+        .type = RBH_VT_STRING,
+        .string = "symlink",
+    };
+
+    (void) arg;
+
+    return source_stack_alloc(&SYMLINK, sizeof(SYMLINK));
+}
+
+struct rbh_value *
+fill_enrich(const char *key, struct rbh_value *(*builder)(void *),
+            void *arg)
+{
+    const struct rbh_value ENRICH = {
+        .type = RBH_VT_MAP,
+        .map = {
+            .count = 1,
+            .pairs = build_pair(key, builder, arg),
+        },
+    };
+    struct rbh_value *enrich;
+
+    if (ENRICH.map.pairs == NULL)
+        return NULL;
+
+    enrich = source_stack_alloc(NULL, sizeof(*enrich));
+    if (enrich == NULL)
+        return NULL;
+    memcpy(enrich, &ENRICH, sizeof(*enrich));
+
+    return enrich;
+}
+
+/* BSON results:
+ * { "xattrs" : { "rbh-fsevents" : { "statx" : 1234567 } } }
+ */
+struct rbh_value *
+fill_statx(void *arg)
+{
+    return fill_enrich("statx", build_statx_mask, arg);
+}
+
+/* BSON results:
+ * { "xattrs" : { "rbh-fsevents" : { "symlink" : "symlink" } } }
+ */
+struct rbh_value *
+build_symlink_enrich_map(void *arg)
+{
+    return fill_enrich("symlink", build_symlink_string, arg);
+}
+
 void *
 source_stack_alloc(const void *data, size_t size)
 {
@@ -0,0 +1,142 @@
+#!/usr/bin/env bash
+
+# This file is part of RobinHood 4
+# Copyright (C) 2023 Commissariat a l'energie atomique et aux energies
+#                    alternatives
+#
+# SPDX-License-Identifer: LGPL-3.0-or-later
+
+test_dir=$(dirname $(readlink -e $0))
+. $test_dir/../test_utils.bash
+. $test_dir/lustre_utils.bash
+
+################################################################################
+#                                  UTILITIES                                   #
+################################################################################
+
+invoke_rbh-fsevents_ignore()
+{
+    local rules=()
+
+    for rule in "$@"; do
+        rules+=(--ignore "$rule")
+    done
+
+    rbh_fsevents --enrich rbh:lustre:"$LUSTRE_DIR" "${rules[@]}" \
+        src:lustre:"$LUSTRE_MDT" "rbh:mongo:$testdb"
+}
+
+count_entries()
+{
+    mongo "$testdb" --eval "db.entries.count({$1})"
+}
+
+################################################################################
+#                                    TESTS                                     #
+################################################################################
+
+test_ignore_type()
+{
+    local entry="test_file"
+
+    touch "$entry"
+    setfattr -n user.test -v 42 "$entry"
+
+    invoke_rbh-fsevents_ignore "type:XATTR" 2> "report" ||
+        error "rbh-fsevents failed: $(cat report)"
+
+    find_attribute '"ns.name":"'$entry'"'
+
+    grep -q "$LUSTRE_MDT: dropped 1 records by type (XATTR: 1)" "report" ||
+        error "dropped records were not reported: $(cat report)"
+}
+
+test_ignore_xattr()
+{
+    local entry="test_file"
+
+    touch "$entry"
+
+    invoke_rbh-fsevents
+
+    clear_changelogs "$LUSTRE_MDT" "$userid"
+    setfattr -n user.skipped -v 42 "$entry"
+    setfattr -n user.kept -v 43 "$entry"
+
+    invoke_rbh-fsevents_ignore "xattr:user.skip*" 2> "report" ||
+        error "rbh-fsevents failed: $(cat report)"
+
+    find_attribute '"xattrs.user.kept":{$exists: true}' '"ns.name":"'$entry'"'
+
+    grep -q "$LUSTRE_MDT: dropped 1 records by xattr" "report" ||
+        error "dropped records were not reported: $(cat report)"
+}
+
+test_ignore_fid()
+{
+    mkdir "ignored" "kept"
+    touch "ignored/file" "kept/file"
+
+    invoke_rbh-fsevents_ignore "fid:$(lfs path2fid "ignored")"
+
+    # "ignored" itself is not under "ignored"
+    find_attribute '"ns.name":"ignored"'
+    find_attribute '"ns.name":"kept"'
+
+    local count=$(count_entries '"ns.name":"file"')
+    if [[ $count -ne 1 ]]; then
+        error "Expected 1 entry named 'file', found '$count'"
+    fi
+}
+
+test_ignore_fid_rename_out()
+{
+    mkdir "ignored" "kept"
+
+    invoke_rbh-fsevents
+
+    clear_changelogs "$LUSTRE_MDT" "$userid"
+    touch "ignored/file"
+    mv "ignored/file" "kept/moved"
+
+    invoke_rbh-fsevents_ignore "fid:$(lfs path2fid "ignored")"
+
+    # Entries renamed out of an ignored subtree are not missed
+    find_attribute '"ns.name":"moved"'
+}
+
+test_ignore_invalid()
+{
+    local rc=0
+
+    invoke_rbh-fsevents_ignore "bogus" || rc=$?
+    if [[ $rc -ne 64 ]]; then
+        error "An invalid rule should be a usage error (64), got '$rc'"
+    fi
+
+    rc=0
+    invoke_rbh-fsevents_ignore "type:NOT_A_TYPE" || rc=$?
+    if [[ $rc -ne 64 ]]; then
+        error "An unknown record type should be a usage error (64), got '$rc'"
+    fi
+}
+
+################################################################################
+#                                     MAIN                                     #
+################################################################################
+
+declare -a tests=(test_ignore_type test_ignore_xattr test_ignore_fid
+                  test_ignore_fid_rename_out test_ignore_invalid)
+
+LUSTRE_DIR=/mnt/lustre/
+cd "$LUSTRE_DIR"
+
+LUSTRE_MDT=lustre-MDT0000
+userid="$(start_changelogs "$LUSTRE_MDT")"
+
+tmpdir=$(mktemp --directory --tmpdir=$LUSTRE_DIR)
+lfs setdirstripe -D -i 0 $tmpdir
+trap -- "rm -rf '$tmpdir'; stop_changelogs '$LUSTRE_MDT' '$userid'" EXIT
+cd "$tmpdir"
+
+run_tests lustre_setup lustre_teardown "${tests[@]}"
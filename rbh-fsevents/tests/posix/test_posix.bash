@@ -0,0 +1,132 @@
+#!/usr/bin/env bash
+
+# This file is part of RobinHood 4
+# Copyright (C) 2024 Commissariat a l'energie atomique et aux energies
+#                    alternatives
+#
+# SPDX-License-Identifer: LGPL-3.0-or-later
+
+test_dir=$(dirname $(readlink -e $0))
+. $test_dir/../test_utils.bash
+
+################################################################################
+#                                  UTILITIES                                   #
+################################################################################
+
+# A posix source is watched until rbh-fsevents is interrupted: run rbh-fsevents
+# in the background while "$@" runs (with $workers workers, if set)
+invoke_rbh-fsevents()
+{
+    rbh_fsevents --enrich rbh:posix:"$POSIX_DIR" --workers "${workers:-1}" \
+        src:posix:"$POSIX_DIR" "rbh:mongo:$testdb" &
+    local pid=$!
+
+    # Wait for rbh-fsevents to watch $POSIX_DIR
+    sleep 1
+    "$@"
+    # rbh-fsevents flushes its fsevents once the filesystem is idle
+    sleep 3
+
+    kill $pid
+    wait $pid || true
+}
+
+mountless_path()
+{
+    local path="$(realpath --no-symlinks "$1")"
+
+    echo "${path#$POSIX_DIR}"
+}
+
+count_entries()
+{
+    mongo "$testdb" --eval "db.entries.countDocuments($1)"
+}
+
+################################################################################
+#                                    TESTS                                     #
+################################################################################
+
+test_create()
+{
+    invoke_rbh-fsevents eval 'mkdir dir && echo data > dir/file'
+
+    find_attribute '"ns.xattrs.path":"'$(mountless_path dir)'"' \
+                   '"statx.type":'$((0040000))
+    find_attribute '"ns.xattrs.path":"'$(mountless_path dir/file)'"' \
+                   '"statx.size":NumberLong(5)'
+}
+
+test_symlink()
+{
+    invoke_rbh-fsevents ln -s target link
+
+    find_attribute '"ns.xattrs.path":"'$(mountless_path link)'"' \
+                   '"symlink":"target"'
+}
+
+test_rename()
+{
+    invoke_rbh-fsevents eval 'touch file && mkdir dir && mv file dir/renamed'
+
+    find_attribute '"ns.xattrs.path":"'$(mountless_path dir/renamed)'"'
+    if [[ $(count_entries '{"ns.name":"file"}') != 0 ]]; then
+        error "file should have been renamed"
+    fi
+}
+
+test_unlink()
+{
+    touch file
+
+    invoke_rbh-fsevents eval 'echo data > file && rm file'
+
+    if [[ $(count_entries '{"ns.name":"file"}') != 0 ]]; then
+        error "file should have been deleted"
+    fi
+}
+
+test_workers()
+{
+    local workers=4
+
+    invoke_rbh-fsevents eval 'mkdir dir &&
+        for i in $(seq 64); do echo $i > dir/file$i; done &&
+        for i in $(seq 32); do mv dir/file$i dir/renamed$i; done &&
+        for i in $(seq 33 48); do rm dir/file$i; done'
+
+    # Every fsevent was applied...
+    if [[ $(count_entries '{"ns.name":/^renamed/}') != 32 ]]; then
+        error "every renamed file should be in the database"
+    fi
+    if [[ $(count_entries '{"ns.name":/^file/}') != 16 ]]; then
+        error "only the files that were neither renamed nor deleted should" \
+              "be in the database"
+    fi
+
+    # ... and the fsevents about a single entry were applied in order
+    for i in 1 32; do
+        find_attribute '"ns.xattrs.path":"'$(mountless_path dir/renamed$i)'"' \
+                       '"statx.size":NumberLong('$((${#i} + 1))')'
+    done
+    find_attribute '"ns.xattrs.path":"'$(mountless_path dir/file64)'"' \
+                   '"statx.size":NumberLong(3)'
+}
+
+################################################################################
+#                                     MAIN                                     #
+################################################################################
+
+if [[ $(id -u) != 0 ]]; then
+    echo "watching a whole filesystem requires CAP_SYS_ADMIN"
+    exit 77
+fi
+
+declare -a tests=(test_create test_symlink test_rename test_unlink test_workers)
+
+POSIX_DIR=$(mktemp --directory)
+mount -t tmpfs tmpfs "$POSIX_DIR"
+trap -- "umount '$POSIX_DIR'; rmdir '$POSIX_DIR'" EXIT
+cd "$POSIX_DIR"
+
+run_tests "" "" "${tests[@]}"
@@ -978,6 +978,144 @@ START_TEST(dedup_check_flush_order)
 }
 END_TEST
 
+START_TEST(dedup_keep_hot)
+{
+    struct rbh_mut_iterator *deduplicator;
+    struct source *fake_source = NULL;
+    struct rbh_fsevent fake_events[6];
+    struct rbh_mut_iterator *events;
+    struct rbh_fsevent *event;
+    struct rbh_id *ids[4];
+
+    for (size_t i = 0; i < 4; i++)
+        ids[i] = fake_id();
+
+    /* ids[0] is updated 3 times before the other ids enter the pool: it is the
+     * oldest id in the pool, but also the hottest one.
+     */
+    fake_xattr(&fake_events[0], ids[0], "test");
+    fake_xattr(&fake_events[1], ids[0], "test");
+    fake_xattr(&fake_events[2], ids[0], "test");
+    fake_xattr(&fake_events[3], ids[1], "test");
+    fake_xattr(&fake_events[4], ids[2], "test");
+    fake_xattr(&fake_events[5], ids[3], "test");
+
+    fake_source = event_list_source(fake_events, 6);
+    ck_assert_ptr_nonnull(fake_source);
+
+    deduplicator = deduplicator_new(4, 2, fake_source);
+    ck_assert_ptr_nonnull(deduplicator);
+    ck_assert_int_eq(deduplicator_keep_hot(deduplicator, 3600), 0);
+
+    /* The pool is full, the two oldest cold ids are flushed first */
+    events = rbh_mut_iter_next(deduplicator);
+    ck_assert_ptr_nonnull(events);
+
+    event = rbh_mut_iter_next(events);
+    ck_assert_ptr_nonnull(event);
+    ck_assert_id_eq(ids[1], &event->id);
+
+    event = rbh_mut_iter_next(events);
+    ck_assert_ptr_nonnull(event);
+    ck_assert_id_eq(ids[2], &event->id);
+
+    event = rbh_mut_iter_next(events);
+    ck_assert_ptr_null(event);
+    ck_assert_int_eq(errno, ENODATA);
+    rbh_mut_iter_destroy(events);
+
+    /* The source is exhausted, everything else is flushed, oldest first */
+    events = rbh_mut_iter_next(deduplicator);
+    ck_assert_ptr_nonnull(events);
+
+    event = rbh_mut_iter_next(events);
+    ck_assert_ptr_nonnull(event);
+    ck_assert_id_eq(ids[0], &event->id);
+
+    event = rbh_mut_iter_next(events);
+    ck_assert_ptr_nonnull(event);
+    ck_assert_id_eq(ids[3], &event->id);
+
+    event = rbh_mut_iter_next(events);
+    ck_assert_ptr_null(event);
+    ck_assert_int_eq(errno, ENODATA);
+
+    for (size_t i = 0; i < 4; i++)
+        free(ids[i]);
+    rbh_mut_iter_destroy(events);
+    rbh_mut_iter_destroy(deduplicator);
+    event_list_source_destroy(fake_source);
+}
+END_TEST
+
+START_TEST(dedup_adaptive_bounds)
+{
+    struct rbh_mut_iterator *deduplicator;
+    struct source *fake_source = NULL;
+    struct rbh_fsevent fake_events[200];
+    struct rbh_mut_iterator *events;
+    struct rbh_id *ids[200];
+    struct rbh_fsevent *event;
+    struct rbh_id *parent;
+    size_t total = 0;
+
+    parent = fake_id();
+    for (size_t i = 0; i < 200; i++) {
+        ids[i] = fake_id();
+        fake_create(&fake_events[i], ids[i], parent);
+    }
+
+    fake_source = event_list_source(fake_events, 200);
+    ck_assert_ptr_nonnull(fake_source);
+
+    deduplicator = adaptive_deduplicator_new(64, 32, 60000, fake_source);
+    ck_assert_ptr_nonnull(deduplicator);
+
+    /* Whatever the batch size is, no batch exceeds the maximum, and every
+     * fsevent is flushed once, in order
+     */
+    while ((events = rbh_mut_iter_next(deduplicator)) != NULL) {
+        size_t count = 0;
+
+        while ((event = rbh_mut_iter_next(events)) != NULL) {
+            ck_assert_uint_lt(total, 200);
+            ck_assert_id_eq(ids[total], &event->id);
+            total++;
+            count++;
+        }
+        ck_assert_int_eq(errno, ENODATA);
+        ck_assert_uint_le(count, 64);
+
+        rbh_mut_iter_destroy(events);
+    }
+    ck_assert_int_eq(errno, ENODATA);
+    ck_assert_uint_eq(total, 200);
+
+    for (size_t i = 0; i < 200; i++)
+        free(ids[i]);
+    free(parent);
+    rbh_mut_iter_destroy(deduplicator);
+    event_list_source_destroy(fake_source);
+}
+END_TEST
+
+START_TEST(dedup_adaptive_einval)
+{
+    struct source *fake_source;
+
+    fake_source = empty_source();
+    ck_assert_ptr_nonnull(fake_source);
+
+    errno = 0;
+    ck_assert_ptr_null(adaptive_deduplicator_new(20, 10, 0, fake_source));
+    ck_assert_int_eq(errno, EINVAL);
+
+    errno = 0;
+    ck_assert_ptr_null(adaptive_deduplicator_new(10, 20, 1000, fake_source));
+    ck_assert_int_eq(errno, EINVAL);
+}
+END_TEST
+
 static Suite *
 unit_suite(void)
 {
@@ -1009,6 +1147,9 @@ unit_suite(void)
     tcase_add_test(tests, dedup_xattr_merge_xattrs_with_fid);
     tcase_add_test(tests, dedup_xattr_merge_xattrs_fid_and_lustre);
     tcase_add_test(tests, dedup_check_flush_order);
+    tcase_add_test(tests, dedup_keep_hot);
+    tcase_add_test(tests, dedup_adaptive_bounds);
+    tcase_add_test(tests, dedup_adaptive_einval);
 
     suite_add_tcase(suite, tests);
 
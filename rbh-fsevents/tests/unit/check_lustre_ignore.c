@@ -0,0 +1,481 @@
+/* This file is part of the RobinHood Library
+ * Copyright (C) 2019 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: LGPL-3.0-or-later
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+
+#include "check-compat.h"
+#include "check_macros.h"
+
+#include "lustre_ignore.h"
+
+/*----------------------------------------------------------------------------*
+ |                                 fake paths                                 |
+ *----------------------------------------------------------------------------*/
+
+enum fake_entry {
+    FE_IGNORED,         /* ignored */
+    FE_IGNORED_FILE,    /* ignored/file */
+    FE_KEPT,            /* kept */
+    FE_KEPT_DIR,        /* kept/dir */
+    FE_COUNT,
+};
+
+static const struct lu_fid FIDS[FE_COUNT] = {
+    [FE_IGNORED]        = { .f_seq = 0x200000401, .f_oid = 0x1 },
+    [FE_IGNORED_FILE]   = { .f_seq = 0x200000401, .f_oid = 0x2 },
+    [FE_KEPT]           = { .f_seq = 0x200000401, .f_oid = 0x3 },
+    [FE_KEPT_DIR]       = { .f_seq = 0x200000401, .f_oid = 0x4 },
+};
+
+#define IGNORED_FID "fid:[0x200000401:0x1:0x0]"
+
+static const char *paths[FE_COUNT];
+static size_t resolved;
+
+static void
+fake_paths_init(void)
+{
+    paths[FE_IGNORED] = "ignored";
+    paths[FE_IGNORED_FILE] = "ignored/file";
+    paths[FE_KEPT] = "kept";
+    paths[FE_KEPT_DIR] = "kept/dir";
+    resolved = 0;
+}
+
+/* Mimics lustre_fid_path() without a mounted filesystem */
+static int
+fake_fid_path(const char *fsname, const struct lu_fid *fid,
+              char path[PATH_MAX])
+{
+    ck_assert_str_eq(fsname, "lustre");
+    resolved++;
+
+    for (size_t i = 0; i < FE_COUNT; i++) {
+        if (memcmp(fid, &FIDS[i], sizeof(*fid)) == 0) {
+            strcpy(path, paths[i]);
+            return 0;
+        }
+    }
+
+    errno = ENOENT;
+    return -1;
+}
+
+/*----------------------------------------------------------------------------*
+ |                                fake records                                |
+ *----------------------------------------------------------------------------*/
+
+struct fake_record {
+    alignas(struct changelog_rec) char buffer[1 << 12];
+};
+
+static struct changelog_rec *
+fake_record(struct fake_record *fake, enum changelog_rec_type type,
+            uint16_t flags, enum fake_entry target, enum fake_entry parent)
+{
+    struct changelog_rec *record = (struct changelog_rec *)fake->buffer;
+
+    memset(fake, 0, sizeof(*fake));
+    record->cr_type = type;
+    record->cr_flags = CLF_VERSION | flags;
+    record->cr_tfid = FIDS[target];
+    if (parent != FE_COUNT)
+        record->cr_pfid = FIDS[parent];
+
+    return record;
+}
+
+static struct changelog_rec *
+fake_rename(struct fake_record *fake, enum fake_entry target,
+            enum fake_entry source_parent, enum fake_entry parent)
+{
+    struct changelog_rec *record;
+
+    record = fake_record(fake, CL_RENAME, CLF_RENAME, target, parent);
+    changelog_rec_rename(record)->cr_sfid = FIDS[target];
+    changelog_rec_rename(record)->cr_spfid = FIDS[source_parent];
+
+    return record;
+}
+
+static struct changelog_rec *
+fake_jobid(struct fake_record *fake, const char *jobid)
+{
+    struct changelog_rec *record;
+
+    record = fake_record(fake, CL_CREATE, CLF_JOBID, FE_KEPT_DIR, FE_KEPT);
+    strcpy(changelog_rec_jobid(record)->cr_jobid, jobid);
+
+    return record;
+}
+
+static struct changelog_rec *
+fake_setxattr(struct fake_record *fake, const char *name)
+{
+    struct changelog_rec *record;
+
+    record = fake_record(fake, CL_SETXATTR, CLF_EXTRA_FLAGS, FE_KEPT_DIR,
+                         FE_COUNT);
+    changelog_rec_extra_flags(record)->cr_extra_flags = CLFE_XATTR;
+    strcpy(changelog_rec_xattr(record)->cr_xattr, name);
+
+    return record;
+}
+
+/*----------------------------------------------------------------------------*
+ |                                   tests                                    |
+ *----------------------------------------------------------------------------*/
+
+#define rules_init(rules, ...) \
+    ignore_rules_init(rules, "lustre-MDT0000", (const char *[]){ __VA_ARGS__ },\
+                      sizeof((const char *[]){ __VA_ARGS__ }) / sizeof(char *),\
+                      fake_fid_path)
+
+START_TEST(ir_none)
+{
+    struct ignore_rules rules;
+    struct fake_record fake;
+
+    fake_paths_init();
+    ignore_rules_init(&rules, "lustre-MDT0000", NULL, 0, fake_fid_path);
+
+    ck_assert(!ignore_record(&rules, fake_record(&fake, CL_CLOSE, 0,
+                                                 FE_IGNORED_FILE, FE_COUNT)));
+    ck_assert(!ignore_record(&rules, fake_jobid(&fake, "dd.0")));
+    ck_assert_uint_eq(resolved, 0);
+
+    ignore_rules_fini(&rules);
+}
+END_TEST
+
+START_TEST(ir_type)
+{
+    struct ignore_rules rules;
+    struct fake_record fake;
+
+    fake_paths_init();
+    rules_init(&rules, "type:CLOSE", "type:atime");
+
+    ck_assert(ignore_record(&rules, fake_record(&fake, CL_CLOSE, 0, FE_KEPT,
+                                                FE_COUNT)));
+    ck_assert(ignore_record(&rules, fake_record(&fake, CL_ATIME, 0, FE_KEPT,
+                                                FE_COUNT)));
+    ck_assert(ignore_record(&rules, fake_record(&fake, CL_ATIME, 0, FE_KEPT,
+                                                FE_COUNT)));
+    ck_assert(!ignore_record(&rules, fake_record(&fake, CL_CREATE, 0,
+                                                 FE_KEPT_DIR, FE_KEPT)));
+
+    ck_assert_uint_eq(rules.dropped[IR_TYPE], 3);
+    ck_assert_uint_eq(rules.dropped_types[CL_CLOSE], 1);
+    ck_assert_uint_eq(rules.dropped_types[CL_ATIME], 2);
+
+    ignore_rules_fini(&rules);
+}
+END_TEST
+
+START_TEST(ir_jobid)
+{
+    struct ignore_rules rules;
+    struct fake_record fake;
+
+    fake_paths_init();
+    rules_init(&rules, "jobid:dd.*", "jobid:rsync.[0-9]");
+
+    ck_assert(ignore_record(&rules, fake_jobid(&fake, "dd.0")));
+    ck_assert(ignore_record(&rules, fake_jobid(&fake, "rsync.1")));
+    ck_assert(!ignore_record(&rules, fake_jobid(&fake, "rsync.10")));
+    ck_assert(!ignore_record(&rules, fake_jobid(&fake, "cp.0")));
+    /* Records without a jobid are kept */
+    ck_assert(!ignore_record(&rules, fake_record(&fake, CL_CREATE, 0,
+                                                 FE_KEPT_DIR, FE_KEPT)));
+
+    ck_assert_uint_eq(rules.dropped[IR_JOBID], 2);
+
+    ignore_rules_fini(&rules);
+}
+END_TEST
+
+START_TEST(ir_xattr)
+{
+    struct ignore_rules rules;
+    struct fake_record fake;
+
+    fake_paths_init();
+    rules_init(&rules, "xattr:trusted.*");
+
+    ck_assert(ignore_record(&rules, fake_setxattr(&fake, "trusted.hsm")));
+    ck_assert(!ignore_record(&rules, fake_setxattr(&fake, "user.hsm")));
+
+    ck_assert_uint_eq(rules.dropped[IR_XATTR], 1);
+
+    ignore_rules_fini(&rules);
+}
+END_TEST
+
+START_TEST(ir_subtree)
+{
+    struct ignore_rules rules;
+    struct fake_record fake;
+
+    fake_paths_init();
+    rules_init(&rules, IGNORED_FID);
+
+    /* Namespace records are matched with the fid of the parent... */
+    ck_assert(ignore_record(&rules, fake_record(&fake, CL_CREATE, 0,
+                                                FE_IGNORED_FILE, FE_IGNORED)));
+    ck_assert(!ignore_record(&rules, fake_record(&fake, CL_MKDIR, 0,
+                                                 FE_KEPT_DIR, FE_KEPT)));
+
+    /* ... others with the fid of their target */
+    ck_assert(ignore_record(&rules, fake_record(&fake, CL_SETATTR, 0,
+                                                FE_IGNORED_FILE, FE_COUNT)));
+    ck_assert(ignore_record(&rules, fake_record(&fake, CL_SETATTR, 0,
+                                                FE_IGNORED, FE_COUNT)));
+    ck_assert(!ignore_record(&rules, fake_record(&fake, CL_SETATTR, 0,
+                                                 FE_KEPT, FE_COUNT)));
+
+    ck_assert_uint_eq(rules.dropped[IR_SUBTREE], 3);
+
+    ignore_rules_fini(&rules);
+}
+END_TEST
+
+START_TEST(ir_subtree_prefix)
+{
+    struct ignore_rules rules;
+    struct fake_record fake;
+
+    fake_paths_init();
+    /* Without the square brackets */
+    rules_init(&rules, "fid:0x200000401:0x1:0x0");
+
+    /* "ignored-too" is not under "ignored" */
+    paths[FE_KEPT] = "ignored-too";
+    ck_assert(!ignore_record(&rules, fake_record(&fake, CL_SETATTR, 0,
+                                                 FE_KEPT, FE_COUNT)));
+
+    ignore_rules_fini(&rules);
+}
+END_TEST
+
+START_TEST(ir_subtree_cached)
+{
+    struct ignore_rules rules;
+    struct fake_record fake;
+    size_t count;
+
+    fake_paths_init();
+    rules_init(&rules, IGNORED_FID);
+    count = resolved;
+
+    for (int i = 0; i < 4; i++) {
+        ck_assert(ignore_record(&rules, fake_record(&fake, CL_CREATE, 0,
+                                                    FE_IGNORED_FILE,
+                                                    FE_IGNORED)));
+        ck_assert(!ignore_record(&rules, fake_record(&fake, CL_CREATE, 0,
+                                                     FE_KEPT_DIR, FE_KEPT)));
+    }
+
+    /* The path of each parent is only resolved once */
+    ck_assert_uint_eq(resolved - count, 2);
+
+    ignore_rules_fini(&rules);
+}
+END_TEST
+
+START_TEST(ir_subtree_unresolved)
+{
+    struct ignore_rules rules;
+    struct fake_record fake;
+    struct changelog_rec *record;
+
+    fake_paths_init();
+    rules_init(&rules, IGNORED_FID);
+
+    /* Entries that are already gone are kept */
+    record = fake_record(&fake, CL_SETATTR, 0, FE_KEPT, FE_COUNT);
+    record->cr_tfid.f_oid = 0x42;
+    ck_assert(!ignore_record(&rules, record));
+
+    ignore_rules_fini(&rules);
+}
+END_TEST
+
+START_TEST(ir_rename)
+{
+    struct ignore_rules rules;
+    struct fake_record fake;
+
+    fake_paths_init();
+    rules_init(&rules, IGNORED_FID);
+
+    /* Within the subtree */
+    ck_assert(ignore_record(&rules, fake_rename(&fake, FE_IGNORED_FILE,
+                                                FE_IGNORED, FE_IGNORED)));
+    /* Out of the subtree */
+    ck_assert(!ignore_record(&rules, fake_rename(&fake, FE_IGNORED_FILE,
+                                                 FE_IGNORED, FE_KEPT)));
+    /* Into the subtree, the entry must leave the rest of the filesystem */
+    ck_assert(!ignore_record(&rules, fake_rename(&fake, FE_KEPT_DIR, FE_KEPT,
+                                                 FE_IGNORED)));
+
+    ck_assert_uint_eq(rules.dropped[IR_SUBTREE], 1);
+
+    ignore_rules_fini(&rules);
+}
+END_TEST
+
+START_TEST(ir_rename_resets_cache)
+{
+    struct ignore_rules rules;
+    struct fake_record fake;
+
+    fake_paths_init();
+    rules_init(&rules, IGNORED_FID);
+
+    ck_assert(!ignore_record(&rules, fake_record(&fake, CL_CREATE, 0,
+                                                 FE_IGNORED_FILE,
+                                                 FE_KEPT_DIR)));
+
+    /* mv /kept/dir /ignored/dir */
+    ck_assert(!ignore_record(&rules, fake_rename(&fake, FE_KEPT_DIR, FE_KEPT,
+                                                 FE_IGNORED)));
+    paths[FE_KEPT_DIR] = "ignored/dir";
+
+    /* What was cached about /kept/dir no longer holds */
+    ck_assert(ignore_record(&rules, fake_record(&fake, CL_CREATE, 0,
+                                                FE_IGNORED_FILE,
+                                                FE_KEPT_DIR)));
+
+    ignore_rules_fini(&rules);
+}
+END_TEST
+
+START_TEST(ir_ignored_rename_keeps_cache)
+{
+    struct ignore_rules rules;
+    struct fake_record fake;
+    size_t count;
+
+    fake_paths_init();
+    rules_init(&rules, IGNORED_FID);
+
+    ck_assert(!ignore_record(&rules, fake_record(&fake, CL_CREATE, 0,
+                                                 FE_KEPT_DIR, FE_KEPT)));
+    ck_assert(ignore_record(&rules, fake_rename(&fake, FE_IGNORED_FILE,
+                                                FE_IGNORED, FE_IGNORED)));
+    count = resolved;
+
+    /* Renames within an ignored subtree cannot move what is cached */
+    ck_assert(!ignore_record(&rules, fake_record(&fake, CL_CREATE, 0,
+                                                 FE_KEPT_DIR, FE_KEPT)));
+    ck_assert_uint_eq(resolved, count);
+
+    ignore_rules_fini(&rules);
+}
+END_TEST
+
+START_TEST(ir_combined)
+{
+    struct ignore_rules rules;
+    struct fake_record fake;
+
+    fake_paths_init();
+    rules_init(&rules, "type:CLOSE", IGNORED_FID, "jobid:dd.*");
+
+    /* The type is checked first, no path is resolved */
+    ck_assert(ignore_record(&rules, fake_record(&fake, CL_CLOSE, 0,
+                                                FE_IGNORED_FILE, FE_COUNT)));
+    ck_assert_uint_eq(resolved, 1);
+    ck_assert(ignore_record(&rules, fake_jobid(&fake, "dd.0")));
+    ck_assert_uint_eq(resolved, 1);
+    ck_assert(ignore_record(&rules, fake_record(&fake, CL_SETATTR, 0,
+                                                FE_IGNORED_FILE, FE_COUNT)));
+
+    ck_assert_uint_eq(rules.dropped[IR_TYPE], 1);
+    ck_assert_uint_eq(rules.dropped[IR_JOBID], 1);
+    ck_assert_uint_eq(rules.dropped[IR_SUBTREE], 1);
+
+    ignore_rules_fini(&rules);
+}
+END_TEST
+
+static const char * const INVALID_RULES[] = {
+    "CLOSE",
+    "kind:CLOSE",
+    "type:NOT_A_TYPE",
+    "fid:not-a-fid",
+    "fid:[0x200000401:0x1]",
+};
+
+START_TEST(ir_invalid)
+{
+    struct ignore_rules rules;
+
+    fake_paths_init();
+    rules_init(&rules, INVALID_RULES[_i]);
+}
+END_TEST
+
+static Suite *
+unit_suite(void)
+{
+    Suite *suite;
+    TCase *tests;
+
+    suite = suite_create("lustre ignore rules");
+    tests = tcase_create("ignore_record");
+    tcase_add_test(tests, ir_none);
+    tcase_add_test(tests, ir_type);
+    tcase_add_test(tests, ir_jobid);
+    tcase_add_test(tests, ir_xattr);
+    tcase_add_test(tests, ir_subtree);
+    tcase_add_test(tests, ir_subtree_prefix);
+    tcase_add_test(tests, ir_subtree_cached);
+    tcase_add_test(tests, ir_subtree_unresolved);
+    tcase_add_test(tests, ir_rename);
+    tcase_add_test(tests, ir_rename_resets_cache);
+    tcase_add_test(tests, ir_ignored_rename_keeps_cache);
+    tcase_add_test(tests, ir_combined);
+
+    suite_add_tcase(suite, tests);
+
+    tests = tcase_create("ignore_rules_init");
+    tcase_add_loop_exit_test(tests, ir_invalid, EX_USAGE, 0,
+                             sizeof(INVALID_RULES) / sizeof(*INVALID_RULES));
+
+    suite_add_tcase(suite, tests);
+
+    return suite;
+}
+
+int
+main(void)
+{
+    int number_failed;
+    Suite *suite;
+    SRunner *runner;
+
+    suite = unit_suite();
+    runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
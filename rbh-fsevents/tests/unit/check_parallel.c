@@ -0,0 +1,312 @@
+/* This file is part of the RobinHood Library
+ * Copyright (C) 2019 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: LGPL-3.0-or-later
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check-compat.h"
+#include "check_macros.h"
+#include "utils.h"
+
+#include "sink.h"
+
+#include <robinhood/backend.h>
+#include <robinhood/itertools.h>
+
+/*----------------------------------------------------------------------------*
+ |                                record_sink                                 |
+ *----------------------------------------------------------------------------*/
+
+#define ID_COUNT 7
+#define EVENT_COUNT (ID_COUNT * 16)
+
+static struct rbh_id *ids[ID_COUNT];
+
+/* A sink that records which fsevents it processes, in order */
+struct record_sink {
+    struct sink sink;
+
+    /* The id for which processing fails (if any) */
+    const struct rbh_id *fail_id;
+    bool failed;
+
+    struct {
+        size_t id;
+        long seq;
+    } records[EVENT_COUNT];
+    size_t count;
+};
+
+static size_t
+id_index(const struct rbh_id *id)
+{
+    size_t i;
+
+    for (i = 0; i < ID_COUNT; i++) {
+        if (rbh_id_equal(ids[i], id))
+            break;
+    }
+    ck_assert_uint_lt(i, ID_COUNT);
+
+    return i;
+}
+
+static int
+record_sink_process(void *_sink, struct rbh_iterator *fsevents)
+{
+    struct record_sink *sink = _sink;
+
+    while (true) {
+        const struct rbh_fsevent *fsevent;
+
+        fsevent = rbh_iter_next(fsevents);
+        if (fsevent == NULL)
+            break;
+
+        if (sink->fail_id && rbh_id_equal(&fsevent->id, sink->fail_id)) {
+            snprintf(rbh_backend_error, sizeof(rbh_backend_error),
+                     "cannot process fsevent");
+            errno = RBH_BACKEND_ERROR;
+            sink->failed = true;
+            return -1;
+        }
+
+        ck_assert_uint_lt(sink->count, EVENT_COUNT);
+        sink->records[sink->count].id = id_index(&fsevent->id);
+        sink->records[sink->count].seq =
+            strtol(fsevent->xattrs.pairs[0].value->binary.data, NULL, 10);
+        sink->count++;
+    }
+
+    return errno == ENODATA ? 0 : -1;
+}
+
+static void
+record_sink_destroy(void *sink)
+{
+    (void)sink;
+}
+
+static const struct sink_operations RECORD_SINK_OPS = {
+    .process = record_sink_process,
+    .destroy = record_sink_destroy,
+};
+
+static void
+record_sinks_init(struct record_sink *sinks, struct sink **_sinks,
+                  size_t count)
+{
+    memset(sinks, 0, count * sizeof(*sinks));
+    for (size_t i = 0; i < count; i++) {
+        sinks[i].sink.name = "record";
+        sinks[i].sink.ops = &RECORD_SINK_OPS;
+        _sinks[i] = &sinks[i].sink;
+    }
+}
+
+/* Event number i is about ids[i % ID_COUNT] and carries the sequence number i
+ * as the value of its only xattr.
+ */
+static struct rbh_iterator *
+interleaved_fsevents(struct rbh_fsevent *fsevents,
+                     char seqs[EVENT_COUNT][16])
+{
+    for (size_t i = 0; i < ID_COUNT; i++)
+        ids[i] = fake_id();
+
+    for (size_t i = 0; i < EVENT_COUNT; i++) {
+        snprintf(seqs[i], sizeof(seqs[i]), "%zu", i);
+        fake_xattr_key_value(&fsevents[i], ids[i % ID_COUNT], "seq", seqs[i]);
+    }
+
+    return rbh_iter_array(fsevents, sizeof(*fsevents), EVENT_COUNT);
+}
+
+/*----------------------------------------------------------------------------*
+ |                                   tests                                    |
+ *----------------------------------------------------------------------------*/
+
+#define SINK_COUNT 3
+
+START_TEST(parallel_all_applied)
+{
+    struct record_sink records[SINK_COUNT];
+    struct rbh_fsevent fsevents[EVENT_COUNT];
+    struct sink *sinks[SINK_COUNT];
+    char seqs[EVENT_COUNT][16];
+    bool applied[EVENT_COUNT] = {};
+    struct rbh_iterator *iter;
+    struct sink *parallel;
+
+    record_sinks_init(records, sinks, SINK_COUNT);
+    parallel = sink_from_sinks(sinks, SINK_COUNT);
+    ck_assert_ptr_nonnull(parallel);
+    ck_assert_str_eq(parallel->name, "record");
+
+    iter = interleaved_fsevents(fsevents, seqs);
+    ck_assert_ptr_nonnull(iter);
+
+    ck_assert_int_eq(sink_process(parallel, iter), 0);
+
+    for (size_t i = 0; i < SINK_COUNT; i++) {
+        for (size_t j = 0; j < records[i].count; j++) {
+            long seq = records[i].records[j].seq;
+
+            ck_assert_int_ge(seq, 0);
+            ck_assert_int_lt(seq, EVENT_COUNT);
+            ck_assert(!applied[seq]);
+            applied[seq] = true;
+            ck_assert_uint_eq(records[i].records[j].id, seq % ID_COUNT);
+        }
+    }
+
+    for (size_t i = 0; i < EVENT_COUNT; i++)
+        ck_assert(applied[i]);
+
+    rbh_iter_destroy(iter);
+    sink_destroy(parallel);
+}
+END_TEST
+
+START_TEST(parallel_same_id_in_order)
+{
+    struct record_sink records[SINK_COUNT];
+    struct rbh_fsevent fsevents[EVENT_COUNT];
+    struct sink *sinks[SINK_COUNT];
+    char seqs[EVENT_COUNT][16];
+    struct rbh_iterator *iter;
+    struct sink *parallel;
+    size_t owners[ID_COUNT];
+    long last[ID_COUNT];
+
+    record_sinks_init(records, sinks, SINK_COUNT);
+    parallel = sink_from_sinks(sinks, SINK_COUNT);
+    ck_assert_ptr_nonnull(parallel);
+
+    iter = interleaved_fsevents(fsevents, seqs);
+    ck_assert_ptr_nonnull(iter);
+
+    ck_assert_int_eq(sink_process(parallel, iter), 0);
+
+    for (size_t i = 0; i < ID_COUNT; i++) {
+        owners[i] = SINK_COUNT;
+        last[i] = -1;
+    }
+
+    for (size_t i = 0; i < SINK_COUNT; i++) {
+        for (size_t j = 0; j < records[i].count; j++) {
+            size_t id = records[i].records[j].id;
+
+            /* Every fsevent about an entry goes to the same sink... */
+            if (owners[id] == SINK_COUNT)
+                owners[id] = i;
+            ck_assert_uint_eq(owners[id], i);
+
+            /* ... in the order they were emitted */
+            ck_assert_int_gt(records[i].records[j].seq, last[id]);
+            last[id] = records[i].records[j].seq;
+        }
+    }
+
+    rbh_iter_destroy(iter);
+    sink_destroy(parallel);
+}
+END_TEST
+
+START_TEST(parallel_partition_error)
+{
+    struct record_sink records[SINK_COUNT];
+    struct rbh_fsevent fsevents[EVENT_COUNT];
+    struct sink *sinks[SINK_COUNT];
+    char seqs[EVENT_COUNT][16];
+    struct rbh_iterator *iter;
+    struct sink *parallel;
+    size_t failed = SINK_COUNT;
+
+    record_sinks_init(records, sinks, SINK_COUNT);
+    parallel = sink_from_sinks(sinks, SINK_COUNT);
+    ck_assert_ptr_nonnull(parallel);
+
+    iter = interleaved_fsevents(fsevents, seqs);
+    ck_assert_ptr_nonnull(iter);
+
+    /* Every sink fails on ids[1], only the one it is dispatched to sees it */
+    for (size_t i = 0; i < SINK_COUNT; i++)
+        records[i].fail_id = ids[1];
+
+    rbh_backend_error[0] = '\0';
+    errno = 0;
+    ck_assert_int_eq(sink_process(parallel, iter), -1);
+    ck_assert_int_eq(errno, RBH_BACKEND_ERROR);
+    ck_assert_str_eq(rbh_backend_error, "cannot process fsevent");
+
+    for (size_t i = 0; i < SINK_COUNT; i++) {
+        size_t seen[ID_COUNT] = {};
+
+        if (records[i].failed) {
+            ck_assert_uint_eq(failed, SINK_COUNT);
+            failed = i;
+            continue;
+        }
+
+        /* The other partitions are still processed entirely */
+        for (size_t j = 0; j < records[i].count; j++)
+            seen[records[i].records[j].id]++;
+
+        ck_assert_uint_eq(seen[1], 0);
+        for (size_t j = 0; j < ID_COUNT; j++) {
+            if (seen[j])
+                ck_assert_uint_eq(seen[j], EVENT_COUNT / ID_COUNT);
+        }
+    }
+    ck_assert_uint_lt(failed, SINK_COUNT);
+
+    rbh_iter_destroy(iter);
+    sink_destroy(parallel);
+}
+END_TEST
+
+static Suite *
+unit_suite(void)
+{
+    Suite *suite;
+    TCase *tests;
+
+    suite = suite_create("parallel sink");
+    tests = tcase_create("parallel");
+    tcase_add_test(tests, parallel_all_applied);
+    tcase_add_test(tests, parallel_same_id_in_order);
+    tcase_add_test(tests, parallel_partition_error);
+
+    suite_add_tcase(suite, tests);
+
+    return suite;
+}
+
+int
+main(void)
+{
+    int number_failed;
+    Suite *suite;
+    SRunner *runner;
+
+    suite = unit_suite();
+    runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
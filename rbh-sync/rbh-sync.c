@@ -9,18 +9,36 @@
 #include <errno.h>
 #include <error.h>
 #include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sysexits.h>
+#include <time.h>
+
+#include <sys/stat.h>
+#include <sys/utsname.h>
 
 #include <robinhood.h>
+#include <robinhood/backends/lustre.h>
+#include <robinhood/backends/mongo.h>
 #include <robinhood/utils.h>
 
 #ifndef RBH_ITER_CHUNK_SIZE
 # define RBH_ITER_CHUNK_SIZE (1 << 12)
 #endif
 
+/* Minimum number of seconds between two reports of the state of the throttle */
+#ifndef RBH_SYNC_THROTTLE_REPORT_INTERVAL
+# define RBH_SYNC_THROTTLE_REPORT_INTERVAL 60
+#endif
+
+/* Minimum number of seconds between two checkpoints */
+#ifndef RBH_SYNC_CHECKPOINT_INTERVAL
+# define RBH_SYNC_CHECKPOINT_INTERVAL 60
+#endif
+
 static struct rbh_backend *from, *to;
 
 static void __attribute__((destructor))
@@ -48,6 +66,583 @@ destroy_chunks(void)
 
 static bool one = false;
 static bool skip_error = true;
+static bool sweep = false;
+static bool resume = false;
+static const char *checkpoint_path;
+static const char *queue_name;
+static unsigned int lease_duration = 600;
+static uint64_t rate_limit;
+static uint64_t latency_target;
+static int max_depth = -1;
+
+/*----------------------------------------------------------------------------*
+ |                                 checkpoint                                 |
+ *----------------------------------------------------------------------------*/
+
+/* Backends that walk a filesystem (posix, lustre, ...) return fsentries in
+ * depth-first pre-order. Tracking the path of each fsentry is then enough to
+ * know the stack of directories that are being walked (the frontier), and which
+ * of their children were completely walked.
+ *
+ * Checkpoints are only ever saved after a successful update of DEST, at which
+ * point every fsentry that was read from SOURCE has been converted and
+ * committed. Resuming a sync amounts to walking SOURCE again, skipping the
+ * subtrees that were completed (cf. RBH_GBO_SKIP_SUBTREES).
+ */
+
+struct string_array {
+    char **strings;
+    size_t count;
+    size_t capacity;
+};
+
+static void
+string_array_append(struct string_array *array, char *string)
+{
+    if (array->count == array->capacity) {
+        size_t capacity = array->capacity ? array->capacity * 2 : 16;
+        char **strings;
+
+        strings = reallocarray(array->strings, capacity, sizeof(*strings));
+        if (strings == NULL)
+            error(EXIT_FAILURE, errno, "reallocarray");
+
+        array->strings = strings;
+        array->capacity = capacity;
+    }
+
+    array->strings[array->count++] = string;
+}
+
+static void
+string_array_clear(struct string_array *array)
+{
+    for (size_t i = 0; i < array->count; i++)
+        free(array->strings[i]);
+    free(array->strings);
+    array->strings = NULL;
+    array->count = array->capacity = 0;
+}
+
+struct frontier_dir {
+    char *path;
+    /* Children of `path' that were completely walked */
+    struct string_array done;
+};
+
+static struct {
+    const char *source;
+    uint64_t generation;
+    bool complete;
+    /* Subtrees a previous run completed, sorted */
+    struct string_array resumed;
+    struct {
+        struct frontier_dir *dirs;
+        size_t count;
+        size_t capacity;
+    } frontier;
+    time_t saved_at;
+} checkpoint;
+
+static void __attribute__((destructor))
+destroy_checkpoint(void)
+{
+    for (size_t i = 0; i < checkpoint.frontier.count; i++) {
+        free(checkpoint.frontier.dirs[i].path);
+        string_array_clear(&checkpoint.frontier.dirs[i].done);
+    }
+    free(checkpoint.frontier.dirs);
+    string_array_clear(&checkpoint.resumed);
+}
+
+static bool
+is_ancestor(const char *ancestor, const char *path)
+{
+    size_t length = strlen(ancestor);
+
+    if (strcmp(ancestor, "/") == 0)
+        return path[0] == '/' && path[1] != '\0';
+
+    return strncmp(ancestor, path, length) == 0 && path[length] == '/';
+}
+
+static int
+strcmp_ptr(const void *first, const void *second)
+{
+    return strcmp(*(char * const *)first, *(char * const *)second);
+}
+
+/* Subtrees completed by a previous run are not returned by SOURCE anymore, they
+ * are accounted for when their parent is pushed on the frontier.
+ */
+static void
+frontier_adopt_resumed(struct frontier_dir *dir)
+{
+    struct string_array *resumed = &checkpoint.resumed;
+    char * const *first = resumed->strings;
+    char * const *last = resumed->strings + resumed->count;
+    const char *path = dir->path;
+
+    /* Binary search for the first resumed path that is not lower than `path' */
+    while (first < last) {
+        char * const *middle = first + (last - first) / 2;
+
+        if (strcmp(*middle, path) < 0)
+            first = middle + 1;
+        else
+            last = middle;
+    }
+
+    for (; first < resumed->strings + resumed->count; first++) {
+        const char *child = *first;
+        const char *name;
+
+        if (strcmp(child, path) == 0)
+            continue;
+        if (!is_ancestor(path, child))
+            break;
+
+        name = child + (strcmp(path, "/") ? strlen(path) : 0) + 1;
+        if (strchr(name, '/') != NULL)
+            continue;
+
+        child = strdup(child);
+        if (child == NULL)
+            error(EXIT_FAILURE, errno, "strdup");
+        string_array_append(&dir->done, (char *)child);
+    }
+}
+
+static void
+frontier_push(const char *path)
+{
+    struct frontier_dir *dir;
+
+    if (checkpoint.frontier.count == checkpoint.frontier.capacity) {
+        size_t capacity = checkpoint.frontier.capacity ?
+            checkpoint.frontier.capacity * 2 : 64;
+        struct frontier_dir *dirs;
+
+        dirs = reallocarray(checkpoint.frontier.dirs, capacity, sizeof(*dirs));
+        if (dirs == NULL)
+            error(EXIT_FAILURE, errno, "reallocarray");
+
+        checkpoint.frontier.dirs = dirs;
+        checkpoint.frontier.capacity = capacity;
+    }
+
+    dir = &checkpoint.frontier.dirs[checkpoint.frontier.count++];
+    dir->path = strdup(path);
+    if (dir->path == NULL)
+        error(EXIT_FAILURE, errno, "strdup");
+    dir->done = (struct string_array){};
+
+    frontier_adopt_resumed(dir);
+}
+
+static void
+frontier_pop(void)
+{
+    struct frontier_dir *dir;
+
+    dir = &checkpoint.frontier.dirs[--checkpoint.frontier.count];
+    string_array_clear(&dir->done);
+
+    if (checkpoint.frontier.count == 0) {
+        free(dir->path);
+        return;
+    }
+
+    /* Everything below `dir' is accounted for by `dir' itself */
+    string_array_append(&dir[-1].done, dir->path);
+}
+
+static const char *
+fsentry_path(const struct rbh_fsentry *fsentry)
+{
+    if (!(fsentry->mask & RBH_FP_NAMESPACE_XATTRS))
+        return NULL;
+
+    for (size_t i = 0; i < fsentry->xattrs.ns.count; i++) {
+        const struct rbh_value_pair *pair = &fsentry->xattrs.ns.pairs[i];
+
+        if (strcmp(pair->key, "path") == 0
+         && pair->value && pair->value->type == RBH_VT_STRING)
+            return pair->value->string;
+    }
+
+    return NULL;
+}
+
+static void
+checkpoint_track(const struct rbh_fsentry *fsentry)
+{
+    const char *path = fsentry_path(fsentry);
+
+    if (path == NULL)
+        error(EXIT_FAILURE, ENODATA,
+              "checkpoints require SOURCE to provide the path of its entries");
+
+    while (checkpoint.frontier.count > 0) {
+        struct frontier_dir *top;
+
+        top = &checkpoint.frontier.dirs[checkpoint.frontier.count - 1];
+        if (is_ancestor(top->path, path))
+            break;
+        frontier_pop();
+    }
+
+    if (fsentry->mask & RBH_FP_STATX
+     && fsentry->statx->stx_mask & RBH_STATX_TYPE
+     && S_ISDIR(fsentry->statx->stx_mode))
+        frontier_push(path);
+}
+
+    /*--------------------------------------------------------------------*
+     |                            iter_track()                            |
+     *--------------------------------------------------------------------*/
+
+struct track_iterator {
+    struct rbh_iterator iterator;
+    struct rbh_iterator *fsentries;
+};
+
+static const void *
+track_iter_next(void *iterator)
+{
+    struct track_iterator *track = iterator;
+    const struct rbh_fsentry *fsentry;
+
+    fsentry = rbh_iter_next(track->fsentries);
+    if (fsentry != NULL)
+        checkpoint_track(fsentry);
+
+    return fsentry;
+}
+
+static void
+track_iter_destroy(void *iterator)
+{
+    struct track_iterator *track = iterator;
+
+    rbh_iter_destroy(track->fsentries);
+    free(track);
+}
+
+static const struct rbh_iterator_operations TRACK_ITER_OPS = {
+    .next = track_iter_next,
+    .destroy = track_iter_destroy,
+};
+
+static const struct rbh_iterator TRACK_ITER = {
+    .ops = &TRACK_ITER_OPS,
+};
+
+static struct rbh_iterator *
+iter_track(struct rbh_iterator *fsentries)
+{
+    struct track_iterator *track;
+
+    track = malloc(sizeof(*track));
+    if (track == NULL)
+        return NULL;
+
+    track->iterator = TRACK_ITER;
+    track->fsentries = fsentries;
+
+    return &track->iterator;
+}
+
+    /*--------------------------------------------------------------------*
+     |                          save() / load()                           |
+     *--------------------------------------------------------------------*/
+
+/* A checkpoint is a text file:
+ *
+ *     source <SOURCE>
+ *     generation <the generation DEST's entries are tagged with, or 0>
+ *     frontier <path of a directory being walked>
+ *     ...
+ *     done <path of a completely walked subtree>
+ *     ...
+ *     complete
+ *
+ * Paths are percent-encoded, so that they fit on a single line.
+ */
+
+static void
+fputs_encoded(const char *string, FILE *file)
+{
+    for (; *string != '\0'; string++) {
+        if (*string == '%' || *string == '\n' || *string == '\r')
+            fprintf(file, "%%%02X", (unsigned char)*string);
+        else
+            fputc(*string, file);
+    }
+}
+
+static void
+checkpoint_save(void)
+{
+    char *tmp;
+    FILE *file;
+
+    if (asprintf(&tmp, "%s.tmp", checkpoint_path) < 0)
+        error(EXIT_FAILURE, ENOMEM, "asprintf");
+
+    file = fopen(tmp, "w");
+    if (file == NULL)
+        error(EXIT_FAILURE, errno, "fopen: %s", tmp);
+
+    fprintf(file, "source %s\n", checkpoint.source);
+    fprintf(file, "generation %" PRIu64 "\n", checkpoint.generation);
+
+    for (size_t i = 0; i < checkpoint.frontier.count; i++) {
+        const struct frontier_dir *dir = &checkpoint.frontier.dirs[i];
+
+        fputs("frontier ", file);
+        fputs_encoded(dir->path, file);
+        fputc('\n', file);
+    }
+
+    for (size_t i = 0; i < checkpoint.frontier.count; i++) {
+        const struct frontier_dir *dir = &checkpoint.frontier.dirs[i];
+
+        for (size_t j = 0; j < dir->done.count; j++) {
+            fputs("done ", file);
+            fputs_encoded(dir->done.strings[j], file);
+            fputc('\n', file);
+        }
+    }
+
+    if (checkpoint.complete)
+        fputs("complete\n", file);
+
+    if (fclose(file))
+        error(EXIT_FAILURE, errno, "fclose: %s", tmp);
+
+    /* Never leave a partially written checkpoint behind */
+    if (rename(tmp, checkpoint_path))
+        error(EXIT_FAILURE, errno, "rename: %s", tmp);
+    free(tmp);
+
+    checkpoint.saved_at = time(NULL);
+}
+
+static void
+checkpoint_save_periodically(void)
+{
+    if (time(NULL) - checkpoint.saved_at >= RBH_SYNC_CHECKPOINT_INTERVAL)
+        checkpoint_save();
+}
+
+static void
+checkpoint_load(void)
+{
+    size_t linecap = 0;
+    char *line = NULL;
+    ssize_t length;
+    FILE *file;
+
+    file = fopen(checkpoint_path, "r");
+    if (file == NULL) {
+        /* Nothing to resume */
+        if (errno == ENOENT)
+            return;
+        error(EXIT_FAILURE, errno, "fopen: %s", checkpoint_path);
+    }
+
+    while ((length = getline(&line, &linecap, file)) != -1) {
+        char *value;
+
+        if (length > 0 && line[length - 1] == '\n')
+            line[--length] = '\0';
+
+        value = strchr(line, ' ');
+        if (value != NULL)
+            *value++ = '\0';
+
+        if (strcmp(line, "complete") == 0) {
+            checkpoint.complete = true;
+            continue;
+        }
+
+        if (value == NULL)
+            error(EXIT_FAILURE, 0, "%s: invalid checkpoint line: %s",
+                  checkpoint_path, line);
+
+        if (strcmp(line, "source") == 0) {
+            if (strcmp(value, checkpoint.source))
+                error(EX_USAGE, 0, "%s is a checkpoint of %s, not %s",
+                      checkpoint_path, value, checkpoint.source);
+        } else if (strcmp(line, "generation") == 0) {
+            if (sscanf(value, "%" SCNu64, &checkpoint.generation) != 1)
+                error(EXIT_FAILURE, 0, "%s: invalid generation: %s",
+                      checkpoint_path, value);
+        } else if (strcmp(line, "done") == 0) {
+            ssize_t size;
+            char *path;
+
+            size = rbh_percent_decode(value, value, strlen(value));
+            if (size < 0)
+                error(EXIT_FAILURE, errno, "%s: invalid path", checkpoint_path);
+            value[size] = '\0';
+
+            path = strdup(value);
+            if (path == NULL)
+                error(EXIT_FAILURE, errno, "strdup");
+            string_array_append(&checkpoint.resumed, path);
+        }
+        /* "frontier" lines are only informative */
+    }
+    if (ferror(file))
+        error(EXIT_FAILURE, errno, "getline: %s", checkpoint_path);
+
+    free(line);
+    fclose(file);
+
+    /* frontier_adopt_resumed() relies on this */
+    qsort(checkpoint.resumed.strings, checkpoint.resumed.count,
+          sizeof(*checkpoint.resumed.strings), strcmp_ptr);
+}
+
+static void
+checkpoint_skip_resumed(void)
+{
+    int rc;
+
+    if (checkpoint.resumed.count == 0)
+        return;
+
+    rc = rbh_backend_set_option(from, RBH_GBO_SKIP_SUBTREES,
+                                checkpoint.resumed.strings,
+                                checkpoint.resumed.count
+                                    * sizeof(*checkpoint.resumed.strings));
+    if (rc)
+        error(EXIT_FAILURE, errno, "cannot resume from %s", checkpoint_path);
+}
+
+/*----------------------------------------------------------------------------*
+ |                                  throttle                                  |
+ *----------------------------------------------------------------------------*/
+
+static void
+throttle(struct rbh_backend *source)
+{
+    if (rate_limit && rbh_backend_set_option(source, RBH_GBO_RATE_LIMIT,
+                                             &rate_limit, sizeof(rate_limit)))
+        error(EXIT_FAILURE, errno, "cannot limit the rate of SOURCE");
+
+    if (latency_target
+     && rbh_backend_set_option(source, RBH_GBO_LATENCY_TARGET, &latency_target,
+                               sizeof(latency_target)))
+        error(EXIT_FAILURE, errno, "cannot make the rate of SOURCE adaptive");
+}
+
+static void
+throttle_report(struct rbh_backend *source)
+{
+    static time_t reported_at;
+    struct rbh_throttle_state state;
+    size_t size = sizeof(state);
+    char rate[32];
+
+    if (!rate_limit && !latency_target)
+        return;
+
+    if (time(NULL) - reported_at < RBH_SYNC_THROTTLE_REPORT_INTERVAL)
+        return;
+    reported_at = time(NULL);
+
+    /* Reports are only informative */
+    if (rbh_backend_get_option(source, RBH_GBO_THROTTLE, &state, &size))
+        return;
+
+    if (state.rate)
+        snprintf(rate, sizeof(rate), "%" PRIu64 " entries/s", state.rate);
+    else
+        snprintf(rate, sizeof(rate), "unlimited");
+
+    fprintf(stderr,
+            "%s: throttle: %s, latency: %" PRIu64 " us, backoffs: %" PRIu64 "\n",
+            program_invocation_short_name, rate, state.latency, state.backoffs);
+}
+
+/*----------------------------------------------------------------------------*
+ |                                  exclude                                   |
+ *----------------------------------------------------------------------------*/
+
+/* Rules that exclude subtrees of SOURCE from the sync (cf. RBH_GBO_EXCLUDE) */
+static struct string_array excludes;
+
+static void
+exclude(struct rbh_backend *source)
+{
+    if (excludes.count > 0
+     && rbh_backend_set_option(source, RBH_GBO_EXCLUDE, excludes.strings,
+                               excludes.count * sizeof(*excludes.strings)))
+        error(EXIT_FAILURE, errno, "cannot exclude entries from SOURCE");
+}
+
+/*----------------------------------------------------------------------------*
+ |                                   xattrs                                   |
+ *----------------------------------------------------------------------------*/
+
+/* Rules that select the xattrs SOURCE fetches (cf. RBH_GBO_XATTRS) */
+static struct string_array xattr_rules;
+
+static void
+select_xattrs(struct rbh_backend *source)
+{
+    if (xattr_rules.count > 0
+     && rbh_backend_set_option(source, RBH_GBO_XATTRS, xattr_rules.strings,
+                               xattr_rules.count * sizeof(*xattr_rules.strings)))
+        error(EXIT_FAILURE, errno, "cannot select the xattrs of SOURCE");
+}
+
+/*----------------------------------------------------------------------------*
+ |                                 lazy size                                  |
+ *----------------------------------------------------------------------------*/
+
+/* Whether to read the size of files from their LSOM (cf. RBH_LBO_LAZY_SIZE) */
+static bool lazy_size;
+
+static void
+use_lazy_size(struct rbh_backend *source)
+{
+    if (!lazy_size)
+        return;
+
+    if (source->id != RBH_BI_LUSTRE)
+        error(EX_USAGE, 0, "--lazy-size requires a lustre SOURCE");
+
+    if (rbh_backend_set_option(source, RBH_LBO_LAZY_SIZE, &lazy_size,
+                               sizeof(lazy_size)))
+        error(EXIT_FAILURE, errno, "cannot use the lazy size of SOURCE");
+}
+
+/*----------------------------------------------------------------------------*
+ |                                 hardlinks                                  |
+ *----------------------------------------------------------------------------*/
+
+/* How many files with several links a source should remember at once */
+#define RBH_SYNC_HARDLINK_CACHE (1 << 16)
+
+/* Have SOURCE fetch the inode data of hardlinked files only once, the other
+ * names of those files are converted into links alone (cf. iter_convert()).
+ */
+static void
+cache_hardlinks(struct rbh_backend *source)
+{
+    const size_t capacity = RBH_SYNC_HARDLINK_CACHE;
+
+    /* This is merely an optimization, not every backend supports it */
+    if (rbh_backend_set_option(source, RBH_GBO_HARDLINK_CACHE, &capacity,
+                               sizeof(capacity))
+     && errno != ENOTSUP && errno != ENOPROTOOPT)
+        error(EXIT_FAILURE, errno, "cannot cache the hardlinks of SOURCE");
+}
+
 /*----------------------------------------------------------------------------*
  |                                   sync()                                   |
  *----------------------------------------------------------------------------*/
@@ -135,6 +730,9 @@ struct convert_iterator {
     } todo;
 };
 
+/* The fields of an fsentry that describe its inode */
+#define RBH_FP_INODE (RBH_FP_STATX | RBH_FP_SYMLINK | RBH_FP_INODE_XATTRS)
+
 /* Advance a convert_iterator to its next fsentry */
 static int
 _convert_iter_next(struct convert_iterator *convert,
@@ -150,12 +748,14 @@ _convert_iter_next(struct convert_iterator *convert,
             bool name:1;
             bool inode_xattrs:1;
             bool ns_xattrs:1;
+            bool inode:1;
         } has, needs = {
             .id = projection->fsentry_mask & RBH_FP_ID,
             .parent_id = projection->fsentry_mask & RBH_FP_PARENT_ID,
             .name = projection->fsentry_mask & RBH_FP_NAME,
             .inode_xattrs = projection->fsentry_mask & RBH_FP_INODE_XATTRS,
             .ns_xattrs = projection->fsentry_mask & RBH_FP_NAMESPACE_XATTRS,
+            .inode = projection->fsentry_mask & RBH_FP_INODE,
         };
 
 next:
@@ -170,12 +770,16 @@ next:
                         && fsentry->xattrs.inode.count;
         has.ns_xattrs = fsentry->mask & RBH_FP_NAMESPACE_XATTRS
                      && fsentry->xattrs.ns.count;
+        has.inode = fsentry->mask & RBH_FP_INODE;
 
         if (!has.id)
             goto next;
 
         /* What kind of fsevent should this fsentry be converted into? */
-        upsert = needs.id;
+        /* Sources may only link the other names of a hardlinked file, once
+         * they returned its inode data (cf. RBH_GBO_HARDLINK_CACHE)
+         */
+        upsert = needs.id && (has.inode || !needs.inode);
         inode_xattr = !upsert && needs.inode_xattrs && has.inode_xattrs;
         link = needs.parent_id && needs.name && has.parent_id && has.name;
         ns_xattr = !link && has.parent_id && has.name && needs.ns_xattrs
@@ -270,111 +874,436 @@ link_from_fsentry(struct rbh_fsevent *fsevent,
         .xattrs = projection->fsentry_mask & RBH_FP_NAMESPACE_XATTRS,
     };
 
-    fsevent->type = RBH_FET_LINK;
-    assert(fsentry->mask & RBH_FP_ID);
-    fsevent->id = fsentry->id;
-    assert(fsentry->mask & RBH_FP_PARENT_ID);
-    fsevent->link.parent_id = &fsentry->parent_id;
-    assert(fsentry->mask & RBH_FP_NAME);
-    fsevent->link.name = fsentry->name;
-
-    if (needs.xattrs & has.xattrs)
-        fsevent->xattrs = fsentry->xattrs.ns;
-    else
-        fsevent->xattrs.count = 0;
+    fsevent->type = RBH_FET_LINK;
+    assert(fsentry->mask & RBH_FP_ID);
+    fsevent->id = fsentry->id;
+    assert(fsentry->mask & RBH_FP_PARENT_ID);
+    fsevent->link.parent_id = &fsentry->parent_id;
+    assert(fsentry->mask & RBH_FP_NAME);
+    fsevent->link.name = fsentry->name;
+
+    if (needs.xattrs & has.xattrs)
+        fsevent->xattrs = fsentry->xattrs.ns;
+    else
+        fsevent->xattrs.count = 0;
+
+    return fsevent;
+}
+
+static struct rbh_fsevent *
+ns_xattr_from_fsentry(struct rbh_fsevent *fsevent,
+                      const struct rbh_fsentry *fsentry)
+{
+    fsevent->type = RBH_FET_XATTR;
+    assert(fsentry->mask & RBH_FP_ID);
+    fsevent->id = fsentry->id;
+    assert(fsentry->mask & RBH_FP_PARENT_ID);
+    fsevent->link.parent_id = &fsentry->parent_id;
+    assert(fsentry->mask & RBH_FP_NAME);
+    fsevent->link.name = fsentry->name;
+    assert(fsentry->mask & RBH_FP_NAMESPACE_XATTRS);
+    fsevent->xattrs = fsentry->xattrs.ns;
+
+    return fsevent;
+}
+
+static const void *
+convert_iter_next(void *iterator)
+{
+    struct convert_iterator *convert = iterator;
+
+    if (convert->todo.upsert) {
+        convert->todo.upsert = false;
+        return upsert_from_fsentry(&convert->fsevent, &convert->statx,
+                                   convert->fsentry, convert->projection);
+    }
+
+    if (convert->todo.inode_xattr) {
+        convert->todo.inode_xattr = false;
+        return inode_xattr_from_fsentry(&convert->fsevent, convert->fsentry);
+    }
+
+    if (convert->todo.link) {
+        convert->todo.link = false;
+        return link_from_fsentry(&convert->fsevent, convert->fsentry,
+                                 convert->projection);
+    }
+
+    if (convert->todo.ns_xattr) {
+        convert->todo.ns_xattr = false;
+        return ns_xattr_from_fsentry(&convert->fsevent, convert->fsentry);
+    }
+
+    if (_convert_iter_next(convert, convert->projection))
+        return NULL;
+
+    return convert_iter_next(iterator);
+}
+
+static void
+convert_iter_destroy(void *iterator) {
+    struct convert_iterator *convert = iterator;
+
+    rbh_iter_destroy(convert->fsentries);
+    free(convert);
+}
+
+static const struct rbh_iterator_operations CONVERT_ITER_OPS = {
+    .next = convert_iter_next,
+    .destroy = convert_iter_destroy,
+};
+
+static const struct rbh_iterator CONVERT_ITER = {
+    .ops = &CONVERT_ITER_OPS,
+};
+
+static struct rbh_iterator *
+iter_convert(struct rbh_iterator *fsentries,
+             const struct rbh_filter_projection *projection)
+{
+    struct convert_iterator *convert;
+
+    convert = malloc(sizeof(*convert));
+    if (convert == NULL)
+        return NULL;
+
+    convert->iterator = CONVERT_ITER;
+    convert->fsentries = fsentries;
+    convert->projection = projection;
+    convert->fsentry = NULL;
+    convert->todo.upsert = convert->todo.link = false;
+    convert->todo.inode_xattr = convert->todo.ns_xattr = false;
+
+    return &convert->iterator;
+}
+
+static void
+sync_fsentries(struct rbh_backend *source, struct rbh_iterator *fsentries,
+               const struct rbh_filter_projection *projection)
+{
+    struct rbh_iterator *fsevents;
+
+    /* Convert all this information into fsevents */
+    fsevents = iter_convert(fsentries, projection);
+    if (fsevents == NULL) {
+        int save_errno = errno;
+
+        rbh_iter_destroy(fsentries);
+        error(EXIT_FAILURE, save_errno, "iter_convert");
+    }
+
+    /* XXX: the mongo backend tries to process all the fsevents at once in a
+     *      single bulk operation, but a bulk operation is limited in size.
+     *
+     * Splitting `fsevents' into fixed-size sub-iterators solves this.
+     */
+    chunks = rbh_iter_chunkify(fsevents, RBH_ITER_CHUNK_SIZE);
+    if (chunks == NULL) {
+        int save_errno = errno;
+
+        rbh_iter_destroy(fsevents);
+        error(EXIT_FAILURE, save_errno, "rbh_mut_iter_chunkify");
+    }
+
+    /* Update `to' */
+    do {
+        struct rbh_iterator *chunk = rbh_mut_iter_next(chunks);
+        int save_errno;
+        ssize_t count;
+
+        if (chunk == NULL) {
+            if (errno == ENODATA || errno == RBH_BACKEND_ERROR)
+                break;
+            error(EXIT_FAILURE, errno, "while chunkifying SOURCE's entries");
+        }
+
+        count = rbh_backend_update(to, chunk, skip_error);
+        save_errno = errno;
+        rbh_iter_destroy(chunk);
+        if (count < 0) {
+            errno = save_errno;
+            assert(errno != ENODATA);
+            break;
+        }
+
+        /* Everything that was tracked so far is now in `to' */
+        if (checkpoint_path)
+            checkpoint_save_periodically();
+
+        throttle_report(source);
+    } while (true);
+
+    switch (errno) {
+    case ENODATA:
+        rbh_mut_iter_destroy(chunks);
+        chunks = NULL;
+        return;
+    case RBH_BACKEND_ERROR:
+        error(EXIT_FAILURE, 0, "unhandled error: %s", rbh_backend_error);
+        __builtin_unreachable();
+    default:
+        error(EXIT_FAILURE, errno, "while iterating over SOURCE's entries");
+    }
+}
+
+static void
+sync(const struct rbh_filter_projection *projection)
+{
+    const struct rbh_filter_options OPTIONS = {
+        .projection = {
+            .fsentry_mask = RBH_FP_ALL,
+            .statx_mask = RBH_STATX_ALL,
+        },
+        .skip_error = skip_error,
+    };
+    struct rbh_mut_iterator *_fsentries;
+    struct rbh_iterator *fsentries;
+
+    if (one) {
+        struct rbh_fsentry *root;
+
+        root = rbh_backend_root(from, &OPTIONS.projection);
+        if (root == NULL)
+            error(EXIT_FAILURE, errno, "rbh_backend_root");
+
+        _fsentries = mut_iter_one(root);
+        if (_fsentries == NULL)
+            error(EXIT_FAILURE, errno, "rbh_mut_array_iterator");
+    } else {
+        /* "Dump" `from' */
+        _fsentries = rbh_backend_filter(from, NULL, &OPTIONS);
+        if (_fsentries == NULL)
+            error(EXIT_FAILURE, errno, "rbh_backend_filter_fsentries");
+    }
+
+    fsentries = rbh_iter_constify(_fsentries);
+    if (fsentries == NULL) {
+        int save_errno = errno;
+
+        rbh_mut_iter_destroy(_fsentries);
+        error(EXIT_FAILURE, save_errno, "rbh_iter_constify");
+    }
+
+    if (checkpoint_path) {
+        struct rbh_iterator *tracked = iter_track(fsentries);
+
+        if (tracked == NULL) {
+            int save_errno = errno;
+
+            rbh_iter_destroy(fsentries);
+            error(EXIT_FAILURE, save_errno, "iter_track");
+        }
+        fsentries = tracked;
+    }
+
+    sync_fsentries(from, fsentries, projection);
+}
+
+/*----------------------------------------------------------------------------*
+ |                               mark & sweep                                 |
+ *----------------------------------------------------------------------------*/
+
+/* Every entry and namespace entry `to' receives during a sync is tagged with a
+ * generation (the time at which the sync started, so that it keeps increasing
+ * from one run to the next). Once the sync is complete, whatever was not tagged
+ * was not seen in SOURCE anymore, and can be removed from DEST.
+ */
+
+#define SWEEP_MASK (RBH_FP_ID | RBH_FP_PARENT_ID | RBH_FP_NAME)
+
+/* Two syncs may start within the same second: the generation of a sync must be
+ * strictly greater than any generation DEST was already tagged with.
+ */
+static uint64_t
+next_generation(void)
+{
+    uint64_t now = time(NULL);
+    uint64_t previous;
+    size_t size = sizeof(previous);
+
+    if (rbh_backend_get_option(to, RBH_GBO_GENERATION, &previous, &size)) {
+        if (errno == RBH_BACKEND_ERROR)
+            error(EXIT_FAILURE, 0, "unhandled error: %s", rbh_backend_error);
+        error(EXIT_FAILURE, errno, "rbh_backend_get_option");
+    }
+
+    return previous < now ? now : previous + 1;
+}
+
+static void
+mark(uint64_t generation)
+{
+    if (rbh_backend_set_option(to, RBH_GBO_GENERATION, &generation,
+                               sizeof(generation))) {
+        if (errno == RBH_BACKEND_ERROR)
+            error(EXIT_FAILURE, 0, "unhandled error: %s", rbh_backend_error);
+        error(EXIT_FAILURE, errno, "rbh_backend_set_option");
+    }
+}
+
+static void
+sweep_generation(uint64_t generation)
+{
+    const struct rbh_filter_projection ID_AND_PARENT = {
+        .fsentry_mask = RBH_FP_ID | RBH_FP_PARENT_ID,
+    };
+    struct rbh_backend *branch = to;
+    struct rbh_fsentry *root;
+    int rc;
+
+    root = rbh_backend_root(from, &ID_AND_PARENT);
+    if (root == NULL)
+        error(EXIT_FAILURE, errno, "rbh_backend_root");
+
+    if (!(root->mask & RBH_FP_ID) || !(root->mask & RBH_FP_PARENT_ID))
+        error(EXIT_FAILURE, ENODATA, "rbh_backend_root");
+
+    /* Only the root of a whole backend has no parent */
+    if (root->parent_id.size != 0) {
+        branch = rbh_backend_branch(to, &root->id, NULL);
+        if (branch == NULL)
+            error(EXIT_FAILURE, errno, "rbh_backend_branch");
+    }
+    free(root);
+
+    rc = rbh_backend_sweep(branch, generation);
+    if (rc && errno == RBH_BACKEND_ERROR)
+        error(EXIT_FAILURE, 0, "unhandled error: %s", rbh_backend_error);
+    if (rc)
+        error(EXIT_FAILURE, errno, "rbh_backend_sweep");
 
-    return fsevent;
+    if (branch != to)
+        rbh_backend_destroy(branch);
 }
 
-static struct rbh_fsevent *
-ns_xattr_from_fsentry(struct rbh_fsevent *fsevent,
-                      const struct rbh_fsentry *fsentry)
+/*----------------------------------------------------------------------------*
+ |                                  rollups                                   |
+ *----------------------------------------------------------------------------*/
+
+/* Whether to build the rollups of DEST's directories (cf. RBH_MBO_ROLLUPS)
+ *
+ * Rather than maintain them entry by entry during the sync, they are dropped
+ * beforehand and built from scratch once the sync is complete.
+ */
+static bool rollups;
+
+static void
+set_rollups(bool enable)
 {
-    fsevent->type = RBH_FET_XATTR;
-    assert(fsentry->mask & RBH_FP_ID);
-    fsevent->id = fsentry->id;
-    assert(fsentry->mask & RBH_FP_PARENT_ID);
-    fsevent->link.parent_id = &fsentry->parent_id;
-    assert(fsentry->mask & RBH_FP_NAME);
-    fsevent->link.name = fsentry->name;
-    assert(fsentry->mask & RBH_FP_NAMESPACE_XATTRS);
-    fsevent->xattrs = fsentry->xattrs.ns;
+    if (rbh_backend_set_option(to, RBH_MBO_ROLLUPS, &enable, sizeof(enable))) {
+        if (errno == RBH_BACKEND_ERROR)
+            error(EXIT_FAILURE, 0, "unhandled error: %s", rbh_backend_error);
+        error(EXIT_FAILURE, errno, "cannot %s the rollups of DEST",
+              enable ? "build" : "drop");
+    }
+}
 
-    return fsevent;
+/*----------------------------------------------------------------------------*
+ |                              distributed sync                              |
+ *----------------------------------------------------------------------------*/
+
+/* Several rbh-sync processes (possibly on several nodes) may cooperate to sync
+ * SOURCE into DEST, through a work queue DEST hosts. Items of this queue are
+ * paths of directories in SOURCE: processing an item means syncing the
+ * directory and its children, and adding its subdirectories to the queue.
+ *
+ * Items are leased to a single worker at a time. If a worker dies, its lease
+ * eventually expires, and another worker processes the item again: upserting
+ * the same entries twice is harmless.
+ */
+
+static struct string_array subdirectories;
+
+static void __attribute__((destructor))
+destroy_subdirectories(void)
+{
+    string_array_clear(&subdirectories);
 }
 
+    /*--------------------------------------------------------------------*
+     |                           iter_collect()                           |
+     *--------------------------------------------------------------------*/
+
+struct collect_iterator {
+    struct rbh_iterator iterator;
+    struct rbh_iterator *fsentries;
+    const char *root;
+};
+
 static const void *
-convert_iter_next(void *iterator)
+collect_iter_next(void *iterator)
 {
-    struct convert_iterator *convert = iterator;
+    struct collect_iterator *collect = iterator;
+    const struct rbh_fsentry *fsentry;
+    const char *path;
+    char *copy;
 
-    if (convert->todo.upsert) {
-        convert->todo.upsert = false;
-        return upsert_from_fsentry(&convert->fsevent, &convert->statx,
-                                   convert->fsentry, convert->projection);
-    }
+    fsentry = rbh_iter_next(collect->fsentries);
+    if (fsentry == NULL)
+        return NULL;
 
-    if (convert->todo.inode_xattr) {
-        convert->todo.inode_xattr = false;
-        return inode_xattr_from_fsentry(&convert->fsevent, convert->fsentry);
-    }
+    if (!(fsentry->mask & RBH_FP_STATX)
+     || !(fsentry->statx->stx_mask & RBH_STATX_TYPE)
+     || !S_ISDIR(fsentry->statx->stx_mode))
+        return fsentry;
 
-    if (convert->todo.link) {
-        convert->todo.link = false;
-        return link_from_fsentry(&convert->fsevent, convert->fsentry,
-                                 convert->projection);
-    }
+    path = fsentry_path(fsentry);
+    if (path == NULL)
+        error(EXIT_FAILURE, ENODATA,
+              "--queue requires SOURCE to provide the path of its entries");
 
-    if (convert->todo.ns_xattr) {
-        convert->todo.ns_xattr = false;
-        return ns_xattr_from_fsentry(&convert->fsevent, convert->fsentry);
-    }
+    if (strcmp(path, collect->root) == 0)
+        return fsentry;
 
-    if (_convert_iter_next(convert, convert->projection))
-        return NULL;
+    copy = strdup(path);
+    if (copy == NULL)
+        error(EXIT_FAILURE, errno, "strdup");
+    string_array_append(&subdirectories, copy);
 
-    return convert_iter_next(iterator);
+    return fsentry;
 }
 
 static void
-convert_iter_destroy(void *iterator) {
-    struct convert_iterator *convert = iterator;
+collect_iter_destroy(void *iterator)
+{
+    struct collect_iterator *collect = iterator;
 
-    rbh_iter_destroy(convert->fsentries);
-    free(convert);
+    rbh_iter_destroy(collect->fsentries);
+    free(collect);
 }
 
-static const struct rbh_iterator_operations CONVERT_ITER_OPS = {
-    .next = convert_iter_next,
-    .destroy = convert_iter_destroy,
+static const struct rbh_iterator_operations COLLECT_ITER_OPS = {
+    .next = collect_iter_next,
+    .destroy = collect_iter_destroy,
 };
 
-static const struct rbh_iterator CONVERT_ITER = {
-    .ops = &CONVERT_ITER_OPS,
+static const struct rbh_iterator COLLECT_ITER = {
+    .ops = &COLLECT_ITER_OPS,
 };
 
+/* Collect the paths of the directories `fsentries' yields, except `root' */
 static struct rbh_iterator *
-iter_convert(struct rbh_iterator *fsentries,
-             const struct rbh_filter_projection *projection)
+iter_collect(struct rbh_iterator *fsentries, const char *root)
 {
-    struct convert_iterator *convert;
+    struct collect_iterator *collect;
 
-    convert = malloc(sizeof(*convert));
-    if (convert == NULL)
+    collect = malloc(sizeof(*collect));
+    if (collect == NULL)
         return NULL;
 
-    convert->iterator = CONVERT_ITER;
-    convert->fsentries = fsentries;
-    convert->projection = projection;
-    convert->fsentry = NULL;
-    convert->todo.upsert = convert->todo.link = false;
-    convert->todo.inode_xattr = convert->todo.ns_xattr = false;
+    collect->iterator = COLLECT_ITER;
+    collect->fsentries = fsentries;
+    collect->root = root;
 
-    return &convert->iterator;
+    return &collect->iterator;
 }
 
+    /*--------------------------------------------------------------------*
+     |                              worker()                              |
+     *--------------------------------------------------------------------*/
+
 static void
-sync(const struct rbh_filter_projection *projection)
+sync_item(const char *item, const struct rbh_filter_projection *projection)
 {
     const struct rbh_filter_options OPTIONS = {
         .projection = {
@@ -384,26 +1313,39 @@ sync(const struct rbh_filter_projection *projection)
         .skip_error = skip_error,
     };
     struct rbh_mut_iterator *_fsentries;
+    struct rbh_iterator *collected;
     struct rbh_iterator *fsentries;
-    struct rbh_iterator *fsevents;
-
-    if (one) {
-        struct rbh_fsentry *root;
-
-        root = rbh_backend_root(from, &OPTIONS.projection);
-        if (root == NULL)
-            error(EXIT_FAILURE, errno, "rbh_backend_root");
-
-        _fsentries = mut_iter_one(root);
-        if (_fsentries == NULL)
-            error(EXIT_FAILURE, errno, "rbh_mut_array_iterator");
+    struct rbh_backend *branch;
+    int item_depth = 1;
+
+    if (strcmp(item, "/")) {
+        /* Queue items are paths relative to the root of SOURCE
+         *
+         * Branches share the counters of an instrumented SOURCE: every item
+         * is accounted for in SOURCE's report, there is no report per item.
+         */
+        branch = rbh_backend_branch(from, NULL, item);
+        if (branch == NULL)
+            error(EXIT_FAILURE, errno, "rbh_backend_branch: %s", item);
+
+        throttle(branch);
+        cache_hardlinks(branch);
+        exclude(branch);
+        select_xattrs(branch);
+        use_lazy_size(branch);
     } else {
-        /* "Dump" `from' */
-        _fsentries = rbh_backend_filter(from, NULL, &OPTIONS);
-        if (_fsentries == NULL)
-            error(EXIT_FAILURE, errno, "rbh_backend_filter_fsentries");
+        branch = from;
     }
 
+    /* Subdirectories are items of their own */
+    if (rbh_backend_set_option(branch, RBH_GBO_MAX_DEPTH, &item_depth,
+                               sizeof(item_depth)))
+        error(EXIT_FAILURE, errno, "cannot limit the depth of %s", item);
+
+    _fsentries = rbh_backend_filter(branch, NULL, &OPTIONS);
+    if (_fsentries == NULL)
+        error(EXIT_FAILURE, errno, "rbh_backend_filter_fsentries");
+
     fsentries = rbh_iter_constify(_fsentries);
     if (fsentries == NULL) {
         int save_errno = errno;
@@ -412,59 +1354,115 @@ sync(const struct rbh_filter_projection *projection)
         error(EXIT_FAILURE, save_errno, "rbh_iter_constify");
     }
 
-    /* Convert all this information into fsevents */
-    fsevents = iter_convert(fsentries, projection);
-    if (fsevents == NULL) {
+    collected = iter_collect(fsentries, item);
+    if (collected == NULL) {
         int save_errno = errno;
 
         rbh_iter_destroy(fsentries);
-        error(EXIT_FAILURE, save_errno, "iter_convert");
+        error(EXIT_FAILURE, save_errno, "iter_collect");
     }
 
-    /* XXX: the mongo backend tries to process all the fsevents at once in a
-     *      single bulk operation, but a bulk operation is limited in size.
-     *
-     * Splitting `fsevents' into fixed-size sub-iterators solves this.
-     */
-    chunks = rbh_iter_chunkify(fsevents, RBH_ITER_CHUNK_SIZE);
-    if (chunks == NULL) {
-        int save_errno = errno;
+    sync_fsentries(branch, collected, projection);
 
-        rbh_iter_destroy(fsevents);
-        error(EXIT_FAILURE, save_errno, "rbh_mut_iter_chunkify");
+    if (branch != from)
+        rbh_backend_destroy(branch);
+}
+
+static void
+queue_error(const char *operation)
+{
+    if (errno == RBH_BACKEND_ERROR)
+        error(EXIT_FAILURE, 0, "unhandled error: %s", rbh_backend_error);
+    error(EXIT_FAILURE, errno, "%s", operation);
+}
+
+/* Report the items of the queue that were given up on, and count them */
+static size_t
+report_abandoned(void)
+{
+    struct rbh_mut_iterator *items;
+    size_t count = 0;
+    char *item;
+
+    items = rbh_backend_queue_abandoned(to, queue_name);
+    if (items == NULL)
+        queue_error("rbh_backend_queue_abandoned");
+
+    while (errno = 0, (item = rbh_mut_iter_next(items)) != NULL) {
+        fprintf(stderr, "%s: '%s' was given up on after too many attempts\n",
+                program_invocation_short_name, item);
+        free(item);
+        count++;
     }
 
-    /* Update `to' */
-    do {
-        struct rbh_iterator *chunk = rbh_mut_iter_next(chunks);
-        int save_errno;
-        ssize_t count;
+    if (errno != ENODATA)
+        queue_error("rbh_mut_iter_next");
+    rbh_mut_iter_destroy(items);
 
-        if (chunk == NULL) {
-            if (errno == ENODATA || errno == RBH_BACKEND_ERROR)
+    return count;
+}
+
+/* Return the number of items of the queue that were never synced */
+static size_t
+worker(const struct rbh_filter_projection *projection)
+{
+    const struct timespec POLL_INTERVAL = { .tv_sec = 1 };
+    const char *ROOT = "/";
+    struct utsname utsname;
+    struct timespec now;
+    char *owner;
+
+    if (uname(&utsname))
+        error(EXIT_FAILURE, errno, "uname");
+
+    /* Identify this worker by the node it runs on and when it started */
+    if (clock_gettime(CLOCK_REALTIME, &now))
+        error(EXIT_FAILURE, errno, "clock_gettime");
+
+    if (asprintf(&owner, "%s:%ld.%09ld", utsname.nodename, (long)now.tv_sec,
+                 now.tv_nsec) < 0)
+        error(EXIT_FAILURE, ENOMEM, "asprintf");
+
+    /* Every worker seeds the queue, only the first one actually does it */
+    if (rbh_backend_queue_push(to, queue_name, &ROOT, 1) < 0)
+        queue_error("rbh_backend_queue_push");
+
+    while (true) {
+        char *item;
+
+        item = rbh_backend_queue_lease(to, queue_name, owner, lease_duration);
+        if (item == NULL) {
+            if (errno == ENODATA)
                 break;
-            error(EXIT_FAILURE, errno, "while chunkifying SOURCE's entries");
-        }
+            if (errno != EAGAIN)
+                queue_error("rbh_backend_queue_lease");
 
-        count = rbh_backend_update(to, chunk, skip_error);
-        save_errno = errno;
-        rbh_iter_destroy(chunk);
-        if (count < 0) {
-            errno = save_errno;
-            assert(errno != ENODATA);
-            break;
+            /* Other workers may yet add items to the queue */
+            nanosleep(&POLL_INTERVAL, NULL);
+            continue;
         }
-    } while (true);
 
-    switch (errno) {
-    case ENODATA:
-        return;
-    case RBH_BACKEND_ERROR:
-        error(EXIT_FAILURE, 0, "unhandled error: %s", rbh_backend_error);
-        __builtin_unreachable();
-    default:
-        error(EXIT_FAILURE, errno, "while iterating over SOURCE's entries");
+        sync_item(item, projection);
+
+        /* Only mark `item' as done once its subdirectories are queued */
+        if (rbh_backend_queue_push(to, queue_name,
+                                   (const char * const *)subdirectories.strings,
+                                   subdirectories.count) < 0)
+            queue_error("rbh_backend_queue_push");
+        string_array_clear(&subdirectories);
+
+        if (rbh_backend_queue_ack(to, queue_name, item, owner, RBH_QA_DONE)) {
+            if (errno != ESTALE)
+                queue_error("rbh_backend_queue_ack");
+            /* Another worker took over, it will process `item' again */
+            fprintf(stderr, "%s: lease on '%s' expired before it was synced\n",
+                    program_invocation_short_name, item);
+        }
+        free(item);
     }
+
+    free(owner);
+    return report_abandoned();
 }
 
 /*----------------------------------------------------------------------------*
@@ -479,7 +1477,9 @@ static int
 usage(void)
 {
     const char *message =
-        "usage: %s [-hon] [-f [+-]FIELD] SOURCE DEST\n"
+        "usage: %s [-hLonRrs] [-a USEC] [-c FILE] [-f [+-]FIELD] [-m DEPTH]\n"
+        "       [-t RATE] [-x RULE] [-X [!]NAME] [-q NAME [-l SECONDS]]\n"
+        "       SOURCE DEST\n"
         "\n"
         "Upsert SOURCE's entries into DEST\n"
         "\n"
@@ -488,12 +1488,42 @@ usage(void)
         "    DEST    a robinhood URI\n"
         "\n"
         "Optional arguments:\n"
+        "    -a,--adaptive USEC    reduce the rate at which SOURCE is read whenever\n"
+        "                          reading an entry takes more than USEC\n"
+        "                          microseconds on average\n"
+        "    -c,--checkpoint FILE  regularly save the progress of the sync in FILE,\n"
+        "                          FILE is removed once the sync completes\n"
         "    -f,--field [+-]FIELD  select, add or remove a FIELD to synchronize\n"
         "                          (can be specified multiple times)\n"
         "    -h,--help             show this message and exit\n"
+        "    -L,--lazy-size        read the size of files from their LSOM rather\n"
+        "                          than from OSTs, when it is not stale (lustre\n"
+        "                          only)\n"
+        "    -l,--lease SECONDS    how long a worker may hold an item of the work\n"
+        "                          queue before it is given to another worker\n"
+        "                          (default: 600)\n"
+        "    -m,--max-depth DEPTH  do not synchronize entries more than DEPTH levels\n"
+        "                          below the root of SOURCE\n"
         "    -o,--one              only consider the root of SOURCE\n"
         "    -n,--no-skip          do not skip errors when synchronizing backends,\n"
         "                          instead stop on the first error.\n"
+        "    -q,--queue NAME       cooperate with other rbh-sync processes that use\n"
+        "                          the same NAME, through a work queue hosted in DEST\n"
+        "    -R,--rollups          once SOURCE is synchronized (and DEST swept),\n"
+        "                          build the size and count rollups of DEST's\n"
+        "                          directories (mongo only)\n"
+        "    -r,--resume           resume the sync saved in the checkpoint FILE\n"
+        "                          (requires --checkpoint)\n"
+        "    -s,--sweep            once SOURCE is synchronized, remove from DEST the\n"
+        "                          entries that were not found in SOURCE (implies\n"
+        "                          --no-skip)\n"
+        "    -t,--throttle RATE    read at most RATE entries per second from SOURCE\n"
+        "    -x,--exclude RULE     do not synchronize the entries that match RULE,\n"
+        "                          nor their descendants (can be specified multiple\n"
+        "                          times)\n"
+        "    -X,--xattr [!]NAME    only fetch (or never fetch, with '!') the xattrs\n"
+        "                          called NAME, or in namespace NAME if it ends with\n"
+        "                          a '.' (can be specified multiple times)\n"
         "\n"
         "A robinhood URI is built as follows:\n"
         "    "RBH_SCHEME":BACKEND:FSNAME[#{PATH|ID}]\n"
@@ -517,7 +1547,13 @@ usage(void)
         "    [x] dev.major   [x] dev.minor   [ ] mount-id\n"
         "\n"
         "  [x] indicates the field is included by default\n"
-        "  [ ] indicates the field is excluded by default\n";
+        "  [ ] indicates the field is excluded by default\n"
+        "\n"
+        "RULE can be any of the following:\n"
+        "    [glob:]PATTERN  entries whose path relative to SOURCE matches PATTERN\n"
+        "                    (or whose name does, if PATTERN contains no '/')\n"
+        "    regex:REGEX     entries whose path relative to SOURCE matches REGEX\n"
+        "    uid:UID         entries owned by UID\n";
 
     return printf(message, program_invocation_short_name);
 }
@@ -852,10 +1888,39 @@ projection_set(struct rbh_filter_projection *projection,
     }
 }
 
+static uint64_t
+str2uint64(const char *string, const char *name)
+{
+    unsigned long long value;
+    char *end;
+
+    errno = 0;
+    value = strtoull(string, &end, 10);
+    if (errno || *end != '\0' || end == string || value == 0)
+        error(EX_USAGE, 0, "invalid %s: %s", name, string);
+
+    return value;
+}
+
 int
 main(int argc, char *argv[])
 {
     const struct option LONG_OPTIONS[] = {
+        {
+            .name = "adaptive",
+            .has_arg = required_argument,
+            .val = 'a',
+        },
+        {
+            .name = "checkpoint",
+            .has_arg = required_argument,
+            .val = 'c',
+        },
+        {
+            .name = "exclude",
+            .has_arg = required_argument,
+            .val = 'x',
+        },
         {
             .name = "field",
             .has_arg = required_argument,
@@ -865,6 +1930,20 @@ main(int argc, char *argv[])
             .name = "help",
             .val = 'h',
         },
+        {
+            .name = "lazy-size",
+            .val = 'L',
+        },
+        {
+            .name = "lease",
+            .has_arg = required_argument,
+            .val = 'l',
+        },
+        {
+            .name = "max-depth",
+            .has_arg = required_argument,
+            .val = 'm',
+        },
         {
             .name = "one",
             .val = 'o',
@@ -873,6 +1952,33 @@ main(int argc, char *argv[])
             .name = "no-skip",
             .val = 'n',
         },
+        {
+            .name = "queue",
+            .has_arg = required_argument,
+            .val = 'q',
+        },
+        {
+            .name = "resume",
+            .val = 'r',
+        },
+        {
+            .name = "rollups",
+            .val = 'R',
+        },
+        {
+            .name = "sweep",
+            .val = 's',
+        },
+        {
+            .name = "throttle",
+            .has_arg = required_argument,
+            .val = 't',
+        },
+        {
+            .name = "xattr",
+            .has_arg = required_argument,
+            .val = 'X',
+        },
         {}
     };
     struct rbh_filter_projection projection = {
@@ -882,8 +1988,15 @@ main(int argc, char *argv[])
     char c;
 
     /* Parse the command line */
-    while ((c = getopt_long(argc, argv, "f:hon", LONG_OPTIONS, NULL)) != -1) {
+    while ((c = getopt_long(argc, argv, "a:c:f:hLl:m:onq:Rrst:x:X:",
+                            LONG_OPTIONS, NULL)) != -1) {
         switch (c) {
+        case 'a':
+            latency_target = str2uint64(optarg, "latency");
+            break;
+        case 'c':
+            checkpoint_path = optarg;
+            break;
         case 'f':
             switch (optarg[0]) {
             case '+':
@@ -900,12 +2013,56 @@ main(int argc, char *argv[])
         case 'h':
             usage();
             return 0;
+        case 'L':
+            lazy_size = true;
+            break;
+        case 'l': {
+            uint64_t duration = str2uint64(optarg, "lease duration");
+
+            if (duration > UINT_MAX)
+                error(EX_USAGE, 0, "invalid lease duration: %s", optarg);
+            lease_duration = duration;
+            break;
+        }
+        case 'm': {
+            char *end;
+            long depth;
+
+            errno = 0;
+            depth = strtol(optarg, &end, 10);
+            if (errno || *end != '\0' || end == optarg || depth < 0
+             || depth > INT_MAX)
+                error(EX_USAGE, 0, "invalid depth: %s", optarg);
+            max_depth = depth;
+            break;
+        }
         case 'o':
             one = true;
             break;
         case 'n':
             skip_error = false;
             break;
+        case 'q':
+            queue_name = optarg;
+            break;
+        case 'R':
+            rollups = true;
+            break;
+        case 'r':
+            resume = true;
+            break;
+        case 's':
+            sweep = true;
+            break;
+        case 't':
+            rate_limit = str2uint64(optarg, "rate");
+            break;
+        case 'x':
+            string_array_append(&excludes, optarg);
+            break;
+        case 'X':
+            string_array_append(&xattr_rules, optarg);
+            break;
         case '?':
         default:
             /* getopt_long() prints meaningful error messages itself */
@@ -921,12 +2078,99 @@ main(int argc, char *argv[])
     if (argc > 2)
         error(EX_USAGE, 0, "unexpected argument: %s", argv[2]);
 
+    if (sweep && one)
+        error(EX_USAGE, 0, "--sweep and --one are mutually exclusive");
+
+    /* Sweeping relies on every synchronized entry being tagged */
+    if (sweep && (projection.fsentry_mask & SWEEP_MASK) != SWEEP_MASK)
+        error(EX_USAGE, 0,
+              "--sweep requires the id, parent-id and name fields");
+
+    /* An entry whose synchronization is skipped is not tagged either: it would
+     * be swept from DEST although it still exists in SOURCE.
+     */
+    if (sweep)
+        skip_error = false;
+
+    if (resume && checkpoint_path == NULL)
+        error(EX_USAGE, 0, "--resume requires --checkpoint");
+    if (checkpoint_path && one)
+        error(EX_USAGE, 0, "--checkpoint and --one are mutually exclusive");
+    if (queue_name && (one || sweep || checkpoint_path || max_depth >= 0))
+        error(EX_USAGE, 0,
+              "--queue cannot be combined with --one, --sweep, --checkpoint or "
+              "--max-depth");
+    if (queue_name && rollups)
+        error(EX_USAGE, 0, "--queue and --rollups are mutually exclusive");
+    /* Workers build branches of SOURCE themselves */
+    if (queue_name && strchr(argv[0], '#'))
+        error(EX_USAGE, 0, "--queue requires SOURCE to be a whole backend");
+
     /* Parse SOURCE */
     from = rbh_backend_from_uri(argv[0]);
     /* Parse DEST */
     to = rbh_backend_from_uri(argv[1]);
 
-    sync(&projection);
+    if (rollups && to->id != RBH_BI_MONGO)
+        error(EX_USAGE, 0, "--rollups requires a mongo DEST");
+
+    throttle(from);
+    cache_hardlinks(from);
+    exclude(from);
+    select_xattrs(from);
+    use_lazy_size(from);
+
+    if (max_depth >= 0
+     && rbh_backend_set_option(from, RBH_GBO_MAX_DEPTH, &max_depth,
+                               sizeof(max_depth)))
+        error(EXIT_FAILURE, errno, "cannot limit the depth of SOURCE");
+
+    if (queue_name) {
+        size_t abandoned = worker(&projection);
+
+        if (abandoned)
+            error(EX_SOFTWARE, 0,
+                  "%zu item%s of queue '%s' could not be synced", abandoned,
+                  abandoned > 1 ? "s" : "", queue_name);
+        return EXIT_SUCCESS;
+    }
+
+    checkpoint.source = argv[0];
+    if (resume) {
+        checkpoint_load();
+        if (sweep && checkpoint.generation == 0 && checkpoint.resumed.count)
+            error(EX_USAGE, 0,
+                  "%s was not saved by a sync with --sweep, cannot sweep",
+                  checkpoint_path);
+        checkpoint_skip_resumed();
+    }
+
+    if (sweep) {
+        /* A resumed sync keeps tagging entries with the same generation */
+        if (checkpoint.generation == 0)
+            checkpoint.generation = next_generation();
+        mark(checkpoint.generation);
+    }
+
+    if (rollups)
+        set_rollups(false);
+
+    if (!checkpoint.complete) {
+        sync(&projection);
+        if (checkpoint_path) {
+            checkpoint.complete = true;
+            checkpoint_save();
+        }
+    }
+
+    if (sweep)
+        sweep_generation(checkpoint.generation);
+
+    if (rollups)
+        set_rollups(true);
+
+    if (checkpoint_path && remove(checkpoint_path))
+        error(EXIT_FAILURE, errno, "remove: %s", checkpoint_path);
 
     return EXIT_SUCCESS;
 }
@@ -488,6 +488,37 @@ test_mdt_count()
                    '"ns.xattrs.path":"/test_mdt_count"'
 }
 
+test_sync_branch_lazy_size()
+{
+    mkdir -p "dir/subdir"
+    dd if=/dev/zero of="dir/subdir/file" bs=1k count=4
+
+    rbh_sync --lazy-size "rbh:lustre:.#dir" "rbh:mongo:$testdb"
+
+    find_attribute '"ns.xattrs.path":"/dir/subdir/file"' \
+                   '"statx.size":4096'
+}
+
+test_sync_queue()
+{
+    mkdir -p "tree/dirA/subdir" "tree/dirB"
+    touch "tree/dirA/fileA" "tree/dirA/subdir/fileB"
+
+    rbh_sync --queue "scan" "rbh:lustre:tree" "rbh:mongo:$testdb" &
+    local pid=$!
+    rbh_sync --queue "scan" "rbh:lustre:tree" "rbh:mongo:$testdb"
+    wait $pid
+
+    find_attribute '"ns.xattrs.path":"/dirB"'
+    find_attribute '"ns.xattrs.path":"/dirA/fileA"'
+
+    # Entries below the root are synced through branches of the lustre source
+    local mdt_index=$(lfs getstripe -m "tree/dirA/subdir/fileB")
+
+    find_attribute '"xattrs.mdt_index":'$mdt_index \
+                   '"ns.xattrs.path":"/dirA/subdir/fileB"'
+}
+
 ################################################################################
 #                                     MAIN                                     #
 ################################################################################
@@ -503,7 +534,8 @@ fi
 tests+=(test_flags test_gen test_mirror_count test_stripe_count
         test_stripe_size test_pattern test_comp_flags test_pool test_mirror_id
         test_begin test_end test_ost test_mdt_index_file test_mdt_index_dir
-        test_mdt_hash test_mdt_count)
+        test_mdt_hash test_mdt_count test_sync_branch_lazy_size
+        test_sync_queue)
 
 LUSTRE_DIR=/mnt/lustre/
 cd "$LUSTRE_DIR"
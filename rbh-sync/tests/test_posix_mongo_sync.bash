@@ -282,6 +282,341 @@ test_stop_sync_on_error(){
 
 }
 
+count_entries()
+{
+    old_IFS=$IFS
+    IFS=','
+    local output="$*"
+    IFS=$old_IFS
+
+    mongo $testdb --eval "db.entries.count({$output})"
+}
+
+test_sync_sweep()
+{
+    mkdir "dir"
+    truncate -s 1k "fileA" "fileB" "dir/fileC"
+    ln "fileA" "linkA"
+
+    rbh_sync "rbh:posix:." "rbh:mongo:$testdb"
+    rm -r "fileB" "dir" "fileA"
+
+    rbh_sync --sweep "rbh:posix:." "rbh:mongo:$testdb"
+    find_attribute '"ns.xattrs.path":"/"'
+    find_attribute '"ns.xattrs.path":"/linkA"'
+
+    local count=$(count_entries)
+    if [[ $count -ne 2 ]]; then
+        error "Invalid number of entries after sweeping, expected '2', " \
+              "found '$count'."
+    fi
+
+    count=$(count_entries '"ns.name":"fileA"')
+    if [[ $count -ne 0 ]]; then
+        error "Stale link 'fileA' was not swept"
+    fi
+}
+
+test_sync_sweep_on_error()
+{
+    mkdir "dir"
+    touch "fileA" "dir/fileB"
+
+    rbh_sync "rbh:posix:." "rbh:mongo:$testdb"
+    chmod o-rw "dir"
+
+    # The content of "dir" cannot be read, it must not be swept
+    useradd -N -M test
+    local rc=0
+    sudo -E -H -u test bash -c "rbh-sync --sweep rbh:posix:. \
+                                rbh:mongo:$testdb" || rc=$?
+    userdel -f -r test || true
+
+    if [[ $rc -eq 0 ]]; then
+        error "rbh-sync --sweep should stop on the first error"
+    fi
+
+    find_attribute '"ns.xattrs.path":"/dir/fileB"'
+}
+
+test_sync_sweep_same_second()
+{
+    truncate -s 1k "fileA" "fileB"
+
+    # Both syncs most likely start within the same second
+    rbh_sync --sweep "rbh:posix:." "rbh:mongo:$testdb"
+    rm "fileB"
+    rbh_sync --sweep "rbh:posix:." "rbh:mongo:$testdb"
+
+    local count=$(count_entries '"ns.name":"fileB"')
+    if [[ $count -ne 0 ]]; then
+        error "'fileB' was not swept by the second sync"
+    fi
+}
+
+test_sync_branch_sweep()
+{
+    mkdir -p "dir/subdir" "other"
+    truncate -s 1k "dir/fileA" "dir/subdir/fileB" "other/fileC"
+
+    rbh_sync "rbh:posix:." "rbh:mongo:$testdb"
+    rm -r "dir/subdir"
+    rm "other/fileC"
+
+    rbh_sync --sweep "rbh:posix:.#dir" "rbh:mongo:$testdb"
+    find_attribute '"ns.xattrs.path":"/dir"'
+    find_attribute '"ns.xattrs.path":"/dir/fileA"'
+    # Only the branch is swept
+    find_attribute '"ns.xattrs.path":"/other/fileC"'
+
+    local count=$(count_entries '"ns.name":{$in:["subdir", "fileB"]}')
+    if [[ $count -ne 0 ]]; then
+        error "Stale entries of the branch were not swept"
+    fi
+}
+
+test_sync_sweep_one()
+{
+    touch "fileA"
+
+    ! rbh_sync --sweep --one "rbh:posix:fileA" "rbh:mongo:$testdb"
+}
+
+test_sync_checkpoint()
+{
+    local checkpoint="$(mktemp --dry-run)"
+
+    mkdir "dir"
+    touch "dir/fileA"
+
+    rbh_sync --checkpoint "$checkpoint" "rbh:posix:." "rbh:mongo:$testdb"
+
+    find_attribute '"ns.xattrs.path":"/dir/fileA"'
+    if [[ -e "$checkpoint" ]]; then
+        error "Checkpoint was not removed after a complete sync"
+    fi
+}
+
+test_sync_resume()
+{
+    local checkpoint="$(mktemp)"
+    trap -- "rm -f '$checkpoint'" RETURN
+
+    mkdir "done" "todo"
+    touch "done/fileA" "todo/fileB"
+
+    cat > "$checkpoint" << EOF
+source rbh:posix:.
+generation 0
+frontier /
+done /done
+EOF
+
+    rbh_sync --checkpoint "$checkpoint" --resume "rbh:posix:." \
+        "rbh:mongo:$testdb"
+
+    find_attribute '"ns.xattrs.path":"/todo/fileB"'
+
+    local count=$(count_entries '"ns.name":{$in:["done", "fileA"]}')
+    if [[ $count -ne 0 ]]; then
+        error "A subtree completed before resuming was synchronized again"
+    fi
+}
+
+test_sync_resume_other_source()
+{
+    local checkpoint="$(mktemp)"
+    trap -- "rm -f '$checkpoint'" RETURN
+
+    echo "source rbh:posix:/elsewhere" > "$checkpoint"
+
+    ! rbh_sync --checkpoint "$checkpoint" --resume "rbh:posix:." \
+        "rbh:mongo:$testdb"
+}
+
+count_queue()
+{
+    mongo $testdb --eval "db.getCollection('queue.$1').count({$2})"
+}
+
+test_sync_queue()
+{
+    mkdir -p "tree/dirA/subdir" "tree/dirB" "tree/dirC"
+    touch "tree/fileA" "tree/dirA/fileB" "tree/dirA/subdir/fileC" \
+          "tree/dirB/fileD"
+
+    rbh_sync --queue "scan" "rbh:posix:tree" "rbh:mongo:$testdb" &
+    rbh_sync --queue "scan" "rbh:posix:tree" "rbh:mongo:$testdb" &
+    rbh_sync --queue "scan" "rbh:posix:tree" "rbh:mongo:$testdb"
+    wait
+
+    find_attribute '"ns.xattrs.path":"/"'
+    find_attribute '"ns.xattrs.path":"/fileA"'
+    find_attribute '"ns.xattrs.path":"/dirA/fileB"'
+    find_attribute '"ns.xattrs.path":"/dirA/subdir/fileC"'
+    find_attribute '"ns.xattrs.path":"/dirB/fileD"'
+    find_attribute '"ns.xattrs.path":"/dirC"'
+
+    local count=$(count_queue "scan" '"state":{$ne:2}')
+    if [[ $count -ne 0 ]]; then
+        error "$count items of the work queue were not processed"
+    fi
+}
+
+test_sync_queue_expired_lease()
+{
+    mkdir -p "tree/dirA"
+    touch "tree/dirA/fileA"
+
+    # A worker leased the root then died
+    mongo $testdb --eval "db.getCollection('queue.scan').insert({
+                              _id: '/', state: 1, owner: 'dead',
+                              expires: new Date(0), attempts: 1})"
+
+    rbh_sync --queue "scan" "rbh:posix:tree" "rbh:mongo:$testdb"
+
+    find_attribute '"ns.xattrs.path":"/dirA/fileA"'
+}
+
+test_sync_queue_abandoned()
+{
+    mkdir -p "tree/dirA" "tree/dirB"
+    touch "tree/dirA/fileA" "tree/dirB/fileB"
+
+    # Workers died on dirA as many times as the queue allows
+    mongo $testdb --eval "db.getCollection('queue.scan').insert({
+                              _id: '/dirA', state: 1, owner: 'dead',
+                              expires: new Date(0), attempts: 3})"
+
+    local output
+    local rc=0
+    output="$(rbh_sync --queue "scan" "rbh:posix:tree" "rbh:mongo:$testdb" \
+                  2>&1)" || rc=$?
+
+    if [[ $rc -ne 70 ]]; then
+        error "a worker that gave up on an item exited with status $rc"
+    fi
+
+    echo "$output" | grep "'/dirA'" ||
+        error "the item that was given up on was not reported"
+
+    find_attribute '"ns.xattrs.path":"/dirB/fileB"'
+
+    local count=$(mongo $testdb --eval \
+                      'db.entries.count({"ns.xattrs.path":"/dirA/fileA"})')
+    if [[ $count -ne 0 ]]; then
+        error "an item that was given up on was synced"
+    fi
+}
+
+test_sync_queue_branch()
+{
+    mkdir "dir"
+
+    ! rbh_sync --queue "scan" "rbh:posix:.#dir" "rbh:mongo:$testdb"
+}
+
+test_sync_queue_stats()
+{
+    mkdir -p "tree/dirA/subdir" "tree/dirB"
+    touch "tree/fileA" "tree/dirA/fileB" "tree/dirB/fileC"
+
+    RBH_STATS=1 rbh_sync --queue "scan" "rbh:posix:tree" "rbh:mongo:$testdb" \
+        2> "report"
+
+    # Items are branches of SOURCE, accounted for in a single report
+    local count=$(grep -cxF "rbh:posix:tree:" "report")
+    if [[ $count -ne 1 ]]; then
+        error "expected 1 report for SOURCE, found '$count'"
+    fi
+
+    count=$(grep -cxF "rbh:mongo:$testdb:" "report")
+    if [[ $count -ne 1 ]]; then
+        error "expected 1 report for DEST, found '$count'"
+    fi
+
+    # dirA, dirA/subdir and dirB
+    grep -qE "^  branch +3 " "report" ||
+        error "branches of SOURCE were not accounted for"
+}
+
+test_sync_throttle()
+{
+    touch "fileA" "fileB" "fileC" "fileD" "fileE"
+
+    local start=$SECONDS
+    rbh_sync --throttle 2 "rbh:posix:." "rbh:mongo:$testdb"
+
+    # 6 entries at 2 entries per second
+    if (( SECONDS - start < 2 )); then
+        error "Sync was not throttled"
+    fi
+
+    find_attribute '"ns.xattrs.path":"/fileE"'
+}
+
+test_sync_adaptive_throttle()
+{
+    mkdir "dir"
+    touch "dir/fileA" "dir/fileB"
+
+    # No filesystem answers in less than a microsecond, back off right away
+    rbh_sync --adaptive 1 "rbh:posix:." "rbh:mongo:$testdb"
+
+    find_attribute '"ns.xattrs.path":"/dir/fileB"'
+}
+
+test_sync_hardlinks()
+{
+    mkdir "dir"
+    truncate -s 1k "fileA"
+    setfattr -n user.a -v b "fileA"
+    ln "fileA" "fileB"
+    ln "fileA" "dir/fileC"
+
+    rbh_sync "rbh:posix:." "rbh:mongo:$testdb"
+
+    # A single entry, linked under all three names
+    find_attribute \
+        '"ns.xattrs.path":{$all:["/fileA", "/fileB", "/dir/fileC"]}' \
+        '"statx.nlink":3' '"statx.size":1024' '"xattrs.user.a":{$exists:true}'
+}
+
+test_sync_exclude()
+{
+    mkdir -p "dir/.snapshot" "jobs/42" "jobs/logs"
+    touch "dir/.snapshot/fileA" "jobs/42/fileB" "jobs/logs/fileC"
+
+    rbh_sync --exclude .snapshot --exclude 'regex:^/jobs/[0-9]+$' \
+        "rbh:posix:." "rbh:mongo:$testdb"
+
+    find_attribute '"ns.xattrs.path":"/dir"'
+    find_attribute '"ns.xattrs.path":"/jobs/logs/fileC"'
+
+    # /, /dir, /jobs, /jobs/logs and /jobs/logs/fileC
+    local db_count=$(mongo $testdb --eval "db.entries.count()")
+    if [[ $db_count -ne 5 ]]; then
+        error "Excluded entries were synced, expected '5' entries, " \
+              "found '$db_count'."
+    fi
+}
+
+test_sync_max_depth()
+{
+    mkdir -p "dir/subdir"
+    touch "dir/fileA" "dir/subdir/fileB"
+
+    rbh_sync --max-depth 1 "rbh:posix:." "rbh:mongo:$testdb"
+
+    find_attribute '"ns.xattrs.path":"/dir"'
+
+    local db_count=$(mongo $testdb --eval "db.entries.count()")
+    if [[ $db_count -ne 2 ]]; then
+        error "Entries below the maximum depth were synced, expected '2' " \
+              "entries, found '$db_count'."
+    fi
+}
+
 ################################################################################
 #                                     MAIN                                     #
 ################################################################################
@@ -291,7 +626,15 @@ declare -a tests=(test_sync_2_files test_sync_size test_sync_3_files
                   test_sync_one_one_file test_sync_one_two_files
                   test_sync_symbolic_link test_sync_socket test_sync_fifo
                   test_sync_branch test_continue_sync_on_error
-                  test_stop_sync_on_error )
+                  test_stop_sync_on_error test_sync_sweep
+                  test_sync_sweep_on_error
+                  test_sync_sweep_same_second test_sync_branch_sweep test_sync_sweep_one
+                  test_sync_checkpoint test_sync_resume
+                  test_sync_resume_other_source test_sync_queue
+                  test_sync_queue_expired_lease test_sync_queue_abandoned
+                  test_sync_queue_branch test_sync_queue_stats
+                  test_sync_throttle test_sync_adaptive_throttle
+                  test_sync_hardlinks test_sync_exclude test_sync_max_depth)
 
 tmpdir=$(mktemp --directory)
 trap -- "rm -rf '$tmpdir'" EXIT